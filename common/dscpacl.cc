@@ -0,0 +1,425 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Access policy for the admission of associations
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpacl.h"
+#include "dscpcond.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#define INCLUDE_CSTDLIB
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+END_EXTERN_C
+
+// initial number of slots of an AE title set (a power of two)
+#define SCP_ACL_INITIAL_SLOTS 16
+
+// length of an address in bits
+#define SCP_ACL_ADDRESS_BITS (SCP_ACL_ADDRESS_LENGTH * 8)
+
+// length of the prefix of IPv4-mapped IPv6 addresses in bits
+#define SCP_ACL_IPV4_PREFIX_BITS 96
+
+// minimum interval in seconds between two checks of the policy file for modifications
+#define SCP_ACL_CHECK_INTERVAL 1
+
+// maximum length of a line of the policy file
+#define SCP_ACL_MAX_LINE 1024
+
+
+// helper functions for the access policy
+
+static Uint32 hashAETitle(const OFString &aeTitle)
+{
+  // FNV-1a
+  Uint32 hash = 2166136261UL;
+  for (size_t i = 0; i < aeTitle.length(); ++i)
+  {
+    hash ^= OFstatic_cast(Uint8, aeTitle[i]);
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+
+static unsigned int getBit(const Uint8 *address, const unsigned int index)
+{
+  return (address[index >> 3] >> (7 - (index & 7))) & 1;
+}
+
+
+static unsigned int commonPrefixLength(const Uint8 *address1, const Uint8 *address2, const unsigned int maxLength)
+{
+  unsigned int length = 0;
+  // compare whole bytes first
+  while ((length + 8 <= maxLength) && (address1[length >> 3] == address2[length >> 3]))
+    length += 8;
+  while ((length < maxLength) && (getBit(address1, length) == getBit(address2, length)))
+    ++length;
+  return length;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmAETitleSet::DcmAETitleSet()
+  : m_slots(SCP_ACL_INITIAL_SLOTS)
+  , m_count(0)
+{
+}
+
+
+void DcmAETitleSet::add(const OFString &aeTitle)
+{
+  const OFString key = trim(aeTitle);
+  if (key.empty() || !m_slots[findSlot(key)].empty())
+    return;
+  // keep at least half of the slots free, so that probe sequences stay short
+  if (2 * (m_count + 1) > m_slots.size())
+  {
+    OFVector<OFString> slots(2 * m_slots.size());
+    slots.swap(m_slots);
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+      if (!slots[i].empty())
+        m_slots[findSlot(slots[i])] = slots[i];
+    }
+  }
+  m_slots[findSlot(key)] = key;
+  ++m_count;
+}
+
+
+OFBool DcmAETitleSet::contains(const OFString &aeTitle) const
+{
+  const OFString key = trim(aeTitle);
+  return !key.empty() && !m_slots[findSlot(key)].empty();
+}
+
+
+OFBool DcmAETitleSet::empty() const
+{
+  return m_count == 0;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t DcmAETitleSet::findSlot(const OFString &aeTitle) const
+{
+  // linear probing, there is always a free slot
+  const size_t mask = m_slots.size() - 1;
+  size_t index = hashAETitle(aeTitle) & mask;
+  while (!m_slots[index].empty() && (m_slots[index] != aeTitle))
+    index = (index + 1) & mask;
+  return index;
+}
+
+
+OFString DcmAETitleSet::trim(const OFString &aeTitle)
+{
+  const size_t first = aeTitle.find_first_not_of(' ');
+  if (first == OFString_npos)
+    return OFString();
+  const size_t last = aeTitle.find_last_not_of(' ');
+  return aeTitle.substr(first, last - first + 1);
+}
+
+// ----------------------------------------------------------------------------
+
+DcmAddressTrie::DcmAddressTrie()
+  : m_root(NULL)
+{
+}
+
+
+DcmAddressTrie::~DcmAddressTrie()
+{
+  deleteNode(m_root);
+}
+
+
+OFBool DcmAddressTrie::add(const OFString &network)
+{
+  // split the prefix length from the address
+  OFString address = network;
+  unsigned int length = SCP_ACL_ADDRESS_BITS;
+  int prefixLength = -1;
+  const size_t slash = network.find('/');
+  if (slash != OFString_npos)
+  {
+    address = network.substr(0, slash);
+    const OFString lengthString = network.substr(slash + 1);
+    if (lengthString.empty() || (lengthString.find_first_not_of("0123456789") != OFString_npos) ||
+        (lengthString.length() > 3))
+      return OFFalse;
+    prefixLength = atoi(lengthString.c_str());
+  }
+  Uint8 prefix[SCP_ACL_ADDRESS_LENGTH];
+  OFBool isIPv4 = OFFalse;
+  if (!parseAddress(address, prefix, isIPv4))
+    return OFFalse;
+  if (prefixLength >= 0)
+  {
+    if (prefixLength > (isIPv4 ? 32 : SCP_ACL_ADDRESS_BITS))
+      return OFFalse;
+    length = OFstatic_cast(unsigned int, prefixLength) + (isIPv4 ? SCP_ACL_IPV4_PREFIX_BITS : 0);
+  }
+
+  // walk down as long as the nodes are prefixes of the network
+  Node **link = &m_root;
+  while (*link != NULL)
+  {
+    Node *node = *link;
+    const unsigned int common = commonPrefixLength(node->prefix, prefix, (node->length < length) ? node->length : length);
+    if (common < node->length)
+    {
+      // the network branches off within the prefix of the node: split it
+      Node *inner = createNode(prefix, common, common == length);
+      inner->child[getBit(node->prefix, common)] = node;
+      if (common < length)
+        inner->child[getBit(prefix, common)] = createNode(prefix, length, OFTrue);
+      *link = inner;
+      return OFTrue;
+    }
+    if (node->length == length)
+    {
+      node->network = OFTrue;
+      return OFTrue;
+    }
+    link = &node->child[getBit(prefix, node->length)];
+  }
+  *link = createNode(prefix, length, OFTrue);
+  return OFTrue;
+}
+
+
+OFBool DcmAddressTrie::contains(const OFString &address) const
+{
+  Uint8 key[SCP_ACL_ADDRESS_LENGTH];
+  OFBool isIPv4 = OFFalse;
+  if (!parseAddress(address, key, isIPv4))
+    return OFFalse;
+  const Node *node = m_root;
+  while (node != NULL)
+  {
+    if (commonPrefixLength(node->prefix, key, node->length) < node->length)
+      return OFFalse;
+    if (node->network)
+      return OFTrue;
+    if (node->length >= SCP_ACL_ADDRESS_BITS)
+      return OFFalse;
+    node = node->child[getBit(key, node->length)];
+  }
+  return OFFalse;
+}
+
+
+OFBool DcmAddressTrie::empty() const
+{
+  return m_root == NULL;
+}
+
+// ----------------------------------------------------------------------------
+
+OFBool DcmAddressTrie::parseAddress(const OFString &address,
+                                    Uint8 *result,
+                                    OFBool &isIPv4)
+{
+  struct in_addr ipv4;
+  if (inet_pton(AF_INET, address.c_str(), &ipv4) == 1)
+  {
+    // IPv4-mapped IPv6 address ::ffff:a.b.c.d
+    memset(result, 0, SCP_ACL_ADDRESS_LENGTH);
+    result[10] = 0xff;
+    result[11] = 0xff;
+    memcpy(result + 12, &ipv4.s_addr, 4);
+    isIPv4 = OFTrue;
+    return OFTrue;
+  }
+  struct in6_addr ipv6;
+  if (inet_pton(AF_INET6, address.c_str(), &ipv6) == 1)
+  {
+    memcpy(result, ipv6.s6_addr, SCP_ACL_ADDRESS_LENGTH);
+    isIPv4 = OFFalse;
+    return OFTrue;
+  }
+  return OFFalse;
+}
+
+
+DcmAddressTrie::Node *DcmAddressTrie::createNode(const Uint8 *address,
+                                                 const unsigned int length,
+                                                 const OFBool network)
+{
+  Node *node = new Node();
+  memset(node->prefix, 0, SCP_ACL_ADDRESS_LENGTH);
+  memcpy(node->prefix, address, length >> 3);
+  if (length & 7)
+    node->prefix[length >> 3] = OFstatic_cast(Uint8, address[length >> 3] & (0xff << (8 - (length & 7))));
+  node->length = length;
+  node->network = network;
+  node->child[0] = NULL;
+  node->child[1] = NULL;
+  return node;
+}
+
+
+void DcmAddressTrie::deleteNode(Node *node)
+{
+  if (node != NULL)
+  {
+    deleteNode(node->child[0]);
+    deleteNode(node->child[1]);
+    delete node;
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+DcmAccessPolicy::DcmAccessPolicy()
+  : m_filename()
+  , m_modified(0)
+  , m_lastCheck(0)
+  , m_rules(NULL)
+{
+}
+
+
+DcmAccessPolicy::~DcmAccessPolicy()
+{
+  delete m_rules;
+}
+
+
+OFCondition DcmAccessPolicy::load(const OFString &filename)
+{
+  m_filename = filename;
+  struct stat info;
+  if (stat(m_filename.c_str(), &info) != 0)
+  {
+    char buf[256];
+    DCMNET_ERROR("Cannot access policy file " << m_filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return SCP_EC_InvalidAccessPolicy;
+  }
+  Rules *rules = new Rules();
+  OFCondition cond = readFile(*rules);
+  if (cond.bad())
+  {
+    delete rules;
+    return cond;
+  }
+  delete m_rules;
+  m_rules = rules;
+  m_modified = info.st_mtime;
+  m_lastCheck = time(NULL);
+  DCMNET_DEBUG("Access policy loaded from " << m_filename);
+  return EC_Normal;
+}
+
+
+void DcmAccessPolicy::update(const time_t now)
+{
+  if (m_filename.empty() || ((now >= m_lastCheck) && (now - m_lastCheck < SCP_ACL_CHECK_INTERVAL)))
+    return;
+  m_lastCheck = now;
+  struct stat info;
+  if ((stat(m_filename.c_str(), &info) != 0) || (info.st_mtime == m_modified))
+    return;
+  // remember the modification time even if the file is invalid, so that it is not
+  // parsed again and again until it is fixed
+  m_modified = info.st_mtime;
+  Rules *rules = new Rules();
+  if (readFile(*rules).bad())
+  {
+    DCMNET_WARN("Access policy file " << m_filename << " is invalid, keeping the current policy");
+    delete rules;
+    return;
+  }
+  delete m_rules;
+  m_rules = rules;
+  DCMNET_INFO("Access policy reloaded from " << m_filename);
+}
+
+
+OFBool DcmAccessPolicy::isCallingAETitleAllowed(const OFString &aeTitle) const
+{
+  return (m_rules == NULL) || m_rules->callingAETitles.empty() || m_rules->callingAETitles.contains(aeTitle);
+}
+
+
+OFBool DcmAccessPolicy::isCalledAETitleAllowed(const OFString &aeTitle) const
+{
+  return (m_rules == NULL) || m_rules->calledAETitles.empty() || m_rules->calledAETitles.contains(aeTitle);
+}
+
+
+OFBool DcmAccessPolicy::isHostAllowed(const OFString &address) const
+{
+  return (m_rules == NULL) || m_rules->hosts.empty() || m_rules->hosts.contains(address);
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmAccessPolicy::readFile(Rules &rules) const
+{
+  FILE *file = fopen(m_filename.c_str(), "r");
+  if (file == NULL)
+  {
+    char buf[256];
+    DCMNET_ERROR("Cannot open access policy file " << m_filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return SCP_EC_InvalidAccessPolicy;
+  }
+  OFCondition cond = EC_Normal;
+  char line[SCP_ACL_MAX_LINE];
+  unsigned long lineNumber = 0;
+  while (cond.good() && (fgets(line, sizeof(line), file) != NULL))
+  {
+    ++lineNumber;
+    // split the line into keyword and value, ignoring surrounding whitespace
+    OFString text(line);
+    const size_t end = text.find_last_not_of(" \t\r\n");
+    text = (end == OFString_npos) ? OFString() : text.substr(0, end + 1);
+    const size_t begin = text.find_first_not_of(" \t");
+    if ((begin == OFString_npos) || (text[begin] == '#'))
+      continue;
+    const size_t separator = text.find_first_of(" \t", begin);
+    const OFString keyword = text.substr(begin, (separator == OFString_npos) ? OFString_npos : separator - begin);
+    OFString value;
+    if (separator != OFString_npos)
+      value = text.substr(text.find_first_not_of(" \t", separator));
+
+    if (value.empty())
+      cond = SCP_EC_InvalidAccessPolicy;
+    else if (keyword == "calling")
+      rules.callingAETitles.add(value);
+    else if (keyword == "called")
+      rules.calledAETitles.add(value);
+    else if (keyword == "host")
+    {
+      if (!rules.hosts.add(value))
+        cond = SCP_EC_InvalidAccessPolicy;
+    }
+    else
+      cond = SCP_EC_InvalidAccessPolicy;
+    if (cond.bad())
+      DCMNET_ERROR("Invalid rule in access policy file " << m_filename << ", line " << lineNumber << ": " << text);
+  }
+  fclose(file);
+  return cond;
+}
@@ -0,0 +1,266 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Access policy for the admission of associations
+ *
+ */
+
+#ifndef DSCPACL_H
+#define DSCPACL_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofvector.h"
+
+#define INCLUDE_CTIME
+#include "dcmtk/ofstd/ofstdinc.h"
+
+/// length of an address in the access policy (IPv6, IPv4 as IPv4-mapped IPv6 address)
+#define SCP_ACL_ADDRESS_LENGTH 16
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Set of AE titles, stored in an open addressing hash table
+ */
+class DcmAETitleSet
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmAETitleSet();
+
+    /** Add an AE title
+     *  @param aeTitle [in] The AE title (leading and trailing spaces are ignored)
+     */
+    void add(const OFString &aeTitle);
+
+    /** Check whether an AE title is in the set
+     *  @param aeTitle [in] The AE title (leading and trailing spaces are ignored)
+     *  @return OFTrue if the AE title is in the set, OFFalse otherwise
+     */
+    OFBool contains(const OFString &aeTitle) const;
+
+    /** Returns whether the set is empty
+     *  @return OFTrue if the set is empty, OFFalse otherwise
+     */
+    OFBool empty() const;
+
+  private:
+
+    /** Find the slot of an AE title, i.e.\ the slot holding it or the empty slot it
+     *  would be stored in
+     *  @param aeTitle [in] The AE title without leading and trailing spaces
+     *  @return Index of the slot
+     */
+    size_t findSlot(const OFString &aeTitle) const;
+
+    /** Remove leading and trailing spaces
+     *  @param aeTitle [in] The AE title
+     *  @return The AE title without leading and trailing spaces
+     */
+    static OFString trim(const OFString &aeTitle);
+
+    /// the slots (a power of two, at most half of them used), empty string if unused
+    OFVector<OFString> m_slots;
+
+    /// number of AE titles in the set
+    size_t m_count;
+
+};
+
+
+/** Set of IPv4 and IPv6 networks (CIDR notation), stored in a compressed prefix trie.
+ *  IPv4 addresses are stored as IPv4-mapped IPv6 addresses, so a single trie covers
+ *  both. Looking up an address takes at most one step per node on its path, i.e.\
+ *  never more than the number of networks added.
+ */
+class DcmAddressTrie
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmAddressTrie();
+
+    /** destructor
+     */
+    ~DcmAddressTrie();
+
+    /** Add a network
+     *  @param network [in] The network in CIDR notation (e.g.\ "10.1.0.0/16" or
+     *                      "2001:db8::/32"), or a single address
+     *  @return OFTrue if successful, OFFalse if the network is invalid
+     */
+    OFBool add(const OFString &network);
+
+    /** Check whether an address belongs to one of the networks
+     *  @param address [in] The numeric IPv4 or IPv6 address
+     *  @return OFTrue if the address belongs to a network, OFFalse otherwise (also if
+     *          the address is not a numeric address)
+     */
+    OFBool contains(const OFString &address) const;
+
+    /** Returns whether no network has been added
+     *  @return OFTrue if the trie is empty, OFFalse otherwise
+     */
+    OFBool empty() const;
+
+  private:
+
+    /** Node of the trie, representing a prefix of the addresses below
+     */
+    struct Node
+    {
+      /// the prefix, bits beyond its length are zero
+      Uint8 prefix[SCP_ACL_ADDRESS_LENGTH];
+      /// length of the prefix in bits
+      unsigned int length;
+      /// OFTrue if the prefix is one of the networks
+      OFBool network;
+      /// subtrees for the next bit being 0 or 1
+      Node *child[2];
+    };
+
+    /** Parse a numeric address
+     *  @param address [in]  The IPv4 or IPv6 address
+     *  @param result  [out] The address as IPv6 address
+     *  @param isIPv4  [out] OFTrue if it is an IPv4 address
+     *  @return OFTrue if successful, OFFalse otherwise
+     */
+    static OFBool parseAddress(const OFString &address,
+                               Uint8 *result,
+                               OFBool &isIPv4);
+
+    /** Create a node
+     *  @param address [in] The address the prefix is taken from
+     *  @param length  [in] Length of the prefix in bits
+     *  @param network [in] OFTrue if the prefix is one of the networks
+     *  @return The node
+     */
+    static Node *createNode(const Uint8 *address,
+                            const unsigned int length,
+                            const OFBool network);
+
+    /** Delete a subtree
+     *  @param node [in] The root of the subtree, may be NULL
+     */
+    static void deleteNode(Node *node);
+
+    /// the root of the trie, NULL if empty
+    Node *m_root;
+
+    // private undefined copy constructor
+    DcmAddressTrie(const DcmAddressTrie &);
+
+    // private undefined assignment operator
+    DcmAddressTrie &operator=(const DcmAddressTrie &);
+
+};
+
+
+/** Access policy deciding which peers may open associations, based on the calling AE
+ *  title, the called AE title and the address of the peer. The policy is read from a
+ *  text file with one rule per line:
+ *  <pre>
+ *    calling &lt;AE title&gt;     allow this calling AE title
+ *    called  &lt;AE title&gt;     allow this called AE title
+ *    host    &lt;network&gt;      allow peers in this network (CIDR notation) or with
+ *                            this address
+ *  </pre>
+ *  Empty lines and lines starting with '#' are ignored. If there is no rule of a kind,
+ *  that criterion is not checked. The file is checked for modifications by update()
+ *  and reloaded if changed; a file that cannot be read or parsed leaves the current
+ *  policy in effect.
+ */
+class DcmAccessPolicy
+{
+
+  public:
+
+    /** default constructor. Without a file, all peers are allowed.
+     */
+    DcmAccessPolicy();
+
+    /** destructor
+     */
+    ~DcmAccessPolicy();
+
+    /** Load the policy from a file, which is then watched for modifications
+     *  @param filename [in] The name of the file
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition load(const OFString &filename);
+
+    /** Reload the policy if the file has been modified. The file is checked at most
+     *  once per second.
+     *  @param now [in] The current time
+     */
+    void update(const time_t now);
+
+    /** Check whether a calling AE title is allowed
+     *  @param aeTitle [in] The calling AE title
+     *  @return OFTrue if allowed, OFFalse otherwise
+     */
+    OFBool isCallingAETitleAllowed(const OFString &aeTitle) const;
+
+    /** Check whether a called AE title is allowed
+     *  @param aeTitle [in] The called AE title
+     *  @return OFTrue if allowed, OFFalse otherwise
+     */
+    OFBool isCalledAETitleAllowed(const OFString &aeTitle) const;
+
+    /** Check whether a peer address is allowed
+     *  @param address [in] The numeric IPv4 or IPv6 address of the peer
+     *  @return OFTrue if allowed, OFFalse otherwise
+     */
+    OFBool isHostAllowed(const OFString &address) const;
+
+  private:
+
+    /** The rules of a policy file
+     */
+    struct Rules
+    {
+      /// allowed calling AE titles
+      DcmAETitleSet callingAETitles;
+      /// allowed called AE titles
+      DcmAETitleSet calledAETitles;
+      /// allowed networks
+      DcmAddressTrie hosts;
+    };
+
+    /** Read and parse the policy file
+     *  @param rules [out] The rules read
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition readFile(Rules &rules) const;
+
+    /// name of the policy file, empty if none
+    OFString m_filename;
+
+    /// modification time of the file the current rules have been read from
+    time_t m_modified;
+
+    /// time of the last check for modifications
+    time_t m_lastCheck;
+
+    /// the current rules, NULL if no policy is loaded
+    Rules *m_rules;
+
+    // private undefined copy constructor
+    DcmAccessPolicy(const DcmAccessPolicy &);
+
+    // private undefined assignment operator
+    DcmAccessPolicy &operator=(const DcmAccessPolicy &);
+
+};
+
+#endif // DSCPACL_H
@@ -0,0 +1,200 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Log appender writing log output in a background thread
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpalog.h"
+#include "dcmtk/ofstd/ofstd.h"
+
+#define INCLUDE_CSTDIO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+using dcmtk::log4cplus::Logger;
+using dcmtk::log4cplus::SharedAppenderPtr;
+using dcmtk::log4cplus::SharedAppenderPtrList;
+using dcmtk::log4cplus::spi::InternalLoggingEvent;
+
+
+// make the stores before the barrier visible to the other thread before the stores
+// after the barrier (and likewise for loads)
+static inline void memoryBarrier()
+{
+  __sync_synchronize();
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmAsyncLogAppender::install(const size_t capacity,
+                                         const DcmAsyncLogOverflow overflow)
+{
+  Logger root = Logger::getRoot();
+  if (root.getAppender(SCP_ALOG_APPENDER_NAME).get() != NULL)
+    return EC_Normal;
+  const SharedAppenderPtrList targets = root.getAllAppenders();
+  if (targets.empty())
+    return EC_Normal;
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  DcmAsyncLogAppender *appender = new DcmAsyncLogAppender(targets, size, overflow);
+  // the shared pointer deletes the appender if it cannot be started
+  SharedAppenderPtr ptr(appender);
+  if (appender->start() != 0)
+    return EC_IllegalCall;
+  appender->m_running = OFTrue;
+  root.removeAllAppenders();
+  root.addAppender(ptr);
+  return EC_Normal;
+}
+
+
+void DcmAsyncLogAppender::uninstall()
+{
+  Logger root = Logger::getRoot();
+  SharedAppenderPtr ptr = root.getAppender(SCP_ALOG_APPENDER_NAME);
+  DcmAsyncLogAppender *appender = OFdynamic_cast(DcmAsyncLogAppender *, ptr.get());
+  if (appender == NULL)
+    return;
+  // nobody appends to it any more once it is removed from the logger
+  root.removeAppender(ptr);
+  appender->close();
+  for (size_t i = 0; i < appender->m_targets.size(); ++i)
+    root.addAppender(appender->m_targets[i]);
+}
+
+// ----------------------------------------------------------------------------
+
+DcmAsyncLogAppender::DcmAsyncLogAppender(const SharedAppenderPtrList &targets,
+                                         const size_t capacity,
+                                         const DcmAsyncLogOverflow overflow)
+  : Appender()
+  , OFThread()
+  , m_targets(targets)
+  , m_ring(capacity)
+  , m_mask(capacity - 1)
+  , m_overflow(overflow)
+  , m_head(0)
+  , m_tail(0)
+  , m_dropped(0)
+  , m_droppedReported(0)
+  , m_sleeping(0)
+  , m_stop(0)
+  , m_running(OFFalse)
+  , m_semaphore(0)
+{
+  setName(SCP_ALOG_APPENDER_NAME);
+}
+
+
+DcmAsyncLogAppender::~DcmAsyncLogAppender()
+{
+  destructorImpl();
+}
+
+
+void DcmAsyncLogAppender::close()
+{
+  if (m_running)
+  {
+    // the thread writes all buffered records before it stops
+    m_stop = 1;
+    memoryBarrier();
+    m_semaphore.post();
+    join();
+    m_running = OFFalse;
+  }
+  closed = true;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmAsyncLogAppender::append(const InternalLoggingEvent &event)
+{
+  const size_t head = m_head;
+  while (head - m_tail > m_mask)
+  {
+    if ((m_overflow == SCP_LO_Drop) || !m_running)
+    {
+      ++m_dropped;
+      return;
+    }
+    // the thread releases the slots as soon as its current batch is written
+    OFStandard::milliSleep(1);
+  }
+  // do not overwrite the slot before the thread is done with it
+  memoryBarrier();
+  InternalLoggingEvent &slot = m_ring[head & m_mask];
+  slot = event;
+  // the name of the thread and its NDC are only known in this thread
+  slot.gatherThreadSpecificData();
+  memoryBarrier();
+  m_head = head + 1;
+  memoryBarrier();
+  if (m_sleeping)
+  {
+    m_sleeping = 0;
+    m_semaphore.post();
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmAsyncLogAppender::run()
+{
+  for (;;)
+  {
+    const size_t head = m_head;
+    memoryBarrier();
+    size_t tail = m_tail;
+    if (tail == head)
+    {
+      if (m_stop)
+        break;
+      // announce that we are going to sleep, then check again for a record added
+      // before the producer could see the announcement
+      m_sleeping = 1;
+      memoryBarrier();
+      if ((m_head == tail) && !m_stop)
+        m_semaphore.wait();
+      m_sleeping = 0;
+      continue;
+    }
+    // write all records available, then release their slots at once
+    while (tail != head)
+    {
+      write(m_ring[tail & m_mask]);
+      ++tail;
+    }
+    memoryBarrier();
+    m_tail = tail;
+    reportDropped();
+  }
+  reportDropped();
+}
+
+
+void DcmAsyncLogAppender::write(const InternalLoggingEvent &event)
+{
+  for (size_t i = 0; i < m_targets.size(); ++i)
+    m_targets[i]->doAppend(event);
+}
+
+
+void DcmAsyncLogAppender::reportDropped()
+{
+  const size_t dropped = m_dropped;
+  if (dropped == m_droppedReported)
+    return;
+  char message[100];
+  sprintf(message, "Log buffer full, dropped %lu log record(s)",
+    OFstatic_cast(unsigned long, dropped - m_droppedReported));
+  const InternalLoggingEvent event("dcmtk.dcmnet", dcmtk::log4cplus::WARN_LOG_LEVEL, message, __FILE__, __LINE__);
+  write(event);
+  m_droppedReported = dropped;
+}
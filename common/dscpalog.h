@@ -0,0 +1,153 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Log appender writing log output in a background thread
+ *
+ */
+
+#ifndef DSCPALOG_H
+#define DSCPALOG_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofvector.h"
+#include "dcmtk/ofstd/ofthread.h"
+#include "dcmtk/oflog/oflog.h"
+#include "dcmtk/oflog/appender.h"
+#include "dcmtk/oflog/logger.h"
+#include "dcmtk/oflog/spi/logevent.h"
+
+/// default number of log records buffered
+#define SCP_ALOG_DEFAULT_CAPACITY 8192
+
+/// name of the appender attached to the root logger
+#define SCP_ALOG_APPENDER_NAME "async"
+
+/** What to do with a log record if the buffer is full
+ */
+enum DcmAsyncLogOverflow
+{
+  /// drop the record and count it, the number is logged once there is space again
+  SCP_LO_Drop = 1,
+  /// wait until the background thread has written enough records
+  SCP_LO_Block = 2
+};
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Appender decoupling the threads producing log output from the appenders actually
+ *  writing it. A log record is only copied into a ring buffer, a background thread
+ *  takes the records out in batches and passes them to the appenders previously
+ *  attached to the root logger, so formatting and writing (and a stalled disk) never
+ *  delay the thread that logged. oflog already serializes all calls of an appender,
+ *  so the ring has exactly one producer and one consumer at any time and needs no
+ *  lock between them.
+ */
+class DcmAsyncLogAppender : public dcmtk::log4cplus::Appender, public OFThread
+{
+
+  public:
+
+    /** Move the appenders of the root logger behind a new asynchronous appender and
+     *  start its thread. Should be called after the logger has been configured.
+     *  @param capacity [in] Number of records buffered (rounded up to a power of 2)
+     *  @param overflow [in] What to do if the buffer is full
+     *  @return EC_Normal if successful (or the root logger has no appenders), an
+     *          error code otherwise
+     */
+    static OFCondition install(const size_t capacity = SCP_ALOG_DEFAULT_CAPACITY,
+                               const DcmAsyncLogOverflow overflow = SCP_LO_Drop);
+
+    /** Write all buffered records, stop the thread and attach the original appenders
+     *  to the root logger again. Does nothing if not installed.
+     */
+    static void uninstall();
+
+    /** destructor
+     */
+    virtual ~DcmAsyncLogAppender();
+
+    /** Write all buffered records and stop the thread
+     */
+    virtual void close();
+
+  protected:
+
+    /** Copy a record into the ring buffer
+     *  @param event [in] The log record
+     */
+    virtual void append(const dcmtk::log4cplus::spi::InternalLoggingEvent &event);
+
+    /** Write the buffered records until closed
+     */
+    virtual void run();
+
+  private:
+
+    /** constructor
+     *  @param targets  [in] Appenders the records are written to
+     *  @param capacity [in] Number of records buffered (a power of 2)
+     *  @param overflow [in] What to do if the buffer is full
+     */
+    DcmAsyncLogAppender(const dcmtk::log4cplus::SharedAppenderPtrList &targets,
+                        const size_t capacity,
+                        const DcmAsyncLogOverflow overflow);
+
+    /** Pass a record to all target appenders
+     *  @param event [in] The log record
+     */
+    void write(const dcmtk::log4cplus::spi::InternalLoggingEvent &event);
+
+    /** Log the number of records dropped since the last report (if any)
+     */
+    void reportDropped();
+
+    /// appenders the records are written to
+    dcmtk::log4cplus::SharedAppenderPtrList m_targets;
+
+    /// the ring buffer
+    OFVector<dcmtk::log4cplus::spi::InternalLoggingEvent> m_ring;
+
+    /// capacity of the ring minus 1, for computing the index of a slot
+    size_t m_mask;
+
+    /// what to do if the buffer is full
+    DcmAsyncLogOverflow m_overflow;
+
+    /// number of records added, only changed by the producer
+    volatile size_t m_head;
+
+    /// number of records written, only changed by the background thread
+    volatile size_t m_tail;
+
+    /// number of records dropped because the buffer was full
+    volatile size_t m_dropped;
+
+    /// number of dropped records already reported
+    size_t m_droppedReported;
+
+    /// flag indicating that the background thread waits for records
+    volatile int m_sleeping;
+
+    /// flag indicating that the background thread should stop
+    volatile int m_stop;
+
+    /// flag indicating that the background thread is running
+    OFBool m_running;
+
+    /// semaphore the background thread waits on while the buffer is empty
+    OFSemaphore m_semaphore;
+
+    // private undefined copy constructor
+    DcmAsyncLogAppender(const DcmAsyncLogAppender &);
+
+    // private undefined assignment operator
+    DcmAsyncLogAppender &operator=(const DcmAsyncLogAppender &);
+
+};
+
+#endif // DSCPALOG_H
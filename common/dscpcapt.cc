@@ -0,0 +1,394 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Capture of the PDUs received per association for later replay
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpcapt.h"
+#include "dscpcond.h"
+#include "dscpconn.h"
+#include "dscptrace.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/time.h>
+END_EXTERN_C
+
+// offsets of the fields of the file header
+#define SCP_CAPTURE_OFFSET_MAGIC 0
+#define SCP_CAPTURE_OFFSET_VERSION 4
+
+// types of the records
+#define SCP_CAPTURE_RECORD_SESSION 0x01
+#define SCP_CAPTURE_RECORD_PDU 0x02
+#define SCP_CAPTURE_RECORD_END 0x03
+
+// maximum number of bytes of a time (64 bits, 7 bits per byte)
+#define SCP_CAPTURE_MAX_TIME_SIZE 10
+
+
+// helper functions for little endian encoding
+
+static void putUint16(Uint8 *buffer, const Uint16 value)
+{
+  buffer[0] = OFstatic_cast(Uint8, value);
+  buffer[1] = OFstatic_cast(Uint8, value >> 8);
+}
+
+static void putUint32(Uint8 *buffer, const Uint32 value)
+{
+  for (int i = 0; i < 4; ++i)
+    buffer[i] = OFstatic_cast(Uint8, value >> (8 * i));
+}
+
+static void putUint64(Uint8 *buffer, const Uint64 value)
+{
+  for (int i = 0; i < 8; ++i)
+    buffer[i] = OFstatic_cast(Uint8, value >> (8 * i));
+}
+
+static Uint16 getUint16(const Uint8 *buffer)
+{
+  return OFstatic_cast(Uint16, buffer[0] | (buffer[1] << 8));
+}
+
+static Uint32 getUint32(const Uint8 *buffer)
+{
+  Uint32 value = 0;
+  for (int i = 3; i >= 0; --i)
+    value = (value << 8) | buffer[i];
+  return value;
+}
+
+static Uint64 getUint64(const Uint8 *buffer)
+{
+  Uint64 value = 0;
+  for (int i = 7; i >= 0; --i)
+    value = (value << 8) | buffer[i];
+  return value;
+}
+
+// length of a PDU from its (big endian) header, without the header itself
+static Uint32 getPDULength(const Uint8 *header)
+{
+  return (OFstatic_cast(Uint32, header[2]) << 24) | (OFstatic_cast(Uint32, header[3]) << 16) |
+    (OFstatic_cast(Uint32, header[4]) << 8) | header[5];
+}
+
+// decode a variable length number, returns OFFalse if the data ends before it
+static OFBool getTime(const Uint8 *&data, const Uint8 *end, Uint64 &value)
+{
+  value = 0;
+  for (int shift = 0; (data < end) && (shift < 64); shift += 7)
+  {
+    const Uint8 byte = *data++;
+    value |= OFstatic_cast(Uint64, byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+      return OFTrue;
+  }
+  return OFFalse;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmCapturedPDU::DcmCapturedPDU()
+  : offset(0)
+  , data()
+{
+}
+
+// ----------------------------------------------------------------------------
+
+DcmCapturedSession::DcmCapturedSession()
+  : startTime(0)
+  , duration(0)
+  , peerAddress()
+  , pdus()
+{
+}
+
+// ----------------------------------------------------------------------------
+
+DcmTrafficCapture::DcmTrafficCapture()
+  : m_file()
+  , m_filename()
+  , m_capturing(OFFalse)
+  , m_records()
+  , m_lastTime(0)
+  , m_pdu()
+  , m_pduLength(0)
+  , m_pduTime(0)
+{
+}
+
+
+DcmTrafficCapture::~DcmTrafficCapture()
+{
+  close();
+}
+
+
+OFCondition DcmTrafficCapture::open(const OFString &filename,
+                                    const Uint32 magic)
+{
+  close();
+  // check the header of an existing file before appending to it
+  OFFile existing;
+  if (existing.fopen(filename.c_str(), "rb"))
+  {
+    Uint8 header[SCP_CAPTURE_HEADER_SIZE];
+    const size_t count = existing.fread(header, 1, SCP_CAPTURE_HEADER_SIZE);
+    existing.fclose();
+    if ((count > 0) && ((count != SCP_CAPTURE_HEADER_SIZE) ||
+        (getUint32(header + SCP_CAPTURE_OFFSET_MAGIC) != magic) ||
+        (getUint16(header + SCP_CAPTURE_OFFSET_VERSION) != SCP_CAPTURE_VERSION)))
+    {
+      DCMNET_ERROR("cannot append to " << filename << ": not a capture file of version " << SCP_CAPTURE_VERSION);
+      return SCP_EC_InvalidCapture;
+    }
+  }
+  if (!m_file.fopen(filename.c_str(), "ab"))
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot open capture file " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return SCP_EC_InvalidCapture;
+  }
+  m_filename = filename;
+  if (m_file.ftell() == 0)
+  {
+    Uint8 header[SCP_CAPTURE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    putUint32(header + SCP_CAPTURE_OFFSET_MAGIC, magic);
+    putUint16(header + SCP_CAPTURE_OFFSET_VERSION, SCP_CAPTURE_VERSION);
+    if ((m_file.fwrite(header, 1, sizeof(header)) != sizeof(header)) || (m_file.fflush() != 0))
+    {
+      char buf[256];
+      DCMNET_ERROR("cannot write capture file " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+      m_file.fclose();
+      return SCP_EC_InvalidCapture;
+    }
+    DCMNET_DEBUG("created capture file " << filename);
+  }
+  else
+    DCMNET_DEBUG("appending to capture file " << filename);
+  return EC_Normal;
+}
+
+
+void DcmTrafficCapture::close()
+{
+  if (m_file.open())
+    m_file.fclose();
+  m_capturing = OFFalse;
+  m_records.clear();
+  m_pdu.clear();
+}
+
+
+OFBool DcmTrafficCapture::isOpen() const
+{
+  return m_file.open();
+}
+
+
+void DcmTrafficCapture::beginSession(const Uint64 startTime,
+                                     const OFString &peerAddress)
+{
+  if (!m_file.open())
+    return;
+  m_records.clear();
+  m_pdu.clear();
+  m_pduLength = 0;
+  m_capturing = OFTrue;
+  m_lastTime = startTime;
+
+  // the start time is stored as wall clock time, the monotonic clock has no epoch
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  const Uint64 wallClock = OFstatic_cast(Uint64, tv.tv_sec) * 1000000 + OFstatic_cast(Uint64, tv.tv_usec);
+  const Uint64 elapsed = (DcmTraceRecorder::now() - startTime) / 1000;
+  const size_t addressLength = (peerAddress.length() < 255) ? peerAddress.length() : 255;
+  Uint8 record[1 + 8 + 1];
+  record[0] = SCP_CAPTURE_RECORD_SESSION;
+  putUint64(record + 1, (wallClock > elapsed) ? wallClock - elapsed : 0);
+  record[9] = OFstatic_cast(Uint8, addressLength);
+  m_records.insert(m_records.end(), record, record + sizeof(record));
+  m_records.insert(m_records.end(), peerAddress.c_str(), peerAddress.c_str() + addressLength);
+}
+
+
+void DcmTrafficCapture::addData(const Uint8 *data,
+                                const size_t length,
+                                const Uint64 time)
+{
+  size_t pos = 0;
+  while (m_capturing && (pos < length))
+  {
+    if (m_pdu.empty())
+      m_pduTime = time;
+    // complete the header first, it tells how much data follows
+    const size_t wanted = (m_pdu.size() < SCP_CONN_PDU_HEADER_SIZE) ?
+      SCP_CONN_PDU_HEADER_SIZE - m_pdu.size() :
+      SCP_CONN_PDU_HEADER_SIZE + OFstatic_cast(size_t, m_pduLength) - m_pdu.size();
+    const size_t count = (length - pos < wanted) ? length - pos : wanted;
+    m_pdu.insert(m_pdu.end(), data + pos, data + pos + count);
+    pos += count;
+    if ((m_pdu.size() == SCP_CONN_PDU_HEADER_SIZE) && (count == wanted))
+    {
+      m_pduLength = getPDULength(&m_pdu[0]);
+      if (m_pduLength > SCP_CAPTURE_MAX_PDU_LENGTH)
+      {
+        DCMNET_WARN("PDU of " << m_pduLength << " bytes exceeds the limit of the capture, "
+          << "capturing the rest of the association stopped");
+        endSession(time);
+        return;
+      }
+    }
+    if ((m_pdu.size() >= SCP_CONN_PDU_HEADER_SIZE) &&
+        (m_pdu.size() == SCP_CONN_PDU_HEADER_SIZE + OFstatic_cast(size_t, m_pduLength)))
+    {
+      m_records.push_back(SCP_CAPTURE_RECORD_PDU);
+      putTime(m_pduTime);
+      m_records.insert(m_records.end(), m_pdu.begin(), m_pdu.end());
+      m_pdu.clear();
+      m_pduLength = 0;
+      if (m_records.size() >= SCP_CAPTURE_FLUSH_SIZE)
+        writeRecords();
+    }
+  }
+}
+
+
+void DcmTrafficCapture::endSession(const Uint64 time)
+{
+  if (!m_capturing)
+    return;
+  m_records.push_back(SCP_CAPTURE_RECORD_END);
+  putTime(time);
+  writeRecords();
+  m_capturing = OFFalse;
+  m_pdu.clear();
+  if (m_file.open() && (m_file.fflush() != 0))
+  {
+    char buf[256];
+    DCMNET_WARN("cannot write capture file " << m_filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf))
+      << ", capturing disabled");
+    m_file.fclose();
+  }
+}
+
+
+OFCondition DcmTrafficCapture::readFile(const OFString &filename,
+                                        const Uint32 magic,
+                                        OFVector<DcmCapturedSession> &sessions)
+{
+  sessions.clear();
+  OFFile file;
+  if (!file.fopen(filename.c_str(), "rb"))
+    return SCP_EC_InvalidCapture;
+  OFVector<Uint8> content;
+  Uint8 buffer[65536];
+  size_t count;
+  while ((count = file.fread(buffer, 1, sizeof(buffer))) > 0)
+    content.insert(content.end(), buffer, buffer + count);
+  file.fclose();
+  if ((content.size() < SCP_CAPTURE_HEADER_SIZE) ||
+      (getUint32(&content[0] + SCP_CAPTURE_OFFSET_MAGIC) != magic) ||
+      (getUint16(&content[0] + SCP_CAPTURE_OFFSET_VERSION) != SCP_CAPTURE_VERSION))
+    return SCP_EC_InvalidCapture;
+
+  const Uint8 *data = &content[0] + SCP_CAPTURE_HEADER_SIZE;
+  const Uint8 *end = &content[0] + content.size();
+  Uint64 lastOffset = 0;
+  while (data < end)
+  {
+    const Uint8 type = *data++;
+    Uint64 delta = 0;
+    if (type == SCP_CAPTURE_RECORD_SESSION)
+    {
+      if ((end - data < 9) || (end - data < 9 + data[8]))
+        break;
+      sessions.push_back(DcmCapturedSession());
+      sessions.back().startTime = getUint64(data);
+      sessions.back().peerAddress.assign(OFreinterpret_cast(const char *, data + 9), data[8]);
+      data += 9 + data[8];
+      lastOffset = 0;
+    }
+    else if ((type == SCP_CAPTURE_RECORD_PDU) && !sessions.empty())
+    {
+      if (!getTime(data, end, delta) || (end - data < SCP_CONN_PDU_HEADER_SIZE))
+        break;
+      const size_t length = SCP_CONN_PDU_HEADER_SIZE + OFstatic_cast(size_t, getPDULength(data));
+      if (OFstatic_cast(size_t, end - data) < length)
+        break;
+      lastOffset += delta;
+      sessions.back().pdus.push_back(DcmCapturedPDU());
+      sessions.back().pdus.back().offset = lastOffset;
+      sessions.back().pdus.back().data.assign(data, data + length);
+      data += length;
+    }
+    else if ((type == SCP_CAPTURE_RECORD_END) && !sessions.empty())
+    {
+      if (!getTime(data, end, delta))
+        break;
+      sessions.back().duration = lastOffset + delta;
+    }
+    else
+    {
+      DCMNET_ERROR("invalid record in capture file " << filename << " at offset "
+        << (data - 1 - &content[0]));
+      return SCP_EC_InvalidCapture;
+    }
+  }
+  // the last session may still be written by a running SCP
+  if (data < end)
+    DCMNET_DEBUG("ignoring incomplete record at the end of capture file " << filename);
+  return EC_Normal;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmTrafficCapture::putTime(const Uint64 time)
+{
+  // times are stored relative to the previous record, in microseconds
+  Uint64 value = (time > m_lastTime) ? (time - m_lastTime) / 1000 : 0;
+  m_lastTime += value * 1000;
+  Uint8 buffer[SCP_CAPTURE_MAX_TIME_SIZE];
+  size_t length = 0;
+  do
+  {
+    buffer[length] = OFstatic_cast(Uint8, value & 0x7f);
+    value >>= 7;
+    if (value != 0)
+      buffer[length] |= 0x80;
+    ++length;
+  } while (value != 0);
+  m_records.insert(m_records.end(), buffer, buffer + length);
+}
+
+
+void DcmTrafficCapture::writeRecords()
+{
+  if (m_records.empty() || !m_file.open())
+    return;
+  if (m_file.fwrite(&m_records[0], 1, m_records.size()) != m_records.size())
+  {
+    char buf[256];
+    DCMNET_WARN("cannot write capture file " << m_filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf))
+      << ", capturing disabled");
+    m_file.fclose();
+    m_capturing = OFFalse;
+  }
+  m_records.clear();
+}
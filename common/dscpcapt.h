@@ -0,0 +1,200 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Capture of the PDUs received per association for later replay
+ *
+ */
+
+#ifndef DSCPCAPT_H
+#define DSCPCAPT_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/offile.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofvector.h"
+
+/// magic number at the start of a capture file of mppsrecv ("MPCP" in little endian byte order)
+#define SCP_CAPTURE_MAGIC_MPPS 0x5043504dUL
+
+/// magic number at the start of a capture file of storcmtrecv ("SCCP" in little endian byte order)
+#define SCP_CAPTURE_MAGIC_STORCMT 0x50434353UL
+
+/// version of the capture file format
+#define SCP_CAPTURE_VERSION 1
+
+/// size of the header of a capture file in bytes
+#define SCP_CAPTURE_HEADER_SIZE 8
+
+/// size of the records of a session in progress written to the file before the end
+#define SCP_CAPTURE_FLUSH_SIZE 1048576
+
+/// largest PDU captured; a session with a larger PDU is no longer captured
+#define SCP_CAPTURE_MAX_PDU_LENGTH 16777216UL
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** A PDU received on a captured association
+ */
+struct DcmCapturedPDU
+{
+  /** default constructor
+   */
+  DcmCapturedPDU();
+
+  /// time the first byte of the PDU was received, in microseconds since the start
+  /// of the session
+  Uint64 offset;
+  /// the complete PDU including its header
+  OFVector<Uint8> data;
+};
+
+
+/** An association captured, with the PDUs received from the peer
+ */
+struct DcmCapturedSession
+{
+  /** default constructor
+   */
+  DcmCapturedSession();
+
+  /// time the connection was accepted (microseconds since the epoch)
+  Uint64 startTime;
+  /// time the connection was closed, in microseconds since the start of the
+  /// session, 0 if the session has not been completed in the file
+  Uint64 duration;
+  /// numeric address of the peer
+  OFString peerAddress;
+  /// the PDUs received, in the order of their arrival
+  OFVector<DcmCapturedPDU> pdus;
+};
+
+
+/** Capture of the raw data received on each association, split into PDUs and
+ *  appended to a capture file together with the time of their arrival, for replaying
+ *  the traffic later against an SCP (see mppsreplay and storcmtreplay). The data is taken as it comes
+ *  from the socket, before DUL has seen it, so an association is captured even if it
+ *  is rejected or aborted. Only one association is captured at a time.
+ *  The file starts with a header (magic number, version) followed by records, each
+ *  introduced by its type: the start of a session (time since the epoch, peer
+ *  address), a PDU (time since the previous record of the session, the PDU itself,
+ *  whose header tells its length) or the end of a session (time since the previous
+ *  record). Times are stored in microseconds as variable length numbers (7 bits per
+ *  byte, least significant first), all other numbers in little endian byte order.
+ *  The records of a session are collected in memory and written when it ends (or
+ *  when they exceed SCP_CAPTURE_FLUSH_SIZE), so the SCP does not write to the file
+ *  while handling the requests of a typical association.
+ */
+class DcmTrafficCapture
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmTrafficCapture();
+
+    /** destructor. Closes the capture file.
+     */
+    ~DcmTrafficCapture();
+
+    /** Open a capture file. The sessions are appended if the file already exists.
+     *  @param filename [in] Name of the capture file
+     *  @param magic    [in] Magic number of the capture files of the SCP, e.g.
+     *                       SCP_CAPTURE_MAGIC_MPPS
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition open(const OFString &filename,
+                     const Uint32 magic);
+
+    /** Close the capture file, discarding the session in progress (if any)
+     */
+    void close();
+
+    /** Returns whether the capture file is open
+     *  @return OFTrue if open, OFFalse otherwise
+     */
+    OFBool isOpen() const;
+
+    /** Start capturing a new association, discarding the session in progress (if any)
+     *  @param startTime   [in] Time the connection was accepted, see
+     *                          DcmTraceRecorder::now()
+     *  @param peerAddress [in] Numeric address of the peer
+     */
+    void beginSession(const Uint64 startTime,
+                      const OFString &peerAddress);
+
+    /** Add data received on the association
+     *  @param data   [in] The data as received from the socket
+     *  @param length [in] Number of bytes
+     *  @param time   [in] Time the data was received, see DcmTraceRecorder::now()
+     */
+    void addData(const Uint8 *data,
+                 const size_t length,
+                 const Uint64 time);
+
+    /** End the session and write it to the capture file. An incomplete PDU at the
+     *  end is not written.
+     *  @param time [in] Time the connection was closed, see DcmTraceRecorder::now()
+     */
+    void endSession(const Uint64 time);
+
+    /** Read all sessions of a capture file
+     *  @param filename [in]  Name of the capture file
+     *  @param magic    [in]  Magic number of the capture files of the SCP, e.g.
+     *                        SCP_CAPTURE_MAGIC_MPPS
+     *  @param sessions [out] The sessions, in the order they were captured
+     *  @return EC_Normal if successful, SCP_EC_InvalidCapture otherwise
+     */
+    static OFCondition readFile(const OFString &filename,
+                                const Uint32 magic,
+                                OFVector<DcmCapturedSession> &sessions);
+
+  private:
+
+    /** Append a time to the records of the session in progress
+     *  @param time [in] The time, see DcmTraceRecorder::now()
+     */
+    void putTime(const Uint64 time);
+
+    /** Write the records collected to the capture file. On failure, capturing is
+     *  disabled.
+     */
+    void writeRecords();
+
+    /// the capture file, not open if capturing is disabled
+    OFFile m_file;
+
+    /// name of the capture file
+    OFString m_filename;
+
+    /// OFTrue while an association is captured
+    OFBool m_capturing;
+
+    /// encoded records of the session in progress
+    OFVector<Uint8> m_records;
+
+    /// time of the last record of the session in progress
+    Uint64 m_lastTime;
+
+    /// data of the PDU being received, header first
+    OFVector<Uint8> m_pdu;
+
+    /// length of the PDU being received (from its header), 0 until known
+    Uint32 m_pduLength;
+
+    /// time the first byte of the PDU being received arrived
+    Uint64 m_pduTime;
+
+    // private undefined copy constructor
+    DcmTrafficCapture(const DcmTrafficCapture &);
+
+    // private undefined assignment operator
+    DcmTrafficCapture &operator=(const DcmTrafficCapture &);
+};
+
+#endif // DSCPCAPT_H
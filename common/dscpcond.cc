@@ -0,0 +1,21 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Error conditions of the code shared by the SCPs
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpcond.h"
+
+makeOFConditionConst(SCP_EC_InvalidAccessPolicy,  OFM_scpcommon, 1, OF_error, "Invalid access policy");
+makeOFConditionConst(SCP_EC_MetricsError,         OFM_scpcommon, 2, OF_error, "Cannot set up metrics endpoint");
+makeOFConditionConst(SCP_EC_TraceError,           OFM_scpcommon, 3, OF_error, "Cannot write trace file");
+makeOFConditionConst(SCP_EC_FlightRecorderError,  OFM_scpcommon, 4, OF_error, "Flight recorder error");
+makeOFConditionConst(SCP_EC_BenchmarkFailed,      OFM_scpcommon, 5, OF_error, "Micro-benchmark failed");
+makeOFConditionConst(SCP_EC_InvalidBaseline,      OFM_scpcommon, 6, OF_error, "Invalid baseline file");
+makeOFConditionConst(SCP_EC_InvalidCapture,       OFM_scpcommon, 7, OF_error, "Invalid capture file");
+makeOFConditionConst(SCP_EC_ReplayFailed,         OFM_scpcommon, 8, OF_error, "Replay of captured session failed");
@@ -0,0 +1,36 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Error conditions of the code shared by the SCPs
+ *
+ */
+
+#ifndef DSCPCOND_H
+#define DSCPCOND_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+/// module number for the conditions of the code shared by the SCPs
+#define OFM_scpcommon 1026
+
+/// the access policy file could not be read or contains an invalid rule
+extern const OFCondition SCP_EC_InvalidAccessPolicy;
+/// the metrics endpoint could not be set up
+extern const OFCondition SCP_EC_MetricsError;
+/// a trace file could not be written
+extern const OFCondition SCP_EC_TraceError;
+/// the flight recorder could not be set up or written
+extern const OFCondition SCP_EC_FlightRecorderError;
+/// a micro-benchmark failed
+extern const OFCondition SCP_EC_BenchmarkFailed;
+/// a baseline file of micro-benchmark results cannot be read
+extern const OFCondition SCP_EC_InvalidBaseline;
+/// a capture file cannot be opened or has an invalid format
+extern const OFCondition SCP_EC_InvalidCapture;
+/// a captured session could not be replayed
+extern const OFCondition SCP_EC_ReplayFailed;
+
+#endif // DSCPCOND_H
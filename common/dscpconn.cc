@@ -0,0 +1,549 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Transport layer with buffered reading and gathered writing of PDUs
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpconn.h"
+#include "dscpcapt.h"
+#include "dscptrace.h"
+#include "dcmtk/dcmnet/assoc.h"
+#include "dcmtk/dcmnet/cond.h"
+#include "dcmtk/dcmnet/diutil.h"
+#include "dcmtk/ofstd/ofstd.h"
+
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// highest file descriptor checked when looking for the listening socket
+#define SCP_CONN_MAX_LISTEN_FD 1024
+
+// size of the receive buffer if not configured otherwise
+#define SCP_CONN_DEFAULT_BUFFER_SIZE (ASC_DEFAULTMAXPDU + SCP_CONN_PDU_HEADER_SIZE)
+
+// writes up to this size are collected while sending a message (PDU and PDV headers,
+// small command sets)
+#define SCP_CONN_GATHER_SIZE 8192
+
+
+DcmSocketOptions::DcmSocketOptions()
+  : m_noDelaySet(OFFalse)
+  , m_noDelay(OFTrue)
+  , m_receiveBufferSize(0)
+  , m_sendBufferSize(0)
+  , m_listenBacklog(0)
+  , m_keepAlive(OFFalse)
+  , m_keepAliveIdle(0)
+  , m_keepAliveInterval(0)
+  , m_keepAliveCount(0)
+  , m_userTimeout(0)
+{
+}
+
+
+void DcmSocketOptions::setNoDelay(const OFBool noDelay)
+{
+  m_noDelaySet = OFTrue;
+  m_noDelay = noDelay;
+}
+
+
+void DcmSocketOptions::setReceiveBufferSize(const Uint32 size)
+{
+  m_receiveBufferSize = size;
+}
+
+
+void DcmSocketOptions::setSendBufferSize(const Uint32 size)
+{
+  m_sendBufferSize = size;
+}
+
+
+void DcmSocketOptions::setListenBacklog(const Uint32 backlog)
+{
+  m_listenBacklog = backlog;
+}
+
+
+void DcmSocketOptions::setKeepAlive(const Uint32 idle,
+                                    const Uint32 interval,
+                                    const Uint32 count)
+{
+  m_keepAlive = OFTrue;
+  m_keepAliveIdle = idle;
+  m_keepAliveInterval = interval;
+  m_keepAliveCount = count;
+}
+
+
+void DcmSocketOptions::setUserTimeout(const Uint32 timeout)
+{
+  m_userTimeout = timeout;
+}
+
+
+void DcmSocketOptions::applyToConnection(int socket) const
+{
+  if (m_noDelaySet)
+    setOption(socket, IPPROTO_TCP, TCP_NODELAY, m_noDelay ? 1 : 0, "TCP_NODELAY");
+  if (m_receiveBufferSize > 0)
+    setOption(socket, SOL_SOCKET, SO_RCVBUF, OFstatic_cast(int, m_receiveBufferSize), "SO_RCVBUF");
+  if (m_sendBufferSize > 0)
+    setOption(socket, SOL_SOCKET, SO_SNDBUF, OFstatic_cast(int, m_sendBufferSize), "SO_SNDBUF");
+  if (m_keepAlive)
+  {
+    setOption(socket, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+    if (m_keepAliveIdle > 0)
+      setOption(socket, IPPROTO_TCP, TCP_KEEPIDLE, OFstatic_cast(int, m_keepAliveIdle), "TCP_KEEPIDLE");
+    if (m_keepAliveInterval > 0)
+      setOption(socket, IPPROTO_TCP, TCP_KEEPINTVL, OFstatic_cast(int, m_keepAliveInterval), "TCP_KEEPINTVL");
+    if (m_keepAliveCount > 0)
+      setOption(socket, IPPROTO_TCP, TCP_KEEPCNT, OFstatic_cast(int, m_keepAliveCount), "TCP_KEEPCNT");
+#else
+    if ((m_keepAliveIdle > 0) || (m_keepAliveInterval > 0) || (m_keepAliveCount > 0))
+      DCMNET_WARN("TCP keepalive parameters not supported on this platform, using system defaults");
+#endif
+  }
+  if (m_userTimeout > 0)
+  {
+#ifdef TCP_USER_TIMEOUT
+    setOption(socket, IPPROTO_TCP, TCP_USER_TIMEOUT, OFstatic_cast(int, m_userTimeout), "TCP_USER_TIMEOUT");
+#else
+    DCMNET_WARN("TCP_USER_TIMEOUT not supported on this platform, ignored");
+#endif
+  }
+}
+
+
+void DcmSocketOptions::applyToListener(const Uint16 port) const
+{
+  if ((m_receiveBufferSize == 0) && (m_sendBufferSize == 0) && (m_listenBacklog == 0))
+    return;
+#ifdef SO_ACCEPTCONN
+  // find the listening socket created by ASC_initializeNetwork()
+  int listenSocket = -1;
+  for (int fd = 0; (fd < SCP_CONN_MAX_LISTEN_FD) && (listenSocket < 0); ++fd)
+  {
+    int listening = 0;
+    socklen_t length = sizeof(listening);
+    if ((getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, OFreinterpret_cast(char *, &listening), &length) != 0) || !listening)
+      continue;
+    struct sockaddr_storage address;
+    socklen_t addressLength = sizeof(address);
+    if (getsockname(fd, OFreinterpret_cast(struct sockaddr *, &address), &addressLength) != 0)
+      continue;
+    if (((address.ss_family == AF_INET) && (ntohs(OFreinterpret_cast(struct sockaddr_in *, &address)->sin_port) == port)) ||
+        ((address.ss_family == AF_INET6) && (ntohs(OFreinterpret_cast(struct sockaddr_in6 *, &address)->sin6_port) == port)))
+      listenSocket = fd;
+  }
+  if (listenSocket < 0)
+  {
+    DCMNET_WARN("Cannot find listening socket for port " << port << ", socket buffer sizes and backlog not applied");
+    return;
+  }
+  // buffer sizes set on the listening socket are inherited by the accepted sockets
+  if (m_receiveBufferSize > 0)
+    setOption(listenSocket, SOL_SOCKET, SO_RCVBUF, OFstatic_cast(int, m_receiveBufferSize), "SO_RCVBUF");
+  if (m_sendBufferSize > 0)
+    setOption(listenSocket, SOL_SOCKET, SO_SNDBUF, OFstatic_cast(int, m_sendBufferSize), "SO_SNDBUF");
+  // calling listen() again on a listening socket changes its backlog
+  if ((m_listenBacklog > 0) && (::listen(listenSocket, OFstatic_cast(int, m_listenBacklog)) != 0))
+  {
+    char buf[256];
+    DCMNET_WARN("Cannot set listen backlog to " << m_listenBacklog << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+  }
+  else if (m_listenBacklog > 0)
+    DCMNET_DEBUG("Listen backlog set to " << m_listenBacklog);
+#else
+  (void) port;
+  DCMNET_WARN("Socket buffer sizes and backlog cannot be applied to the listening socket on this platform");
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmSocketOptions::setOption(int socket,
+                                 int level,
+                                 int name,
+                                 int value,
+                                 const char *text)
+{
+  if (setsockopt(socket, level, name, OFreinterpret_cast(char *, &value), sizeof(value)) != 0)
+  {
+    char buf[256];
+    DCMNET_WARN("Cannot set socket option " << text << " to " << value << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+  }
+  else
+    DCMNET_TRACE("Socket option " << text << " set to " << value);
+}
+
+// ----------------------------------------------------------------------------
+
+DcmBufferedConnection::DcmBufferedConnection(DcmBufferedTransportLayer &layer,
+                                             int openSocket,
+                                             const size_t bufferSize)
+  : DcmTCPConnection(openSocket)
+  , m_buffer(bufferSize)
+  , m_begin(0)
+  , m_end(0)
+  , m_layer(layer)
+  , m_gather(SCP_CONN_GATHER_SIZE)
+  , m_gatherLength(0)
+  , m_gathering(OFFalse)
+{
+}
+
+
+DcmBufferedConnection::~DcmBufferedConnection()
+{
+  m_layer.removeConnection(this);
+}
+
+
+ssize_t DcmBufferedConnection::read(void *buf, size_t nbyte)
+{
+  if (m_begin == m_end)
+  {
+    // reads at least as large as the buffer gain nothing from it
+    if (nbyte >= m_buffer.size())
+      return receive(buf, nbyte);
+    const ssize_t result = receive(&m_buffer[0], m_buffer.size());
+    if (result <= 0)
+      return result;
+    m_begin = 0;
+    m_end = OFstatic_cast(size_t, result);
+  }
+  const size_t length = (nbyte < m_end - m_begin) ? nbyte : m_end - m_begin;
+  memcpy(buf, &m_buffer[m_begin], length);
+  m_begin += length;
+  return OFstatic_cast(ssize_t, length);
+}
+
+
+ssize_t DcmBufferedConnection::write(void *buf, size_t nbyte)
+{
+  if (!m_gathering)
+  {
+    const ssize_t result = DcmTCPConnection::write(buf, nbyte);
+    if (result > 0)
+      m_layer.countBytesSent(OFstatic_cast(size_t, result));
+    return result;
+  }
+  if (m_gatherLength + nbyte <= m_gather.size())
+  {
+    memcpy(&m_gather[m_gatherLength], buf, nbyte);
+    m_gatherLength += nbyte;
+    return OFstatic_cast(ssize_t, nbyte);
+  }
+  // send what has been collected together with this write
+  struct iovec iov[2];
+  iov[0].iov_base = &m_gather[0];
+  iov[0].iov_len = m_gatherLength;
+  iov[1].iov_base = buf;
+  iov[1].iov_len = nbyte;
+  m_gatherLength = 0;
+  if (!writeAll(iov, 2))
+    return -1;
+  return OFstatic_cast(ssize_t, nbyte);
+}
+
+
+OFBool DcmBufferedConnection::networkDataAvailable(int timeout)
+{
+  if (m_begin < m_end)
+    return OFTrue;
+  return DcmTCPConnection::networkDataAvailable(timeout);
+}
+
+
+OFBool DcmBufferedConnection::isTransparentConnection()
+{
+  return OFFalse;
+}
+
+
+void DcmBufferedConnection::beginMessage()
+{
+  setCork(OFTrue);
+  m_gathering = OFTrue;
+}
+
+
+OFCondition DcmBufferedConnection::endMessage()
+{
+  if (!m_gathering)
+    return EC_Normal;
+  m_gathering = OFFalse;
+  OFBool result = OFTrue;
+  if (m_gatherLength > 0)
+  {
+    struct iovec iov;
+    iov.iov_base = &m_gather[0];
+    iov.iov_len = m_gatherLength;
+    m_gatherLength = 0;
+    result = writeAll(&iov, 1);
+  }
+  setCork(OFFalse);
+  return result ? EC_Normal : DUL_NETWORKCLOSED;
+}
+
+// ----------------------------------------------------------------------------
+
+OFBool DcmBufferedConnection::writeAll(struct iovec *iov, int count)
+{
+  while (count > 0)
+  {
+    const ssize_t result = writev(getSocket(), iov, count);
+    if (result < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return OFFalse;
+    }
+    m_layer.countBytesSent(OFstatic_cast(size_t, result));
+    // skip what has been written, continue with the rest
+    size_t written = OFstatic_cast(size_t, result);
+    while ((count > 0) && (written >= iov->iov_len))
+    {
+      written -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0)
+    {
+      iov->iov_base = OFstatic_cast(char *, iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+  return OFTrue;
+}
+
+
+void DcmBufferedConnection::setCork(const OFBool cork)
+{
+#ifdef TCP_CORK
+  int value = cork ? 1 : 0;
+  (void) setsockopt(getSocket(), IPPROTO_TCP, TCP_CORK, OFreinterpret_cast(char *, &value), sizeof(value));
+#else
+  (void) cork;
+#endif
+}
+
+
+ssize_t DcmBufferedConnection::receive(void *buf, size_t nbyte)
+{
+  ssize_t result;
+  do
+  {
+    m_layer.countReadCall();
+    result = recv(getSocket(), OFstatic_cast(char *, buf), nbyte, 0);
+  } while ((result < 0) && (errno == EINTR));
+  if (result > 0)
+  {
+    m_layer.noteDataArrival();
+    m_layer.countBytesReceived(OFstatic_cast(size_t, result));
+    m_layer.captureData(buf, OFstatic_cast(size_t, result));
+  }
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmBufferedTransportLayer::DcmBufferedTransportLayer(const T_ASC_NetworkRole role)
+  : DcmTransportLayer(role)
+  , m_bufferSize(SCP_CONN_DEFAULT_BUFFER_SIZE)
+  , m_socketOptions()
+  , m_readCalls(0)
+  , m_bytesReceived(0)
+  , m_bytesSent(0)
+  , m_acceptTime(0)
+  , m_readyTime(0)
+  , m_dataArrivalTime(0)
+  , m_connection(NULL)
+  , m_capture(NULL)
+{
+}
+
+
+DcmBufferedTransportLayer::~DcmBufferedTransportLayer()
+{
+}
+
+
+DcmTransportConnection *DcmBufferedTransportLayer::createConnection(int openSocket,
+                                                                    OFBool useSecureLayer)
+{
+  if (useSecureLayer)
+    return NULL;
+  // called right after accept(), so this is when the peer was accepted
+  m_acceptTime = DcmTraceRecorder::now();
+  m_bytesReceived = 0;
+  m_bytesSent = 0;
+  m_socketOptions.applyToConnection(openSocket);
+  m_connection = new DcmBufferedConnection(*this, openSocket, m_bufferSize);
+  m_readyTime = DcmTraceRecorder::now();
+  if (m_capture != NULL)
+  {
+    OFString peerAddress;
+    (void) getSocketPeerAddress(openSocket, peerAddress);
+    m_capture->beginSession(m_acceptTime, peerAddress);
+  }
+  return m_connection;
+}
+
+
+void DcmBufferedTransportLayer::setBufferSize(const size_t size)
+{
+  m_bufferSize = (size > SCP_CONN_PDU_HEADER_SIZE) ? size : SCP_CONN_DEFAULT_BUFFER_SIZE;
+}
+
+
+void DcmBufferedTransportLayer::setSocketOptions(const DcmSocketOptions &options)
+{
+  m_socketOptions = options;
+}
+
+
+Uint64 DcmBufferedTransportLayer::getReadCalls() const
+{
+  return m_readCalls;
+}
+
+
+Uint64 DcmBufferedTransportLayer::getBytesReceived() const
+{
+  return m_bytesReceived;
+}
+
+
+Uint64 DcmBufferedTransportLayer::getBytesSent() const
+{
+  return m_bytesSent;
+}
+
+
+void DcmBufferedTransportLayer::beginMessage()
+{
+  if (m_connection != NULL)
+    m_connection->beginMessage();
+}
+
+
+OFCondition DcmBufferedTransportLayer::endMessage()
+{
+  if (m_connection != NULL)
+    return m_connection->endMessage();
+  return EC_Normal;
+}
+
+
+OFBool DcmBufferedTransportLayer::getPeerAddress(OFString &address) const
+{
+  if (m_connection == NULL)
+    return OFFalse;
+  return getSocketPeerAddress(m_connection->getSocket(), address);
+}
+
+
+void DcmBufferedTransportLayer::getConnectionTimes(Uint64 &acceptTime,
+                                                   Uint64 &readyTime) const
+{
+  acceptTime = (m_connection != NULL) ? m_acceptTime : 0;
+  readyTime = (m_connection != NULL) ? m_readyTime : 0;
+}
+
+
+void DcmBufferedTransportLayer::setTrafficCapture(DcmTrafficCapture *capture)
+{
+  m_capture = capture;
+}
+
+
+void DcmBufferedTransportLayer::clearDataArrivalTime()
+{
+  m_dataArrivalTime = 0;
+}
+
+
+Uint64 DcmBufferedTransportLayer::getDataArrivalTime() const
+{
+  return m_dataArrivalTime;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmBufferedTransportLayer::countReadCall()
+{
+  ++m_readCalls;
+}
+
+
+void DcmBufferedTransportLayer::noteDataArrival()
+{
+  if (m_dataArrivalTime == 0)
+    m_dataArrivalTime = DcmTraceRecorder::now();
+}
+
+
+void DcmBufferedTransportLayer::countBytesReceived(const size_t bytes)
+{
+  m_bytesReceived += bytes;
+}
+
+
+void DcmBufferedTransportLayer::captureData(const void *data, const size_t length)
+{
+  if (m_capture != NULL)
+    m_capture->addData(OFstatic_cast(const Uint8 *, data), length, DcmTraceRecorder::now());
+}
+
+
+void DcmBufferedTransportLayer::countBytesSent(const size_t bytes)
+{
+  m_bytesSent += bytes;
+}
+
+
+void DcmBufferedTransportLayer::removeConnection(DcmBufferedConnection *connection)
+{
+  if (m_connection == connection)
+  {
+    m_connection = NULL;
+    if (m_capture != NULL)
+      m_capture->endSession(DcmTraceRecorder::now());
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+OFBool DcmBufferedTransportLayer::getSocketPeerAddress(int socket,
+                                                       OFString &address)
+{
+  struct sockaddr_storage peer;
+  socklen_t length = sizeof(peer);
+  if (getpeername(socket, OFreinterpret_cast(struct sockaddr *, &peer), &length) != 0)
+    return OFFalse;
+  char host[NI_MAXHOST];
+  if (getnameinfo(OFreinterpret_cast(struct sockaddr *, &peer), length, host, sizeof(host), NULL, 0, NI_NUMERICHOST) != 0)
+    return OFFalse;
+  address = host;
+  return OFTrue;
+}
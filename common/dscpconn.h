@@ -0,0 +1,444 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Transport layer with buffered reading and gathered writing of PDUs
+ *
+ */
+
+#ifndef DSCPCONN_H
+#define DSCPCONN_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofvector.h"
+#include "dcmtk/dcmnet/assoc.h"
+#include "dcmtk/dcmnet/dcmlayer.h"
+#include "dcmtk/dcmnet/dcmtrans.h"
+
+/// size of the PDU header (PDU type, reserved byte, PDU length)
+#define SCP_CONN_PDU_HEADER_SIZE 6
+
+class DcmBufferedTransportLayer;
+class DcmTrafficCapture;
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** TCP options applied to the sockets of a network. All options are left at the
+ *  defaults of DCMTK and the operating system unless set explicitly. Options not
+ *  supported by the operating system (e.g.\ TCP_USER_TIMEOUT) are ignored with a
+ *  warning.
+ */
+class DcmSocketOptions
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmSocketOptions();
+
+    /** Enable or disable TCP_NODELAY, i.e.\ disable or enable the Nagle algorithm.
+     *  DCMTK already sets TCP_NODELAY unless the environment variable TCP_NODELAY is
+     *  "0", so this is mainly needed to override the environment.
+     *  @param noDelay [in] OFTrue to send small segments immediately
+     */
+    void setNoDelay(const OFBool noDelay);
+
+    /** Set the size of the socket receive buffer (SO_RCVBUF). On the listening socket,
+     *  the size is inherited by the accepted sockets before the TCP handshake, so the
+     *  window scaling is negotiated accordingly.
+     *  @param size [in] Size in bytes, 0 for the system default
+     */
+    void setReceiveBufferSize(const Uint32 size);
+
+    /** Set the size of the socket send buffer (SO_SNDBUF)
+     *  @param size [in] Size in bytes, 0 for the system default
+     */
+    void setSendBufferSize(const Uint32 size);
+
+    /** Set the backlog of the listening socket, i.e.\ the maximum number of pending
+     *  connections not yet accepted
+     *  @param backlog [in] Number of connections, 0 for the DCMTK default
+     */
+    void setListenBacklog(const Uint32 backlog);
+
+    /** Enable TCP keepalive (SO_KEEPALIVE) and set its parameters
+     *  @param idle     [in] Seconds of idleness before the first probe (TCP_KEEPIDLE),
+     *                       0 for the system default
+     *  @param interval [in] Seconds between probes (TCP_KEEPINTVL), 0 for the system
+     *                       default
+     *  @param count    [in] Number of unanswered probes before the connection is
+     *                       dropped (TCP_KEEPCNT), 0 for the system default
+     */
+    void setKeepAlive(const Uint32 idle,
+                      const Uint32 interval,
+                      const Uint32 count);
+
+    /** Set the maximum time transmitted data may remain unacknowledged before the
+     *  connection is dropped (TCP_USER_TIMEOUT)
+     *  @param timeout [in] Timeout in milliseconds, 0 for the system default
+     */
+    void setUserTimeout(const Uint32 timeout);
+
+    /** Apply the options to a connected socket
+     *  @param socket [in] The socket
+     */
+    void applyToConnection(int socket) const;
+
+    /** Apply the buffer sizes and the backlog to the listening socket of an acceptor
+     *  network. DCMTK does not expose this socket, so it is looked up by its port.
+     *  @param port [in] The port the network is listening on
+     */
+    void applyToListener(const Uint16 port) const;
+
+  private:
+
+    /** Set an integer socket option, log a warning on failure
+     *  @param socket [in] The socket
+     *  @param level  [in] The protocol level (e.g.\ IPPROTO_TCP)
+     *  @param name   [in] The option (e.g.\ TCP_NODELAY)
+     *  @param value  [in] The value
+     *  @param text   [in] Name of the option for the log output
+     */
+    static void setOption(int socket,
+                          int level,
+                          int name,
+                          int value,
+                          const char *text);
+
+    /// OFTrue if TCP_NODELAY is set explicitly
+    OFBool m_noDelaySet;
+
+    /// value of TCP_NODELAY
+    OFBool m_noDelay;
+
+    /// size of the receive buffer, 0 for the default
+    Uint32 m_receiveBufferSize;
+
+    /// size of the send buffer, 0 for the default
+    Uint32 m_sendBufferSize;
+
+    /// backlog of the listening socket, 0 for the default
+    Uint32 m_listenBacklog;
+
+    /// OFTrue if keepalive is enabled
+    OFBool m_keepAlive;
+
+    /// seconds of idleness before the first keepalive probe, 0 for the default
+    Uint32 m_keepAliveIdle;
+
+    /// seconds between keepalive probes, 0 for the default
+    Uint32 m_keepAliveInterval;
+
+    /// number of keepalive probes, 0 for the default
+    Uint32 m_keepAliveCount;
+
+    /// TCP user timeout in milliseconds, 0 for the default
+    Uint32 m_userTimeout;
+
+};
+
+
+/** TCP connection reading the incoming data through a receive buffer. DUL reads each
+ *  PDU in several small pieces (PDU header, PDV item headers, PDV data), which would
+ *  otherwise cost one recv() each. Instead, as much data as available (up to the size
+ *  of the buffer) is received at once and the pieces are handed out from the buffer,
+ *  so a small DIMSE message usually costs a single recv().
+ *  Since the connection may hold data that is no longer visible on the socket, it
+ *  reports itself as not transparent, so DCMTK asks networkDataAvailable() instead
+ *  of selecting on the socket.
+ *  For sending, DUL writes the header and the data of each PDU separately. Between
+ *  beginMessage() and endMessage(), small writes are collected and sent together with
+ *  the next large one by a single writev(), and the socket is corked (TCP_CORK where
+ *  available), so all PDVs of a DIMSE message leave as one train of full segments.
+ */
+class DcmBufferedConnection : public DcmTCPConnection
+{
+
+  public:
+
+    /** constructor
+     *  @param layer      [in] The transport layer that created the connection
+     *  @param openSocket [in] The connected socket
+     *  @param bufferSize [in] Size of the receive buffer in bytes
+     */
+    DcmBufferedConnection(DcmBufferedTransportLayer &layer,
+                          int openSocket,
+                          const size_t bufferSize);
+
+    /** destructor
+     */
+    virtual ~DcmBufferedConnection();
+
+    /** Read data from the connection, from the receive buffer if possible
+     *  @param buf   [out] Buffer to read into
+     *  @param nbyte [in]  Maximum number of bytes to read
+     *  @return Number of bytes read, 0 if the peer closed the connection, negative
+     *          on error
+     */
+    virtual ssize_t read(void *buf, size_t nbyte);
+
+    /** Write data to the connection. Between beginMessage() and endMessage(), small
+     *  writes are only collected.
+     *  @param buf   [in] Data to write
+     *  @param nbyte [in] Number of bytes to write
+     *  @return Number of bytes written, negative on error
+     */
+    virtual ssize_t write(void *buf, size_t nbyte);
+
+    /** Check whether data can be read without blocking
+     *  @param timeout [in] Maximum time to wait in seconds
+     *  @return OFTrue if data is available, OFFalse otherwise
+     */
+    virtual OFBool networkDataAvailable(int timeout);
+
+    /** Returns whether the connection is transparent, i.e.\ whether a select() on the
+     *  socket tells whether data is available
+     *  @return Always OFFalse, since data may be waiting in the receive buffer
+     */
+    virtual OFBool isTransparentConnection();
+
+    /** Start collecting the writes of a message and cork the socket
+     */
+    void beginMessage();
+
+    /** Send the data collected and uncork the socket
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition endMessage();
+
+  private:
+
+    /** Write all data of an I/O vector, continuing after partial writes
+     *  @param iov   [in] The I/O vector (modified)
+     *  @param count [in] Number of entries
+     *  @return OFTrue if successful, OFFalse otherwise
+     */
+    OFBool writeAll(struct iovec *iov, int count);
+
+    /** Set the TCP_CORK option of the socket (if supported)
+     *  @param cork [in] OFTrue to cork, OFFalse to uncork
+     */
+    void setCork(const OFBool cork);
+
+    /** Receive data from the socket
+     *  @param buf   [out] Buffer to receive into
+     *  @param nbyte [in]  Maximum number of bytes to receive
+     *  @return Result of recv()
+     */
+    ssize_t receive(void *buf, size_t nbyte);
+
+    /// the receive buffer
+    OFVector<Uint8> m_buffer;
+
+    /// offset of the first byte not yet handed out
+    size_t m_begin;
+
+    /// offset behind the last byte received
+    size_t m_end;
+
+    /// the transport layer that created the connection
+    DcmBufferedTransportLayer &m_layer;
+
+    /// data collected for sending
+    OFVector<Uint8> m_gather;
+
+    /// number of bytes collected
+    size_t m_gatherLength;
+
+    /// flag indicating that writes are collected
+    OFBool m_gathering;
+
+    // private undefined copy constructor
+    DcmBufferedConnection(const DcmBufferedConnection &);
+
+    // private undefined assignment operator
+    DcmBufferedConnection &operator=(const DcmBufferedConnection &);
+
+};
+
+
+/** Transport layer creating a DcmBufferedConnection for each association and applying
+ *  the socket options to its socket. If a DcmTrafficCapture is set, the data received
+ *  on each connection is added to it. Secure connections are not supported.
+ */
+class DcmBufferedTransportLayer : public DcmTransportLayer
+{
+
+  public:
+
+    /** constructor
+     *  @param role [in] NET_ACCEPTOR for incoming, NET_REQUESTOR for outgoing associations
+     */
+    DcmBufferedTransportLayer(const T_ASC_NetworkRole role = NET_ACCEPTOR);
+
+    /** destructor
+     */
+    virtual ~DcmBufferedTransportLayer();
+
+    /** Create a connection for a socket
+     *  @param openSocket     [in] The connected socket
+     *  @param useSecureLayer [in] Must be OFFalse
+     *  @return The connection, NULL if a secure layer is requested
+     */
+    virtual DcmTransportConnection *createConnection(int openSocket,
+                                                     OFBool useSecureLayer);
+
+    /** Set the size of the receive buffer of new connections. Should be the maximum
+     *  receive PDU length plus the size of the PDU header, so that a complete PDU
+     *  fits into the buffer.
+     *  @param size [in] Size in bytes
+     */
+    void setBufferSize(const size_t size);
+
+    /** Set the options applied to the socket of new connections
+     *  @param options [in] The socket options
+     */
+    void setSocketOptions(const DcmSocketOptions &options);
+
+    /** Returns the number of recv() calls of all connections so far
+     *  @return Number of recv() calls
+     */
+    Uint64 getReadCalls() const;
+
+    /** Returns the number of bytes received on the current (or last) connection
+     *  @return Number of bytes received from the socket
+     */
+    Uint64 getBytesReceived() const;
+
+    /** Returns the number of bytes sent on the current (or last) connection
+     *  @return Number of bytes written to the socket
+     */
+    Uint64 getBytesSent() const;
+
+    /** Start a message on the current connection (if any), see
+     *  DcmBufferedConnection::beginMessage()
+     */
+    void beginMessage();
+
+    /** End a message on the current connection (if any), see
+     *  DcmBufferedConnection::endMessage()
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition endMessage();
+
+    /** Get the numeric address of the peer of the current connection
+     *  @param address [out] The IPv4 or IPv6 address
+     *  @return OFTrue if successful, OFFalse if there is no connection or the address
+     *          cannot be determined
+     */
+    OFBool getPeerAddress(OFString &address) const;
+
+    /** Returns the times the current connection was set up, for tracing
+     *  @param acceptTime [out] Time the accepted socket was handed over, see
+     *                          DcmTraceRecorder::now(), 0 if there is no connection
+     *  @param readyTime  [out] Time the socket options were applied
+     */
+    void getConnectionTimes(Uint64 &acceptTime,
+                            Uint64 &readyTime) const;
+
+    /** Set the capture the data received on each connection is added to
+     *  @param capture [in] The capture, NULL for none (default). Not deleted by the
+     *                      transport layer.
+     */
+    void setTrafficCapture(DcmTrafficCapture *capture);
+
+    /** Forget the time data was last received, see getDataArrivalTime()
+     */
+    void clearDataArrivalTime();
+
+    /** Returns the time data was first received from the socket since the last call of
+     *  clearDataArrivalTime(), i.e.\ the end of waiting for the peer
+     *  @return The time, see DcmTraceRecorder::now(), 0 if the data read since was
+     *          already buffered
+     */
+    Uint64 getDataArrivalTime() const;
+
+  protected:
+
+    friend class DcmBufferedConnection;
+
+    /** Count a recv() call. Called by the connections.
+     */
+    void countReadCall();
+
+    /** Note that a recv() call returned data. Called by the connections.
+     */
+    void noteDataArrival();
+
+    /** Count bytes received from a socket. Called by the connections.
+     *  @param bytes [in] Number of bytes
+     */
+    void countBytesReceived(const size_t bytes);
+
+    /** Add data received from a socket to the capture (if any). Called by the
+     *  connections.
+     *  @param data   [in] The data
+     *  @param length [in] Number of bytes
+     */
+    void captureData(const void *data, const size_t length);
+
+    /** Count bytes written to a socket. Called by the connections.
+     *  @param bytes [in] Number of bytes
+     */
+    void countBytesSent(const size_t bytes);
+
+    /** Forget about a connection being destroyed. Called by the connections.
+     *  @param connection [in] The connection
+     */
+    void removeConnection(DcmBufferedConnection *connection);
+
+  private:
+
+    /** Get the numeric address of the peer of a socket
+     *  @param socket  [in]  The connected socket
+     *  @param address [out] The IPv4 or IPv6 address
+     *  @return OFTrue if successful, OFFalse otherwise
+     */
+    static OFBool getSocketPeerAddress(int socket,
+                                       OFString &address);
+
+    /// size of the receive buffer of new connections
+    size_t m_bufferSize;
+
+    /// options applied to the socket of new connections
+    DcmSocketOptions m_socketOptions;
+
+    /// counter of recv() calls
+    Uint64 m_readCalls;
+
+    /// counter of bytes received on the current connection
+    Uint64 m_bytesReceived;
+
+    /// counter of bytes sent on the current connection
+    Uint64 m_bytesSent;
+
+    /// time the current connection was handed over after accept(), 0 if none
+    Uint64 m_acceptTime;
+
+    /// time the socket options of the current connection were applied
+    Uint64 m_readyTime;
+
+    /// time data was first received since clearDataArrivalTime(), 0 if not yet
+    Uint64 m_dataArrivalTime;
+
+    /// the connection created last, NULL if already destroyed
+    DcmBufferedConnection *m_connection;
+
+    /// capture of the data received, NULL if none
+    DcmTrafficCapture *m_capture;
+
+    // private undefined copy constructor
+    DcmBufferedTransportLayer(const DcmBufferedTransportLayer &);
+
+    // private undefined assignment operator
+    DcmBufferedTransportLayer &operator=(const DcmBufferedTransportLayer &);
+
+};
+
+#endif // DSCPCONN_H
@@ -0,0 +1,181 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Asynchronous reverse DNS lookup of peer host names
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpdns.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTRING
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+END_EXTERN_C
+
+// maximum number of cached addresses
+#define SCP_DNS_MAX_ENTRIES 4096
+
+// maximum number of addresses waiting for lookup
+#define SCP_DNS_MAX_QUEUE 64
+
+
+DcmHostNameResolver::DcmHostNameResolver()
+  : OFThread()
+  , m_cache()
+  , m_queue()
+  , m_queueLength(0)
+  , m_ttl(SCP_DNS_DEFAULT_TTL)
+  , m_negativeTTL(SCP_DNS_DEFAULT_NEGATIVE_TTL)
+  , m_stop(OFFalse)
+  , m_mutex()
+  , m_semaphore(0)
+{
+}
+
+
+DcmHostNameResolver::~DcmHostNameResolver()
+{
+}
+
+
+void DcmHostNameResolver::setTTL(const Uint32 ttl,
+                                 const Uint32 negativeTTL)
+{
+  m_mutex.lock();
+  m_ttl = ttl;
+  m_negativeTTL = negativeTTL;
+  m_mutex.unlock();
+}
+
+
+OFBool DcmHostNameResolver::lookup(const OFString &address,
+                                   OFString &hostName)
+{
+  if (address.empty())
+    return OFFalse;
+  const time_t now = time(NULL);
+  OFBool found = OFFalse;
+  OFBool queue = OFFalse;
+  m_mutex.lock();
+  OFMap<OFString, CacheEntry>::iterator it = m_cache.find(address);
+  if (it != m_cache.end())
+  {
+    // an expired host name is still used until the lookup has been repeated
+    found = !it->second.hostName.empty();
+    if (found)
+      hostName = it->second.hostName;
+    queue = !it->second.pending && (now >= it->second.expires);
+  }
+  else
+    queue = OFTrue;
+  if (queue && (m_queueLength < SCP_DNS_MAX_QUEUE))
+  {
+    if (it == m_cache.end())
+    {
+      if (m_cache.size() >= SCP_DNS_MAX_ENTRIES)
+        purge(now);
+      m_cache[address].expires = 0;
+    }
+    m_cache[address].pending = OFTrue;
+    m_queue.push_back(address);
+    ++m_queueLength;
+    m_semaphore.post();
+  }
+  m_mutex.unlock();
+  return found;
+}
+
+
+void DcmHostNameResolver::stop()
+{
+  m_mutex.lock();
+  m_stop = OFTrue;
+  m_mutex.unlock();
+  m_semaphore.post();
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmHostNameResolver::run()
+{
+  while (m_semaphore.wait() == 0)
+  {
+    m_mutex.lock();
+    if (m_stop)
+    {
+      m_mutex.unlock();
+      break;
+    }
+    if (m_queue.empty())
+    {
+      m_mutex.unlock();
+      continue;
+    }
+    const OFString address = m_queue.front();
+    m_queue.pop_front();
+    --m_queueLength;
+    m_mutex.unlock();
+
+    // this may take a while if the DNS server is slow, nobody is waiting for it
+    OFString hostName;
+    const OFBool resolved = resolve(address, hostName);
+
+    m_mutex.lock();
+    CacheEntry &entry = m_cache[address];
+    entry.pending = OFFalse;
+    entry.hostName = hostName;
+    entry.expires = time(NULL) + (resolved ? m_ttl : m_negativeTTL);
+    m_mutex.unlock();
+    if (resolved)
+      DCMNET_DEBUG("Resolved host name of " << address << ": " << hostName);
+    else
+      DCMNET_DEBUG("Cannot resolve host name of " << address);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+OFBool DcmHostNameResolver::resolve(const OFString &address,
+                                    OFString &hostName)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_flags = AI_NUMERICHOST;
+  struct addrinfo *result = NULL;
+  if (getaddrinfo(address.c_str(), NULL, &hints, &result) != 0)
+    return OFFalse;
+  char host[NI_MAXHOST];
+  const int status = getnameinfo(result->ai_addr, result->ai_addrlen, host, sizeof(host), NULL, 0, NI_NAMEREQD);
+  freeaddrinfo(result);
+  if (status != 0)
+    return OFFalse;
+  hostName = host;
+  return OFTrue;
+}
+
+
+void DcmHostNameResolver::purge(const time_t now)
+{
+  const size_t size = m_cache.size();
+  OFMap<OFString, CacheEntry>::iterator it = m_cache.begin();
+  while (it != m_cache.end())
+  {
+    if (!it->second.pending && (now >= it->second.expires))
+      m_cache.erase(it++);
+    else
+      ++it;
+  }
+  // nothing expired: start over, queued addresses are added again when resolved
+  if (m_cache.size() == size)
+    m_cache.clear();
+}
@@ -0,0 +1,140 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Asynchronous reverse DNS lookup of peer host names
+ *
+ */
+
+#ifndef DSCPDNS_H
+#define DSCPDNS_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/oflist.h"
+#include "dcmtk/ofstd/ofmap.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofthread.h"
+
+#define INCLUDE_CTIME
+#include "dcmtk/ofstd/ofstdinc.h"
+
+/// default time in seconds a resolved host name is kept
+#define SCP_DNS_DEFAULT_TTL 3600
+
+/// default time in seconds a failed lookup is kept
+#define SCP_DNS_DEFAULT_NEGATIVE_TTL 300
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Background thread resolving the host names of peer addresses. The SCP never waits
+ *  for a lookup: lookup() only consults the cache and, if the address is unknown or
+ *  its entry expired, queues the address for the thread and returns immediately. The
+ *  host name is thus usually missing for the first association of a peer and
+ *  available for all later ones. Failed lookups are cached as well (for a shorter
+ *  time), so a peer without a DNS entry does not cause a query per association. If
+ *  the DNS server is slow, the queue is bounded and further addresses are dropped
+ *  until it drains.
+ */
+class DcmHostNameResolver : public OFThread
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmHostNameResolver();
+
+    /** destructor
+     */
+    virtual ~DcmHostNameResolver();
+
+    /** Set the time resolved host names and failed lookups are kept
+     *  @param ttl         [in] Time in seconds a resolved host name is kept
+     *  @param negativeTTL [in] Time in seconds a failed lookup is kept
+     */
+    void setTTL(const Uint32 ttl,
+                const Uint32 negativeTTL);
+
+    /** Get the host name of an address from the cache. Never blocks on DNS; if the
+     *  address is not in the cache (or its entry expired), it is queued for lookup.
+     *  @param address  [in]  The numeric IPv4 or IPv6 address
+     *  @param hostName [out] The host name, if known
+     *  @return OFTrue if the host name is known, OFFalse otherwise
+     */
+    OFBool lookup(const OFString &address,
+                  OFString &hostName);
+
+    /** Ask the thread to stop after the current lookup
+     */
+    void stop();
+
+  protected:
+
+    /** Resolve queued addresses until stopped
+     */
+    virtual void run();
+
+  private:
+
+    /** Cached result of a lookup
+     */
+    struct CacheEntry
+    {
+      /// the host name, empty if the lookup failed
+      OFString hostName;
+      /// time the entry expires
+      time_t expires;
+      /// OFTrue while the address is queued or being resolved
+      OFBool pending;
+    };
+
+    /** Resolve an address (blocking)
+     *  @param address  [in]  The numeric IPv4 or IPv6 address
+     *  @param hostName [out] The host name
+     *  @return OFTrue if successful, OFFalse otherwise
+     */
+    static OFBool resolve(const OFString &address,
+                          OFString &hostName);
+
+    /** Remove expired entries, or all entries if none is expired. Must be called with
+     *  the mutex locked.
+     *  @param now [in] The current time
+     */
+    void purge(const time_t now);
+
+    /// cached results by address
+    OFMap<OFString, CacheEntry> m_cache;
+
+    /// addresses waiting for lookup
+    OFList<OFString> m_queue;
+
+    /// number of addresses waiting for lookup
+    size_t m_queueLength;
+
+    /// time in seconds a resolved host name is kept
+    Uint32 m_ttl;
+
+    /// time in seconds a failed lookup is kept
+    Uint32 m_negativeTTL;
+
+    /// flag indicating that the thread should stop
+    OFBool m_stop;
+
+    /// mutex protecting cache, queue and flag
+    OFMutex m_mutex;
+
+    /// semaphore counting the queued addresses (and the request to stop)
+    OFSemaphore m_semaphore;
+
+    // private undefined copy constructor
+    DcmHostNameResolver(const DcmHostNameResolver &);
+
+    // private undefined assignment operator
+    DcmHostNameResolver &operator=(const DcmHostNameResolver &);
+
+};
+
+#endif // DSCPDNS_H
@@ -0,0 +1,654 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: In-memory flight recorder of the last associations
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpfrec.h"
+#include "dscpcond.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmnet/dimse.h"
+#include "dcmtk/dcmnet/assoc.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+END_EXTERN_C
+
+
+/// the signals the recorder is dumped on, SIGUSR1 first
+static const int flightSignals[SCP_FLIGHT_SIGNALS] = { SIGUSR1, SIGABRT, SIGSEGV, SIGBUS, SIGFPE };
+
+
+DcmFlightRecorder *DcmFlightRecorder::s_recorder = NULL;
+
+
+// read a clock in microseconds
+static Uint64 readClock(const clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return OFstatic_cast(Uint64, ts.tv_sec) * 1000000 + OFstatic_cast(Uint64, ts.tv_nsec) / 1000;
+}
+
+
+// copy a string into a fixed length field, truncating if necessary
+static void copyString(char *target,
+                       const size_t size,
+                       const char *source)
+{
+  size_t i = 0;
+  if (source != NULL)
+  {
+    for (; (i + 1 < size) && (source[i] != '\0'); ++i)
+      target[i] = source[i];
+  }
+  target[i] = '\0';
+}
+
+
+// name of a DIMSE command field
+static const char *commandName(const Uint16 commandField)
+{
+  switch (commandField)
+  {
+    case DIMSE_C_ECHO_RQ:
+      return "C-ECHO-RQ";
+    case DIMSE_N_EVENT_REPORT_RQ:
+      return "N-EVENT-REPORT-RQ";
+    case DIMSE_N_EVENT_REPORT_RSP:
+      return "N-EVENT-REPORT-RSP";
+    case DIMSE_N_GET_RQ:
+      return "N-GET-RQ";
+    case DIMSE_N_SET_RQ:
+      return "N-SET-RQ";
+    case DIMSE_N_ACTION_RQ:
+      return "N-ACTION-RQ";
+    case DIMSE_N_CREATE_RQ:
+      return "N-CREATE-RQ";
+    case DIMSE_N_DELETE_RQ:
+      return "N-DELETE-RQ";
+    default:
+      return NULL;
+  }
+}
+
+
+// description of the result of a presentation context negotiation
+static const char *contextResultName(const Uint8 result)
+{
+  switch (result)
+  {
+    case ASC_P_ACCEPTANCE:
+      return "accepted";
+    case ASC_P_USERREJECTION:
+      return "rejected by user";
+    case ASC_P_NOREASON:
+      return "rejected, no reason";
+    case ASC_P_ABSTRACTSYNTAXNOTSUPPORTED:
+      return "rejected, abstract syntax not supported";
+    case ASC_P_TRANSFERSYNTAXESNOTSUPPORTED:
+      return "rejected, transfer syntaxes not supported";
+    default:
+      return "not negotiated";
+  }
+}
+
+
+// name of a signal the recorder is dumped on
+static const char *signalName(const int signal)
+{
+  switch (signal)
+  {
+    case SIGUSR1:
+      return "SIGUSR1";
+    case SIGABRT:
+      return "SIGABRT";
+    case SIGSEGV:
+      return "SIGSEGV";
+    case SIGBUS:
+      return "SIGBUS";
+    case SIGFPE:
+      return "SIGFPE";
+    default:
+      return "signal";
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+/** Text output into a buffer on the stack, written to a file descriptor when full.
+ *  Only uses async-signal-safe calls, so it can be used in a signal handler.
+ */
+class DcmFlightDumpWriter
+{
+
+  public:
+
+    /** constructor
+     *  @param fd [in] File descriptor written to
+     */
+    DcmFlightDumpWriter(const int fd)
+      : m_fd(fd)
+      , m_length(0)
+      , m_failed(OFFalse)
+    {
+    }
+
+    /** Append a string
+     *  @param text [in] The string
+     */
+    void put(const char *text)
+    {
+      for (; *text != '\0'; ++text)
+      {
+        if (m_length == sizeof(m_buffer))
+          flush();
+        m_buffer[m_length++] = *text;
+      }
+    }
+
+    /** Append a decimal number
+     *  @param value [in] The number
+     *  @param width [in] Minimum number of digits, padded with zeros
+     */
+    void putNumber(Uint64 value,
+                   const size_t width = 1)
+    {
+      char digits[24];
+      size_t count = 0;
+      do
+      {
+        digits[count++] = OFstatic_cast(char, '0' + value % 10);
+        value /= 10;
+      } while ((value > 0) || (count < width));
+      char text[24];
+      for (size_t i = 0; i < count; ++i)
+        text[i] = digits[count - 1 - i];
+      text[count] = '\0';
+      put(text);
+    }
+
+    /** Append a 16 bit value as 0x and four hex digits
+     *  @param value [in] The value
+     */
+    void putHex(const Uint16 value)
+    {
+      static const char hexDigits[] = "0123456789abcdef";
+      char text[7];
+      text[0] = '0';
+      text[1] = 'x';
+      for (int i = 0; i < 4; ++i)
+        text[2 + i] = hexDigits[(value >> (12 - 4 * i)) & 0x0f];
+      text[6] = '\0';
+      put(text);
+    }
+
+    /** Append a time in microseconds as milliseconds with three decimals
+     *  @param microseconds [in] The time
+     */
+    void putMilliseconds(const Uint64 microseconds)
+    {
+      putNumber(microseconds / 1000);
+      put(".");
+      putNumber(microseconds % 1000, 3);
+      put(" ms");
+    }
+
+    /** Append a wall clock time as UTC date and time
+     *  @param microseconds [in] Microseconds since the epoch
+     */
+    void putDateTime(const Uint64 microseconds)
+    {
+      // gmtime() is not async-signal-safe, so compute the civil date from the day number
+      const Uint64 seconds = microseconds / 1000000;
+      const Uint64 days = seconds / 86400 + 719468;
+      const Uint64 era = days / 146097;
+      const Uint64 dayOfEra = days - era * 146097;
+      const Uint64 yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+      const Uint64 dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+      const Uint64 monthIndex = (5 * dayOfYear + 2) / 153;
+      const Uint64 day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+      const Uint64 month = (monthIndex < 10) ? monthIndex + 3 : monthIndex - 9;
+      const Uint64 year = yearOfEra + era * 400 + ((month <= 2) ? 1 : 0);
+      putNumber(year, 4);
+      put("-");
+      putNumber(month, 2);
+      put("-");
+      putNumber(day, 2);
+      put(" ");
+      putNumber((seconds % 86400) / 3600, 2);
+      put(":");
+      putNumber((seconds % 3600) / 60, 2);
+      put(":");
+      putNumber(seconds % 60, 2);
+      put(".");
+      putNumber(microseconds % 1000000, 6);
+      put(" UTC");
+    }
+
+    /** Write the buffered text
+     *  @return OFTrue if all text has been written so far, OFFalse otherwise
+     */
+    OFBool flush()
+    {
+      size_t offset = 0;
+      while (!m_failed && (offset < m_length))
+      {
+        const ssize_t result = write(m_fd, m_buffer + offset, m_length - offset);
+        if (result > 0)
+          offset += OFstatic_cast(size_t, result);
+        else if ((result < 0) && (errno == EINTR))
+          continue;
+        else
+          m_failed = OFTrue;
+      }
+      m_length = 0;
+      return !m_failed;
+    }
+
+  private:
+
+    /// file descriptor written to
+    int m_fd;
+
+    /// number of bytes in the buffer
+    size_t m_length;
+
+    /// OFTrue if a write has failed
+    OFBool m_failed;
+
+    /// the text not yet written
+    char m_buffer[4096];
+};
+
+// ----------------------------------------------------------------------------
+
+DcmFlightRecorder::DcmFlightRecorder()
+  : m_records(NULL)
+  , m_capacity(0)
+  , m_count(0)
+  , m_association(NULL)
+  , m_command(NULL)
+  , m_commandReceived(0)
+  , m_commandSent(0)
+  , m_filename()
+  , m_tempFilename()
+{
+  memset(m_previousHandlers, 0, sizeof(m_previousHandlers));
+}
+
+
+DcmFlightRecorder::~DcmFlightRecorder()
+{
+  close();
+}
+
+
+OFCondition DcmFlightRecorder::open(const OFString &filename,
+                                    const Uint32 capacity)
+{
+  close();
+  if (filename.empty() || (capacity == 0))
+    return SCP_EC_FlightRecorderError;
+  if ((s_recorder != NULL) && (s_recorder != this))
+  {
+    DCMNET_ERROR("another flight recorder is already open");
+    return SCP_EC_FlightRecorderError;
+  }
+  m_records = new DcmFlightAssociation[capacity];
+  memset(m_records, 0, sizeof(DcmFlightAssociation) * capacity);
+  m_capacity = capacity;
+  m_count = 0;
+  m_association = NULL;
+  m_command = NULL;
+  m_filename = filename;
+  m_tempFilename = filename + ".tmp";
+
+  // the handler must not be interrupted by another signal of the recorder, and
+  // restores the default action of fatal signals so that they can be raised again
+  s_recorder = this;
+  for (size_t i = 0; i < SCP_FLIGHT_SIGNALS; ++i)
+  {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signalHandler;
+    sigemptyset(&action.sa_mask);
+    for (size_t j = 0; j < SCP_FLIGHT_SIGNALS; ++j)
+      sigaddset(&action.sa_mask, flightSignals[j]);
+    action.sa_flags = (flightSignals[i] == SIGUSR1) ? SA_RESTART : SA_RESETHAND;
+    if (sigaction(flightSignals[i], &action, &m_previousHandlers[i]) != 0)
+    {
+      char buf[256];
+      DCMNET_ERROR("cannot install handler of " << signalName(flightSignals[i]) << ": "
+        << OFStandard::strerror(errno, buf, sizeof(buf)));
+      // restore the handlers installed so far
+      while (i-- > 0)
+        sigaction(flightSignals[i], &m_previousHandlers[i], NULL);
+      s_recorder = NULL;
+      delete[] m_records;
+      m_records = NULL;
+      m_capacity = 0;
+      return SCP_EC_FlightRecorderError;
+    }
+  }
+  DCMNET_DEBUG("flight recorder keeps the last " << capacity << " associations, dumped to "
+    << filename << " on SIGUSR1");
+  return EC_Normal;
+}
+
+
+void DcmFlightRecorder::close()
+{
+  if (m_records == NULL)
+    return;
+  for (size_t i = 0; i < SCP_FLIGHT_SIGNALS; ++i)
+    sigaction(flightSignals[i], &m_previousHandlers[i], NULL);
+  s_recorder = NULL;
+  delete[] m_records;
+  m_records = NULL;
+  m_capacity = 0;
+  m_association = NULL;
+  m_command = NULL;
+}
+
+
+OFBool DcmFlightRecorder::isOpen() const
+{
+  return m_records != NULL;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmFlightRecorder::beginAssociation(const char *peerAddress,
+                                         const char *callingAETitle,
+                                         const char *calledAETitle)
+{
+  if (m_records == NULL)
+    return;
+  // the previous association should have been ended already
+  if (m_association != NULL)
+  {
+    if (m_association->outcome == NULL)
+      m_association->outcome = "dropped";
+    m_association->endTime = readClock(CLOCK_MONOTONIC);
+  }
+  DcmFlightAssociation *record = &m_records[m_count % m_capacity];
+  // invalidate the record while it is reused, so that a dump skips it
+  record->sequence = 0;
+  record->wallTime = readClock(CLOCK_REALTIME);
+  record->startTime = readClock(CLOCK_MONOTONIC);
+  record->endTime = 0;
+  record->bytesReceived = 0;
+  record->bytesSent = 0;
+  record->outcome = NULL;
+  copyString(record->peerAddress, sizeof(record->peerAddress), peerAddress);
+  copyString(record->callingAETitle, sizeof(record->callingAETitle), callingAETitle);
+  copyString(record->calledAETitle, sizeof(record->calledAETitle), calledAETitle);
+  record->contextCount = 0;
+  record->commandCount = 0;
+  record->sequence = ++m_count;
+  m_association = record;
+  m_command = NULL;
+}
+
+
+void DcmFlightRecorder::addContext(const Uint8 presentationContextID,
+                                   const Uint8 result,
+                                   const char *abstractSyntax,
+                                   const char *transferSyntax)
+{
+  if (m_association == NULL)
+    return;
+  if (m_association->contextCount < SCP_FLIGHT_MAX_CONTEXTS)
+  {
+    DcmFlightContext &context = m_association->contexts[m_association->contextCount];
+    context.presentationContextID = presentationContextID;
+    context.result = result;
+    copyString(context.abstractSyntax, sizeof(context.abstractSyntax), abstractSyntax);
+    copyString(context.transferSyntax, sizeof(context.transferSyntax), transferSyntax);
+  }
+  ++m_association->contextCount;
+}
+
+
+void DcmFlightRecorder::setOutcome(const char *outcome)
+{
+  if (m_association != NULL)
+    m_association->outcome = outcome;
+}
+
+
+void DcmFlightRecorder::beginCommand(const Uint16 commandField,
+                                     const Uint16 messageID,
+                                     const Uint8 presentationContextID,
+                                     const Uint64 bytesReceived,
+                                     const Uint64 bytesSent)
+{
+  if (m_association == NULL)
+    return;
+  DcmFlightCommand *command = &m_association->commands[m_association->commandCount % SCP_FLIGHT_MAX_COMMANDS];
+  command->startTime = readClock(CLOCK_MONOTONIC);
+  command->duration = 0;
+  command->bytesReceived = 0;
+  command->bytesSent = 0;
+  command->commandField = commandField;
+  command->messageID = messageID;
+  command->status = 0;
+  command->presentationContextID = presentationContextID;
+  command->hasStatus = 0;
+  command->complete = 0;
+  ++m_association->commandCount;
+  m_command = command;
+  m_commandReceived = bytesReceived;
+  m_commandSent = bytesSent;
+}
+
+
+void DcmFlightRecorder::setStatus(const Uint16 status)
+{
+  if (m_command == NULL)
+    return;
+  m_command->status = status;
+  m_command->hasStatus = 1;
+}
+
+
+void DcmFlightRecorder::endCommand(const Uint64 bytesReceived,
+                                   const Uint64 bytesSent)
+{
+  if (m_command == NULL)
+    return;
+  m_command->duration = OFstatic_cast(Uint32, readClock(CLOCK_MONOTONIC) - m_command->startTime);
+  m_command->bytesReceived = OFstatic_cast(Uint32, bytesReceived - m_commandReceived);
+  m_command->bytesSent = OFstatic_cast(Uint32, bytesSent - m_commandSent);
+  m_command->complete = 1;
+  m_command = NULL;
+}
+
+
+void DcmFlightRecorder::endAssociation(const Uint64 bytesReceived,
+                                       const Uint64 bytesSent)
+{
+  if (m_association == NULL)
+    return;
+  endCommand(bytesReceived, bytesSent);
+  m_association->bytesReceived = bytesReceived;
+  m_association->bytesSent = bytesSent;
+  if (m_association->outcome == NULL)
+    m_association->outcome = "dropped";
+  m_association->endTime = readClock(CLOCK_MONOTONIC);
+  m_association = NULL;
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmFlightRecorder::dump(const int signal) const
+{
+  if (m_records == NULL)
+    return SCP_EC_FlightRecorderError;
+  // write to a temporary file first, so that a complete dump is never seen half written
+  const int fd = ::open(m_tempFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return SCP_EC_FlightRecorderError;
+  const Uint64 now = readClock(CLOCK_MONOTONIC);
+  const Uint64 kept = (m_count < m_capacity) ? m_count : m_capacity;
+  DcmFlightDumpWriter out(fd);
+  out.put("flight recorder of process ");
+  out.putNumber(OFstatic_cast(Uint64, getpid()));
+  out.put(", dumped ");
+  if (signal != 0)
+  {
+    out.put("on ");
+    out.put(signalName(signal));
+    out.put(" ");
+  }
+  out.put("at ");
+  out.putDateTime(readClock(CLOCK_REALTIME));
+  out.put("\n");
+  out.putNumber(m_count);
+  out.put(" associations recorded, the last ");
+  out.putNumber(kept);
+  out.put(" kept\n");
+
+  for (Uint64 sequence = m_count - kept + 1; sequence <= m_count; ++sequence)
+  {
+    const DcmFlightAssociation &record = m_records[(sequence - 1) % m_capacity];
+    if (record.sequence != sequence)
+      continue;
+    out.put("\nassociation ");
+    out.putNumber(record.sequence);
+    out.put(", ");
+    out.putDateTime(record.wallTime);
+    if (record.endTime != 0)
+    {
+      out.put(", ");
+      out.put(record.outcome);
+      out.put(" after ");
+      out.putMilliseconds(record.endTime - record.startTime);
+    }
+    else
+    {
+      out.put(", in progress for ");
+      out.putMilliseconds(now - record.startTime);
+    }
+    out.put("\n  peer ");
+    out.put(record.peerAddress);
+    out.put(", calling AE title \"");
+    out.put(record.callingAETitle);
+    out.put("\", called AE title \"");
+    out.put(record.calledAETitle);
+    out.put("\"\n");
+    if (record.endTime != 0)
+    {
+      out.put("  ");
+      out.putNumber(record.bytesReceived);
+      out.put(" bytes received, ");
+      out.putNumber(record.bytesSent);
+      out.put(" bytes sent\n");
+    }
+
+    const Uint32 contexts = (record.contextCount < SCP_FLIGHT_MAX_CONTEXTS) ? record.contextCount : SCP_FLIGHT_MAX_CONTEXTS;
+    for (Uint32 i = 0; i < contexts; ++i)
+    {
+      const DcmFlightContext &context = record.contexts[i];
+      out.put("  presentation context ");
+      out.putNumber(context.presentationContextID);
+      out.put(": ");
+      out.put(context.abstractSyntax);
+      if (context.transferSyntax[0] != '\0')
+      {
+        out.put(" with ");
+        out.put(context.transferSyntax);
+      }
+      out.put(", ");
+      out.put(contextResultName(context.result));
+      out.put("\n");
+    }
+    if (record.contextCount > contexts)
+    {
+      out.put("  ");
+      out.putNumber(record.contextCount - contexts);
+      out.put(" further presentation contexts not kept\n");
+    }
+
+    const Uint32 commands = (record.commandCount < SCP_FLIGHT_MAX_COMMANDS) ? record.commandCount : SCP_FLIGHT_MAX_COMMANDS;
+    out.put("  ");
+    out.putNumber(record.commandCount);
+    out.put(" commands received");
+    if (record.commandCount > commands)
+    {
+      out.put(", the last ");
+      out.putNumber(commands);
+      out.put(" kept");
+    }
+    out.put("\n");
+    for (Uint32 n = record.commandCount - commands + 1; n <= record.commandCount; ++n)
+    {
+      const DcmFlightCommand &command = record.commands[(n - 1) % SCP_FLIGHT_MAX_COMMANDS];
+      out.put("    +");
+      out.putMilliseconds(command.startTime - record.startTime);
+      out.put(" ");
+      const char *name = commandName(command.commandField);
+      if (name != NULL)
+        out.put(name);
+      else
+        out.putHex(command.commandField);
+      out.put(" message ID ");
+      out.putNumber(command.messageID);
+      out.put(" on presentation context ");
+      out.putNumber(command.presentationContextID);
+      if (command.hasStatus)
+      {
+        out.put(", status ");
+        out.putHex(command.status);
+      }
+      else
+        out.put(", no response");
+      if (command.complete)
+      {
+        out.put(", ");
+        out.putMilliseconds(command.duration);
+        out.put(", ");
+        out.putNumber(command.bytesReceived);
+        out.put(" bytes received, ");
+        out.putNumber(command.bytesSent);
+        out.put(" bytes sent\n");
+      }
+      else
+        out.put(", in progress\n");
+    }
+  }
+
+  const OFBool written = out.flush();
+  if ((::close(fd) != 0) || !written || (rename(m_tempFilename.c_str(), m_filename.c_str()) != 0))
+  {
+    unlink(m_tempFilename.c_str());
+    return SCP_EC_FlightRecorderError;
+  }
+  return EC_Normal;
+}
+
+
+void DcmFlightRecorder::signalHandler(int signal)
+{
+  const int savedErrno = errno;
+  if (s_recorder != NULL)
+    (void) s_recorder->dump(signal);
+  errno = savedErrno;
+  // the default action has been restored for fatal signals, raise it again to
+  // terminate (and dump core) as without the recorder
+  if (signal != SIGUSR1)
+    raise(signal);
+}
@@ -0,0 +1,267 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: In-memory flight recorder of the last associations
+ *
+ */
+
+#ifndef DSCPFREC_H
+#define DSCPFREC_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+
+#define INCLUDE_CSIGNAL
+#include "dcmtk/ofstd/ofstdinc.h"
+
+/// default number of associations kept by the flight recorder
+#define SCP_FLIGHT_DEFAULT_CAPACITY 64
+
+/// number of presentation contexts kept per association, further ones are only counted
+#define SCP_FLIGHT_MAX_CONTEXTS 16
+
+/// number of DIMSE commands kept per association, older ones are overwritten
+#define SCP_FLIGHT_MAX_COMMANDS 64
+
+/// number of signals the flight recorder is dumped on
+#define SCP_FLIGHT_SIGNALS 5
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** A presentation context of an association kept by the flight recorder
+ */
+struct DcmFlightContext
+{
+  /// presentation context ID
+  Uint8 presentationContextID;
+  /// result of the negotiation (ASC_P_ACCEPTANCE etc.)
+  Uint8 result;
+  /// abstract syntax UID
+  char abstractSyntax[65];
+  /// accepted transfer syntax UID, empty if rejected
+  char transferSyntax[65];
+};
+
+
+/** A DIMSE command of an association kept by the flight recorder
+ */
+struct DcmFlightCommand
+{
+  /// time the command was received in microseconds (monotonic clock)
+  Uint64 startTime;
+  /// time from receiving the command to the end of its handling in microseconds
+  Uint32 duration;
+  /// bytes received from the socket for the command and its dataset
+  Uint32 bytesReceived;
+  /// bytes sent to the socket for the response (and any other messages sent meanwhile)
+  Uint32 bytesSent;
+  /// command field (e.g.\ DIMSE_N_CREATE_RQ)
+  Uint16 commandField;
+  /// message ID of the command
+  Uint16 messageID;
+  /// status of the response, see hasStatus
+  Uint16 status;
+  /// presentation context ID the command was received on
+  Uint8 presentationContextID;
+  /// 1 if a response has been sent, 0 otherwise
+  Uint8 hasStatus;
+  /// 1 if the handling of the command has ended, 0 while in progress
+  Uint8 complete;
+};
+
+
+/** An association kept by the flight recorder. All strings are stored with fixed
+ *  length, so that recording never allocates memory.
+ */
+struct DcmFlightAssociation
+{
+  /// number of the association since the recorder was opened, starting with 1; 0 while
+  /// the record is being reused
+  Uint64 sequence;
+  /// time the association was accepted (microseconds since the epoch)
+  Uint64 wallTime;
+  /// time the association was accepted in microseconds (monotonic clock)
+  Uint64 startTime;
+  /// time the association was terminated in microseconds, 0 while in progress
+  Uint64 endTime;
+  /// bytes received from the socket
+  Uint64 bytesReceived;
+  /// bytes sent to the socket
+  Uint64 bytesSent;
+  /// how the association ended (a string literal), NULL while in progress
+  const char *outcome;
+  /// numeric address of the peer
+  char peerAddress[49];
+  /// calling AE title
+  char callingAETitle[17];
+  /// called AE title
+  char calledAETitle[17];
+  /// number of presentation contexts negotiated, the first SCP_FLIGHT_MAX_CONTEXTS are kept
+  Uint32 contextCount;
+  /// the presentation contexts
+  DcmFlightContext contexts[SCP_FLIGHT_MAX_CONTEXTS];
+  /// number of commands received, the last SCP_FLIGHT_MAX_COMMANDS are kept
+  Uint32 commandCount;
+  /// the commands, command n at index (n - 1) % SCP_FLIGHT_MAX_COMMANDS
+  DcmFlightCommand commands[SCP_FLIGHT_MAX_COMMANDS];
+};
+
+
+/** Flight recorder of the last associations handled by the SCP. The records of a fixed
+ *  number of associations are allocated once by open(); recording copies a few values
+ *  into them without any allocation, system call (apart from reading the clocks) or
+ *  formatting. The oldest association is overwritten once all records are in use.
+ *  The records are written as text to a file on SIGUSR1 and when the process is killed
+ *  by SIGABRT, SIGSEGV, SIGBUS or SIGFPE. The dump only uses async-signal-safe calls.
+ *  Since the records are updated without locking, an association interrupted by the
+ *  signal may be dumped half updated. Only one recorder can be open per process.
+ */
+class DcmFlightRecorder
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmFlightRecorder();
+
+    /** destructor, closes the recorder
+     */
+    ~DcmFlightRecorder();
+
+    /** Allocate the records and install the signal handlers
+     *  @param filename [in] File the records are written to on a signal. It is
+     *                       replaced by each dump.
+     *  @param capacity [in] Number of associations kept
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition open(const OFString &filename,
+                     const Uint32 capacity);
+
+    /** Restore the previous signal handlers and release the records
+     */
+    void close();
+
+    /** Returns whether the recorder is open
+     *  @return OFTrue if open, OFFalse otherwise
+     */
+    OFBool isOpen() const;
+
+    /** Start the record of a new association, overwriting the oldest one if necessary
+     *  @param peerAddress    [in] Numeric address of the peer
+     *  @param callingAETitle [in] Calling AE title
+     *  @param calledAETitle  [in] Called AE title
+     */
+    void beginAssociation(const char *peerAddress,
+                          const char *callingAETitle,
+                          const char *calledAETitle);
+
+    /** Add a negotiated presentation context to the current association
+     *  @param presentationContextID [in] Presentation context ID
+     *  @param result                [in] Result of the negotiation
+     *  @param abstractSyntax        [in] Abstract syntax UID
+     *  @param transferSyntax        [in] Accepted transfer syntax UID, empty if rejected
+     */
+    void addContext(const Uint8 presentationContextID,
+                    const Uint8 result,
+                    const char *abstractSyntax,
+                    const char *transferSyntax);
+
+    /** Set how the current association ended, e.g.\ "released"
+     *  @param outcome [in] The outcome, must be a string literal
+     */
+    void setOutcome(const char *outcome);
+
+    /** Start the record of a command received on the current association
+     *  @param commandField          [in] Command field
+     *  @param messageID             [in] Message ID
+     *  @param presentationContextID [in] Presentation context ID
+     *  @param bytesReceived         [in] Bytes received on the connection before the
+     *                                    command
+     *  @param bytesSent             [in] Bytes sent on the connection before the command
+     */
+    void beginCommand(const Uint16 commandField,
+                      const Uint16 messageID,
+                      const Uint8 presentationContextID,
+                      const Uint64 bytesReceived,
+                      const Uint64 bytesSent);
+
+    /** Set the status of the response to the current command
+     *  @param status [in] The status
+     */
+    void setStatus(const Uint16 status);
+
+    /** End the record of the current command
+     *  @param bytesReceived [in] Bytes received on the connection so far
+     *  @param bytesSent     [in] Bytes sent on the connection so far
+     */
+    void endCommand(const Uint64 bytesReceived,
+                    const Uint64 bytesSent);
+
+    /** End the record of the current association. If no outcome was set, it is
+     *  recorded as "dropped".
+     *  @param bytesReceived [in] Bytes received on the connection of the association
+     *  @param bytesSent     [in] Bytes sent on the connection of the association
+     */
+    void endAssociation(const Uint64 bytesReceived,
+                        const Uint64 bytesSent);
+
+    /** Write all associations kept to the file. Only uses async-signal-safe calls.
+     *  @param signal [in] Signal the dump is written on, 0 if requested otherwise
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition dump(const int signal = 0) const;
+
+  private:
+
+    /// private undefined copy constructor
+    DcmFlightRecorder(const DcmFlightRecorder &);
+
+    /// private undefined assignment operator
+    DcmFlightRecorder &operator=(const DcmFlightRecorder &);
+
+    /** Handler of the signals the recorder is dumped on
+     *  @param signal [in] The signal
+     */
+    static void signalHandler(int signal);
+
+    /// the records, NULL if not open
+    DcmFlightAssociation *m_records;
+
+    /// number of records
+    Uint32 m_capacity;
+
+    /// number of associations recorded
+    Uint64 m_count;
+
+    /// record of the current association, NULL if none
+    DcmFlightAssociation *m_association;
+
+    /// record of the current command, NULL if none
+    DcmFlightCommand *m_command;
+
+    /// bytes received on the connection at the start of the current command
+    Uint64 m_commandReceived;
+
+    /// bytes sent on the connection at the start of the current command
+    Uint64 m_commandSent;
+
+    /// file the records are written to
+    OFString m_filename;
+
+    /// temporary file the records are written to before being renamed
+    OFString m_tempFilename;
+
+    /// signal handlers replaced by open()
+    struct sigaction m_previousHandlers[SCP_FLIGHT_SIGNALS];
+
+    /// the open recorder, NULL if none
+    static DcmFlightRecorder *s_recorder;
+};
+
+#endif // DSCPFREC_H
@@ -0,0 +1,494 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Counters and latency histograms served in Prometheus text format
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpmetr.h"
+#include "dscpcond.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/ofstd/ofstream.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// number of sub-buckets per power of 2
+#define SCP_METRICS_SUB_BUCKETS (1 << SCP_METRICS_SUB_BUCKET_BITS)
+
+// interval in milliseconds at which the server checks whether it should stop
+#define SCP_METRICS_POLL_INTERVAL 1000
+
+// time in milliseconds a client may take to send its request
+#define SCP_METRICS_REQUEST_TIMEOUT 1000
+
+// maximum size of a request in bytes
+#define SCP_METRICS_MAX_REQUEST 4096
+
+
+DcmLatencyHistogram::DcmLatencyHistogram()
+  : m_count(0)
+  , m_sum(0)
+{
+  for (size_t i = 0; i < SCP_METRICS_BUCKETS; ++i)
+    m_buckets[i] = 0;
+}
+
+
+void DcmLatencyHistogram::record(const Uint64 value)
+{
+  __sync_fetch_and_add(&m_buckets[getIndex(value)], 1);
+  __sync_fetch_and_add(&m_sum, value);
+  __sync_fetch_and_add(&m_count, 1);
+}
+
+
+Uint64 DcmLatencyHistogram::getCount() const
+{
+  return m_count;
+}
+
+
+Uint64 DcmLatencyHistogram::getSum() const
+{
+  return m_sum;
+}
+
+
+Uint64 DcmLatencyHistogram::getQuantile(const double quantile) const
+{
+  // the buckets are read one by one while values may still be recorded, so their
+  // total is used rather than the count
+  Uint64 total = 0;
+  for (size_t i = 0; i < SCP_METRICS_BUCKETS; ++i)
+    total += m_buckets[i];
+  if (total == 0)
+    return 0;
+  Uint64 rank = OFstatic_cast(Uint64, quantile * OFstatic_cast(double, total) + 0.5);
+  if (rank < 1)
+    rank = 1;
+  Uint64 seen = 0;
+  for (size_t i = 0; i < SCP_METRICS_BUCKETS; ++i)
+  {
+    seen += m_buckets[i];
+    if (seen >= rank)
+      return getUpperBound(i);
+  }
+  return getUpperBound(SCP_METRICS_BUCKETS - 1);
+}
+
+
+size_t DcmLatencyHistogram::getIndex(const Uint64 value)
+{
+  if (value < SCP_METRICS_SUB_BUCKETS)
+    return OFstatic_cast(size_t, value);
+  int exponent = SCP_METRICS_SUB_BUCKET_BITS;
+  while ((exponent < 63) && ((value >> (exponent + 1)) != 0))
+    ++exponent;
+  if (exponent > SCP_METRICS_MAX_EXPONENT)
+    return SCP_METRICS_BUCKETS - 1;
+  const size_t shift = exponent - SCP_METRICS_SUB_BUCKET_BITS;
+  return OFstatic_cast(size_t, (shift + 1) * SCP_METRICS_SUB_BUCKETS +
+    ((value >> shift) & (SCP_METRICS_SUB_BUCKETS - 1)));
+}
+
+
+Uint64 DcmLatencyHistogram::getUpperBound(const size_t index)
+{
+  if (index < SCP_METRICS_SUB_BUCKETS)
+    return index;
+  const size_t shift = index / SCP_METRICS_SUB_BUCKETS - 1;
+  const Uint64 lower = OFstatic_cast(Uint64, SCP_METRICS_SUB_BUCKETS + index % SCP_METRICS_SUB_BUCKETS) << shift;
+  return lower + (OFstatic_cast(Uint64, 1) << shift) - 1;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMetricsRegistry::DcmMetricsRegistry()
+  : m_families()
+  , m_seriesCount(0)
+  , m_mutex()
+{
+}
+
+
+DcmMetricsRegistry::~DcmMetricsRegistry()
+{
+  OFMap<OFString, Family>::iterator family = m_families.begin();
+  while (family != m_families.end())
+  {
+    OFMap<OFString, Series *>::iterator it = family->second.series.begin();
+    while (it != family->second.series.end())
+    {
+      delete it->second->histogram;
+      delete it->second;
+      ++it;
+    }
+    ++family;
+  }
+}
+
+
+void DcmMetricsRegistry::describe(const OFString &name,
+                                  const OFString &help)
+{
+  m_mutex.lock();
+  m_families[name].help = help;
+  m_mutex.unlock();
+}
+
+
+void DcmMetricsRegistry::increment(const OFString &name,
+                                   const OFString &labels,
+                                   const Uint64 value)
+{
+  Series *series = getSeries(name, labels, OFFalse);
+  if (series != NULL)
+    __sync_fetch_and_add(&series->value, value);
+}
+
+
+volatile Uint64 *DcmMetricsRegistry::getCounter(const OFString &name,
+                                                const OFString &labels)
+{
+  // series are only deleted with the registry
+  Series *series = getSeries(name, labels, OFFalse);
+  return (series != NULL) ? &series->value : NULL;
+}
+
+
+void DcmMetricsRegistry::increment(volatile Uint64 *counter,
+                                   const Uint64 value)
+{
+  if (counter != NULL)
+    __sync_fetch_and_add(counter, value);
+}
+
+
+void DcmMetricsRegistry::observe(const OFString &name,
+                                 const OFString &labels,
+                                 const Uint64 microseconds)
+{
+  Series *series = getSeries(name, labels, OFTrue);
+  if (series != NULL)
+    series->histogram->record(microseconds);
+}
+
+
+void DcmMetricsRegistry::format(OFString &text)
+{
+  static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  OFOStringStream stream;
+  m_mutex.lock();
+  OFMap<OFString, Family>::iterator family = m_families.begin();
+  while (family != m_families.end())
+  {
+    const OFString &name = family->first;
+    const Family &metric = family->second;
+    if (metric.series.empty())
+    {
+      ++family;
+      continue;
+    }
+    if (!metric.help.empty())
+      stream << "# HELP " << name << " " << metric.help << "\n";
+    stream << "# TYPE " << name << (metric.summary ? " summary" : " counter") << "\n";
+    OFMap<OFString, Series *>::const_iterator it = metric.series.begin();
+    while (it != metric.series.end())
+    {
+      const OFString &labels = it->first;
+      if (metric.summary)
+      {
+        const DcmLatencyHistogram &histogram = *it->second->histogram;
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i)
+        {
+          stream << name << "{" << labels << (labels.empty() ? "" : ",") << "quantile=\"" << quantiles[i] << "\"} "
+                 << OFstatic_cast(double, histogram.getQuantile(quantiles[i])) / 1e6 << "\n";
+        }
+        const OFString suffix = labels.empty() ? OFString() : "{" + labels + "}";
+        stream << name << "_sum" << suffix << " " << OFstatic_cast(double, histogram.getSum()) / 1e6 << "\n";
+        stream << name << "_count" << suffix << " " << histogram.getCount() << "\n";
+      }
+      else
+      {
+        stream << name;
+        if (!labels.empty())
+          stream << "{" << labels << "}";
+        stream << " " << it->second->value << "\n";
+      }
+      ++it;
+    }
+    ++family;
+  }
+  m_mutex.unlock();
+  stream << OFStringStream_ends;
+  OFSTRINGSTREAM_GETOFSTRING(stream, result)
+  text = result;
+}
+
+
+void DcmMetricsRegistry::addLabel(OFString &labels,
+                                  const char *name,
+                                  const OFString &value)
+{
+  if (!labels.empty())
+    labels += ',';
+  labels += name;
+  labels += "=\"";
+  // AE titles are padded with trailing spaces
+  const size_t last = value.find_last_not_of(' ');
+  const size_t length = (last == OFString_npos) ? 0 : last + 1;
+  for (size_t i = 0; i < length; ++i)
+  {
+    const char c = value[i];
+    if (c == '\\')
+      labels += "\\\\";
+    else if (c == '"')
+      labels += "\\\"";
+    else if (c == '\n')
+      labels += "\\n";
+    else
+      labels += c;
+  }
+  labels += '"';
+}
+
+
+Uint64 DcmMetricsRegistry::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return OFstatic_cast(Uint64, ts.tv_sec) * 1000000 + OFstatic_cast(Uint64, ts.tv_nsec / 1000);
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMetricsRegistry::Series *DcmMetricsRegistry::getSeries(const OFString &name,
+                                                          const OFString &labels,
+                                                          const OFBool summary)
+{
+  Series *series = NULL;
+  m_mutex.lock();
+  Family &family = m_families[name];
+  if (family.series.empty())
+    family.summary = summary;
+  if (family.summary == summary)
+  {
+    OFMap<OFString, Series *>::iterator it = family.series.find(labels);
+    if (it != family.series.end())
+      series = it->second;
+    else
+    {
+      // too many label combinations: count them all in one series
+      const OFString key = (m_seriesCount < SCP_METRICS_MAX_SERIES) ? labels : OFString("overflow=\"true\"");
+      it = family.series.find(key);
+      if (it != family.series.end())
+        series = it->second;
+      else
+      {
+        series = new Series;
+        series->value = 0;
+        series->histogram = summary ? new DcmLatencyHistogram() : NULL;
+        family.series[key] = series;
+        ++m_seriesCount;
+      }
+    }
+  }
+  m_mutex.unlock();
+  return series;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMetricsServer::DcmMetricsServer(DcmMetricsRegistry &registry)
+  : OFThread()
+  , m_registry(registry)
+  , m_listenSocket(-1)
+  , m_socketPath()
+  , m_stop(OFFalse)
+  , m_mutex()
+{
+}
+
+
+DcmMetricsServer::~DcmMetricsServer()
+{
+  if (m_listenSocket >= 0)
+  {
+    ::close(m_listenSocket);
+    if (!m_socketPath.empty())
+      unlink(m_socketPath.c_str());
+  }
+}
+
+
+OFCondition DcmMetricsServer::openPort(const Uint16 port)
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  // only serve local clients, e.g. a node exporter or a scraping agent
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const int reuse = 1;
+  m_listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+  if ((m_listenSocket < 0) ||
+      (setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) ||
+      (bind(m_listenSocket, OFreinterpret_cast(struct sockaddr *, &addr), sizeof(addr)) != 0) ||
+      (::listen(m_listenSocket, SOMAXCONN) != 0))
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot listen on metrics port " << port << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    if (m_listenSocket >= 0)
+      ::close(m_listenSocket);
+    m_listenSocket = -1;
+    return SCP_EC_MetricsError;
+  }
+  DCMNET_INFO("serving metrics on http://127.0.0.1:" << port << "/metrics");
+  return EC_Normal;
+}
+
+
+OFCondition DcmMetricsServer::openSocket(const OFString &path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.length() >= sizeof(addr.sun_path))
+  {
+    DCMNET_ERROR("metrics socket path too long: " << path);
+    return SCP_EC_MetricsError;
+  }
+  OFStandard::strlcpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path));
+
+  // remove a stale socket left behind by a previous run
+  unlink(path.c_str());
+  m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((m_listenSocket < 0) ||
+      (bind(m_listenSocket, OFreinterpret_cast(struct sockaddr *, &addr), sizeof(addr)) != 0) ||
+      (::listen(m_listenSocket, SOMAXCONN) != 0))
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot listen on metrics socket " << path << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    if (m_listenSocket >= 0)
+      ::close(m_listenSocket);
+    m_listenSocket = -1;
+    return SCP_EC_MetricsError;
+  }
+  m_socketPath = path;
+  DCMNET_INFO("serving metrics on " << path);
+  return EC_Normal;
+}
+
+
+void DcmMetricsServer::stop()
+{
+  m_mutex.lock();
+  m_stop = OFTrue;
+  m_mutex.unlock();
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMetricsServer::run()
+{
+  while (!stopRequested())
+  {
+    struct pollfd pfd;
+    pfd.fd = m_listenSocket;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if ((poll(&pfd, 1, SCP_METRICS_POLL_INTERVAL) > 0) && (pfd.revents & POLLIN))
+    {
+      const int fd = accept(m_listenSocket, NULL, NULL);
+      if (fd >= 0)
+      {
+        serve(fd);
+        ::close(fd);
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMetricsServer::serve(const int fd)
+{
+  // read the request line and headers, the body (if any) is ignored
+  char request[SCP_METRICS_MAX_REQUEST + 1];
+  size_t length = 0;
+  while (length < SCP_METRICS_MAX_REQUEST)
+  {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, SCP_METRICS_REQUEST_TIMEOUT) <= 0)
+      return;
+    const ssize_t result = recv(fd, request + length, SCP_METRICS_MAX_REQUEST - length, 0);
+    if (result <= 0)
+      return;
+    length += OFstatic_cast(size_t, result);
+    request[length] = '\0';
+    if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+      break;
+  }
+  request[length] = '\0';
+
+  OFString status = "200 OK";
+  OFString body;
+  if (strncmp(request, "GET ", 4) != 0)
+    status = "405 Method Not Allowed";
+  else
+  {
+    const char *path = request + 4;
+    const size_t pathLength = strcspn(path, " ?\r\n");
+    if (((pathLength == 8) && (strncmp(path, "/metrics", 8) == 0)) || ((pathLength == 1) && (path[0] == '/')))
+      m_registry.format(body);
+    else
+      status = "404 Not Found";
+  }
+
+  char header[200];
+  sprintf(header, "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+    status.c_str(), OFstatic_cast(unsigned long, body.length()));
+  const OFString response = OFString(header) + body;
+  size_t written = 0;
+  while (written < response.length())
+  {
+    const ssize_t result = send(fd, response.c_str() + written, response.length() - written, MSG_NOSIGNAL);
+    if (result <= 0)
+    {
+      if ((result < 0) && (errno == EINTR))
+        continue;
+      return;
+    }
+    written += OFstatic_cast(size_t, result);
+  }
+}
+
+
+OFBool DcmMetricsServer::stopRequested()
+{
+  m_mutex.lock();
+  const OFBool stop = m_stop;
+  m_mutex.unlock();
+  return stop;
+}
@@ -0,0 +1,312 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Counters and latency histograms served in Prometheus text format
+ *
+ */
+
+#ifndef DSCPMETR_H
+#define DSCPMETR_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofmap.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofthread.h"
+
+/// number of bits of a value kept exactly by a histogram bucket (relative error 1/16)
+#define SCP_METRICS_SUB_BUCKET_BITS 4
+
+/// largest power of 2 (in microseconds) distinguished by a histogram, about 25 days
+#define SCP_METRICS_MAX_EXPONENT 41
+
+/// number of buckets of a histogram
+#define SCP_METRICS_BUCKETS ((SCP_METRICS_MAX_EXPONENT - SCP_METRICS_SUB_BUCKET_BITS + 2) << SCP_METRICS_SUB_BUCKET_BITS)
+
+/// maximum number of series (metric and label combinations) kept
+#define SCP_METRICS_MAX_SERIES 4096
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Latency histogram with logarithmic buckets, each power of 2 being divided into
+ *  16 linear sub-buckets (as in HdrHistogram). Values are microseconds; quantiles are
+ *  reported with a relative error of at most 1/16. Recording a value is a few atomic
+ *  additions and never blocks, so a histogram can be read by another thread while
+ *  it is being updated.
+ */
+class DcmLatencyHistogram
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmLatencyHistogram();
+
+    /** Record a value
+     *  @param value [in] The value in microseconds
+     */
+    void record(const Uint64 value);
+
+    /** Returns the number of values recorded
+     *  @return The number of values
+     */
+    Uint64 getCount() const;
+
+    /** Returns the sum of the values recorded
+     *  @return The sum in microseconds
+     */
+    Uint64 getSum() const;
+
+    /** Returns a quantile of the values recorded
+     *  @param quantile [in] The quantile, e.g.\ 0.99
+     *  @return Upper bound of the bucket holding the quantile in microseconds, 0 if
+     *          no value has been recorded
+     */
+    Uint64 getQuantile(const double quantile) const;
+
+  private:
+
+    /** Returns the bucket a value is counted in
+     *  @param value [in] The value
+     *  @return The index of the bucket
+     */
+    static size_t getIndex(const Uint64 value);
+
+    /** Returns the largest value counted in a bucket
+     *  @param index [in] The index of the bucket
+     *  @return The value
+     */
+    static Uint64 getUpperBound(const size_t index);
+
+    /// number of values per bucket
+    volatile Uint64 m_buckets[SCP_METRICS_BUCKETS];
+
+    /// number of values recorded
+    volatile Uint64 m_count;
+
+    /// sum of the values recorded
+    volatile Uint64 m_sum;
+
+    // private undefined copy constructor
+    DcmLatencyHistogram(const DcmLatencyHistogram &);
+
+    // private undefined assignment operator
+    DcmLatencyHistogram &operator=(const DcmLatencyHistogram &);
+
+};
+
+
+/** Set of counters and latency summaries, each identified by a metric name and a
+ *  set of labels (e.g.\ SOP class and peer). A series is created when first used;
+ *  finding it takes a mutex, which is only contended while the metrics are being
+ *  formatted. The values themselves are updated atomically. If there are too many
+ *  series, new label combinations are counted in a common series labeled
+ *  overflow="true".
+ */
+class DcmMetricsRegistry
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmMetricsRegistry();
+
+    /** destructor
+     */
+    ~DcmMetricsRegistry();
+
+    /** Set the help text of a metric
+     *  @param name [in] Name of the metric
+     *  @param help [in] The help text
+     */
+    void describe(const OFString &name,
+                  const OFString &help);
+
+    /** Add to a counter
+     *  @param name   [in] Name of the metric
+     *  @param labels [in] The labels, see addLabel()
+     *  @param value  [in] The value to add
+     */
+    void increment(const OFString &name,
+                   const OFString &labels,
+                   const Uint64 value = 1);
+
+    /** Find (or create) a counter, so that it can be incremented later without
+     *  looking it up again. The counter is valid as long as the registry.
+     *  @param name   [in] Name of the metric
+     *  @param labels [in] The labels, see addLabel()
+     *  @return The counter, NULL if the metric is a latency
+     */
+    volatile Uint64 *getCounter(const OFString &name,
+                                const OFString &labels);
+
+    /** Add to a counter returned by getCounter()
+     *  @param counter [in] The counter, may be NULL
+     *  @param value   [in] The value to add
+     */
+    static void increment(volatile Uint64 *counter,
+                          const Uint64 value = 1);
+
+    /** Record a latency
+     *  @param name         [in] Name of the metric (in seconds, as exported)
+     *  @param labels       [in] The labels, see addLabel()
+     *  @param microseconds [in] The latency in microseconds
+     */
+    void observe(const OFString &name,
+                 const OFString &labels,
+                 const Uint64 microseconds);
+
+    /** Format all metrics in the Prometheus text exposition format. Latencies are
+     *  exported as summaries with the quantiles 0.5, 0.9, 0.99 and 0.999.
+     *  @param text [out] The formatted metrics
+     */
+    void format(OFString &text);
+
+    /** Add a label to a list of labels
+     *  @param labels [inout] The labels
+     *  @param name   [in]    Name of the label
+     *  @param value  [in]    Value of the label (escaped as needed)
+     */
+    static void addLabel(OFString &labels,
+                         const char *name,
+                         const OFString &value);
+
+    /** Returns the time of a monotonic clock, for measuring latencies
+     *  @return The time in microseconds
+     */
+    static Uint64 now();
+
+  private:
+
+    /** A counter or a latency histogram
+     */
+    struct Series
+    {
+      /// value of a counter
+      volatile Uint64 value;
+      /// the histogram, NULL for a counter
+      DcmLatencyHistogram *histogram;
+    };
+
+    /** All series of a metric
+     */
+    struct Family
+    {
+      /// the help text
+      OFString help;
+      /// OFTrue for latencies, OFFalse for counters
+      OFBool summary;
+      /// the series by labels
+      OFMap<OFString, Series *> series;
+    };
+
+    /** Find (or create) a series
+     *  @param name    [in] Name of the metric
+     *  @param labels  [in] The labels
+     *  @param summary [in] OFTrue for a latency, OFFalse for a counter
+     *  @return The series, NULL if the metric is of the other kind
+     */
+    Series *getSeries(const OFString &name,
+                      const OFString &labels,
+                      const OFBool summary);
+
+    /// the metrics by name
+    OFMap<OFString, Family> m_families;
+
+    /// number of series
+    size_t m_seriesCount;
+
+    /// mutex protecting the maps
+    OFMutex m_mutex;
+
+    // private undefined copy constructor
+    DcmMetricsRegistry(const DcmMetricsRegistry &);
+
+    // private undefined assignment operator
+    DcmMetricsRegistry &operator=(const DcmMetricsRegistry &);
+
+};
+
+
+/** Thread serving the metrics of a registry over HTTP (GET /metrics), either on a
+ *  TCP port of the loopback interface or on a unix domain socket. Every request is
+ *  answered and the connection is closed.
+ */
+class DcmMetricsServer : public OFThread
+{
+
+  public:
+
+    /** constructor
+     *  @param registry [in] The metrics served
+     */
+    DcmMetricsServer(DcmMetricsRegistry &registry);
+
+    /** destructor. Closes the listening socket.
+     */
+    virtual ~DcmMetricsServer();
+
+    /** Listen on a TCP port of the loopback interface
+     *  @param port [in] The port
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition openPort(const Uint16 port);
+
+    /** Listen on a unix domain socket
+     *  @param path [in] The socket path
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition openSocket(const OFString &path);
+
+    /** Ask the thread to stop
+     */
+    void stop();
+
+  protected:
+
+    /** Answer requests until stopped
+     */
+    virtual void run();
+
+  private:
+
+    /** Read a request and send the response
+     *  @param fd [in] The connection
+     */
+    void serve(const int fd);
+
+    /** Check whether the thread should stop
+     *  @return OFTrue if the thread should stop, OFFalse otherwise
+     */
+    OFBool stopRequested();
+
+    /// the metrics served
+    DcmMetricsRegistry &m_registry;
+
+    /// listening socket, -1 if not open
+    int m_listenSocket;
+
+    /// path of the unix domain socket, empty for TCP
+    OFString m_socketPath;
+
+    /// flag indicating that the thread should stop
+    OFBool m_stop;
+
+    /// mutex protecting the flag
+    OFMutex m_mutex;
+
+    // private undefined copy constructor
+    DcmMetricsServer(const DcmMetricsServer &);
+
+    // private undefined assignment operator
+    DcmMetricsServer &operator=(const DcmMetricsServer &);
+
+};
+
+#endif // DSCPMETR_H
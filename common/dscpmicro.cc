@@ -0,0 +1,535 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Runner for micro-benchmarks with JSON output and baseline comparison
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpmicro.h"
+#include "dscpcond.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmdata/dcistrmb.h"
+#include "dcmtk/dcmdata/dcostrmb.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <time.h>
+END_EXTERN_C
+
+// maximum length of a line of a baseline file
+#define SCP_MICRO_MAX_LINE 1024
+
+// maximum number of iterations per sample, reached only by empty operations
+#define SCP_MICRO_MAX_ITERATIONS 0x10000000
+
+
+// print a string as JSON string literal
+static void printJSONString(STD_NAMESPACE ostream &out,
+                            const OFString &value)
+{
+  out << '"';
+  for (size_t i = 0; i < value.length(); ++i)
+  {
+    const unsigned char c = OFstatic_cast(unsigned char, value[i]);
+    if ((c == '"') || (c == '\\'))
+      out << '\\' << value[i];
+    else if (c < 0x20)
+    {
+      char buf[8];
+      sprintf(buf, "\\u%04x", OFstatic_cast(unsigned int, c));
+      out << buf;
+    }
+    else
+      out << value[i];
+  }
+  out << '"';
+}
+
+
+// print a time in nanoseconds with one decimal
+static void printNanoseconds(STD_NAMESPACE ostream &out,
+                             const double nanoseconds)
+{
+  char buf[32];
+  sprintf(buf, "%.1f", nanoseconds);
+  out << buf;
+}
+
+
+// get the value of a member from a line written by printJSON(), empty if not found
+static OFString getMember(const OFString &line,
+                          const char *name)
+{
+  const OFString key = OFString("\"") + name + "\":";
+  size_t pos = line.find(key);
+  if (pos == OFString_npos)
+    return OFString();
+  pos += key.length();
+  if ((pos < line.length()) && (line[pos] == '"'))
+  {
+    // the names of the benchmarks contain no quotes or backslashes
+    const size_t end = line.find('"', pos + 1);
+    return (end == OFString_npos) ? OFString() : line.substr(pos + 1, end - pos - 1);
+  }
+  const size_t end = line.find_first_of(",}", pos);
+  return line.substr(pos, (end == OFString_npos) ? OFString_npos : end - pos);
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMicroBenchmark::DcmMicroBenchmark(const OFString &name)
+  : m_name(name)
+{
+}
+
+
+DcmMicroBenchmark::~DcmMicroBenchmark()
+{
+}
+
+
+const OFString &DcmMicroBenchmark::getName() const
+{
+  return m_name;
+}
+
+
+OFCondition DcmMicroBenchmark::setUp()
+{
+  return EC_Normal;
+}
+
+
+size_t DcmMicroBenchmark::getBytes() const
+{
+  return 0;
+}
+
+
+OFCondition DcmMicroBenchmark::encodeDataset(DcmDataset &dataset,
+                                             const E_TransferSyntax xfer,
+                                             OFVector<Uint8> &buffer)
+{
+  const Uint32 length = dataset.calcElementLength(xfer, EET_ExplicitLength);
+  buffer.resize(length);
+  if (length == 0)
+    return EC_Normal;
+  DcmOutputBufferStream stream(&buffer[0], length);
+  dataset.transferInit();
+  OFCondition cond = dataset.write(stream, xfer, EET_ExplicitLength, NULL);
+  dataset.transferEnd();
+  // the buffer has exactly the size needed, running out of space would be an error
+  if (cond == EC_StreamNotifyClient)
+    cond = EC_IllegalCall;
+  return cond;
+}
+
+
+OFCondition DcmMicroBenchmark::decodeDataset(const OFVector<Uint8> &buffer,
+                                             const E_TransferSyntax xfer,
+                                             DcmDataset &dataset)
+{
+  DcmInputBufferStream stream;
+  if (!buffer.empty())
+    stream.setBuffer(&buffer[0], OFstatic_cast(offile_off_t, buffer.size()));
+  stream.setEos();
+  dataset.transferInit();
+  OFCondition cond = dataset.read(stream, xfer);
+  dataset.transferEnd();
+  return cond;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmDecodeBenchmark::DcmDecodeBenchmark(const OFString &name,
+                                       DcmDataset *dataset,
+                                       const E_TransferSyntax xfer)
+  : DcmMicroBenchmark(name)
+  , m_dataset(dataset)
+  , m_xfer(xfer)
+  , m_buffer()
+{
+}
+
+
+DcmDecodeBenchmark::~DcmDecodeBenchmark()
+{
+  delete m_dataset;
+}
+
+
+OFCondition DcmDecodeBenchmark::setUp()
+{
+  return encodeDataset(*m_dataset, m_xfer, m_buffer);
+}
+
+
+OFCondition DcmDecodeBenchmark::iterate()
+{
+  DcmDataset dataset;
+  return decodeDataset(m_buffer, m_xfer, dataset);
+}
+
+
+size_t DcmDecodeBenchmark::getBytes() const
+{
+  return m_buffer.size();
+}
+
+// ----------------------------------------------------------------------------
+
+DcmEncodeBenchmark::DcmEncodeBenchmark(const OFString &name,
+                                       DcmDataset *dataset,
+                                       const E_TransferSyntax xfer)
+  : DcmMicroBenchmark(name)
+  , m_dataset(dataset)
+  , m_xfer(xfer)
+  , m_buffer()
+{
+}
+
+
+DcmEncodeBenchmark::~DcmEncodeBenchmark()
+{
+  delete m_dataset;
+}
+
+
+OFCondition DcmEncodeBenchmark::iterate()
+{
+  return encodeDataset(*m_dataset, m_xfer, m_buffer);
+}
+
+
+size_t DcmEncodeBenchmark::getBytes() const
+{
+  return m_buffer.size();
+}
+
+// ----------------------------------------------------------------------------
+
+DcmCloneBenchmark::DcmCloneBenchmark(const OFString &name,
+                                     DcmDataset *dataset)
+  : DcmMicroBenchmark(name)
+  , m_dataset(dataset)
+{
+}
+
+
+DcmCloneBenchmark::~DcmCloneBenchmark()
+{
+  delete m_dataset;
+}
+
+
+OFCondition DcmCloneBenchmark::iterate()
+{
+  DcmObject *copy = m_dataset->clone();
+  delete copy;
+  return EC_Normal;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmDumpBenchmark::DcmDumpBenchmark(const OFString &name,
+                                   const T_DIMSE_Message &message,
+                                   DcmDataset *dataset)
+  : DcmMicroBenchmark(name)
+  , m_message(message)
+  , m_dataset(dataset)
+{
+}
+
+
+DcmDumpBenchmark::~DcmDumpBenchmark()
+{
+  delete m_dataset;
+}
+
+
+OFCondition DcmDumpBenchmark::iterate()
+{
+  OFString str;
+  DIMSE_dumpMessage(str, m_message, DIMSE_INCOMING, m_dataset, 1 /* presID */);
+  return EC_Normal;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmResponseBenchmark::DcmResponseBenchmark(const OFString &name,
+                                           const T_DIMSE_Command commandField,
+                                           const OFString &sopClassUID,
+                                           const OFString &sopInstanceUID)
+  : DcmMicroBenchmark(name)
+  , m_encoder()
+  , m_commandField(commandField)
+  , m_sopClassUID(sopClassUID)
+  , m_sopInstanceUID(sopInstanceUID)
+  , m_messageID(0)
+  , m_bytes(0)
+{
+}
+
+
+OFCondition DcmResponseBenchmark::iterate()
+{
+  m_bytes = m_encoder.encodeResponse(m_commandField, ++m_messageID, m_sopClassUID.c_str(),
+    m_sopInstanceUID.c_str(), STATUS_Success).size();
+  return EC_Normal;
+}
+
+
+size_t DcmResponseBenchmark::getBytes() const
+{
+  return m_bytes;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMicroBenchmarkRunner::Result::Result()
+  : name()
+  , failed(OFFalse)
+  , iterations(0)
+  , bytes(0)
+  , median(0)
+  , minimum(0)
+  , maximum(0)
+  , mean(0)
+  , baseline(-1)
+  , regression(OFFalse)
+{
+}
+
+
+DcmMicroBenchmarkRunner::DcmMicroBenchmarkRunner(const Uint32 samples,
+                                                 const Uint32 sampleTime)
+  : m_samples((samples > 0) ? samples : 1)
+  , m_sampleTime(OFstatic_cast(Uint64, sampleTime) * 1000000)
+  , m_benchmarks()
+  , m_results()
+  , m_baseline()
+{
+}
+
+
+DcmMicroBenchmarkRunner::~DcmMicroBenchmarkRunner()
+{
+  for (size_t i = 0; i < m_benchmarks.size(); ++i)
+    delete m_benchmarks[i];
+}
+
+
+void DcmMicroBenchmarkRunner::add(DcmMicroBenchmark *benchmark)
+{
+  if (benchmark != NULL)
+    m_benchmarks.push_back(benchmark);
+}
+
+
+void DcmMicroBenchmarkRunner::printNames(STD_NAMESPACE ostream &out) const
+{
+  for (size_t i = 0; i < m_benchmarks.size(); ++i)
+    out << m_benchmarks[i]->getName() << OFendl;
+}
+
+
+OFCondition DcmMicroBenchmarkRunner::run(const OFString &filter)
+{
+  OFCondition result = EC_Normal;
+  m_results.clear();
+  for (size_t i = 0; i < m_benchmarks.size(); ++i)
+  {
+    DcmMicroBenchmark &benchmark = *m_benchmarks[i];
+    if (!filter.empty() && (benchmark.getName().find(filter) == OFString_npos))
+      continue;
+    Result benchmarkResult;
+    benchmarkResult.name = benchmark.getName();
+    OFCondition cond = benchmark.setUp();
+    if (cond.good())
+      cond = measure(benchmark, benchmarkResult);
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Benchmark " << benchmark.getName() << " failed: " << cond.text());
+      benchmarkResult.failed = OFTrue;
+      result = SCP_EC_BenchmarkFailed;
+    } else {
+      DCMNET_INFO(benchmark.getName() << ": " << benchmarkResult.median << " ns per iteration (median of "
+        << m_samples << " x " << benchmarkResult.iterations << ")");
+    }
+    m_results.push_back(benchmarkResult);
+  }
+  return result;
+}
+
+
+OFCondition DcmMicroBenchmarkRunner::readBaseline(const OFString &filename)
+{
+  FILE *file = fopen(filename.c_str(), "r");
+  if (file == NULL)
+  {
+    char buf[256];
+    DCMNET_ERROR("Cannot open baseline file " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return SCP_EC_InvalidBaseline;
+  }
+  m_baseline.clear();
+  char line[SCP_MICRO_MAX_LINE];
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    // one benchmark per line, failed ones have no median
+    const OFString text(line);
+    const OFString name = getMember(text, "name");
+    const OFString median = getMember(text, "median_ns");
+    if (name.empty() || median.empty())
+      continue;
+    OFBool success = OFFalse;
+    const double value = OFStandard::atof(median.c_str(), &success);
+    if (success)
+      m_baseline[name] = value;
+  }
+  fclose(file);
+  if (m_baseline.empty())
+  {
+    DCMNET_ERROR("No benchmark results found in baseline file " << filename);
+    return SCP_EC_InvalidBaseline;
+  }
+  return EC_Normal;
+}
+
+
+size_t DcmMicroBenchmarkRunner::compare(const double threshold)
+{
+  size_t regressions = 0;
+  for (size_t i = 0; i < m_results.size(); ++i)
+  {
+    Result &result = m_results[i];
+    OFMap<OFString, double>::const_iterator it = m_baseline.find(result.name);
+    if (result.failed || (it == m_baseline.end()) || ((*it).second <= 0))
+      continue;
+    result.baseline = (*it).second;
+    result.regression = (result.median > result.baseline * (1.0 + threshold / 100.0));
+    if (result.regression)
+    {
+      DCMNET_WARN("Benchmark " << result.name << " regressed: " << result.median << " ns per iteration, baseline "
+        << result.baseline << " ns");
+      ++regressions;
+    }
+  }
+  return regressions;
+}
+
+
+void DcmMicroBenchmarkRunner::printJSON(STD_NAMESPACE ostream &out,
+                                        const char *tool) const
+{
+  out << "{\"tool\":";
+  printJSONString(out, tool);
+  out << ",\"version\":";
+  printJSONString(out, OFFIS_DCMTK_VERSION);
+  out << ",\"samples\":" << m_samples << ",\"sample_time_ms\":" << (m_sampleTime / 1000000) << ",\"benchmarks\":[";
+  size_t regressions = 0;
+  for (size_t i = 0; i < m_results.size(); ++i)
+  {
+    const Result &result = m_results[i];
+    out << ((i > 0) ? ",\n" : "\n") << "{\"name\":";
+    printJSONString(out, result.name);
+    if (result.failed)
+    {
+      out << ",\"failed\":true}";
+      continue;
+    }
+    out << ",\"iterations\":" << result.iterations << ",\"bytes\":" << result.bytes << ",\"median_ns\":";
+    printNanoseconds(out, result.median);
+    out << ",\"min_ns\":";
+    printNanoseconds(out, result.minimum);
+    out << ",\"max_ns\":";
+    printNanoseconds(out, result.maximum);
+    out << ",\"mean_ns\":";
+    printNanoseconds(out, result.mean);
+    if (result.bytes > 0)
+    {
+      char buf[32];
+      sprintf(buf, "%.1f", OFstatic_cast(double, result.bytes) * 1000.0 / result.median);
+      out << ",\"mb_per_s\":" << buf;
+    }
+    if (result.baseline > 0)
+    {
+      char buf[32];
+      sprintf(buf, "%.1f", (result.median / result.baseline - 1.0) * 100.0);
+      out << ",\"baseline_ns\":";
+      printNanoseconds(out, result.baseline);
+      out << ",\"change_percent\":" << buf << ",\"regression\":" << (result.regression ? "true" : "false");
+      if (result.regression)
+        ++regressions;
+    }
+    out << "}";
+  }
+  out << "\n],\"regressions\":" << regressions << "}" << OFendl;
+}
+
+
+Uint64 DcmMicroBenchmarkRunner::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return OFstatic_cast(Uint64, ts.tv_sec) * 1000000000 + OFstatic_cast(Uint64, ts.tv_nsec);
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmMicroBenchmarkRunner::measure(DcmMicroBenchmark &benchmark,
+                                             Result &result)
+{
+  // double the iterations until a sample takes long enough, which also warms up caches
+  OFCondition cond = EC_Normal;
+  Uint64 iterations = 1;
+  while (cond.good())
+  {
+    const Uint64 start = now();
+    for (Uint64 i = 0; (i < iterations) && cond.good(); ++i)
+      cond = benchmark.iterate();
+    if ((now() - start >= m_sampleTime) || (iterations >= SCP_MICRO_MAX_ITERATIONS))
+      break;
+    iterations *= 2;
+  }
+
+  OFVector<double> times;
+  for (Uint32 s = 0; (s < m_samples) && cond.good(); ++s)
+  {
+    const Uint64 start = now();
+    for (Uint64 i = 0; (i < iterations) && cond.good(); ++i)
+      cond = benchmark.iterate();
+    const double time = OFstatic_cast(double, now() - start) / OFstatic_cast(double, iterations);
+    // insertion sort, ascending (the number of samples is small)
+    times.push_back(time);
+    size_t j = times.size() - 1;
+    while ((j > 0) && (times[j - 1] > time))
+    {
+      times[j] = times[j - 1];
+      --j;
+    }
+    times[j] = time;
+  }
+  if (cond.bad())
+    return cond;
+
+  double sum = 0;
+  for (size_t i = 0; i < times.size(); ++i)
+    sum += times[i];
+  const size_t middle = times.size() / 2;
+  result.iterations = iterations;
+  result.bytes = benchmark.getBytes();
+  result.median = (times.size() % 2 == 1) ? times[middle] : (times[middle - 1] + times[middle]) / 2;
+  result.minimum = times[0];
+  result.maximum = times[times.size() - 1];
+  result.mean = sum / OFstatic_cast(double, times.size());
+  return EC_Normal;
+}
@@ -0,0 +1,442 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Runner for micro-benchmarks with JSON output and baseline comparison
+ *
+ */
+
+#ifndef DSCPMICRO_H
+#define DSCPMICRO_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofmap.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofstream.h"
+#include "dcmtk/ofstd/ofvector.h"
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcxfer.h"
+#include "dcmtk/dcmnet/dimse.h"
+#include "dscprsp.h"               /* for DcmDimseResponseEncoder */
+
+/// default number of samples taken per benchmark
+#define SCP_MICRO_DEFAULT_SAMPLES 10
+
+/// default minimum time of a sample in milliseconds
+#define SCP_MICRO_DEFAULT_SAMPLE_TIME 20
+
+/// default slowdown against the baseline in percent reported as regression
+#define SCP_MICRO_DEFAULT_THRESHOLD 10
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** A micro-benchmark: an operation that is timed over many iterations. Everything
+ *  the operation needs is prepared by setUp(), so that iterate() only does the
+ *  operation measured.
+ */
+class DcmMicroBenchmark
+{
+
+  public:
+
+    /** constructor
+     *  @param name [in] Name of the benchmark, e.g.\ "decode/n-create"
+     */
+    DcmMicroBenchmark(const OFString &name);
+
+    /** destructor
+     */
+    virtual ~DcmMicroBenchmark();
+
+    /** Returns the name of the benchmark
+     *  @return The name
+     */
+    const OFString &getName() const;
+
+    /** Prepare the benchmark, called once before the first iteration
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    virtual OFCondition setUp();
+
+    /** Run the operation measured once
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    virtual OFCondition iterate() = 0;
+
+    /** Returns the number of bytes processed per iteration
+     *  @return The number of bytes, 0 if not applicable
+     */
+    virtual size_t getBytes() const;
+
+    /** Encode a dataset the way it is sent over the network
+     *  @param dataset [in]  The dataset
+     *  @param xfer    [in]  The transfer syntax
+     *  @param buffer  [out] The encoded dataset
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    static OFCondition encodeDataset(DcmDataset &dataset,
+                                     const E_TransferSyntax xfer,
+                                     OFVector<Uint8> &buffer);
+
+    /** Decode a dataset the way it is received from the network
+     *  @param buffer  [in]  The encoded dataset
+     *  @param xfer    [in]  The transfer syntax
+     *  @param dataset [out] The dataset, must be empty
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    static OFCondition decodeDataset(const OFVector<Uint8> &buffer,
+                                     const E_TransferSyntax xfer,
+                                     DcmDataset &dataset);
+
+  private:
+
+    /// name of the benchmark
+    OFString m_name;
+
+    // private undefined copy constructor
+    DcmMicroBenchmark(const DcmMicroBenchmark &);
+
+    // private undefined assignment operator
+    DcmMicroBenchmark &operator=(const DcmMicroBenchmark &);
+};
+
+
+/** Benchmark decoding a dataset received from the network
+ */
+class DcmDecodeBenchmark : public DcmMicroBenchmark
+{
+
+  public:
+
+    /** constructor
+     *  @param name    [in] Name of the benchmark
+     *  @param dataset [in] The dataset, encoded by setUp() and deleted by the benchmark
+     *  @param xfer    [in] The transfer syntax
+     */
+    DcmDecodeBenchmark(const OFString &name,
+                       DcmDataset *dataset,
+                       const E_TransferSyntax xfer);
+
+    /** destructor
+     */
+    virtual ~DcmDecodeBenchmark();
+
+    /** Encode the dataset
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    virtual OFCondition setUp();
+
+    /** Decode the dataset into a new dataset
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    virtual OFCondition iterate();
+
+    /** Returns the size of the encoded dataset
+     *  @return The number of bytes
+     */
+    virtual size_t getBytes() const;
+
+  private:
+
+    /// the dataset
+    DcmDataset *m_dataset;
+
+    /// the transfer syntax
+    E_TransferSyntax m_xfer;
+
+    /// the encoded dataset
+    OFVector<Uint8> m_buffer;
+};
+
+
+/** Benchmark encoding a dataset sent over the network
+ */
+class DcmEncodeBenchmark : public DcmMicroBenchmark
+{
+
+  public:
+
+    /** constructor
+     *  @param name    [in] Name of the benchmark
+     *  @param dataset [in] The dataset, deleted by the benchmark
+     *  @param xfer    [in] The transfer syntax
+     */
+    DcmEncodeBenchmark(const OFString &name,
+                       DcmDataset *dataset,
+                       const E_TransferSyntax xfer);
+
+    /** destructor
+     */
+    virtual ~DcmEncodeBenchmark();
+
+    /** Encode the dataset
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    virtual OFCondition iterate();
+
+    /** Returns the size of the encoded dataset
+     *  @return The number of bytes
+     */
+    virtual size_t getBytes() const;
+
+  private:
+
+    /// the dataset
+    DcmDataset *m_dataset;
+
+    /// the transfer syntax
+    E_TransferSyntax m_xfer;
+
+    /// the encoded dataset, reused by all iterations
+    OFVector<Uint8> m_buffer;
+};
+
+
+/** Benchmark cloning a dataset, as done for datasets kept beyond the request
+ */
+class DcmCloneBenchmark : public DcmMicroBenchmark
+{
+
+  public:
+
+    /** constructor
+     *  @param name    [in] Name of the benchmark
+     *  @param dataset [in] The dataset, deleted by the benchmark
+     */
+    DcmCloneBenchmark(const OFString &name,
+                      DcmDataset *dataset);
+
+    /** destructor
+     */
+    virtual ~DcmCloneBenchmark();
+
+    /** Clone the dataset and delete the copy
+     *  @return EC_Normal
+     */
+    virtual OFCondition iterate();
+
+  private:
+
+    /// the dataset
+    DcmDataset *m_dataset;
+};
+
+
+/** Benchmark DIMSE_dumpMessage() of a request with its dataset, as done for each
+ *  request if debug logging is enabled
+ */
+class DcmDumpBenchmark : public DcmMicroBenchmark
+{
+
+  public:
+
+    /** constructor
+     *  @param name    [in] Name of the benchmark
+     *  @param message [in] The request, copied
+     *  @param dataset [in] The dataset of the request, deleted by the benchmark
+     */
+    DcmDumpBenchmark(const OFString &name,
+                     const T_DIMSE_Message &message,
+                     DcmDataset *dataset);
+
+    /** destructor
+     */
+    virtual ~DcmDumpBenchmark();
+
+    /** Dump the request and its dataset to a string
+     *  @return EC_Normal
+     */
+    virtual OFCondition iterate();
+
+  private:
+
+    /// the request
+    T_DIMSE_Message m_message;
+
+    /// the dataset of the request
+    DcmDataset *m_dataset;
+};
+
+
+/** Benchmark encoding the command set of a response without a dataset
+ */
+class DcmResponseBenchmark : public DcmMicroBenchmark
+{
+
+  public:
+
+    /** constructor
+     *  @param name           [in] Name of the benchmark
+     *  @param commandField   [in] The command field of the response
+     *  @param sopClassUID    [in] The Affected SOP Class UID
+     *  @param sopInstanceUID [in] The Affected SOP Instance UID
+     */
+    DcmResponseBenchmark(const OFString &name,
+                         const T_DIMSE_Command commandField,
+                         const OFString &sopClassUID,
+                         const OFString &sopInstanceUID);
+
+    /** Encode the response, with a new message ID each time
+     *  @return EC_Normal
+     */
+    virtual OFCondition iterate();
+
+    /** Returns the size of the encoded command set
+     *  @return The number of bytes
+     */
+    virtual size_t getBytes() const;
+
+  private:
+
+    /// the encoder
+    DcmDimseResponseEncoder m_encoder;
+
+    /// the command field of the response
+    T_DIMSE_Command m_commandField;
+
+    /// the Affected SOP Class UID
+    OFString m_sopClassUID;
+
+    /// the Affected SOP Instance UID
+    OFString m_sopInstanceUID;
+
+    /// message ID of the last response
+    Uint16 m_messageID;
+
+    /// size of the last command set encoded
+    size_t m_bytes;
+};
+
+
+/** Runner timing micro-benchmarks. The number of iterations of a benchmark is
+ *  doubled until they take at least the sample time, then the given number of
+ *  samples with that many iterations is taken; the median time per iteration is
+ *  what is compared against the baseline, since it is hardly affected by single
+ *  samples disturbed by other processes. The results are written as JSON, one
+ *  benchmark per line, which is also the format of the baseline file.
+ */
+class DcmMicroBenchmarkRunner
+{
+
+  public:
+
+    /** constructor
+     *  @param samples    [in] Number of samples taken per benchmark
+     *  @param sampleTime [in] Minimum time of a sample in milliseconds
+     */
+    DcmMicroBenchmarkRunner(const Uint32 samples,
+                            const Uint32 sampleTime);
+
+    /** destructor. Deletes the benchmarks.
+     */
+    ~DcmMicroBenchmarkRunner();
+
+    /** Add a benchmark
+     *  @param benchmark [in] The benchmark, deleted by the runner
+     */
+    void add(DcmMicroBenchmark *benchmark);
+
+    /** Print the names of the benchmarks
+     *  @param out [out] Stream the names are printed to, one per line
+     */
+    void printNames(STD_NAMESPACE ostream &out) const;
+
+    /** Run the benchmarks
+     *  @param filter [in] Only run benchmarks whose name contains this text,
+     *                     all if empty
+     *  @return EC_Normal if all benchmarks run succeeded, SCP_EC_BenchmarkFailed
+     *          if at least one failed
+     */
+    OFCondition run(const OFString &filter);
+
+    /** Read the results of an earlier run to compare against
+     *  @param filename [in] JSON file written by printJSON()
+     *  @return EC_Normal if successful, SCP_EC_InvalidBaseline otherwise
+     */
+    OFCondition readBaseline(const OFString &filename);
+
+    /** Compare the results with the baseline
+     *  @param threshold [in] Slowdown of the median time in percent reported as regression
+     *  @return The number of regressions
+     */
+    size_t compare(const double threshold);
+
+    /** Print the results as JSON
+     *  @param out  [out] Stream the results are printed to
+     *  @param tool [in]  Name of the tool, printed for reference
+     */
+    void printJSON(STD_NAMESPACE ostream &out,
+                   const char *tool) const;
+
+    /** Returns the current time of a monotonic clock
+     *  @return The time in nanoseconds
+     */
+    static Uint64 now();
+
+  private:
+
+    /** Result of a benchmark
+     */
+    struct Result
+    {
+      /** default constructor
+       */
+      Result();
+
+      /// name of the benchmark
+      OFString name;
+      /// OFTrue if the benchmark failed
+      OFBool failed;
+      /// number of iterations per sample
+      Uint64 iterations;
+      /// bytes processed per iteration
+      size_t bytes;
+      /// median time per iteration in nanoseconds
+      double median;
+      /// shortest time per iteration in nanoseconds
+      double minimum;
+      /// longest time per iteration in nanoseconds
+      double maximum;
+      /// mean time per iteration in nanoseconds
+      double mean;
+      /// median time per iteration of the baseline, negative if none
+      double baseline;
+      /// OFTrue if slower than the baseline by more than the threshold
+      OFBool regression;
+    };
+
+    /** Take the samples of a benchmark
+     *  @param benchmark [in]  The benchmark
+     *  @param result    [out] The result
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition measure(DcmMicroBenchmark &benchmark,
+                        Result &result);
+
+    /// number of samples per benchmark
+    Uint32 m_samples;
+
+    /// minimum time of a sample in nanoseconds
+    Uint64 m_sampleTime;
+
+    /// the benchmarks
+    OFVector<DcmMicroBenchmark *> m_benchmarks;
+
+    /// results of the last run
+    OFVector<Result> m_results;
+
+    /// median time per iteration of the baseline benchmarks
+    OFMap<OFString, double> m_baseline;
+
+    // private undefined copy constructor
+    DcmMicroBenchmarkRunner(const DcmMicroBenchmarkRunner &);
+
+    // private undefined assignment operator
+    DcmMicroBenchmarkRunner &operator=(const DcmMicroBenchmarkRunner &);
+};
+
+#endif // DSCPMICRO_H
@@ -0,0 +1,186 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Cache for the results of association negotiation
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscpneg.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+// maximum number of cached results (a few per modality in practice)
+#define SCP_NEG_MAX_ENTRIES 256
+
+// separator of the parts of a key (not allowed in AE titles and UIDs)
+#define SCP_NEG_SEPARATOR '\\'
+
+
+DcmNegotiationCache::DcmNegotiationCache()
+  : m_entries()
+  , m_key()
+  , m_hash(0)
+  , m_cacheable(OFFalse)
+  , m_hits(0)
+  , m_misses(0)
+{
+}
+
+
+DcmNegotiationCache::~DcmNegotiationCache()
+{
+  clear();
+}
+
+
+OFBool DcmNegotiationCache::apply(T_ASC_Parameters &params)
+{
+  m_cacheable = buildKey(params, m_key);
+  if (!m_cacheable)
+    return OFFalse;
+  m_hash = hashKey(m_key);
+  OFMap<Uint64, CacheEntry *>::iterator it = m_entries.find(m_hash);
+  if ((it == m_entries.end()) || (it->second->key != m_key))
+  {
+    ++m_misses;
+    return OFFalse;
+  }
+
+  // the presentation contexts are the same as in the cached request
+  const OFVector<ContextResult> &results = it->second->results;
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    const ContextResult &result = results[i];
+    OFCondition cond;
+    if (result.resultReason == ASC_P_ACCEPTANCE)
+      cond = ASC_acceptPresentationContext(&params, result.presentationContextID,
+        result.acceptedTransferSyntax.c_str(), result.acceptedRole);
+    else
+      cond = ASC_refusePresentationContext(&params, result.presentationContextID, result.resultReason);
+    if (cond.bad())
+    {
+      // should never happen, negotiate the request as usual
+      DCMNET_WARN("Cannot apply cached result of presentation context "
+        << OFstatic_cast(unsigned int, result.presentationContextID) << ": " << cond.text());
+      ++m_misses;
+      return OFFalse;
+    }
+  }
+  ++m_hits;
+  return OFTrue;
+}
+
+
+void DcmNegotiationCache::store(T_ASC_Parameters &params)
+{
+  if (!m_cacheable)
+    return;
+  m_cacheable = OFFalse;
+
+  CacheEntry *entry = new CacheEntry();
+  entry->key = m_key;
+  const int count = ASC_countPresentationContexts(&params);
+  for (int i = 0; i < count; ++i)
+  {
+    T_ASC_PresentationContext pc;
+    if (ASC_getPresentationContext(&params, i, &pc).bad())
+    {
+      delete entry;
+      return;
+    }
+    ContextResult result;
+    result.presentationContextID = pc.presentationContextID;
+    result.resultReason = pc.resultReason;
+    result.acceptedTransferSyntax = pc.acceptedTransferSyntax;
+    result.acceptedRole = pc.acceptedRole;
+    entry->results.push_back(result);
+  }
+
+  if (m_entries.size() >= SCP_NEG_MAX_ENTRIES)
+    clear();
+  // on a hash collision, keep the newer request
+  OFMap<Uint64, CacheEntry *>::iterator it = m_entries.find(m_hash);
+  if (it != m_entries.end())
+    delete it->second;
+  m_entries[m_hash] = entry;
+  DCMNET_TRACE("Cached negotiation result of " << count << " presentation context(s) for "
+    << params.DULparams.callingAPTitle << " -> " << params.DULparams.calledAPTitle);
+}
+
+
+void DcmNegotiationCache::clear()
+{
+  OFMap<Uint64, CacheEntry *>::iterator it = m_entries.begin();
+  while (it != m_entries.end())
+  {
+    delete it->second;
+    ++it;
+  }
+  m_entries.clear();
+  m_cacheable = OFFalse;
+}
+
+
+Uint64 DcmNegotiationCache::getHits() const
+{
+  return m_hits;
+}
+
+
+Uint64 DcmNegotiationCache::getMisses() const
+{
+  return m_misses;
+}
+
+// ----------------------------------------------------------------------------
+
+OFBool DcmNegotiationCache::buildKey(T_ASC_Parameters &params,
+                                     OFString &key)
+{
+  // the result of extended negotiation is not covered by the cache
+  if ((params.DULparams.requestedExtNegList != NULL) && !params.DULparams.requestedExtNegList->empty())
+    return OFFalse;
+
+  key = params.DULparams.callingAPTitle;
+  key += SCP_NEG_SEPARATOR;
+  key += params.DULparams.calledAPTitle;
+  const int count = ASC_countPresentationContexts(&params);
+  for (int i = 0; i < count; ++i)
+  {
+    T_ASC_PresentationContext pc;
+    if (ASC_getPresentationContext(&params, i, &pc).bad())
+      return OFFalse;
+    char buf[32];
+    sprintf(buf, "%c%u,%u", SCP_NEG_SEPARATOR, OFstatic_cast(unsigned int, pc.presentationContextID),
+      OFstatic_cast(unsigned int, pc.proposedRole));
+    key += buf;
+    key += SCP_NEG_SEPARATOR;
+    key += pc.abstractSyntax;
+    for (int j = 0; j < pc.transferSyntaxCount; ++j)
+    {
+      key += ',';
+      key += pc.proposedTransferSyntaxes[j];
+    }
+  }
+  return OFTrue;
+}
+
+
+Uint64 DcmNegotiationCache::hashKey(const OFString &key)
+{
+  // FNV-1a offset basis 0xcbf29ce484222325 and prime 0x100000001b3
+  Uint64 hash = (OFstatic_cast(Uint64, 0xcbf29ce4UL) << 32) | 0x84222325UL;
+  const Uint64 prime = (OFstatic_cast(Uint64, 1) << 40) | 0x1b3;
+  for (size_t i = 0; i < key.length(); ++i)
+  {
+    hash ^= OFstatic_cast(Uint8, key[i]);
+    hash *= prime;
+  }
+  return hash;
+}
@@ -0,0 +1,139 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Cache for the results of association negotiation
+ *
+ */
+
+#ifndef DSCPNEG_H
+#define DSCPNEG_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofmap.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofvector.h"
+#include "dcmtk/dcmnet/assoc.h"
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Cache for the results of the presentation context negotiation. Modalities usually
+ *  propose the same presentation contexts on every association, so evaluating them
+ *  against the association configuration each time is wasted effort. The cache keeps
+ *  the result (accepted transfer syntax and role, or reason of rejection) of each
+ *  presentation context, keyed by a hash of the calling and called AE title and the
+ *  proposed presentation contexts (ID, abstract syntax, transfer syntaxes and role).
+ *  Requests with SOP class extended negotiation are never cached, since their result
+ *  is not limited to the presentation contexts.
+ *  The cache must be cleared whenever the association configuration changes.
+ */
+class DcmNegotiationCache
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmNegotiationCache();
+
+    /** destructor
+     */
+    ~DcmNegotiationCache();
+
+    /** Accept or reject the presentation contexts of an association request as for an
+     *  identical earlier request, if known
+     *  @param params [in/out] The parameters of the association request
+     *  @return OFTrue if the cached result has been applied, OFFalse if the request has
+     *          to be negotiated and the result can then be passed to store()
+     */
+    OFBool apply(T_ASC_Parameters &params);
+
+    /** Remember the result of the negotiation of the request last passed to apply()
+     *  @param params [in] The parameters of the negotiated association request
+     */
+    void store(T_ASC_Parameters &params);
+
+    /** Remove all cached results
+     */
+    void clear();
+
+    /** Returns the number of requests negotiated from the cache
+     *  @return Number of cache hits
+     */
+    Uint64 getHits() const;
+
+    /** Returns the number of requests not found in the cache
+     *  @return Number of cache misses
+     */
+    Uint64 getMisses() const;
+
+  private:
+
+    /** Result of the negotiation of a presentation context
+     */
+    struct ContextResult
+    {
+      /// ID of the presentation context
+      T_ASC_PresentationContextID presentationContextID;
+      /// result, ASC_P_ACCEPTANCE if accepted
+      T_ASC_P_ResultReason resultReason;
+      /// accepted transfer syntax
+      OFString acceptedTransferSyntax;
+      /// accepted role
+      T_ASC_SC_ROLE acceptedRole;
+    };
+
+    /** Cached result of an association request
+     */
+    struct CacheEntry
+    {
+      /// the complete key, to detect hash collisions
+      OFString key;
+      /// results of all presentation contexts in the order proposed
+      OFVector<ContextResult> results;
+    };
+
+    /** Build the key of an association request
+     *  @param params [in]  The parameters of the association request
+     *  @param key    [out] The key
+     *  @return OFTrue if the request may be cached, OFFalse otherwise
+     */
+    static OFBool buildKey(T_ASC_Parameters &params,
+                           OFString &key);
+
+    /** Compute the hash of a key (64 bit FNV-1a)
+     *  @param key [in] The key
+     *  @return The hash
+     */
+    static Uint64 hashKey(const OFString &key);
+
+    /// cached results, by hash of the key
+    OFMap<Uint64, CacheEntry *> m_entries;
+
+    /// key of the request last passed to apply()
+    OFString m_key;
+
+    /// hash of this key
+    Uint64 m_hash;
+
+    /// flag indicating whether the request last passed to apply() may be cached
+    OFBool m_cacheable;
+
+    /// number of cache hits
+    Uint64 m_hits;
+
+    /// number of cache misses
+    Uint64 m_misses;
+
+    // private undefined copy constructor
+    DcmNegotiationCache(const DcmNegotiationCache &);
+
+    // private undefined assignment operator
+    DcmNegotiationCache &operator=(const DcmNegotiationCache &);
+
+};
+
+#endif // DSCPNEG_H
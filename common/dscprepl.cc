@@ -0,0 +1,1011 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Replay of captured associations against an SCP
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscprepl.h"
+#include "dscpcond.h"
+#include "dscpconn.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmnet/diutil.h"
+#include "dcmtk/dcmdata/dcuid.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#define INCLUDE_CTIME
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+END_EXTERN_C
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// PDU types
+#define SCP_REPLAY_PDU_ASSOCIATE_RQ 0x01
+#define SCP_REPLAY_PDU_ASSOCIATE_AC 0x02
+#define SCP_REPLAY_PDU_ASSOCIATE_RJ 0x03
+#define SCP_REPLAY_PDU_DATA 0x04
+#define SCP_REPLAY_PDU_RELEASE_RQ 0x05
+#define SCP_REPLAY_PDU_RELEASE_RP 0x06
+#define SCP_REPLAY_PDU_ABORT 0x07
+
+// offset and length of the called AE title in an A-ASSOCIATE-RQ PDU
+#define SCP_REPLAY_CALLED_AE_OFFSET 10
+#define SCP_REPLAY_AE_LENGTH 16
+
+// size of a PDV item header (item length, presentation context ID, message control header)
+#define SCP_REPLAY_PDV_HEADER_SIZE 6
+
+// bits of the message control header of a PDV
+#define SCP_REPLAY_PDV_COMMAND 0x01
+#define SCP_REPLAY_PDV_LAST 0x02
+
+// bit of the command field set for responses
+#define SCP_REPLAY_RESPONSE 0x8000
+
+// value of Command Data Set Type if no dataset follows
+#define SCP_REPLAY_NO_DATASET 0x0101
+
+// status of a successful response
+#define SCP_REPLAY_STATUS_SUCCESS 0x0000
+
+// size of the Command Group Length element in a command set (tag, length, value)
+#define SCP_REPLAY_GROUP_LENGTH_SIZE 12
+
+// prefix of the well-known UIDs defined by the standard, which are never replaced
+#define SCP_REPLAY_WELL_KNOWN_UID_PREFIX "1.2.840.10008."
+
+// number of bytes received at once
+#define SCP_REPLAY_RECEIVE_SIZE 65536
+
+
+// commands of the requests the latencies are reported for, the last entry counts the rest
+static const struct
+{
+  Uint16 commandField;
+  const char *name;
+} replayCommands[SCP_REPLAY_COMMANDS] =
+{
+  { 0x0001, "C-STORE" },
+  { 0x0010, "C-GET" },
+  { 0x0020, "C-FIND" },
+  { 0x0021, "C-MOVE" },
+  { 0x0030, "C-ECHO" },
+  { 0x0100, "N-EVENT-REPORT" },
+  { 0x0110, "N-GET" },
+  { 0x0120, "N-SET" },
+  { 0x0130, "N-ACTION" },
+  { 0x0140, "N-CREATE" },
+  { 0x0150, "N-DELETE" },
+  { 0x0000, "other" }
+};
+
+
+// helper functions for reading numbers in PDUs (big endian) and command sets (little endian)
+
+static Uint32 getUint32BE(const Uint8 *data)
+{
+  return (OFstatic_cast(Uint32, data[0]) << 24) | (OFstatic_cast(Uint32, data[1]) << 16) |
+    (OFstatic_cast(Uint32, data[2]) << 8) | data[3];
+}
+
+
+static Uint16 getUint16LE(const Uint8 *data)
+{
+  return OFstatic_cast(Uint16, data[0] | (data[1] << 8));
+}
+
+
+static Uint32 getUint32LE(const Uint8 *data)
+{
+  return OFstatic_cast(Uint32, data[0]) | (OFstatic_cast(Uint32, data[1]) << 8) |
+    (OFstatic_cast(Uint32, data[2]) << 16) | (OFstatic_cast(Uint32, data[3]) << 24);
+}
+
+
+static void putUint32BE(Uint8 *data,
+                        const Uint32 value)
+{
+  data[0] = OFstatic_cast(Uint8, value >> 24);
+  data[1] = OFstatic_cast(Uint8, value >> 16);
+  data[2] = OFstatic_cast(Uint8, value >> 8);
+  data[3] = OFstatic_cast(Uint8, value);
+}
+
+
+static void putUint32LE(Uint8 *data,
+                        const Uint32 value)
+{
+  data[0] = OFstatic_cast(Uint8, value);
+  data[1] = OFstatic_cast(Uint8, value >> 8);
+  data[2] = OFstatic_cast(Uint8, value >> 16);
+  data[3] = OFstatic_cast(Uint8, value >> 24);
+}
+
+
+// get the name of a request type from the command field
+static const char *getCommandName(const Uint16 commandField)
+{
+  size_t i = 0;
+  while ((i < SCP_REPLAY_COMMANDS - 1) && (replayCommands[i].commandField != commandField))
+    ++i;
+  return replayCommands[i].name;
+}
+
+
+// sleep until an absolute time, see DcmMetricsRegistry::now()
+static void sleepUntil(const Uint64 time)
+{
+  struct timespec ts;
+  ts.tv_sec = OFstatic_cast(time_t, time / 1000000);
+  ts.tv_nsec = OFstatic_cast(long, (time % 1000000) * 1000);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+
+// print a latency in microseconds as milliseconds with three decimals
+static void printMilliseconds(STD_NAMESPACE ostream &out,
+                              const Uint64 microseconds)
+{
+  char buf[32];
+  sprintf(buf, "%10.3f", OFstatic_cast(double, microseconds) / 1000.0);
+  out << buf;
+}
+
+
+// print a row of the latency table
+static void printLatencies(STD_NAMESPACE ostream &out,
+                           const char *name,
+                           const DcmLatencyHistogram &histogram)
+{
+  const Uint64 count = histogram.getCount();
+  if (count == 0)
+    return;
+  char buf[64];
+  sprintf(buf, "%-22s %8lu ", name, OFstatic_cast(unsigned long, count));
+  out << buf;
+  printMilliseconds(out, histogram.getSum() / count);
+  out << ' ';
+  printMilliseconds(out, histogram.getQuantile(0.5));
+  out << ' ';
+  printMilliseconds(out, histogram.getQuantile(0.9));
+  out << ' ';
+  printMilliseconds(out, histogram.getQuantile(0.99));
+  out << ' ';
+  printMilliseconds(out, histogram.getQuantile(0.999));
+  out << ' ';
+  printMilliseconds(out, histogram.getQuantile(1.0));
+  out << OFendl;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmReplayConfig::DcmReplayConfig()
+  : peerHost()
+  , peerPort(104)
+  , peerAETitle()
+  , speed(1.0)
+  , window(1)
+  , timeout(SCP_REPLAY_DEFAULT_TIMEOUT)
+  , keepUIDs(OFFalse)
+{
+}
+
+// ----------------------------------------------------------------------------
+
+DcmReplayUIDMap::DcmReplayUIDMap()
+  : m_uids()
+  , m_mutex()
+{
+}
+
+
+OFString DcmReplayUIDMap::map(const OFString &uid,
+                              const Uint32 round)
+{
+  char buf[100];
+  sprintf(buf, " %lu", OFstatic_cast(unsigned long, round));
+  const OFString key = uid + buf;
+  m_mutex.lock();
+  OFString &replacement = m_uids[key];
+  if (replacement.empty())
+    replacement = dcmGenerateUniqueIdentifier(buf, SITE_INSTANCE_UID_ROOT);
+  const OFString result = replacement;
+  m_mutex.unlock();
+  return result;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmReplaySchedule::DcmReplaySchedule(const OFVector<DcmCapturedSession> &sessions,
+                                     const double speed,
+                                     const Uint32 rounds)
+  : m_sessions(sessions)
+  , m_speed(speed)
+  , m_count(OFstatic_cast(Uint64, sessions.size()) * rounds)
+  , m_firstStart(0)
+  , m_span(0)
+  , m_startTime(0)
+  , m_next(0)
+{
+  // a round lasts from the start of the first to the end of the last session
+  Uint64 lastEnd = 0;
+  for (size_t i = 0; i < sessions.size(); ++i)
+  {
+    const DcmCapturedSession &session = sessions[i];
+    if ((i == 0) || (session.startTime < m_firstStart))
+      m_firstStart = session.startTime;
+    Uint64 end = session.startTime + session.duration;
+    if (!session.pdus.empty() && (session.startTime + session.pdus.back().offset > end))
+      end = session.startTime + session.pdus.back().offset;
+    if (end > lastEnd)
+      lastEnd = end;
+  }
+  m_span = (lastEnd > m_firstStart) ? lastEnd - m_firstStart : 1;
+}
+
+
+void DcmReplaySchedule::start()
+{
+  m_next = 0;
+  m_startTime = DcmMetricsRegistry::now();
+}
+
+
+OFBool DcmReplaySchedule::next(const DcmCapturedSession *&session,
+                               Uint64 &dueTime,
+                               Uint32 &round)
+{
+  const Uint64 index = __sync_fetch_and_add(&m_next, 1);
+  if (index >= m_count)
+    return OFFalse;
+  const size_t count = m_sessions.size();
+  session = &m_sessions[OFstatic_cast(size_t, index % count)];
+  round = OFstatic_cast(Uint32, index / count);
+  if (m_speed > 0)
+  {
+    const Uint64 offset = (session->startTime - m_firstStart) + (index / count) * m_span;
+    dueTime = m_startTime + OFstatic_cast(Uint64, OFstatic_cast(double, offset) / m_speed);
+  } else
+    dueTime = 0;
+  return OFTrue;
+}
+
+
+Uint64 DcmReplaySchedule::getStartTime() const
+{
+  return m_startTime;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmReplayStatistics::DcmReplayStatistics()
+  : m_completedSessions(0)
+  , m_rejectedSessions(0)
+  , m_failedSessions(0)
+  , m_pdus(0)
+  , m_bytes(0)
+  , m_statuses()
+  , m_statusMutex()
+{
+}
+
+
+void DcmReplayStatistics::record(const DcmReplayMeasure measure,
+                                 const Uint64 latency)
+{
+  m_latencies[measure].record(latency);
+}
+
+
+void DcmReplayStatistics::recordRequest(const Uint16 commandField,
+                                        const Uint64 latency)
+{
+  size_t i = 0;
+  while ((i < SCP_REPLAY_COMMANDS - 1) && (replayCommands[i].commandField != commandField))
+    ++i;
+  m_requests[i].record(latency);
+}
+
+
+void DcmReplayStatistics::countStatus(const Uint16 commandField,
+                                      const Uint16 status)
+{
+  const Uint32 key = (OFstatic_cast(Uint32, commandField) << 16) | status;
+  m_statusMutex.lock();
+  ++m_statuses[key];
+  m_statusMutex.unlock();
+}
+
+
+void DcmReplayStatistics::countSession(const OFBool successful,
+                                       const OFBool rejected)
+{
+  if (!successful)
+    __sync_fetch_and_add(&m_failedSessions, 1);
+  else if (rejected)
+    __sync_fetch_and_add(&m_rejectedSessions, 1);
+  else
+    __sync_fetch_and_add(&m_completedSessions, 1);
+}
+
+
+void DcmReplayStatistics::countPDU(const size_t bytes)
+{
+  __sync_fetch_and_add(&m_pdus, 1);
+  __sync_fetch_and_add(&m_bytes, OFstatic_cast(Uint64, bytes));
+}
+
+
+Uint64 DcmReplayStatistics::getFailedSessions() const
+{
+  return m_failedSessions;
+}
+
+
+void DcmReplayStatistics::print(STD_NAMESPACE ostream &out,
+                                const Uint64 elapsed) const
+{
+  static const char *names[SCP_RM_Count] =
+  {
+    "association setup",
+    "session",
+    "session start lag"
+  };
+  const double seconds = OFstatic_cast(double, elapsed) / 1000000.0;
+  Uint64 requests = 0;
+  for (size_t i = 0; i < SCP_REPLAY_COMMANDS; ++i)
+    requests += m_requests[i].getCount();
+  Uint64 unsuccessful = 0;
+  OFMap<Uint32, Uint64>::const_iterator it;
+  for (it = m_statuses.begin(); it != m_statuses.end(); ++it)
+    unsuccessful += it->second;
+  char buf[128];
+  out << "Sessions replayed:      " << m_completedSessions << OFendl;
+  out << "Sessions rejected:      " << m_rejectedSessions << OFendl;
+  out << "Sessions failed:        " << m_failedSessions << OFendl;
+  out << "PDUs sent:              " << m_pdus << " (" << m_bytes << " bytes)" << OFendl;
+  out << "Requests answered:      " << requests << OFendl;
+  out << "Unsuccessful responses: " << unsuccessful << OFendl;
+  if (seconds > 0)
+  {
+    sprintf(buf, "%.3f s, %.1f sessions/s, %.1f requests/s, %.2f MB/s", seconds,
+      OFstatic_cast(double, m_completedSessions + m_rejectedSessions) / seconds,
+      OFstatic_cast(double, requests) / seconds,
+      OFstatic_cast(double, m_bytes) / seconds / 1000000.0);
+    out << "Replayed:               " << buf << OFendl;
+  }
+  out << OFendl;
+  if (unsuccessful > 0)
+  {
+    // e.g. duplicates if the SCP still has the instances created by an earlier replay
+    sprintf(buf, "%-22s %8s", "Response status", "count");
+    out << buf << OFendl;
+    for (it = m_statuses.begin(); it != m_statuses.end(); ++it)
+    {
+      char name[32];
+      sprintf(name, "%s %04X", getCommandName(OFstatic_cast(Uint16, it->first >> 16)),
+        OFstatic_cast(unsigned int, it->first & 0xffff));
+      sprintf(buf, "%-22s %8lu", name, OFstatic_cast(unsigned long, it->second));
+      out << buf << OFendl;
+    }
+    out << OFendl;
+  }
+  sprintf(buf, "%-22s %8s %10s %10s %10s %10s %10s %10s", "Latency (ms)", "count",
+    "mean", "p50", "p90", "p99", "p99.9", "max");
+  out << buf << OFendl;
+  for (size_t i = 0; i < SCP_REPLAY_COMMANDS; ++i)
+    printLatencies(out, replayCommands[i].name, m_requests[i]);
+  for (size_t i = 0; i < SCP_RM_Count; ++i)
+    printLatencies(out, names[i], m_latencies[i]);
+}
+
+// ----------------------------------------------------------------------------
+
+DcmReplayWorker::Message::Message()
+  : command()
+  , commandComplete(OFFalse)
+  , commandField(0)
+  , messageID(0)
+  , status(SCP_REPLAY_STATUS_SUCCESS)
+  , hasDataset(OFFalse)
+{
+}
+
+
+void DcmReplayWorker::Message::clear()
+{
+  command.clear();
+  commandComplete = OFFalse;
+  commandField = 0;
+  messageID = 0;
+  status = SCP_REPLAY_STATUS_SUCCESS;
+  hasDataset = OFFalse;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmReplayWorker::DcmReplayWorker(const DcmReplayConfig &config,
+                                 DcmReplaySchedule &schedule,
+                                 DcmReplayStatistics &statistics,
+                                 DcmReplayUIDMap &uids,
+                                 const Uint32 index)
+  : OFThread()
+  , m_config(config)
+  , m_schedule(schedule)
+  , m_statistics(statistics)
+  , m_uids(uids)
+  , m_index(index)
+  , m_round(0)
+  , m_socket(-1)
+  , m_input()
+  , m_sent()
+  , m_received()
+  , m_outstanding()
+  , m_peerRequests()
+  , m_associateTime(0)
+  , m_reply(0)
+  , m_released(OFFalse)
+  , m_closed(OFFalse)
+{
+}
+
+
+DcmReplayWorker::~DcmReplayWorker()
+{
+  disconnect();
+}
+
+
+void DcmReplayWorker::run()
+{
+  const DcmCapturedSession *session = NULL;
+  Uint64 dueTime;
+  Uint32 round;
+  while (m_schedule.next(session, dueTime, round))
+  {
+    OFBool rejected = OFFalse;
+    const OFCondition cond = replaySession(*session, dueTime, round, rejected);
+    m_statistics.countSession(cond.good(), rejected);
+    disconnect();
+  }
+}
+
+
+OFCondition DcmReplayWorker::replaySession(const DcmCapturedSession &session,
+                                           const Uint64 dueTime,
+                                           const Uint32 round,
+                                           OFBool &rejected)
+{
+  rejected = OFFalse;
+  m_round = round;
+  if (dueTime > 0)
+  {
+    const Uint64 now = DcmMetricsRegistry::now();
+    if (now < dueTime)
+      sleepUntil(dueTime);
+    m_statistics.record(SCP_RM_StartLag, (now > dueTime) ? now - dueTime : 0);
+  }
+  m_input.clear();
+  m_sent.clear();
+  m_received.clear();
+  m_outstanding.clear();
+  m_peerRequests.clear();
+  m_associateTime = 0;
+  m_reply = 0;
+  m_released = OFFalse;
+  m_closed = OFFalse;
+
+  OFCondition cond = connect();
+  if (cond.bad())
+    return cond;
+  const Uint64 sessionStart = DcmMetricsRegistry::now();
+  DCMNET_DEBUG("Worker " << m_index << ": replaying session of " << session.peerAddress
+    << " with " << session.pdus.size() << " PDU(s)");
+
+  for (size_t i = 0; cond.good() && (i < session.pdus.size()); ++i)
+  {
+    const DcmCapturedPDU &captured = session.pdus[i];
+    OFVector<Uint8> pdu(captured.data);
+    const Uint8 type = pdu[0];
+    WaitCondition before = WC_None;
+    WaitCondition after = WC_None;
+    OFVector<Message> completed;
+    size_t patchOffset = 0;
+    if (type == SCP_REPLAY_PDU_ASSOCIATE_RQ)
+    {
+      if (!m_config.peerAETitle.empty() && (pdu.size() >= SCP_REPLAY_CALLED_AE_OFFSET + SCP_REPLAY_AE_LENGTH))
+      {
+        // AE titles are padded with spaces to 16 characters
+        Uint8 *calledAE = &pdu[SCP_REPLAY_CALLED_AE_OFFSET];
+        memset(calledAE, ' ', SCP_REPLAY_AE_LENGTH);
+        memcpy(calledAE, m_config.peerAETitle.c_str(),
+          (m_config.peerAETitle.length() < SCP_REPLAY_AE_LENGTH) ? m_config.peerAETitle.length() : SCP_REPLAY_AE_LENGTH);
+      }
+      after = WC_AssociationReply;
+    }
+    else if (type == SCP_REPLAY_PDU_DATA)
+    {
+      if (!m_config.keepUIDs)
+        replaceUIDs(pdu);
+      before = trackPDVs(&pdu[0], pdu.size(), m_sent, completed, patchOffset);
+    }
+    else if (type == SCP_REPLAY_PDU_RELEASE_RQ)
+    {
+      before = WC_AllResponses;
+      after = WC_ReleaseReply;
+    }
+
+    // keep the captured pace (if any), but never overtake the SCP
+    const Uint64 sendTime = (m_config.speed > 0) ?
+      sessionStart + OFstatic_cast(Uint64, OFstatic_cast(double, captured.offset) / m_config.speed) : 0;
+    cond = waitFor(before, sendTime);
+    if (cond.bad())
+      break;
+    if (before == WC_PeerRequest)
+    {
+      if (patchOffset > 0)
+      {
+        pdu[patchOffset] = OFstatic_cast(Uint8, m_peerRequests.front());
+        pdu[patchOffset + 1] = OFstatic_cast(Uint8, m_peerRequests.front() >> 8);
+      }
+      m_peerRequests.erase(m_peerRequests.begin());
+    }
+    if (type == SCP_REPLAY_PDU_ASSOCIATE_RQ)
+      m_associateTime = DcmMetricsRegistry::now();
+    cond = sendPDU(pdu);
+    if (cond.bad())
+      break;
+    const Uint64 now = DcmMetricsRegistry::now();
+    for (size_t j = 0; j < completed.size(); ++j)
+    {
+      if ((completed[j].commandField & SCP_REPLAY_RESPONSE) == 0)
+      {
+        Request request;
+        request.commandField = completed[j].commandField;
+        request.sendTime = now;
+        m_outstanding.push_back(request);
+      }
+    }
+    if (type == SCP_REPLAY_PDU_ABORT)
+      break;
+    cond = waitFor(after, 0);
+    if (cond.good() && (type == SCP_REPLAY_PDU_ASSOCIATE_RQ) && (m_reply != SCP_REPLAY_PDU_ASSOCIATE_AC))
+    {
+      // replaying a rejected association is fine, it may have been rejected when captured
+      rejected = (m_reply == SCP_REPLAY_PDU_ASSOCIATE_RJ);
+      if (!rejected)
+        cond = SCP_EC_ReplayFailed;
+      break;
+    }
+  }
+
+  // the capture may end without A-RELEASE-RQ, e.g. if the peer was aborted
+  if (cond.good() && !m_released && !rejected)
+    cond = waitFor(WC_AllResponses, 0);
+  if (cond.bad())
+    DCMNET_WARN("Worker " << m_index << ": cannot replay session of " << session.peerAddress
+      << ": " << cond.text());
+  disconnect();
+  m_statistics.record(SCP_RM_Session, DcmMetricsRegistry::now() - sessionStart);
+  return cond;
+}
+
+
+OFCondition DcmReplayWorker::connect()
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  char port[8];
+  sprintf(port, "%u", OFstatic_cast(unsigned int, m_config.peerPort));
+  struct addrinfo *addresses = NULL;
+  const int result = getaddrinfo(m_config.peerHost.c_str(), port, &hints, &addresses);
+  if (result != 0)
+  {
+    DCMNET_ERROR("Worker " << m_index << ": cannot resolve " << m_config.peerHost << ": " << gai_strerror(result));
+    return SCP_EC_ReplayFailed;
+  }
+  int error = 0;
+  for (struct addrinfo *address = addresses; (address != NULL) && (m_socket < 0); address = address->ai_next)
+  {
+    m_socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (m_socket < 0)
+    {
+      error = errno;
+      continue;
+    }
+    if (::connect(m_socket, address->ai_addr, address->ai_addrlen) != 0)
+    {
+      error = errno;
+      ::close(m_socket);
+      m_socket = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (m_socket < 0)
+  {
+    char buf[256];
+    DCMNET_ERROR("Worker " << m_index << ": cannot connect to " << m_config.peerHost << ":" << m_config.peerPort
+      << ": " << OFStandard::strerror(error, buf, sizeof(buf)));
+    return SCP_EC_ReplayFailed;
+  }
+  // the captured PDUs are sent one by one, as by the original peer
+  int noDelay = 1;
+  (void) setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, OFreinterpret_cast(char *, &noDelay), sizeof(noDelay));
+  return EC_Normal;
+}
+
+
+void DcmReplayWorker::disconnect()
+{
+  if (m_socket >= 0)
+  {
+    ::close(m_socket);
+    m_socket = -1;
+  }
+}
+
+
+OFCondition DcmReplayWorker::sendPDU(const OFVector<Uint8> &pdu)
+{
+  size_t sent = 0;
+  while (sent < pdu.size())
+  {
+    const ssize_t result = send(m_socket, OFreinterpret_cast(const char *, &pdu[sent]), pdu.size() - sent, MSG_NOSIGNAL);
+    if (result < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      char buf[256];
+      DCMNET_DEBUG("Worker " << m_index << ": cannot send PDU: " << OFStandard::strerror(errno, buf, sizeof(buf)));
+      return SCP_EC_ReplayFailed;
+    }
+    sent += OFstatic_cast(size_t, result);
+  }
+  m_statistics.countPDU(pdu.size());
+  return EC_Normal;
+}
+
+
+OFCondition DcmReplayWorker::waitFor(const WaitCondition condition,
+                                     const Uint64 time)
+{
+  const Uint64 timeout = DcmMetricsRegistry::now() + OFstatic_cast(Uint64, m_config.timeout) * 1000000;
+  while (OFTrue)
+  {
+    const Uint64 now = DcmMetricsRegistry::now();
+    const OFBool met = isMet(condition);
+    if (met && ((now >= time) || m_closed))
+      return EC_Normal;
+    if (m_closed)
+    {
+      DCMNET_DEBUG("Worker " << m_index << ": connection closed by SCP");
+      return SCP_EC_ReplayFailed;
+    }
+    if (!met && (now >= timeout))
+    {
+      DCMNET_DEBUG("Worker " << m_index << ": no answer from SCP within " << m_config.timeout << " seconds");
+      return SCP_EC_ReplayFailed;
+    }
+    const OFCondition cond = receive(met ? time : timeout);
+    if (cond.bad())
+      return cond;
+  }
+  return EC_Normal;
+}
+
+
+OFBool DcmReplayWorker::isMet(const WaitCondition condition) const
+{
+  switch (condition)
+  {
+    case WC_AssociationReply:
+      return (m_reply != 0);
+    case WC_Window:
+      return (m_outstanding.size() < m_config.window);
+    case WC_PeerRequest:
+      return !m_peerRequests.empty();
+    case WC_AllResponses:
+      return m_outstanding.empty();
+    case WC_ReleaseReply:
+      return m_released;
+    default:
+      return OFTrue;
+  }
+}
+
+
+OFCondition DcmReplayWorker::receive(const Uint64 until)
+{
+  const Uint64 now = DcmMetricsRegistry::now();
+  // round up, so that the loop in waitFor() does not spin until the time has come
+  const int timeout = (until > now) ? OFstatic_cast(int, (until - now + 999) / 1000) : 0;
+  struct pollfd pfd;
+  pfd.fd = m_socket;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  const int ready = poll(&pfd, 1, timeout);
+  if (ready < 0)
+    return (errno == EINTR) ? EC_Normal : SCP_EC_ReplayFailed;
+  if (ready == 0)
+    return EC_Normal;
+
+  const size_t size = m_input.size();
+  m_input.resize(size + SCP_REPLAY_RECEIVE_SIZE);
+  ssize_t result;
+  do
+  {
+    result = recv(m_socket, OFreinterpret_cast(char *, &m_input[size]), SCP_REPLAY_RECEIVE_SIZE, 0);
+  } while ((result < 0) && (errno == EINTR));
+  m_input.resize(size + ((result > 0) ? OFstatic_cast(size_t, result) : 0));
+  if (result <= 0)
+  {
+    m_closed = OFTrue;
+    return EC_Normal;
+  }
+
+  // handle the complete PDUs, keep the rest for the next call
+  size_t pos = 0;
+  while (m_input.size() - pos >= SCP_CONN_PDU_HEADER_SIZE)
+  {
+    const size_t length = SCP_CONN_PDU_HEADER_SIZE + OFstatic_cast(size_t, getUint32BE(&m_input[pos + 2]));
+    if (m_input.size() - pos < length)
+      break;
+    handlePDU(&m_input[pos], length);
+    pos += length;
+  }
+  if (pos > 0)
+  {
+    const size_t rest = m_input.size() - pos;
+    if (rest > 0)
+      memmove(&m_input[0], &m_input[pos], rest);
+    m_input.resize(rest);
+  }
+  return EC_Normal;
+}
+
+
+void DcmReplayWorker::handlePDU(const Uint8 *pdu,
+                                const size_t length)
+{
+  switch (pdu[0])
+  {
+    case SCP_REPLAY_PDU_ASSOCIATE_AC:
+      if (m_associateTime > 0)
+        m_statistics.record(SCP_RM_Association, DcmMetricsRegistry::now() - m_associateTime);
+      m_reply = pdu[0];
+      break;
+    case SCP_REPLAY_PDU_ASSOCIATE_RJ:
+      m_reply = pdu[0];
+      break;
+    case SCP_REPLAY_PDU_DATA:
+    {
+      OFVector<Message> completed;
+      size_t patchOffset;
+      (void) trackPDVs(pdu, length, m_received, completed, patchOffset);
+      const Uint64 now = DcmMetricsRegistry::now();
+      for (size_t i = 0; i < completed.size(); ++i)
+      {
+        if ((completed[i].commandField & SCP_REPLAY_RESPONSE) == 0)
+          m_peerRequests.push_back(completed[i].messageID);
+        else if (!m_outstanding.empty())
+        {
+          // responses are matched in order, as sent by a single-threaded SCP
+          m_statistics.recordRequest(m_outstanding.front().commandField, now - m_outstanding.front().sendTime);
+          if (completed[i].status != SCP_REPLAY_STATUS_SUCCESS)
+            m_statistics.countStatus(m_outstanding.front().commandField, completed[i].status);
+          m_outstanding.erase(m_outstanding.begin());
+        }
+      }
+      break;
+    }
+    case SCP_REPLAY_PDU_RELEASE_RP:
+      m_released = OFTrue;
+      break;
+    case SCP_REPLAY_PDU_ABORT:
+      m_closed = OFTrue;
+      break;
+    default:
+      break;
+  }
+}
+
+
+void DcmReplayWorker::replaceUIDs(OFVector<Uint8> &pdu)
+{
+  size_t pos = SCP_CONN_PDU_HEADER_SIZE;
+  while (pdu.size() - pos >= SCP_REPLAY_PDV_HEADER_SIZE)
+  {
+    Uint32 itemLength = getUint32BE(&pdu[pos]);
+    if ((itemLength < 2) || (itemLength > pdu.size() - pos - 4))
+      break;
+    const size_t dataStart = pos + SCP_REPLAY_PDV_HEADER_SIZE;
+    const size_t dataLength = itemLength - 2;
+    OFVector<Uint8> command;
+    if (((pdu[pos + 5] & (SCP_REPLAY_PDV_COMMAND | SCP_REPLAY_PDV_LAST)) == (SCP_REPLAY_PDV_COMMAND | SCP_REPLAY_PDV_LAST)) &&
+        replaceUID(&pdu[dataStart], dataLength, command))
+    {
+      // the lengths of the PDV item and the PDU change with the length of the UID
+      OFVector<Uint8> result;
+      result.reserve(pdu.size() - dataLength + command.size());
+      result.insert(result.end(), pdu.begin(), pdu.begin() + dataStart);
+      result.insert(result.end(), command.begin(), command.end());
+      result.insert(result.end(), pdu.begin() + dataStart + dataLength, pdu.end());
+      itemLength = OFstatic_cast(Uint32, command.size() + 2);
+      putUint32BE(&result[pos], itemLength);
+      putUint32BE(&result[2], OFstatic_cast(Uint32, result.size() - SCP_CONN_PDU_HEADER_SIZE));
+      pdu = result;
+    }
+    pos += 4 + itemLength;
+  }
+}
+
+
+OFBool DcmReplayWorker::replaceUID(const Uint8 *data,
+                                   const size_t length,
+                                   OFVector<Uint8> &command)
+{
+  // the command set must start with its group length and end in this PDV
+  if ((length < SCP_REPLAY_GROUP_LENGTH_SIZE) || (getUint16LE(data) != 0x0000) || (getUint16LE(data + 2) != 0x0000) ||
+      (getUint32LE(data + 4) != 4) || (getUint32LE(data + 8) != length - SCP_REPLAY_GROUP_LENGTH_SIZE))
+    return OFFalse;
+  Uint16 commandField = 0;
+  size_t uidPos = 0;
+  size_t uidLength = 0;
+  size_t pos = 0;
+  while (length - pos >= 8)
+  {
+    const Uint16 group = getUint16LE(data + pos);
+    const Uint16 element = getUint16LE(data + pos + 2);
+    const Uint32 valueLength = getUint32LE(data + pos + 4);
+    if (valueLength > length - pos - 8)
+      return OFFalse;
+    if ((group == 0x0000) && (element == 0x0100) && (valueLength == 2))
+      commandField = getUint16LE(data + pos + 8);
+    // Affected SOP Instance UID (N-CREATE) or Requested SOP Instance UID
+    else if ((group == 0x0000) && ((element == 0x1000) || (element == 0x1001)))
+    {
+      uidPos = pos;
+      uidLength = valueLength;
+    }
+    pos += 8 + valueLength;
+  }
+  // N-GET, N-SET, N-ACTION, N-CREATE and N-DELETE requests
+  if ((commandField < 0x0110) || (commandField > 0x0150) || (uidPos == 0))
+    return OFFalse;
+  OFString uid(OFreinterpret_cast(const char *, data + uidPos + 8), uidLength);
+  while (!uid.empty() && ((uid[uid.length() - 1] == '\0') || (uid[uid.length() - 1] == ' ')))
+    uid.erase(uid.length() - 1);
+  if (uid.empty() || (uid.compare(0, strlen(SCP_REPLAY_WELL_KNOWN_UID_PREFIX), SCP_REPLAY_WELL_KNOWN_UID_PREFIX) == 0))
+    return OFFalse;
+  const OFString replacement = m_uids.map(uid, m_round);
+  // UIDs are padded with a null byte to an even length
+  const size_t valueLength = replacement.length() + (replacement.length() & 1);
+  command.clear();
+  command.reserve(length - uidLength + valueLength);
+  command.insert(command.end(), data, data + uidPos + 4);
+  command.resize(uidPos + 8, 0);
+  putUint32LE(&command[uidPos + 4], OFstatic_cast(Uint32, valueLength));
+  command.insert(command.end(), replacement.c_str(), replacement.c_str() + replacement.length());
+  command.resize(uidPos + 8 + valueLength, 0);
+  command.insert(command.end(), data + uidPos + 8 + uidLength, data + length);
+  putUint32LE(&command[8], OFstatic_cast(Uint32, command.size() - SCP_REPLAY_GROUP_LENGTH_SIZE));
+  DCMNET_TRACE("Worker " << m_index << ": replacing SOP Instance UID " << uid << " by " << replacement);
+  return OFTrue;
+}
+
+
+DcmReplayWorker::WaitCondition DcmReplayWorker::trackPDVs(const Uint8 *pdu,
+                                                          const size_t length,
+                                                          Message &message,
+                                                          OFVector<Message> &completed,
+                                                          size_t &patchOffset)
+{
+  WaitCondition result = WC_None;
+  patchOffset = 0;
+  size_t pos = SCP_CONN_PDU_HEADER_SIZE;
+  while (length - pos >= SCP_REPLAY_PDV_HEADER_SIZE)
+  {
+    const Uint32 itemLength = getUint32BE(pdu + pos);
+    if ((itemLength < 2) || (itemLength > length - pos - 4))
+      break;
+    const Uint8 control = pdu[pos + 5];
+    const Uint8 *data = pdu + pos + SCP_REPLAY_PDV_HEADER_SIZE;
+    const size_t dataLength = itemLength - 2;
+    if (control & SCP_REPLAY_PDV_COMMAND)
+    {
+      const OFBool starting = message.command.empty();
+      message.command.insert(message.command.end(), data, data + dataLength);
+      if (control & SCP_REPLAY_PDV_LAST)
+      {
+        size_t respondTo = 0;
+        if (!parseCommand(&message.command[0], message.command.size(), message, respondTo))
+          DCMNET_DEBUG("Worker " << m_index << ": no command field in command set");
+        message.commandComplete = OFTrue;
+        // a command set is hardly ever split, only one in a single PDV is considered
+        if (starting && (result == WC_None))
+        {
+          if (message.commandField & SCP_REPLAY_RESPONSE)
+          {
+            result = WC_PeerRequest;
+            if (respondTo > 0)
+              patchOffset = OFstatic_cast(size_t, data - pdu) + respondTo;
+          } else
+            result = WC_Window;
+        }
+        if (!message.hasDataset)
+        {
+          completed.push_back(message);
+          message.clear();
+        }
+      }
+    }
+    else if ((control & SCP_REPLAY_PDV_LAST) && message.commandComplete)
+    {
+      completed.push_back(message);
+      message.clear();
+    }
+    pos += 4 + itemLength;
+  }
+  return result;
+}
+
+
+OFBool DcmReplayWorker::parseCommand(const Uint8 *data,
+                                     const size_t length,
+                                     Message &message,
+                                     size_t &respondTo)
+{
+  OFBool found = OFFalse;
+  message.hasDataset = OFFalse;
+  respondTo = 0;
+  size_t pos = 0;
+  while (length - pos >= 8)
+  {
+    const Uint16 group = getUint16LE(data + pos);
+    const Uint16 element = getUint16LE(data + pos + 2);
+    const Uint32 valueLength = getUint32LE(data + pos + 4);
+    pos += 8;
+    if (valueLength > length - pos)
+      break;
+    if ((group == 0x0000) && (valueLength == 2))
+    {
+      const Uint16 value = getUint16LE(data + pos);
+      if (element == 0x0100)
+      {
+        message.commandField = value;
+        found = OFTrue;
+      }
+      else if (element == 0x0110)
+        message.messageID = value;
+      else if (element == 0x0120)
+        respondTo = pos;
+      else if (element == 0x0900)
+        message.status = value;
+      else if (element == 0x0800)
+        message.hasDataset = (value != SCP_REPLAY_NO_DATASET);
+    }
+    pos += valueLength;
+  }
+  return found;
+}
@@ -0,0 +1,529 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Replay of captured associations against an SCP
+ *
+ */
+
+#ifndef DSCPREPL_H
+#define DSCPREPL_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofmap.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofstream.h"
+#include "dcmtk/ofstd/ofthread.h"
+#include "dcmtk/ofstd/ofvector.h"
+#include "dscpcapt.h"              /* for DcmCapturedSession */
+#include "dscpmetr.h"              /* for DcmLatencyHistogram */
+
+/// default time in seconds to wait for the SCP
+#define SCP_REPLAY_DEFAULT_TIMEOUT 30
+
+/// number of DIMSE request types the latencies are reported for
+#define SCP_REPLAY_COMMANDS 12
+
+/** Latencies measured by the replay, besides those of the requests
+ */
+enum DcmReplayMeasure
+{
+  /// A-ASSOCIATE-RQ sent to A-ASSOCIATE-AC received
+  SCP_RM_Association,
+  /// connection established to connection closed
+  SCP_RM_Session,
+  /// time a session was started after the time it was due (scaled capture time)
+  SCP_RM_StartLag,
+  /// number of measures
+  SCP_RM_Count
+};
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Settings of the replay shared by all sessions
+ */
+struct DcmReplayConfig
+{
+  /** default constructor, sets the defaults
+   */
+  DcmReplayConfig();
+
+  /// host name or address of the SCP
+  OFString peerHost;
+  /// port of the SCP
+  Uint16 peerPort;
+  /// called AE title put into the A-ASSOCIATE-RQ, empty to keep the captured one
+  OFString peerAETitle;
+  /// factor the captured timing is accelerated by, 0 to send as fast as possible
+  double speed;
+  /// maximum number of requests sent without waiting for their responses
+  Uint32 window;
+  /// time in seconds to wait for the SCP
+  Uint32 timeout;
+  /// OFTrue to send the SOP Instance UIDs of the requests as captured
+  OFBool keepUIDs;
+};
+
+
+/** Replacements of the SOP Instance UIDs of the captured requests, shared by all
+ *  workers. An SCP like mppsrecv keeps the instances created, so a captured N-CREATE
+ *  sent twice fails as duplicate and an N-SET of a completed instance fails as well.
+ *  Each captured UID is therefore replaced by a new UID per round, the same in all
+ *  sessions of the round (an instance is often created and updated on different
+ *  associations).
+ */
+class DcmReplayUIDMap
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmReplayUIDMap();
+
+    /** Get the replacement of a captured UID, a new UID on first use
+     *  @param uid   [in] The captured UID
+     *  @param round [in] Number of the round, starting with 0
+     *  @return The replacement
+     */
+    OFString map(const OFString &uid,
+                 const Uint32 round);
+
+  private:
+
+    /// replacements by captured UID and round (separated by a space)
+    OFMap<OFString, OFString> m_uids;
+
+    /// mutex protecting the replacements
+    OFMutex m_mutex;
+
+    // private undefined copy constructor
+    DcmReplayUIDMap(const DcmReplayUIDMap &);
+
+    // private undefined assignment operator
+    DcmReplayUIDMap &operator=(const DcmReplayUIDMap &);
+};
+
+
+/** Schedule of the captured sessions shared by all workers. With a speed factor,
+ *  each session is due at the time it started in the capture (relative to the first
+ *  one) divided by the factor, no matter how long earlier sessions took; repeated
+ *  rounds follow each other without a gap. Without a speed factor, each session is
+ *  due as soon as a worker is free.
+ */
+class DcmReplaySchedule
+{
+
+  public:
+
+    /** constructor
+     *  @param sessions [in] The captured sessions, must exist as long as the schedule
+     *  @param speed    [in] Factor the captured timing is accelerated by, 0 for none
+     *  @param rounds   [in] Number of times all sessions are replayed
+     */
+    DcmReplaySchedule(const OFVector<DcmCapturedSession> &sessions,
+                      const double speed,
+                      const Uint32 rounds);
+
+    /** Start the schedule now
+     */
+    void start();
+
+    /** Get the next session to replay
+     *  @param session [out] The session
+     *  @param dueTime [out] Time the session is due (see DcmMetricsRegistry::now()),
+     *                       0 if it is due as soon as a worker is ready
+     *  @param round   [out] Number of the round the session belongs to, starting with 0
+     *  @return OFTrue if a session is due, OFFalse if the replay is over
+     */
+    OFBool next(const DcmCapturedSession *&session,
+                Uint64 &dueTime,
+                Uint32 &round);
+
+    /** Returns the time the schedule was started
+     *  @return The time, see DcmMetricsRegistry::now()
+     */
+    Uint64 getStartTime() const;
+
+  private:
+
+    /// the captured sessions
+    const OFVector<DcmCapturedSession> &m_sessions;
+
+    /// factor the captured timing is accelerated by, 0 for none
+    double m_speed;
+
+    /// number of sessions replayed in total
+    Uint64 m_count;
+
+    /// start time of the first session in the capture (microseconds since the epoch)
+    Uint64 m_firstStart;
+
+    /// time covered by the capture in microseconds, the length of a round
+    Uint64 m_span;
+
+    /// time the schedule was started
+    Uint64 m_startTime;
+
+    /// number of the next session
+    volatile Uint64 m_next;
+};
+
+
+/** Counters and latency histograms of a replay, updated by all workers
+ */
+class DcmReplayStatistics
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmReplayStatistics();
+
+    /** Record a latency
+     *  @param measure [in] What has been measured
+     *  @param latency [in] The latency in microseconds
+     */
+    void record(const DcmReplayMeasure measure,
+                const Uint64 latency);
+
+    /** Record the latency of a request
+     *  @param commandField [in] Command field of the request
+     *  @param latency      [in] Time from sending the request to receiving its
+     *                           response in microseconds
+     */
+    void recordRequest(const Uint16 commandField,
+                       const Uint64 latency);
+
+    /** Count a response that is not successful
+     *  @param commandField [in] Command field of the request
+     *  @param status       [in] Status of the response
+     */
+    void countStatus(const Uint16 commandField,
+                     const Uint16 status);
+
+    /** Count a session replayed
+     *  @param successful [in] OFTrue if replayed completely, OFFalse otherwise
+     *  @param rejected   [in] OFTrue if the association has been rejected
+     */
+    void countSession(const OFBool successful,
+                      const OFBool rejected);
+
+    /** Count a PDU sent
+     *  @param bytes [in] Size of the PDU
+     */
+    void countPDU(const size_t bytes);
+
+    /** Print the counters, the statuses of the responses not successful and the
+     *  latency percentiles. Only to be called when the workers have finished.
+     *  @param out     [out] Stream the report is printed to
+     *  @param elapsed [in]  Time the replay lasted in microseconds
+     */
+    void print(STD_NAMESPACE ostream &out,
+               const Uint64 elapsed) const;
+
+    /** Returns the number of sessions that failed
+     *  @return The number of sessions
+     */
+    Uint64 getFailedSessions() const;
+
+  private:
+
+    /// latencies per measure
+    DcmLatencyHistogram m_latencies[SCP_RM_Count];
+
+    /// latencies of the requests per command
+    DcmLatencyHistogram m_requests[SCP_REPLAY_COMMANDS];
+
+    /// number of sessions replayed completely
+    volatile Uint64 m_completedSessions;
+
+    /// number of sessions whose association was rejected
+    volatile Uint64 m_rejectedSessions;
+
+    /// number of sessions that failed
+    volatile Uint64 m_failedSessions;
+
+    /// number of PDUs sent
+    volatile Uint64 m_pdus;
+
+    /// number of bytes sent
+    volatile Uint64 m_bytes;
+
+    /// number of responses not successful by command field (high word) and status
+    OFMap<Uint32, Uint64> m_statuses;
+
+    /// mutex protecting the statuses
+    OFMutex m_statusMutex;
+
+    // private undefined copy constructor
+    DcmReplayStatistics(const DcmReplayStatistics &);
+
+    // private undefined assignment operator
+    DcmReplayStatistics &operator=(const DcmReplayStatistics &);
+};
+
+
+/** Thread replaying captured sessions over TCP connections of its own, as scheduled
+ *  by a DcmReplaySchedule. The captured PDUs are sent unchanged, so the SCP sees the
+ *  same traffic as during the capture, except for the called AE title (if configured)
+ *  and the SOP Instance UIDs of N-GET, N-SET, N-ACTION, N-CREATE and N-DELETE requests,
+ *  which are replaced per round (see DcmReplayUIDMap) unless they are well-known UIDs
+ *  or to be kept. UIDs in datasets are not replaced, nor are UIDs an SCP assigned to
+ *  instances created without one (later requests of the capture still refer to them).
+ *  Each PDU is sent at its captured time divided by the speed factor, but never
+ *  before the SCP has answered what the peer was waiting for: the A-ASSOCIATE-RQ and
+ *  the A-RELEASE-RQ, requests beyond the window of outstanding requests, and the
+ *  requests of the SCP (e.g.\ N-EVENT-REPORT) a captured response answers. The
+ *  Message ID Being Responded To of such a response is replaced by the message ID of
+ *  the request received. The PDUs of the SCP are read while waiting, so the time from
+ *  sending a request to receiving its response is measured.
+ */
+class DcmReplayWorker : public OFThread
+{
+
+  public:
+
+    /** constructor
+     *  @param config     [in] Settings, must exist as long as the worker
+     *  @param schedule   [in] Schedule of the sessions
+     *  @param statistics [in] Counters and histograms updated
+     *  @param uids       [in] Replacements of the SOP Instance UIDs
+     *  @param index      [in] Number of the worker, for the log output
+     */
+    DcmReplayWorker(const DcmReplayConfig &config,
+                    DcmReplaySchedule &schedule,
+                    DcmReplayStatistics &statistics,
+                    DcmReplayUIDMap &uids,
+                    const Uint32 index);
+
+    /** destructor. Closes the connection, if any.
+     */
+    virtual ~DcmReplayWorker();
+
+  protected:
+
+    /** Replay sessions until the schedule is over
+     */
+    virtual void run();
+
+  private:
+
+    /** What a worker waits for before sending the next PDU
+     */
+    enum WaitCondition
+    {
+      /// nothing
+      WC_None,
+      /// A-ASSOCIATE-AC or A-ASSOCIATE-RJ
+      WC_AssociationReply,
+      /// fewer outstanding requests than the window
+      WC_Window,
+      /// a request of the SCP not yet answered
+      WC_PeerRequest,
+      /// responses to all requests sent
+      WC_AllResponses,
+      /// A-RELEASE-RP
+      WC_ReleaseReply
+    };
+
+    /** Progress of a DIMSE message sent or received in P-DATA-TF PDUs
+     */
+    struct Message
+    {
+      /** default constructor
+       */
+      Message();
+
+      /** Forget the message, e.g.\ once it is complete
+       */
+      void clear();
+
+      /// fragments of the command set received so far
+      OFVector<Uint8> command;
+      /// OFTrue once the command set is complete
+      OFBool commandComplete;
+      /// command field from the command set
+      Uint16 commandField;
+      /// message ID (requests) from the command set
+      Uint16 messageID;
+      /// status (responses) from the command set
+      Uint16 status;
+      /// OFTrue if a dataset follows the command set
+      OFBool hasDataset;
+    };
+
+    /** A request sent, waiting for its response
+     */
+    struct Request
+    {
+      /// command field of the request
+      Uint16 commandField;
+      /// time the request was sent, see DcmMetricsRegistry::now()
+      Uint64 sendTime;
+    };
+
+    /** Replay one session
+     *  @param session  [in]  The session
+     *  @param dueTime  [in]  Time the session is due, 0 if due as soon as possible
+     *  @param round    [in]  Number of the round the session belongs to
+     *  @param rejected [out] OFTrue if the SCP rejected the association
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition replaySession(const DcmCapturedSession &session,
+                              const Uint64 dueTime,
+                              const Uint32 round,
+                              OFBool &rejected);
+
+    /** Open a TCP connection to the SCP
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition connect();
+
+    /** Close the TCP connection (if any)
+     */
+    void disconnect();
+
+    /** Send a PDU
+     *  @param pdu [in] The PDU
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition sendPDU(const OFVector<Uint8> &pdu);
+
+    /** Read PDUs of the SCP until a condition is met and a time has come
+     *  @param condition [in] What to wait for
+     *  @param time      [in] Time to wait for (see DcmMetricsRegistry::now()), 0 for none
+     *  @return EC_Normal if successful, an error code if the SCP does not answer in
+     *          time or the connection is lost
+     */
+    OFCondition waitFor(const WaitCondition condition,
+                        const Uint64 time);
+
+    /** Check whether a condition is met
+     *  @param condition [in] The condition
+     *  @return OFTrue if met, OFFalse otherwise
+     */
+    OFBool isMet(const WaitCondition condition) const;
+
+    /** Receive data from the SCP (waiting at most until a time) and handle the
+     *  complete PDUs received
+     *  @param until [in] Time to wait until, see DcmMetricsRegistry::now()
+     *  @return EC_Normal if successful (also if nothing has been received in time),
+     *          an error code if the connection is lost
+     */
+    OFCondition receive(const Uint64 until);
+
+    /** Handle a PDU received from the SCP
+     *  @param pdu    [in] The PDU including its header
+     *  @param length [in] Length of the PDU
+     */
+    void handlePDU(const Uint8 *pdu,
+                   const size_t length);
+
+    /** Replace the SOP Instance UIDs of the requests in a P-DATA-TF PDU by those of
+     *  the current round. Only command sets in a single PDV are considered.
+     *  @param pdu [inout] The PDU including its header, resized if the length of a UID
+     *                     changes
+     */
+    void replaceUIDs(OFVector<Uint8> &pdu);
+
+    /** Replace the SOP Instance UID of a request in a command set
+     *  @param data    [in]  The command set (implicit VR little endian)
+     *  @param length  [in]  Length of the command set
+     *  @param command [out] The command set with the UID replaced
+     *  @return OFTrue if a UID has been replaced, OFFalse otherwise
+     */
+    OFBool replaceUID(const Uint8 *data,
+                      const size_t length,
+                      OFVector<Uint8> &command);
+
+    /** Track the PDVs of a P-DATA-TF PDU
+     *  @param pdu         [in]    The PDU including its header
+     *  @param length      [in]    Length of the PDU
+     *  @param message     [inout] Message the PDVs belong to
+     *  @param completed   [out]   Messages completed by the PDU
+     *  @param patchOffset [out]   Offset of the Message ID Being Responded To of a
+     *                             response starting in the PDU, 0 if none
+     *  @return WC_PeerRequest if the PDU starts a response, WC_Window if it starts a
+     *          request, WC_None otherwise
+     */
+    WaitCondition trackPDVs(const Uint8 *pdu,
+                            const size_t length,
+                            Message &message,
+                            OFVector<Message> &completed,
+                            size_t &patchOffset);
+
+    /** Get the values needed from a command set
+     *  @param data      [in]  The command set (implicit VR little endian)
+     *  @param length    [in]  Length of the command set
+     *  @param message   [out] The message
+     *  @param respondTo [out] Offset of the value of Message ID Being Responded To,
+     *                         0 if not present
+     *  @return OFTrue if the command field has been found, OFFalse otherwise
+     */
+    static OFBool parseCommand(const Uint8 *data,
+                               const size_t length,
+                               Message &message,
+                               size_t &respondTo);
+
+    /// settings
+    const DcmReplayConfig &m_config;
+
+    /// schedule of the sessions
+    DcmReplaySchedule &m_schedule;
+
+    /// counters and histograms
+    DcmReplayStatistics &m_statistics;
+
+    /// replacements of the SOP Instance UIDs
+    DcmReplayUIDMap &m_uids;
+
+    /// number of the worker
+    Uint32 m_index;
+
+    /// number of the round of the current session
+    Uint32 m_round;
+
+    /// the socket of the connection, -1 if none
+    int m_socket;
+
+    /// data received from the SCP and not yet handled
+    OFVector<Uint8> m_input;
+
+    /// message sent currently
+    Message m_sent;
+
+    /// message received currently
+    Message m_received;
+
+    /// requests sent waiting for their responses, oldest first
+    OFVector<Request> m_outstanding;
+
+    /// message IDs of the requests of the SCP not yet answered, oldest first
+    OFVector<Uint16> m_peerRequests;
+
+    /// time the A-ASSOCIATE-RQ was sent, 0 if not yet
+    Uint64 m_associateTime;
+
+    /// PDU type of the association reply received, 0 if none
+    Uint8 m_reply;
+
+    /// OFTrue if the A-RELEASE-RP has been received
+    OFBool m_released;
+
+    /// OFTrue if the SCP aborted the association or closed the connection
+    OFBool m_closed;
+
+    // private undefined copy constructor
+    DcmReplayWorker(const DcmReplayWorker &);
+
+    // private undefined assignment operator
+    DcmReplayWorker &operator=(const DcmReplayWorker &);
+};
+
+#endif // DSCPREPL_H
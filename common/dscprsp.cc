@@ -0,0 +1,215 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Encoder for DIMSE responses using pre-encoded command sets
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscprsp.h"
+#include "dcmtk/dcmnet/dul.h"
+#include "dcmtk/dcmnet/diutil.h"
+#include "dcmtk/dcmdata/dcuid.h"
+
+#define INCLUDE_CSTRING
+#include "dcmtk/ofstd/ofstdinc.h"
+
+// size of the tag and length field of an element in implicit VR little endian
+#define DIMSE_RSP_ELEMENT_HEADER 8
+
+// size of the complete command group length element
+#define DIMSE_RSP_GROUP_LENGTH_SIZE 12
+
+// maximum number of templates kept (a few per SOP class and status in practice)
+#define DIMSE_RSP_MAX_TEMPLATES 64
+
+// value of Command Data Set Type if there is no dataset
+#define DIMSE_RSP_NO_DATASET 0x0101
+
+
+// helper functions for encoding command set elements (implicit VR little endian)
+
+static void putUint16(Uint8 *buffer, const Uint16 value)
+{
+  buffer[0] = OFstatic_cast(Uint8, value);
+  buffer[1] = OFstatic_cast(Uint8, value >> 8);
+}
+
+
+static void putUint32(Uint8 *buffer, const Uint32 value)
+{
+  putUint16(buffer, OFstatic_cast(Uint16, value));
+  putUint16(buffer + 2, OFstatic_cast(Uint16, value >> 16));
+}
+
+
+static void addElement(OFVector<Uint8> &buffer, const Uint16 element, const Uint8 *value, const Uint32 length)
+{
+  const size_t offset = buffer.size();
+  buffer.resize(offset + DIMSE_RSP_ELEMENT_HEADER + length);
+  putUint16(&buffer[offset], 0x0000 /* command group */);
+  putUint16(&buffer[offset + 2], element);
+  putUint32(&buffer[offset + 4], length);
+  if (length > 0)
+    memcpy(&buffer[offset + DIMSE_RSP_ELEMENT_HEADER], value, length);
+}
+
+
+static void addUS(OFVector<Uint8> &buffer, const Uint16 element, const Uint16 value)
+{
+  Uint8 data[2];
+  putUint16(data, value);
+  addElement(buffer, element, data, 2);
+}
+
+
+static void addUI(OFVector<Uint8> &buffer, const Uint16 element, const char *value)
+{
+  // UIDs are padded with a trailing null byte to an even length
+  const size_t length = strlen(value);
+  const size_t offset = buffer.size();
+  addElement(buffer, element, OFreinterpret_cast(const Uint8 *, value), OFstatic_cast(Uint32, length + (length & 1)));
+  if (length & 1)
+    buffer[offset + DIMSE_RSP_ELEMENT_HEADER + length] = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmDimseResponseEncoder::DcmDimseResponseEncoder()
+  : m_templates()
+  , m_echoTemplate()
+  , m_buffer()
+{
+  encodeTemplate(m_echoTemplate, DIMSE_C_ECHO_RSP, UID_VerificationSOPClass, STATUS_Success);
+}
+
+
+DcmDimseResponseEncoder::~DcmDimseResponseEncoder()
+{
+  clear();
+}
+
+
+OFCondition DcmDimseResponseEncoder::sendResponse(T_ASC_Association *assoc,
+                                                  const T_ASC_PresentationContextID presID,
+                                                  const T_DIMSE_Command commandField,
+                                                  const Uint16 messageID,
+                                                  const char *sopClassUID,
+                                                  const char *sopInstanceUID,
+                                                  const Uint16 status)
+{
+  if ((assoc == NULL) || (sopClassUID == NULL) || (sopInstanceUID == NULL) ||
+      (sopClassUID[0] == '\0') || (sopInstanceUID[0] == '\0'))
+    return EC_IllegalCall;
+
+  encodeResponse(commandField, messageID, sopClassUID, sopInstanceUID, status);
+  return sendBuffer(assoc, presID);
+}
+
+
+const OFVector<Uint8> &DcmDimseResponseEncoder::encodeResponse(const T_DIMSE_Command commandField,
+                                                               const Uint16 messageID,
+                                                               const char *sopClassUID,
+                                                               const char *sopInstanceUID,
+                                                               const Uint16 status)
+{
+  // assemble the command set from the template and the instance specific values
+  const ResponseTemplate &rspTemplate = getTemplate(OFstatic_cast(Uint16, commandField), sopClassUID, status);
+  m_buffer.assign(rspTemplate.data.begin(), rspTemplate.data.end());
+  putUint16(&m_buffer[rspTemplate.messageIDOffset], messageID);
+  addUI(m_buffer, 0x1000 /* Affected SOP Instance UID */, sopInstanceUID);
+  putUint32(&m_buffer[DIMSE_RSP_ELEMENT_HEADER], OFstatic_cast(Uint32, m_buffer.size() - DIMSE_RSP_GROUP_LENGTH_SIZE));
+  return m_buffer;
+}
+
+
+OFCondition DcmDimseResponseEncoder::sendEchoResponse(T_ASC_Association *assoc,
+                                                      const T_ASC_PresentationContextID presID,
+                                                      const Uint16 messageID,
+                                                      const char *sopClassUID)
+{
+  if ((assoc == NULL) || (sopClassUID == NULL) || (strcmp(sopClassUID, UID_VerificationSOPClass) != 0))
+    return EC_IllegalCall;
+
+  // the template is complete, only the message ID differs
+  m_buffer.assign(m_echoTemplate.data.begin(), m_echoTemplate.data.end());
+  putUint16(&m_buffer[m_echoTemplate.messageIDOffset], messageID);
+  return sendBuffer(assoc, presID);
+}
+
+
+void DcmDimseResponseEncoder::clear()
+{
+  for (size_t i = 0; i < m_templates.size(); ++i)
+    delete m_templates[i];
+  m_templates.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmDimseResponseEncoder::sendBuffer(T_ASC_Association *assoc,
+                                                const T_ASC_PresentationContextID presID)
+{
+  // the command set must fit into a single PDV, which is always the case in practice
+  if (m_buffer.size() > assoc->sendPDVLength)
+    return EC_IllegalCall;
+
+  DUL_PDV pdv;
+  pdv.fragmentLength = OFstatic_cast(unsigned long, m_buffer.size());
+  pdv.presentationContextID = presID;
+  pdv.pdvType = DUL_COMMANDPDV;
+  pdv.lastPDV = OFTrue;
+  pdv.data = &m_buffer[0];
+  DUL_PDVLIST pdvList;
+  pdvList.count = 1;
+  pdvList.pdv = &pdv;
+  return DUL_WritePDataPDU(&assoc->DULassociation, &pdvList);
+}
+
+
+const DcmDimseResponseEncoder::ResponseTemplate &DcmDimseResponseEncoder::getTemplate(const Uint16 commandField,
+                                                                                      const char *sopClassUID,
+                                                                                      const Uint16 status)
+{
+  for (size_t i = 0; i < m_templates.size(); ++i)
+  {
+    const ResponseTemplate &rspTemplate = *m_templates[i];
+    if ((rspTemplate.commandField == commandField) && (rspTemplate.status == status) &&
+        (rspTemplate.sopClassUID == sopClassUID))
+      return rspTemplate;
+  }
+  if (m_templates.size() >= DIMSE_RSP_MAX_TEMPLATES)
+    clear();
+
+  ResponseTemplate *rspTemplate = new ResponseTemplate();
+  encodeTemplate(*rspTemplate, commandField, sopClassUID, status);
+  m_templates.push_back(rspTemplate);
+  DCMNET_TRACE("created DIMSE response template for command field 0x" << STD_NAMESPACE hex << commandField
+    << ", status 0x" << status << STD_NAMESPACE dec << ", SOP class " << sopClassUID);
+  return *rspTemplate;
+}
+
+
+void DcmDimseResponseEncoder::encodeTemplate(ResponseTemplate &rspTemplate,
+                                             const Uint16 commandField,
+                                             const char *sopClassUID,
+                                             const Uint16 status)
+{
+  rspTemplate.commandField = commandField;
+  rspTemplate.status = status;
+  rspTemplate.sopClassUID = sopClassUID;
+  OFVector<Uint8> &data = rspTemplate.data;
+  // command group length, filled in for each response
+  Uint8 groupLength[4] = { 0, 0, 0, 0 };
+  addElement(data, 0x0000 /* Command Group Length */, groupLength, 4);
+  addUI(data, 0x0002 /* Affected SOP Class UID */, sopClassUID);
+  addUS(data, 0x0100 /* Command Field */, commandField);
+  addUS(data, 0x0120 /* Message ID Being Responded To */, 0);
+  rspTemplate.messageIDOffset = data.size() - 2;
+  addUS(data, 0x0800 /* Command Data Set Type */, DIMSE_RSP_NO_DATASET);
+  addUS(data, 0x0900 /* Status */, status);
+  putUint32(&data[DIMSE_RSP_ELEMENT_HEADER], OFstatic_cast(Uint32, data.size() - DIMSE_RSP_GROUP_LENGTH_SIZE));
+}
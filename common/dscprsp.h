@@ -0,0 +1,167 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Encoder for DIMSE responses using pre-encoded command sets
+ *
+ */
+
+#ifndef DSCPRSP_H
+#define DSCPRSP_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofvector.h"
+#include "dcmtk/dcmnet/assoc.h"
+#include "dcmtk/dcmnet/dimse.h"     /* DIMSE network layer */
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Encoder for DIMSE responses without a dataset (e.g.\ N-CREATE-RSP, N-SET-RSP,
+ *  N-ACTION-RSP). The command set of a response only differs in a few attributes from
+ *  the previous response with the same command field, SOP class and status. The
+ *  encoder therefore keeps the encoded command set per (command field, SOP class,
+ *  status) as a template; for each response, only the Message ID Being Responded To,
+ *  the Affected SOP Instance UID and the command group length are filled in, and the
+ *  result is sent as a single PDV in one P-DATA-TF PDU. The C-ECHO response, which has
+ *  no Affected SOP Instance UID, is encoded completely on construction.
+ *  The command set is encoded exactly as DIMSE would do (implicit VR little endian,
+ *  elements in ascending tag order, with command group length).
+ */
+class DcmDimseResponseEncoder
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmDimseResponseEncoder();
+
+    /** destructor
+     */
+    ~DcmDimseResponseEncoder();
+
+    /** Send a response without a dataset
+     *  @param assoc          [in] The association to send the response on
+     *  @param presID         [in] The presentation context ID the request was received on
+     *  @param commandField   [in] The command field of the response (e.g.\ DIMSE_N_SET_RSP)
+     *  @param messageID      [in] The message ID of the request
+     *  @param sopClassUID    [in] The Affected SOP Class UID
+     *  @param sopInstanceUID [in] The Affected SOP Instance UID
+     *  @param status         [in] The DIMSE status
+     *  @return EC_Normal if successful, an error code otherwise. EC_IllegalCall if the
+     *          response cannot be sent this way, in which case nothing has been sent.
+     */
+    OFCondition sendResponse(T_ASC_Association *assoc,
+                             const T_ASC_PresentationContextID presID,
+                             const T_DIMSE_Command commandField,
+                             const Uint16 messageID,
+                             const char *sopClassUID,
+                             const char *sopInstanceUID,
+                             const Uint16 status);
+
+    /** Encode the command set of a response without a dataset, as sent by
+     *  sendResponse()
+     *  @param commandField   [in] The command field of the response (e.g.\ DIMSE_N_SET_RSP)
+     *  @param messageID      [in] The message ID of the request
+     *  @param sopClassUID    [in] The Affected SOP Class UID, not empty
+     *  @param sopInstanceUID [in] The Affected SOP Instance UID, not empty
+     *  @param status         [in] The DIMSE status
+     *  @return The encoded command set, valid until the next call of this encoder
+     */
+    const OFVector<Uint8> &encodeResponse(const T_DIMSE_Command commandField,
+                                          const Uint16 messageID,
+                                          const char *sopClassUID,
+                                          const char *sopInstanceUID,
+                                          const Uint16 status);
+
+    /** Send a C-ECHO response with status success from the command set pre-encoded on
+     *  construction, so that frequent health checks cost as little as possible
+     *  @param assoc       [in] The association to send the response on
+     *  @param presID      [in] The presentation context ID the request was received on
+     *  @param messageID   [in] The message ID of the request
+     *  @param sopClassUID [in] The Affected SOP Class UID of the request
+     *  @return EC_Normal if successful, an error code otherwise. EC_IllegalCall if the
+     *          response cannot be sent this way (e.g.\ not the Verification SOP Class),
+     *          in which case nothing has been sent.
+     */
+    OFCondition sendEchoResponse(T_ASC_Association *assoc,
+                                 const T_ASC_PresentationContextID presID,
+                                 const Uint16 messageID,
+                                 const char *sopClassUID);
+
+    /** Remove all templates
+     */
+    void clear();
+
+  private:
+
+    /** Pre-encoded command set, from the command group length up to and including the
+     *  status. The Affected SOP Instance UID is appended behind.
+     */
+    struct ResponseTemplate
+    {
+      /// command field of the response
+      Uint16 commandField;
+      /// DIMSE status
+      Uint16 status;
+      /// Affected SOP Class UID
+      OFString sopClassUID;
+      /// the encoded elements
+      OFVector<Uint8> data;
+      /// offset of the value of Message ID Being Responded To within the data
+      size_t messageIDOffset;
+    };
+
+    /** Encode a template
+     *  @param rspTemplate  [out] The template, must be empty
+     *  @param commandField [in]  The command field of the response
+     *  @param sopClassUID  [in]  The Affected SOP Class UID
+     *  @param status       [in]  The DIMSE status
+     */
+    static void encodeTemplate(ResponseTemplate &rspTemplate,
+                               const Uint16 commandField,
+                               const char *sopClassUID,
+                               const Uint16 status);
+
+    /** Send the command set assembled in the buffer as a single PDV
+     *  @param assoc  [in] The association to send the command set on
+     *  @param presID [in] The presentation context ID
+     *  @return EC_Normal if successful, an error code otherwise. EC_IllegalCall if the
+     *          command set does not fit into a single PDV.
+     */
+    OFCondition sendBuffer(T_ASC_Association *assoc,
+                           const T_ASC_PresentationContextID presID);
+
+    /** Find the template for a response, create it if not yet available
+     *  @param commandField [in] The command field of the response
+     *  @param sopClassUID  [in] The Affected SOP Class UID
+     *  @param status       [in] The DIMSE status
+     *  @return The template
+     */
+    const ResponseTemplate &getTemplate(const Uint16 commandField,
+                                        const char *sopClassUID,
+                                        const Uint16 status);
+
+    /// templates created so far
+    OFVector<ResponseTemplate *> m_templates;
+
+    /// the C-ECHO response with status success
+    ResponseTemplate m_echoTemplate;
+
+    /// buffer the command set is assembled in
+    OFVector<Uint8> m_buffer;
+
+    // private undefined copy constructor
+    DcmDimseResponseEncoder(const DcmDimseResponseEncoder &);
+
+    // private undefined assignment operator
+    DcmDimseResponseEncoder &operator=(const DcmDimseResponseEncoder &);
+
+};
+
+#endif // DSCPRSP_H
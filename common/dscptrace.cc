@@ -0,0 +1,331 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Span trees of associations written as trace files
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dscptrace.h"
+#include "dscpcond.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/ofstd/offile.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CERRNO
+#define INCLUDE_CTIME
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <time.h>
+#include <unistd.h>
+END_EXTERN_C
+
+
+// print a time in nanoseconds as microseconds with three decimals
+static void printMicroseconds(STD_NAMESPACE ostream &out,
+                              const Uint64 nanoseconds)
+{
+  char buf[8];
+  sprintf(buf, ".%03u", OFstatic_cast(unsigned int, nanoseconds % 1000));
+  out << (nanoseconds / 1000) << buf;
+}
+
+
+// print a string as JSON string literal
+static void printJSONString(STD_NAMESPACE ostream &out,
+                            const OFString &value)
+{
+  out << '"';
+  for (size_t i = 0; i < value.length(); ++i)
+  {
+    const unsigned char c = OFstatic_cast(unsigned char, value[i]);
+    if ((c == '"') || (c == '\\'))
+      out << '\\' << value[i];
+    else if (c < 0x20)
+    {
+      char buf[8];
+      sprintf(buf, "\\u%04x", OFstatic_cast(unsigned int, c));
+      out << buf;
+    }
+    else
+      out << value[i];
+  }
+  out << '"';
+}
+
+
+// print a 64 bit value as 16 hex digits
+static void printHex(STD_NAMESPACE ostream &out,
+                     const Uint64 value)
+{
+  char buf[20];
+  sprintf(buf, "%08lx%08lx", OFstatic_cast(unsigned long, (value >> 32) & 0xffffffffUL),
+    OFstatic_cast(unsigned long, value & 0xffffffffUL));
+  out << buf;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmTraceRecorder::DcmTraceRecorder()
+  : m_directory()
+  , m_format(SCP_TF_Chrome)
+  , m_serviceName()
+  , m_spans()
+  , m_open()
+  , m_droppedSpans(0)
+  , m_traceCount(0)
+  , m_wallClockOffset(0)
+{
+}
+
+
+void DcmTraceRecorder::setDirectory(const OFString &directory)
+{
+  m_directory = directory;
+}
+
+
+void DcmTraceRecorder::setFormat(const DcmTraceFormat format)
+{
+  m_format = format;
+}
+
+
+void DcmTraceRecorder::setServiceName(const OFString &name)
+{
+  m_serviceName = name;
+}
+
+
+OFBool DcmTraceRecorder::isEnabled() const
+{
+  return !m_directory.empty();
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmTraceRecorder::begin(const char *name,
+                             const Uint64 startTime)
+{
+  if (m_directory.empty())
+    return;
+  m_spans.clear();
+  m_open.clear();
+  m_droppedSpans = 0;
+  ++m_traceCount;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  m_wallClockOffset = OFstatic_cast(Uint64, ts.tv_sec) * 1000000000 + OFstatic_cast(Uint64, ts.tv_nsec) - now();
+  Span root;
+  root.name = name;
+  root.parent = SCP_TRACE_NO_SPAN;
+  root.startTime = startTime;
+  root.endTime = 0;
+  m_spans.push_back(root);
+  m_open.push_back(0);
+}
+
+
+size_t DcmTraceRecorder::beginSpan(const char *name,
+                                   const Uint64 startTime)
+{
+  const size_t span = addSpan(name, (startTime > 0) ? startTime : now(), 0);
+  if (span != SCP_TRACE_NO_SPAN)
+    m_open.push_back(span);
+  return span;
+}
+
+
+void DcmTraceRecorder::endSpan(const size_t span,
+                               const Uint64 endTime)
+{
+  if ((span == SCP_TRACE_NO_SPAN) || (span >= m_spans.size()))
+    return;
+  const Uint64 time = (endTime > 0) ? endTime : now();
+  // spans begun after this one cannot last any longer
+  while (!m_open.empty())
+  {
+    const size_t innermost = m_open.back();
+    m_open.pop_back();
+    m_spans[innermost].endTime = time;
+    if (innermost == span)
+      break;
+  }
+}
+
+
+size_t DcmTraceRecorder::addSpan(const char *name,
+                                 const Uint64 startTime,
+                                 const Uint64 endTime)
+{
+  if (m_directory.empty() || m_open.empty())
+    return SCP_TRACE_NO_SPAN;
+  if (m_spans.size() >= SCP_TRACE_MAX_SPANS)
+  {
+    ++m_droppedSpans;
+    return SCP_TRACE_NO_SPAN;
+  }
+  Span span;
+  span.name = name;
+  span.parent = m_open.back();
+  span.startTime = startTime;
+  span.endTime = endTime;
+  m_spans.push_back(span);
+  return m_spans.size() - 1;
+}
+
+
+void DcmTraceRecorder::setAttribute(const size_t span,
+                                    const char *key,
+                                    const OFString &value)
+{
+  if (span >= m_spans.size())
+    return;
+  Attribute attribute;
+  attribute.key = key;
+  attribute.value = value;
+  m_spans[span].attributes.push_back(attribute);
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmTraceRecorder::finish()
+{
+  if (m_directory.empty() || m_spans.empty())
+    return EC_Normal;
+  endSpan(0);
+  if (m_droppedSpans > 0)
+  {
+    char buf[20];
+    sprintf(buf, "%lu", OFstatic_cast(unsigned long, m_droppedSpans));
+    setAttribute(0, "dropped_spans", buf);
+  }
+
+  // name the file after the wall clock time of the start of the association
+  const time_t seconds = OFstatic_cast(time_t, (m_spans[0].startTime + m_wallClockOffset) / 1000000000);
+  struct tm tmBuf;
+  char date[32];
+  char filename[64];
+  strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime_r(&seconds, &tmBuf));
+  sprintf(filename, "trace-%s-%lu-%lu.%s", date, OFstatic_cast(unsigned long, getpid()),
+    OFstatic_cast(unsigned long, m_traceCount), (m_format == SCP_TF_OTLP) ? "otlp.json" : "json");
+  OFString path;
+  OFStandard::combineDirAndFilename(path, m_directory, filename, OFTrue /* allowEmptyDirName */);
+
+  OFOStringStream stream;
+  if (m_format == SCP_TF_OTLP)
+    formatOTLP(stream);
+  else
+    formatChrome(stream);
+  stream << OFStringStream_ends;
+  OFSTRINGSTREAM_GETOFSTRING(stream, text)
+  m_spans.clear();
+  m_open.clear();
+
+  // write to a temporary file first, so that a complete file is never seen half written
+  const OFString tempPath = path + ".tmp";
+  OFFile file;
+  OFCondition cond = EC_Normal;
+  if (!file.fopen(tempPath.c_str(), "wb") ||
+      (file.fwrite(text.c_str(), 1, text.length()) != text.length()) ||
+      (file.fclose() != 0) ||
+      (rename(tempPath.c_str(), path.c_str()) != 0))
+  {
+    char buf[256];
+    DCMNET_WARN("cannot write trace file " << path << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    unlink(tempPath.c_str());
+    cond = SCP_EC_TraceError;
+  }
+  return cond;
+}
+
+
+Uint64 DcmTraceRecorder::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return OFstatic_cast(Uint64, ts.tv_sec) * 1000000000 + OFstatic_cast(Uint64, ts.tv_nsec);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmTraceRecorder::formatChrome(STD_NAMESPACE ostream &out) const
+{
+  // one "thread" per association, so that consecutive traces can be merged
+  const unsigned long pid = OFstatic_cast(unsigned long, getpid());
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << m_traceCount
+      << ",\"args\":{\"name\":\"association " << m_traceCount << "\"}}";
+  for (size_t i = 0; i < m_spans.size(); ++i)
+  {
+    const Span &span = m_spans[i];
+    out << ",\n{\"name\":";
+    printJSONString(out, span.name);
+    out << ",\"cat\":\"dicom\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << m_traceCount << ",\"ts\":";
+    printMicroseconds(out, span.startTime);
+    out << ",\"dur\":";
+    printMicroseconds(out, (span.endTime > span.startTime) ? span.endTime - span.startTime : 0);
+    out << ",\"args\":{";
+    for (size_t j = 0; j < span.attributes.size(); ++j)
+    {
+      if (j > 0)
+        out << ',';
+      printJSONString(out, span.attributes[j].key);
+      out << ':';
+      printJSONString(out, span.attributes[j].value);
+    }
+    out << "}}";
+  }
+  out << "\n]}\n";
+}
+
+
+void DcmTraceRecorder::formatOTLP(STD_NAMESPACE ostream &out) const
+{
+  // the trace ID only has to be unique: start time, process and trace number
+  const Uint64 traceIdHigh = m_spans[0].startTime + m_wallClockOffset;
+  const Uint64 traceIdLow = (OFstatic_cast(Uint64, getpid()) << 32) | m_traceCount;
+  out << "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\",\"value\":{\"stringValue\":";
+  printJSONString(out, m_serviceName);
+  out << "}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"dcmtk.dcmnet\"},\"spans\":[";
+  for (size_t i = 0; i < m_spans.size(); ++i)
+  {
+    const Span &span = m_spans[i];
+    out << ((i > 0) ? ",\n" : "\n") << "{\"traceId\":\"";
+    printHex(out, traceIdHigh);
+    printHex(out, traceIdLow);
+    out << "\",\"spanId\":\"";
+    printHex(out, (OFstatic_cast(Uint64, m_traceCount) << 32) | (i + 1));
+    out << '"';
+    if (span.parent != SCP_TRACE_NO_SPAN)
+    {
+      out << ",\"parentSpanId\":\"";
+      printHex(out, (OFstatic_cast(Uint64, m_traceCount) << 32) | (span.parent + 1));
+      out << '"';
+    }
+    out << ",\"name\":";
+    printJSONString(out, span.name);
+    // the association is served, its phases are internal
+    out << ",\"kind\":" << ((i == 0) ? 2 : 1)
+        << ",\"startTimeUnixNano\":\"" << (span.startTime + m_wallClockOffset)
+        << "\",\"endTimeUnixNano\":\"" << (((span.endTime > span.startTime) ? span.endTime : span.startTime) + m_wallClockOffset)
+        << "\",\"attributes\":[";
+    for (size_t j = 0; j < span.attributes.size(); ++j)
+    {
+      if (j > 0)
+        out << ',';
+      out << "{\"key\":";
+      printJSONString(out, span.attributes[j].key);
+      out << ",\"value\":{\"stringValue\":";
+      printJSONString(out, span.attributes[j].value);
+      out << "}}";
+    }
+    out << "]}";
+  }
+  out << "\n]}]}]}\n";
+}
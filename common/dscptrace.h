@@ -0,0 +1,190 @@
+/*
+ *
+ *  Module:  common
+ *
+ *  Purpose: Span trees of associations written as trace files
+ *
+ */
+
+#ifndef DSCPTRACE_H
+#define DSCPTRACE_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofvector.h"
+#include "dcmtk/ofstd/ofstream.h"
+
+/// maximum number of spans recorded per association, further spans are dropped
+#define SCP_TRACE_MAX_SPANS 65536
+
+/// span ID returned if no span is recorded
+#define SCP_TRACE_NO_SPAN OFstatic_cast(size_t, -1)
+
+/** Format of the trace files
+ */
+enum DcmTraceFormat
+{
+  /// Chrome trace-event JSON (chrome://tracing, Perfetto)
+  SCP_TF_Chrome = 1,
+  /// OpenTelemetry protocol (OTLP) JSON, as written by the file exporter of the collector
+  SCP_TF_OTLP = 2
+};
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Recorder of the spans of one association at a time: the association itself is the
+ *  root span, each phase (accept, negotiation, each DIMSE command and its parts,
+ *  release) a child span. Spans are nested by the order in which they are begun and
+ *  ended. Timestamps are taken from a monotonic clock in nanoseconds. When the
+ *  association has been terminated, the spans are written to a file of their own in
+ *  the trace directory. All methods do nothing unless a directory is set.
+ */
+class DcmTraceRecorder
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmTraceRecorder();
+
+    /** Set the directory the trace files are written to
+     *  @param directory [in] The directory, empty to disable tracing
+     */
+    void setDirectory(const OFString &directory);
+
+    /** Set the format of the trace files
+     *  @param format [in] The format
+     */
+    void setFormat(const DcmTraceFormat format);
+
+    /** Set the name of the service the spans are reported for (OTLP only)
+     *  @param name [in] The service name, e.g.\ the name of the tool
+     */
+    void setServiceName(const OFString &name);
+
+    /** Check whether spans are recorded
+     *  @return OFTrue if a directory is set, OFFalse otherwise
+     */
+    OFBool isEnabled() const;
+
+    /** Start the trace of a new association, discarding the spans of the previous one
+     *  (if not written)
+     *  @param name      [in] Name of the root span
+     *  @param startTime [in] Start of the association, see now()
+     */
+    void begin(const char *name,
+               const Uint64 startTime);
+
+    /** Begin a span as child of the innermost open span
+     *  @param name      [in] Name of the span
+     *  @param startTime [in] Start of the span, 0 for now
+     *  @return ID of the span, SCP_TRACE_NO_SPAN if not recorded
+     */
+    size_t beginSpan(const char *name,
+                     const Uint64 startTime = 0);
+
+    /** End a span and all spans begun after it
+     *  @param span    [in] ID of the span
+     *  @param endTime [in] End of the span, 0 for now
+     */
+    void endSpan(const size_t span,
+                 const Uint64 endTime = 0);
+
+    /** Add a completed span as child of the innermost open span
+     *  @param name      [in] Name of the span
+     *  @param startTime [in] Start of the span
+     *  @param endTime   [in] End of the span
+     *  @return ID of the span, SCP_TRACE_NO_SPAN if not recorded
+     */
+    size_t addSpan(const char *name,
+                   const Uint64 startTime,
+                   const Uint64 endTime);
+
+    /** Set an attribute of a span
+     *  @param span  [in] ID of the span, 0 for the root span
+     *  @param key   [in] Name of the attribute
+     *  @param value [in] Value of the attribute
+     */
+    void setAttribute(const size_t span,
+                      const char *key,
+                      const OFString &value);
+
+    /** End all open spans (including the root span) and write the trace file
+     *  @return EC_Normal if successful or not enabled, an error code otherwise
+     */
+    OFCondition finish();
+
+    /** Returns the time of a monotonic clock
+     *  @return The time in nanoseconds
+     */
+    static Uint64 now();
+
+  private:
+
+    /** An attribute of a span
+     */
+    struct Attribute
+    {
+      /// name of the attribute
+      OFString key;
+      /// value of the attribute
+      OFString value;
+    };
+
+    /** A span of the current trace
+     */
+    struct Span
+    {
+      /// name of the span
+      OFString name;
+      /// index of the parent span, SCP_TRACE_NO_SPAN for the root span
+      size_t parent;
+      /// start of the span in nanoseconds (monotonic clock)
+      Uint64 startTime;
+      /// end of the span in nanoseconds, 0 while open
+      Uint64 endTime;
+      /// attributes of the span
+      OFVector<Attribute> attributes;
+    };
+
+    /** Write the spans in Chrome trace-event JSON
+     *  @param out [out] The JSON text
+     */
+    void formatChrome(STD_NAMESPACE ostream &out) const;
+
+    /** Write the spans in OTLP JSON
+     *  @param out [out] The JSON text
+     */
+    void formatOTLP(STD_NAMESPACE ostream &out) const;
+
+    /// directory the trace files are written to, empty if disabled
+    OFString m_directory;
+
+    /// format of the trace files
+    DcmTraceFormat m_format;
+
+    /// name of the service (OTLP resource attribute service.name)
+    OFString m_serviceName;
+
+    /// spans of the current trace, the root span first
+    OFVector<Span> m_spans;
+
+    /// open spans, innermost last
+    OFVector<size_t> m_open;
+
+    /// number of spans dropped because of SCP_TRACE_MAX_SPANS
+    size_t m_droppedSpans;
+
+    /// number of traces started, part of the file name and the trace ID
+    Uint32 m_traceCount;
+
+    /// wall clock time minus monotonic clock time at the start of the trace
+    Uint64 m_wallClockOffset;
+};
+
+#endif // DSCPTRACE_H
@@ -0,0 +1,22 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Error conditions of the MPPS SCP
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dmppscond.h"
+
+makeOFConditionConst(MPPS_EC_DuplicateSOPInstance, OFM_mppsscp, 1, OF_error, "Duplicate SOP Instance");
+makeOFConditionConst(MPPS_EC_NoSuchSOPInstance,    OFM_mppsscp, 2, OF_error, "No such SOP Instance");
+makeOFConditionConst(MPPS_EC_InstanceFinalized,    OFM_mppsscp, 3, OF_error, "Performed Procedure Step already COMPLETED or DISCONTINUED");
+makeOFConditionConst(MPPS_EC_SegmentIOError,       OFM_mppsscp, 4, OF_error, "Segment file I/O error");
+makeOFConditionConst(MPPS_EC_EndOfSegment,         OFM_mppsscp, 5, OF_error, "End of segment file");
+makeOFConditionConst(MPPS_EC_CorruptRecord,        OFM_mppsscp, 6, OF_error, "Corrupt record in segment file");
+makeOFConditionConst(MPPS_EC_StreamError,          OFM_mppsscp, 7, OF_error, "Cannot set up MPPS event stream");
+makeOFConditionConst(MPPS_EC_InvalidEventRing,     OFM_mppsscp, 9, OF_error, "Invalid event ring file");
+makeOFConditionConst(MPPS_EC_RequestFailed,        OFM_mppsscp, 13, OF_error, "Request failed with error status");
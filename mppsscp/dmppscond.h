@@ -0,0 +1,39 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Error conditions of the MPPS SCP
+ *
+ */
+
+#ifndef DMPPSCOND_H
+#define DMPPSCOND_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+/// module number for the conditions of the MPPS SCP
+#define OFM_mppsscp 1024
+
+/// N-CREATE for a SOP instance that already exists
+extern const OFCondition MPPS_EC_DuplicateSOPInstance;
+/// N-SET (or N-GET) for a SOP instance that does not exist
+extern const OFCondition MPPS_EC_NoSuchSOPInstance;
+/// N-SET for a SOP instance that is already COMPLETED or DISCONTINUED
+extern const OFCondition MPPS_EC_InstanceFinalized;
+/// a segment file could not be read or written
+extern const OFCondition MPPS_EC_SegmentIOError;
+/// no further (complete) record in a segment file (yet). Reported as an error, so
+/// that loops reading records while the result is good stop at the end.
+extern const OFCondition MPPS_EC_EndOfSegment;
+/// a segment file contains data that is not a valid record
+extern const OFCondition MPPS_EC_CorruptRecord;
+/// the event stream could not be set up
+extern const OFCondition MPPS_EC_StreamError;
+/// the event ring file could not be opened or has an invalid format
+extern const OFCondition MPPS_EC_InvalidEventRing;
+/// a request was answered with a failure status
+extern const OFCondition MPPS_EC_RequestFailed;
+
+#endif // DMPPSCOND_H
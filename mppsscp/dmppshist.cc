@@ -0,0 +1,493 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Retention management of the on-disk MPPS history
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dmppshist.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// filename extension of files being written by a compaction pass
+#define MPPS_HISTORY_TEMP_EXTENSION ".tmp"
+
+// output is written in chunks of this size
+#define MPPS_HISTORY_CHUNK_SIZE (64 * 1024)
+
+// interval in which the idle thread checks whether it should stop (milliseconds)
+#define MPPS_HISTORY_POLL_INTERVAL 1000
+
+
+/** Output file of a compaction pass. The file is written under a temporary name and
+ *  only replaces the target by commit(), after it has been flushed to disk.
+ */
+class DcmMppsCompactionOutput
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmMppsCompactionOutput()
+      : m_filename()
+      , m_fd(-1)
+      , m_length(0)
+      , m_buffer()
+    {
+    }
+
+    /** destructor. Discards an uncommitted file.
+     */
+    ~DcmMppsCompactionOutput()
+    {
+      discard();
+    }
+
+    /** Create the temporary file for the given target
+     *  @param filename [in] Name of the target file
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition open(const OFString &filename)
+    {
+      m_filename = filename;
+      const OFString temp = m_filename + MPPS_HISTORY_TEMP_EXTENSION;
+      // a temporary file left behind by an interrupted pass is simply overwritten
+      m_fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (m_fd < 0)
+      {
+        char buf[256];
+        DCMNET_ERROR("cannot create MPPS history file " << temp << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+        return MPPS_EC_SegmentIOError;
+      }
+      m_length = 0;
+      m_buffer.clear();
+      return EC_Normal;
+    }
+
+    /** Returns whether the file has been created
+     *  @return OFTrue if open, OFFalse otherwise
+     */
+    OFBool isOpen() const
+    {
+      return (m_fd >= 0);
+    }
+
+    /** Returns the number of bytes appended so far
+     *  @return The length in bytes
+     */
+    Uint64 getLength() const
+    {
+      return m_length;
+    }
+
+    /** Append data to the file
+     *  @param data   [in] The data
+     *  @param length [in] Number of bytes
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition append(const Uint8 *data,
+                       const Uint32 length)
+    {
+      m_buffer.insert(m_buffer.end(), data, data + length);
+      m_length += length;
+      if (m_buffer.size() >= MPPS_HISTORY_CHUNK_SIZE)
+        return flush();
+      return EC_Normal;
+    }
+
+    /** Write the buffered data to the file
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition flush()
+    {
+      size_t written = 0;
+      while (written < m_buffer.size())
+      {
+        const ssize_t result = write(m_fd, &m_buffer[written], m_buffer.size() - written);
+        if (result < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          char buf[256];
+          DCMNET_ERROR("cannot write MPPS history file " << m_filename << MPPS_HISTORY_TEMP_EXTENSION
+            << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+          return MPPS_EC_SegmentIOError;
+        }
+        written += OFstatic_cast(size_t, result);
+      }
+      m_buffer.clear();
+      return EC_Normal;
+    }
+
+    /** Flush the file to disk and replace the target by it
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition commit()
+    {
+      OFCondition cond = flush();
+      if (cond.bad())
+        return cond;
+      const OFString temp = m_filename + MPPS_HISTORY_TEMP_EXTENSION;
+      if ((fdatasync(m_fd) != 0) || (rename(temp.c_str(), m_filename.c_str()) != 0))
+      {
+        char buf[256];
+        DCMNET_ERROR("cannot replace MPPS history file " << m_filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+        return MPPS_EC_SegmentIOError;
+      }
+      ::close(m_fd);
+      m_fd = -1;
+      return EC_Normal;
+    }
+
+    /** Close and remove an uncommitted file
+     */
+    void discard()
+    {
+      if (m_fd >= 0)
+      {
+        ::close(m_fd);
+        m_fd = -1;
+        unlink((m_filename + MPPS_HISTORY_TEMP_EXTENSION).c_str());
+      }
+      m_buffer.clear();
+    }
+
+  private:
+
+    /// name of the target file
+    OFString m_filename;
+
+    /// file descriptor of the temporary file, -1 if not open
+    int m_fd;
+
+    /// number of bytes appended
+    Uint64 m_length;
+
+    /// data not yet written
+    OFVector<Uint8> m_buffer;
+
+    // private undefined copy constructor
+    DcmMppsCompactionOutput(const DcmMppsCompactionOutput &);
+
+    // private undefined assignment operator
+    DcmMppsCompactionOutput &operator=(const DcmMppsCompactionOutput &);
+
+};
+
+// ----------------------------------------------------------------------------
+
+DcmMppsHistoryCompactor::DcmMppsHistoryCompactor(DcmMppsSegmentLog &log)
+  : OFThread()
+  , m_log(log)
+  , m_retention(0)
+  , m_archiveDirectory()
+  , m_rateLimit(MPPS_HISTORY_DEFAULT_RATE)
+  , m_interval(MPPS_HISTORY_DEFAULT_INTERVAL)
+  , m_tokens(0)
+  , m_lastRefill(0)
+  , m_droppedRecords(0)
+  , m_droppedBytes(0)
+  , m_stop(OFFalse)
+  , m_mutex()
+{
+}
+
+
+DcmMppsHistoryCompactor::~DcmMppsHistoryCompactor()
+{
+}
+
+
+void DcmMppsHistoryCompactor::setRetention(const Uint32 seconds)
+{
+  m_retention = seconds;
+}
+
+
+void DcmMppsHistoryCompactor::setArchiveDirectory(const OFString &directory)
+{
+  m_archiveDirectory = directory;
+}
+
+
+void DcmMppsHistoryCompactor::setRateLimit(const Uint32 bytesPerSecond)
+{
+  m_rateLimit = bytesPerSecond;
+}
+
+
+void DcmMppsHistoryCompactor::setInterval(const Uint32 seconds)
+{
+  m_interval = seconds;
+}
+
+
+void DcmMppsHistoryCompactor::stop()
+{
+  m_mutex.lock();
+  m_stop = OFTrue;
+  m_mutex.unlock();
+}
+
+
+OFCondition DcmMppsHistoryCompactor::compact(const Uint64 now)
+{
+  const Uint64 retention = OFstatic_cast(Uint64, m_retention) * 1000000;
+  if ((m_retention == 0) || (now < retention))
+    return EC_Normal;
+  const Uint64 cutoff = now - retention;
+
+  // the active segment (and any segment started after we looked) is left alone
+  const Uint64 active = m_log.getActiveSegment();
+  OFVector<Uint64> segments;
+  OFCondition cond = DcmMppsSegmentLog::listSegments(m_log.getDirectory(), segments);
+  if (cond.bad())
+    return cond;
+  size_t closed = 0;
+  while ((closed < segments.size()) && (segments[closed] < active))
+    ++closed;
+  if (closed == 0)
+    return EC_Normal;
+
+  OFMap<OFString, OFBool> live;
+  size_t count = 0;
+  cond = collectLiveInstances(segments, cutoff, live, count);
+  if (cond.bad())
+    return cond;
+  if (count > closed)
+    count = closed;
+
+  m_droppedRecords = 0;
+  m_droppedBytes = 0;
+  for (size_t i = 0; (i < count) && cond.good() && !stopRequested(); ++i)
+    cond = compactSegment(segments[i], live);
+  if (m_droppedRecords > 0)
+  {
+    DCMNET_INFO("compacted MPPS history in " << m_log.getDirectory() << ": "
+      << (m_archiveDirectory.empty() ? "dropped " : "archived ") << m_droppedRecords
+      << " records (" << m_droppedBytes << " bytes) older than " << m_retention << " seconds");
+  }
+  return cond;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsHistoryCompactor::run()
+{
+  Uint64 nextPass = 0;
+  while (!stopRequested())
+  {
+    const Uint64 now = DcmMppsSegmentLog::getTimestamp();
+    if (now >= nextPass)
+    {
+      OFCondition cond = compact(now);
+      if (cond.bad())
+        DCMNET_WARN("cannot compact MPPS history in " << m_log.getDirectory() << ": " << cond.text());
+      nextPass = DcmMppsSegmentLog::getTimestamp() + OFstatic_cast(Uint64, m_interval) * 1000000;
+    }
+    OFStandard::milliSleep(MPPS_HISTORY_POLL_INTERVAL);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+OFBool DcmMppsHistoryCompactor::stopRequested()
+{
+  m_mutex.lock();
+  const OFBool stop = m_stop;
+  m_mutex.unlock();
+  return stop;
+}
+
+
+OFCondition DcmMppsHistoryCompactor::collectLiveInstances(const OFVector<Uint64> &segments,
+                                                          const Uint64 cutoff,
+                                                          OFMap<OFString, OFBool> &live,
+                                                          size_t &count)
+{
+  // records are appended in time order, so only the segments from the last one
+  // starting before the cutoff on can hold records that are not expired
+  count = 0;
+  DcmMppsSegmentReader reader;
+  DcmMppsRecord record;
+  size_t i = segments.size();
+  while ((i > 0) && !stopRequested())
+  {
+    --i;
+    OFCondition cond = reader.open(DcmMppsSegmentLog::getSegmentFilename(m_log.getDirectory(), segments[i]));
+    if (cond.bad())
+      return cond;
+    OFBool first = OFTrue;
+    OFBool startsBefore = OFFalse;
+    while ((cond = reader.readRecord(record)).good())
+    {
+      throttle(record.rawLength);
+      if (first)
+      {
+        startsBefore = (record.timestamp < cutoff);
+        first = OFFalse;
+      }
+      if (record.timestamp >= cutoff)
+        live[record.sopInstanceUID] = OFTrue;
+    }
+    reader.close();
+    if (cond != MPPS_EC_EndOfSegment)
+      return cond;
+    if (startsBefore)
+    {
+      count = i + 1;
+      break;
+    }
+  }
+  return EC_Normal;
+}
+
+
+OFCondition DcmMppsHistoryCompactor::compactSegment(const Uint64 segment,
+                                                    const OFMap<OFString, OFBool> &live)
+{
+  const OFString filename = DcmMppsSegmentLog::getSegmentFilename(m_log.getDirectory(), segment);
+  DcmMppsSegmentReader reader;
+  OFCondition cond = reader.open(filename);
+  if (cond.bad())
+    return cond;
+
+  // the output files are only created once the first expired record is found. The
+  // records kept up to then are copied from the original segment in one go.
+  DcmMppsCompactionOutput kept;
+  DcmMppsCompactionOutput archived;
+  Uint64 dropped = 0;
+  Uint64 droppedBytes = 0;
+  DcmMppsRecord record;
+  while (!stopRequested())
+  {
+    const Uint64 offset = reader.getOffset();
+    cond = reader.readRecord(record);
+    if (cond.bad())
+      break;
+    throttle(record.rawLength);
+    const OFBool expired = (live.find(record.sopInstanceUID) == live.end());
+    if (expired && !kept.isOpen())
+    {
+      cond = kept.open(filename);
+      if (cond.good() && (offset > 0))
+      {
+        DcmMppsSegmentReader prefix;
+        DcmMppsRecord prefixRecord;
+        cond = prefix.open(filename);
+        while (cond.good() && (prefix.getOffset() < offset))
+        {
+          cond = prefix.readRecord(prefixRecord);
+          if (cond.good())
+          {
+            // read and written once
+            throttle(2 * prefixRecord.rawLength);
+            cond = kept.append(prefixRecord.raw, prefixRecord.rawLength);
+          }
+        }
+      }
+      if (cond.bad())
+        break;
+    }
+    if (!expired)
+    {
+      if (kept.isOpen())
+      {
+        throttle(record.rawLength);
+        cond = kept.append(record.raw, record.rawLength);
+      }
+    }
+    else
+    {
+      if (!m_archiveDirectory.empty())
+      {
+        if (!archived.isOpen())
+          cond = archived.open(DcmMppsSegmentLog::getSegmentFilename(m_archiveDirectory, record.sequence));
+        if (cond.good())
+        {
+          throttle(record.rawLength);
+          cond = archived.append(record.raw, record.rawLength);
+        }
+      }
+      ++dropped;
+      droppedBytes += record.rawLength;
+    }
+    if (cond.bad())
+      break;
+  }
+  reader.close();
+  if (cond != MPPS_EC_EndOfSegment)
+  {
+    // interrupted by stop() or an error: the original segment remains unchanged
+    return (cond.bad()) ? cond : EC_Normal;
+  }
+  if (!kept.isOpen())
+    return EC_Normal;
+
+  // archive first, so a crash in between can only leave records in both places
+  if (archived.isOpen())
+  {
+    cond = archived.commit();
+    if (cond.bad())
+      return cond;
+  }
+  if (kept.getLength() == 0)
+  {
+    kept.discard();
+    if (unlink(filename.c_str()) != 0)
+    {
+      char buf[256];
+      DCMNET_ERROR("cannot remove MPPS history segment " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+      return MPPS_EC_SegmentIOError;
+    }
+    DCMNET_DEBUG("removed MPPS history segment " << filename << " (" << dropped << " records expired)");
+  } else {
+    cond = kept.commit();
+    if (cond.bad())
+      return cond;
+    DCMNET_DEBUG("rewrote MPPS history segment " << filename << " (" << dropped << " records expired, "
+      << kept.getLength() << " bytes kept)");
+  }
+  m_droppedRecords += dropped;
+  m_droppedBytes += droppedBytes;
+  return EC_Normal;
+}
+
+
+void DcmMppsHistoryCompactor::throttle(const Uint32 bytes)
+{
+  if (m_rateLimit == 0)
+    return;
+  // refill the bucket, allowing bursts of up to one second worth of I/O
+  const Uint64 now = DcmMppsSegmentLog::getTimestamp();
+  if (now > m_lastRefill)
+  {
+    m_tokens += OFstatic_cast(double, now - m_lastRefill) * m_rateLimit / 1000000.0;
+    if (m_tokens > m_rateLimit)
+      m_tokens = m_rateLimit;
+  }
+  m_lastRefill = now;
+  m_tokens -= bytes;
+  if (m_tokens < 0)
+  {
+    const double delay = -m_tokens * 1000.0 / m_rateLimit;
+    OFStandard::milliSleep(OFstatic_cast(unsigned int, delay) + 1);
+  }
+}
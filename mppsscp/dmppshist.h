@@ -0,0 +1,167 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Retention management of the on-disk MPPS history
+ *
+ */
+
+#ifndef DMPPSHIST_H
+#define DMPPSHIST_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofmap.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofthread.h"
+#include "dmppslog.h"               /* for DcmMppsSegmentLog */
+
+/// default interval between two compaction passes in seconds
+#define MPPS_HISTORY_DEFAULT_INTERVAL 3600
+
+/// default limit of the compaction I/O in bytes per second
+#define MPPS_HISTORY_DEFAULT_RATE (4 * 1024 * 1024)
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Background task keeping the MPPS history stored in a DcmMppsSegmentLog within its
+ *  retention. An instance is expired if its last record is older than the retention;
+ *  all records of expired instances are dropped from the closed segments (or moved to
+ *  an archive directory), so an instance is always either completely in the history or
+ *  not at all. Segments are rewritten to a temporary file which then replaces the
+ *  original by rename(), so readers that have the segment open keep reading the old
+ *  content. Segments without any remaining record are removed.
+ *  The active segment is never touched, so appending records is never blocked. All
+ *  reading and writing is limited to a configurable rate, so a pass over months of
+ *  history does not compete with the SCP for the disk.
+ */
+class DcmMppsHistoryCompactor : public OFThread
+{
+
+  public:
+
+    /** constructor
+     *  @param log [in] The segment log holding the history
+     */
+    DcmMppsHistoryCompactor(DcmMppsSegmentLog &log);
+
+    /** destructor
+     */
+    virtual ~DcmMppsHistoryCompactor();
+
+    /** Set the retention of the history
+     *  @param seconds [in] Time in seconds after the last record of an instance after
+     *                      which the instance is dropped
+     */
+    void setRetention(const Uint32 seconds);
+
+    /** Set the directory expired records are moved to. Archive segments have the same
+     *  format as the segments of the log and are named after their first record.
+     *  @param directory [in] The directory (must exist). If empty, expired records are
+     *                        deleted.
+     */
+    void setArchiveDirectory(const OFString &directory);
+
+    /** Set the limit of the compaction I/O
+     *  @param bytesPerSecond [in] Maximum number of bytes read and written per second,
+     *                             0 for unlimited
+     */
+    void setRateLimit(const Uint32 bytesPerSecond);
+
+    /** Set the interval between two compaction passes
+     *  @param seconds [in] Interval in seconds
+     */
+    void setInterval(const Uint32 seconds);
+
+    /** Ask the thread to stop. The current pass is interrupted between two records.
+     */
+    void stop();
+
+    /** Perform a single compaction pass
+     *  @param now [in] Current time in microseconds since the epoch
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition compact(const Uint64 now);
+
+  protected:
+
+    /** Perform a compaction pass every interval until stopped
+     */
+    virtual void run();
+
+  private:
+
+    /** Returns whether the thread should stop
+     *  @return OFTrue if stop() has been called, OFFalse otherwise
+     */
+    OFBool stopRequested();
+
+    /** Collect the instances with records not older than the given time. Segments are
+     *  scanned from the newest one until a segment starting before the given time.
+     *  @param segments [in]  First sequence numbers of all segments, sorted ascending
+     *  @param cutoff   [in]  Records older than this time are expired
+     *  @param live     [out] SOP instance UIDs of the instances to be kept
+     *  @param count    [out] Number of segments that may hold expired records
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition collectLiveInstances(const OFVector<Uint64> &segments,
+                                     const Uint64 cutoff,
+                                     OFMap<OFString, OFBool> &live,
+                                     size_t &count);
+
+    /** Drop (or archive) the records of expired instances from a closed segment
+     *  @param segment [in] First sequence number of the segment
+     *  @param live    [in] SOP instance UIDs of the instances to be kept
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition compactSegment(const Uint64 segment,
+                               const OFMap<OFString, OFBool> &live);
+
+    /** Account for I/O of the given size and sleep if the rate limit is exceeded
+     *  @param bytes [in] Number of bytes read or written
+     */
+    void throttle(const Uint32 bytes);
+
+    /// segment log holding the history
+    DcmMppsSegmentLog &m_log;
+
+    /// retention in seconds
+    Uint32 m_retention;
+
+    /// directory expired records are moved to, empty if they are deleted
+    OFString m_archiveDirectory;
+
+    /// rate limit in bytes per second, 0 for unlimited
+    Uint32 m_rateLimit;
+
+    /// interval between two passes in seconds
+    Uint32 m_interval;
+
+    /// bytes that may still be transferred without sleeping (token bucket)
+    double m_tokens;
+
+    /// time the token bucket was refilled last (microseconds since the epoch)
+    Uint64 m_lastRefill;
+
+    /// statistics of the current pass: records and bytes dropped
+    Uint64 m_droppedRecords;
+    Uint64 m_droppedBytes;
+
+    /// flag indicating that the thread should stop
+    OFBool m_stop;
+
+    /// mutex protecting the flag
+    OFMutex m_mutex;
+
+    // private undefined copy constructor
+    DcmMppsHistoryCompactor(const DcmMppsHistoryCompactor &);
+
+    // private undefined assignment operator
+    DcmMppsHistoryCompactor &operator=(const DcmMppsHistoryCompactor &);
+
+};
+
+#endif // DMPPSHIST_H
@@ -0,0 +1,628 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Load generator driving MPPS sequences over concurrent associations
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dmppsload.h"
+#include "dmppscond.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#define INCLUDE_CTIME
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <time.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// time in microseconds a worker waits before requesting an association again
+#define MPPS_LOAD_RECONNECT_DELAY 100000
+
+
+// get the current date (YYYYMMDD) and time (HHMMSS) for the synthetic datasets
+static void getDateTime(char *date,
+                        char *timeOfDay)
+{
+  const time_t now = time(NULL);
+  struct tm tmBuf;
+  localtime_r(&now, &tmBuf);
+  strftime(date, 9, "%Y%m%d", &tmBuf);
+  strftime(timeOfDay, 7, "%H%M%S", &tmBuf);
+}
+
+
+// append an item to a sequence, creating the sequence if necessary
+static DcmItem *appendItem(DcmItem &parent,
+                           const DcmTag &sequence)
+{
+  DcmItem *item = NULL;
+  parent.findOrCreateSequenceItem(sequence, item, -2 /* append */);
+  return item;
+}
+
+
+// print a latency in microseconds as milliseconds with three decimals
+static void printMilliseconds(STD_NAMESPACE ostream &out,
+                              const Uint64 microseconds)
+{
+  char buf[32];
+  sprintf(buf, "%10.3f", OFstatic_cast(double, microseconds) / 1000.0);
+  out << buf;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMppsLoadConfig::DcmMppsLoadConfig()
+  : peerHost()
+  , peerPort(104)
+  , ourAETitle("MPPSLOAD")
+  , peerAETitle("ANY-SCP")
+  , maxReceivePDULength(ASC_DEFAULTMAXPDU)
+  , acseTimeout(30)
+  , dimseTimeout(0)
+  , associationPerSequence(OFFalse)
+  , progressSets(MPPS_LOAD_DEFAULT_PROGRESS_SETS)
+  , finalStatus(MPPS_LF_Completed)
+  , series(MPPS_LOAD_DEFAULT_SERIES)
+  , images(MPPS_LOAD_DEFAULT_IMAGES)
+{
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMppsLoadSchedule::DcmMppsLoadSchedule(const double rate,
+                                         const Uint64 duration,
+                                         const Uint64 sequences,
+                                         const Uint64 warmup)
+  : m_rate(rate)
+  , m_duration(duration)
+  , m_sequences(sequences)
+  , m_warmup(warmup)
+  , m_startTime(0)
+  , m_next(0)
+  , m_measured(0)
+{
+}
+
+
+void DcmMppsLoadSchedule::start()
+{
+  m_next = 0;
+  m_measured = 0;
+  m_startTime = DcmMetricsRegistry::now();
+}
+
+
+OFBool DcmMppsLoadSchedule::next(Uint64 &dueTime,
+                                 OFBool &measured)
+{
+  const Uint64 index = __sync_fetch_and_add(&m_next, 1);
+  Uint64 due;
+  if (m_rate > 0)
+  {
+    // sequence n is due at a fixed time, however late the previous ones are
+    due = m_startTime + OFstatic_cast(Uint64, OFstatic_cast(double, index) * 1000000.0 / m_rate);
+    dueTime = due;
+  } else {
+    due = DcmMetricsRegistry::now();
+    dueTime = 0;
+  }
+  const Uint64 measureStart = getMeasureStart();
+  measured = (due >= measureStart);
+  if (measured)
+  {
+    if ((m_duration > 0) && (due >= measureStart + m_duration))
+      return OFFalse;
+    if ((m_sequences > 0) && (__sync_fetch_and_add(&m_measured, 1) >= m_sequences))
+      return OFFalse;
+  }
+  return OFTrue;
+}
+
+
+Uint64 DcmMppsLoadSchedule::getMeasureStart() const
+{
+  return m_startTime + m_warmup;
+}
+
+
+void DcmMppsLoadSchedule::waitUntil(const Uint64 time)
+{
+  struct timespec ts;
+  ts.tv_sec = OFstatic_cast(time_t, time / 1000000);
+  ts.tv_nsec = OFstatic_cast(long, (time % 1000000) * 1000);
+  // sleep until an absolute time, so that a late wake-up does not add up
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMppsLoadStatistics::DcmMppsLoadStatistics()
+  : m_completedSequences(0)
+  , m_failedSequences(0)
+  , m_requests(0)
+  , m_associationFailures(0)
+{
+}
+
+
+void DcmMppsLoadStatistics::record(const DcmMppsLoadMeasure measure,
+                                   const Uint64 latency)
+{
+  m_latencies[measure].record(latency);
+}
+
+
+void DcmMppsLoadStatistics::countSequence(const OFBool successful)
+{
+  if (successful)
+    __sync_fetch_and_add(&m_completedSequences, 1);
+  else
+    __sync_fetch_and_add(&m_failedSequences, 1);
+}
+
+
+void DcmMppsLoadStatistics::countRequest()
+{
+  __sync_fetch_and_add(&m_requests, 1);
+}
+
+
+void DcmMppsLoadStatistics::countAssociationFailure()
+{
+  __sync_fetch_and_add(&m_associationFailures, 1);
+}
+
+
+Uint64 DcmMppsLoadStatistics::getFailedSequences() const
+{
+  return m_failedSequences;
+}
+
+
+void DcmMppsLoadStatistics::print(STD_NAMESPACE ostream &out,
+                                  const Uint64 elapsed) const
+{
+  static const char *names[MPPS_LM_Count] =
+  {
+    "N-CREATE",
+    "N-SET (IN PROGRESS)",
+    "N-SET (final)",
+    "sequence (service)",
+    "sequence (response)"
+  };
+  const double seconds = OFstatic_cast(double, elapsed) / 1000000.0;
+  char buf[128];
+  out << "Sequences completed:    " << m_completedSequences << OFendl;
+  out << "Sequences failed:       " << m_failedSequences << OFendl;
+  out << "Requests sent:          " << m_requests << OFendl;
+  out << "Association failures:   " << m_associationFailures << OFendl;
+  if (seconds > 0)
+  {
+    sprintf(buf, "%.3f s, %.1f sequences/s, %.1f requests/s", seconds,
+      OFstatic_cast(double, m_completedSequences) / seconds,
+      OFstatic_cast(double, m_requests) / seconds);
+    out << "Measured:               " << buf << OFendl;
+  }
+  out << OFendl;
+  sprintf(buf, "%-22s %8s %10s %10s %10s %10s %10s %10s", "Latency (ms)", "count",
+    "mean", "p50", "p90", "p99", "p99.9", "max");
+  out << buf << OFendl;
+  for (size_t i = 0; i < MPPS_LM_Count; ++i)
+  {
+    const DcmLatencyHistogram &histogram = m_latencies[i];
+    const Uint64 count = histogram.getCount();
+    if (count == 0)
+      continue;
+    sprintf(buf, "%-22s %8lu ", names[i], OFstatic_cast(unsigned long, count));
+    out << buf;
+    printMilliseconds(out, histogram.getSum() / count);
+    out << ' ';
+    printMilliseconds(out, histogram.getQuantile(0.5));
+    out << ' ';
+    printMilliseconds(out, histogram.getQuantile(0.9));
+    out << ' ';
+    printMilliseconds(out, histogram.getQuantile(0.99));
+    out << ' ';
+    printMilliseconds(out, histogram.getQuantile(0.999));
+    out << ' ';
+    printMilliseconds(out, histogram.getQuantile(1.0));
+    out << OFendl;
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMppsLoadWorker::DcmMppsLoadWorker(const DcmMppsLoadConfig &config,
+                                     DcmMppsLoadSchedule &schedule,
+                                     DcmMppsLoadStatistics &statistics,
+                                     const Uint32 index)
+  : OFThread()
+  , m_config(config)
+  , m_schedule(schedule)
+  , m_statistics(statistics)
+  , m_index(index)
+  , m_sequenceCount(0)
+  , m_net(NULL)
+  , m_assoc(NULL)
+  , m_presID(0)
+  , m_messageID(0)
+{
+}
+
+
+DcmMppsLoadWorker::~DcmMppsLoadWorker()
+{
+  disconnect(OFFalse);
+  ASC_dropNetwork(&m_net);
+}
+
+
+void DcmMppsLoadWorker::run()
+{
+  Uint64 dueTime;
+  OFBool measured;
+  while (m_schedule.next(dueTime, measured))
+  {
+    OFCondition cond = runSequence(dueTime, measured);
+    if (measured)
+      m_statistics.countSequence(cond.good());
+    // a failure status leaves the association intact, any other error does not
+    if (cond.bad() && (cond != MPPS_EC_RequestFailed))
+      disconnect(OFTrue);
+    else if (m_config.associationPerSequence)
+      disconnect(OFFalse);
+  }
+  disconnect(OFFalse);
+}
+
+
+OFCondition DcmMppsLoadWorker::connect()
+{
+  if (m_assoc != NULL)
+    return EC_Normal;
+
+  OFString tempStr;
+  OFCondition cond;
+  if (m_net == NULL)
+  {
+    cond = ASC_initializeNetwork(NET_REQUESTOR, 0, m_config.acseTimeout, &m_net);
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Cannot initialize network: " << DimseCondition::dump(tempStr, cond));
+      return cond;
+    }
+  }
+
+  T_ASC_Parameters *params = NULL;
+  cond = ASC_createAssociationParameters(&params, m_config.maxReceivePDULength);
+  if (cond.bad())
+  {
+    DCMNET_ERROR(DimseCondition::dump(tempStr, cond));
+    return cond;
+  }
+  ASC_setAPTitles(params, m_config.ourAETitle.c_str(), m_config.peerAETitle.c_str(), NULL);
+
+  DIC_NODENAME localHost;
+  DIC_NODENAME peerHost;
+  memset(localHost, 0, sizeof(localHost));
+  gethostname(localHost, sizeof(localHost) - 1);
+  // the host names are limited to 63 characters by the underlying dcmnet structures
+  if (m_config.peerHost.length() + 6 /* ":65535" */ > 63)
+  {
+    DCMNET_ERROR("Peer host name '" << m_config.peerHost << "' is longer than maximum of 57 characters");
+    ASC_destroyAssociationParameters(&params);
+    return EC_IllegalCall;
+  }
+  sprintf(peerHost, "%s:%d", m_config.peerHost.c_str(), OFstatic_cast(int, m_config.peerPort));
+  ASC_setPresentationAddresses(params, localHost, peerHost);
+
+  const char *transferSyntaxes[] =
+  {
+    UID_LittleEndianExplicitTransferSyntax,
+    UID_BigEndianExplicitTransferSyntax,
+    UID_LittleEndianImplicitTransferSyntax
+  };
+  cond = ASC_addPresentationContext(params, 1, UID_ModalityPerformedProcedureStepSOPClass,
+    transferSyntaxes, 3);
+  if (cond.bad())
+  {
+    DCMNET_ERROR(DimseCondition::dump(tempStr, cond));
+    ASC_destroyAssociationParameters(&params);
+    return cond;
+  }
+
+  DCMNET_DEBUG("Worker " << m_index << ": Requesting Association");
+  cond = ASC_requestAssociation(m_net, params, &m_assoc);
+  if (cond.bad())
+  {
+    if (cond == DUL_ASSOCIATIONREJECTED)
+    {
+      T_ASC_RejectParameters rej;
+      ASC_getRejectParameters(params, &rej);
+      DCMNET_ERROR("Worker " << m_index << ": Association Rejected:" << OFendl
+        << ASC_printRejectParameters(tempStr, &rej));
+    } else {
+      DCMNET_ERROR("Worker " << m_index << ": Association Request Failed: "
+        << DimseCondition::dump(tempStr, cond));
+    }
+    // the association (if created) owns the parameters
+    if (m_assoc != NULL)
+      ASC_destroyAssociation(&m_assoc);
+    else
+      ASC_destroyAssociationParameters(&params);
+    return cond;
+  }
+
+  m_presID = ASC_findAcceptedPresentationContextID(m_assoc, UID_ModalityPerformedProcedureStepSOPClass);
+  if (m_presID == 0)
+  {
+    DCMNET_ERROR("Worker " << m_index << ": No Acceptable Presentation Contexts");
+    disconnect(OFTrue);
+    return NET_EC_NoAcceptablePresentationContexts;
+  }
+  DCMNET_DEBUG("Worker " << m_index << ": Association Accepted (Max Send PDV: "
+    << OFstatic_cast(unsigned long, m_assoc->sendPDVLength) << ")");
+  return EC_Normal;
+}
+
+
+void DcmMppsLoadWorker::disconnect(const OFBool abort)
+{
+  if (m_assoc == NULL)
+    return;
+  OFString tempStr;
+  OFCondition cond;
+  if (abort)
+  {
+    DCMNET_DEBUG("Worker " << m_index << ": Aborting Association");
+    cond = ASC_abortAssociation(m_assoc);
+  } else {
+    DCMNET_DEBUG("Worker " << m_index << ": Releasing Association");
+    cond = ASC_releaseAssociation(m_assoc);
+  }
+  if (cond.bad())
+    DCMNET_WARN("Worker " << m_index << ": Cannot terminate association: " << DimseCondition::dump(tempStr, cond));
+  ASC_destroyAssociation(&m_assoc);
+  m_presID = 0;
+}
+
+
+OFCondition DcmMppsLoadWorker::runSequence(const Uint64 dueTime,
+                                           const OFBool measured)
+{
+  // create all datasets before the sequence is started
+  char sopInstanceUID[100];
+  char studyInstanceUID[100];
+  char uid[100];
+  char date[9];
+  char timeOfDay[7];
+  char buf[64];
+  dcmGenerateUniqueIdentifier(sopInstanceUID, SITE_INSTANCE_UID_ROOT);
+  dcmGenerateUniqueIdentifier(studyInstanceUID, SITE_STUDY_UID_ROOT);
+  getDateTime(date, timeOfDay);
+  const Uint32 sequence = ++m_sequenceCount;
+
+  DcmDataset createDataset;
+  DcmItem *item = appendItem(createDataset, DCM_ScheduledStepAttributesSequence);
+  if (item != NULL)
+  {
+    item->putAndInsertString(DCM_StudyInstanceUID, studyInstanceUID);
+    item->insertEmptyElement(DCM_ReferencedStudySequence);
+    item->insertEmptyElement(DCM_AccessionNumber);
+    item->insertEmptyElement(DCM_RequestedProcedureID);
+    item->insertEmptyElement(DCM_RequestedProcedureDescription);
+    item->insertEmptyElement(DCM_ScheduledProcedureStepID);
+    item->insertEmptyElement(DCM_ScheduledProcedureStepDescription);
+    item->insertEmptyElement(DCM_ScheduledProtocolCodeSequence);
+  }
+  sprintf(buf, "LOAD^WORKER%u", OFstatic_cast(unsigned int, m_index));
+  createDataset.putAndInsertString(DCM_PatientName, buf);
+  sprintf(buf, "LOAD%u-%u", OFstatic_cast(unsigned int, m_index), OFstatic_cast(unsigned int, sequence));
+  createDataset.putAndInsertString(DCM_PatientID, buf);
+  createDataset.insertEmptyElement(DCM_PatientBirthDate);
+  createDataset.insertEmptyElement(DCM_PatientSex);
+  createDataset.insertEmptyElement(DCM_ReferencedPatientSequence);
+  sprintf(buf, "%u", OFstatic_cast(unsigned int, sequence));
+  createDataset.putAndInsertString(DCM_PerformedProcedureStepID, buf);
+  createDataset.putAndInsertString(DCM_PerformedStationAETitle, m_config.ourAETitle.c_str());
+  createDataset.insertEmptyElement(DCM_PerformedStationName);
+  createDataset.insertEmptyElement(DCM_PerformedLocation);
+  createDataset.putAndInsertString(DCM_PerformedProcedureStepStartDate, date);
+  createDataset.putAndInsertString(DCM_PerformedProcedureStepStartTime, timeOfDay);
+  createDataset.putAndInsertString(DCM_PerformedProcedureStepStatus, "IN PROGRESS");
+  createDataset.putAndInsertString(DCM_PerformedProcedureStepDescription, "LOAD TEST");
+  createDataset.insertEmptyElement(DCM_PerformedProcedureTypeDescription);
+  createDataset.insertEmptyElement(DCM_ProcedureCodeSequence);
+  createDataset.insertEmptyElement(DCM_PerformedProcedureStepEndDate);
+  createDataset.insertEmptyElement(DCM_PerformedProcedureStepEndTime);
+  createDataset.putAndInsertString(DCM_Modality, "OT");
+  createDataset.insertEmptyElement(DCM_StudyID);
+  createDataset.insertEmptyElement(DCM_PerformedProtocolCodeSequence);
+  createDataset.insertEmptyElement(DCM_PerformedSeriesSequence);
+
+  DcmDataset progressDataset;
+  progressDataset.putAndInsertString(DCM_PerformedProcedureStepStatus, "IN PROGRESS");
+  progressDataset.putAndInsertString(DCM_PerformedProcedureStepDescription, "LOAD TEST IN PROGRESS");
+
+  DcmDataset finalDataset;
+  if (m_config.finalStatus != MPPS_LF_None)
+  {
+    finalDataset.putAndInsertString(DCM_PerformedProcedureStepStatus,
+      (m_config.finalStatus == MPPS_LF_Completed) ? "COMPLETED" : "DISCONTINUED");
+    finalDataset.putAndInsertString(DCM_PerformedProcedureStepEndDate, date);
+    finalDataset.putAndInsertString(DCM_PerformedProcedureStepEndTime, timeOfDay);
+    finalDataset.insertEmptyElement(DCM_PerformedSeriesSequence);
+    for (Uint32 s = 0; s < m_config.series; ++s)
+    {
+      DcmItem *series = appendItem(finalDataset, DCM_PerformedSeriesSequence);
+      if (series == NULL)
+        break;
+      series->insertEmptyElement(DCM_PerformingPhysicianName);
+      series->putAndInsertString(DCM_ProtocolName, "LOAD TEST");
+      series->insertEmptyElement(DCM_OperatorsName);
+      series->putAndInsertString(DCM_SeriesInstanceUID, dcmGenerateUniqueIdentifier(uid, SITE_SERIES_UID_ROOT));
+      series->insertEmptyElement(DCM_SeriesDescription);
+      series->insertEmptyElement(DCM_RetrieveAETitle);
+      series->insertEmptyElement(DCM_ReferencedImageSequence);
+      for (Uint32 i = 0; i < m_config.images; ++i)
+      {
+        DcmItem *image = appendItem(*series, DCM_ReferencedImageSequence);
+        if (image == NULL)
+          break;
+        image->putAndInsertString(DCM_ReferencedSOPClassUID, UID_SecondaryCaptureImageStorage);
+        image->putAndInsertString(DCM_ReferencedSOPInstanceUID, dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT));
+      }
+      series->insertEmptyElement(DCM_ReferencedNonImageCompositeSOPInstanceSequence);
+    }
+  }
+
+  if (dueTime > 0)
+    DcmMppsLoadSchedule::waitUntil(dueTime);
+  const Uint64 startTime = DcmMetricsRegistry::now();
+
+  // the response time also includes requesting the association, if necessary
+  OFCondition cond = connect();
+  if (cond.bad())
+  {
+    m_statistics.countAssociationFailure();
+    DcmMppsLoadSchedule::waitUntil(DcmMetricsRegistry::now() + MPPS_LOAD_RECONNECT_DELAY);
+    return cond;
+  }
+  const Uint64 serviceStart = DcmMetricsRegistry::now();
+  cond = sendRequest(DIMSE_N_CREATE_RQ, sopInstanceUID, createDataset, MPPS_LM_Create, measured);
+  for (Uint32 i = 0; cond.good() && (i < m_config.progressSets); ++i)
+    cond = sendRequest(DIMSE_N_SET_RQ, sopInstanceUID, progressDataset, MPPS_LM_ProgressSet, measured);
+  if (cond.good() && (m_config.finalStatus != MPPS_LF_None))
+    cond = sendRequest(DIMSE_N_SET_RQ, sopInstanceUID, finalDataset, MPPS_LM_FinalSet, measured);
+  if (cond.good() && measured)
+  {
+    const Uint64 endTime = DcmMetricsRegistry::now();
+    m_statistics.record(MPPS_LM_SequenceService, endTime - serviceStart);
+    m_statistics.record(MPPS_LM_SequenceResponse, endTime - ((dueTime > 0) ? dueTime : startTime));
+  }
+  return cond;
+}
+
+
+OFCondition DcmMppsLoadWorker::sendRequest(const T_DIMSE_Command commandField,
+                                           const char *sopInstanceUID,
+                                           DcmDataset &dataset,
+                                           const DcmMppsLoadMeasure measure,
+                                           const OFBool measured)
+{
+  T_DIMSE_Message request;
+  // make sure everything is zeroed (especially options)
+  memset(&request, 0, sizeof(request));
+  request.CommandField = commandField;
+  const Uint16 messageID = ++m_messageID;
+  T_DIMSE_Command expectedResponse;
+  if (commandField == DIMSE_N_CREATE_RQ)
+  {
+    T_DIMSE_N_CreateRQ &createReq = request.msg.NCreateRQ;
+    createReq.MessageID = messageID;
+    createReq.DataSetType = DIMSE_DATASET_PRESENT;
+    createReq.opts = O_NCREATE_AFFECTEDSOPINSTANCEUID;
+    OFStandard::strlcpy(createReq.AffectedSOPClassUID, UID_ModalityPerformedProcedureStepSOPClass, sizeof(createReq.AffectedSOPClassUID));
+    OFStandard::strlcpy(createReq.AffectedSOPInstanceUID, sopInstanceUID, sizeof(createReq.AffectedSOPInstanceUID));
+    expectedResponse = DIMSE_N_CREATE_RSP;
+  } else {
+    T_DIMSE_N_SetRQ &setReq = request.msg.NSetRQ;
+    setReq.MessageID = messageID;
+    setReq.DataSetType = DIMSE_DATASET_PRESENT;
+    OFStandard::strlcpy(setReq.RequestedSOPClassUID, UID_ModalityPerformedProcedureStepSOPClass, sizeof(setReq.RequestedSOPClassUID));
+    OFStandard::strlcpy(setReq.RequestedSOPInstanceUID, sopInstanceUID, sizeof(setReq.RequestedSOPInstanceUID));
+    expectedResponse = DIMSE_N_SET_RSP;
+  }
+
+  OFString tempStr;
+  const Uint64 startTime = DcmMetricsRegistry::now();
+  OFCondition cond = DIMSE_sendMessageUsingMemoryData(m_assoc, m_presID, &request, NULL /* statusDetail */,
+    &dataset, NULL /* callback */, NULL /* callbackContext */);
+  if (cond.bad())
+  {
+    DCMNET_ERROR("Worker " << m_index << ": Failed sending request: " << DimseCondition::dump(tempStr, cond));
+    return cond;
+  }
+  if (measured)
+    m_statistics.countRequest();
+
+  const T_DIMSE_BlockingMode blockMode = (m_config.dimseTimeout > 0) ? DIMSE_NONBLOCKING : DIMSE_BLOCKING;
+  T_DIMSE_Message response;
+  memset(&response, 0, sizeof(response));
+  T_ASC_PresentationContextID presID;
+  DcmDataset *statusDetail = NULL;
+  cond = DIMSE_receiveCommand(m_assoc, blockMode, m_config.dimseTimeout, &presID, &response, &statusDetail);
+  if (cond.bad())
+  {
+    DCMNET_ERROR("Worker " << m_index << ": Failed receiving response: " << DimseCondition::dump(tempStr, cond));
+    return cond;
+  }
+  delete statusDetail;
+  if (response.CommandField != expectedResponse)
+  {
+    DCMNET_ERROR("Worker " << m_index << ": Expected DIMSE command 0x"
+      << STD_NAMESPACE hex << STD_NAMESPACE setfill('0') << STD_NAMESPACE setw(4)
+      << OFstatic_cast(unsigned int, expectedResponse) << " but received 0x" << STD_NAMESPACE setw(4)
+      << OFstatic_cast(unsigned int, response.CommandField));
+    return DIMSE_BADCOMMANDTYPE;
+  }
+  Uint16 status;
+  Uint16 messageIDRespondedTo;
+  T_DIMSE_DataSetType dataSetType;
+  if (expectedResponse == DIMSE_N_CREATE_RSP)
+  {
+    status = response.msg.NCreateRSP.DimseStatus;
+    messageIDRespondedTo = response.msg.NCreateRSP.MessageIDBeingRespondedTo;
+    dataSetType = response.msg.NCreateRSP.DataSetType;
+  } else {
+    status = response.msg.NSetRSP.DimseStatus;
+    messageIDRespondedTo = response.msg.NSetRSP.MessageIDBeingRespondedTo;
+    dataSetType = response.msg.NSetRSP.DataSetType;
+  }
+  if (messageIDRespondedTo != messageID)
+  {
+    DCMNET_ERROR("Worker " << m_index << ": Response to message ID " << messageIDRespondedTo
+      << " received, expected " << messageID);
+    return DIMSE_BADMESSAGE;
+  }
+  if (dataSetType == DIMSE_DATASET_PRESENT)
+  {
+    // the attributes returned by the SCP are not of interest
+    DcmDataset *rspDataset = NULL;
+    cond = DIMSE_receiveDataSetInMemory(m_assoc, blockMode, m_config.dimseTimeout, &presID, &rspDataset,
+      NULL /* callback */, NULL /* callbackContext */);
+    delete rspDataset;
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Worker " << m_index << ": Failed receiving response dataset: " << DimseCondition::dump(tempStr, cond));
+      return cond;
+    }
+  }
+  const Uint64 latency = DcmMetricsRegistry::now() - startTime;
+
+  if ((status != STATUS_Success) && !DICOM_WARNING_STATUS(status))
+  {
+    DCMNET_WARN("Worker " << m_index << ": " << ((expectedResponse == DIMSE_N_CREATE_RSP) ? "N-CREATE" : "N-SET")
+      << " failed with status 0x"
+      << STD_NAMESPACE hex << STD_NAMESPACE setfill('0') << STD_NAMESPACE setw(4) << status
+      << STD_NAMESPACE dec << " for " << sopInstanceUID);
+    return MPPS_EC_RequestFailed;
+  }
+  if (measured)
+    m_statistics.record(measure, latency);
+  return EC_Normal;
+}
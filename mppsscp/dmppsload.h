@@ -0,0 +1,344 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Load generator driving MPPS sequences over concurrent associations
+ *
+ */
+
+#ifndef DMPPSLOAD_H
+#define DMPPSLOAD_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofstream.h"
+#include "dcmtk/ofstd/ofthread.h"
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmnet/assoc.h"
+#include "dcmtk/dcmnet/dimse.h"
+#include "dscpmetr.h"               /* for DcmLatencyHistogram */
+
+/// default number of N-SET requests with status IN PROGRESS per sequence
+#define MPPS_LOAD_DEFAULT_PROGRESS_SETS 1
+
+/// default number of performed series in the final N-SET request
+#define MPPS_LOAD_DEFAULT_SERIES 2
+
+/// default number of images referenced per performed series
+#define MPPS_LOAD_DEFAULT_IMAGES 50
+
+/** How a sequence ends
+ */
+enum DcmMppsLoadFinalStatus
+{
+  /// with an N-SET request setting the status COMPLETED
+  MPPS_LF_Completed,
+  /// with an N-SET request setting the status DISCONTINUED
+  MPPS_LF_Discontinued,
+  /// without a final N-SET request, the instance stays IN PROGRESS
+  MPPS_LF_None
+};
+
+/** Latencies measured by the load generator
+ */
+enum DcmMppsLoadMeasure
+{
+  /// N-CREATE request to response
+  MPPS_LM_Create,
+  /// N-SET (IN PROGRESS) request to response
+  MPPS_LM_ProgressSet,
+  /// final N-SET (COMPLETED or DISCONTINUED) request to response
+  MPPS_LM_FinalSet,
+  /// whole sequence, from sending the first request (service time)
+  MPPS_LM_SequenceService,
+  /// whole sequence, from the time it was scheduled to start (response time)
+  MPPS_LM_SequenceResponse,
+  /// number of measures
+  MPPS_LM_Count
+};
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Settings of the load generator shared by all associations
+ */
+struct DcmMppsLoadConfig
+{
+  /** default constructor, sets the defaults
+   */
+  DcmMppsLoadConfig();
+
+  /// host name or address of the SCP
+  OFString peerHost;
+  /// port of the SCP
+  Uint16 peerPort;
+  /// calling AE title
+  OFString ourAETitle;
+  /// called AE title
+  OFString peerAETitle;
+  /// maximum PDU length received
+  Uint32 maxReceivePDULength;
+  /// timeout for ACSE messages in seconds
+  Uint32 acseTimeout;
+  /// timeout for DIMSE messages in seconds, 0 for none
+  Uint32 dimseTimeout;
+  /// open a new association for each sequence instead of keeping one per worker
+  OFBool associationPerSequence;
+  /// number of N-SET requests with status IN PROGRESS per sequence
+  Uint32 progressSets;
+  /// how a sequence ends
+  DcmMppsLoadFinalStatus finalStatus;
+  /// number of performed series in the final N-SET request
+  Uint32 series;
+  /// number of images referenced per performed series
+  Uint32 images;
+};
+
+
+/** Schedule of the sequences shared by all associations. With a target rate,
+ *  sequence n is due at start + n / rate, no matter how long earlier sequences took
+ *  (open model). Latencies measured from the due time instead of the time the first
+ *  request was actually sent include the time a sequence waited for a free
+ *  association, which corrects for coordinated omission: a slow response delays the
+ *  following sequences and is counted for each of them. Without a target rate, each
+ *  association starts the next sequence as soon as the previous one is done (closed
+ *  model).
+ */
+class DcmMppsLoadSchedule
+{
+
+  public:
+
+    /** constructor
+     *  @param rate      [in] Target rate in sequences per second, 0 for none
+     *  @param duration  [in] Time in microseconds sequences are measured, 0 for no limit
+     *  @param sequences [in] Number of sequences measured, 0 for no limit
+     *  @param warmup    [in] Time in microseconds sequences are run before measuring
+     */
+    DcmMppsLoadSchedule(const double rate,
+                        const Uint64 duration,
+                        const Uint64 sequences,
+                        const Uint64 warmup);
+
+    /** Start the schedule now
+     */
+    void start();
+
+    /** Get the next sequence to run
+     *  @param dueTime  [out] Time the sequence is due (see DcmMetricsRegistry::now()),
+     *                        0 if it is due as soon as it is ready
+     *  @param measured [out] OFTrue if the sequence is measured, OFFalse during warm-up
+     *  @return OFTrue if a sequence is due, OFFalse if the run is over
+     */
+    OFBool next(Uint64 &dueTime,
+                OFBool &measured);
+
+    /** Returns the time the measurement started, i.e.\ the end of the warm-up
+     *  @return The time, see DcmMetricsRegistry::now()
+     */
+    Uint64 getMeasureStart() const;
+
+    /** Wait until a time has come
+     *  @param time [in] The time, see DcmMetricsRegistry::now()
+     */
+    static void waitUntil(const Uint64 time);
+
+  private:
+
+    /// target rate in sequences per second, 0 for none
+    double m_rate;
+
+    /// time in microseconds sequences are measured, 0 for no limit
+    Uint64 m_duration;
+
+    /// number of sequences measured, 0 for no limit
+    Uint64 m_sequences;
+
+    /// warm-up time in microseconds
+    Uint64 m_warmup;
+
+    /// time the schedule was started
+    Uint64 m_startTime;
+
+    /// number of the next sequence
+    volatile Uint64 m_next;
+
+    /// number of measured sequences handed out
+    volatile Uint64 m_measured;
+};
+
+
+/** Counters and latency histograms of a run, updated by all associations
+ */
+class DcmMppsLoadStatistics
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmMppsLoadStatistics();
+
+    /** Record a latency
+     *  @param measure [in] What has been measured
+     *  @param latency [in] The latency in microseconds
+     */
+    void record(const DcmMppsLoadMeasure measure,
+                const Uint64 latency);
+
+    /** Count a completed sequence
+     *  @param successful [in] OFTrue if all requests succeeded, OFFalse otherwise
+     */
+    void countSequence(const OFBool successful);
+
+    /** Count a request sent
+     */
+    void countRequest();
+
+    /** Count an association that could not be established or was lost
+     */
+    void countAssociationFailure();
+
+    /** Print the counters and latency percentiles
+     *  @param out     [out] Stream the report is printed to
+     *  @param elapsed [in]  Time the measurement lasted in microseconds
+     */
+    void print(STD_NAMESPACE ostream &out,
+               const Uint64 elapsed) const;
+
+    /** Returns the number of sequences that failed
+     *  @return The number of sequences
+     */
+    Uint64 getFailedSequences() const;
+
+  private:
+
+    /// latencies per measure
+    DcmLatencyHistogram m_latencies[MPPS_LM_Count];
+
+    /// number of sequences completed successfully
+    volatile Uint64 m_completedSequences;
+
+    /// number of sequences with a failed request
+    volatile Uint64 m_failedSequences;
+
+    /// number of requests sent
+    volatile Uint64 m_requests;
+
+    /// number of associations that could not be established or were lost
+    volatile Uint64 m_associationFailures;
+
+    // private undefined copy constructor
+    DcmMppsLoadStatistics(const DcmMppsLoadStatistics &);
+
+    // private undefined assignment operator
+    DcmMppsLoadStatistics &operator=(const DcmMppsLoadStatistics &);
+};
+
+
+/** Thread running MPPS sequences (N-CREATE, N-SET IN PROGRESS, final N-SET) with
+ *  synthetic datasets over an association of its own, as scheduled by a
+ *  DcmMppsLoadSchedule. The datasets of a sequence are created before its first
+ *  request is sent, so that only network and SCP time is measured. A failed request
+ *  ends the sequence; the association is aborted and established again for the next
+ *  sequence if the failure was not a status returned by the SCP.
+ */
+class DcmMppsLoadWorker : public OFThread
+{
+
+  public:
+
+    /** constructor
+     *  @param config     [in] Settings, must exist as long as the worker
+     *  @param schedule   [in] Schedule of the sequences
+     *  @param statistics [in] Counters and histograms updated
+     *  @param index      [in] Number of the worker, part of the synthetic patient IDs
+     */
+    DcmMppsLoadWorker(const DcmMppsLoadConfig &config,
+                      DcmMppsLoadSchedule &schedule,
+                      DcmMppsLoadStatistics &statistics,
+                      const Uint32 index);
+
+    /** destructor. Releases the association, if any.
+     */
+    virtual ~DcmMppsLoadWorker();
+
+  protected:
+
+    /** Run sequences until the schedule is over
+     */
+    virtual void run();
+
+  private:
+
+    /** Request an association (if there is none)
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition connect();
+
+    /** Release or abort the association (if any)
+     *  @param abort [in] OFTrue to abort, OFFalse to release
+     */
+    void disconnect(const OFBool abort);
+
+    /** Run one sequence
+     *  @param dueTime  [in] Time the sequence is due, 0 if due as soon as it is ready
+     *  @param measured [in] OFTrue if the latencies are recorded
+     *  @return EC_Normal if all requests succeeded, an error code otherwise
+     */
+    OFCondition runSequence(const Uint64 dueTime,
+                            const OFBool measured);
+
+    /** Send an N-CREATE or N-SET request, receive its response and record its latency
+     *  @param commandField   [in] DIMSE_N_CREATE_RQ or DIMSE_N_SET_RQ
+     *  @param sopInstanceUID [in] The MPPS instance
+     *  @param dataset        [in] The dataset of the request
+     *  @param measure        [in] The latency recorded
+     *  @param measured       [in] OFTrue if the request and its latency are recorded
+     *  @return EC_Normal if the response has a success or warning status,
+     *          MPPS_EC_RequestFailed if it has a failure status, an error code otherwise
+     */
+    OFCondition sendRequest(const T_DIMSE_Command commandField,
+                            const char *sopInstanceUID,
+                            DcmDataset &dataset,
+                            const DcmMppsLoadMeasure measure,
+                            const OFBool measured);
+
+    /// settings
+    const DcmMppsLoadConfig &m_config;
+
+    /// schedule of the sequences
+    DcmMppsLoadSchedule &m_schedule;
+
+    /// counters and histograms
+    DcmMppsLoadStatistics &m_statistics;
+
+    /// number of the worker
+    Uint32 m_index;
+
+    /// number of sequences run by this worker
+    Uint32 m_sequenceCount;
+
+    /// network of the association
+    T_ASC_Network *m_net;
+
+    /// the association, NULL if none
+    T_ASC_Association *m_assoc;
+
+    /// accepted presentation context for MPPS
+    T_ASC_PresentationContextID m_presID;
+
+    /// message ID of the last request
+    Uint16 m_messageID;
+
+    // private undefined copy constructor
+    DcmMppsLoadWorker(const DcmMppsLoadWorker &);
+
+    // private undefined assignment operator
+    DcmMppsLoadWorker &operator=(const DcmMppsLoadWorker &);
+};
+
+#endif // DMPPSLOAD_H
@@ -0,0 +1,534 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Append-only log of MPPS records, stored in segment files
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dmppslog.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+END_EXTERN_C
+
+// number of digits of the sequence number in segment file names
+#define MPPS_LOG_SEGMENT_DIGITS 20
+
+
+// helper functions for little endian encoding
+
+static void putUint16(Uint8 *buffer, const Uint16 value)
+{
+  buffer[0] = OFstatic_cast(Uint8, value);
+  buffer[1] = OFstatic_cast(Uint8, value >> 8);
+}
+
+static void putUint32(Uint8 *buffer, const Uint32 value)
+{
+  for (int i = 0; i < 4; ++i)
+    buffer[i] = OFstatic_cast(Uint8, value >> (8 * i));
+}
+
+static void putUint64(Uint8 *buffer, const Uint64 value)
+{
+  for (int i = 0; i < 8; ++i)
+    buffer[i] = OFstatic_cast(Uint8, value >> (8 * i));
+}
+
+static Uint16 getUint16(const Uint8 *buffer)
+{
+  return OFstatic_cast(Uint16, buffer[0] | (buffer[1] << 8));
+}
+
+static Uint32 getUint32(const Uint8 *buffer)
+{
+  Uint32 value = 0;
+  for (int i = 3; i >= 0; --i)
+    value = (value << 8) | buffer[i];
+  return value;
+}
+
+static Uint64 getUint64(const Uint8 *buffer)
+{
+  Uint64 value = 0;
+  for (int i = 7; i >= 0; --i)
+    value = (value << 8) | buffer[i];
+  return value;
+}
+
+// ----------------------------------------------------------------------------
+
+// implementation of the segment reader
+
+DcmMppsSegmentReader::DcmMppsSegmentReader()
+  : m_fd(-1)
+  , m_offset(0)
+  , m_buffer(NULL)
+  , m_capacity(0)
+{
+}
+
+
+DcmMppsSegmentReader::~DcmMppsSegmentReader()
+{
+  close();
+  delete[] m_buffer;
+}
+
+
+OFCondition DcmMppsSegmentReader::open(const OFString &filename)
+{
+  close();
+  m_fd = ::open(filename.c_str(), O_RDONLY);
+  if (m_fd < 0)
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot open segment file " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return MPPS_EC_SegmentIOError;
+  }
+  m_offset = 0;
+  return EC_Normal;
+}
+
+
+void DcmMppsSegmentReader::close()
+{
+  if (m_fd >= 0)
+  {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_offset = 0;
+}
+
+
+OFCondition DcmMppsSegmentReader::readRecord(DcmMppsRecord &record)
+{
+  if (m_fd < 0)
+    return MPPS_EC_SegmentIOError;
+
+  // read the fixed part of the record first
+  reserve(MPPS_LOG_HEADER_SIZE);
+  ssize_t bytesRead = pread(m_fd, m_buffer, MPPS_LOG_HEADER_SIZE, OFstatic_cast(off_t, m_offset));
+  if (bytesRead < 0)
+    return MPPS_EC_SegmentIOError;
+  if (bytesRead < MPPS_LOG_HEADER_SIZE)
+    return MPPS_EC_EndOfSegment;
+  if (getUint32(m_buffer) != MPPS_LOG_RECORD_MAGIC)
+    return MPPS_EC_CorruptRecord;
+  const Uint32 length = getUint32(m_buffer + 4);
+  if (length < MPPS_LOG_HEADER_SIZE)
+    return MPPS_EC_CorruptRecord;
+
+  // then the variable part (UID and payload)
+  reserve(length);
+  const Uint32 remaining = length - MPPS_LOG_HEADER_SIZE;
+  if (remaining > 0)
+  {
+    bytesRead = pread(m_fd, m_buffer + MPPS_LOG_HEADER_SIZE, remaining,
+      OFstatic_cast(off_t, m_offset + MPPS_LOG_HEADER_SIZE));
+    if (bytesRead < 0)
+      return MPPS_EC_SegmentIOError;
+    if (OFstatic_cast(Uint32, bytesRead) < remaining)
+      return MPPS_EC_EndOfSegment;
+  }
+
+  OFCondition cond = DcmMppsSegmentLog::decodeRecord(m_buffer, length, record);
+  if (cond.good())
+    m_offset += length;
+  return cond;
+}
+
+
+Uint64 DcmMppsSegmentReader::getOffset() const
+{
+  return m_offset;
+}
+
+
+OFBool DcmMppsSegmentReader::isOpen() const
+{
+  return (m_fd >= 0);
+}
+
+
+void DcmMppsSegmentReader::reserve(const Uint32 length)
+{
+  if (length <= m_capacity)
+    return;
+  // keep the header already read (if any)
+  Uint8 *buffer = new Uint8[length];
+  if (m_buffer != NULL)
+    memcpy(buffer, m_buffer, (m_capacity < MPPS_LOG_HEADER_SIZE) ? m_capacity : MPPS_LOG_HEADER_SIZE);
+  delete[] m_buffer;
+  m_buffer = buffer;
+  m_capacity = length;
+}
+
+// ----------------------------------------------------------------------------
+
+// implementation of the segment log
+
+DcmMppsSegmentLog::DcmMppsSegmentLog()
+  : m_directory()
+  , m_fd(-1)
+  , m_activeSegment(0)
+  , m_segmentSize(0)
+  , m_nextSequence(1)
+  , m_maxSegmentSize(MPPS_LOG_DEFAULT_SEGMENT_SIZE)
+  , m_syncMode(OFFalse)
+  , m_buffer()
+  , m_mutex()
+{
+}
+
+
+DcmMppsSegmentLog::~DcmMppsSegmentLog()
+{
+  close();
+}
+
+
+void DcmMppsSegmentLog::setMaxSegmentSize(const Uint32 size)
+{
+  m_maxSegmentSize = size;
+}
+
+
+void DcmMppsSegmentLog::setSyncMode(const OFBool mode)
+{
+  m_syncMode = mode;
+}
+
+
+OFCondition DcmMppsSegmentLog::open(const OFString &directory)
+{
+  close();
+  OFVector<Uint64> segments;
+  OFCondition cond = listSegments(directory, segments);
+  if (cond.bad())
+    return cond;
+
+  m_mutex.lock();
+  m_directory = directory;
+  m_nextSequence = 1;
+  if (segments.empty())
+    cond = startSegment();
+  else
+    cond = recover(segments.back());
+  m_mutex.unlock();
+  if (cond.good())
+  {
+    DCMNET_DEBUG("opened MPPS log in " << directory << " (" << segments.size()
+      << " segments, next sequence number " << m_nextSequence << ")");
+  }
+  return cond;
+}
+
+
+void DcmMppsSegmentLog::close()
+{
+  m_mutex.lock();
+  if (m_fd >= 0)
+  {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_mutex.unlock();
+}
+
+
+OFCondition DcmMppsSegmentLog::append(const Uint16 type,
+                                      const OFString &sopInstanceUID,
+                                      const Uint8 *payload,
+                                      const Uint32 payloadLength,
+                                      Uint64 &sequence)
+{
+  const Uint16 uidLength = OFstatic_cast(Uint16, sopInstanceUID.length());
+  const Uint32 length = MPPS_LOG_HEADER_SIZE + uidLength + payloadLength;
+  OFCondition cond = EC_Normal;
+
+  m_mutex.lock();
+  if (m_fd < 0)
+    cond = MPPS_EC_SegmentIOError;
+  // start a new segment if the record does not fit into the active one any more
+  else if ((m_segmentSize > 0) && (m_segmentSize + length > m_maxSegmentSize))
+    cond = startSegment();
+  if (cond.good())
+  {
+    // encode the complete record, so it is written with a single call
+    if (m_buffer.size() < length)
+      m_buffer.resize(length);
+    Uint8 *buffer = &m_buffer[0];
+    encodeHeader(buffer, m_nextSequence, getTimestamp(), type, uidLength, payloadLength);
+    memcpy(buffer + MPPS_LOG_HEADER_SIZE, sopInstanceUID.c_str(), uidLength);
+    if (payloadLength > 0)
+      memcpy(buffer + MPPS_LOG_HEADER_SIZE + uidLength, payload, payloadLength);
+
+    Uint32 written = 0;
+    while (written < length)
+    {
+      const ssize_t result = ::write(m_fd, buffer + written, length - written);
+      if (result < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        char buf[256];
+        DCMNET_ERROR("cannot write to MPPS log segment " << getSegmentFilename(m_directory, m_activeSegment)
+          << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+        // cut off the partial record, so the segment stays readable
+        if ((written > 0) && (ftruncate(m_fd, OFstatic_cast(off_t, m_segmentSize)) != 0))
+          DCMNET_WARN("cannot truncate MPPS log segment after failed write");
+        cond = MPPS_EC_SegmentIOError;
+        break;
+      }
+      written += OFstatic_cast(Uint32, result);
+    }
+    if (cond.good())
+    {
+      if (m_syncMode)
+        fdatasync(m_fd);
+      m_segmentSize += length;
+      sequence = m_nextSequence++;
+    }
+  }
+  m_mutex.unlock();
+  return cond;
+}
+
+
+OFBool DcmMppsSegmentLog::isOpen() const
+{
+  return (m_fd >= 0);
+}
+
+
+const OFString &DcmMppsSegmentLog::getDirectory() const
+{
+  return m_directory;
+}
+
+
+Uint64 DcmMppsSegmentLog::getNextSequence()
+{
+  m_mutex.lock();
+  const Uint64 sequence = m_nextSequence;
+  m_mutex.unlock();
+  return sequence;
+}
+
+
+Uint64 DcmMppsSegmentLog::getActiveSegment()
+{
+  m_mutex.lock();
+  const Uint64 segment = m_activeSegment;
+  m_mutex.unlock();
+  return segment;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSegmentLog::encodeHeader(Uint8 *buffer,
+                                     const Uint64 sequence,
+                                     const Uint64 timestamp,
+                                     const Uint16 type,
+                                     const Uint16 uidLength,
+                                     const Uint32 payloadLength)
+{
+  putUint32(buffer, MPPS_LOG_RECORD_MAGIC);
+  putUint32(buffer + 4, MPPS_LOG_HEADER_SIZE + uidLength + payloadLength);
+  putUint64(buffer + 8, sequence);
+  putUint64(buffer + 16, timestamp);
+  putUint16(buffer + 24, type);
+  putUint16(buffer + 26, uidLength);
+  putUint32(buffer + 28, payloadLength);
+}
+
+
+OFCondition DcmMppsSegmentLog::decodeRecord(const Uint8 *buffer,
+                                            const Uint32 length,
+                                            DcmMppsRecord &record)
+{
+  if (length < MPPS_LOG_HEADER_SIZE)
+    return MPPS_EC_EndOfSegment;
+  if (getUint32(buffer) != MPPS_LOG_RECORD_MAGIC)
+    return MPPS_EC_CorruptRecord;
+  const Uint32 recordLength = getUint32(buffer + 4);
+  const Uint16 uidLength = getUint16(buffer + 26);
+  const Uint32 payloadLength = getUint32(buffer + 28);
+  if (recordLength != MPPS_LOG_HEADER_SIZE + uidLength + payloadLength)
+    return MPPS_EC_CorruptRecord;
+  if (length < recordLength)
+    return MPPS_EC_EndOfSegment;
+
+  record.sequence = getUint64(buffer + 8);
+  record.timestamp = getUint64(buffer + 16);
+  record.type = getUint16(buffer + 24);
+  record.sopInstanceUID.assign(OFreinterpret_cast(const char *, buffer + MPPS_LOG_HEADER_SIZE), uidLength);
+  record.payload = buffer + MPPS_LOG_HEADER_SIZE + uidLength;
+  record.payloadLength = payloadLength;
+  record.raw = buffer;
+  record.rawLength = recordLength;
+  return EC_Normal;
+}
+
+
+Uint64 DcmMppsSegmentLog::getTimestamp()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return OFstatic_cast(Uint64, tv.tv_sec) * 1000000 + OFstatic_cast(Uint64, tv.tv_usec);
+}
+
+
+OFString DcmMppsSegmentLog::getSegmentFilename(const OFString &directory,
+                                               const Uint64 firstSequence)
+{
+  char name[MPPS_LOG_SEGMENT_DIGITS + 1];
+  // print the sequence number with leading zeros, so the names sort numerically
+  Uint64 value = firstSequence;
+  for (int i = MPPS_LOG_SEGMENT_DIGITS - 1; i >= 0; --i)
+  {
+    name[i] = OFstatic_cast(char, '0' + (value % 10));
+    value /= 10;
+  }
+  name[MPPS_LOG_SEGMENT_DIGITS] = '\0';
+  OFString filename;
+  OFStandard::combineDirAndFilename(filename, directory, name, OFTrue /* allowEmptyDirName */);
+  filename += MPPS_LOG_SEGMENT_EXTENSION;
+  return filename;
+}
+
+
+OFCondition DcmMppsSegmentLog::listSegments(const OFString &directory,
+                                            OFVector<Uint64> &segments)
+{
+  segments.clear();
+  DIR *dir = opendir(directory.c_str());
+  if (dir == NULL)
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot open MPPS log directory " << directory << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return MPPS_EC_SegmentIOError;
+  }
+  const size_t extLength = strlen(MPPS_LOG_SEGMENT_EXTENSION);
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    const OFString name(entry->d_name);
+    if ((name.length() != MPPS_LOG_SEGMENT_DIGITS + extLength) ||
+        (name.compare(MPPS_LOG_SEGMENT_DIGITS, extLength, MPPS_LOG_SEGMENT_EXTENSION) != 0))
+      continue;
+    Uint64 value = 0;
+    OFBool valid = OFTrue;
+    for (size_t i = 0; valid && (i < MPPS_LOG_SEGMENT_DIGITS); ++i)
+    {
+      if ((name[i] < '0') || (name[i] > '9'))
+        valid = OFFalse;
+      else
+        value = value * 10 + OFstatic_cast(Uint64, name[i] - '0');
+    }
+    if (valid)
+      segments.push_back(value);
+  }
+  closedir(dir);
+
+  // sort ascending (insertion sort, the number of segments is moderate)
+  for (size_t i = 1; i < segments.size(); ++i)
+  {
+    const Uint64 value = segments[i];
+    size_t j = i;
+    while ((j > 0) && (segments[j - 1] > value))
+    {
+      segments[j] = segments[j - 1];
+      --j;
+    }
+    segments[j] = value;
+  }
+  return EC_Normal;
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmMppsSegmentLog::recover(const Uint64 firstSequence)
+{
+  const OFString filename = getSegmentFilename(m_directory, firstSequence);
+  DcmMppsSegmentReader reader;
+  OFCondition cond = reader.open(filename);
+  if (cond.bad())
+    return cond;
+
+  // find the end of the last complete record
+  m_nextSequence = firstSequence;
+  DcmMppsRecord record;
+  while ((cond = reader.readRecord(record)).good())
+    m_nextSequence = record.sequence + 1;
+  const Uint64 validLength = reader.getOffset();
+  reader.close();
+  // anything but the end of the segment or a torn record behind the last complete one
+  if ((cond != MPPS_EC_EndOfSegment) && (cond != MPPS_EC_CorruptRecord))
+    return cond;
+
+  m_fd = ::open(filename.c_str(), O_WRONLY | O_APPEND);
+  if (m_fd < 0)
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot open MPPS log segment " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return MPPS_EC_SegmentIOError;
+  }
+  struct stat st;
+  if ((fstat(m_fd, &st) == 0) && (OFstatic_cast(Uint64, st.st_size) > validLength))
+  {
+    DCMNET_WARN("cutting off " << (OFstatic_cast(Uint64, st.st_size) - validLength)
+      << " bytes of incomplete record(s) at the end of MPPS log segment " << filename);
+    if (ftruncate(m_fd, OFstatic_cast(off_t, validLength)) != 0)
+    {
+      ::close(m_fd);
+      m_fd = -1;
+      return MPPS_EC_SegmentIOError;
+    }
+  }
+  m_activeSegment = firstSequence;
+  m_segmentSize = validLength;
+  return EC_Normal;
+}
+
+
+OFCondition DcmMppsSegmentLog::startSegment()
+{
+  if (m_fd >= 0)
+  {
+    if (m_syncMode)
+      fdatasync(m_fd);
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  const OFString filename = getSegmentFilename(m_directory, m_nextSequence);
+  m_fd = ::open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (m_fd < 0)
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot create MPPS log segment " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return MPPS_EC_SegmentIOError;
+  }
+  m_activeSegment = m_nextSequence;
+  m_segmentSize = 0;
+  DCMNET_DEBUG("started MPPS log segment " << filename);
+  return EC_Normal;
+}
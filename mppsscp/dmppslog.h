@@ -0,0 +1,336 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Append-only log of MPPS records, stored in segment files
+ *
+ */
+
+#ifndef DMPPSLOG_H
+#define DMPPSLOG_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofvector.h"
+#include "dcmtk/ofstd/ofthread.h"
+#include "dmppscond.h"              /* for MPPS_EC_* conditions */
+
+/// magic number at the start of each record ("MPEV" in little endian byte order)
+#define MPPS_LOG_RECORD_MAGIC 0x5645504dUL
+
+/// size of the fixed part of each record in bytes
+#define MPPS_LOG_HEADER_SIZE 32
+
+/// default maximum size of a segment file in bytes
+#define MPPS_LOG_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+
+/// filename extension of segment files
+#define MPPS_LOG_SEGMENT_EXTENSION ".mpps"
+
+/** Types of records stored in the log
+ */
+enum DcmMppsRecordType
+{
+  /// N-CREATE, the payload is the N-CREATE attribute list
+  MPPS_RT_Create = 1,
+  /// N-SET, the payload is the N-SET modification list
+  MPPS_RT_Set = 2
+};
+
+/** A single record of the log. The record is stored as a header of
+ *  MPPS_LOG_HEADER_SIZE bytes (all numbers in little endian byte order):
+ *  magic (4), total record length (4), sequence number (8), timestamp in
+ *  microseconds since the epoch (8), record type (2), length of the SOP instance UID
+ *  (2) and length of the payload (4); followed by the SOP instance UID and the
+ *  payload. The same format is used for the segment files and for the event stream
+ *  sent to consumers.
+ *  When read from a segment, the pointers refer to memory owned by the reader and are
+ *  only valid until the next record is read.
+ */
+struct DcmMppsRecord
+{
+  DcmMppsRecord()
+    : sequence(0)
+    , timestamp(0)
+    , type(0)
+    , sopInstanceUID()
+    , payload(NULL)
+    , payloadLength(0)
+    , raw(NULL)
+    , rawLength(0)
+  {
+  }
+
+  /// sequence number, strictly increasing over all segments
+  Uint64 sequence;
+  /// time the record was appended (microseconds since the epoch)
+  Uint64 timestamp;
+  /// record type, see DcmMppsRecordType
+  Uint16 type;
+  /// SOP instance UID the record refers to
+  OFString sopInstanceUID;
+  /// payload, i.e. an attribute list in explicit VR little endian
+  const Uint8 *payload;
+  /// length of the payload in bytes
+  Uint32 payloadLength;
+  /// the complete encoded record (header, UID and payload)
+  const Uint8 *raw;
+  /// length of the complete encoded record in bytes
+  Uint32 rawLength;
+};
+
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Sequential reader for a single segment file of the log. The reader never blocks
+ *  on a segment that is still being written: an incomplete record at the end of the
+ *  file is reported as MPPS_EC_EndOfSegment and read again by the next call once the
+ *  writer has finished it.
+ */
+class DcmMppsSegmentReader
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmMppsSegmentReader();
+
+    /** destructor
+     */
+    ~DcmMppsSegmentReader();
+
+    /** Open a segment file for reading
+     *  @param filename [in] Name of the segment file
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition open(const OFString &filename);
+
+    /** Close the segment file
+     */
+    void close();
+
+    /** Read the next record
+     *  @param record [out] The record read
+     *  @return EC_Normal if a record was read, MPPS_EC_EndOfSegment if no complete
+     *          record is available (yet), another error code otherwise
+     */
+    OFCondition readRecord(DcmMppsRecord &record);
+
+    /** Returns the offset of the next record to be read, i.e. the number of bytes of
+     *  the segment file consumed by complete records so far
+     *  @return The offset in bytes
+     */
+    Uint64 getOffset() const;
+
+    /** Returns whether a segment file is open
+     *  @return OFTrue if open, OFFalse otherwise
+     */
+    OFBool isOpen() const;
+
+  private:
+
+    /** Make sure that the buffer holds at least the given number of bytes
+     *  @param length [in] Number of bytes required
+     */
+    void reserve(const Uint32 length);
+
+    /// file descriptor of the segment file, -1 if not open
+    int m_fd;
+
+    /// offset of the next record within the segment file
+    Uint64 m_offset;
+
+    /// buffer for the record read last
+    Uint8 *m_buffer;
+
+    /// size of the buffer in bytes
+    Uint32 m_capacity;
+
+    // private undefined copy constructor
+    DcmMppsSegmentReader(const DcmMppsSegmentReader &);
+
+    // private undefined assignment operator
+    DcmMppsSegmentReader &operator=(const DcmMppsSegmentReader &);
+
+};
+
+
+/** Append-only log of MPPS records. Records are appended to the active segment file
+ *  of a directory; a new segment is started when the active one exceeds the maximum
+ *  segment size. Segment files are named after the sequence number of their first
+ *  record, so the segment holding a given sequence number can be found from the
+ *  directory listing alone. On open, the last segment is scanned and an incomplete
+ *  record left behind by a crash is cut off.
+ *  Appending is thread-safe; readers use DcmMppsSegmentReader on the segment files.
+ */
+class DcmMppsSegmentLog
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmMppsSegmentLog();
+
+    /** destructor. Closes the log.
+     */
+    ~DcmMppsSegmentLog();
+
+    /** Set the maximum size of a segment file
+     *  @param size [in] Maximum size in bytes
+     */
+    void setMaxSegmentSize(const Uint32 size);
+
+    /** Set whether each record should be flushed to disk (fdatasync) after appending
+     *  @param mode [in] OFTrue to sync every record, OFFalse to leave it to the OS
+     */
+    void setSyncMode(const OFBool mode);
+
+    /** Open the log in the given directory, recovering the sequence number from the
+     *  existing segments (if any). The directory must exist.
+     *  @param directory [in] Directory holding the segment files
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition open(const OFString &directory);
+
+    /** Close the log
+     */
+    void close();
+
+    /** Append a record
+     *  @param type           [in]  Record type, see DcmMppsRecordType
+     *  @param sopInstanceUID [in]  SOP instance UID the record refers to
+     *  @param payload        [in]  Payload to be stored (may be NULL if length is 0)
+     *  @param payloadLength  [in]  Length of the payload in bytes
+     *  @param sequence       [out] Sequence number assigned to the record
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition append(const Uint16 type,
+                       const OFString &sopInstanceUID,
+                       const Uint8 *payload,
+                       const Uint32 payloadLength,
+                       Uint64 &sequence);
+
+    /** Returns whether the log is open
+     *  @return OFTrue if open, OFFalse otherwise
+     */
+    OFBool isOpen() const;
+
+    /** Returns the directory of the log
+     *  @return The directory
+     */
+    const OFString &getDirectory() const;
+
+    /** Returns the sequence number the next record will get
+     *  @return The next sequence number
+     */
+    Uint64 getNextSequence();
+
+    /** Returns the sequence number of the first record of the active segment. The
+     *  active segment is the only segment still being written to.
+     *  @return The first sequence number of the active segment
+     */
+    Uint64 getActiveSegment();
+
+    /** Encode a record header
+     *  @param buffer         [out] Buffer of at least MPPS_LOG_HEADER_SIZE bytes
+     *  @param sequence       [in]  Sequence number
+     *  @param timestamp      [in]  Timestamp (microseconds since the epoch)
+     *  @param type           [in]  Record type
+     *  @param uidLength      [in]  Length of the SOP instance UID
+     *  @param payloadLength  [in]  Length of the payload
+     */
+    static void encodeHeader(Uint8 *buffer,
+                             const Uint64 sequence,
+                             const Uint64 timestamp,
+                             const Uint16 type,
+                             const Uint16 uidLength,
+                             const Uint32 payloadLength);
+
+    /** Decode a complete record (header, UID and payload) from memory
+     *  @param buffer [in]  The encoded record
+     *  @param length [in]  Number of bytes available in the buffer
+     *  @param record [out] The decoded record, pointing into the buffer
+     *  @return EC_Normal if successful, MPPS_EC_EndOfSegment if the buffer does not hold
+     *          a complete record, MPPS_EC_CorruptRecord if it is not a valid record
+     */
+    static OFCondition decodeRecord(const Uint8 *buffer,
+                                    const Uint32 length,
+                                    DcmMppsRecord &record);
+
+    /** Returns the current time in microseconds since the epoch
+     *  @return The current time
+     */
+    static Uint64 getTimestamp();
+
+    /** Returns the file name of a segment
+     *  @param directory     [in] Directory holding the segment files
+     *  @param firstSequence [in] Sequence number of the first record in the segment
+     *  @return The file name
+     */
+    static OFString getSegmentFilename(const OFString &directory,
+                                       const Uint64 firstSequence);
+
+    /** List the segments of a directory
+     *  @param directory [in]  Directory holding the segment files
+     *  @param segments  [out] First sequence numbers of the segments, sorted ascending
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    static OFCondition listSegments(const OFString &directory,
+                                    OFVector<Uint64> &segments);
+
+  private:
+
+    /** Scan the given segment, cut off an incomplete record at its end and determine
+     *  the next sequence number
+     *  @param firstSequence [in] Sequence number of the first record of the segment
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition recover(const Uint64 firstSequence);
+
+    /** Start a new active segment with the next sequence number
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition startSegment();
+
+    /// directory holding the segment files
+    OFString m_directory;
+
+    /// file descriptor of the active segment, -1 if not open
+    int m_fd;
+
+    /// sequence number of the first record of the active segment
+    Uint64 m_activeSegment;
+
+    /// current size of the active segment in bytes
+    Uint64 m_segmentSize;
+
+    /// sequence number the next record will get
+    Uint64 m_nextSequence;
+
+    /// maximum size of a segment in bytes
+    Uint32 m_maxSegmentSize;
+
+    /// sync every record to disk
+    OFBool m_syncMode;
+
+    /// buffer used for encoding records
+    OFVector<Uint8> m_buffer;
+
+    /// mutex protecting the active segment and the sequence number
+    OFMutex m_mutex;
+
+    // private undefined copy constructor
+    DcmMppsSegmentLog(const DcmMppsSegmentLog &);
+
+    // private undefined assignment operator
+    DcmMppsSegmentLog &operator=(const DcmMppsSegmentLog &);
+
+};
+
+#endif // DMPPSLOG_H
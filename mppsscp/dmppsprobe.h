@@ -0,0 +1,58 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Static tracepoints (USDT probes) for bpftrace, perf and SystemTap
+ *
+ */
+
+#ifndef DMPPSPROBE_H
+#define DMPPSPROBE_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+/* The probes are compiled in if <sys/sdt.h> is available (package systemtap-sdt-dev
+ * or systemtap-sdt-devel), unless MPPS_DISABLE_PROBES is defined. Define
+ * HAVE_SYS_SDT_H if the compiler cannot check for the header itself. A probe is a
+ * single nop instruction until a tracer attaches to it; its arguments are still
+ * evaluated, so they should be values at hand.
+ *
+ * Probes of provider "mppsscp" (list them with "bpftrace -l 'usdt:<path>/mppsrecv:*'"):
+ *   association__accept(peer, calling AE title, called AE title)
+ *   association__refuse(reason)
+ *   association__ack(calling AE title, number of accepted presentation contexts)
+ *   association__release(reason: "release", "abort" or "error")
+ *   command__receive(command field, message ID, presentation context ID)
+ *   dataset__receive(presentation context ID, 1 if successful)
+ *   response__sent(command field, message ID responded to, status, 1 if successful)
+ */
+
+#ifndef MPPS_DISABLE_PROBES
+#if defined(HAVE_SYS_SDT_H)
+#define MPPS_PROBES_ENABLED 1
+#elif defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define MPPS_PROBES_ENABLED 1
+#endif
+#endif
+#endif
+
+#ifdef MPPS_PROBES_ENABLED
+
+#include <sys/sdt.h>
+
+#define MPPS_PROBE1(name, a1) DTRACE_PROBE1(mppsscp, name, a1)
+#define MPPS_PROBE2(name, a1, a2) DTRACE_PROBE2(mppsscp, name, a1, a2)
+#define MPPS_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(mppsscp, name, a1, a2, a3)
+#define MPPS_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(mppsscp, name, a1, a2, a3, a4)
+
+#else
+
+#define MPPS_PROBE1(name, a1) do { } while (0)
+#define MPPS_PROBE2(name, a1, a2) do { } while (0)
+#define MPPS_PROBE3(name, a1, a2, a3) do { } while (0)
+#define MPPS_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+
+#endif
+
+#endif // DMPPSPROBE_H
@@ -0,0 +1,323 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Ring buffer of binary records of the DIMSE requests handled
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dmppsring.h"
+#include "dmppscond.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// offsets of the fields of the file header
+#define MPPS_RING_OFFSET_MAGIC 0
+#define MPPS_RING_OFFSET_VERSION 4
+#define MPPS_RING_OFFSET_RECORD_SIZE 6
+#define MPPS_RING_OFFSET_CAPACITY 8
+#define MPPS_RING_OFFSET_NEXT_SEQUENCE 16
+
+// offsets of the fields of a record
+#define MPPS_RING_OFFSET_SEQUENCE 0
+#define MPPS_RING_OFFSET_TIMESTAMP 8
+#define MPPS_RING_OFFSET_DURATION 16
+#define MPPS_RING_OFFSET_COMMAND 20
+#define MPPS_RING_OFFSET_STATUS 22
+#define MPPS_RING_OFFSET_MESSAGE_ID 24
+#define MPPS_RING_OFFSET_PRESENTATION_CONTEXT 26
+#define MPPS_RING_OFFSET_DATASET_LENGTH 28
+#define MPPS_RING_OFFSET_STREAM_SEQUENCE 32
+#define MPPS_RING_OFFSET_CALLING_AE 40
+#define MPPS_RING_OFFSET_CALLED_AE 56
+#define MPPS_RING_OFFSET_SOP_CLASS 72
+#define MPPS_RING_OFFSET_SOP_INSTANCE 136
+#define MPPS_RING_OFFSET_PEER 200
+
+// lengths of the string fields of a record (without terminating zero)
+#define MPPS_RING_AE_LENGTH 16
+#define MPPS_RING_UID_LENGTH 64
+#define MPPS_RING_PEER_LENGTH 48
+
+
+// helper functions for little endian encoding
+
+static void putUint16(Uint8 *buffer, const Uint16 value)
+{
+  buffer[0] = OFstatic_cast(Uint8, value);
+  buffer[1] = OFstatic_cast(Uint8, value >> 8);
+}
+
+static void putUint32(Uint8 *buffer, const Uint32 value)
+{
+  for (int i = 0; i < 4; ++i)
+    buffer[i] = OFstatic_cast(Uint8, value >> (8 * i));
+}
+
+static void putUint64(Uint8 *buffer, const Uint64 value)
+{
+  for (int i = 0; i < 8; ++i)
+    buffer[i] = OFstatic_cast(Uint8, value >> (8 * i));
+}
+
+static Uint16 getUint16(const Uint8 *buffer)
+{
+  return OFstatic_cast(Uint16, buffer[0] | (buffer[1] << 8));
+}
+
+static Uint32 getUint32(const Uint8 *buffer)
+{
+  Uint32 value = 0;
+  for (int i = 3; i >= 0; --i)
+    value = (value << 8) | buffer[i];
+  return value;
+}
+
+static Uint64 getUint64(const Uint8 *buffer)
+{
+  Uint64 value = 0;
+  for (int i = 7; i >= 0; --i)
+    value = (value << 8) | buffer[i];
+  return value;
+}
+
+// copy a string into a fixed length field, padded with zeros
+static void putString(Uint8 *buffer, const char *value, const size_t length)
+{
+  size_t i = 0;
+  for (; (i < length) && (value[i] != '\0'); ++i)
+    buffer[i] = OFstatic_cast(Uint8, value[i]);
+  memset(buffer + i, 0, length - i);
+}
+
+// copy a fixed length field into a zero terminated string
+static void getString(const Uint8 *buffer, char *value, const size_t length)
+{
+  memcpy(value, buffer, length);
+  value[length] = '\0';
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMppsEventRecord::DcmMppsEventRecord()
+  : sequence(0)
+  , timestamp(0)
+  , duration(0)
+  , commandField(0)
+  , status(0)
+  , messageID(0)
+  , presentationContextID(0)
+  , datasetLength(0)
+  , streamSequence(0)
+{
+  callingAETitle[0] = '\0';
+  calledAETitle[0] = '\0';
+  sopClassUID[0] = '\0';
+  sopInstanceUID[0] = '\0';
+  peerAddress[0] = '\0';
+}
+
+// ----------------------------------------------------------------------------
+
+DcmMppsEventRing::DcmMppsEventRing()
+  : m_map(NULL)
+  , m_mapSize(0)
+  , m_capacity(0)
+  , m_nextSequence(1)
+{
+}
+
+
+DcmMppsEventRing::~DcmMppsEventRing()
+{
+  close();
+}
+
+
+OFCondition DcmMppsEventRing::open(const OFString &filename,
+                                   const Uint32 capacity)
+{
+  close();
+  if (capacity == 0)
+    return EC_IllegalParameter;
+  const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot open event ring " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return MPPS_EC_InvalidEventRing;
+  }
+  const size_t size = MPPS_RING_HEADER_SIZE + OFstatic_cast(size_t, capacity) * MPPS_RING_RECORD_SIZE;
+  struct stat info;
+  const OFBool existing = (fstat(fd, &info) == 0) && (OFstatic_cast(size_t, info.st_size) == size);
+  if (!existing && (ftruncate(fd, 0) != 0 || ftruncate(fd, OFstatic_cast(off_t, size)) != 0))
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot resize event ring " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    ::close(fd);
+    return MPPS_EC_InvalidEventRing;
+  }
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED)
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot map event ring " << filename << ": " << OFStandard::strerror(errno, buf, sizeof(buf)));
+    return MPPS_EC_InvalidEventRing;
+  }
+  m_map = OFstatic_cast(Uint8 *, map);
+  m_mapSize = size;
+  m_capacity = capacity;
+
+  // continue an existing ring of the same layout, otherwise start a new one
+  if (existing && (getUint32(m_map + MPPS_RING_OFFSET_MAGIC) == MPPS_RING_MAGIC) &&
+      (getUint16(m_map + MPPS_RING_OFFSET_VERSION) == MPPS_RING_VERSION) &&
+      (getUint16(m_map + MPPS_RING_OFFSET_RECORD_SIZE) == MPPS_RING_RECORD_SIZE) &&
+      (getUint32(m_map + MPPS_RING_OFFSET_CAPACITY) == capacity))
+  {
+    m_nextSequence = getUint64(m_map + MPPS_RING_OFFSET_NEXT_SEQUENCE);
+    if (m_nextSequence == 0)
+      m_nextSequence = 1;
+    DCMNET_DEBUG("continuing event ring " << filename << " at record " << m_nextSequence);
+  }
+  else
+  {
+    memset(m_map, 0, size);
+    putUint32(m_map + MPPS_RING_OFFSET_MAGIC, MPPS_RING_MAGIC);
+    putUint16(m_map + MPPS_RING_OFFSET_VERSION, MPPS_RING_VERSION);
+    putUint16(m_map + MPPS_RING_OFFSET_RECORD_SIZE, MPPS_RING_RECORD_SIZE);
+    putUint32(m_map + MPPS_RING_OFFSET_CAPACITY, capacity);
+    m_nextSequence = 1;
+    putUint64(m_map + MPPS_RING_OFFSET_NEXT_SEQUENCE, m_nextSequence);
+    DCMNET_DEBUG("created event ring " << filename << " for " << capacity << " records");
+  }
+  return EC_Normal;
+}
+
+
+void DcmMppsEventRing::close()
+{
+  if (m_map != NULL)
+  {
+    munmap(m_map, m_mapSize);
+    m_map = NULL;
+    m_mapSize = 0;
+  }
+}
+
+
+OFBool DcmMppsEventRing::isOpen() const
+{
+  return m_map != NULL;
+}
+
+
+void DcmMppsEventRing::append(const DcmMppsEventRecord &record)
+{
+  if (m_map == NULL)
+    return;
+  Uint8 *slot = m_map + MPPS_RING_HEADER_SIZE +
+    OFstatic_cast(size_t, (m_nextSequence - 1) % m_capacity) * MPPS_RING_RECORD_SIZE;
+  // invalidate the slot while it is being written, a reader skips it
+  putUint64(slot + MPPS_RING_OFFSET_SEQUENCE, 0);
+  encodeRecord(slot, record);
+  putUint64(slot + MPPS_RING_OFFSET_SEQUENCE, m_nextSequence);
+  ++m_nextSequence;
+  putUint64(m_map + MPPS_RING_OFFSET_NEXT_SEQUENCE, m_nextSequence);
+}
+
+
+OFCondition DcmMppsEventRing::readFile(const OFString &filename,
+                                       OFVector<DcmMppsEventRecord> &records)
+{
+  records.clear();
+  FILE *file = fopen(filename.c_str(), "rb");
+  if (file == NULL)
+    return MPPS_EC_InvalidEventRing;
+  Uint8 header[MPPS_RING_HEADER_SIZE];
+  if ((fread(header, 1, MPPS_RING_HEADER_SIZE, file) != MPPS_RING_HEADER_SIZE) ||
+      (getUint32(header + MPPS_RING_OFFSET_MAGIC) != MPPS_RING_MAGIC) ||
+      (getUint16(header + MPPS_RING_OFFSET_VERSION) != MPPS_RING_VERSION) ||
+      (getUint16(header + MPPS_RING_OFFSET_RECORD_SIZE) != MPPS_RING_RECORD_SIZE))
+  {
+    fclose(file);
+    return MPPS_EC_InvalidEventRing;
+  }
+  const Uint32 capacity = getUint32(header + MPPS_RING_OFFSET_CAPACITY);
+  const Uint64 nextSequence = getUint64(header + MPPS_RING_OFFSET_NEXT_SEQUENCE);
+
+  // the oldest record is in the slot the next one will be written to
+  const Uint64 first = (nextSequence > capacity) ? nextSequence - capacity : 1;
+  OFVector<Uint8> slots(OFstatic_cast(size_t, capacity) * MPPS_RING_RECORD_SIZE);
+  const size_t count = fread(&slots[0], MPPS_RING_RECORD_SIZE, capacity, file);
+  fclose(file);
+  for (Uint64 sequence = first; sequence < nextSequence; ++sequence)
+  {
+    const size_t index = OFstatic_cast(size_t, (sequence - 1) % capacity);
+    if (index >= count)
+      continue;
+    DcmMppsEventRecord record;
+    decodeRecord(&slots[index * MPPS_RING_RECORD_SIZE], record);
+    // skip slots being overwritten while reading
+    if (record.sequence == sequence)
+      records.push_back(record);
+  }
+  return EC_Normal;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsEventRing::encodeRecord(Uint8 *buffer,
+                                    const DcmMppsEventRecord &record)
+{
+  putUint64(buffer + MPPS_RING_OFFSET_TIMESTAMP, record.timestamp);
+  putUint32(buffer + MPPS_RING_OFFSET_DURATION, record.duration);
+  putUint16(buffer + MPPS_RING_OFFSET_COMMAND, record.commandField);
+  putUint16(buffer + MPPS_RING_OFFSET_STATUS, record.status);
+  putUint16(buffer + MPPS_RING_OFFSET_MESSAGE_ID, record.messageID);
+  buffer[MPPS_RING_OFFSET_PRESENTATION_CONTEXT] = record.presentationContextID;
+  buffer[MPPS_RING_OFFSET_PRESENTATION_CONTEXT + 1] = 0;
+  putUint32(buffer + MPPS_RING_OFFSET_DATASET_LENGTH, record.datasetLength);
+  putUint64(buffer + MPPS_RING_OFFSET_STREAM_SEQUENCE, record.streamSequence);
+  putString(buffer + MPPS_RING_OFFSET_CALLING_AE, record.callingAETitle, MPPS_RING_AE_LENGTH);
+  putString(buffer + MPPS_RING_OFFSET_CALLED_AE, record.calledAETitle, MPPS_RING_AE_LENGTH);
+  putString(buffer + MPPS_RING_OFFSET_SOP_CLASS, record.sopClassUID, MPPS_RING_UID_LENGTH);
+  putString(buffer + MPPS_RING_OFFSET_SOP_INSTANCE, record.sopInstanceUID, MPPS_RING_UID_LENGTH);
+  putString(buffer + MPPS_RING_OFFSET_PEER, record.peerAddress, MPPS_RING_PEER_LENGTH);
+}
+
+
+void DcmMppsEventRing::decodeRecord(const Uint8 *buffer,
+                                    DcmMppsEventRecord &record)
+{
+  record.sequence = getUint64(buffer + MPPS_RING_OFFSET_SEQUENCE);
+  record.timestamp = getUint64(buffer + MPPS_RING_OFFSET_TIMESTAMP);
+  record.duration = getUint32(buffer + MPPS_RING_OFFSET_DURATION);
+  record.commandField = getUint16(buffer + MPPS_RING_OFFSET_COMMAND);
+  record.status = getUint16(buffer + MPPS_RING_OFFSET_STATUS);
+  record.messageID = getUint16(buffer + MPPS_RING_OFFSET_MESSAGE_ID);
+  record.presentationContextID = buffer[MPPS_RING_OFFSET_PRESENTATION_CONTEXT];
+  record.datasetLength = getUint32(buffer + MPPS_RING_OFFSET_DATASET_LENGTH);
+  record.streamSequence = getUint64(buffer + MPPS_RING_OFFSET_STREAM_SEQUENCE);
+  getString(buffer + MPPS_RING_OFFSET_CALLING_AE, record.callingAETitle, MPPS_RING_AE_LENGTH);
+  getString(buffer + MPPS_RING_OFFSET_CALLED_AE, record.calledAETitle, MPPS_RING_AE_LENGTH);
+  getString(buffer + MPPS_RING_OFFSET_SOP_CLASS, record.sopClassUID, MPPS_RING_UID_LENGTH);
+  getString(buffer + MPPS_RING_OFFSET_SOP_INSTANCE, record.sopInstanceUID, MPPS_RING_UID_LENGTH);
+  getString(buffer + MPPS_RING_OFFSET_PEER, record.peerAddress, MPPS_RING_PEER_LENGTH);
+}
@@ -0,0 +1,165 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Ring buffer of binary records of the DIMSE requests handled
+ *
+ */
+
+#ifndef DMPPSRING_H
+#define DMPPSRING_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofvector.h"
+
+/// magic number at the start of a ring file ("MPRG" in little endian byte order)
+#define MPPS_RING_MAGIC 0x4752504dUL
+
+/// version of the ring file format
+#define MPPS_RING_VERSION 1
+
+/// size of the header of a ring file in bytes
+#define MPPS_RING_HEADER_SIZE 64
+
+/// size of each record in bytes
+#define MPPS_RING_RECORD_SIZE 256
+
+/// default number of records kept in the ring
+#define MPPS_RING_DEFAULT_CAPACITY 65536
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Binary record of a DIMSE request handled by the SCP. All strings are stored with
+ *  fixed length, so a record is encoded without any formatting.
+ */
+struct DcmMppsEventRecord
+{
+  /** default constructor, clears all fields
+   */
+  DcmMppsEventRecord();
+
+  /// sequence number in the ring, starting with 1
+  Uint64 sequence;
+  /// time the request was received (microseconds since the epoch)
+  Uint64 timestamp;
+  /// time from receiving the request to sending the response in microseconds
+  Uint32 duration;
+  /// command field of the request (e.g.\ DIMSE_N_CREATE_RQ)
+  Uint16 commandField;
+  /// status sent in the response
+  Uint16 status;
+  /// message ID of the request
+  Uint16 messageID;
+  /// presentation context ID of the request
+  Uint8 presentationContextID;
+  /// length of the dataset as stored in the event stream in bytes, 0 if not stored
+  Uint32 datasetLength;
+  /// sequence number of the event in the event stream holding the dataset, 0 if none
+  Uint64 streamSequence;
+  /// calling AE title of the association
+  char callingAETitle[17];
+  /// called AE title of the association
+  char calledAETitle[17];
+  /// affected or requested SOP class UID
+  char sopClassUID[65];
+  /// affected or requested SOP instance UID
+  char sopInstanceUID[65];
+  /// numeric address of the peer
+  char peerAddress[49];
+};
+
+
+/** Ring buffer of DcmMppsEventRecord in a memory mapped file. Recording a request
+ *  costs a copy of a few hundred bytes without any system call or text formatting;
+ *  the oldest records are overwritten once the ring is full. Since the file is
+ *  mapped shared, the records survive a crash of the SCP and can be read at any time
+ *  by the mppsdump tool, which renders them (and, from the event stream, the complete
+ *  datasets) as text. All numbers are stored in little endian byte order.
+ */
+class DcmMppsEventRing
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmMppsEventRing();
+
+    /** destructor
+     */
+    ~DcmMppsEventRing();
+
+    /** Open (or create) a ring file. An existing file with the same capacity is
+     *  continued, otherwise it is reinitialized.
+     *  @param filename [in] Name of the ring file
+     *  @param capacity [in] Number of records kept
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition open(const OFString &filename,
+                     const Uint32 capacity);
+
+    /** Close the ring file
+     */
+    void close();
+
+    /** Returns whether the ring is open
+     *  @return OFTrue if open, OFFalse otherwise
+     */
+    OFBool isOpen() const;
+
+    /** Add a record, overwriting the oldest one if the ring is full. The sequence
+     *  number of the record is assigned by the ring.
+     *  @param record [in] The record
+     */
+    void append(const DcmMppsEventRecord &record);
+
+    /** Read all records of a ring file, e.g.\ of a running or crashed SCP
+     *  @param filename [in]  Name of the ring file
+     *  @param records  [out] The records, sorted by sequence number
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    static OFCondition readFile(const OFString &filename,
+                                OFVector<DcmMppsEventRecord> &records);
+
+  private:
+
+    /** Encode a record
+     *  @param buffer [out] Buffer of MPPS_RING_RECORD_SIZE bytes
+     *  @param record [in]  The record
+     */
+    static void encodeRecord(Uint8 *buffer,
+                             const DcmMppsEventRecord &record);
+
+    /** Decode a record
+     *  @param buffer [in]  Buffer of MPPS_RING_RECORD_SIZE bytes
+     *  @param record [out] The record
+     */
+    static void decodeRecord(const Uint8 *buffer,
+                             DcmMppsEventRecord &record);
+
+    /// the mapped file, NULL if not open
+    Uint8 *m_map;
+
+    /// size of the mapped file in bytes
+    size_t m_mapSize;
+
+    /// number of records kept
+    Uint32 m_capacity;
+
+    /// sequence number the next record will get
+    Uint64 m_nextSequence;
+
+    // private undefined copy constructor
+    DcmMppsEventRing(const DcmMppsEventRing &);
+
+    // private undefined assignment operator
+    DcmMppsEventRing &operator=(const DcmMppsEventRing &);
+
+};
+
+#endif // DMPPSRING_H
@@ -23,14 +23,119 @@
 #include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
 
 #include "dmppsscp.h"
+#include "dscpcond.h"
 #include "dcmtk/dcmnet/diutil.h"
+#include "dmppsprobe.h"
+
+// minimum interval in seconds between two summaries of C-ECHO requests answered
+// by the fast path
+#define MPPS_ECHO_REPORT_INTERVAL 60
+
+// log a message of the association level, at debug level for associations of
+// health checks (see isEchoOnlyRequest())
+#define MPPS_ASSOCIATION_INFO(msg) do { if (m_echoOnly) DCMNET_DEBUG(msg); else DCMNET_INFO(msg); } while (0)
+
+// get the message ID of a request, or the message ID responded to and the status
+// of a response, for the probes and the flight recorder; returns OFTrue for a response
+static OFBool getMessageInfo(const T_DIMSE_Message &message,
+                             Uint16 &messageID,
+                             Uint16 &status)
+{
+  messageID = 0;
+  status = 0;
+  switch (message.CommandField)
+  {
+    case DIMSE_C_ECHO_RQ:
+      messageID = message.msg.CEchoRQ.MessageID;
+      return OFFalse;
+    case DIMSE_N_CREATE_RQ:
+      messageID = message.msg.NCreateRQ.MessageID;
+      return OFFalse;
+    case DIMSE_N_SET_RQ:
+      messageID = message.msg.NSetRQ.MessageID;
+      return OFFalse;
+    case DIMSE_N_GET_RQ:
+      messageID = message.msg.NGetRQ.MessageID;
+      return OFFalse;
+    case DIMSE_C_ECHO_RSP:
+      messageID = message.msg.CEchoRSP.MessageIDBeingRespondedTo;
+      status = message.msg.CEchoRSP.DimseStatus;
+      return OFTrue;
+    case DIMSE_N_CREATE_RSP:
+      messageID = message.msg.NCreateRSP.MessageIDBeingRespondedTo;
+      status = message.msg.NCreateRSP.DimseStatus;
+      return OFTrue;
+    case DIMSE_N_SET_RSP:
+      messageID = message.msg.NSetRSP.MessageIDBeingRespondedTo;
+      status = message.msg.NSetRSP.DimseStatus;
+      return OFTrue;
+    case DIMSE_N_GET_RSP:
+      messageID = message.msg.NGetRSP.MessageIDBeingRespondedTo;
+      status = message.msg.NGetRSP.DimseStatus;
+      return OFTrue;
+    default:
+      return OFFalse;
+  }
+}
+
+// check whether an association request only proposes the Verification SOP class,
+// as health checks do
+static OFBool isEchoOnlyRequest(T_ASC_Parameters &params)
+{
+  T_ASC_PresentationContext pc;
+  const int count = ASC_countPresentationContexts(&params);
+  for (int i = 0; i < count; ++i)
+  {
+    if (ASC_getPresentationContext(&params, i, &pc).bad() || (strcmp(pc.abstractSyntax, UID_VerificationSOPClass) != 0))
+      return OFFalse;
+  }
+  return (count > 0);
+}
 
 // implementation of the main interface class
 
 DcmMppsSCP::DcmMppsSCP():
   m_assoc(NULL),
-  m_cfg()
+  m_cfg(),
+  m_commandPresContext(),
+  m_instanceStore(),
+  m_eventStream(),
+  m_eventRing(),
+  m_eventRingFile(),
+  m_eventRingCapacity(MPPS_RING_DEFAULT_CAPACITY),
+  m_responseEncoder(),
+  m_transportLayer(),
+  m_socketOptions(),
+  m_negotiationCache(),
+  m_accessPolicy(),
+  m_hostLookup(OFTrue),
+  m_hostNameResolver(NULL),
+  m_metrics(),
+  m_metricsServer(NULL),
+  m_metricsPort(0),
+  m_metricsSocket(),
+  m_associationStart(0),
+  m_datasetReceiveTime(0),
+  m_responseSendTime(0),
+  m_trace(),
+  m_traceCommand(SCP_TRACE_NO_SPAN),
+  m_traceHandlerStart(0),
+  m_flightRecorder(),
+  m_flightRecorderFile(),
+  m_flightRecorderCapacity(SCP_FLIGHT_DEFAULT_CAPACITY),
+  m_capture(),
+  m_captureFile(),
+  m_receivedMessages(0),
+  m_messageReadCalls(0),
+  m_fastEcho(OFTrue),
+  m_echoRequests(0),
+  m_echoRequestsReported(0),
+  m_echoReportTime(0),
+  m_echoCounter(NULL),
+  m_echoOnly(OFFalse)
 {
+    clearPresentationContextTable();
+    m_echoSOPClassUID[0] = '\0';
     // make sure that the SCP at least supports C-ECHO with default transfer syntax
     OFList<OFString> transferSyntaxes;
     transferSyntaxes.push_back(UID_LittleEndianExplicitTransferSyntax);
@@ -40,6 +145,15 @@ DcmMppsSCP::DcmMppsSCP():
     // add MPPS (N-CREATE,N-SET) support
     addPresentationContext(UID_ModalityPerformedProcedureStepSOPClass, transferSyntaxes);
 
+    m_metrics.describe("mpps_associations_total", "Association requests by result");
+    m_metrics.describe("mpps_associations_closed_total", "Associations terminated by reason");
+    m_metrics.describe("mpps_association_setup_seconds", "Time from association request to acknowledgement");
+    m_metrics.describe("mpps_association_duration_seconds", "Time from association request to termination");
+    m_metrics.describe("mpps_requests_total", "DIMSE requests handled by command, SOP class and status");
+    m_metrics.describe("mpps_dataset_receive_seconds", "Time spent receiving the dataset of a request");
+    m_metrics.describe("mpps_handler_seconds", "Time spent handling a request, excluding network I/O");
+    m_metrics.describe("mpps_response_send_seconds", "Time spent sending the response to a request");
+    m_trace.setServiceName("mppsscp");
 }
 
 
@@ -50,7 +164,8 @@ DcmMppsSCP::~DcmMppsSCP()
   {
     dropAndDestroyAssociation();
   }
-
+  stopHostNameResolver();
+  stopMetricsServer();
 }
 
 // ----------------------------------------------------------------------------
@@ -84,6 +199,21 @@ OFCondition DcmMppsSCP::listen()
   if( cond.bad() )
     return cond;
 
+  // Read incoming PDUs through a buffer that holds a complete PDU, so that a small
+  // DIMSE message can be received with a single recv().
+  m_transportLayer.setBufferSize(m_cfg->getMaxReceivePDULength() + SCP_CONN_PDU_HEADER_SIZE);
+
+  // Apply the socket options to the listening socket and (through the transport
+  // layer) to the socket of each incoming association.
+  m_socketOptions.applyToListener(m_cfg->getPort());
+  m_transportLayer.setSocketOptions(m_socketOptions);
+  cond = ASC_setTransportLayer( network, &m_transportLayer, 0 /* do not take over ownership */ );
+  if( cond.bad() )
+  {
+    ASC_dropNetwork( &network );
+    return cond;
+  }
+
   // drop root privileges now and revert to the calling user id (if we are running as setuid root)
   cond = OFStandard::dropPrivileges();
   if (cond.bad())
@@ -92,6 +222,105 @@ OFCondition DcmMppsSCP::listen()
       return cond;
   }
 
+  // Open the event stream (if configured), so all accepted requests are recorded.
+  if (!m_eventStream.getDirectory().empty())
+  {
+    cond = m_eventStream.open();
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Cannot open MPPS event stream in " << m_eventStream.getDirectory() << ": " << cond.text());
+      ASC_dropNetwork( &network );
+      return cond;
+    }
+    // cold instances can be evicted from memory, they are restored from the stream
+    m_instanceStore.setHistory(&m_eventStream.getLog(), m_eventStream.getRetention());
+  }
+
+  // Open the event ring (if configured), so all handled requests are recorded.
+  if (!m_eventRingFile.empty())
+  {
+    cond = m_eventRing.open(m_eventRingFile, m_eventRingCapacity);
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Cannot open event ring " << m_eventRingFile << ": " << cond.text());
+      m_eventStream.close();
+      ASC_dropNetwork( &network );
+      return cond;
+    }
+  }
+
+  // Keep the last associations in memory (if configured), dumped on SIGUSR1 or a crash.
+  if (!m_flightRecorderFile.empty())
+  {
+    cond = m_flightRecorder.open(m_flightRecorderFile, m_flightRecorderCapacity);
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Cannot set up flight recorder " << m_flightRecorderFile << ": " << cond.text());
+      m_eventRing.close();
+      m_eventStream.close();
+      ASC_dropNetwork( &network );
+      return cond;
+    }
+  }
+
+  // Append the PDUs received on each association to the capture file (if configured).
+  if (!m_captureFile.empty())
+  {
+    cond = m_capture.open(m_captureFile, SCP_CAPTURE_MAGIC_MPPS);
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Cannot open capture file " << m_captureFile << ": " << cond.text());
+      m_flightRecorder.close();
+      m_eventRing.close();
+      m_eventStream.close();
+      ASC_dropNetwork( &network );
+      return cond;
+    }
+    m_transportLayer.setTrafficCapture(&m_capture);
+  }
+
+  // Serve the metrics (if configured) in the background.
+  if (((m_metricsPort > 0) || !m_metricsSocket.empty()) && (m_metricsServer == NULL))
+  {
+    m_metricsServer = new DcmMetricsServer(m_metrics);
+    if (m_metricsPort > 0)
+      cond = m_metricsServer->openPort(m_metricsPort);
+    else
+      cond = m_metricsServer->openSocket(m_metricsSocket);
+    if (cond.good() && (m_metricsServer->start() != 0))
+    {
+      DCMNET_ERROR("Cannot start metrics server");
+      cond = SCP_EC_MetricsError;
+    }
+    if (cond.bad())
+    {
+      delete m_metricsServer;
+      m_metricsServer = NULL;
+      m_transportLayer.setTrafficCapture(NULL);
+      m_capture.close();
+      m_flightRecorder.close();
+      m_eventRing.close();
+      m_eventStream.close();
+      ASC_dropNetwork( &network );
+      return cond;
+    }
+  }
+
+  // Never let DCMTK look up the host name of a peer while accepting its association,
+  // this may block for seconds if the DNS server is slow. Host names are resolved in
+  // the background instead.
+  m_cfg->setHostLookupEnabled(OFFalse);
+  if (m_hostLookup && (m_hostNameResolver == NULL))
+  {
+    m_hostNameResolver = new DcmHostNameResolver();
+    if (m_hostNameResolver->start() != 0)
+    {
+      DCMNET_WARN("Cannot start host name resolver, host names of peers are not looked up");
+      delete m_hostNameResolver;
+      m_hostNameResolver = NULL;
+    }
+  }
+
   // If we get to this point, the entire initialization process has been completed
   // successfully. Now, we want to start handling all incoming requests. Since
   // this activity is supposed to represent a server process, we do not want to
@@ -107,6 +336,13 @@ OFCondition DcmMppsSCP::listen()
   // is the counterpart of ASC_initializeNetwork(...) which was called above.
   cond = ASC_dropNetwork( &network );
   network = NULL;
+  stopHostNameResolver();
+  stopMetricsServer();
+  m_transportLayer.setTrafficCapture(NULL);
+  m_capture.close();
+  m_flightRecorder.close();
+  m_eventRing.close();
+  m_eventStream.close();
 
   // return ok
   return cond;
@@ -115,39 +351,115 @@ OFCondition DcmMppsSCP::listen()
 // ----------------------------------------------------------------------------
 
 void DcmMppsSCP::findPresentationContext(const T_ASC_PresentationContextID presID,
-                                     OFString &abstractSyntax,
-                                     OFString &transferSyntax)
+                                         OFString &abstractSyntax,
+                                         OFString &transferSyntax)
 {
-  transferSyntax.clear();
-  abstractSyntax.clear();
+  const char *abstractSyntaxUID;
+  const char *transferSyntaxUID;
+  if (findPresentationContext(presID, abstractSyntaxUID, transferSyntaxUID))
+  {
+    transferSyntax = transferSyntaxUID;
+    abstractSyntax = abstractSyntaxUID;
+  }
+  else
+  {
+    transferSyntax.clear();
+    abstractSyntax.clear();
+  }
+}
+
+
+OFBool DcmMppsSCP::findPresentationContext(const T_ASC_PresentationContextID presID,
+                                           const char *&abstractSyntax,
+                                           const char *&transferSyntax) const
+{
+  // the table only holds accepted presentation contexts
+  const PresentationContextEntry &entry = m_presContexts[presID];
+  abstractSyntax = entry.abstractSyntax;
+  transferSyntax = entry.acceptedTransferSyntax;
+  return (m_assoc != NULL) && (entry.presentationContextID != 0);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::buildPresentationContextTable()
+{
+  clearPresentationContextTable();
   if (m_assoc == NULL)
     return;
 
-  DUL_PRESENTATIONCONTEXT *pc;
-  LST_HEAD **l;
+  LST_HEAD **l = &m_assoc->params->DULparams.acceptedPresentationContext;
+  if (*l == NULL)
+    return;
+  DUL_PRESENTATIONCONTEXT *pc = (DUL_PRESENTATIONCONTEXT*) LST_Head(l);
+  (void)LST_Position(l, (LST_NODE*)pc);
+  while (pc)
+  {
+    if (pc->result == ASC_P_ACCEPTANCE)
+    {
+      PresentationContextEntry &entry = m_presContexts[pc->presentationContextID];
+      entry.presentationContextID = pc->presentationContextID;
+      entry.proposedSCRole = OFstatic_cast(Uint8, pc->proposedSCRole);
+      entry.acceptedSCRole = OFstatic_cast(Uint8, pc->acceptedSCRole);
+      entry.abstractSyntax = pc->abstractSyntax;
+      entry.acceptedTransferSyntax = pc->acceptedTransferSyntax;
+    }
+    pc = (DUL_PRESENTATIONCONTEXT*) LST_Next(l);
+  }
+}
 
-  /* we look for a presentation context matching
-   * both abstract and transfer syntax
-   */
-  l = &m_assoc->params->DULparams.acceptedPresentationContext;
-  pc = (DUL_PRESENTATIONCONTEXT*) LST_Head(l);
+
+void DcmMppsSCP::recordPresentationContexts()
+{
+  if (!m_flightRecorder.isOpen() || (m_assoc == NULL))
+    return;
+
+  LST_HEAD **l = &m_assoc->params->DULparams.acceptedPresentationContext;
+  if (*l == NULL)
+    return;
+  DUL_PRESENTATIONCONTEXT *pc = (DUL_PRESENTATIONCONTEXT*) LST_Head(l);
   (void)LST_Position(l, (LST_NODE*)pc);
   while (pc)
   {
-     if (presID == pc->presentationContextID)
-     {
-       if (pc->result == ASC_P_ACCEPTANCE)
-       {
-         // found a match
-         transferSyntax = pc->acceptedTransferSyntax;
-         abstractSyntax = pc->abstractSyntax;
-       }
-       break;
-     }
-     pc = (DUL_PRESENTATIONCONTEXT*) LST_Next(l);
+    m_flightRecorder.addContext(pc->presentationContextID, pc->result, pc->abstractSyntax,
+      (pc->result == ASC_P_ACCEPTANCE) ? pc->acceptedTransferSyntax : "");
+    pc = (DUL_PRESENTATIONCONTEXT*) LST_Next(l);
   }
 }
 
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::clearPresentationContextTable()
+{
+  memset(m_presContexts, 0, sizeof(m_presContexts));
+  // the next command copies the UIDs again
+  m_commandPresContext.presentationContextID = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+const DcmPresentationContextInfo &DcmMppsSCP::getCommandPresentationContext(const T_ASC_PresentationContextID presID)
+{
+  const PresentationContextEntry &entry = m_presContexts[presID];
+  if ((entry.presentationContextID == 0) || (m_commandPresContext.presentationContextID != presID))
+  {
+    m_commandPresContext.presentationContextID = entry.presentationContextID;
+    m_commandPresContext.proposedSCRole = entry.proposedSCRole;
+    m_commandPresContext.acceptedSCRole = entry.acceptedSCRole;
+    if (entry.presentationContextID != 0)
+    {
+      m_commandPresContext.abstractSyntax = entry.abstractSyntax;
+      m_commandPresContext.acceptedTransferSyntax = entry.acceptedTransferSyntax;
+    }
+    else
+    {
+      m_commandPresContext.abstractSyntax.clear();
+      m_commandPresContext.acceptedTransferSyntax.clear();
+    }
+  }
+  return m_commandPresContext;
+}
+
 DUL_PRESENTATIONCONTEXT* DcmMppsSCP::findPresentationContextID(LST_HEAD *head,
                                                            T_ASC_PresentationContextID presentationContextID)
 {
@@ -188,6 +500,15 @@ void DcmMppsSCP::refuseAssociation(const DcmRefuseReasonType reason)
     return;
   }
 
+  // count the refusal, the association is not measured any further
+  OFString labels = getPeerLabel();
+  DcmMetricsRegistry::addLabel(labels, "result", "refused");
+  m_metrics.increment("mpps_associations_total", labels);
+  m_associationStart = 0;
+  m_trace.setAttribute(0, "result", "refused");
+  m_flightRecorder.setOutcome("refused");
+  MPPS_PROBE1(association__refuse, OFstatic_cast(int, reason));
+
   T_ASC_RejectParameters rej;
 
   // dump some information if required
@@ -208,6 +529,9 @@ void DcmMppsSCP::refuseAssociation(const DcmRefuseReasonType reason)
     case DCMSCP_CALLING_AE_TITLE_NOT_RECOGNIZED:
       DCMNET_INFO("Refusing Association (calling AE title not recognized)");
       break;
+    case DCMSCP_CALLING_HOST_NOT_ALLOWED:
+      DCMNET_INFO("Refusing Association (calling host not allowed)");
+      break;
     case DCMSCP_FORCED:
       DCMNET_INFO("Refusing Association (forced via command line)");
       break;
@@ -245,6 +569,9 @@ void DcmMppsSCP::refuseAssociation(const DcmRefuseReasonType reason)
     case DCMSCP_CALLING_AE_TITLE_NOT_RECOGNIZED:
       DCMNET_INFO("Refusing Association (calling AE title not recognized)");
       break;
+    case DCMSCP_CALLING_HOST_NOT_ALLOWED:
+      DCMNET_INFO("Refusing Association (calling host not allowed)");
+      break;
     case DCMSCP_FORCED:
       DCMNET_INFO("Refusing Association (forced via command line)");
       break;
@@ -290,6 +617,7 @@ void DcmMppsSCP::refuseAssociation(const DcmRefuseReasonType reason)
       rej.source = ASC_SOURCE_SERVICEUSER;
       rej.reason = ASC_REASON_SU_CALLINGAETITLENOTRECOGNIZED;
       break;
+    case DCMSCP_CALLING_HOST_NOT_ALLOWED:
     case DCMSCP_FORCED:
     case DCMSCP_NO_IMPLEMENTATION_CLASS_UID:
     case DCMSCP_NO_PRESENTATION_CONTEXTS:
@@ -336,6 +664,25 @@ OFCondition DcmMppsSCP::waitForAssociationRQ(T_ASC_Network *network)
     return EC_Normal;
   }
 
+  MPPS_PROBE3(association__accept, m_assoc->params->DULparams.callingPresentationAddress,
+    m_assoc->params->DULparams.callingAPTitle, m_assoc->params->DULparams.calledAPTitle);
+  m_flightRecorder.beginAssociation(m_assoc->params->DULparams.callingPresentationAddress,
+    m_assoc->params->DULparams.callingAPTitle, m_assoc->params->DULparams.calledAPTitle);
+
+  // the trace of the association starts when the connection is accepted
+  if (m_trace.isEnabled())
+  {
+    Uint64 acceptTime = 0;
+    Uint64 readyTime = 0;
+    m_transportLayer.getConnectionTimes(acceptTime, readyTime);
+    const Uint64 receiveTime = DcmTraceRecorder::now();
+    if (acceptTime == 0)
+      acceptTime = readyTime = receiveTime;
+    m_trace.begin("association", acceptTime);
+    m_trace.addSpan("TCP accept", acceptTime, readyTime);
+    m_trace.addSpan("A-ASSOCIATE-RQ receive", readyTime, receiveTime);
+  }
+
   return processAssociationRQ();
 }
 
@@ -345,8 +692,27 @@ OFCondition DcmMppsSCP::processAssociationRQ()
   DcmSCPActionType desiredAction = DCMSCP_ACTION_UNDEFINED;
   if ( (m_assoc == NULL) || (m_assoc->params == NULL) )
     return ASC_NULLKEY;
+  m_associationStart = DcmMetricsRegistry::now();
+  const size_t negotiationSpan = m_trace.beginSpan("negotiation");
+
+  // Check the address of the peer before anything else, so that hosts not allowed by
+  // the access policy are refused without further effort
+  m_accessPolicy.update(time(NULL));
+  OFString peerAddress;
+  if (!m_transportLayer.getPeerAddress(peerAddress))
+    peerAddress = getPeerIP();
+  m_trace.setAttribute(0, "peer", peerAddress);
+  m_trace.setAttribute(0, "calling_ae", m_assoc->params->DULparams.callingAPTitle);
+  m_trace.setAttribute(0, "called_ae", m_assoc->params->DULparams.calledAPTitle);
+  if (!checkCallingHostAccepted(peerAddress))
+  {
+    refuseAssociation( DCMSCP_CALLING_HOST_NOT_ALLOWED );
+    dropAndDestroyAssociation();
+    return EC_Normal;
+  }
 
   // call notifier function
+  m_echoOnly = isEchoOnlyRequest(*m_assoc->params);
   notifyAssociationRequest(*m_assoc->params, desiredAction);
   if (desiredAction != DCMSCP_ACTION_UNDEFINED)
   {
@@ -413,6 +779,7 @@ OFCondition DcmMppsSCP::processAssociationRQ()
     dropAndDestroyAssociation();
     return EC_Normal;
   }
+  recordPresentationContexts();
 
   // Reject association if no presentation context was negotiated
   if( ASC_countAcceptedPresentationContexts( m_assoc->params ) == 0 )
@@ -430,17 +797,28 @@ OFCondition DcmMppsSCP::processAssociationRQ()
   }
 
   // If the negotiation was successful, accept the association request
+  m_trace.endSpan(negotiationSpan);
+  const size_t acknowledgeSpan = m_trace.beginSpan("A-ASSOCIATE-AC send");
   cond = ASC_acknowledgeAssociation( m_assoc );
+  m_trace.endSpan(acknowledgeSpan);
   if( cond.bad() )
   {
     dropAndDestroyAssociation();
     return EC_Normal;
   }
+  buildPresentationContextTable();
   notifyAssociationAcknowledge();
+  OFString labels = getPeerLabel();
+  m_metrics.observe("mpps_association_setup_seconds", labels, DcmMetricsRegistry::now() - m_associationStart);
+  DcmMetricsRegistry::addLabel(labels, "result", "accepted");
+  m_metrics.increment("mpps_associations_total", labels);
+  m_trace.setAttribute(0, "result", "accepted");
+  MPPS_PROBE2(association__ack, m_assoc->params->DULparams.callingAPTitle,
+    ASC_countAcceptedPresentationContexts(m_assoc->params));
 
   // Dump some debug information
   OFString tempStr;
-  DCMNET_INFO("Association Acknowledged (Max Send PDV: " << OFstatic_cast(Uint32, m_assoc->sendPDVLength) << ")");
+  MPPS_ASSOCIATION_INFO("Association Acknowledged (Max Send PDV: " << OFstatic_cast(Uint32, m_assoc->sendPDVLength) << ")");
   if (m_cfg->getVerbosePCMode())
     DCMNET_INFO(ASC_dumpParameters(tempStr, m_assoc->params, ASC_ASSOC_AC));
   else
@@ -459,6 +837,13 @@ OFCondition DcmMppsSCP::negotiateAssociation()
   if (m_assoc == NULL)
     return DIMSE_ILLEGALASSOCIATION;
 
+  // Accept the presentation contexts as for an identical earlier request, if any
+  if (m_negotiationCache.apply(*m_assoc->params))
+  {
+    DCMNET_DEBUG("Presentation contexts negotiated from cache");
+    return EC_Normal;
+  }
+
   // Set presentation contexts as defined in association configuration
   OFCondition result = m_cfg->evaluateIncomingAssociation(*m_assoc);
   if (result.bad())
@@ -466,6 +851,8 @@ OFCondition DcmMppsSCP::negotiateAssociation()
     OFString tempStr;
     DCMNET_ERROR(DimseCondition::dump(tempStr, result));
   }
+  else
+    m_negotiationCache.store(*m_assoc->params);
   return result;
 }
 
@@ -511,36 +898,91 @@ void DcmMppsSCP::handleAssociation()
   OFCondition cond = EC_Normal;
   T_DIMSE_Message message;
   T_ASC_PresentationContextID presID;
+  const Uint64 receivedMessages = m_receivedMessages;
+  const Uint64 messageReadCalls = m_messageReadCalls;
+  Uint64 receiveStart = 0;
 
   // start a loop to be able to receive more than one DIMSE command
   while( cond.good() )
   {
     // receive a DIMSE command over the network
+    const Uint64 readCalls = m_transportLayer.getReadCalls();
+    const Uint64 bytesReceived = m_transportLayer.getBytesReceived();
+    const Uint64 bytesSent = m_transportLayer.getBytesSent();
+    if (m_trace.isEnabled())
+    {
+      receiveStart = DcmTraceRecorder::now();
+      m_transportLayer.clearDataArrivalTime();
+    }
     cond = DIMSE_receiveCommand( m_assoc, m_cfg->getDIMSEBlockingMode(), m_cfg->getDIMSETimeout(),
                                  &presID, &message, NULL );
     // check if peer did release or abort, or if we have a valid message
     if( cond.good() )
     {
-      DcmPresentationContextInfo presInfo;
-      getPresentationContextInfo(m_assoc, presID, presInfo);
-      cond = handleIncomingCommand(&message, presInfo);
+      Uint16 messageID;
+      Uint16 status;
+      (void) getMessageInfo(message, messageID, status);
+      MPPS_PROBE3(command__receive, OFstatic_cast(unsigned int, message.CommandField), messageID, presID);
+      m_flightRecorder.beginCommand(OFstatic_cast(Uint16, message.CommandField), messageID, presID,
+        bytesReceived, bytesSent);
+      if (m_trace.isEnabled())
+        beginCommandTrace(message, receiveStart);
+      cond = handleIncomingCommand(&message, getCommandPresentationContext(presID));
+      endCommandTrace();
+      m_flightRecorder.endCommand(m_transportLayer.getBytesReceived(), m_transportLayer.getBytesSent());
+      // count the recv() calls for command and dataset (the response is sent by then)
+      ++m_receivedMessages;
+      m_messageReadCalls += m_transportLayer.getReadCalls() - readCalls;
+      DCMNET_TRACE("DIMSE message received with " << (m_transportLayer.getReadCalls() - readCalls) << " recv() call(s)");
+      // move instances that have been final long enough to the cold tier
+      m_instanceStore.ageInstances(time(NULL));
     }
   }
-  // Clean up on association termination.
+  if (m_receivedMessages > receivedMessages)
+  {
+    DCMNET_DEBUG("Received " << (m_receivedMessages - receivedMessages) << " DIMSE message(s) with "
+      << (m_messageReadCalls - messageReadCalls) << " recv() call(s)");
+  }
+  // Clean up on association termination. The trace span starts when the request
+  // (or the error) arrived.
+  size_t terminationSpan = SCP_TRACE_NO_SPAN;
+  if (m_trace.isEnabled())
+  {
+    const Uint64 arrivalTime = m_transportLayer.getDataArrivalTime();
+    const char *name = "error";
+    if (cond == DUL_PEERREQUESTEDRELEASE)
+      name = "release";
+    else if (cond == DUL_PEERABORTEDASSOCIATION)
+      name = "abort";
+    terminationSpan = m_trace.beginSpan(name, (arrivalTime > receiveStart) ? arrivalTime : receiveStart);
+  }
+  OFString labels = getPeerLabel();
   if( cond == DUL_PEERREQUESTEDRELEASE )
   {
     notifyReleaseRequest();
     ASC_acknowledgeRelease(m_assoc);
+    DcmMetricsRegistry::addLabel(labels, "reason", "release");
+    m_flightRecorder.setOutcome("released");
+    MPPS_PROBE1(association__release, "release");
   }
   else if( cond == DUL_PEERABORTEDASSOCIATION )
   {
     notifyAbortRequest();
+    DcmMetricsRegistry::addLabel(labels, "reason", "abort");
+    m_flightRecorder.setOutcome("aborted");
+    MPPS_PROBE1(association__release, "abort");
   }
   else
   {
     notifyDIMSEError(cond);
     ASC_abortAssociation( m_assoc );
+    DcmMetricsRegistry::addLabel(labels, "reason", "error");
+    m_flightRecorder.setOutcome("error");
+    MPPS_PROBE1(association__release, "error");
+    m_trace.setAttribute(terminationSpan, "error", cond.text());
   }
+  m_trace.endSpan(terminationSpan);
+  m_metrics.increment("mpps_associations_closed_total", labels);
 
   // Drop and destroy the association.
   dropAndDestroyAssociation();
@@ -557,19 +999,48 @@ OFCondition DcmMppsSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
                                                  const DcmPresentationContextInfo &presInfo)
 {
     OFCondition status = EC_IllegalParameter;
+    const Uint64 metricsStart = DcmMetricsRegistry::now();
+    m_datasetReceiveTime = 0;
+    m_responseSendTime = 0;
     if (incomingMsg != NULL)
     {
         // check whether we've received a supported command
         if (incomingMsg->CommandField == DIMSE_C_ECHO_RQ)
         {
-            // handle incoming C-ECHO request
-            status = handleECHORequest(incomingMsg->msg.CEchoRQ, presInfo.presentationContextID);
+            // answer health checks without logging (unless the messages are dumped),
+            // otherwise handle incoming C-ECHO request
+            status = EC_IllegalCall;
+            if (m_fastEcho && !DCM_dcmnetLogger.isEnabledFor(OFLogger::DEBUG_LOG_LEVEL))
+                status = sendFastECHOResponse(incomingMsg->msg.CEchoRQ, presInfo.presentationContextID);
+            if (status == EC_IllegalCall)
+                status = handleECHORequest(incomingMsg->msg.CEchoRQ, presInfo.presentationContextID);
+            // health checks are only counted. The counter is looked up by the first
+            // C-ECHO of an association and reused by all further ones.
+            const char *sopClassUID = incomingMsg->msg.CEchoRQ.AffectedSOPClassUID;
+            volatile Uint64 *counter = m_echoCounter;
+            if (status.bad() || (counter == NULL) || (strcmp(sopClassUID, m_echoSOPClassUID) != 0))
+            {
+              OFString labels = getPeerLabel();
+              DcmMetricsRegistry::addLabel(labels, "command", "C-ECHO");
+              DcmMetricsRegistry::addLabel(labels, "sop_class", sopClassUID);
+              DcmMetricsRegistry::addLabel(labels, "status", status.good() ? "0000" : "failed");
+              counter = m_metrics.getCounter("mpps_requests_total", labels);
+              if (status.good())
+              {
+                m_echoCounter = counter;
+                OFStandard::strlcpy(m_echoSOPClassUID, sopClassUID, sizeof(m_echoSOPClassUID));
+              }
+            }
+            DcmMetricsRegistry::increment(counter);
         }
         else if (incomingMsg->CommandField == DIMSE_N_CREATE_RQ)
         {
             // handle incoming N-CREATE request
             T_DIMSE_N_CreateRQ &createReq = incomingMsg->msg.NCreateRQ;
             Uint16 rspStatusCode = STATUS_N_NoSuchAttribute;
+            const Uint64 startTime = DcmMppsSegmentLog::getTimestamp();
+            Uint64 streamSequence = 0;
+            Uint32 datasetLength = 0;
 
             DcmFileFormat fileformat;
             DcmDataset *reqDataset = fileformat.getDataset();
@@ -578,8 +1049,34 @@ OFCondition DcmMppsSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
             status = receiveCREATERequest(createReq, presInfo.presentationContextID, reqDataset);
             if (status.good())
             {
-                // output debug message that dataset is not stored
-                rspStatusCode = STATUS_Success;
+                // the SCU may leave it to us to create the SOP instance UID
+                if ((createReq.AffectedSOPInstanceUID[0] == '\0') || !(createReq.opts & O_NCREATE_AFFECTEDSOPINSTANCEUID))
+                {
+                    char uid[100];
+                    dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT);
+                    OFStandard::strlcpy(createReq.AffectedSOPInstanceUID, uid, sizeof(createReq.AffectedSOPInstanceUID));
+                    createReq.opts |= O_NCREATE_AFFECTEDSOPINSTANCEUID;
+                }
+                // keep the new instance
+                OFCondition storeStatus = m_instanceStore.createInstance(createReq.AffectedSOPClassUID,
+                    createReq.AffectedSOPInstanceUID, *reqDataset);
+                if (storeStatus.good())
+                {
+                    rspStatusCode = STATUS_Success;
+                    if (m_eventStream.isOpen() && m_eventStream.append(MPPS_RT_Create, createReq.AffectedSOPInstanceUID,
+                        *reqDataset, &streamSequence, &datasetLength).good())
+                    {
+                        m_instanceStore.addHistoryRecord(createReq.AffectedSOPInstanceUID, streamSequence);
+                    }
+                }
+                else if (storeStatus == MPPS_EC_DuplicateSOPInstance)
+                {
+                    DCMNET_WARN("MPPS instance " << createReq.AffectedSOPInstanceUID << " already exists");
+                    rspStatusCode = STATUS_N_DuplicateSOPInstance;
+                } else {
+                    DCMNET_ERROR("cannot store MPPS instance " << createReq.AffectedSOPInstanceUID << ": " << storeStatus.text());
+                    rspStatusCode = STATUS_N_ProcessingFailure;
+                }
             }
             else
             {
@@ -589,6 +1086,10 @@ OFCondition DcmMppsSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
             }
 
             status = sendCREATEResponse(presInfo.presentationContextID, createReq, rspStatusCode);
+            recordMetrics("N-CREATE", createReq.AffectedSOPClassUID, rspStatusCode, metricsStart);
+            recordEvent(DIMSE_N_CREATE_RQ, createReq.MessageID, presInfo.presentationContextID,
+                createReq.AffectedSOPClassUID, createReq.AffectedSOPInstanceUID, rspStatusCode,
+                startTime, streamSequence, datasetLength);
 
         }
         else if (incomingMsg->CommandField == DIMSE_N_SET_RQ)
@@ -596,6 +1097,9 @@ OFCondition DcmMppsSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
             // handle incoming N-SET request
             T_DIMSE_N_SetRQ &setReq = incomingMsg->msg.NSetRQ;
             Uint16 rspStatusCode = STATUS_N_NoSuchAttribute ;
+            const Uint64 startTime = DcmMppsSegmentLog::getTimestamp();
+            Uint64 streamSequence = 0;
+            Uint32 datasetLength = 0;
 
             DcmFileFormat fileformat;
             DcmDataset *reqDataset = fileformat.getDataset();
@@ -604,8 +1108,30 @@ OFCondition DcmMppsSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
             status = receiveSETRequest(setReq, presInfo.presentationContextID, reqDataset);
             if (status.good())
             {
-                // output debug message that dataset is not stored
-                rspStatusCode = STATUS_Success;
+                // merge the modification list into the stored instance
+                OFCondition storeStatus = m_instanceStore.setInstance(setReq.RequestedSOPInstanceUID, *reqDataset);
+                if (storeStatus.good())
+                {
+                    rspStatusCode = STATUS_Success;
+                    if (m_eventStream.isOpen() && m_eventStream.append(MPPS_RT_Set, setReq.RequestedSOPInstanceUID,
+                        *reqDataset, &streamSequence, &datasetLength).good())
+                    {
+                        m_instanceStore.addHistoryRecord(setReq.RequestedSOPInstanceUID, streamSequence);
+                    }
+                }
+                else if (storeStatus == MPPS_EC_NoSuchSOPInstance)
+                {
+                    DCMNET_WARN("MPPS instance " << setReq.RequestedSOPInstanceUID << " does not exist");
+                    rspStatusCode = STATUS_N_NoSuchObjectInstance;
+                }
+                else if (storeStatus == MPPS_EC_InstanceFinalized)
+                {
+                    DCMNET_WARN("MPPS instance " << setReq.RequestedSOPInstanceUID << " cannot be modified any more");
+                    rspStatusCode = STATUS_N_ProcessingFailure;
+                } else {
+                    DCMNET_ERROR("cannot update MPPS instance " << setReq.RequestedSOPInstanceUID << ": " << storeStatus.text());
+                    rspStatusCode = STATUS_N_ProcessingFailure;
+                }
             }
             else
             {
@@ -615,6 +1141,59 @@ OFCondition DcmMppsSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
             }
 
             status = sendSETResponse(presInfo.presentationContextID, setReq, rspStatusCode);
+            recordMetrics("N-SET", setReq.RequestedSOPClassUID, rspStatusCode, metricsStart);
+            recordEvent(DIMSE_N_SET_RQ, setReq.MessageID, presInfo.presentationContextID,
+                setReq.RequestedSOPClassUID, setReq.RequestedSOPInstanceUID, rspStatusCode,
+                startTime, streamSequence, datasetLength);
+
+        }
+        else if (incomingMsg->CommandField == DIMSE_N_GET_RQ)
+        {
+            // handle incoming N-GET request
+            T_DIMSE_N_GetRQ &getReq = incomingMsg->msg.NGetRQ;
+            Uint16 rspStatusCode = STATUS_Success;
+            const Uint64 startTime = DcmMppsSegmentLog::getTimestamp();
+
+            if (DCM_dcmnetLogger.isEnabledFor(OFLogger::DEBUG_LOG_LEVEL))
+            {
+                OFString tempStr;
+                DCMNET_INFO("Received N-GET Request");
+                DCMNET_DEBUG(DIMSE_dumpMessage(tempStr, getReq, DIMSE_INCOMING, NULL, presInfo.presentationContextID));
+            } else
+                DCMNET_INFO("Received N-GET Request (MsgID " << getReq.MessageID << ")");
+
+            // retrieve the requested attributes from the stored instance
+            DcmDataset rspDataset;
+            OFVector<Uint32> missing;
+            const size_t tagCount = (getReq.ListCount > 0) ? OFstatic_cast(size_t, getReq.ListCount) / 2 : 0;
+            OFCondition storeStatus = m_instanceStore.getInstance(getReq.RequestedSOPInstanceUID,
+                getReq.AttributeIdentifierList, tagCount, rspDataset, missing);
+            if (storeStatus.good())
+            {
+                if (!missing.empty())
+                {
+                    DCMNET_DEBUG(missing.size() << " requested attribute(s) not present in MPPS instance "
+                        << getReq.RequestedSOPInstanceUID);
+                    rspStatusCode = STATUS_N_AttributeListError;
+                }
+            }
+            else if (storeStatus == MPPS_EC_NoSuchSOPInstance)
+            {
+                DCMNET_WARN("MPPS instance " << getReq.RequestedSOPInstanceUID << " does not exist");
+                rspStatusCode = STATUS_N_NoSuchObjectInstance;
+            } else {
+                DCMNET_ERROR("cannot retrieve MPPS instance " << getReq.RequestedSOPInstanceUID << ": " << storeStatus.text());
+                rspStatusCode = STATUS_N_ProcessingFailure;
+            }
+
+            status = sendGETResponse(presInfo.presentationContextID, getReq, rspStatusCode,
+                storeStatus.good() ? &rspDataset : NULL);
+            recordMetrics("N-GET", getReq.RequestedSOPClassUID, rspStatusCode, metricsStart);
+            recordEvent(DIMSE_N_GET_RQ, getReq.MessageID, presInfo.presentationContextID,
+                getReq.RequestedSOPClassUID, getReq.RequestedSOPInstanceUID, rspStatusCode,
+                startTime, 0, 0);
+            // free the attribute identifier list allocated while parsing the request
+            DIMSE_freeMessage(incomingMsg);
 
         } else {
             // unsupported command
@@ -664,6 +1243,211 @@ OFCondition DcmMppsSCP::handleECHORequest(T_DIMSE_C_EchoRQ &reqMessage,
 
 // ----------------------------------------------------------------------------
 
+OFCondition DcmMppsSCP::sendFastECHOResponse(const T_DIMSE_C_EchoRQ &reqMessage,
+                                             const T_ASC_PresentationContextID presID)
+{
+  T_DIMSE_Message response;
+  bzero((char*)&response, sizeof(response));
+  T_DIMSE_C_EchoRSP &echoRsp = response.msg.CEchoRSP;
+  response.CommandField = DIMSE_C_ECHO_RSP;
+  echoRsp.MessageIDBeingRespondedTo = reqMessage.MessageID;
+  echoRsp.DimseStatus = STATUS_Success;
+  echoRsp.DataSetType = DIMSE_DATASET_NULL;
+  OFStandard::strlcpy(echoRsp.AffectedSOPClassUID, reqMessage.AffectedSOPClassUID, sizeof(echoRsp.AffectedSOPClassUID));
+  OFCondition cond = sendMessage(presID, response, NULL /* dataObject */, NULL, NULL, OFTrue /* preEncoded */);
+  if (cond.good())
+  {
+    ++m_echoRequests;
+    reportEchoRequests(time(NULL));
+  }
+  else if (cond != EC_IllegalCall)
+  {
+    OFString tempStr;
+    DCMNET_ERROR("Cannot send C-ECHO Response: " << DimseCondition::dump(tempStr, cond));
+  }
+  return cond;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::reportEchoRequests(const time_t now)
+{
+  if ((now >= m_echoReportTime) && (now - m_echoReportTime < MPPS_ECHO_REPORT_INTERVAL))
+    return;
+  DCMNET_INFO("Answered " << (m_echoRequests - m_echoRequestsReported) << " C-ECHO Request(s) ("
+    << m_echoRequests << " in total)");
+  m_echoRequestsReported = m_echoRequests;
+  m_echoReportTime = now;
+}
+
+// ----------------------------------------------------------------------------
+
+OFString DcmMppsSCP::formatPeerAddress(const OFString &address)
+{
+  OFString hostName;
+  if ((m_hostNameResolver != NULL) && m_hostNameResolver->lookup(address, hostName))
+    return hostName + " (" + address + ")";
+  return address;
+}
+
+
+void DcmMppsSCP::stopHostNameResolver()
+{
+  if (m_hostNameResolver != NULL)
+  {
+    m_hostNameResolver->stop();
+    m_hostNameResolver->join();
+    delete m_hostNameResolver;
+    m_hostNameResolver = NULL;
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::recordEvent(const Uint16 commandField,
+                             const Uint16 messageID,
+                             const T_ASC_PresentationContextID presID,
+                             const char *sopClassUID,
+                             const char *sopInstanceUID,
+                             const Uint16 status,
+                             const Uint64 startTime,
+                             const Uint64 streamSequence,
+                             const Uint32 datasetLength)
+{
+  if (!m_eventRing.isOpen() || (m_assoc == NULL) || (m_assoc->params == NULL))
+    return;
+  DcmMppsEventRecord record;
+  record.timestamp = startTime;
+  record.duration = OFstatic_cast(Uint32, DcmMppsSegmentLog::getTimestamp() - startTime);
+  record.commandField = commandField;
+  record.status = status;
+  record.messageID = messageID;
+  record.presentationContextID = presID;
+  record.datasetLength = datasetLength;
+  record.streamSequence = streamSequence;
+  const T_ASC_Parameters *params = m_assoc->params;
+  OFStandard::strlcpy(record.callingAETitle, params->DULparams.callingAPTitle, sizeof(record.callingAETitle));
+  OFStandard::strlcpy(record.calledAETitle, params->DULparams.calledAPTitle, sizeof(record.calledAETitle));
+  OFStandard::strlcpy(record.sopClassUID, sopClassUID, sizeof(record.sopClassUID));
+  OFStandard::strlcpy(record.sopInstanceUID, sopInstanceUID, sizeof(record.sopInstanceUID));
+  OFStandard::strlcpy(record.peerAddress, params->DULparams.callingPresentationAddress, sizeof(record.peerAddress));
+  m_eventRing.append(record);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::recordMetrics(const char *command,
+                               const char *sopClassUID,
+                               const Uint16 status,
+                               const Uint64 startTime)
+{
+  const Uint64 total = DcmMetricsRegistry::now() - startTime;
+  const Uint64 networkTime = m_datasetReceiveTime + m_responseSendTime;
+  OFString labels = getPeerLabel();
+  DcmMetricsRegistry::addLabel(labels, "command", command);
+  DcmMetricsRegistry::addLabel(labels, "sop_class", sopClassUID);
+  m_metrics.observe("mpps_dataset_receive_seconds", labels, m_datasetReceiveTime);
+  m_metrics.observe("mpps_handler_seconds", labels, (total > networkTime) ? total - networkTime : 0);
+  m_metrics.observe("mpps_response_send_seconds", labels, m_responseSendTime);
+  char statusString[8];
+  sprintf(statusString, "%04x", OFstatic_cast(unsigned int, status));
+  DcmMetricsRegistry::addLabel(labels, "status", statusString);
+  m_metrics.increment("mpps_requests_total", labels);
+}
+
+
+OFString DcmMppsSCP::getPeerLabel() const
+{
+  if ((m_assoc == NULL) || (m_assoc->params == NULL))
+    return "";
+  OFString labels;
+  DcmMetricsRegistry::addLabel(labels, "peer", m_assoc->params->DULparams.callingAPTitle);
+  return labels;
+}
+
+
+void DcmMppsSCP::stopMetricsServer()
+{
+  if (m_metricsServer != NULL)
+  {
+    m_metricsServer->stop();
+    m_metricsServer->join();
+    delete m_metricsServer;
+    m_metricsServer = NULL;
+  }
+}
+
+
+void DcmMppsSCP::beginCommandTrace(const T_DIMSE_Message &message,
+                                   const Uint64 receiveStart)
+{
+  const char *name = "DIMSE";
+  Uint16 messageID = 0;
+  const char *sopClassUID = "";
+  switch (message.CommandField)
+  {
+    case DIMSE_C_ECHO_RQ:
+      name = "C-ECHO";
+      messageID = message.msg.CEchoRQ.MessageID;
+      sopClassUID = message.msg.CEchoRQ.AffectedSOPClassUID;
+      break;
+    case DIMSE_N_CREATE_RQ:
+      name = "N-CREATE";
+      messageID = message.msg.NCreateRQ.MessageID;
+      sopClassUID = message.msg.NCreateRQ.AffectedSOPClassUID;
+      break;
+    case DIMSE_N_SET_RQ:
+      name = "N-SET";
+      messageID = message.msg.NSetRQ.MessageID;
+      sopClassUID = message.msg.NSetRQ.RequestedSOPClassUID;
+      break;
+    case DIMSE_N_GET_RQ:
+      name = "N-GET";
+      messageID = message.msg.NGetRQ.MessageID;
+      sopClassUID = message.msg.NGetRQ.RequestedSOPClassUID;
+      break;
+    default:
+      break;
+  }
+  // the command starts when its first PDU arrived, unless it had been read ahead
+  const Uint64 arrivalTime = m_transportLayer.getDataArrivalTime();
+  const Uint64 startTime = (arrivalTime > receiveStart) ? arrivalTime : receiveStart;
+  m_traceCommand = m_trace.beginSpan(name, startTime);
+  char buf[8];
+  sprintf(buf, "%u", OFstatic_cast(unsigned int, messageID));
+  m_trace.setAttribute(m_traceCommand, "message_id", buf);
+  m_trace.setAttribute(m_traceCommand, "sop_class", sopClassUID);
+  m_traceHandlerStart = DcmTraceRecorder::now();
+  m_trace.addSpan("command receive", startTime, m_traceHandlerStart);
+}
+
+
+void DcmMppsSCP::traceIO(const char *name,
+                         const Uint64 startTime)
+{
+  if ((startTime == 0) || (m_traceHandlerStart == 0))
+    return;
+  if (startTime > m_traceHandlerStart)
+    m_trace.addSpan("handler", m_traceHandlerStart, startTime);
+  m_traceHandlerStart = DcmTraceRecorder::now();
+  m_trace.addSpan(name, startTime, m_traceHandlerStart);
+}
+
+
+void DcmMppsSCP::endCommandTrace()
+{
+  if (m_traceHandlerStart == 0)
+    return;
+  const Uint64 endTime = DcmTraceRecorder::now();
+  if (endTime > m_traceHandlerStart)
+    m_trace.addSpan("handler", m_traceHandlerStart, endTime);
+  m_trace.endSpan(m_traceCommand, endTime);
+  m_traceCommand = SCP_TRACE_NO_SPAN;
+  m_traceHandlerStart = 0;
+}
+
+// ----------------------------------------------------------------------------
+
 // -- N-CREATE --
 
 OFCondition DcmMppsSCP::receiveCREATERequest(T_DIMSE_N_CreateRQ &reqMessage,
@@ -699,8 +1483,6 @@ OFCondition DcmMppsSCP::receiveCREATERequest(T_DIMSE_N_CreateRQ &reqMessage,
     return cond;
   }
 
-  DCMNET_INFO(DIMSE_dumpMessage(tempStr, reqMessage, DIMSE_INCOMING, dataset, presID));
-
   // Output request message only if trace level is enabled
   if (DCM_dcmnetLogger.isEnabledFor(OFLogger::TRACE_LOG_LEVEL))
     DCMNET_DEBUG(DIMSE_dumpMessage(tempStr, reqMessage, DIMSE_INCOMING, dataset, presID));
@@ -748,16 +1530,20 @@ OFCondition DcmMppsSCP::sendCREATEResponse(T_ASC_PresentationContextID presID,
   OFStandard::strlcpy(createRsp.AffectedSOPClassUID, reqMessage.AffectedSOPClassUID, sizeof(createRsp.AffectedSOPClassUID));
   OFStandard::strlcpy(createRsp.AffectedSOPInstanceUID, reqMessage.AffectedSOPInstanceUID, sizeof(createRsp.AffectedSOPInstanceUID));
 
+  // Send the response from a pre-encoded command set (unless it is to be dumped)
+  cond = EC_IllegalCall;
   if (DCM_dcmnetLogger.isEnabledFor(OFLogger::DEBUG_LOG_LEVEL))
   {
     DCMNET_INFO("Sending N-CREATE Response");
     DCMNET_DEBUG(DIMSE_dumpMessage(tempStr, response, DIMSE_OUTGOING, NULL, presID));
   } else {
     DCMNET_INFO("Sending N-CREATE Response (" << DU_ncreateStatusString(rspStatusCode) << ")");
+    cond = sendMessage(presID, response, NULL /* dataObject */, NULL, NULL, OFTrue /* preEncoded */);
   }
 
   // Send response message
-  cond = sendDIMSEMessage(presID, &response, NULL /* dataObject */, NULL);
+  if (cond == EC_IllegalCall)
+    cond = sendDIMSEMessage(presID, &response, NULL /* dataObject */, NULL);
   if (cond.bad())
   {
     DCMNET_ERROR("Failed sending N-CREATE response: " << DimseCondition::dump(tempStr, cond));
@@ -804,8 +1590,6 @@ OFCondition DcmMppsSCP::receiveSETRequest(T_DIMSE_N_SetRQ &reqMessage,
     return cond;
   }
 
-  DCMNET_INFO(DIMSE_dumpMessage(tempStr, reqMessage, DIMSE_INCOMING, dataset, presID));
-
   // Output request message only if trace level is enabled
   if (DCM_dcmnetLogger.isEnabledFor(OFLogger::TRACE_LOG_LEVEL))
     DCMNET_DEBUG(DIMSE_dumpMessage(tempStr, reqMessage, DIMSE_INCOMING, dataset, presID));
@@ -853,16 +1637,20 @@ OFCondition DcmMppsSCP::sendSETResponse(T_ASC_PresentationContextID presID,
   OFStandard::strlcpy(setRsp.AffectedSOPClassUID, reqMessage.RequestedSOPClassUID, sizeof(setRsp.AffectedSOPClassUID));
   OFStandard::strlcpy(setRsp.AffectedSOPInstanceUID, reqMessage.RequestedSOPInstanceUID, sizeof(setRsp.AffectedSOPInstanceUID));
 
+  // Send the response from a pre-encoded command set (unless it is to be dumped)
+  cond = EC_IllegalCall;
   if (DCM_dcmnetLogger.isEnabledFor(OFLogger::DEBUG_LOG_LEVEL))
   {
     DCMNET_INFO("Sending N-SET Response");
     DCMNET_DEBUG(DIMSE_dumpMessage(tempStr, response, DIMSE_OUTGOING, NULL, presID));
   } else {
     DCMNET_INFO("Sending N-SET Response (" << DU_nsetStatusString(rspStatusCode) << ")");
+    cond = sendMessage(presID, response, NULL /* dataObject */, NULL, NULL, OFTrue /* preEncoded */);
   }
 
   // Send response message
-  cond = sendDIMSEMessage(presID, &response, NULL /* dataObject */, NULL);
+  if (cond == EC_IllegalCall)
+    cond = sendDIMSEMessage(presID, &response, NULL /* dataObject */, NULL);
   if (cond.bad())
   {
     DCMNET_ERROR("Failed sending N-SET response: " << DimseCondition::dump(tempStr, cond));
@@ -872,6 +1660,51 @@ OFCondition DcmMppsSCP::sendSETResponse(T_ASC_PresentationContextID presID,
 
 }
 
+// ----------------------------------------------------------------------------
+
+// -- N-GET --
+
+OFCondition DcmMppsSCP::sendGETResponse(T_ASC_PresentationContextID presID,
+                                        const T_DIMSE_N_GetRQ &reqMessage,
+                                        const Uint16 rspStatusCode,
+                                        DcmDataset *rspDataset)
+{
+  OFCondition cond;
+  OFString tempStr;
+
+  // Send back response
+  T_DIMSE_Message response;
+  // Make sure everything is zeroed (especially options)
+  bzero((char*)&response, sizeof(response));
+  T_DIMSE_N_GetRSP &getRsp = response.msg.NGetRSP;
+  response.CommandField = DIMSE_N_GET_RSP;
+  getRsp.MessageIDBeingRespondedTo = reqMessage.MessageID;
+  getRsp.DimseStatus = rspStatusCode;
+  getRsp.DataSetType = (rspDataset != NULL) ? DIMSE_DATASET_PRESENT : DIMSE_DATASET_NULL;
+  // Always send the optional fields "Affected SOP Class UID" and "Affected SOP Instance UID"
+  getRsp.opts = O_NGET_AFFECTEDSOPCLASSUID | O_NGET_AFFECTEDSOPINSTANCEUID;
+  OFStandard::strlcpy(getRsp.AffectedSOPClassUID, reqMessage.RequestedSOPClassUID, sizeof(getRsp.AffectedSOPClassUID));
+  OFStandard::strlcpy(getRsp.AffectedSOPInstanceUID, reqMessage.RequestedSOPInstanceUID, sizeof(getRsp.AffectedSOPInstanceUID));
+
+  if (DCM_dcmnetLogger.isEnabledFor(OFLogger::DEBUG_LOG_LEVEL))
+  {
+    DCMNET_INFO("Sending N-GET Response");
+    DCMNET_DEBUG(DIMSE_dumpMessage(tempStr, response, DIMSE_OUTGOING, rspDataset, presID));
+  } else {
+    DCMNET_INFO("Sending N-GET Response (" << DU_ngetStatusString(rspStatusCode) << ")");
+  }
+
+  // Send response message
+  cond = sendDIMSEMessage(presID, &response, rspDataset, NULL);
+  if (cond.bad())
+  {
+    DCMNET_ERROR("Failed sending N-GET response: " << DimseCondition::dump(tempStr, cond));
+  }
+
+  return cond;
+
+}
+
 /* ************************************************************************* */
 /*                            Various helpers                                */
 /* ************************************************************************* */
@@ -888,9 +1721,62 @@ OFCondition DcmMppsSCP::sendDIMSEMessage(const T_ASC_PresentationContextID presI
   if (message == NULL)
     return DIMSE_NULLKEY;
 
-  OFCondition cond;
-  cond = DIMSE_sendMessageUsingMemoryData(m_assoc, presID, message, statusDetail, dataObject,
+  return sendMessage(presID, *message, dataObject, statusDetail, commandSet, OFFalse /* preEncoded */);
+}
+
+// ----------------------------------------------------------------------------
+
+// Sends a message, by DIMSE or from a pre-encoded command set, and accounts for the time
+OFCondition DcmMppsSCP::sendMessage(const T_ASC_PresentationContextID presID,
+                                    T_DIMSE_Message &message,
+                                    DcmDataset *dataObject,
+                                    DcmDataset *statusDetail,
+                                    DcmDataset **commandSet,
+                                    const OFBool preEncoded)
+{
+  // Collect all PDVs of the message, so they are sent as one train of full segments
+  OFCondition cond = EC_IllegalCall;
+  const Uint64 startTime = DcmMetricsRegistry::now();
+  const Uint64 traceStart = (m_traceHandlerStart > 0) ? DcmTraceRecorder::now() : 0;
+  m_transportLayer.beginMessage();
+  if (!preEncoded)
+  {
+    cond = DIMSE_sendMessageUsingMemoryData(m_assoc, presID, &message, statusDetail, dataObject,
                                             NULL /*callback*/, NULL /*callbackData*/, commandSet);
+  }
+  else if (message.CommandField == DIMSE_C_ECHO_RSP)
+  {
+    cond = m_responseEncoder.sendEchoResponse(m_assoc, presID, message.msg.CEchoRSP.MessageIDBeingRespondedTo,
+      message.msg.CEchoRSP.AffectedSOPClassUID);
+  }
+  else if (message.CommandField == DIMSE_N_CREATE_RSP)
+  {
+    const T_DIMSE_N_CreateRSP &createRsp = message.msg.NCreateRSP;
+    cond = m_responseEncoder.sendResponse(m_assoc, presID, DIMSE_N_CREATE_RSP, createRsp.MessageIDBeingRespondedTo,
+      createRsp.AffectedSOPClassUID, createRsp.AffectedSOPInstanceUID, createRsp.DimseStatus);
+  }
+  else if (message.CommandField == DIMSE_N_SET_RSP)
+  {
+    const T_DIMSE_N_SetRSP &setRsp = message.msg.NSetRSP;
+    cond = m_responseEncoder.sendResponse(m_assoc, presID, DIMSE_N_SET_RSP, setRsp.MessageIDBeingRespondedTo,
+      setRsp.AffectedSOPClassUID, setRsp.AffectedSOPInstanceUID, setRsp.DimseStatus);
+  }
+  const OFCondition sendCond = m_transportLayer.endMessage();
+  // nothing has been sent if the message cannot be sent from a pre-encoded command set
+  if (cond == EC_IllegalCall)
+    return cond;
+  m_responseSendTime += DcmMetricsRegistry::now() - startTime;
+  traceIO("response send", traceStart);
+  if (cond.good())
+    cond = sendCond;
+  Uint16 messageID;
+  Uint16 status;
+  if (getMessageInfo(message, messageID, status))
+  {
+    m_flightRecorder.setStatus(status);
+    MPPS_PROBE4(response__sent, OFstatic_cast(unsigned int, message.CommandField), messageID, status,
+      cond.good() ? 1 : 0);
+  }
   return cond;
 }
 
@@ -930,8 +1816,13 @@ OFCondition DcmMppsSCP::receiveDIMSEDataset(T_ASC_PresentationContextID *presID,
     return DIMSE_ILLEGALASSOCIATION;
 
   OFCondition cond;
+  const Uint64 startTime = DcmMetricsRegistry::now();
+  const Uint64 traceStart = (m_traceHandlerStart > 0) ? DcmTraceRecorder::now() : 0;
   cond = DIMSE_receiveDataSetInMemory(m_assoc, m_cfg->getDIMSEBlockingMode(), m_cfg->getDIMSETimeout(),
                                         presID, dataObject, NULL /*callback*/, NULL /*callbackData*/);
+  m_datasetReceiveTime += DcmMetricsRegistry::now() - startTime;
+  traceIO("dataset receive", traceStart);
+  MPPS_PROBE2(dataset__receive, *presID, cond.good() ? 1 : 0);
 
   if (cond.good())
   {
@@ -958,6 +1849,8 @@ OFCondition DcmMppsSCP::addPresentationContext(const OFString &abstractSyntax,
                                            const T_ASC_SC_ROLE role,
                                            const OFString &profile)
 {
+  // the cached negotiation results may no longer be valid
+  m_negotiationCache.clear();
   return m_cfg->addPresentationContext(abstractSyntax, xferSyntaxes, role, profile);
 }
 
@@ -1029,7 +1922,164 @@ void DcmMppsSCP::setVerbosePCMode(const OFBool mode)
 
 void DcmMppsSCP::setHostLookupEnabled(const OFBool mode)
 {
-  m_cfg->setHostLookupEnabled(mode);
+  m_hostLookup = mode;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setEventStreamDirectory(const OFString &directory)
+{
+  m_eventStream.setDirectory(directory);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setEventStreamSocket(const OFString &path)
+{
+  m_eventStream.setSocketPath(path);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setEventStreamRetention(const Uint32 seconds)
+{
+  m_eventStream.setRetention(seconds);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setEventStreamArchive(const OFString &directory)
+{
+  m_eventStream.setArchiveDirectory(directory);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setEventStreamCompactionRate(const Uint32 bytesPerSecond)
+{
+  m_eventStream.setCompactionRate(bytesPerSecond);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setEventRingFile(const OFString &filename,
+                                  const Uint32 capacity)
+{
+  m_eventRingFile = filename;
+  m_eventRingCapacity = capacity;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setMetricsPort(const Uint16 port)
+{
+  m_metricsPort = port;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setMetricsSocket(const OFString &path)
+{
+  m_metricsSocket = path;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setTraceDirectory(const OFString &directory)
+{
+  m_trace.setDirectory(directory);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setTraceFormat(const DcmTraceFormat format)
+{
+  m_trace.setFormat(format);
+}
+
+
+void DcmMppsSCP::setFlightRecorder(const OFString &filename,
+                                   const Uint32 capacity)
+{
+  m_flightRecorderFile = filename;
+  m_flightRecorderCapacity = capacity;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setCaptureFile(const OFString &filename)
+{
+  m_captureFile = filename;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setColdStorageDelay(const Uint32 seconds)
+{
+  m_instanceStore.setColdAfter(seconds);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setColdCacheSize(const size_t count)
+{
+  m_instanceStore.setColdCacheSize(count);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setTCPNoDelay(const OFBool noDelay)
+{
+  m_socketOptions.setNoDelay(noDelay);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setSocketBufferSizes(const Uint32 receiveSize,
+                                      const Uint32 sendSize)
+{
+  m_socketOptions.setReceiveBufferSize(receiveSize);
+  m_socketOptions.setSendBufferSize(sendSize);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setListenBacklog(const Uint32 backlog)
+{
+  m_socketOptions.setListenBacklog(backlog);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setTCPKeepAlive(const Uint32 idle,
+                                 const Uint32 interval,
+                                 const Uint32 count)
+{
+  m_socketOptions.setKeepAlive(idle, interval, count);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setTCPUserTimeout(const Uint32 timeout)
+{
+  m_socketOptions.setUserTimeout(timeout);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsSCP::setFastEchoMode(const OFBool mode)
+{
+  m_fastEcho = mode;
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmMppsSCP::setAccessPolicyFile(const OFString &filename)
+{
+  OFCondition cond = m_accessPolicy.load(filename);
+  if (cond.good())
+    m_negotiationCache.clear();
+  return cond;
 }
 
 // ----------------------------------------------------------------------------
@@ -1041,6 +2091,27 @@ Uint32 DcmMppsSCP::getMaxReceivePDULength() const
 
 // ----------------------------------------------------------------------------
 
+Uint64 DcmMppsSCP::getNumberOfReceivedMessages() const
+{
+  return m_receivedMessages;
+}
+
+// ----------------------------------------------------------------------------
+
+Uint64 DcmMppsSCP::getNumberOfReadCalls() const
+{
+  return m_messageReadCalls;
+}
+
+// ----------------------------------------------------------------------------
+
+Uint64 DcmMppsSCP::getNumberOfEchoRequests() const
+{
+  return m_echoRequests;
+}
+
+// ----------------------------------------------------------------------------
+
 Uint16 DcmMppsSCP::getPort() const
 {
   return m_cfg->getPort();
@@ -1106,7 +2177,7 @@ OFBool DcmMppsSCP::getVerbosePCMode() const
 
 OFBool DcmMppsSCP::getHostLookupEnabled() const
 {
-  return m_cfg->getHostLookupEnabled();
+  return m_hostLookup;
 }
 
 // ----------------------------------------------------------------------------
@@ -1161,7 +2232,13 @@ void DcmMppsSCP::dropAndDestroyAssociation()
     notifyAssociationTermination();
     ASC_dropSCPAssociation( m_assoc );
     ASC_destroyAssociation( &m_assoc );
+    m_trace.finish();
+    m_flightRecorder.endAssociation(m_transportLayer.getBytesReceived(), m_transportLayer.getBytesSent());
   }
+  clearPresentationContextTable();
+  // the peer label of the C-ECHO counter belongs to this association
+  m_echoCounter = NULL;
+  m_echoOnly = OFFalse;
 }
 
 
@@ -1174,9 +2251,9 @@ void DcmMppsSCP::notifyAssociationRequest(const T_ASC_Parameters &params,
                                       DcmSCPActionType & /* desiredAction */)
 {
   // Dump some information if required
-  DCMNET_INFO("Association Received " << params.DULparams.callingPresentationAddress << ": "
-                                      << params.DULparams.callingAPTitle << " -> "
-                                      << params.DULparams.calledAPTitle);
+  MPPS_ASSOCIATION_INFO("Association Received " << formatPeerAddress(params.DULparams.callingPresentationAddress) << ": "
+                                                << params.DULparams.callingAPTitle << " -> "
+                                                << params.DULparams.calledAPTitle);
 
     // Dump more information if required
   OFString tempStr;
@@ -1188,24 +2265,24 @@ void DcmMppsSCP::notifyAssociationRequest(const T_ASC_Parameters &params,
 
 // ----------------------------------------------------------------------------
 
-OFBool DcmMppsSCP::checkCalledAETitleAccepted(const OFString& /*calledAETitle*/)
+OFBool DcmMppsSCP::checkCalledAETitleAccepted(const OFString& calledAETitle)
 {
-  return OFTrue;
+  return m_accessPolicy.isCalledAETitleAllowed(calledAETitle);
 }
 
 
 // ----------------------------------------------------------------------------
 
-OFBool DcmMppsSCP::checkCallingAETitleAccepted(const OFString& /*callingAETitle*/)
+OFBool DcmMppsSCP::checkCallingAETitleAccepted(const OFString& callingAETitle)
 {
-  return OFTrue;
+  return m_accessPolicy.isCallingAETitleAllowed(callingAETitle);
 }
 
 // ----------------------------------------------------------------------------
 
-OFBool DcmMppsSCP::checkCallingHostAccepted(const OFString& /*hostOrIP*/)
+OFBool DcmMppsSCP::checkCallingHostAccepted(const OFString& hostOrIP)
 {
-  return OFTrue;
+  return m_accessPolicy.isHostAllowed(hostOrIP);
 }
 
 // ----------------------------------------------------------------------------
@@ -1219,7 +2296,7 @@ void DcmMppsSCP::notifyAssociationAcknowledge()
 
 void DcmMppsSCP::notifyReleaseRequest()
 {
-  DCMNET_INFO("Received Association Release Request");
+  MPPS_ASSOCIATION_INFO("Received Association Release Request");
 }
 
 // ----------------------------------------------------------------------------
@@ -1234,6 +2311,11 @@ void DcmMppsSCP::notifyAbortRequest()
 void DcmMppsSCP::notifyAssociationTermination()
 {
   DCMNET_DEBUG("DcmSCP: Association Terminated");
+  if (m_associationStart > 0)
+  {
+    m_metrics.observe("mpps_association_duration_seconds", getPeerLabel(), DcmMetricsRegistry::now() - m_associationStart);
+    m_associationStart = 0;
+  }
 }
 
 // ----------------------------------------------------------------------------
@@ -30,6 +30,18 @@
 #include "dcmtk/dcmnet/dimse.h"     /* DIMSE network layer */
 #include "dcmtk/dcmnet/scpcfg.h"
 #include "dcmtk/dcmnet/diutil.h"    /* for DCMNET_WARN() */
+#include "dmppsstore.h"             /* for DcmMppsInstanceStore */
+#include "dmppsstrm.h"              /* for DcmMppsEventStream */
+#include "dscprsp.h"                /* for DcmDimseResponseEncoder */
+#include "dscpconn.h"               /* for DcmBufferedTransportLayer */
+#include "dscpneg.h"                /* for DcmNegotiationCache */
+#include "dscpacl.h"                /* for DcmAccessPolicy */
+#include "dscpdns.h"                /* for DcmHostNameResolver */
+#include "dmppsring.h"              /* for DcmMppsEventRing */
+#include "dscpmetr.h"               /* for DcmMetricsRegistry */
+#include "dscptrace.h"              /* for DcmTraceRecorder */
+#include "dscpfrec.h"               /* for DcmFlightRecorder */
+#include "dscpcapt.h"               /* for DcmTrafficCapture */
 
 /** Action codes that can be given to DcmSCP to control behavior during SCP's operation.
  *  Different hooks permit jumping into different phases of SCP operation.
@@ -56,6 +68,8 @@ enum DcmRefuseReasonType
   DCMSCP_CALLED_AE_TITLE_NOT_RECOGNIZED,
   /// Refusing association because of unaccepted calling AE title
   DCMSCP_CALLING_AE_TITLE_NOT_RECOGNIZED,
+  /// Refusing association because the address of the calling host is not allowed
+  DCMSCP_CALLING_HOST_NOT_ALLOWED,
   /// Refusing association because SCP was forced to do so
   DCMSCP_FORCED,
   /// Refusing association because of missing Implementation Class UID
@@ -94,6 +108,9 @@ struct DCMTK_DCMNET_EXPORT DcmPresentationContextInfo
   // Fields "reserved" and "result" not included from DUL_PRESENTATIONCONTEXT
 };
 
+/// Number of possible presentation context IDs (IDs are odd numbers from 1 to 255)
+#define DCMSCP_MAX_PRESENTATION_CONTEXTS 256
+
 /*---------------------*
  *  class declaration  *
  *---------------------*/
@@ -215,8 +232,10 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
   void setVerbosePCMode(const OFBool mode);
 
   /** Enables or disables looking up the host name from a connecting system.
-   *  Note that this sets a GLOBAL flag in DCMTK, i.e. the behavior changes
-   *  for all servers. This should be changed in the future.
+   *  Host names are only used for log output and are resolved by a background
+   *  thread with a cache, so accepting an association never waits for DNS. The
+   *  host name of a peer is thus usually not known for its first association.
+   *  While listening, the lookup in DCMTK (a GLOBAL flag) is always disabled.
    *  @param mode [in] OFTrue, if hostname lookup should be enabled, OFFalse for disabling it.
    */
   void setHostLookupEnabled(const OFBool mode);
@@ -227,6 +246,153 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
   */
   void setCommitWaitTimeout(const Uint32 timeout);
 
+  /** Set the directory the stream of accepted N-CREATE and N-SET requests is written to.
+   *  The stream is opened by listen().
+   *  @param directory [in] The directory (must exist). If empty, no stream is written.
+   */
+  void setEventStreamDirectory(const OFString &directory);
+
+  /** Set the path of the unix domain socket the event stream is served on
+   *  @param path [in] The socket path. If empty, the stream is only written to disk.
+   */
+  void setEventStreamSocket(const OFString &path);
+
+  /** Set the retention of the event stream stored on disk, which makes it a history of
+   *  the MPPS instances. Expired instances are dropped by a background thread.
+   *  @param seconds [in] Time in seconds after the last event of an MPPS instance after
+   *                      which its events are dropped, 0 to keep all events
+   */
+  void setEventStreamRetention(const Uint32 seconds);
+
+  /** Set the directory expired events are moved to instead of being deleted
+   *  @param directory [in] The directory (must exist), empty to delete them
+   */
+  void setEventStreamArchive(const OFString &directory);
+
+  /** Set the limit of the disk I/O used for dropping expired events
+   *  @param bytesPerSecond [in] Maximum number of bytes per second, 0 for unlimited
+   */
+  void setEventStreamCompactionRate(const Uint32 bytesPerSecond);
+
+  /** Set the file a binary record of each handled N-CREATE, N-SET and N-GET request is
+   *  written to (instead of dumping the requests as text). The file is a ring of a
+   *  fixed number of records and is opened by listen(). Use mppsdump to read it.
+   *  @param filename [in] The ring file. If empty, no records are written.
+   *  @param capacity [in] Number of records kept in the ring
+   */
+  void setEventRingFile(const OFString &filename,
+                        const Uint32 capacity = MPPS_RING_DEFAULT_CAPACITY);
+
+  /** Serve counters and latency summaries (per command, SOP class and calling AE
+   *  title) in Prometheus text format on a TCP port of the loopback interface. The
+   *  endpoint is opened by listen().
+   *  @param port [in] The port, 0 for none
+   */
+  void setMetricsPort(const Uint16 port);
+
+  /** Serve counters and latency summaries in Prometheus text format on a unix domain
+   *  socket instead of a TCP port
+   *  @param path [in] The socket path, empty for none
+   */
+  void setMetricsSocket(const OFString &path);
+
+  /** Record the phases of each association (accept, negotiation, each DIMSE command
+   *  with the receipt of its dataset, handling and response, release) as a tree of
+   *  spans and write them to a file per association
+   *  @param directory [in] The directory the trace files are written to, empty for none
+   */
+  void setTraceDirectory(const OFString &directory);
+
+  /** Set the format of the trace files
+   *  @param format [in] Chrome trace-event JSON (default) or OTLP JSON
+   */
+  void setTraceFormat(const DcmTraceFormat format);
+
+  /** Keep the last associations (peer, AE titles, presentation contexts, commands with
+   *  status, timing and byte counts) in memory and write them as text to a file on
+   *  SIGUSR1 and when the process is killed by SIGABRT, SIGSEGV, SIGBUS or SIGFPE.
+   *  The recorder is set up by listen().
+   *  @param filename [in] The file the associations are written to, empty for none
+   *  @param capacity [in] Number of associations kept
+   */
+  void setFlightRecorder(const OFString &filename,
+                         const Uint32 capacity);
+
+  /** Append the PDUs received on each association, with the time of their arrival,
+   *  to a capture file, so the traffic can be replayed later by mppsreplay. The file
+   *  is opened by listen().
+   *  @param filename [in] The capture file, empty for none
+   */
+  void setCaptureFile(const OFString &filename);
+
+  /** Set the time after which completed or discontinued MPPS instances are moved to
+   *  the compressed cold tier of the instance store. Compressed instances are expanded
+   *  again on access.
+   *  @param seconds [in] Delay in seconds after the last modification, 0 for never
+   */
+  void setColdStorageDelay(const Uint32 seconds);
+
+  /** Set the number of cold (i.e. compressed) MPPS instances kept in memory. If the
+   *  event stream is stored on disk, the oldest cold instances beyond this number are
+   *  evicted and restored from the stream when they are requested by N-GET again.
+   *  @param count [in] Number of instances, MPPS_STORE_DEFAULT_COLD_CACHE by default
+   */
+  void setColdCacheSize(const size_t count);
+
+  /** Enable or disable TCP_NODELAY on the sockets of incoming associations. If not
+   *  set, the DCMTK default is used (enabled unless the environment variable
+   *  TCP_NODELAY is "0").
+   *  @param noDelay [in] OFTrue to disable the Nagle algorithm
+   */
+  void setTCPNoDelay(const OFBool noDelay);
+
+  /** Set the socket buffer sizes (SO_RCVBUF/SO_SNDBUF). Applied to the listening
+   *  socket as well, so the TCP window is negotiated with the configured size.
+   *  @param receiveSize [in] Size of the receive buffer in bytes, 0 for the default
+   *  @param sendSize    [in] Size of the send buffer in bytes, 0 for the default
+   */
+  void setSocketBufferSizes(const Uint32 receiveSize,
+                            const Uint32 sendSize);
+
+  /** Set the backlog of the listening socket
+   *  @param backlog [in] Maximum number of pending connections, 0 for the default
+   */
+  void setListenBacklog(const Uint32 backlog);
+
+  /** Enable TCP keepalive on the sockets of incoming associations
+   *  @param idle     [in] Seconds of idleness before the first probe, 0 for the default
+   *  @param interval [in] Seconds between probes, 0 for the default
+   *  @param count    [in] Number of probes before the connection is dropped, 0 for
+   *                       the default
+   */
+  void setTCPKeepAlive(const Uint32 idle,
+                       const Uint32 interval,
+                       const Uint32 count);
+
+  /** Set the maximum time sent data may remain unacknowledged before the connection is
+   *  dropped (TCP_USER_TIMEOUT, if supported by the operating system)
+   *  @param timeout [in] Timeout in milliseconds, 0 for the default
+   */
+  void setTCPUserTimeout(const Uint32 timeout);
+
+  /** Enable or disable the fast path for C-ECHO requests. If enabled (default), C-ECHO
+   *  requests of the Verification SOP Class are answered from a pre-encoded response
+   *  without logging each of them; a summary is logged at most once a minute instead.
+   *  handleECHORequest() is only called if the fast path is disabled, the request
+   *  cannot be answered this way or debug logging is enabled.
+   *  @param mode [in] OFTrue to enable the fast path, OFFalse to disable it
+   */
+  void setFastEchoMode(const OFBool mode);
+
+  /** Load the access policy from a file (see DcmAccessPolicy for the format). The
+   *  address of the peer, the called and the calling AE title of each association
+   *  request are checked against the policy before any negotiation takes place. The
+   *  file is reloaded automatically when modified.
+   *  @param filename [in] The name of the policy file
+   *  @return EC_Normal if successful, an error code otherwise
+   */
+  OFCondition setAccessPolicyFile(const OFString &filename);
+
   /* Get methods for SCP settings */
 
   /** Returns TCP/IP port number SCP listens for new connection requests
@@ -251,6 +417,21 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
    */
   Uint32 getMaxReceivePDULength() const;
 
+  /** Returns the number of DIMSE messages received so far
+   *  @return Number of messages
+   */
+  Uint64 getNumberOfReceivedMessages() const;
+
+  /** Returns the number of recv() calls made for receiving DIMSE messages so far
+   *  @return Number of recv() calls
+   */
+  Uint64 getNumberOfReadCalls() const;
+
+  /** Returns the number of C-ECHO requests answered by the fast path so far
+   *  @return Number of C-ECHO requests
+   */
+  Uint64 getNumberOfEchoRequests() const;
+
   /** Returns whether receiving of TCP/IP connection requests is done in blocking or
    *  unblocking mode
    *  @return DUL_BLOCK if in blocking mode, otherwise DUL_NOBLOCK
@@ -345,6 +526,45 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
                                OFString &abstractSyntax,
                                OFString &transferSyntax);
 
+  /** This call returns the presentation context belonging to the given
+   *  presentation context ID without copying the UIDs.
+   *  @param presID         [in]  The presentation context ID to look for
+   *  @param abstractSyntax [out] The abstract syntax (UID) for that ID, valid as long
+   *                              as the association exists. NULL, if such a
+   *                              presentation context does not exist.
+   *  @param transferSyntax [out] The transfer syntax (UID) for that ID, valid as long
+   *                              as the association exists. NULL, if such a
+   *                              presentation context does not exist.
+   *  @return OFTrue if the presentation context has been accepted, OFFalse otherwise
+   */
+  OFBool findPresentationContext(const T_ASC_PresentationContextID presID,
+                                 const char *&abstractSyntax,
+                                 const char *&transferSyntax) const;
+
+  /** Fill the presentation context table from the accepted presentation contexts of
+   *  the current association. Called once the association has been acknowledged, so
+   *  looking up the presentation context of an incoming command is a single array
+   *  access.
+   */
+  void buildPresentationContextTable();
+
+  /** Add the negotiated presentation contexts of the current association (accepted
+   *  or not) to the flight recorder
+   */
+  void recordPresentationContexts();
+
+  /** Clear the presentation context table, e.g.\ when the association is dropped
+   */
+  void clearPresentationContextTable();
+
+  /** Get the presentation context of an incoming command from the presentation
+   *  context table. The UIDs are only copied if the presentation context differs from
+   *  that of the previous command, and then into the strings already allocated.
+   *  @param presID [in] The presentation context ID of the command
+   *  @return The presentation context, valid until the next call
+   */
+  const DcmPresentationContextInfo &getCommandPresentationContext(const T_ASC_PresentationContextID presID);
+
   /** Aborts the current association by sending an A-ABORT request to the SCU.
    *  This method allows derived classes to abort an association in case of severe errors.
    *  @return status, EC_Normal if successful, an error code otherwise
@@ -372,7 +592,7 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
    *  OFTrue is returned, the AE title is accepted and processing is continued.
    *  In case of OFFalse, the SCP will refuse the incoming association with
    *  error "Called Application Entity Title Not Recognized".
-   *  The standard handler always returns OFTrue.
+   *  The standard handler checks the AE title against the access policy, if any.
    *  @param calledAE The called AE title the SCU used that should be checked
    *  @return OFTrue, if AE title is accepted, OFFalse otherwise
    */
@@ -382,7 +602,7 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
    *  OFTrue is returned, the AE title is accepted and processing is continued.
    *  In case of OFFalse, the SCP will refuse the incoming association with
    *  error "Calling Application Entity Title Not Recognized".
-   *  The standard handler always returns OFTrue.
+   *  The standard handler checks the AE title against the access policy, if any.
    *  @param callingAE The calling AE title the SCU used that should be checked
    *  @return OFTrue, if AE title is accepted, OFFalse otherwise
    */
@@ -392,7 +612,8 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
    *  that this function may also return a hostname instead. If
    *  OFTrue is returned, the IP is accepted and processing is continued.
    *  In case of OFFalse, the SCP will refuse the incoming association with
-   *  an error. The standard handler always returns OFTrue.
+   *  an error. The standard handler checks the numeric address against the access
+   *  policy, if any. This function is called before any other check.
    *  @param hostOrIP The IP of the client to check.
    *  @return OFTrue, if IP/host is accepted, OFFalse otherwise
    */
@@ -444,6 +665,95 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
   virtual OFCondition handleECHORequest(T_DIMSE_C_EchoRQ &reqMessage,
                                         const T_ASC_PresentationContextID presID);
 
+  /** Answer a C-ECHO request from the pre-encoded response, without logging
+   *  @param reqMessage [in] The C-ECHO request message that was received
+   *  @param presID     [in] The presentation context of the request
+   *  @return status, EC_Normal if successful, an error code otherwise. EC_IllegalCall
+   *          if the request cannot be answered this way, in which case nothing has
+   *          been sent.
+   */
+  OFCondition sendFastECHOResponse(const T_DIMSE_C_EchoRQ &reqMessage,
+                                   const T_ASC_PresentationContextID presID);
+
+  /** Log the number of C-ECHO requests answered by the fast path since the last
+   *  summary, unless the last summary is less than a minute old
+   *  @param now [in] The current time
+   */
+  void reportEchoRequests(const time_t now);
+
+  /** Format the address of a peer for log output, adding its host name if already
+   *  resolved. If not, the lookup is started in the background.
+   *  @param address [in] The numeric address of the peer
+   *  @return "hostname (address)" if the host name is known, the address otherwise
+   */
+  OFString formatPeerAddress(const OFString &address);
+
+  /** Stop the host name resolver (if running) and wait for it to terminate
+   */
+  void stopHostNameResolver();
+
+  /** Write a record of a handled request to the event ring (if open)
+   *  @param commandField   [in] Command field of the request
+   *  @param messageID      [in] Message ID of the request
+   *  @param presID         [in] Presentation context ID of the request
+   *  @param sopClassUID    [in] Affected or requested SOP class UID
+   *  @param sopInstanceUID [in] Affected or requested SOP instance UID
+   *  @param status         [in] Status sent in the response
+   *  @param startTime      [in] Time the request was received (microseconds)
+   *  @param streamSequence [in] Sequence number of the event in the event stream, 0 if none
+   *  @param datasetLength  [in] Length of the dataset in the event stream, 0 if none
+   */
+  void recordEvent(const Uint16 commandField,
+                   const Uint16 messageID,
+                   const T_ASC_PresentationContextID presID,
+                   const char *sopClassUID,
+                   const char *sopInstanceUID,
+                   const Uint16 status,
+                   const Uint64 startTime,
+                   const Uint64 streamSequence,
+                   const Uint32 datasetLength);
+
+  /** Add the latencies of a handled request to the metrics
+   *  @param command     [in] Name of the command, e.g.\ "N-CREATE"
+   *  @param sopClassUID [in] Affected or requested SOP class UID
+   *  @param status      [in] Status sent in the response
+   *  @param startTime   [in] Time the request was received (see DcmMetricsRegistry::now())
+   */
+  void recordMetrics(const char *command,
+                     const char *sopClassUID,
+                     const Uint16 status,
+                     const Uint64 startTime);
+
+  /** Returns the label identifying the peer of the current association in the metrics
+   *  @return The label (calling AE title), empty if there is no association
+   */
+  OFString getPeerLabel() const;
+
+  /** Stop the metrics server (if running) and wait for it to terminate
+   */
+  void stopMetricsServer();
+
+  /** Begin the trace span of a received DIMSE command, with the receipt of the command
+   *  as its first part
+   *  @param message      [in] The command received
+   *  @param receiveStart [in] Time the SCP started waiting for the command (see
+   *                           DcmTraceRecorder::now())
+   */
+  void beginCommandTrace(const T_DIMSE_Message &message,
+                         const Uint64 receiveStart);
+
+  /** Add a part of network I/O to the trace span of the current command. The time since
+   *  the previous part is added as handler part.
+   *  @param name      [in] Name of the part
+   *  @param startTime [in] Start of the I/O (see DcmTraceRecorder::now()), 0 if not traced
+   */
+  void traceIO(const char *name,
+               const Uint64 startTime);
+
+  /** End the trace span of the current command (if any)
+   */
+  void endCommandTrace();
+
   // -- N-CREATE --
 
   /** Receive N-CREATE request (and store accompanying dataset in memory).
@@ -496,6 +806,22 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
                                         const T_DIMSE_N_SetRQ &reqMessage,
                                         const Uint16 rspStatusCode);
 
+  // -- N-GET --
+
+  /** Respond to the N-GET request
+   *  @param presID        [in] The presentation context ID to respond to
+   *  @param reqMessage    [in] The N-GET request that should be responded to
+   *  @param rspStatusCode [in] The response status code. 0 means success,
+   *                            others can found in the DICOM standard.
+   *  @param rspDataset    [in] The attribute list to be sent with the response.
+   *                            NULL if no attribute list should be sent.
+   *  @return EC_Normal, if responding was successful, an error code otherwise
+   */
+  virtual OFCondition sendGETResponse(const T_ASC_PresentationContextID presID,
+                                      const T_DIMSE_N_GetRQ &reqMessage,
+                                      const Uint16 rspStatusCode,
+                                      DcmDataset *rspDataset);
+
   /* ********************************************************************* */
   /*  Further functions and member variables                               */
   /* ********************************************************************* */
@@ -574,6 +900,29 @@ class DCMTK_DCMNET_EXPORT DcmMppsSCP
                                DcmDataset *statusDetail = NULL,
                                DcmDataset **commandSet = NULL);
 
+  /** Send a message on the current association, by DIMSE or from a pre-encoded command
+   *  set, and add the time to the response send time and the trace of the current
+   *  request. The status of a response is set in the flight recorder.
+   *  @param presID       [in]  Presentation context ID to be used for message
+   *  @param message      [in]  The message to be sent
+   *  @param dataObject   [in]  The dataset to be sent, NULL if there is none
+   *  @param statusDetail [in]  The status detail of the response, NULL if none
+   *  @param commandSet   [out] If not NULL, returns a copy of the command set sent
+   *  @param preEncoded   [in]  Send the message from a pre-encoded command set (see
+   *                            DcmDimseResponseEncoder). Only possible for C-ECHO,
+   *                            N-CREATE and N-SET responses without dataset;
+   *                            dataObject, statusDetail and commandSet are ignored.
+   *  @return EC_Normal if successful, an error code otherwise. EC_IllegalCall if the
+   *          message cannot be sent from a pre-encoded command set, in which case
+   *          nothing has been sent.
+   */
+  OFCondition sendMessage(const T_ASC_PresentationContextID presID,
+                          T_DIMSE_Message &message,
+                          DcmDataset *dataObject,
+                          DcmDataset *statusDetail,
+                          DcmDataset **commandSet,
+                          const OFBool preEncoded);
+
   /** Receive DIMSE command (excluding dataset!) over the currently open association
    *  @param presID       [out] Contains in the end the ID of the presentation context
    *                            which was specified in the DIMSE command received
@@ -625,6 +974,138 @@ private:
   /// it, e.g. in the context of the DcmSCPPool class.
   DcmSharedSCPConfig m_cfg;
 
+  /** Entry of the presentation context table. The UIDs are not copied but point to
+   *  the strings held by the association parameters, so the table is cleared when the
+   *  association is dropped.
+   */
+  struct PresentationContextEntry
+  {
+    /// Presentation Context ID, 0 if not accepted
+    Uint8 presentationContextID;
+    /// SCP role as proposed from SCU
+    Uint8 proposedSCRole;
+    /// Role accepted by SCP for this Presentation Context
+    Uint8 acceptedSCRole;
+    /// Abstract Syntax name (UID) as proposed by SCU, NULL if not accepted
+    const char *abstractSyntax;
+    /// Transfer Syntax accepted for this Presentation Context (UID), NULL if not accepted
+    const char *acceptedTransferSyntax;
+  };
+
+  /// Accepted presentation contexts of the current association, indexed by ID
+  PresentationContextEntry m_presContexts[DCMSCP_MAX_PRESENTATION_CONTEXTS];
+
+  /// Presentation context of the current command, see getCommandPresentationContext()
+  DcmPresentationContextInfo m_commandPresContext;
+
+  /// MPPS instances created by N-CREATE and modified by N-SET
+  DcmMppsInstanceStore m_instanceStore;
+
+  /// Stream of accepted N-CREATE and N-SET requests
+  DcmMppsEventStream m_eventStream;
+
+  /// Binary records of the handled requests
+  DcmMppsEventRing m_eventRing;
+
+  /// File of the event ring, empty if not written
+  OFString m_eventRingFile;
+
+  /// Number of records kept in the event ring
+  Uint32 m_eventRingCapacity;
+
+  /// Encoder for N-CREATE and N-SET responses
+  DcmDimseResponseEncoder m_responseEncoder;
+
+  /// Transport layer reading incoming PDUs through a receive buffer
+  DcmBufferedTransportLayer m_transportLayer;
+
+  /// Options applied to the listening socket and the sockets of incoming associations
+  DcmSocketOptions m_socketOptions;
+
+  /// Results of earlier association negotiations
+  DcmNegotiationCache m_negotiationCache;
+
+  /// Access policy for the admission of associations
+  DcmAccessPolicy m_accessPolicy;
+
+  /// Flag indicating whether host names of peers are looked up
+  OFBool m_hostLookup;
+
+  /// Background lookup of host names of peers, NULL if not running
+  DcmHostNameResolver *m_hostNameResolver;
+
+  /// Counters and latency histograms
+  DcmMetricsRegistry m_metrics;
+
+  /// Thread serving the metrics, NULL if not running
+  DcmMetricsServer *m_metricsServer;
+
+  /// TCP port the metrics are served on, 0 if none
+  Uint16 m_metricsPort;
+
+  /// Unix domain socket the metrics are served on, empty if none
+  OFString m_metricsSocket;
+
+  /// Time the current association was received (see DcmMetricsRegistry::now()), 0 if refused
+  Uint64 m_associationStart;
+
+  /// Time spent receiving datasets for the current request in microseconds
+  Uint64 m_datasetReceiveTime;
+
+  /// Time spent sending the response to the current request in microseconds
+  Uint64 m_responseSendTime;
+
+  /// Spans of the current association
+  DcmTraceRecorder m_trace;
+
+  /// Span of the current DIMSE command, SCP_TRACE_NO_SPAN if none
+  size_t m_traceCommand;
+
+  /// End of the last traced part of the current command, 0 if none
+  Uint64 m_traceHandlerStart;
+
+  /// Last associations, dumped on signals
+  DcmFlightRecorder m_flightRecorder;
+
+  /// File the flight recorder is dumped to, empty if disabled
+  OFString m_flightRecorderFile;
+
+  /// Number of associations kept by the flight recorder
+  Uint32 m_flightRecorderCapacity;
+
+  /// Capture of the PDUs received
+  DcmTrafficCapture m_capture;
+
+  /// File the PDUs received are captured to, empty if disabled
+  OFString m_captureFile;
+
+  /// Number of DIMSE messages received
+  Uint64 m_receivedMessages;
+
+  /// Number of recv() calls made for receiving these messages
+  Uint64 m_messageReadCalls;
+
+  /// Flag indicating whether C-ECHO requests are answered by the fast path
+  OFBool m_fastEcho;
+
+  /// Number of C-ECHO requests answered by the fast path
+  Uint64 m_echoRequests;
+
+  /// Number of these requests already included in a summary
+  Uint64 m_echoRequestsReported;
+
+  /// Time of the last summary of C-ECHO requests
+  time_t m_echoReportTime;
+
+  /// Counter of successful C-ECHO requests of the current association, NULL until the first one
+  volatile Uint64 *m_echoCounter;
+
+  /// SOP class UID of the requests counted by m_echoCounter
+  DIC_UI m_echoSOPClassUID;
+
+  /// Flag indicating whether the current association only proposes the Verification SOP class
+  OFBool m_echoOnly;
+
   /** Drops association and clears internal structures to free memory
    */
   void dropAndDestroyAssociation();
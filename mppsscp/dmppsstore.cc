@@ -0,0 +1,978 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: In-memory store of MPPS instances created by N-CREATE and
+ *           modified by N-SET
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dmppsstore.h"
+#include "dcmtk/dcmdata/dcostrmb.h"
+#include "dcmtk/dcmdata/dcistrmb.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTRING
+#include "dcmtk/ofstd/ofstdinc.h"
+
+#ifdef WITH_ZLIB
+BEGIN_EXTERN_C
+#include <zlib.h>
+END_EXTERN_C
+#endif
+
+// transfer syntax used for the encoded attribute blocks
+#define MPPS_STORE_XFER EXS_LittleEndianExplicit
+
+// initial size of the buffer holding the encoded attribute blocks
+#define MPPS_STORE_INITIAL_CAPACITY 4096
+
+// maximum number of instances compressed per call of ageInstances()
+#define MPPS_STORE_MAX_COMPRESS_PER_CALL 16
+
+// number of samples used for training the compression dictionary
+#define MPPS_DICT_SAMPLES 32
+
+// maximum size of the compression dictionary (zlib window size)
+#define MPPS_DICT_MAX_LENGTH 32768
+
+// longer attribute blocks only contribute their first bytes to the dictionary
+#define MPPS_DICT_MAX_FRAGMENT 256
+
+
+// implementation of the compression dictionary
+
+DcmMppsCompressionDictionary::DcmMppsCompressionDictionary()
+  : m_fragments()
+  , m_samples(0)
+  , m_data()
+{
+}
+
+
+void DcmMppsCompressionDictionary::addBlock(const Uint8 *data,
+                                            const Uint32 length)
+{
+  if (isReady())
+    return;
+  const Uint32 fragmentLength = (length > MPPS_DICT_MAX_FRAGMENT) ? MPPS_DICT_MAX_FRAGMENT : length;
+  const OFString fragment(OFreinterpret_cast(const char *, data), fragmentLength);
+  OFMap<OFString, Uint32>::iterator it = m_fragments.find(fragment);
+  if (it == m_fragments.end())
+    m_fragments[fragment] = 1;
+  else
+    ++(*it).second;
+}
+
+
+void DcmMppsCompressionDictionary::endSample()
+{
+  if (isReady())
+    return;
+  if (++m_samples >= MPPS_DICT_SAMPLES)
+    build();
+}
+
+
+OFBool DcmMppsCompressionDictionary::isReady() const
+{
+  return !m_data.empty();
+}
+
+
+const Uint8 *DcmMppsCompressionDictionary::getData() const
+{
+  return m_data.empty() ? NULL : &m_data[0];
+}
+
+
+Uint32 DcmMppsCompressionDictionary::getLength() const
+{
+  return OFstatic_cast(Uint32, m_data.size());
+}
+
+
+void DcmMppsCompressionDictionary::build()
+{
+  // rate each fragment seen more than once by the number of bytes it could save
+  OFVector<Uint32> scores;
+  OFVector<const OFString *> fragments;
+  OFMap<OFString, Uint32>::const_iterator it = m_fragments.begin();
+  while (it != m_fragments.end())
+  {
+    if ((*it).second > 1)
+    {
+      const Uint32 score = (*it).second * OFstatic_cast(Uint32, (*it).first.length());
+      // insertion sort, ascending by score
+      size_t j = scores.size();
+      scores.push_back(score);
+      fragments.push_back(&(*it).first);
+      while ((j > 0) && (scores[j - 1] > score))
+      {
+        scores[j] = scores[j - 1];
+        fragments[j] = fragments[j - 1];
+        --j;
+      }
+      scores[j] = score;
+      fragments[j] = &(*it).first;
+    }
+    ++it;
+  }
+
+  // take the best fragments that fit, and put the best ones at the end
+  size_t first = fragments.size();
+  size_t length = 0;
+  while ((first > 0) && (length + fragments[first - 1]->length() <= MPPS_DICT_MAX_LENGTH))
+  {
+    --first;
+    length += fragments[first]->length();
+  }
+  for (size_t i = first; i < fragments.size(); ++i)
+  {
+    const Uint8 *data = OFreinterpret_cast(const Uint8 *, fragments[i]->data());
+    m_data.insert(m_data.end(), data, data + fragments[i]->length());
+  }
+  DCMNET_DEBUG("built MPPS compression dictionary from " << m_samples << " samples ("
+    << (fragments.size() - first) << " fragments, " << m_data.size() << " bytes)");
+  m_fragments.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+
+// implementation of a single instance
+
+DcmMppsInstance::DcmMppsInstance(const OFString &sopClassUID,
+                                 const OFString &sopInstanceUID)
+  : m_sopClassUID(sopClassUID)
+  , m_sopInstanceUID(sopInstanceUID)
+  , m_status()
+  , m_lastModified(0)
+  , m_firstHistoryRecord(0)
+  , m_lastHistoryRecord(0)
+  , m_blocks()
+  , m_buffer(NULL)
+  , m_used(0)
+  , m_capacity(0)
+  , m_garbage(0)
+  , m_compressed(NULL)
+  , m_compressedLength(0)
+  , m_dictionary(NULL)
+{
+}
+
+
+DcmMppsInstance::~DcmMppsInstance()
+{
+  delete[] m_buffer;
+  delete[] m_compressed;
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmMppsInstance::create(DcmDataset &dataset,
+                                    OFVector<Uint8> &buffer)
+{
+  // forget about any previous content (but keep the buffer)
+  delete[] m_compressed;
+  m_compressed = NULL;
+  m_compressedLength = 0;
+  m_dictionary = NULL;
+  m_blocks.clear();
+  m_used = 0;
+  m_garbage = 0;
+  m_status.clear();
+  return merge(dataset, buffer);
+}
+
+
+OFCondition DcmMppsInstance::merge(DcmDataset &modificationList,
+                                   OFVector<Uint8> &buffer)
+{
+  // encode all attributes before touching the blocks, so that a failed N-SET leaves
+  // the instance as it was
+  OFVector<AttributeBlock> encoded;
+  OFCondition cond = encodeElements(modificationList, buffer, encoded);
+  // modifying a compressed instance requires the attribute blocks to be expanded first
+  if (cond.good())
+    cond = expand();
+  if (cond.good())
+  {
+    // only the top-level attributes of the modification list are touched, all other
+    // blocks stay as they are (N-SET replaces sequences as a whole, see PS3.4 F.7.2.2)
+    for (size_t i = 0; i < encoded.size(); ++i)
+      putBlock(encoded[i].tag, &buffer[encoded[i].offset], encoded[i].length);
+    updateStatus(modificationList);
+    m_lastModified = time(NULL);
+    // get rid of replaced blocks if they occupy more than half of the buffer
+    if (m_garbage > m_used / 2)
+      compact();
+  }
+  return cond;
+}
+
+
+OFCondition DcmMppsInstance::getDataset(DcmDataset &dataset,
+                                        OFVector<Uint8> &buffer) const
+{
+  if (m_blocks.empty())
+    return EC_Normal;
+  const Uint32 length = getEncodedLength();
+  if (m_compressed != NULL)
+  {
+    // the compressed image holds the blocks in tag order already
+    OFCondition cond = decompress(buffer);
+    if (cond.bad())
+      return cond;
+  } else {
+    // collect the blocks in tag order, so they can be parsed in a single pass
+    if (buffer.size() < length)
+      buffer.resize(length);
+    Uint32 offset = 0;
+    for (size_t i = 0; i < m_blocks.size(); ++i)
+    {
+      memcpy(&buffer[offset], m_buffer + m_blocks[i].offset, m_blocks[i].length);
+      offset += m_blocks[i].length;
+    }
+  }
+  return decodeBlocks(&buffer[0], length, dataset);
+}
+
+
+OFCondition DcmMppsInstance::getAttributes(const Uint32 *tags,
+                                           const size_t count,
+                                           DcmDataset &dataset,
+                                           OFVector<Uint8> &buffer,
+                                           OFVector<Uint32> &missing) const
+{
+  // if compressed, the image is inflated to the beginning of the scratch buffer and
+  // the requested blocks are collected behind it
+  Uint32 base = 0;
+  if (m_compressed != NULL)
+  {
+    OFCondition cond = decompress(buffer);
+    if (cond.bad())
+      return cond;
+    base = getEncodedLength();
+  }
+
+  // collect the requested blocks (in tag order) into the scratch buffer
+  Uint32 length = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    // ignore attributes requested more than once
+    if ((i > 0) && (tags[i] == tags[i - 1]))
+      continue;
+    OFBool found = OFFalse;
+    const size_t index = findBlock(tags[i], found);
+    if (!found)
+    {
+      missing.push_back(tags[i]);
+      continue;
+    }
+    const AttributeBlock &block = m_blocks[index];
+    if (buffer.size() < base + length + block.length)
+      buffer.resize(base + length + block.length);
+    const Uint8 *image = (m_compressed != NULL) ? &buffer[0] : m_buffer;
+    memcpy(&buffer[base + length], image + block.offset, block.length);
+    length += block.length;
+  }
+  if (length == 0)
+    return EC_Normal;
+  return decodeBlocks(&buffer[base], length, dataset);
+}
+
+
+OFCondition DcmMppsInstance::compress(const DcmMppsCompressionDictionary *dictionary,
+                                      OFVector<Uint8> &buffer)
+{
+#ifdef WITH_ZLIB
+  if ((m_compressed != NULL) || m_blocks.empty())
+    return EC_Normal;
+  // the image must hold the blocks in tag order without gaps
+  compact();
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+    return EC_MemoryExhausted;
+  const OFBool useDictionary = (dictionary != NULL) && dictionary->isReady();
+  if (useDictionary)
+    deflateSetDictionary(&stream, dictionary->getData(), dictionary->getLength());
+  const uLong bound = deflateBound(&stream, m_used);
+  if (buffer.size() < bound)
+    buffer.resize(bound);
+  stream.next_in = m_buffer;
+  stream.avail_in = m_used;
+  stream.next_out = &buffer[0];
+  stream.avail_out = OFstatic_cast(uInt, bound);
+  const int result = deflate(&stream, Z_FINISH);
+  const Uint32 compressedLength = OFstatic_cast(Uint32, stream.total_out);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END)
+  {
+    DCMNET_ERROR("cannot compress MPPS instance " << m_sopInstanceUID << " (zlib error " << result << ")");
+    return EC_CorruptedData;
+  }
+
+  m_compressed = new Uint8[compressedLength];
+  memcpy(m_compressed, &buffer[0], compressedLength);
+  m_compressedLength = compressedLength;
+  m_dictionary = useDictionary ? dictionary : NULL;
+  DCMNET_DEBUG("compressed MPPS instance " << m_sopInstanceUID << " from " << m_used
+    << " to " << compressedLength << " bytes" << (useDictionary ? " (with dictionary)" : ""));
+  delete[] m_buffer;
+  m_buffer = NULL;
+  m_capacity = 0;
+#else
+  (void) dictionary;
+  (void) buffer;
+#endif
+  return EC_Normal;
+}
+
+
+OFBool DcmMppsInstance::isCompressed() const
+{
+  return (m_compressed != NULL);
+}
+
+
+void DcmMppsInstance::addToDictionary(DcmMppsCompressionDictionary &dictionary) const
+{
+  if (m_compressed != NULL)
+    return;
+  for (size_t i = 0; i < m_blocks.size(); ++i)
+    dictionary.addBlock(m_buffer + m_blocks[i].offset, m_blocks[i].length);
+  dictionary.endSample();
+}
+
+// ----------------------------------------------------------------------------
+
+const OFString &DcmMppsInstance::getSOPClassUID() const
+{
+  return m_sopClassUID;
+}
+
+
+const OFString &DcmMppsInstance::getSOPInstanceUID() const
+{
+  return m_sopInstanceUID;
+}
+
+
+const OFString &DcmMppsInstance::getPerformedProcedureStepStatus() const
+{
+  return m_status;
+}
+
+
+OFBool DcmMppsInstance::isFinal() const
+{
+  return (m_status == "COMPLETED") || (m_status == "DISCONTINUED");
+}
+
+
+time_t DcmMppsInstance::getLastModified() const
+{
+  return m_lastModified;
+}
+
+
+void DcmMppsInstance::addHistoryRecord(const Uint64 sequence)
+{
+  if (m_firstHistoryRecord == 0)
+    m_firstHistoryRecord = sequence;
+  m_lastHistoryRecord = sequence;
+}
+
+
+Uint64 DcmMppsInstance::getFirstHistoryRecord() const
+{
+  return m_firstHistoryRecord;
+}
+
+
+Uint64 DcmMppsInstance::getLastHistoryRecord() const
+{
+  return m_lastHistoryRecord;
+}
+
+
+Uint32 DcmMppsInstance::getEncodedLength() const
+{
+  return m_used - m_garbage;
+}
+
+
+size_t DcmMppsInstance::getNumberOfAttributes() const
+{
+  return m_blocks.size();
+}
+
+
+Uint32 DcmMppsInstance::getStoredLength() const
+{
+  return (m_compressed != NULL) ? m_compressedLength : m_capacity;
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmMppsInstance::encodeElements(DcmDataset &dataset,
+                                            OFVector<Uint8> &buffer,
+                                            OFVector<AttributeBlock> &blocks) const
+{
+  Uint32 offset = 0;
+  DcmObject *object = NULL;
+  while ((object = dataset.nextInContainer(object)) != NULL)
+  {
+    // group length elements are not stored, they are recalculated when needed
+    if (object->getETag() == 0)
+      continue;
+    DcmElement *element = OFstatic_cast(DcmElement *, object);
+    const DcmTagKey key = element->getTag();
+    AttributeBlock block;
+    block.tag = (OFstatic_cast(Uint32, key.getGroup()) << 16) | key.getElement();
+    block.offset = offset;
+    block.length = element->calcElementLength(MPPS_STORE_XFER, EET_ExplicitLength);
+    if (buffer.size() < offset + block.length)
+      buffer.resize(offset + block.length);
+
+    DcmOutputBufferStream stream(&buffer[offset], block.length);
+    element->transferInit();
+    OFCondition cond = element->write(stream, MPPS_STORE_XFER, EET_ExplicitLength, NULL /* wcache */);
+    element->transferEnd();
+    if (cond.bad())
+    {
+      DCMNET_ERROR("cannot encode attribute " << key << " of MPPS instance " << m_sopInstanceUID
+        << ": " << cond.text());
+      return cond;
+    }
+    blocks.push_back(block);
+    offset += block.length;
+  }
+  return EC_Normal;
+}
+
+
+void DcmMppsInstance::putBlock(const Uint32 tag,
+                               const Uint8 *data,
+                               const Uint32 length)
+{
+  OFBool found = OFFalse;
+  const size_t index = findBlock(tag, found);
+  if (found && (length <= m_blocks[index].length))
+  {
+    // the new value fits into the old block, overwrite it in place
+    memcpy(m_buffer + m_blocks[index].offset, data, length);
+    m_garbage += m_blocks[index].length - length;
+    m_blocks[index].length = length;
+    return;
+  }
+
+  // append a new block (the old one, if any, becomes unused)
+  reserve(length);
+  memcpy(m_buffer + m_used, data, length);
+  if (found)
+  {
+    m_garbage += m_blocks[index].length;
+    m_blocks[index].offset = m_used;
+    m_blocks[index].length = length;
+  } else {
+    AttributeBlock block;
+    block.tag = tag;
+    block.offset = m_used;
+    block.length = length;
+    m_blocks.insert(m_blocks.begin() + index, block);
+  }
+  m_used += length;
+}
+
+
+size_t DcmMppsInstance::findBlock(const Uint32 tag, OFBool &found) const
+{
+  // binary search in the offset table
+  size_t lower = 0;
+  size_t upper = m_blocks.size();
+  while (lower < upper)
+  {
+    const size_t middle = lower + (upper - lower) / 2;
+    if (m_blocks[middle].tag < tag)
+      lower = middle + 1;
+    else
+      upper = middle;
+  }
+  found = (lower < m_blocks.size()) && (m_blocks[lower].tag == tag);
+  return lower;
+}
+
+
+void DcmMppsInstance::reserve(const Uint32 length)
+{
+  if (m_used + length <= m_capacity)
+    return;
+  Uint32 capacity = (m_capacity > 0) ? m_capacity : MPPS_STORE_INITIAL_CAPACITY;
+  while (capacity < m_used + length)
+    capacity *= 2;
+  Uint8 *buffer = new Uint8[capacity];
+  if (m_used > 0)
+    memcpy(buffer, m_buffer, m_used);
+  delete[] m_buffer;
+  m_buffer = buffer;
+  m_capacity = capacity;
+}
+
+
+void DcmMppsInstance::compact()
+{
+  const Uint32 length = getEncodedLength();
+  Uint8 *buffer = new Uint8[m_capacity];
+  Uint32 offset = 0;
+  for (size_t i = 0; i < m_blocks.size(); ++i)
+  {
+    memcpy(buffer + offset, m_buffer + m_blocks[i].offset, m_blocks[i].length);
+    m_blocks[i].offset = offset;
+    offset += m_blocks[i].length;
+  }
+  delete[] m_buffer;
+  m_buffer = buffer;
+  m_used = length;
+  m_garbage = 0;
+}
+
+
+OFCondition DcmMppsInstance::decompress(OFVector<Uint8> &buffer) const
+{
+#ifdef WITH_ZLIB
+  const Uint32 length = getEncodedLength();
+  if (buffer.size() < length)
+    buffer.resize(length);
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK)
+    return EC_MemoryExhausted;
+  stream.next_in = m_compressed;
+  stream.avail_in = m_compressedLength;
+  stream.next_out = &buffer[0];
+  stream.avail_out = length;
+  int result = inflate(&stream, Z_FINISH);
+  if ((result == Z_NEED_DICT) && (m_dictionary != NULL))
+  {
+    inflateSetDictionary(&stream, m_dictionary->getData(), m_dictionary->getLength());
+    result = inflate(&stream, Z_FINISH);
+  }
+  const Uint32 inflatedLength = OFstatic_cast(Uint32, stream.total_out);
+  inflateEnd(&stream);
+  if ((result != Z_STREAM_END) || (inflatedLength != length))
+  {
+    DCMNET_ERROR("cannot decompress MPPS instance " << m_sopInstanceUID << " (zlib error " << result << ")");
+    return EC_CorruptedData;
+  }
+  return EC_Normal;
+#else
+  (void) buffer;
+  return EC_IllegalCall;
+#endif
+}
+
+
+OFCondition DcmMppsInstance::expand()
+{
+  if (m_compressed == NULL)
+    return EC_Normal;
+  OFVector<Uint8> buffer;
+  OFCondition cond = decompress(buffer);
+  if (cond.bad())
+    return cond;
+  m_capacity = MPPS_STORE_INITIAL_CAPACITY;
+  while (m_capacity < m_used)
+    m_capacity *= 2;
+  m_buffer = new Uint8[m_capacity];
+  memcpy(m_buffer, &buffer[0], m_used);
+  delete[] m_compressed;
+  m_compressed = NULL;
+  m_compressedLength = 0;
+  m_dictionary = NULL;
+  return EC_Normal;
+}
+
+
+OFCondition DcmMppsInstance::decodeBlocks(const Uint8 *data,
+                                          const Uint32 length,
+                                          DcmDataset &dataset)
+{
+  DcmInputBufferStream stream;
+  stream.setBuffer(data, length);
+  stream.setEos();
+  dataset.transferInit();
+  OFCondition cond = dataset.read(stream, MPPS_STORE_XFER, EGL_noChange);
+  dataset.transferEnd();
+  return cond;
+}
+
+
+void DcmMppsInstance::updateStatus(DcmDataset &dataset)
+{
+  OFString status;
+  if (dataset.findAndGetOFString(DCM_PerformedProcedureStepStatus, status).good())
+    m_status = status;
+}
+
+// ----------------------------------------------------------------------------
+
+// implementation of the instance store
+
+DcmMppsInstanceStore::DcmMppsInstanceStore()
+  : m_instances()
+  , m_tags()
+  , m_buffer()
+  , m_coldAfter(0)
+  , m_finalInstances()
+  , m_dictionary()
+  , m_history(NULL)
+  , m_retention(0)
+  , m_coldCacheSize(MPPS_STORE_DEFAULT_COLD_CACHE)
+  , m_coldInstances()
+  , m_evicted()
+  , m_evictionOrder()
+{
+}
+
+
+DcmMppsInstanceStore::~DcmMppsInstanceStore()
+{
+  OFMap<OFString, DcmMppsInstance *>::iterator it = m_instances.begin();
+  while (it != m_instances.end())
+  {
+    delete (*it).second;
+    ++it;
+  }
+  m_instances.clear();
+}
+
+
+OFCondition DcmMppsInstanceStore::createInstance(const OFString &sopClassUID,
+                                                 const OFString &sopInstanceUID,
+                                                 DcmDataset &dataset)
+{
+  if ((m_instances.find(sopInstanceUID) != m_instances.end()) || (m_evicted.find(sopInstanceUID) != m_evicted.end()))
+    return MPPS_EC_DuplicateSOPInstance;
+
+  DcmMppsInstance *instance = new DcmMppsInstance(sopClassUID, sopInstanceUID);
+  OFCondition cond = instance->create(dataset, m_buffer);
+  if (cond.good())
+  {
+    m_instances[sopInstanceUID] = instance;
+    DCMNET_DEBUG("stored MPPS instance " << sopInstanceUID << " (" << instance->getNumberOfAttributes()
+      << " attributes, " << instance->getEncodedLength() << " bytes)");
+    // instances may be created in a final state, e.g. when uploaded afterwards
+    if (instance->isFinal())
+      addFinalInstance(*instance);
+  } else
+    delete instance;
+  return cond;
+}
+
+
+OFCondition DcmMppsInstanceStore::setInstance(const OFString &sopInstanceUID,
+                                              DcmDataset &modificationList)
+{
+  DcmMppsInstance *instance = findInstance(sopInstanceUID);
+  if (instance == NULL)
+  {
+    // only final instances are evicted, so there is no need to restore them
+    if (m_evicted.find(sopInstanceUID) != m_evicted.end())
+      return MPPS_EC_InstanceFinalized;
+    return MPPS_EC_NoSuchSOPInstance;
+  }
+  if (instance->isFinal())
+    return MPPS_EC_InstanceFinalized;
+
+  OFCondition cond = instance->merge(modificationList, m_buffer);
+  if (cond.good())
+  {
+    DCMNET_DEBUG("updated MPPS instance " << sopInstanceUID << " (status "
+      << instance->getPerformedProcedureStepStatus() << ", " << instance->getEncodedLength() << " bytes)");
+    if (instance->isFinal())
+      addFinalInstance(*instance);
+  }
+  return cond;
+}
+
+
+OFCondition DcmMppsInstanceStore::getInstance(const OFString &sopInstanceUID,
+                                              const Uint16 *tagList,
+                                              const size_t tagCount,
+                                              DcmDataset &dataset,
+                                              OFVector<Uint32> &missing)
+{
+  DcmMppsInstance *instance = findInstance(sopInstanceUID);
+  if (instance == NULL)
+  {
+    // evicted instances are restored from the history
+    OFMap<OFString, EvictedInstance>::iterator it = m_evicted.find(sopInstanceUID);
+    if (it == m_evicted.end())
+      return MPPS_EC_NoSuchSOPInstance;
+    OFCondition cond = restoreInstance(sopInstanceUID, (*it).second, instance);
+    if (cond == MPPS_EC_NoSuchSOPInstance)
+    {
+      DCMNET_DEBUG("MPPS instance " << sopInstanceUID << " has been dropped from the history");
+      m_evicted.erase(it);
+    }
+    if (cond.bad())
+      return cond;
+  }
+  // an empty attribute identifier list means "all attributes"
+  if (tagCount == 0)
+    return instance->getDataset(dataset, m_buffer);
+
+  // convert the list to the key used in the offset table and sort it
+  m_tags.clear();
+  for (size_t i = 0; i < tagCount; ++i)
+  {
+    const Uint32 tag = (OFstatic_cast(Uint32, tagList[2 * i]) << 16) | tagList[2 * i + 1];
+    size_t j = m_tags.size();
+    m_tags.push_back(tag);
+    while ((j > 0) && (m_tags[j - 1] > tag))
+    {
+      m_tags[j] = m_tags[j - 1];
+      --j;
+    }
+    m_tags[j] = tag;
+  }
+  return instance->getAttributes(&m_tags[0], m_tags.size(), dataset, m_buffer, missing);
+}
+
+
+DcmMppsInstance *DcmMppsInstanceStore::findInstance(const OFString &sopInstanceUID)
+{
+  OFMap<OFString, DcmMppsInstance *>::iterator it = m_instances.find(sopInstanceUID);
+  if (it == m_instances.end())
+    return NULL;
+  return (*it).second;
+}
+
+
+size_t DcmMppsInstanceStore::getNumberOfInstances() const
+{
+  return m_instances.size();
+}
+
+
+size_t DcmMppsInstanceStore::getNumberOfEvictedInstances() const
+{
+  return m_evicted.size();
+}
+
+
+void DcmMppsInstanceStore::setColdAfter(const Uint32 seconds)
+{
+  m_coldAfter = seconds;
+}
+
+
+Uint32 DcmMppsInstanceStore::getColdAfter() const
+{
+  return m_coldAfter;
+}
+
+
+void DcmMppsInstanceStore::setHistory(DcmMppsSegmentLog *log,
+                                      const Uint32 retention)
+{
+  m_history = log;
+  m_retention = retention;
+}
+
+
+void DcmMppsInstanceStore::addHistoryRecord(const OFString &sopInstanceUID,
+                                            const Uint64 sequence)
+{
+  DcmMppsInstance *instance = findInstance(sopInstanceUID);
+  if (instance != NULL)
+    instance->addHistoryRecord(sequence);
+}
+
+
+void DcmMppsInstanceStore::setColdCacheSize(const size_t count)
+{
+  m_coldCacheSize = count;
+}
+
+
+size_t DcmMppsInstanceStore::getColdCacheSize() const
+{
+  return m_coldCacheSize;
+}
+
+
+void DcmMppsInstanceStore::ageInstances(const time_t now)
+{
+  size_t compressed = 0;
+  while (!m_finalInstances.empty() && (compressed < MPPS_STORE_MAX_COMPRESS_PER_CALL))
+  {
+    const FinalInstance &entry = m_finalInstances.front();
+    if (entry.finalized + OFstatic_cast(time_t, m_coldAfter) > now)
+      break;
+    DcmMppsInstance *instance = findInstance(entry.sopInstanceUID);
+    if ((instance != NULL) && instance->isFinal())
+    {
+      if (!instance->isCompressed())
+      {
+        instance->compress(&m_dictionary, m_buffer);
+        ++compressed;
+      }
+      // only instances recorded in the history can be evicted and restored later
+      if (instance->getFirstHistoryRecord() > 0)
+        m_coldInstances.push_back(entry.sopInstanceUID);
+    }
+    m_finalInstances.pop_front();
+  }
+  evictInstances(now);
+}
+
+
+void DcmMppsInstanceStore::addFinalInstance(const DcmMppsInstance &instance)
+{
+  if (m_coldAfter == 0)
+    return;
+  // final instances are the ones that get compressed, so they are the samples to train on
+  if (!m_dictionary.isReady())
+    instance.addToDictionary(m_dictionary);
+  FinalInstance entry;
+  entry.finalized = instance.getLastModified();
+  entry.sopInstanceUID = instance.getSOPInstanceUID();
+  m_finalInstances.push_back(entry);
+}
+
+
+void DcmMppsInstanceStore::evictInstances(const time_t now)
+{
+  if (m_history == NULL)
+    return;
+  while (m_coldInstances.size() > m_coldCacheSize)
+  {
+    const OFString sopInstanceUID = m_coldInstances.front();
+    m_coldInstances.pop_front();
+    OFMap<OFString, DcmMppsInstance *>::iterator it = m_instances.find(sopInstanceUID);
+    if (it == m_instances.end())
+      continue;
+    DcmMppsInstance *instance = (*it).second;
+    // instances restored before are still in the index
+    if (m_evicted.find(sopInstanceUID) == m_evicted.end())
+    {
+      EvictedInstance entry;
+      entry.firstRecord = instance->getFirstHistoryRecord();
+      entry.lastRecord = instance->getLastHistoryRecord();
+      entry.lastModified = instance->getLastModified();
+      m_evicted[sopInstanceUID] = entry;
+      m_evictionOrder.push_back(sopInstanceUID);
+    }
+    DCMNET_DEBUG("evicted MPPS instance " << sopInstanceUID << " (records " << instance->getFirstHistoryRecord()
+      << " to " << instance->getLastHistoryRecord() << " in the history)");
+    m_instances.erase(it);
+    delete instance;
+  }
+
+  // instances whose retention has expired are (about to be) dropped from the history
+  if (m_retention == 0)
+    return;
+  while (!m_evictionOrder.empty())
+  {
+    OFMap<OFString, EvictedInstance>::iterator it = m_evicted.find(m_evictionOrder.front());
+    if (it != m_evicted.end())
+    {
+      if ((*it).second.lastModified + OFstatic_cast(time_t, m_retention) > now)
+        break;
+      // an instance restored in the meantime goes as well
+      OFMap<OFString, DcmMppsInstance *>::iterator instance = m_instances.find((*it).first);
+      if (instance != m_instances.end())
+      {
+        delete (*instance).second;
+        m_instances.erase(instance);
+      }
+      m_evicted.erase(it);
+    }
+    m_evictionOrder.pop_front();
+  }
+}
+
+
+OFCondition DcmMppsInstanceStore::restoreInstance(const OFString &sopInstanceUID,
+                                                  const EvictedInstance &entry,
+                                                  DcmMppsInstance *&instance)
+{
+  instance = NULL;
+  if ((m_history == NULL) || !m_history->isOpen())
+    return MPPS_EC_StreamError;
+  OFVector<Uint64> segments;
+  OFCondition cond = DcmMppsSegmentLog::listSegments(m_history->getDirectory(), segments);
+  if (cond.bad())
+    return cond;
+  // the segment files are named after the first sequence number they contain, start
+  // with the last one not beyond the first record of the instance
+  size_t i = 0;
+  while ((i + 1 < segments.size()) && (segments[i + 1] <= entry.firstRecord))
+    ++i;
+
+  DcmMppsInstance *restored = NULL;
+  DcmMppsSegmentReader reader;
+  DcmMppsRecord record;
+  OFBool done = OFFalse;
+  while ((i < segments.size()) && (segments[i] <= entry.lastRecord) && !done && cond.good())
+  {
+    cond = reader.open(DcmMppsSegmentLog::getSegmentFilename(m_history->getDirectory(), segments[i]));
+    while (cond.good() && !done && (cond = reader.readRecord(record)).good())
+    {
+      if (record.sequence > entry.lastRecord)
+        done = OFTrue;
+      else if ((record.sequence >= entry.firstRecord) && (record.sopInstanceUID == sopInstanceUID))
+      {
+        // the history uses the same transfer syntax as the attribute blocks
+        DcmDataset dataset;
+        cond = DcmMppsInstance::decodeBlocks(record.payload, record.payloadLength, dataset);
+        if (cond.bad())
+          break;
+        if (restored == NULL)
+        {
+          // the first record of an instance is its N-CREATE, nothing to restore otherwise
+          if (record.type != MPPS_RT_Create)
+          {
+            done = OFTrue;
+            break;
+          }
+          // the store only ever receives instances of the MPPS SOP class
+          restored = new DcmMppsInstance(UID_ModalityPerformedProcedureStepSOPClass, sopInstanceUID);
+          cond = restored->create(dataset, m_buffer);
+        } else
+          cond = restored->merge(dataset, m_buffer);
+        if (cond.good())
+          restored->addHistoryRecord(record.sequence);
+      }
+    }
+    if (cond == MPPS_EC_EndOfSegment)
+      cond = EC_Normal;
+    reader.close();
+    ++i;
+  }
+  if (cond.good() && ((restored == NULL) || (restored->getLastHistoryRecord() != entry.lastRecord)))
+    cond = MPPS_EC_NoSuchSOPInstance;
+  if (cond.bad())
+  {
+    delete restored;
+    return cond;
+  }
+
+  // the instance is cold again, so it is the newest candidate for eviction
+  restored->compress(&m_dictionary, m_buffer);
+  m_instances[sopInstanceUID] = restored;
+  m_coldInstances.push_back(sopInstanceUID);
+  DCMNET_DEBUG("restored MPPS instance " << sopInstanceUID << " from the history (records "
+    << entry.firstRecord << " to " << entry.lastRecord << ")");
+  instance = restored;
+  return EC_Normal;
+}
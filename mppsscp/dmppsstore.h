@@ -0,0 +1,603 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: In-memory store of MPPS instances created by N-CREATE and
+ *           modified by N-SET
+ *
+ */
+
+#ifndef DMPPSSTORE_H
+#define DMPPSSTORE_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/oflist.h"
+#include "dcmtk/ofstd/ofmap.h"
+#include "dcmtk/ofstd/ofvector.h"
+#include "dcmtk/dcmdata/dctk.h"     /* Covers most common dcmdata classes */
+#include "dmppscond.h"              /* for MPPS_EC_* conditions */
+#include "dmppslog.h"               /* for DcmMppsSegmentLog */
+
+/// default number of cold instances kept in memory before they are evicted
+#define MPPS_STORE_DEFAULT_COLD_CACHE 10000
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Preset dictionary for compressing MPPS instances, trained on the instances
+ *  received. Each sample is split into its attribute blocks (long blocks like
+ *  sequences contribute their beginning only); blocks that occur in several samples
+ *  (e.g. SOP Class UIDs, status values, station and AE titles) make up the
+ *  dictionary, the most valuable ones at its end where zlib finds them cheapest.
+ *  Once built, the dictionary never changes, so instances compressed with it can
+ *  always be decompressed.
+ */
+class DcmMppsCompressionDictionary
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmMppsCompressionDictionary();
+
+    /** Add an attribute block of the current sample
+     *  @param data   [in] The encoded attribute
+     *  @param length [in] Length of the encoded attribute in bytes
+     */
+    void addBlock(const Uint8 *data,
+                  const Uint32 length);
+
+    /** Finish the current sample. The dictionary is built as soon as enough samples
+     *  have been collected.
+     */
+    void endSample();
+
+    /** Returns whether the dictionary has been built
+     *  @return OFTrue if the dictionary can be used, OFFalse otherwise
+     */
+    OFBool isReady() const;
+
+    /** Returns the dictionary
+     *  @return Pointer to the dictionary, NULL if not built (yet)
+     */
+    const Uint8 *getData() const;
+
+    /** Returns the length of the dictionary
+     *  @return Length of the dictionary in bytes, 0 if not built (yet)
+     */
+    Uint32 getLength() const;
+
+  private:
+
+    /** Build the dictionary from the blocks collected so far
+     */
+    void build();
+
+    /// number of occurrences of each block seen in the samples
+    OFMap<OFString, Uint32> m_fragments;
+
+    /// number of samples collected
+    size_t m_samples;
+
+    /// the dictionary, empty until built
+    OFVector<Uint8> m_data;
+
+    // private undefined copy constructor
+    DcmMppsCompressionDictionary(const DcmMppsCompressionDictionary &);
+
+    // private undefined assignment operator
+    DcmMppsCompressionDictionary &operator=(const DcmMppsCompressionDictionary &);
+
+};
+
+
+/** Compact representation of a single MPPS instance. Each top-level attribute is kept
+ *  as a separately encoded block (explicit VR little endian) within one buffer, and an
+ *  offset table sorted by tag maps each attribute to its block. Merging an N-SET
+ *  modification list therefore only encodes the modified attributes and patches their
+ *  blocks; untouched attributes (e.g. a large Performed Series Sequence) are never
+ *  decoded or re-encoded.
+ *  Instances whose procedure step is final can be moved to a compressed (cold) state,
+ *  in which the buffer is replaced by its deflated image. The offset table is kept, so
+ *  requests for single attributes still only decode the attributes requested.
+ */
+class DcmMppsInstance
+{
+
+  public:
+
+    /** constructor
+     *  @param sopClassUID    [in] The SOP class UID of the instance
+     *  @param sopInstanceUID [in] The SOP instance UID of the instance
+     */
+    DcmMppsInstance(const OFString &sopClassUID,
+                    const OFString &sopInstanceUID);
+
+    /** destructor
+     */
+    ~DcmMppsInstance();
+
+    /** Replace the stored content with the attributes of the given dataset (N-CREATE).
+     *  @param dataset [in]    The N-CREATE attribute list
+     *  @param buffer  [inout] Scratch buffer, reused between calls to avoid allocations
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition create(DcmDataset &dataset,
+                       OFVector<Uint8> &buffer);
+
+    /** Merge the attributes of the given modification list into the stored content
+     *  (N-SET). Attributes already present are replaced, new attributes are added.
+     *  Either all attributes are merged or, if any of them cannot be encoded, none.
+     *  @param modificationList [in]    The N-SET modification list
+     *  @param buffer           [inout] Scratch buffer, reused between calls to avoid
+     *                                  allocations
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition merge(DcmDataset &modificationList,
+                      OFVector<Uint8> &buffer);
+
+    /** Decode the stored content into the given dataset.
+     *  @param dataset [out]   Dataset the stored attributes are added to
+     *  @param buffer  [inout] Scratch buffer, reused between calls to avoid allocations
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition getDataset(DcmDataset &dataset,
+                           OFVector<Uint8> &buffer) const;
+
+    /** Decode only the given attributes of the stored content into the given dataset.
+     *  The attributes are looked up in the offset table and only their blocks are
+     *  decoded, so the cost does not depend on the size of the other attributes.
+     *  @param tags    [in]    Tags of the requested attributes (group in the upper,
+     *                         element in the lower 16 bits), sorted ascending
+     *  @param count   [in]    Number of requested attributes
+     *  @param dataset [out]   Dataset the requested attributes are added to
+     *  @param buffer  [inout] Scratch buffer, reused between calls to avoid allocations
+     *  @param missing [out]   Tags of the requested attributes that are not stored
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition getAttributes(const Uint32 *tags,
+                              const size_t count,
+                              DcmDataset &dataset,
+                              OFVector<Uint8> &buffer,
+                              OFVector<Uint32> &missing) const;
+
+    /** Move the instance to the compressed state. Does nothing if the instance is
+     *  compressed already or if compression is not available (no zlib support).
+     *  @param dictionary [in]    Preset dictionary to be used, NULL for none. Must exist
+     *                            as long as the instance.
+     *  @param buffer     [inout] Scratch buffer, reused between calls to avoid allocations
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition compress(const DcmMppsCompressionDictionary *dictionary,
+                         OFVector<Uint8> &buffer);
+
+    /** Returns whether the instance is in the compressed state
+     *  @return OFTrue if compressed, OFFalse otherwise
+     */
+    OFBool isCompressed() const;
+
+    /** Add the attribute blocks of this instance as a sample to the given dictionary
+     *  @param dictionary [inout] The dictionary to be trained
+     */
+    void addToDictionary(DcmMppsCompressionDictionary &dictionary) const;
+
+    /** Returns the SOP class UID of the instance
+     *  @return The SOP class UID
+     */
+    const OFString &getSOPClassUID() const;
+
+    /** Returns the SOP instance UID of the instance
+     *  @return The SOP instance UID
+     */
+    const OFString &getSOPInstanceUID() const;
+
+    /** Returns the current value of Performed Procedure Step Status (0040,0252)
+     *  @return The status, e.g. "IN PROGRESS". Empty if not (yet) known.
+     */
+    const OFString &getPerformedProcedureStepStatus() const;
+
+    /** Returns whether the procedure step reached a final state, i.e. whether the
+     *  Performed Procedure Step Status is "COMPLETED" or "DISCONTINUED".
+     *  @return OFTrue if the procedure step is final, OFFalse otherwise
+     */
+    OFBool isFinal() const;
+
+    /** Returns the time of the last N-CREATE or N-SET applied to this instance
+     *  @return Time of last modification (seconds since the epoch)
+     */
+    time_t getLastModified() const;
+
+    /** Remember a record of this instance that has been appended to the history, so
+     *  the instance can be restored from the history after it has been evicted
+     *  @param sequence [in] Sequence number of the record
+     */
+    void addHistoryRecord(const Uint64 sequence);
+
+    /** Returns the sequence number of the first record of this instance in the history
+     *  @return The sequence number, 0 if there is no record
+     */
+    Uint64 getFirstHistoryRecord() const;
+
+    /** Returns the sequence number of the last record of this instance in the history
+     *  @return The sequence number, 0 if there is no record
+     */
+    Uint64 getLastHistoryRecord() const;
+
+    /** Returns the number of bytes used by the encoded attribute blocks
+     *  @return The encoded length in bytes (excluding unused space)
+     */
+    Uint32 getEncodedLength() const;
+
+    /** Returns the number of top-level attributes stored
+     *  @return The number of attributes
+     */
+    size_t getNumberOfAttributes() const;
+
+    /** Returns the number of bytes of memory held for the attribute blocks, i.e. the
+     *  size of the buffer or, if compressed, the size of the compressed image
+     *  @return The memory held in bytes
+     */
+    Uint32 getStoredLength() const;
+
+    /** Decode a sequence of encoded attributes (explicit VR little endian, as stored
+     *  in the attribute blocks and in the history) into the given dataset
+     *  @param data    [in]  The encoded attributes
+     *  @param length  [in]  Length of the encoded attributes in bytes
+     *  @param dataset [out] Dataset the attributes are added to
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    static OFCondition decodeBlocks(const Uint8 *data,
+                                    const Uint32 length,
+                                    DcmDataset &dataset);
+
+  private:
+
+    /// entry of the offset table
+    struct AttributeBlock
+    {
+      AttributeBlock()
+        : tag(0)
+        , offset(0)
+        , length(0)
+      {
+      }
+
+      /// attribute tag (group in the upper, element in the lower 16 bits)
+      Uint32 tag;
+      /// offset of the encoded attribute within the buffer
+      Uint32 offset;
+      /// length of the encoded attribute (including tag, VR and length field)
+      Uint32 length;
+    };
+
+    /** Encode the top-level attributes of the given dataset (except group lengths)
+     *  one after the other into the given buffer
+     *  @param dataset [in]  The dataset
+     *  @param buffer  [out] Buffer receiving the encoded attributes (starting at index 0)
+     *  @param blocks  [out] Tag, offset in the buffer and length of each attribute
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition encodeElements(DcmDataset &dataset,
+                               OFVector<Uint8> &buffer,
+                               OFVector<AttributeBlock> &blocks) const;
+
+    /** Store an encoded attribute as the block for its tag, either by overwriting the
+     *  previous block in place or by appending a new block.
+     *  @param tag    [in] The tag of the attribute
+     *  @param data   [in] The encoded attribute, must not point into the own buffer
+     *  @param length [in] Length of the encoded attribute
+     */
+    void putBlock(const Uint32 tag,
+                  const Uint8 *data,
+                  const Uint32 length);
+
+    /** Returns the index of the offset table entry for the given tag or the index the
+     *  entry would have to be inserted at.
+     *  @param tag   [in]  The tag to look for
+     *  @param found [out] OFTrue if the tag is present, OFFalse otherwise
+     *  @return Index into the offset table
+     */
+    size_t findBlock(const Uint32 tag, OFBool &found) const;
+
+    /** Make sure that at least the given number of bytes can be appended to the buffer
+     *  @param length [in] Number of bytes to be appended
+     */
+    void reserve(const Uint32 length);
+
+    /** Rewrite the buffer in tag order, dropping space of replaced blocks
+     */
+    void compact();
+
+    /** Inflate the compressed image into the given buffer
+     *  @param buffer [out] Buffer receiving the image (starting at index 0)
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition decompress(OFVector<Uint8> &buffer) const;
+
+    /** Leave the compressed state, i.e. inflate the image into a new buffer
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition expand();
+
+    /** Update the cached procedure step status from the given dataset (if present)
+     *  @param dataset [in] The N-CREATE or N-SET attribute list
+     */
+    void updateStatus(DcmDataset &dataset);
+
+    /// SOP class UID
+    OFString m_sopClassUID;
+
+    /// SOP instance UID
+    OFString m_sopInstanceUID;
+
+    /// current Performed Procedure Step Status
+    OFString m_status;
+
+    /// time of last modification
+    time_t m_lastModified;
+
+    /// sequence numbers of the first and last record in the history, 0 if none
+    Uint64 m_firstHistoryRecord;
+    Uint64 m_lastHistoryRecord;
+
+    /// offset table, sorted by tag
+    OFVector<AttributeBlock> m_blocks;
+
+    /// buffer holding the encoded attribute blocks
+    Uint8 *m_buffer;
+
+    /// number of bytes of the buffer in use (including replaced blocks)
+    Uint32 m_used;
+
+    /// size of the buffer in bytes
+    Uint32 m_capacity;
+
+    /// number of bytes occupied by replaced blocks
+    Uint32 m_garbage;
+
+    /// compressed image of the attribute blocks (in tag order), NULL if not compressed
+    Uint8 *m_compressed;
+
+    /// length of the compressed image in bytes
+    Uint32 m_compressedLength;
+
+    /// preset dictionary used for the compressed image, NULL for none
+    const DcmMppsCompressionDictionary *m_dictionary;
+
+    // private undefined copy constructor
+    DcmMppsInstance(const DcmMppsInstance &);
+
+    // private undefined assignment operator
+    DcmMppsInstance &operator=(const DcmMppsInstance &);
+
+};
+
+
+/** Store of all MPPS instances known to the SCP, indexed by SOP instance UID.
+ *  Final instances are compressed once their cold delay has expired. If a history
+ *  (the segment log of the event stream) is set, only a limited number of these cold
+ *  instances is kept in memory: the oldest ones are evicted and restored from their
+ *  N-CREATE and N-SET records in the history when they are requested again. For an
+ *  evicted instance only its SOP instance UID and the range of its records remain in
+ *  memory, until the retention of the history has expired.
+ */
+class DcmMppsInstanceStore
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmMppsInstanceStore();
+
+    /** destructor
+     */
+    ~DcmMppsInstanceStore();
+
+    /** Create a new instance from an N-CREATE attribute list.
+     *  @param sopClassUID    [in] The affected SOP class UID
+     *  @param sopInstanceUID [in] The affected SOP instance UID
+     *  @param dataset        [in] The N-CREATE attribute list
+     *  @return EC_Normal if successful, MPPS_EC_DuplicateSOPInstance if the instance
+     *          already exists, another error code otherwise
+     */
+    OFCondition createInstance(const OFString &sopClassUID,
+                               const OFString &sopInstanceUID,
+                               DcmDataset &dataset);
+
+    /** Merge an N-SET modification list into an existing instance.
+     *  @param sopInstanceUID   [in] The requested SOP instance UID
+     *  @param modificationList [in] The N-SET modification list
+     *  @return EC_Normal if successful, MPPS_EC_NoSuchSOPInstance if the instance does
+     *          not exist, MPPS_EC_InstanceFinalized if the procedure step is already
+     *          COMPLETED or DISCONTINUED, another error code otherwise
+     */
+    OFCondition setInstance(const OFString &sopInstanceUID,
+                            DcmDataset &modificationList);
+
+    /** Retrieve attributes of an existing instance (N-GET).
+     *  @param sopInstanceUID [in]  The requested SOP instance UID
+     *  @param tagList        [in]  Attribute identifier list as received with the N-GET
+     *                              request (pairs of group and element number)
+     *  @param tagCount       [in]  Number of attributes in the list. If 0, all attributes
+     *                              are returned.
+     *  @param dataset        [out] Dataset the attributes are added to
+     *  @param missing        [out] Tags of the requested attributes that are not stored
+     *  @return EC_Normal if successful, MPPS_EC_NoSuchSOPInstance if the instance does
+     *          not exist, another error code otherwise
+     */
+    OFCondition getInstance(const OFString &sopInstanceUID,
+                            const Uint16 *tagList,
+                            const size_t tagCount,
+                            DcmDataset &dataset,
+                            OFVector<Uint32> &missing);
+
+    /** Set the delay after which instances whose procedure step is COMPLETED or
+     *  DISCONTINUED are compressed
+     *  @param seconds [in] Delay in seconds after the last modification. 0 disables
+     *                      compression.
+     */
+    void setColdAfter(const Uint32 seconds);
+
+    /** Returns the delay after which final instances are compressed
+     *  @return Delay in seconds, 0 if compression is disabled
+     */
+    Uint32 getColdAfter() const;
+
+    /** Set the history the N-CREATE and N-SET requests are recorded in. Cold instances
+     *  that exceed the cold cache are evicted only if a history is set.
+     *  @param log       [in] The segment log holding the history, NULL for none. Must
+     *                        exist as long as it is set.
+     *  @param retention [in] Retention of the history in seconds, 0 if kept forever
+     */
+    void setHistory(DcmMppsSegmentLog *log,
+                    const Uint32 retention);
+
+    /** Remember a record of an instance that has been appended to the history
+     *  @param sopInstanceUID [in] The SOP instance UID of the instance
+     *  @param sequence       [in] Sequence number of the record
+     */
+    void addHistoryRecord(const OFString &sopInstanceUID,
+                          const Uint64 sequence);
+
+    /** Set the maximum number of cold (i.e. compressed) instances kept in memory
+     *  @param count [in] Number of instances, 0 to evict them as soon as they are cold
+     */
+    void setColdCacheSize(const size_t count);
+
+    /** Returns the maximum number of cold instances kept in memory
+     *  @return The number of instances
+     */
+    size_t getColdCacheSize() const;
+
+    /** Compress final instances whose delay has expired and evict the oldest cold
+     *  instances that exceed the cold cache. Only a limited number of instances is
+     *  compressed per call, so the caller is never held up for long.
+     *  @param now [in] The current time
+     */
+    void ageInstances(const time_t now);
+
+    /** Find an instance by its SOP instance UID
+     *  @param sopInstanceUID [in] The SOP instance UID to look for
+     *  @return Pointer to the instance, NULL if not found
+     */
+    DcmMppsInstance *findInstance(const OFString &sopInstanceUID);
+
+    /** Returns the number of instances in the store
+     *  @return The number of instances held in memory
+     */
+    size_t getNumberOfInstances() const;
+
+    /** Returns the number of instances evicted to the history
+     *  @return The number of evicted instances not held in memory
+     */
+    size_t getNumberOfEvictedInstances() const;
+
+  private:
+
+    /// entry of the queue of final instances waiting for compression
+    struct FinalInstance
+    {
+      FinalInstance()
+        : finalized(0)
+        , sopInstanceUID()
+      {
+      }
+
+      /// time the procedure step became final
+      time_t finalized;
+      /// SOP instance UID of the instance
+      OFString sopInstanceUID;
+    };
+
+    /// entry of the index of instances evicted to the history
+    struct EvictedInstance
+    {
+      EvictedInstance()
+        : firstRecord(0)
+        , lastRecord(0)
+        , lastModified(0)
+      {
+      }
+
+      /// sequence number of the first record of the instance in the history
+      Uint64 firstRecord;
+      /// sequence number of the last record of the instance in the history
+      Uint64 lastRecord;
+      /// time of the last modification of the instance
+      time_t lastModified;
+    };
+
+    /** Remember an instance whose procedure step just became final, for compression
+     *  and for training the compression dictionary
+     *  @param instance [in] The instance
+     */
+    void addFinalInstance(const DcmMppsInstance &instance);
+
+    /** Evict the oldest cold instances that exceed the cold cache and forget about
+     *  evicted instances whose retention has expired
+     *  @param now [in] The current time
+     */
+    void evictInstances(const time_t now);
+
+    /** Restore an evicted instance from its records in the history and keep it as a
+     *  cold instance again
+     *  @param sopInstanceUID [in]  The SOP instance UID of the instance
+     *  @param entry          [in]  The entry of the instance in the eviction index
+     *  @param instance       [out] The restored instance
+     *  @return EC_Normal if successful, MPPS_EC_NoSuchSOPInstance if the instance has
+     *          been dropped from the history, another error code otherwise
+     */
+    OFCondition restoreInstance(const OFString &sopInstanceUID,
+                                const EvictedInstance &entry,
+                                DcmMppsInstance *&instance);
+
+    /// instances, indexed by SOP instance UID
+    OFMap<OFString, DcmMppsInstance *> m_instances;
+
+    /// requested tags of the last N-GET, reused to avoid allocations
+    OFVector<Uint32> m_tags;
+
+    /// scratch buffer for encoding and decoding attributes, reused to avoid allocations
+    OFVector<Uint8> m_buffer;
+
+    /// delay after which final instances are compressed (seconds, 0 = never)
+    Uint32 m_coldAfter;
+
+    /// final instances waiting for compression, oldest first
+    OFList<FinalInstance> m_finalInstances;
+
+    /// preset dictionary used for compression
+    DcmMppsCompressionDictionary m_dictionary;
+
+    /// segment log holding the history, NULL if none
+    DcmMppsSegmentLog *m_history;
+
+    /// retention of the history in seconds, 0 if kept forever
+    Uint32 m_retention;
+
+    /// maximum number of cold instances kept in memory
+    size_t m_coldCacheSize;
+
+    /// SOP instance UIDs of the cold instances held in memory, oldest first
+    OFList<OFString> m_coldInstances;
+
+    /// instances evicted to the history, indexed by SOP instance UID
+    OFMap<OFString, EvictedInstance> m_evicted;
+
+    /// SOP instance UIDs of the evicted instances, in the order of their eviction
+    OFList<OFString> m_evictionOrder;
+
+    // private undefined copy constructor
+    DcmMppsInstanceStore(const DcmMppsInstanceStore &);
+
+    // private undefined assignment operator
+    DcmMppsInstanceStore &operator=(const DcmMppsInstanceStore &);
+
+};
+
+#endif // DMPPSSTORE_H
@@ -0,0 +1,708 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Change data capture stream of MPPS events
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dmppsstrm.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmdata/dcostrmb.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// transfer syntax of the event payloads
+#define MPPS_STREAM_XFER EXS_LittleEndianExplicit
+
+// records are sent to a consumer in batches of (at least) this size
+#define MPPS_STREAM_BATCH_SIZE (64 * 1024)
+
+// timeout for receiving the cursor from a new consumer (milliseconds)
+#define MPPS_STREAM_CURSOR_TIMEOUT 10000
+
+// interval in which idle threads check whether they should stop (milliseconds)
+#define MPPS_STREAM_POLL_INTERVAL 1000
+
+
+/** Thread serving a single consumer of the event stream
+ */
+class DcmMppsStreamConsumer : public OFThread
+{
+
+  public:
+
+    /** constructor
+     *  @param log [in] The segment log to read from
+     *  @param fd  [in] Socket of the consumer. Closed by the destructor.
+     */
+    DcmMppsStreamConsumer(DcmMppsSegmentLog &log, int fd)
+      : OFThread()
+      , m_log(log)
+      , m_socket(fd)
+      , m_stop(OFFalse)
+      , m_finished(OFFalse)
+      , m_mutex()
+      , m_batch()
+    {
+      m_wakeup[0] = m_wakeup[1] = -1;
+    }
+
+    /** destructor
+     */
+    virtual ~DcmMppsStreamConsumer()
+    {
+      ::close(m_socket);
+      if (m_wakeup[0] >= 0)
+        ::close(m_wakeup[0]);
+      if (m_wakeup[1] >= 0)
+        ::close(m_wakeup[1]);
+    }
+
+    /** Create the wakeup pipe. Must be called before the thread is started.
+     *  @return OFTrue if successful, OFFalse otherwise
+     */
+    OFBool init()
+    {
+      if (pipe(m_wakeup) != 0)
+        return OFFalse;
+      fcntl(m_wakeup[0], F_SETFL, O_NONBLOCK);
+      fcntl(m_wakeup[1], F_SETFL, O_NONBLOCK);
+      return OFTrue;
+    }
+
+    /** Notify the thread that new records are available
+     */
+    void wakeup()
+    {
+      // if the pipe is full, the thread has not yet seen the previous wakeup anyway
+      const char c = 0;
+      if (write(m_wakeup[1], &c, 1) < 0) { /* ignore */ }
+    }
+
+    /** Ask the thread to stop and interrupt a blocking send
+     */
+    void stop()
+    {
+      m_mutex.lock();
+      m_stop = OFTrue;
+      m_mutex.unlock();
+      shutdown(m_socket, SHUT_RDWR);
+      wakeup();
+    }
+
+    /** Returns whether the thread has finished
+     *  @return OFTrue if finished, OFFalse otherwise
+     */
+    OFBool isFinished()
+    {
+      m_mutex.lock();
+      const OFBool finished = m_finished;
+      m_mutex.unlock();
+      return finished;
+    }
+
+  protected:
+
+    /** Serve the consumer
+     */
+    virtual void run()
+    {
+      Uint64 cursor = 0;
+      if (receiveCursor(cursor))
+      {
+        DCMNET_DEBUG("MPPS event stream consumer connected, cursor " << cursor);
+        serve(cursor);
+      }
+      DCMNET_DEBUG("MPPS event stream consumer disconnected");
+      m_mutex.lock();
+      m_finished = OFTrue;
+      m_mutex.unlock();
+    }
+
+  private:
+
+    /** Check whether the thread should stop
+     *  @return OFTrue if the thread should stop, OFFalse otherwise
+     */
+    OFBool stopRequested()
+    {
+      m_mutex.lock();
+      const OFBool stop = m_stop;
+      m_mutex.unlock();
+      return stop;
+    }
+
+    /** Receive the cursor sent by the consumer after connecting
+     *  @param cursor [out] The cursor
+     *  @return OFTrue if successful, OFFalse otherwise
+     */
+    OFBool receiveCursor(Uint64 &cursor)
+    {
+      Uint8 buffer[8];
+      size_t received = 0;
+      while (received < sizeof(buffer))
+      {
+        struct pollfd pfd;
+        pfd.fd = m_socket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, MPPS_STREAM_CURSOR_TIMEOUT) <= 0)
+        {
+          DCMNET_WARN("MPPS event stream consumer did not send a cursor");
+          return OFFalse;
+        }
+        const ssize_t result = recv(m_socket, buffer + received, sizeof(buffer) - received, 0);
+        if (result <= 0)
+          return OFFalse;
+        received += OFstatic_cast(size_t, result);
+      }
+      cursor = 0;
+      for (int i = 7; i >= 0; --i)
+        cursor = (cursor << 8) | buffer[i];
+      return OFTrue;
+    }
+
+    /** Open the segment holding the given sequence number (or the oldest segment if the
+     *  sequence number is not on disk any more)
+     *  @param sequence [in]  Sequence number to look for
+     *  @param reader   [out] Reader for the segment
+     *  @param segment  [out] First sequence number of the segment
+     *  @return OFTrue if successful, OFFalse otherwise
+     */
+    OFBool openSegment(const Uint64 sequence,
+                       DcmMppsSegmentReader &reader,
+                       Uint64 &segment)
+    {
+      OFVector<Uint64> segments;
+      if (DcmMppsSegmentLog::listSegments(m_log.getDirectory(), segments).bad() || segments.empty())
+        return OFFalse;
+      segment = segments[0];
+      for (size_t i = 1; i < segments.size(); ++i)
+      {
+        if (segments[i] <= sequence)
+          segment = segments[i];
+      }
+      return reader.open(DcmMppsSegmentLog::getSegmentFilename(m_log.getDirectory(), segment)).good();
+    }
+
+    /** Open the segment following the given one
+     *  @param reader  [out]   Reader for the segment
+     *  @param segment [inout] First sequence number of the current segment, replaced
+     *                         by the one of the next segment
+     *  @return OFTrue if successful, OFFalse otherwise
+     */
+    OFBool openNextSegment(DcmMppsSegmentReader &reader,
+                           Uint64 &segment)
+    {
+      OFVector<Uint64> segments;
+      if (DcmMppsSegmentLog::listSegments(m_log.getDirectory(), segments).bad())
+        return OFFalse;
+      for (size_t i = 0; i < segments.size(); ++i)
+      {
+        if (segments[i] > segment)
+        {
+          segment = segments[i];
+          return reader.open(DcmMppsSegmentLog::getSegmentFilename(m_log.getDirectory(), segment)).good();
+        }
+      }
+      return OFFalse;
+    }
+
+    /** Send all records collected so far to the consumer
+     *  @return OFTrue if successful, OFFalse if the consumer is gone
+     */
+    OFBool sendBatch()
+    {
+      size_t sent = 0;
+      while (sent < m_batch.size())
+      {
+        const ssize_t result = send(m_socket, &m_batch[sent], m_batch.size() - sent, MSG_NOSIGNAL);
+        if (result < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return OFFalse;
+        }
+        sent += OFstatic_cast(size_t, result);
+      }
+      m_batch.clear();
+      return OFTrue;
+    }
+
+    /** Wait until new records may be available
+     *  @return OFTrue if the consumer is still connected, OFFalse otherwise
+     */
+    OFBool waitForRecords()
+    {
+      struct pollfd pfd[2];
+      pfd[0].fd = m_wakeup[0];
+      pfd[0].events = POLLIN;
+      pfd[0].revents = 0;
+      pfd[1].fd = m_socket;
+      pfd[1].events = POLLIN;
+      pfd[1].revents = 0;
+      if (poll(pfd, 2, MPPS_STREAM_POLL_INTERVAL) > 0)
+      {
+        if (pfd[0].revents & POLLIN)
+        {
+          char buffer[64];
+          while (read(m_wakeup[0], buffer, sizeof(buffer)) > 0) { /* drain */ }
+        }
+        // the consumer is not supposed to send anything after the cursor
+        if (pfd[1].revents & (POLLIN | POLLHUP | POLLERR))
+          return OFFalse;
+      }
+      return OFTrue;
+    }
+
+    /** Send all records from the given cursor on until the consumer disconnects or the
+     *  thread is stopped
+     *  @param cursor [in] Sequence number of the first record to send
+     */
+    void serve(const Uint64 cursor)
+    {
+      DcmMppsSegmentReader reader;
+      DcmMppsRecord record;
+      Uint64 segment = 0;
+      // records appended after the active segment changed may still end up in our
+      // segment, so it is read once more before moving on
+      OFBool draining = OFFalse;
+      OFBool connected = OFTrue;
+      while (connected && !stopRequested())
+      {
+        if (!reader.isOpen())
+        {
+          if (!openSegment(cursor, reader, segment))
+          {
+            connected = waitForRecords();
+            continue;
+          }
+        }
+        OFCondition cond = reader.readRecord(record);
+        if (cond.good())
+        {
+          if (record.sequence >= cursor)
+          {
+            m_batch.insert(m_batch.end(), record.raw, record.raw + record.rawLength);
+            if (m_batch.size() >= MPPS_STREAM_BATCH_SIZE)
+              connected = sendBatch();
+          }
+        }
+        else if (cond == MPPS_EC_EndOfSegment)
+        {
+          // caught up with this segment, send what we have
+          if (!m_batch.empty())
+            connected = sendBatch();
+          if (!connected)
+            break;
+          if (segment != m_log.getActiveSegment())
+          {
+            if (draining)
+            {
+              draining = OFFalse;
+              if (!openNextSegment(reader, segment))
+                connected = waitForRecords();
+            } else
+              draining = OFTrue;
+          } else
+            connected = waitForRecords();
+        } else {
+          DCMNET_ERROR("cannot read MPPS event stream segment: " << cond.text());
+          break;
+        }
+      }
+    }
+
+    /// segment log to read from
+    DcmMppsSegmentLog &m_log;
+
+    /// socket of the consumer
+    int m_socket;
+
+    /// pipe used to wake up the thread (read end, write end)
+    int m_wakeup[2];
+
+    /// flag indicating that the thread should stop
+    OFBool m_stop;
+
+    /// flag indicating that the thread has finished
+    OFBool m_finished;
+
+    /// mutex protecting the flags
+    OFMutex m_mutex;
+
+    /// records to be sent to the consumer
+    OFVector<Uint8> m_batch;
+
+};
+
+
+/** Thread accepting connections of consumers of the event stream
+ */
+class DcmMppsStreamAcceptor : public OFThread
+{
+
+  public:
+
+    /** constructor
+     *  @param stream       [in] The event stream
+     *  @param listenSocket [in] The listening unix domain socket
+     */
+    DcmMppsStreamAcceptor(DcmMppsEventStream &stream, int listenSocket)
+      : OFThread()
+      , m_stream(stream)
+      , m_listenSocket(listenSocket)
+      , m_stop(OFFalse)
+      , m_mutex()
+    {
+    }
+
+    /** Ask the thread to stop
+     */
+    void stop()
+    {
+      m_mutex.lock();
+      m_stop = OFTrue;
+      m_mutex.unlock();
+    }
+
+  protected:
+
+    /** Accept connections until stopped
+     */
+    virtual void run()
+    {
+      while (!stopRequested())
+      {
+        struct pollfd pfd;
+        pfd.fd = m_listenSocket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if ((poll(&pfd, 1, MPPS_STREAM_POLL_INTERVAL) > 0) && (pfd.revents & POLLIN))
+        {
+          const int fd = accept(m_listenSocket, NULL, NULL);
+          if (fd >= 0)
+            m_stream.addConsumer(fd);
+        }
+        m_stream.removeConsumers(OFFalse /* all */);
+      }
+    }
+
+  private:
+
+    /** Check whether the thread should stop
+     *  @return OFTrue if the thread should stop, OFFalse otherwise
+     */
+    OFBool stopRequested()
+    {
+      m_mutex.lock();
+      const OFBool stop = m_stop;
+      m_mutex.unlock();
+      return stop;
+    }
+
+    /// the event stream
+    DcmMppsEventStream &m_stream;
+
+    /// listening unix domain socket
+    int m_listenSocket;
+
+    /// flag indicating that the thread should stop
+    OFBool m_stop;
+
+    /// mutex protecting the flag
+    OFMutex m_mutex;
+
+};
+
+// ----------------------------------------------------------------------------
+
+// implementation of the event stream
+
+DcmMppsEventStream::DcmMppsEventStream()
+  : m_directory()
+  , m_socketPath()
+  , m_log()
+  , m_listenSocket(-1)
+  , m_retention(0)
+  , m_archiveDirectory()
+  , m_compactionRate(MPPS_HISTORY_DEFAULT_RATE)
+  , m_compactor(NULL)
+  , m_acceptor(NULL)
+  , m_consumers()
+  , m_consumerMutex()
+  , m_buffer()
+{
+}
+
+
+DcmMppsEventStream::~DcmMppsEventStream()
+{
+  close();
+}
+
+
+void DcmMppsEventStream::setDirectory(const OFString &directory)
+{
+  m_directory = directory;
+}
+
+
+void DcmMppsEventStream::setSocketPath(const OFString &path)
+{
+  m_socketPath = path;
+}
+
+
+void DcmMppsEventStream::setMaxSegmentSize(const Uint32 size)
+{
+  m_log.setMaxSegmentSize(size);
+}
+
+
+void DcmMppsEventStream::setRetention(const Uint32 seconds)
+{
+  m_retention = seconds;
+}
+
+
+void DcmMppsEventStream::setArchiveDirectory(const OFString &directory)
+{
+  m_archiveDirectory = directory;
+}
+
+
+void DcmMppsEventStream::setCompactionRate(const Uint32 bytesPerSecond)
+{
+  m_compactionRate = bytesPerSecond;
+}
+
+
+const OFString &DcmMppsEventStream::getDirectory() const
+{
+  return m_directory;
+}
+
+
+const OFString &DcmMppsEventStream::getSocketPath() const
+{
+  return m_socketPath;
+}
+
+
+Uint32 DcmMppsEventStream::getRetention() const
+{
+  return m_retention;
+}
+
+
+OFCondition DcmMppsEventStream::open()
+{
+  OFCondition cond = m_log.open(m_directory);
+  if (cond.bad())
+    return cond;
+
+  if (m_retention > 0)
+  {
+    m_compactor = new DcmMppsHistoryCompactor(m_log);
+    m_compactor->setRetention(m_retention);
+    m_compactor->setArchiveDirectory(m_archiveDirectory);
+    m_compactor->setRateLimit(m_compactionRate);
+    if (m_compactor->start() != 0)
+    {
+      DCMNET_ERROR("cannot start MPPS history compaction thread");
+      delete m_compactor;
+      m_compactor = NULL;
+      m_log.close();
+      return MPPS_EC_StreamError;
+    }
+  }
+  if (m_socketPath.empty())
+    return EC_Normal;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (m_socketPath.length() >= sizeof(addr.sun_path))
+  {
+    DCMNET_ERROR("MPPS event stream socket path too long: " << m_socketPath);
+    close();
+    return MPPS_EC_StreamError;
+  }
+  OFStandard::strlcpy(addr.sun_path, m_socketPath.c_str(), sizeof(addr.sun_path));
+
+  // remove a stale socket left behind by a previous run
+  unlink(m_socketPath.c_str());
+  m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((m_listenSocket < 0) ||
+      (bind(m_listenSocket, OFreinterpret_cast(struct sockaddr *, &addr), sizeof(addr)) != 0) ||
+      (::listen(m_listenSocket, SOMAXCONN) != 0))
+  {
+    char buf[256];
+    DCMNET_ERROR("cannot listen on MPPS event stream socket " << m_socketPath << ": "
+      << OFStandard::strerror(errno, buf, sizeof(buf)));
+    close();
+    return MPPS_EC_StreamError;
+  }
+
+  m_acceptor = new DcmMppsStreamAcceptor(*this, m_listenSocket);
+  if (m_acceptor->start() != 0)
+  {
+    DCMNET_ERROR("cannot start MPPS event stream thread");
+    delete m_acceptor;
+    m_acceptor = NULL;
+    close();
+    return MPPS_EC_StreamError;
+  }
+  DCMNET_INFO("serving MPPS event stream on " << m_socketPath);
+  return EC_Normal;
+}
+
+
+void DcmMppsEventStream::close()
+{
+  if (m_acceptor != NULL)
+  {
+    m_acceptor->stop();
+    m_acceptor->join();
+    delete m_acceptor;
+    m_acceptor = NULL;
+  }
+  removeConsumers(OFTrue /* all */);
+  if (m_compactor != NULL)
+  {
+    m_compactor->stop();
+    m_compactor->join();
+    delete m_compactor;
+    m_compactor = NULL;
+  }
+  if (m_listenSocket >= 0)
+  {
+    ::close(m_listenSocket);
+    m_listenSocket = -1;
+    unlink(m_socketPath.c_str());
+  }
+  m_log.close();
+}
+
+
+OFBool DcmMppsEventStream::isOpen() const
+{
+  return m_log.isOpen();
+}
+
+
+OFCondition DcmMppsEventStream::append(const DcmMppsRecordType type,
+                                       const OFString &sopInstanceUID,
+                                       DcmDataset &dataset,
+                                       Uint64 *sequence,
+                                       Uint32 *length)
+{
+  // encode the attribute list
+  const Uint32 encodedLength = dataset.getLength(MPPS_STREAM_XFER, EET_ExplicitLength);
+  if (m_buffer.size() < encodedLength + 1)
+    m_buffer.resize(encodedLength + 1);
+  DcmOutputBufferStream stream(&m_buffer[0], encodedLength + 1);
+  dataset.transferInit();
+  OFCondition cond = dataset.write(stream, MPPS_STREAM_XFER, EET_ExplicitLength, NULL /* wcache */, EGL_noChange);
+  dataset.transferEnd();
+  if (cond.bad())
+  {
+    DCMNET_ERROR("cannot encode MPPS event for " << sopInstanceUID << ": " << cond.text());
+    return cond;
+  }
+  void *buffer = NULL;
+  offile_off_t written = 0;
+  stream.flushBuffer(buffer, written);
+
+  Uint64 appended = 0;
+  cond = m_log.append(OFstatic_cast(Uint16, type), sopInstanceUID, &m_buffer[0], OFstatic_cast(Uint32, written), appended);
+  if (cond.bad())
+  {
+    DCMNET_ERROR("cannot append MPPS event for " << sopInstanceUID << ": " << cond.text());
+    return cond;
+  }
+  DCMNET_DEBUG("appended MPPS event " << appended << " for " << sopInstanceUID);
+  if (sequence != NULL)
+    *sequence = appended;
+  if (length != NULL)
+    *length = OFstatic_cast(Uint32, written);
+
+  // wake up the consumers waiting for new records
+  m_consumerMutex.lock();
+  OFListIterator(DcmMppsStreamConsumer *) it = m_consumers.begin();
+  while (it != m_consumers.end())
+  {
+    (*it)->wakeup();
+    ++it;
+  }
+  m_consumerMutex.unlock();
+  return EC_Normal;
+}
+
+
+DcmMppsSegmentLog &DcmMppsEventStream::getLog()
+{
+  return m_log;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmMppsEventStream::addConsumer(int fd)
+{
+  DcmMppsStreamConsumer *consumer = new DcmMppsStreamConsumer(m_log, fd);
+  if (!consumer->init() || (consumer->start() != 0))
+  {
+    DCMNET_ERROR("cannot start thread for MPPS event stream consumer");
+    delete consumer;
+    return;
+  }
+  m_consumerMutex.lock();
+  m_consumers.push_back(consumer);
+  m_consumerMutex.unlock();
+}
+
+
+void DcmMppsEventStream::removeConsumers(const OFBool all)
+{
+  OFList<DcmMppsStreamConsumer *> finished;
+  m_consumerMutex.lock();
+  OFListIterator(DcmMppsStreamConsumer *) it = m_consumers.begin();
+  while (it != m_consumers.end())
+  {
+    if (all || (*it)->isFinished())
+    {
+      finished.push_back(*it);
+      it = m_consumers.erase(it);
+    } else
+      ++it;
+  }
+  m_consumerMutex.unlock();
+
+  // join outside of the lock, so appending is never blocked by a consumer
+  it = finished.begin();
+  while (it != finished.end())
+  {
+    if (all)
+      (*it)->stop();
+    (*it)->join();
+    delete *it;
+    ++it;
+  }
+}
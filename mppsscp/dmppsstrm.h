@@ -0,0 +1,196 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Change data capture stream of MPPS events
+ *
+ */
+
+#ifndef DMPPSSTRM_H
+#define DMPPSSTRM_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/oflist.h"
+#include "dcmtk/ofstd/ofthread.h"
+#include "dcmtk/dcmdata/dctk.h"     /* Covers most common dcmdata classes */
+#include "dmppslog.h"               /* for DcmMppsSegmentLog */
+#include "dmppshist.h"              /* for DcmMppsHistoryCompactor */
+
+class DcmMppsStreamAcceptor;
+class DcmMppsStreamConsumer;
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Stream of all accepted N-CREATE and N-SET requests. Every event is appended as a
+ *  record with a strictly increasing sequence number to a DcmMppsSegmentLog, which
+ *  makes the stream durable and allows consumers to resume from any sequence number
+ *  still on disk.
+ *  Optionally, the stream is served on a unix domain socket: a consumer connects and
+ *  sends its cursor, i.e. the sequence number of the first record it wants, as 8 bytes
+ *  in little endian byte order (0 for the oldest record available). It then receives
+ *  all records from the cursor on in the format described for DcmMppsRecord, first the
+ *  ones already stored and then new ones as soon as they are appended. Records are sent
+ *  in batches whenever the consumer is behind. Each consumer is served by a thread of
+ *  its own, so a slow consumer never delays the SCP or other consumers.
+ *  If a retention is set, the stream doubles as retention-managed history of the MPPS
+ *  instances: a DcmMppsHistoryCompactor thread drops expired instances from the
+ *  closed segments.
+ */
+class DcmMppsEventStream
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmMppsEventStream();
+
+    /** destructor. Closes the stream.
+     */
+    ~DcmMppsEventStream();
+
+    /** Set the directory the segment files are stored in
+     *  @param directory [in] The directory (must exist)
+     */
+    void setDirectory(const OFString &directory);
+
+    /** Set the path of the unix domain socket consumers connect to
+     *  @param path [in] The socket path. If empty, the stream is not served.
+     */
+    void setSocketPath(const OFString &path);
+
+    /** Set the maximum size of a segment file
+     *  @param size [in] Maximum size in bytes
+     */
+    void setMaxSegmentSize(const Uint32 size);
+
+    /** Set the retention of the events stored on disk
+     *  @param seconds [in] Time in seconds after the last event of an MPPS instance
+     *                      after which all events of the instance are dropped, 0 to
+     *                      keep all events
+     */
+    void setRetention(const Uint32 seconds);
+
+    /** Set the directory expired events are moved to instead of being deleted
+     *  @param directory [in] The directory (must exist), empty to delete them
+     */
+    void setArchiveDirectory(const OFString &directory);
+
+    /** Set the limit of the disk I/O used for dropping expired events
+     *  @param bytesPerSecond [in] Maximum number of bytes per second, 0 for unlimited
+     */
+    void setCompactionRate(const Uint32 bytesPerSecond);
+
+    /** Returns the directory the segment files are stored in
+     *  @return The directory, empty if not configured
+     */
+    const OFString &getDirectory() const;
+
+    /** Returns the path of the unix domain socket consumers connect to
+     *  @return The socket path, empty if not configured
+     */
+    const OFString &getSocketPath() const;
+
+    /** Returns the retention of the events stored on disk
+     *  @return The retention in seconds, 0 if all events are kept
+     */
+    Uint32 getRetention() const;
+
+    /** Open the segment log and start serving consumers (if configured)
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition open();
+
+    /** Stop serving consumers and close the segment log
+     */
+    void close();
+
+    /** Returns whether the stream is open
+     *  @return OFTrue if open, OFFalse otherwise
+     */
+    OFBool isOpen() const;
+
+    /** Append an event to the stream and wake up all consumers
+     *  @param type           [in]  Event type, see DcmMppsRecordType
+     *  @param sopInstanceUID [in]  SOP instance UID of the MPPS instance
+     *  @param dataset        [in]  N-CREATE attribute list or N-SET modification list
+     *  @param sequence       [out] Sequence number of the event, if not NULL
+     *  @param length         [out] Length of the encoded dataset in bytes, if not NULL
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition append(const DcmMppsRecordType type,
+                       const OFString &sopInstanceUID,
+                       DcmDataset &dataset,
+                       Uint64 *sequence = NULL,
+                       Uint32 *length = NULL);
+
+    /** Returns the segment log the events are stored in
+     *  @return The segment log
+     */
+    DcmMppsSegmentLog &getLog();
+
+  protected:
+
+    friend class DcmMppsStreamAcceptor;
+
+    /** Start serving a newly connected consumer. Called by the acceptor thread.
+     *  @param fd [in] Socket of the consumer. Closed by the consumer thread.
+     */
+    void addConsumer(int fd);
+
+    /** Join and delete consumer threads that have finished
+     *  @param all [in] If OFTrue, stop all consumers and wait for them
+     */
+    void removeConsumers(const OFBool all);
+
+  private:
+
+    /// directory of the segment files
+    OFString m_directory;
+
+    /// path of the unix domain socket
+    OFString m_socketPath;
+
+    /// segment log holding the events
+    DcmMppsSegmentLog m_log;
+
+    /// listening unix domain socket, -1 if not open
+    int m_listenSocket;
+
+    /// retention in seconds, 0 to keep all events
+    Uint32 m_retention;
+
+    /// directory expired events are moved to
+    OFString m_archiveDirectory;
+
+    /// limit of the compaction I/O in bytes per second
+    Uint32 m_compactionRate;
+
+    /// thread dropping expired events, NULL if not running
+    DcmMppsHistoryCompactor *m_compactor;
+
+    /// thread accepting consumer connections
+    DcmMppsStreamAcceptor *m_acceptor;
+
+    /// threads serving the connected consumers
+    OFList<DcmMppsStreamConsumer *> m_consumers;
+
+    /// mutex protecting the list of consumers
+    OFMutex m_consumerMutex;
+
+    /// buffer used for encoding the datasets
+    OFVector<Uint8> m_buffer;
+
+    // private undefined copy constructor
+    DcmMppsEventStream(const DcmMppsEventStream &);
+
+    // private undefined assignment operator
+    DcmMppsEventStream &operator=(const DcmMppsEventStream &);
+
+};
+
+#endif // DMPPSSTRM_H
@@ -0,0 +1,282 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Print the binary event records written by mppsrecv
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"   /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofstd.h"       /* for OFStandard functions */
+#include "dcmtk/ofstd/ofconapp.h"    /* for OFConsoleApplication */
+#include "dcmtk/dcmdata/dctk.h"      /* for DcmDataset et al. */
+#include "dcmtk/dcmdata/dcistrmb.h"  /* for DcmInputBufferStream */
+#include "dcmtk/dcmdata/cmdlnarg.h"  /* for prepareCmdLineArgs */
+#include "dcmtk/dcmnet/dimse.h"      /* for DIMSE command fields */
+#include "dcmtk/dcmnet/diutil.h"     /* for DU_n*StatusString() */
+#include "dmppsring.h"  /* for DcmMppsEventRing */
+#include "dmppslog.h"   /* for DcmMppsSegmentReader */
+
+#define INCLUDE_CTIME
+#include "dcmtk/ofstd/ofstdinc.h"
+
+#ifdef WITH_ZLIB
+#include <zlib.h>       /* for zlibVersion() */
+#endif
+
+
+/* general definitions */
+
+#define OFFIS_CONSOLE_APPLICATION "mppsdump"
+
+static OFLogger mppsdumpLogger = OFLog::getLogger("dcmtk.apps." OFFIS_CONSOLE_APPLICATION);
+
+static char rcsid[] = "$dcmtk: " OFFIS_CONSOLE_APPLICATION " v"
+  OFFIS_DCMTK_VERSION " " OFFIS_DCMTK_RELEASEDATE " $";
+
+
+/* exit codes for this command line tool */
+/* (EXIT_SUCCESS and EXIT_FAILURE are standard codes) */
+
+// general
+#define EXITCODE_NO_ERROR                         0
+
+// input file errors
+#define EXITCODE_CANNOT_READ_INPUT_FILE          20
+
+
+/* transfer syntax of the datasets in the event stream */
+#define MPPS_STREAM_XFER EXS_LittleEndianExplicit
+
+
+/* helper functions */
+
+static const char *commandName(const Uint16 commandField)
+{
+    switch (commandField)
+    {
+        case DIMSE_N_CREATE_RQ:
+            return "N-CREATE";
+        case DIMSE_N_SET_RQ:
+            return "N-SET";
+        case DIMSE_N_GET_RQ:
+            return "N-GET";
+        default:
+            return "unknown";
+    }
+}
+
+
+static const char *statusString(const Uint16 commandField,
+                                const Uint16 status)
+{
+    switch (commandField)
+    {
+        case DIMSE_N_CREATE_RQ:
+            return DU_ncreateStatusString(status);
+        case DIMSE_N_SET_RQ:
+            return DU_nsetStatusString(status);
+        case DIMSE_N_GET_RQ:
+            return DU_ngetStatusString(status);
+        default:
+            return "";
+    }
+}
+
+
+static OFString formatTimestamp(const Uint64 timestamp)
+{
+    const time_t seconds = OFstatic_cast(time_t, timestamp / 1000000);
+    struct tm tmBuf;
+    char date[32];
+    char result[48];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime_r(&seconds, &tmBuf));
+    sprintf(result, "%s.%06lu", date, OFstatic_cast(unsigned long, timestamp % 1000000));
+    return result;
+}
+
+
+/* load the dataset of an event from the segment files of the event stream */
+static OFCondition loadDataset(const OFString &directory,
+                               const OFVector<Uint64> &segments,
+                               const Uint64 sequence,
+                               DcmDataset &dataset)
+{
+    // the segment files are named after the first sequence number they contain
+    size_t i = segments.size();
+    while ((i > 0) && (segments[i - 1] > sequence))
+        --i;
+    if (i == 0)
+        return MPPS_EC_NoSuchSOPInstance;
+    DcmMppsSegmentReader reader;
+    OFCondition cond = reader.open(DcmMppsSegmentLog::getSegmentFilename(directory, segments[i - 1]));
+    if (cond.bad())
+        return cond;
+    DcmMppsRecord record;
+    while ((cond = reader.readRecord(record)).good())
+    {
+        if (record.sequence == sequence)
+        {
+            DcmInputBufferStream stream;
+            stream.setBuffer(record.payload, record.payloadLength);
+            stream.setEos();
+            dataset.clear();
+            dataset.transferInit();
+            cond = dataset.read(stream, MPPS_STREAM_XFER, EGL_noChange);
+            dataset.transferEnd();
+            return cond;
+        }
+        if (record.sequence > sequence)
+            break;
+    }
+    if (cond.bad() && (cond != MPPS_EC_EndOfSegment))
+        return cond;
+    // dropped from the history in the meantime
+    return MPPS_EC_NoSuchSOPInstance;
+}
+
+
+/* main program */
+
+#define SHORTCOL 4
+#define LONGCOL 18
+
+int main(int argc, char *argv[])
+{
+    const char *opt_ringFile = NULL;
+    const char *opt_streamDirectory = NULL;
+    const char *opt_sopInstanceUID = NULL;
+    OFCmdUnsignedInt opt_last = 0;
+    OFBool opt_dumpDatasets = OFFalse;
+
+    OFConsoleApplication app(OFFIS_CONSOLE_APPLICATION , "Print MPPS SCP event records", rcsid);
+    OFCommandLine cmd;
+
+    cmd.setParamColumn(LONGCOL + SHORTCOL + 4);
+    cmd.addParam("ring-file", "event ring file written by mppsrecv");
+
+    cmd.setOptionColumns(LONGCOL, SHORTCOL);
+    cmd.addGroup("general options:", LONGCOL, SHORTCOL + 2);
+      cmd.addOption("--help",                  "-h",      "print this help text and exit", OFCommandLine::AF_Exclusive);
+      cmd.addOption("--version",                          "print version information and exit", OFCommandLine::AF_Exclusive);
+      OFLog::addOptions(cmd);
+
+    cmd.addGroup("selection options:");
+      cmd.addOption("--last",                  "-l",   1, "[n]umber: integer",
+                                                          "print the last n records only");
+      cmd.addOption("--uid",                   "-u",   1, "[u]id: string",
+                                                          "print records of SOP instance u only");
+
+    cmd.addGroup("output options:");
+      cmd.addOption("--dump",                  "+d",      "print the dataset of each N-CREATE/N-SET\nrequest (requires --stream-dir)");
+      cmd.addOption("--stream-dir",            "-sd",  1, "[d]irectory: string",
+                                                          "read datasets from the event stream\nin directory d");
+
+    /* evaluate command line */
+    prepareCmdLineArgs(argc, argv, OFFIS_CONSOLE_APPLICATION);
+    if (app.parseCommandLine(cmd, argc, argv))
+    {
+        /* check exclusive options first */
+        if (cmd.hasExclusiveOption())
+        {
+            if (cmd.findOption("--version"))
+            {
+                app.printHeader(OFTrue /*print host identifier*/);
+#ifdef WITH_ZLIB
+                COUT << OFendl << "External libraries used:" << OFendl;
+                COUT << "- ZLIB, Version " << zlibVersion() << OFendl;
+#else
+                COUT << OFendl << "External libraries used: none" << OFendl;
+#endif
+                return EXITCODE_NO_ERROR;
+            }
+        }
+
+        /* general options */
+        OFLog::configureFromCommandLine(cmd, app);
+
+        if (cmd.findOption("--last"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_last, 1));
+        if (cmd.findOption("--uid"))
+            app.checkValue(cmd.getValue(opt_sopInstanceUID));
+
+        if (cmd.findOption("--stream-dir"))
+            app.checkValue(cmd.getValue(opt_streamDirectory));
+        if (cmd.findOption("--dump"))
+        {
+            app.checkDependence("--dump", "--stream-dir", opt_streamDirectory != NULL);
+            opt_dumpDatasets = OFTrue;
+        }
+
+      /* command line parameters */
+      cmd.getParam(1, opt_ringFile);
+    }
+
+    /* print resource identifier */
+    OFLOG_DEBUG(mppsdumpLogger, rcsid << OFendl);
+
+    /* make sure data dictionary is loaded */
+    if (opt_dumpDatasets && !dcmDataDict.isDictionaryLoaded())
+    {
+        OFLOG_WARN(mppsdumpLogger, "no data dictionary loaded, check environment variable: "
+            << DCM_DICT_ENVIRONMENT_VARIABLE);
+    }
+
+    OFVector<DcmMppsEventRecord> records;
+    OFCondition status = DcmMppsEventRing::readFile(opt_ringFile, records);
+    if (status.bad())
+    {
+        OFLOG_FATAL(mppsdumpLogger, "cannot read event ring " << opt_ringFile << ": " << status.text());
+        return EXITCODE_CANNOT_READ_INPUT_FILE;
+    }
+
+    OFVector<Uint64> segments;
+    if (opt_dumpDatasets)
+    {
+        status = DcmMppsSegmentLog::listSegments(opt_streamDirectory, segments);
+        if (status.bad())
+        {
+            OFLOG_FATAL(mppsdumpLogger, "cannot read event stream in " << opt_streamDirectory << ": " << status.text());
+            return EXITCODE_CANNOT_READ_INPUT_FILE;
+        }
+    }
+
+    /* select the records to be printed */
+    OFVector<const DcmMppsEventRecord *> selected;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        if ((opt_sopInstanceUID == NULL) || (strcmp(records[i].sopInstanceUID, opt_sopInstanceUID) == 0))
+            selected.push_back(&records[i]);
+    }
+    size_t first = 0;
+    if ((opt_last > 0) && (selected.size() > opt_last))
+        first = selected.size() - OFstatic_cast(size_t, opt_last);
+
+    /* print the records, one line each */
+    for (size_t i = first; i < selected.size(); ++i)
+    {
+        const DcmMppsEventRecord &record = *selected[i];
+        COUT << formatTimestamp(record.timestamp) << " #" << record.sequence << " "
+             << commandName(record.commandField) << " MsgID " << record.messageID
+             << " PC " << OFstatic_cast(unsigned int, record.presentationContextID)
+             << " " << record.callingAETitle << "@" << record.peerAddress << " -> " << record.calledAETitle
+             << " " << statusString(record.commandField, record.status)
+             << " " << record.duration << "us " << record.sopInstanceUID;
+        if (record.streamSequence > 0)
+            COUT << " (event " << record.streamSequence << ", " << record.datasetLength << " bytes)";
+        COUT << OFendl;
+        if (opt_dumpDatasets && (record.streamSequence > 0))
+        {
+            DcmDataset dataset;
+            status = loadDataset(opt_streamDirectory, segments, record.streamSequence, dataset);
+            if (status.good())
+                dataset.print(COUT);
+            else
+                COUT << "  (dataset no longer available: " << status.text() << ")" << OFendl;
+        }
+    }
+
+    return EXITCODE_NO_ERROR;
+}
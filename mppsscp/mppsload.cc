@@ -0,0 +1,278 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Load generator for MPPS SCPs reporting throughput and latencies
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"   /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofstd.h"       /* for OFStandard functions */
+#include "dcmtk/ofstd/ofconapp.h"    /* for OFConsoleApplication */
+#include "dcmtk/ofstd/ofstream.h"    /* for OFStringStream et al. */
+#include "dcmtk/ofstd/ofvector.h"    /* for OFVector */
+#include "dcmtk/dcmdata/dcdict.h"    /* for global data dictionary */
+#include "dcmtk/dcmdata/dcuid.h"     /* for dcmtk version name */
+#include "dcmtk/dcmdata/cmdlnarg.h"  /* for prepareCmdLineArgs */
+#include "dmppsload.h"  /* for DcmMppsLoadWorker et al. */
+
+#ifdef WITH_ZLIB
+#include <zlib.h>       /* for zlibVersion() */
+#endif
+
+
+/* general definitions */
+
+#define OFFIS_CONSOLE_APPLICATION "mppsload"
+
+static OFLogger mppsloadLogger = OFLog::getLogger("dcmtk.apps." OFFIS_CONSOLE_APPLICATION);
+
+static char rcsid[] = "$dcmtk: " OFFIS_CONSOLE_APPLICATION " v"
+  OFFIS_DCMTK_VERSION " " OFFIS_DCMTK_RELEASEDATE " $";
+
+/* default application entity titles */
+#define APPLICATIONTITLE "MPPSLOAD"
+#define PEERAPPLICATIONTITLE "ANY-SCP"
+
+/* number of sequences run if neither --duration nor --sequences is given */
+#define DEFAULT_SEQUENCES 1000
+
+
+/* exit codes for this command line tool */
+/* (EXIT_SUCCESS and EXIT_FAILURE are standard codes) */
+
+// general
+#define EXITCODE_NO_ERROR                         0
+
+// network errors
+#define EXITCODE_CANNOT_INITIALIZE_NETWORK       60
+#define EXITCODE_CANNOT_SEND_REQUEST             62
+
+
+/* helper macro for converting stream output to a string */
+#define CONVERT_TO_STRING(output, string) \
+    optStream.str(""); \
+    optStream.clear(); \
+    optStream << output << OFStringStream_ends; \
+    OFSTRINGSTREAM_GETOFSTRING(optStream, string)
+
+
+/* main program */
+
+#define SHORTCOL 4
+#define LONGCOL 26
+
+int main(int argc, char *argv[])
+{
+    OFOStringStream optStream;
+    const char *opt_peer = NULL;
+    OFCmdUnsignedInt opt_port = 104;
+    OFCmdUnsignedInt opt_acseTimeout = 30;
+    OFCmdUnsignedInt opt_dimseTimeout = 0;
+    OFCmdUnsignedInt opt_maxPDULength = ASC_DEFAULTMAXPDU;
+    OFCmdUnsignedInt opt_associations = 1;
+    OFCmdFloat opt_rate = 0;
+    OFCmdUnsignedInt opt_duration = 0;
+    OFCmdUnsignedInt opt_sequences = 0;
+    OFCmdUnsignedInt opt_warmup = 0;
+    OFCmdUnsignedInt opt_progressSets = MPPS_LOAD_DEFAULT_PROGRESS_SETS;
+    OFCmdUnsignedInt opt_series = MPPS_LOAD_DEFAULT_SERIES;
+    OFCmdUnsignedInt opt_images = MPPS_LOAD_DEFAULT_IMAGES;
+    DcmMppsLoadConfig config;
+    config.ourAETitle = APPLICATIONTITLE;
+    config.peerAETitle = PEERAPPLICATIONTITLE;
+
+    OFConsoleApplication app(OFFIS_CONSOLE_APPLICATION , "Load generator for DICOM MPPS SCPs", rcsid);
+    OFCommandLine cmd;
+
+    cmd.setParamColumn(LONGCOL + SHORTCOL + 4);
+    cmd.addParam("peer", "hostname of DICOM peer");
+    cmd.addParam("port", "tcp/ip port number of peer");
+
+    cmd.setOptionColumns(LONGCOL, SHORTCOL);
+    cmd.addGroup("general options:", LONGCOL, SHORTCOL + 2);
+      cmd.addOption("--help",                  "-h",      "print this help text and exit", OFCommandLine::AF_Exclusive);
+      cmd.addOption("--version",                          "print version information and exit", OFCommandLine::AF_Exclusive);
+      OFLog::addOptions(cmd);
+
+    cmd.addGroup("network options:");
+      cmd.addSubGroup("application entity titles:");
+        CONVERT_TO_STRING("set my calling AE title (default: " << APPLICATIONTITLE << ")", optString1);
+        cmd.addOption("--aetitle",             "-aet", 1, "[a]etitle: string", optString1.c_str());
+        CONVERT_TO_STRING("set called AE title of peer (default: " << PEERAPPLICATIONTITLE << ")", optString2);
+        cmd.addOption("--call",                "-aec", 1, "[a]etitle: string", optString2.c_str());
+      cmd.addSubGroup("other network options:");
+        CONVERT_TO_STRING("[s]econds: integer (default: " << opt_acseTimeout << ")", optString3);
+        cmd.addOption("--acse-timeout",        "-ta",  1, optString3.c_str(),
+                                                          "timeout for ACSE messages");
+        cmd.addOption("--dimse-timeout",       "-td",  1, "[s]econds: integer (default: unlimited)",
+                                                          "timeout for DIMSE messages");
+        CONVERT_TO_STRING("[n]umber of bytes: integer (" << ASC_MINIMUMPDUSIZE << ".." << ASC_MAXIMUMPDUSIZE << ")", optString4);
+        CONVERT_TO_STRING("set max receive pdu to n bytes (default: " << opt_maxPDULength << ")", optString5);
+        cmd.addOption("--max-pdu",             "-pdu", 1, optString4.c_str(),
+                                                          optString5.c_str());
+
+    cmd.addGroup("load options:");
+      cmd.addOption("--associations",          "-a",   1, "[n]umber: integer (1..1024, default: 1)",
+                                                          "run sequences over n concurrent associations");
+      cmd.addOption("--rate",                  "-r",   1, "[r]ate: float (default: unlimited)",
+                                                          "start r sequences per second (open model);\nwithout a rate, each association starts\nits next sequence when the last one is done");
+      cmd.addOption("--duration",              "-d",   1, "[s]econds: integer",
+                                                          "measure for s seconds");
+      CONVERT_TO_STRING("measure n sequences (default: " << DEFAULT_SEQUENCES << "\nif no duration is given)", optString6);
+      cmd.addOption("--sequences",             "-n",   1, "[n]umber: integer", optString6.c_str());
+      cmd.addOption("--warmup",                "-w",   1, "[s]econds: integer (default: 0)",
+                                                          "run sequences for s seconds before measuring");
+      cmd.addOption("--association-per-seq",   "-aps",    "request a new association for each sequence");
+
+    cmd.addGroup("sequence options:");
+      CONVERT_TO_STRING("[n]umber: integer (0..100, default: " << opt_progressSets << ")", optString7);
+      cmd.addOption("--progress-sets",         "-ps",  1, optString7.c_str(),
+                                                          "send n N-SET requests with status IN PROGRESS");
+      cmd.addSubGroup("final status:");
+        cmd.addOption("--complete",            "+co",     "end with N-SET status COMPLETED (default)");
+        cmd.addOption("--discontinue",         "+dc",     "end with N-SET status DISCONTINUED");
+        cmd.addOption("--no-final-set",        "-fs",     "do not end the procedure step");
+      cmd.addSubGroup("final N-SET dataset:");
+        cmd.addOption("--series",              "-se",  1, "[n]umber: integer (0..1000, default: 2)",
+                                                          "reference n performed series");
+        cmd.addOption("--images",              "-im",  1, "[n]umber: integer (0..10000, default: 50)",
+                                                          "reference n images per series");
+
+    /* evaluate command line */
+    prepareCmdLineArgs(argc, argv, OFFIS_CONSOLE_APPLICATION);
+    if (app.parseCommandLine(cmd, argc, argv))
+    {
+        /* check exclusive options first */
+        if (cmd.hasExclusiveOption())
+        {
+            if (cmd.findOption("--version"))
+            {
+                app.printHeader(OFTrue /*print host identifier*/);
+#ifdef WITH_ZLIB
+                COUT << OFendl << "External libraries used:" << OFendl;
+                COUT << "- ZLIB, Version " << zlibVersion() << OFendl;
+#else
+                COUT << OFendl << "External libraries used: none" << OFendl;
+#endif
+                return EXITCODE_NO_ERROR;
+            }
+        }
+
+        /* general options */
+        OFLog::configureFromCommandLine(cmd, app);
+
+        /* network options */
+        if (cmd.findOption("--aetitle"))
+            app.checkValue(cmd.getValue(config.ourAETitle));
+        if (cmd.findOption("--call"))
+            app.checkValue(cmd.getValue(config.peerAETitle));
+        if (cmd.findOption("--acse-timeout"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_acseTimeout, 1));
+        if (cmd.findOption("--dimse-timeout"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_dimseTimeout, 1));
+        if (cmd.findOption("--max-pdu"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_maxPDULength, ASC_MINIMUMPDUSIZE, ASC_MAXIMUMPDUSIZE));
+
+        /* load options */
+        if (cmd.findOption("--associations"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_associations, 1, 1024));
+        if (cmd.findOption("--rate"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_rate, 0.001));
+        if (cmd.findOption("--duration"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_duration, 1));
+        if (cmd.findOption("--sequences"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_sequences, 1));
+        if (cmd.findOption("--warmup"))
+            app.checkValue(cmd.getValue(opt_warmup));
+        if (cmd.findOption("--association-per-seq"))
+            config.associationPerSequence = OFTrue;
+
+        /* sequence options */
+        if (cmd.findOption("--progress-sets"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_progressSets, 0, 100));
+        cmd.beginOptionBlock();
+        if (cmd.findOption("--complete"))
+            config.finalStatus = MPPS_LF_Completed;
+        if (cmd.findOption("--discontinue"))
+            config.finalStatus = MPPS_LF_Discontinued;
+        if (cmd.findOption("--no-final-set"))
+            config.finalStatus = MPPS_LF_None;
+        cmd.endOptionBlock();
+        if (cmd.findOption("--series"))
+        {
+            app.checkConflict("--series", "--no-final-set", config.finalStatus == MPPS_LF_None);
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_series, 0, 1000));
+        }
+        if (cmd.findOption("--images"))
+        {
+            app.checkConflict("--images", "--no-final-set", config.finalStatus == MPPS_LF_None);
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_images, 0, 10000));
+        }
+
+        /* command line parameters */
+        cmd.getParam(1, opt_peer);
+        app.checkParam(cmd.getParamAndCheckMinMax(2, opt_port, 1, 65535));
+    }
+
+    /* print resource identifier */
+    OFLOG_DEBUG(mppsloadLogger, rcsid << OFendl);
+
+    /* make sure data dictionary is loaded */
+    if (!dcmDataDict.isDictionaryLoaded())
+    {
+        OFLOG_WARN(mppsloadLogger, "no data dictionary loaded, check environment variable: "
+            << DCM_DICT_ENVIRONMENT_VARIABLE);
+    }
+
+    config.peerHost = opt_peer;
+    config.peerPort = OFstatic_cast(Uint16, opt_port);
+    config.acseTimeout = OFstatic_cast(Uint32, opt_acseTimeout);
+    config.dimseTimeout = OFstatic_cast(Uint32, opt_dimseTimeout);
+    config.maxReceivePDULength = OFstatic_cast(Uint32, opt_maxPDULength);
+    config.progressSets = OFstatic_cast(Uint32, opt_progressSets);
+    config.series = OFstatic_cast(Uint32, opt_series);
+    config.images = OFstatic_cast(Uint32, opt_images);
+    if ((opt_duration == 0) && (opt_sequences == 0))
+        opt_sequences = DEFAULT_SEQUENCES;
+
+    DcmMppsLoadSchedule schedule(opt_rate,
+                                 OFstatic_cast(Uint64, opt_duration) * 1000000,
+                                 opt_sequences,
+                                 OFstatic_cast(Uint64, opt_warmup) * 1000000);
+    DcmMppsLoadStatistics statistics;
+    OFVector<DcmMppsLoadWorker *> workers;
+    for (Uint32 i = 0; i < opt_associations; ++i)
+        workers.push_back(new DcmMppsLoadWorker(config, schedule, statistics, i + 1));
+
+    OFLOG_INFO(mppsloadLogger, "running MPPS sequences against " << config.peerAETitle << "@"
+        << config.peerHost << ":" << config.peerPort << " over " << opt_associations << " association(s)");
+    schedule.start();
+    int result = EXITCODE_NO_ERROR;
+    size_t started = 0;
+    while (started < workers.size())
+    {
+        if (workers[started]->start() != 0)
+        {
+            OFLOG_FATAL(mppsloadLogger, "cannot start worker thread");
+            result = EXITCODE_CANNOT_INITIALIZE_NETWORK;
+            break;
+        }
+        ++started;
+    }
+    for (size_t i = 0; i < started; ++i)
+        workers[i]->join();
+    const Uint64 endTime = DcmMetricsRegistry::now();
+    for (size_t i = 0; i < workers.size(); ++i)
+        delete workers[i];
+
+    /* print the report */
+    const Uint64 measureStart = schedule.getMeasureStart();
+    statistics.print(COUT, (endTime > measureStart) ? endTime - measureStart : 0);
+
+    if ((result == EXITCODE_NO_ERROR) && (statistics.getFailedSequences() > 0))
+        result = EXITCODE_CANNOT_SEND_REQUEST;
+    return result;
+}
@@ -0,0 +1,337 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Micro-benchmarks of the MPPS request path
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"   /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofstd.h"       /* for OFStandard functions */
+#include "dcmtk/ofstd/ofconapp.h"    /* for OFConsoleApplication */
+#include "dcmtk/ofstd/ofstream.h"    /* for OFStringStream et al. */
+#include "dcmtk/ofstd/offile.h"      /* for OFFile */
+#include "dcmtk/dcmdata/dcdict.h"    /* for global data dictionary */
+#include "dcmtk/dcmdata/dcdeftag.h"  /* for DCM_ tags */
+#include "dcmtk/dcmdata/dcuid.h"     /* for dcmtk version name */
+#include "dcmtk/dcmdata/cmdlnarg.h"  /* for prepareCmdLineArgs */
+#include "dscpmicro.h"  /* for DcmMicroBenchmarkRunner et al. */
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#include "dcmtk/ofstd/ofstdinc.h"
+
+#ifdef WITH_ZLIB
+#include <zlib.h>       /* for zlibVersion() */
+#endif
+
+
+/* general definitions */
+
+#define OFFIS_CONSOLE_APPLICATION "mppsmicrobench"
+
+static OFLogger mppsmicrobenchLogger = OFLog::getLogger("dcmtk.apps." OFFIS_CONSOLE_APPLICATION);
+
+static char rcsid[] = "$dcmtk: " OFFIS_CONSOLE_APPLICATION " v"
+  OFFIS_DCMTK_VERSION " " OFFIS_DCMTK_RELEASEDATE " $";
+
+/* shape of the final N-SET dataset (as sent by mppsload by default) */
+#define FINAL_SET_SERIES 2
+#define FINAL_SET_IMAGES 50
+
+/* SOP Instance UID of the MPPS instance in all requests */
+#define MPPS_INSTANCE_UID SITE_INSTANCE_UID_ROOT ".1"
+
+
+/* exit codes for this command line tool */
+/* (EXIT_SUCCESS and EXIT_FAILURE are standard codes) */
+
+// general
+#define EXITCODE_NO_ERROR                         0
+
+// input file errors
+#define EXITCODE_CANNOT_READ_INPUT_FILE          20
+
+// output file errors
+#define EXITCODE_CANNOT_WRITE_OUTPUT_FILE        40
+
+// processing errors
+#define EXITCODE_BENCHMARK_FAILED                80
+#define EXITCODE_REGRESSION                      81
+
+
+/* helper macro for converting stream output to a string */
+#define CONVERT_TO_STRING(output, string) \
+    optStream.str(""); \
+    optStream.clear(); \
+    optStream << output << OFStringStream_ends; \
+    OFSTRINGSTREAM_GETOFSTRING(optStream, string)
+
+
+/* typical N-CREATE dataset of a modality starting a procedure step */
+static DcmDataset *createNCreateDataset()
+{
+  DcmDataset *dataset = new DcmDataset();
+  DcmItem *item = NULL;
+  if (dataset->findOrCreateSequenceItem(DCM_ScheduledStepAttributesSequence, item, -2 /* append */).good())
+  {
+    item->putAndInsertString(DCM_StudyInstanceUID, SITE_STUDY_UID_ROOT ".1");
+    item->insertEmptyElement(DCM_ReferencedStudySequence);
+    item->putAndInsertString(DCM_AccessionNumber, "A0000001");
+    item->putAndInsertString(DCM_RequestedProcedureID, "RP0001");
+    item->putAndInsertString(DCM_RequestedProcedureDescription, "CT CHEST");
+    item->putAndInsertString(DCM_ScheduledProcedureStepID, "SPS0001");
+    item->putAndInsertString(DCM_ScheduledProcedureStepDescription, "CT CHEST WITH CONTRAST");
+    item->insertEmptyElement(DCM_ScheduledProtocolCodeSequence);
+  }
+  dataset->putAndInsertString(DCM_PatientName, "BENCHMARK^PATIENT");
+  dataset->putAndInsertString(DCM_PatientID, "BENCH0001");
+  dataset->putAndInsertString(DCM_PatientBirthDate, "19700101");
+  dataset->putAndInsertString(DCM_PatientSex, "O");
+  dataset->insertEmptyElement(DCM_ReferencedPatientSequence);
+  dataset->putAndInsertString(DCM_PerformedProcedureStepID, "PPS0001");
+  dataset->putAndInsertString(DCM_PerformedStationAETitle, "MODALITY");
+  dataset->putAndInsertString(DCM_PerformedStationName, "CT01");
+  dataset->putAndInsertString(DCM_PerformedLocation, "RADIOLOGY");
+  dataset->putAndInsertString(DCM_PerformedProcedureStepStartDate, "20160801");
+  dataset->putAndInsertString(DCM_PerformedProcedureStepStartTime, "120000");
+  dataset->putAndInsertString(DCM_PerformedProcedureStepStatus, "IN PROGRESS");
+  dataset->putAndInsertString(DCM_PerformedProcedureStepDescription, "CT CHEST WITH CONTRAST");
+  dataset->insertEmptyElement(DCM_PerformedProcedureTypeDescription);
+  dataset->insertEmptyElement(DCM_ProcedureCodeSequence);
+  dataset->insertEmptyElement(DCM_PerformedProcedureStepEndDate);
+  dataset->insertEmptyElement(DCM_PerformedProcedureStepEndTime);
+  dataset->putAndInsertString(DCM_Modality, "CT");
+  dataset->insertEmptyElement(DCM_StudyID);
+  dataset->insertEmptyElement(DCM_PerformedProtocolCodeSequence);
+  dataset->insertEmptyElement(DCM_PerformedSeriesSequence);
+  return dataset;
+}
+
+
+/* N-SET dataset updating a procedure step that is still in progress */
+static DcmDataset *createProgressDataset()
+{
+  DcmDataset *dataset = new DcmDataset();
+  dataset->putAndInsertString(DCM_PerformedProcedureStepStatus, "IN PROGRESS");
+  dataset->putAndInsertString(DCM_PerformedProcedureStepDescription, "CT CHEST WITH CONTRAST");
+  return dataset;
+}
+
+
+/* N-SET dataset completing a procedure step with the performed series and images */
+static DcmDataset *createFinalDataset()
+{
+  char uid[100];
+  DcmDataset *dataset = new DcmDataset();
+  dataset->putAndInsertString(DCM_PerformedProcedureStepStatus, "COMPLETED");
+  dataset->putAndInsertString(DCM_PerformedProcedureStepEndDate, "20160801");
+  dataset->putAndInsertString(DCM_PerformedProcedureStepEndTime, "121500");
+  dataset->insertEmptyElement(DCM_PerformedSeriesSequence);
+  for (unsigned int s = 1; s <= FINAL_SET_SERIES; ++s)
+  {
+    DcmItem *series = NULL;
+    if (dataset->findOrCreateSequenceItem(DCM_PerformedSeriesSequence, series, -2 /* append */).bad())
+      break;
+    series->putAndInsertString(DCM_PerformingPhysicianName, "PHYSICIAN^PERFORMING");
+    series->putAndInsertString(DCM_ProtocolName, "CHEST");
+    series->putAndInsertString(DCM_OperatorsName, "OPERATOR^CT");
+    sprintf(uid, "%s.%u", SITE_SERIES_UID_ROOT, s);
+    series->putAndInsertString(DCM_SeriesInstanceUID, uid);
+    series->insertEmptyElement(DCM_SeriesDescription);
+    series->putAndInsertString(DCM_RetrieveAETitle, "ARCHIVE");
+    series->insertEmptyElement(DCM_ReferencedImageSequence);
+    for (unsigned int i = 1; i <= FINAL_SET_IMAGES; ++i)
+    {
+      DcmItem *image = NULL;
+      if (series->findOrCreateSequenceItem(DCM_ReferencedImageSequence, image, -2 /* append */).bad())
+        break;
+      image->putAndInsertString(DCM_ReferencedSOPClassUID, UID_CTImageStorage);
+      sprintf(uid, "%s.%u.%u", SITE_INSTANCE_UID_ROOT, s, i);
+      image->putAndInsertString(DCM_ReferencedSOPInstanceUID, uid);
+    }
+    series->insertEmptyElement(DCM_ReferencedNonImageCompositeSOPInstanceSequence);
+  }
+  return dataset;
+}
+
+
+/* N-CREATE or N-SET request for the MPPS instance */
+static T_DIMSE_Message createRequest(const T_DIMSE_Command commandField)
+{
+  T_DIMSE_Message message;
+  memset(&message, 0, sizeof(message));
+  message.CommandField = commandField;
+  if (commandField == DIMSE_N_CREATE_RQ)
+  {
+    T_DIMSE_N_CreateRQ &createReq = message.msg.NCreateRQ;
+    createReq.MessageID = 1;
+    createReq.DataSetType = DIMSE_DATASET_PRESENT;
+    createReq.opts = O_NCREATE_AFFECTEDSOPINSTANCEUID;
+    OFStandard::strlcpy(createReq.AffectedSOPClassUID, UID_ModalityPerformedProcedureStepSOPClass, sizeof(createReq.AffectedSOPClassUID));
+    OFStandard::strlcpy(createReq.AffectedSOPInstanceUID, MPPS_INSTANCE_UID, sizeof(createReq.AffectedSOPInstanceUID));
+  } else {
+    T_DIMSE_N_SetRQ &setReq = message.msg.NSetRQ;
+    setReq.MessageID = 2;
+    setReq.DataSetType = DIMSE_DATASET_PRESENT;
+    OFStandard::strlcpy(setReq.RequestedSOPClassUID, UID_ModalityPerformedProcedureStepSOPClass, sizeof(setReq.RequestedSOPClassUID));
+    OFStandard::strlcpy(setReq.RequestedSOPInstanceUID, MPPS_INSTANCE_UID, sizeof(setReq.RequestedSOPInstanceUID));
+  }
+  return message;
+}
+
+
+/* main program */
+
+#define SHORTCOL 3
+#define LONGCOL 16
+
+int main(int argc, char *argv[])
+{
+    OFOStringStream optStream;
+    OFCmdUnsignedInt opt_samples = SCP_MICRO_DEFAULT_SAMPLES;
+    OFCmdUnsignedInt opt_sampleTime = SCP_MICRO_DEFAULT_SAMPLE_TIME;
+    OFCmdFloat opt_threshold = SCP_MICRO_DEFAULT_THRESHOLD;
+    OFString opt_filter;
+    OFString opt_baseline;
+    OFString opt_output;
+    OFBool opt_list = OFFalse;
+
+    OFConsoleApplication app(OFFIS_CONSOLE_APPLICATION , "Micro-benchmarks of the MPPS request path", rcsid);
+    OFCommandLine cmd;
+
+    cmd.setOptionColumns(LONGCOL, SHORTCOL);
+    cmd.addGroup("general options:", LONGCOL, SHORTCOL + 2);
+      cmd.addOption("--help",                  "-h",      "print this help text and exit", OFCommandLine::AF_Exclusive);
+      cmd.addOption("--version",                          "print version information and exit", OFCommandLine::AF_Exclusive);
+      OFLog::addOptions(cmd);
+
+    cmd.addGroup("benchmark options:");
+      cmd.addOption("--list",                  "-l",      "print the names of the benchmarks and exit");
+      cmd.addOption("--filter",                "-f",   1, "[t]ext: string",
+                                                          "only run benchmarks whose name contains t");
+      CONVERT_TO_STRING("[n]umber: integer (1..1000, default: " << opt_samples << ")", optString1);
+      cmd.addOption("--samples",               "-s",   1, optString1.c_str(),
+                                                          "take n samples per benchmark");
+      CONVERT_TO_STRING("[m]illiseconds: integer (1..10000, default: " << opt_sampleTime << ")", optString2);
+      cmd.addOption("--sample-time",           "-st",  1, optString2.c_str(),
+                                                          "run each sample for at least m ms");
+
+    cmd.addGroup("output options:");
+      cmd.addOption("--output",                "-o",   1, "[f]ilename: string",
+                                                          "write the results to file f (default: stdout)");
+      cmd.addOption("--baseline",              "-b",   1, "[f]ilename: string",
+                                                          "compare with the results in file f, written\nby an earlier run, and fail on regressions");
+      CONVERT_TO_STRING("[p]ercent: float (default: " << opt_threshold << ")", optString3);
+      cmd.addOption("--threshold",             "-t",   1, optString3.c_str(),
+                                                          "report a regression if the median time is\nmore than p percent above the baseline");
+
+    /* evaluate command line */
+    prepareCmdLineArgs(argc, argv, OFFIS_CONSOLE_APPLICATION);
+    if (app.parseCommandLine(cmd, argc, argv))
+    {
+        /* check exclusive options first */
+        if (cmd.hasExclusiveOption())
+        {
+            if (cmd.findOption("--version"))
+            {
+                app.printHeader(OFTrue /*print host identifier*/);
+#ifdef WITH_ZLIB
+                COUT << OFendl << "External libraries used:" << OFendl;
+                COUT << "- ZLIB, Version " << zlibVersion() << OFendl;
+#else
+                COUT << OFendl << "External libraries used: none" << OFendl;
+#endif
+                return EXITCODE_NO_ERROR;
+            }
+        }
+
+        /* general options */
+        OFLog::configureFromCommandLine(cmd, app);
+
+        /* benchmark options */
+        if (cmd.findOption("--list"))
+            opt_list = OFTrue;
+        if (cmd.findOption("--filter"))
+            app.checkValue(cmd.getValue(opt_filter));
+        if (cmd.findOption("--samples"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_samples, 1, 1000));
+        if (cmd.findOption("--sample-time"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_sampleTime, 1, 10000));
+
+        /* output options */
+        if (cmd.findOption("--output"))
+            app.checkValue(cmd.getValue(opt_output));
+        if (cmd.findOption("--baseline"))
+            app.checkValue(cmd.getValue(opt_baseline));
+        if (cmd.findOption("--threshold"))
+        {
+            app.checkDependence("--threshold", "--baseline", !opt_baseline.empty());
+            app.checkValue(cmd.getValueAndCheckMin(opt_threshold, 0.0));
+        }
+    }
+
+    /* print resource identifier */
+    OFLOG_DEBUG(mppsmicrobenchLogger, rcsid << OFendl);
+
+    /* make sure data dictionary is loaded */
+    if (!dcmDataDict.isDictionaryLoaded())
+    {
+        OFLOG_WARN(mppsmicrobenchLogger, "no data dictionary loaded, check environment variable: "
+            << DCM_DICT_ENVIRONMENT_VARIABLE);
+    }
+
+    /* the request path of mppsrecv: decode the request, dump it (debug logging),
+       keep a copy of the dataset, encode the response */
+    const E_TransferSyntax xfer = EXS_LittleEndianExplicit;
+    DcmMicroBenchmarkRunner runner(OFstatic_cast(Uint32, opt_samples), OFstatic_cast(Uint32, opt_sampleTime));
+    runner.add(new DcmDecodeBenchmark("decode/n-create", createNCreateDataset(), xfer));
+    runner.add(new DcmDecodeBenchmark("decode/n-set-progress", createProgressDataset(), xfer));
+    runner.add(new DcmDecodeBenchmark("decode/n-set-final", createFinalDataset(), xfer));
+    runner.add(new DcmCloneBenchmark("clone/n-create", createNCreateDataset()));
+    runner.add(new DcmCloneBenchmark("clone/n-set-final", createFinalDataset()));
+    runner.add(new DcmDumpBenchmark("dump/n-create-rq", createRequest(DIMSE_N_CREATE_RQ), createNCreateDataset()));
+    runner.add(new DcmDumpBenchmark("dump/n-set-rq", createRequest(DIMSE_N_SET_RQ), createFinalDataset()));
+    runner.add(new DcmResponseBenchmark("encode/n-create-rsp", DIMSE_N_CREATE_RSP,
+      UID_ModalityPerformedProcedureStepSOPClass, MPPS_INSTANCE_UID));
+    runner.add(new DcmResponseBenchmark("encode/n-set-rsp", DIMSE_N_SET_RSP,
+      UID_ModalityPerformedProcedureStepSOPClass, MPPS_INSTANCE_UID));
+    runner.add(new DcmEncodeBenchmark("encode/n-get-rsp-dataset", createNCreateDataset(), xfer));
+
+    if (opt_list)
+    {
+        runner.printNames(COUT);
+        return EXITCODE_NO_ERROR;
+    }
+
+    if (!opt_baseline.empty() && runner.readBaseline(opt_baseline).bad())
+        return EXITCODE_CANNOT_READ_INPUT_FILE;
+
+    int result = EXITCODE_NO_ERROR;
+    if (runner.run(opt_filter).bad())
+        result = EXITCODE_BENCHMARK_FAILED;
+    if (!opt_baseline.empty() && (runner.compare(opt_threshold) > 0) && (result == EXITCODE_NO_ERROR))
+        result = EXITCODE_REGRESSION;
+
+    /* print the results */
+    if (opt_output.empty())
+        runner.printJSON(COUT, OFFIS_CONSOLE_APPLICATION);
+    else
+    {
+        OFOStringStream stream;
+        runner.printJSON(stream, OFFIS_CONSOLE_APPLICATION);
+        stream << OFStringStream_ends;
+        OFSTRINGSTREAM_GETOFSTRING(stream, text)
+        OFFile file;
+        if (!file.fopen(opt_output.c_str(), "w") ||
+            (file.fwrite(text.c_str(), 1, text.length()) != text.length()) ||
+            (file.fclose() != 0))
+        {
+            OFLOG_FATAL(mppsmicrobenchLogger, "cannot write output file: " << opt_output);
+            return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,231 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Replay of associations captured by mppsrecv against an SCP
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"   /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofstd.h"       /* for OFStandard functions */
+#include "dcmtk/ofstd/ofconapp.h"    /* for OFConsoleApplication */
+#include "dcmtk/ofstd/ofstream.h"    /* for OFStringStream et al. */
+#include "dcmtk/ofstd/ofvector.h"    /* for OFVector */
+#include "dcmtk/dcmdata/dcuid.h"     /* for dcmtk version name */
+#include "dcmtk/dcmdata/cmdlnarg.h"  /* for prepareCmdLineArgs */
+#include "dscprepl.h"  /* for DcmReplayWorker et al. */
+
+#ifdef WITH_ZLIB
+#include <zlib.h>       /* for zlibVersion() */
+#endif
+
+
+/* general definitions */
+
+#define OFFIS_CONSOLE_APPLICATION "mppsreplay"
+
+static OFLogger mppsreplayLogger = OFLog::getLogger("dcmtk.apps." OFFIS_CONSOLE_APPLICATION);
+
+static char rcsid[] = "$dcmtk: " OFFIS_CONSOLE_APPLICATION " v"
+  OFFIS_DCMTK_VERSION " " OFFIS_DCMTK_RELEASEDATE " $";
+
+
+/* exit codes for this command line tool */
+/* (EXIT_SUCCESS and EXIT_FAILURE are standard codes) */
+
+// general
+#define EXITCODE_NO_ERROR                         0
+
+// input file errors
+#define EXITCODE_CANNOT_READ_INPUT_FILE          20
+#define EXITCODE_NO_INPUT_FILES                  21
+
+// network errors
+#define EXITCODE_CANNOT_INITIALIZE_NETWORK       60
+#define EXITCODE_CANNOT_SEND_REQUEST             62
+
+
+/* helper macro for converting stream output to a string */
+#define CONVERT_TO_STRING(output, string) \
+    optStream.str(""); \
+    optStream.clear(); \
+    optStream << output << OFStringStream_ends; \
+    OFSTRINGSTREAM_GETOFSTRING(optStream, string)
+
+
+/* main program */
+
+#define SHORTCOL 4
+#define LONGCOL 21
+
+int main(int argc, char *argv[])
+{
+    OFOStringStream optStream;
+    const char *opt_captureFile = NULL;
+    const char *opt_peer = NULL;
+    OFCmdUnsignedInt opt_port = 104;
+    OFCmdUnsignedInt opt_timeout = SCP_REPLAY_DEFAULT_TIMEOUT;
+    OFCmdFloat opt_speed = 1.0;
+    OFCmdUnsignedInt opt_parallel = 16;
+    OFCmdUnsignedInt opt_rounds = 1;
+    OFCmdUnsignedInt opt_window = 1;
+    DcmReplayConfig config;
+
+    OFConsoleApplication app(OFFIS_CONSOLE_APPLICATION , "Replay captured DICOM associations against an SCP", rcsid);
+    OFCommandLine cmd;
+
+    cmd.setParamColumn(LONGCOL + SHORTCOL + 4);
+    cmd.addParam("capture-file", "capture file written by mppsrecv --capture-file");
+    cmd.addParam("peer", "hostname of DICOM peer");
+    cmd.addParam("port", "tcp/ip port number of peer");
+
+    cmd.setOptionColumns(LONGCOL, SHORTCOL);
+    cmd.addGroup("general options:", LONGCOL, SHORTCOL + 2);
+      cmd.addOption("--help",                  "-h",      "print this help text and exit", OFCommandLine::AF_Exclusive);
+      cmd.addOption("--version",                          "print version information and exit", OFCommandLine::AF_Exclusive);
+      OFLog::addOptions(cmd);
+
+    cmd.addGroup("network options:");
+      cmd.addOption("--call",                  "-aec", 1, "[a]etitle: string",
+                                                          "set called AE title of peer\n(default: as captured)");
+      CONVERT_TO_STRING("[s]econds: integer (default: " << opt_timeout << ")", optString1);
+      cmd.addOption("--timeout",               "-to",  1, optString1.c_str(),
+                                                          "timeout for answers of the SCP");
+
+    cmd.addGroup("replay options:");
+      cmd.addSubGroup("speed:");
+        cmd.addOption("--speed",               "-s",   1, "[f]actor: float (default: 1)",
+                                                          "send the PDUs f times as fast as captured");
+        cmd.addOption("--max-speed",           "+ms",     "send each PDU as soon as the SCP has\nanswered what it waits for");
+      cmd.addSubGroup("other replay options:");
+        CONVERT_TO_STRING("[n]umber: integer (1..1024, default: " << opt_parallel << ")", optString2);
+        cmd.addOption("--parallel",            "-p",   1, optString2.c_str(),
+                                                          "replay up to n sessions in parallel");
+        cmd.addOption("--rounds",              "-r",   1, "[n]umber: integer (default: 1)",
+                                                          "replay the capture n times");
+        cmd.addOption("--window",              "-wi",  1, "[n]umber: integer (1..65535, default: 1)",
+                                                          "send up to n requests without waiting\nfor their responses");
+        cmd.addOption("--keep-uids",           "-ku",     "send the SOP instance UIDs of the requests\nas captured (default: new UIDs per round)");
+
+    /* evaluate command line */
+    prepareCmdLineArgs(argc, argv, OFFIS_CONSOLE_APPLICATION);
+    if (app.parseCommandLine(cmd, argc, argv))
+    {
+        /* check exclusive options first */
+        if (cmd.hasExclusiveOption())
+        {
+            if (cmd.findOption("--version"))
+            {
+                app.printHeader(OFTrue /*print host identifier*/);
+#ifdef WITH_ZLIB
+                COUT << OFendl << "External libraries used:" << OFendl;
+                COUT << "- ZLIB, Version " << zlibVersion() << OFendl;
+#else
+                COUT << OFendl << "External libraries used: none" << OFendl;
+#endif
+                return EXITCODE_NO_ERROR;
+            }
+        }
+
+        /* general options */
+        OFLog::configureFromCommandLine(cmd, app);
+
+        /* network options */
+        if (cmd.findOption("--call"))
+            app.checkValue(cmd.getValue(config.peerAETitle));
+        if (cmd.findOption("--timeout"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_timeout, 1));
+
+        /* replay options */
+        cmd.beginOptionBlock();
+        if (cmd.findOption("--speed"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_speed, 0.001));
+        if (cmd.findOption("--max-speed"))
+            opt_speed = 0;
+        cmd.endOptionBlock();
+        if (cmd.findOption("--parallel"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_parallel, 1, 1024));
+        if (cmd.findOption("--rounds"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_rounds, 1));
+        if (cmd.findOption("--window"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_window, 1, 65535));
+        if (cmd.findOption("--keep-uids"))
+            config.keepUIDs = OFTrue;
+
+        /* command line parameters */
+        cmd.getParam(1, opt_captureFile);
+        cmd.getParam(2, opt_peer);
+        app.checkParam(cmd.getParamAndCheckMinMax(3, opt_port, 1, 65535));
+    }
+
+    /* print resource identifier */
+    OFLOG_DEBUG(mppsreplayLogger, rcsid << OFendl);
+
+    /* read the capture */
+    OFVector<DcmCapturedSession> sessions;
+    OFCondition cond = DcmTrafficCapture::readFile(opt_captureFile, SCP_CAPTURE_MAGIC_MPPS, sessions);
+    if (cond.bad())
+    {
+        OFLOG_FATAL(mppsreplayLogger, "cannot read capture file " << opt_captureFile << ": " << cond.text());
+        return EXITCODE_CANNOT_READ_INPUT_FILE;
+    }
+    size_t pdus = 0;
+    for (size_t i = 0; i < sessions.size(); ++i)
+        pdus += sessions[i].pdus.size();
+    if (pdus == 0)
+    {
+        OFLOG_FATAL(mppsreplayLogger, "no PDUs captured in " << opt_captureFile);
+        return EXITCODE_NO_INPUT_FILES;
+    }
+
+    config.peerHost = opt_peer;
+    config.peerPort = OFstatic_cast(Uint16, opt_port);
+    config.speed = opt_speed;
+    config.window = OFstatic_cast(Uint32, opt_window);
+    config.timeout = OFstatic_cast(Uint32, opt_timeout);
+
+    DcmReplaySchedule schedule(sessions, opt_speed, OFstatic_cast(Uint32, opt_rounds));
+    DcmReplayStatistics statistics;
+    DcmReplayUIDMap uids;
+    OFVector<DcmReplayWorker *> workers;
+    for (Uint32 i = 0; i < opt_parallel; ++i)
+        workers.push_back(new DcmReplayWorker(config, schedule, statistics, uids, i + 1));
+
+    if (opt_speed > 0)
+    {
+        OFLOG_INFO(mppsreplayLogger, "replaying " << sessions.size() << " session(s) with " << pdus << " PDU(s) against "
+            << config.peerHost << ":" << config.peerPort << " at " << opt_speed << "x speed, up to "
+            << opt_parallel << " in parallel");
+    } else {
+        OFLOG_INFO(mppsreplayLogger, "replaying " << sessions.size() << " session(s) with " << pdus << " PDU(s) against "
+            << config.peerHost << ":" << config.peerPort << " at maximum speed, up to "
+            << opt_parallel << " in parallel");
+    }
+    schedule.start();
+    int result = EXITCODE_NO_ERROR;
+    size_t started = 0;
+    while (started < workers.size())
+    {
+        if (workers[started]->start() != 0)
+        {
+            OFLOG_FATAL(mppsreplayLogger, "cannot start worker thread");
+            result = EXITCODE_CANNOT_INITIALIZE_NETWORK;
+            break;
+        }
+        ++started;
+    }
+    for (size_t i = 0; i < started; ++i)
+        workers[i]->join();
+    const Uint64 endTime = DcmMetricsRegistry::now();
+    for (size_t i = 0; i < workers.size(); ++i)
+        delete workers[i];
+
+    /* print the report */
+    statistics.print(COUT, endTime - schedule.getStartTime());
+
+    if ((result == EXITCODE_NO_ERROR) && (statistics.getFailedSessions() > 0))
+        result = EXITCODE_CANNOT_SEND_REQUEST;
+    return result;
+}
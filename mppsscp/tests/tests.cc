@@ -0,0 +1,28 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: main test program
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/oftest.h"
+
+OFTEST_REGISTER(mppsscp_history_dropExpired);
+OFTEST_REGISTER(mppsscp_history_archiveExpired);
+OFTEST_REGISTER(mppsscp_history_keepWithinRetention);
+OFTEST_REGISTER(mppsscp_log_reopen);
+OFTEST_REGISTER(mppsscp_log_recoverTornRecord);
+OFTEST_REGISTER(mppsscp_log_tailSegment);
+OFTEST_REGISTER(mppsscp_stream_tailReopenedLog);
+OFTEST_REGISTER(mppsscp_response_matchDIMSE);
+OFTEST_REGISTER(mppsscp_response_echoMatchesDIMSE);
+OFTEST_REGISTER(mppsscp_store_evictColdInstances);
+OFTEST_REGISTER(mppsscp_store_evictDroppedInstances);
+OFTEST_REGISTER(mppsscp_store_forgetExpiredInstances);
+OFTEST_REGISTER(mppsscp_store_mergeModificationList);
+OFTEST_REGISTER(mppsscp_store_getRequestedAttributes);
+OFTEST_MAIN("mppsscp")
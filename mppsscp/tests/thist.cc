@@ -0,0 +1,203 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Tests of the retention management of the MPPS history
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/oftest.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dmppshist.h"
+
+#define INCLUDE_CSTRING
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// maximum size of the segments written by the tests, a few records each
+#define TEST_SEGMENT_SIZE 256
+
+// retention of the history in seconds
+#define TEST_RETENTION 3600
+
+// SOP instance UIDs of an instance with expired records only, one with both expired
+// and recent records, and one with recent records only
+#define TEST_EXPIRED_UID "1.2.276.0.7230010.3.1.4.100"
+#define TEST_MIXED_UID   "1.2.276.0.7230010.3.1.4.200"
+#define TEST_LIVE_UID    "1.2.276.0.7230010.3.1.4.300"
+
+
+// create an empty directory for the segment files of a test
+static OFString makeDirectory()
+{
+  char name[] = "/tmp/mppshistXXXXXX";
+  if (mkdtemp(name) == NULL)
+    return "";
+  return name;
+}
+
+
+// remove the segment files and the directory of a test
+static void removeDirectory(const OFString &directory)
+{
+  OFVector<Uint64> segments;
+  if (DcmMppsSegmentLog::listSegments(directory, segments).good())
+  {
+    for (size_t i = 0; i < segments.size(); ++i)
+      unlink(DcmMppsSegmentLog::getSegmentFilename(directory, segments[i]).c_str());
+  }
+  rmdir(directory.c_str());
+}
+
+
+// append a number of records of an instance, an N-CREATE followed by N-SETs
+static void appendRecords(DcmMppsSegmentLog &log,
+                          const OFString &sopInstanceUID,
+                          const int count)
+{
+  const char *payload = "modification list";
+  Uint64 sequence;
+  for (int i = 0; i < count; ++i)
+  {
+    OFCHECK(log.append((i == 0) ? MPPS_RT_Create : MPPS_RT_Set, sopInstanceUID,
+      OFreinterpret_cast(const Uint8 *, payload), OFstatic_cast(Uint32, strlen(payload)), sequence).good());
+  }
+}
+
+
+// count the records per instance in all segments of a directory and check that the
+// sequence numbers are still in ascending order
+static void countRecords(const OFString &directory,
+                         OFMap<OFString, size_t> &counts,
+                         size_t &segmentCount)
+{
+  counts.clear();
+  OFVector<Uint64> segments;
+  OFCHECK(DcmMppsSegmentLog::listSegments(directory, segments).good());
+  segmentCount = segments.size();
+  Uint64 last = 0;
+  for (size_t i = 0; i < segments.size(); ++i)
+  {
+    DcmMppsSegmentReader reader;
+    OFCHECK(reader.open(DcmMppsSegmentLog::getSegmentFilename(directory, segments[i])).good());
+    DcmMppsRecord record;
+    OFCondition cond;
+    while ((cond = reader.readRecord(record)).good())
+    {
+      OFCHECK(record.sequence > last);
+      OFCHECK(record.sequence >= segments[i]);
+      last = record.sequence;
+      ++counts[record.sopInstanceUID];
+    }
+    OFCHECK(cond == MPPS_EC_EndOfSegment);
+  }
+}
+
+
+// write a history with expired and recent records, compact it and check the result
+static void testCompaction(const OFBool archive)
+{
+  const OFString directory = makeDirectory();
+  OFCHECK(!directory.empty());
+  const OFString archiveDirectory = archive ? makeDirectory() : "";
+  OFCHECK(!archive || !archiveDirectory.empty());
+
+  DcmMppsSegmentLog log;
+  log.setMaxSegmentSize(TEST_SEGMENT_SIZE);
+  OFCHECK(log.open(directory).good());
+  appendRecords(log, TEST_EXPIRED_UID, 4);
+  appendRecords(log, TEST_MIXED_UID, 2);
+  // the records appended before the cutoff are expired once the retention has passed
+  OFStandard::milliSleep(20);
+  const Uint64 cutoff = DcmMppsSegmentLog::getTimestamp();
+  OFStandard::milliSleep(20);
+  appendRecords(log, TEST_MIXED_UID, 1);
+  appendRecords(log, TEST_LIVE_UID, 6);
+  const Uint64 activeSegment = log.getActiveSegment();
+  const Uint64 nextSequence = log.getNextSequence();
+  OFMap<OFString, size_t> counts;
+  size_t segmentsBefore = 0;
+  countRecords(directory, counts, segmentsBefore);
+
+  DcmMppsHistoryCompactor compactor(log);
+  compactor.setRetention(TEST_RETENTION);
+  compactor.setArchiveDirectory(archiveDirectory);
+  compactor.setRateLimit(0);
+  OFCHECK(compactor.compact(cutoff + OFstatic_cast(Uint64, TEST_RETENTION) * 1000000).good());
+
+  // the expired instance is gone, the others are kept completely
+  size_t segmentsAfter = 0;
+  countRecords(directory, counts, segmentsAfter);
+  OFCHECK(counts.find(TEST_EXPIRED_UID) == counts.end());
+  OFCHECK_EQUAL(counts[TEST_MIXED_UID], 3);
+  OFCHECK_EQUAL(counts[TEST_LIVE_UID], 6);
+  // segments holding expired records only are removed
+  OFCHECK(segmentsAfter < segmentsBefore);
+  // and only the expired instance has been archived
+  if (archive)
+  {
+    size_t archiveSegments = 0;
+    countRecords(archiveDirectory, counts, archiveSegments);
+    OFCHECK(archiveSegments > 0);
+    OFCHECK_EQUAL(counts.size(), 1);
+    OFCHECK_EQUAL(counts[TEST_EXPIRED_UID], 4);
+  }
+
+  // the active segment is left alone and appending goes on where it was
+  OFCHECK_EQUAL(log.getActiveSegment(), activeSegment);
+  Uint64 sequence = 0;
+  OFCHECK(log.append(MPPS_RT_Set, TEST_LIVE_UID, NULL, 0, sequence).good());
+  OFCHECK_EQUAL(sequence, nextSequence);
+  log.close();
+  removeDirectory(directory);
+  if (archive)
+    removeDirectory(archiveDirectory);
+}
+
+
+OFTEST(mppsscp_history_dropExpired)
+{
+  testCompaction(OFFalse);
+}
+
+
+OFTEST(mppsscp_history_archiveExpired)
+{
+  testCompaction(OFTrue);
+}
+
+
+OFTEST(mppsscp_history_keepWithinRetention)
+{
+  const OFString directory = makeDirectory();
+  OFCHECK(!directory.empty());
+
+  DcmMppsSegmentLog log;
+  log.setMaxSegmentSize(TEST_SEGMENT_SIZE);
+  OFCHECK(log.open(directory).good());
+  appendRecords(log, TEST_EXPIRED_UID, 4);
+  appendRecords(log, TEST_LIVE_UID, 6);
+  OFMap<OFString, size_t> counts;
+  size_t segmentsBefore = 0;
+  countRecords(directory, counts, segmentsBefore);
+
+  DcmMppsHistoryCompactor compactor(log);
+  compactor.setRetention(TEST_RETENTION);
+  compactor.setRateLimit(0);
+  OFCHECK(compactor.compact(DcmMppsSegmentLog::getTimestamp()).good());
+
+  size_t segmentsAfter = 0;
+  countRecords(directory, counts, segmentsAfter);
+  OFCHECK_EQUAL(segmentsAfter, segmentsBefore);
+  OFCHECK_EQUAL(counts[TEST_EXPIRED_UID], 4);
+  OFCHECK_EQUAL(counts[TEST_LIVE_UID], 6);
+  log.close();
+  removeDirectory(directory);
+}
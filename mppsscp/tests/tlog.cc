@@ -0,0 +1,334 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Tests of the segment log and the event stream: recovery and tailing
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/oftest.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dmppslog.h"
+#include "dmppsstrm.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#define INCLUDE_CERRNO
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// maximum size of the segments written by the tests, a few records each
+#define TEST_SEGMENT_SIZE 256
+
+// time in milliseconds to wait for records from the event stream
+#define TEST_STREAM_TIMEOUT 5000
+
+
+// create an empty directory for the segment files of a test
+static OFString makeDirectory()
+{
+  char name[] = "/tmp/mppslogXXXXXX";
+  if (mkdtemp(name) == NULL)
+    return "";
+  return name;
+}
+
+
+// remove the segment files and the directory of a test
+static void removeDirectory(const OFString &directory)
+{
+  OFVector<Uint64> segments;
+  if (DcmMppsSegmentLog::listSegments(directory, segments).good())
+  {
+    for (size_t i = 0; i < segments.size(); ++i)
+      unlink(DcmMppsSegmentLog::getSegmentFilename(directory, segments[i]).c_str());
+  }
+  rmdir(directory.c_str());
+}
+
+
+// append a record with a payload derived from the sequence number it will get
+static OFCondition appendRecord(DcmMppsSegmentLog &log,
+                                Uint64 &sequence)
+{
+  char payload[32];
+  sprintf(payload, "payload %lu", OFstatic_cast(unsigned long, log.getNextSequence()));
+  return log.append(MPPS_RT_Create, "1.2.276.0.7230010.3.1.4.1", OFreinterpret_cast(const Uint8 *, payload),
+    OFstatic_cast(Uint32, strlen(payload)), sequence);
+}
+
+
+// read all complete records of a segment, returns the number of records
+static size_t readSegment(DcmMppsSegmentReader &reader,
+                          Uint64 &lastSequence,
+                          OFCondition &cond)
+{
+  size_t count = 0;
+  DcmMppsRecord record;
+  while ((cond = reader.readRecord(record)).good())
+  {
+    lastSequence = record.sequence;
+    ++count;
+  }
+  return count;
+}
+
+
+OFTEST(mppsscp_log_reopen)
+{
+  const OFString directory = makeDirectory();
+  OFCHECK(!directory.empty());
+
+  DcmMppsSegmentLog log;
+  log.setMaxSegmentSize(TEST_SEGMENT_SIZE);
+  OFCHECK(log.open(directory).good());
+  Uint64 sequence = 0;
+  for (int i = 0; i < 20; ++i)
+    OFCHECK(appendRecord(log, sequence).good());
+  OFCHECK_EQUAL(sequence, 20);
+  const Uint64 activeSegment = log.getActiveSegment();
+  log.close();
+
+  OFVector<Uint64> segments;
+  OFCHECK(DcmMppsSegmentLog::listSegments(directory, segments).good());
+  OFCHECK(segments.size() > 2);
+  OFCHECK_EQUAL(segments.back(), activeSegment);
+
+  // reopening scans the last segment for the next sequence number
+  DcmMppsSegmentLog reopened;
+  reopened.setMaxSegmentSize(TEST_SEGMENT_SIZE);
+  OFCHECK(reopened.open(directory).good());
+  OFCHECK_EQUAL(reopened.getNextSequence(), 21);
+  OFCHECK_EQUAL(reopened.getActiveSegment(), activeSegment);
+  OFCHECK(appendRecord(reopened, sequence).good());
+  OFCHECK_EQUAL(sequence, 21);
+  reopened.close();
+
+  // all records can be read back in order
+  OFCHECK(DcmMppsSegmentLog::listSegments(directory, segments).good());
+  Uint64 expected = 1;
+  for (size_t i = 0; i < segments.size(); ++i)
+  {
+    OFCHECK_EQUAL(segments[i], expected);
+    DcmMppsSegmentReader reader;
+    OFCHECK(reader.open(DcmMppsSegmentLog::getSegmentFilename(directory, segments[i])).good());
+    Uint64 last = 0;
+    OFCondition cond;
+    expected += readSegment(reader, last, cond);
+    OFCHECK(cond == MPPS_EC_EndOfSegment);
+    OFCHECK_EQUAL(last + 1, expected);
+  }
+  OFCHECK_EQUAL(expected, 22);
+  removeDirectory(directory);
+}
+
+
+OFTEST(mppsscp_log_recoverTornRecord)
+{
+  const OFString directory = makeDirectory();
+  OFCHECK(!directory.empty());
+
+  DcmMppsSegmentLog log;
+  OFCHECK(log.open(directory).good());
+  Uint64 sequence = 0;
+  for (int i = 0; i < 3; ++i)
+    OFCHECK(appendRecord(log, sequence).good());
+  log.close();
+
+  // leave half a record header behind, as a crash while appending would
+  const OFString filename = DcmMppsSegmentLog::getSegmentFilename(directory, 1);
+  struct stat st;
+  OFCHECK(stat(filename.c_str(), &st) == 0);
+  const off_t validLength = st.st_size;
+  Uint8 header[MPPS_LOG_HEADER_SIZE];
+  DcmMppsSegmentLog::encodeHeader(header, 4, DcmMppsSegmentLog::getTimestamp(), MPPS_RT_Set, 10, 100);
+  int fd = ::open(filename.c_str(), O_WRONLY | O_APPEND);
+  OFCHECK(fd >= 0);
+  OFCHECK(write(fd, header, MPPS_LOG_HEADER_SIZE / 2) == MPPS_LOG_HEADER_SIZE / 2);
+  ::close(fd);
+
+  OFCHECK(log.open(directory).good());
+  OFCHECK_EQUAL(log.getNextSequence(), 4);
+  OFCHECK(stat(filename.c_str(), &st) == 0);
+  OFCHECK_EQUAL(st.st_size, validLength);
+  OFCHECK(appendRecord(log, sequence).good());
+  OFCHECK_EQUAL(sequence, 4);
+  log.close();
+
+  DcmMppsSegmentReader reader;
+  OFCHECK(reader.open(filename).good());
+  Uint64 last = 0;
+  OFCondition cond;
+  OFCHECK_EQUAL(readSegment(reader, last, cond), 4);
+  OFCHECK(cond == MPPS_EC_EndOfSegment);
+  OFCHECK_EQUAL(last, 4);
+  removeDirectory(directory);
+}
+
+
+OFTEST(mppsscp_log_tailSegment)
+{
+  const OFString directory = makeDirectory();
+  OFCHECK(!directory.empty());
+
+  DcmMppsSegmentLog log;
+  OFCHECK(log.open(directory).good());
+  Uint64 sequence = 0;
+  OFCHECK(appendRecord(log, sequence).good());
+  OFCHECK(appendRecord(log, sequence).good());
+
+  const OFString filename = DcmMppsSegmentLog::getSegmentFilename(directory, log.getActiveSegment());
+  DcmMppsSegmentReader reader;
+  OFCHECK(reader.open(filename).good());
+  Uint64 last = 0;
+  OFCondition cond;
+  OFCHECK_EQUAL(readSegment(reader, last, cond), 2);
+  OFCHECK(cond == MPPS_EC_EndOfSegment);
+  // the end of the segment is reported again, without consuming anything
+  const Uint64 offset = reader.getOffset();
+  DcmMppsRecord record;
+  OFCHECK(reader.readRecord(record) == MPPS_EC_EndOfSegment);
+  OFCHECK_EQUAL(reader.getOffset(), offset);
+
+  // a record still being written is not read until it is complete
+  Uint8 header[MPPS_LOG_HEADER_SIZE];
+  DcmMppsSegmentLog::encodeHeader(header, 3, DcmMppsSegmentLog::getTimestamp(), MPPS_RT_Set, 0, 4);
+  int fd = ::open(filename.c_str(), O_WRONLY | O_APPEND);
+  OFCHECK(fd >= 0);
+  OFCHECK(write(fd, header, MPPS_LOG_HEADER_SIZE) == MPPS_LOG_HEADER_SIZE);
+  OFCHECK(reader.readRecord(record) == MPPS_EC_EndOfSegment);
+  OFCHECK_EQUAL(reader.getOffset(), offset);
+  OFCHECK(write(fd, "done", 4) == 4);
+  ::close(fd);
+  OFCHECK(reader.readRecord(record).good());
+  OFCHECK_EQUAL(record.sequence, 3);
+  OFCHECK_EQUAL(record.payloadLength, 4);
+  OFCHECK(memcmp(record.payload, "done", 4) == 0);
+  OFCHECK(reader.readRecord(record) == MPPS_EC_EndOfSegment);
+  log.close();
+  removeDirectory(directory);
+}
+
+
+// connect to the event stream and send the cursor
+static int connectStream(const OFString &socketPath,
+                         const Uint64 cursor)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  OFStandard::strlcpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path));
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, OFreinterpret_cast(struct sockaddr *, &addr), sizeof(addr)) != 0)
+  {
+    ::close(fd);
+    return -1;
+  }
+  Uint8 buffer[8];
+  for (int i = 0; i < 8; ++i)
+    buffer[i] = OFstatic_cast(Uint8, cursor >> (8 * i));
+  if (send(fd, buffer, sizeof(buffer), 0) != sizeof(buffer))
+  {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+// receive records from the event stream until the given sequence number has arrived,
+// returns the number of records received
+static size_t receiveRecords(const int fd,
+                             OFVector<Uint8> &buffer,
+                             size_t &offset,
+                             const Uint64 lastSequence,
+                             Uint64 &firstSequence)
+{
+  size_t count = 0;
+  firstSequence = 0;
+  for (;;)
+  {
+    // consume the complete records received so far
+    DcmMppsRecord record;
+    while ((offset < buffer.size()) && DcmMppsSegmentLog::decodeRecord(&buffer[offset],
+      OFstatic_cast(Uint32, buffer.size() - offset), record).good())
+    {
+      if (count++ == 0)
+        firstSequence = record.sequence;
+      offset += record.rawLength;
+      if (record.sequence >= lastSequence)
+        return count;
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, TEST_STREAM_TIMEOUT) <= 0)
+      return count;
+    Uint8 data[4096];
+    const ssize_t result = recv(fd, data, sizeof(data), 0);
+    if (result <= 0)
+      return count;
+    buffer.insert(buffer.end(), data, data + result);
+  }
+}
+
+
+OFTEST(mppsscp_stream_tailReopenedLog)
+{
+  const OFString directory = makeDirectory();
+  OFCHECK(!directory.empty());
+  const OFString socketPath = directory + "/stream.sock";
+
+  // some segments left behind by an earlier run
+  DcmMppsSegmentLog log;
+  log.setMaxSegmentSize(TEST_SEGMENT_SIZE);
+  OFCHECK(log.open(directory).good());
+  Uint64 sequence = 0;
+  for (int i = 0; i < 10; ++i)
+    OFCHECK(appendRecord(log, sequence).good());
+  log.close();
+
+  DcmMppsEventStream stream;
+  stream.setDirectory(directory);
+  stream.setSocketPath(socketPath);
+  stream.setMaxSegmentSize(TEST_SEGMENT_SIZE);
+  OFCHECK(stream.open().good());
+  OFCHECK_EQUAL(stream.getLog().getNextSequence(), 11);
+
+  // the consumer gets the stored records first, across all segments
+  const int fd = connectStream(socketPath, 0);
+  OFCHECK(fd >= 0);
+  OFVector<Uint8> buffer;
+  size_t offset = 0;
+  Uint64 first = 0;
+  OFCHECK_EQUAL(receiveRecords(fd, buffer, offset, 10, first), 10);
+  OFCHECK_EQUAL(first, 1);
+
+  // and then the ones appended later, also after the active segment changed
+  for (int i = 0; i < 10; ++i)
+    OFCHECK(appendRecord(stream.getLog(), sequence).good());
+  OFCHECK_EQUAL(sequence, 20);
+  OFCHECK_EQUAL(receiveRecords(fd, buffer, offset, 20, first), 10);
+  OFCHECK_EQUAL(first, 11);
+  OFCHECK_EQUAL(offset, buffer.size());
+
+  ::close(fd);
+  stream.close();
+  unlink(socketPath.c_str());
+  removeDirectory(directory);
+}
@@ -0,0 +1,375 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Tests of the DIMSE response encoder against the output of DIMSE
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/oftest.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/ofstd/ofthread.h"
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcostrmb.h"
+#include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmnet/assoc.h"
+#include "dcmtk/dcmnet/dimse.h"
+#include "dscprsp.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#include "dcmtk/ofstd/ofstdinc.h"
+
+// first TCP port tried for the association of a test, the next ones are tried if in use
+#define TEST_PORT_BASE 41104
+
+// number of TCP ports tried
+#define TEST_PORT_COUNT 100
+
+// timeout in seconds for the association of a test
+#define TEST_TIMEOUT 30
+
+// maximum size of an encoded command set compared by the tests
+#define TEST_MAX_COMMAND_SIZE 1024
+
+// presentation context IDs proposed by the tests
+#define TEST_PRESID_VERIFICATION 1
+#define TEST_PRESID_MPPS 3
+#define TEST_PRESID_STORCMT 5
+
+// SOP instance UIDs of the responses, the second one has an odd length
+#define TEST_UID_1 "1.2.276.0.7230010.3.1.4.2001"
+#define TEST_UID_2 "1.2.276.0.7230010.3.1.4.20021"
+
+
+/* response sent by DIMSE and by the encoder */
+struct TestResponse
+{
+  T_DIMSE_Command commandField;
+  T_ASC_PresentationContextID presID;
+  const char *sopClassUID;
+  const char *sopInstanceUID;
+  Uint16 messageID;
+  Uint16 status;
+};
+
+
+/* accepts one association and receives all commands sent on it until it is released */
+class TestCommandReceiver : public OFThread
+{
+
+  public:
+
+    TestCommandReceiver(T_ASC_Network *network)
+      : commandSets()
+      , messages()
+      , released(OFFalse)
+      , m_network(network)
+    {
+    }
+
+    ~TestCommandReceiver()
+    {
+      for (size_t i = 0; i < commandSets.size(); ++i)
+        delete commandSets[i];
+    }
+
+    /// the command sets received, in the order of their arrival
+    OFVector<DcmDataset *> commandSets;
+
+    /// the parsed messages of the command sets
+    OFVector<T_DIMSE_Message> messages;
+
+    /// OFTrue if the association was released by the peer
+    OFBool released;
+
+  protected:
+
+    virtual void run()
+    {
+      T_ASC_Association *assoc = NULL;
+      OFCondition cond = ASC_receiveAssociation(m_network, &assoc, ASC_DEFAULTMAXPDU, NULL, NULL, OFFalse, DUL_NOBLOCK, TEST_TIMEOUT);
+      if (cond.good())
+      {
+        const char *abstractSyntaxes[] = { UID_VerificationSOPClass, UID_ModalityPerformedProcedureStepSOPClass,
+                                           UID_StorageCommitmentPushModelSOPClass };
+        const char *transferSyntaxes[] = { UID_LittleEndianImplicitTransferSyntax };
+        cond = ASC_acceptContextsWithPreferredTransferSyntaxes(assoc->params, abstractSyntaxes, 3, transferSyntaxes, 1);
+      }
+      if (cond.good())
+        cond = ASC_acknowledgeAssociation(assoc);
+      while (cond.good())
+      {
+        T_ASC_PresentationContextID presID;
+        T_DIMSE_Message message;
+        DcmDataset *commandSet = NULL;
+        cond = DIMSE_receiveCommand(assoc, DIMSE_BLOCKING, 0, &presID, &message, NULL, &commandSet);
+        if (cond.good())
+        {
+          commandSets.push_back(commandSet);
+          messages.push_back(message);
+        }
+        else
+          delete commandSet;
+      }
+      if (cond == DUL_PEERREQUESTEDRELEASE)
+      {
+        released = OFTrue;
+        ASC_acknowledgeRelease(assoc);
+      }
+      if (assoc != NULL)
+      {
+        ASC_dropSCPAssociation(assoc);
+        ASC_destroyAssociation(&assoc);
+      }
+    }
+
+  private:
+
+    /// the network to accept the association on
+    T_ASC_Network *m_network;
+};
+
+
+// encode a command set as DIMSE sends it: implicit VR little endian with group length
+static void encodeCommandSet(DcmDataset &commandSet,
+                             OFVector<Uint8> &data)
+{
+  Uint8 buffer[TEST_MAX_COMMAND_SIZE];
+  DcmOutputBufferStream stream(buffer, sizeof(buffer));
+  commandSet.transferInit();
+  OFCHECK(commandSet.write(stream, EXS_LittleEndianImplicit, EET_ExplicitLength, NULL, EGL_recalcGL).good());
+  commandSet.transferEnd();
+  void *written = NULL;
+  offile_off_t length = 0;
+  stream.flushBuffer(written, length);
+  data.assign(buffer, buffer + OFstatic_cast(size_t, length));
+}
+
+
+// compare two encoded command sets
+static OFBool isEqual(const OFVector<Uint8> &data1,
+                      const OFVector<Uint8> &data2)
+{
+  return (data1.size() == data2.size()) && (data1.empty() || (memcmp(&data1[0], &data2[0], data1.size()) == 0));
+}
+
+
+// get the message ID and status of a parsed response
+static void getResponseFields(const T_DIMSE_Message &message,
+                              Uint16 &messageID,
+                              Uint16 &status)
+{
+  switch (message.CommandField)
+  {
+    case DIMSE_C_ECHO_RSP:
+      messageID = message.msg.CEchoRSP.MessageIDBeingRespondedTo;
+      status = message.msg.CEchoRSP.DimseStatus;
+      break;
+    case DIMSE_N_CREATE_RSP:
+      messageID = message.msg.NCreateRSP.MessageIDBeingRespondedTo;
+      status = message.msg.NCreateRSP.DimseStatus;
+      break;
+    case DIMSE_N_SET_RSP:
+      messageID = message.msg.NSetRSP.MessageIDBeingRespondedTo;
+      status = message.msg.NSetRSP.DimseStatus;
+      break;
+    case DIMSE_N_ACTION_RSP:
+      messageID = message.msg.NActionRSP.MessageIDBeingRespondedTo;
+      status = message.msg.NActionRSP.DimseStatus;
+      break;
+    default:
+      messageID = 0;
+      status = 0;
+      break;
+  }
+}
+
+
+// fill the message DIMSE sends for a response
+static void makeResponseMessage(const TestResponse &response,
+                                T_DIMSE_Message &message)
+{
+  memset(&message, 0, sizeof(message));
+  message.CommandField = response.commandField;
+  switch (response.commandField)
+  {
+    case DIMSE_C_ECHO_RSP:
+      message.msg.CEchoRSP.MessageIDBeingRespondedTo = response.messageID;
+      OFStandard::strlcpy(message.msg.CEchoRSP.AffectedSOPClassUID, response.sopClassUID, sizeof(DIC_UI));
+      message.msg.CEchoRSP.opts = O_ECHO_AFFECTEDSOPCLASSUID;
+      message.msg.CEchoRSP.DataSetType = DIMSE_DATASET_NULL;
+      message.msg.CEchoRSP.DimseStatus = response.status;
+      break;
+    case DIMSE_N_CREATE_RSP:
+      message.msg.NCreateRSP.MessageIDBeingRespondedTo = response.messageID;
+      OFStandard::strlcpy(message.msg.NCreateRSP.AffectedSOPClassUID, response.sopClassUID, sizeof(DIC_UI));
+      OFStandard::strlcpy(message.msg.NCreateRSP.AffectedSOPInstanceUID, response.sopInstanceUID, sizeof(DIC_UI));
+      message.msg.NCreateRSP.opts = O_NCREATE_AFFECTEDSOPCLASSUID | O_NCREATE_AFFECTEDSOPINSTANCEUID;
+      message.msg.NCreateRSP.DataSetType = DIMSE_DATASET_NULL;
+      message.msg.NCreateRSP.DimseStatus = response.status;
+      break;
+    case DIMSE_N_SET_RSP:
+      message.msg.NSetRSP.MessageIDBeingRespondedTo = response.messageID;
+      OFStandard::strlcpy(message.msg.NSetRSP.AffectedSOPClassUID, response.sopClassUID, sizeof(DIC_UI));
+      OFStandard::strlcpy(message.msg.NSetRSP.AffectedSOPInstanceUID, response.sopInstanceUID, sizeof(DIC_UI));
+      message.msg.NSetRSP.opts = O_NSET_AFFECTEDSOPCLASSUID | O_NSET_AFFECTEDSOPINSTANCEUID;
+      message.msg.NSetRSP.DataSetType = DIMSE_DATASET_NULL;
+      message.msg.NSetRSP.DimseStatus = response.status;
+      break;
+    default:
+      message.msg.NActionRSP.MessageIDBeingRespondedTo = response.messageID;
+      OFStandard::strlcpy(message.msg.NActionRSP.AffectedSOPClassUID, response.sopClassUID, sizeof(DIC_UI));
+      OFStandard::strlcpy(message.msg.NActionRSP.AffectedSOPInstanceUID, response.sopInstanceUID, sizeof(DIC_UI));
+      message.msg.NActionRSP.opts = O_NACTION_AFFECTEDSOPCLASSUID | O_NACTION_AFFECTEDSOPINSTANCEUID;
+      message.msg.NActionRSP.DataSetType = DIMSE_DATASET_NULL;
+      message.msg.NActionRSP.DimseStatus = response.status;
+      break;
+  }
+}
+
+
+// open a network listening on a free port
+static T_ASC_Network *openAcceptorNetwork(int &port)
+{
+  T_ASC_Network *network = NULL;
+  for (port = TEST_PORT_BASE; port < TEST_PORT_BASE + TEST_PORT_COUNT; ++port)
+  {
+    if (ASC_initializeNetwork(NET_ACCEPTOR, port, TEST_TIMEOUT, &network).good())
+      return network;
+  }
+  return NULL;
+}
+
+
+// request an association with the receiver listening on the given port
+static T_ASC_Association *requestAssociation(T_ASC_Network *network,
+                                             const int port)
+{
+  T_ASC_Parameters *params = NULL;
+  OFCHECK(ASC_createAssociationParameters(&params, ASC_DEFAULTMAXPDU).good());
+  OFCHECK(ASC_setAPTitles(params, "TESTSCU", "TESTSCP", NULL).good());
+  char peer[32];
+  sprintf(peer, "localhost:%d", port);
+  OFCHECK(ASC_setPresentationAddresses(params, "localhost", peer).good());
+  const char *transferSyntaxes[] = { UID_LittleEndianImplicitTransferSyntax };
+  OFCHECK(ASC_addPresentationContext(params, TEST_PRESID_VERIFICATION, UID_VerificationSOPClass, transferSyntaxes, 1).good());
+  OFCHECK(ASC_addPresentationContext(params, TEST_PRESID_MPPS, UID_ModalityPerformedProcedureStepSOPClass, transferSyntaxes, 1).good());
+  OFCHECK(ASC_addPresentationContext(params, TEST_PRESID_STORCMT, UID_StorageCommitmentPushModelSOPClass, transferSyntaxes, 1).good());
+  T_ASC_Association *assoc = NULL;
+  if (ASC_requestAssociation(network, params, &assoc).bad())
+  {
+    OFCHECK_FAIL("cannot request association on port " << port);
+    if (assoc != NULL)
+      ASC_destroyAssociation(&assoc);
+    else
+      ASC_destroyAssociationParameters(&params);
+    return NULL;
+  }
+  return assoc;
+}
+
+
+// send each response with DIMSE and with the encoder on one association and compare
+// the command sets, both as encoded by the sender and as received by the peer
+static void checkResponses(const TestResponse *responses,
+                           const size_t count)
+{
+  int port = 0;
+  T_ASC_Network *acceptorNetwork = openAcceptorNetwork(port);
+  OFCHECK(acceptorNetwork != NULL);
+  T_ASC_Network *requestorNetwork = NULL;
+  OFCHECK(ASC_initializeNetwork(NET_REQUESTOR, 0, TEST_TIMEOUT, &requestorNetwork).good());
+  if ((acceptorNetwork == NULL) || (requestorNetwork == NULL))
+    return;
+  TestCommandReceiver receiver(acceptorNetwork);
+  OFCHECK_EQUAL(receiver.start(), 0);
+
+  T_ASC_Association *assoc = requestAssociation(requestorNetwork, port);
+  DcmDimseResponseEncoder encoder;
+  OFVector<OFVector<Uint8> > expected;
+  for (size_t i = 0; (assoc != NULL) && (i < count); ++i)
+  {
+    const TestResponse &response = responses[i];
+    T_DIMSE_Message message;
+    makeResponseMessage(response, message);
+    DcmDataset *commandSet = NULL;
+    OFCHECK(DIMSE_sendMessageUsingMemoryData(assoc, response.presID, &message, NULL, NULL, NULL, NULL, &commandSet).good());
+    OFCHECK(commandSet != NULL);
+    expected.push_back(OFVector<Uint8>());
+    if (commandSet != NULL)
+      encodeCommandSet(*commandSet, expected.back());
+    delete commandSet;
+
+    // the encoder produces the same bytes as DIMSE
+    if (response.commandField == DIMSE_C_ECHO_RSP)
+      OFCHECK(encoder.sendEchoResponse(assoc, response.presID, response.messageID, response.sopClassUID).good());
+    else
+    {
+      const OFVector<Uint8> &encoded = encoder.encodeResponse(response.commandField, response.messageID,
+        response.sopClassUID, response.sopInstanceUID, response.status);
+      OFCHECK(isEqual(encoded, expected.back()));
+      OFCHECK(encoder.sendResponse(assoc, response.presID, response.commandField, response.messageID,
+        response.sopClassUID, response.sopInstanceUID, response.status).good());
+    }
+  }
+  if (assoc != NULL)
+  {
+    OFCHECK(ASC_releaseAssociation(assoc).good());
+    ASC_destroyAssociation(&assoc);
+  }
+  OFCHECK_EQUAL(receiver.join(), 0);
+  OFCHECK(receiver.released);
+
+  // the peer receives both responses as the same command set and parses them alike
+  OFCHECK_EQUAL(receiver.commandSets.size(), 2 * count);
+  for (size_t i = 0; (i < count) && (2 * i + 1 < receiver.commandSets.size()); ++i)
+  {
+    OFVector<Uint8> fromDIMSE;
+    OFVector<Uint8> fromEncoder;
+    encodeCommandSet(*receiver.commandSets[2 * i], fromDIMSE);
+    encodeCommandSet(*receiver.commandSets[2 * i + 1], fromEncoder);
+    OFCHECK(isEqual(fromDIMSE, expected[i]));
+    OFCHECK(isEqual(fromEncoder, expected[i]));
+    const T_DIMSE_Message &message = receiver.messages[2 * i + 1];
+    OFCHECK_EQUAL(message.CommandField, responses[i].commandField);
+    Uint16 messageID = 0;
+    Uint16 status = 0;
+    getResponseFields(message, messageID, status);
+    OFCHECK_EQUAL(messageID, responses[i].messageID);
+    OFCHECK_EQUAL(status, responses[i].status);
+  }
+
+  ASC_dropNetwork(&requestorNetwork);
+  ASC_dropNetwork(&acceptorNetwork);
+}
+
+
+OFTEST(mppsscp_response_matchDIMSE)
+{
+  const TestResponse responses[] =
+  {
+    { DIMSE_N_CREATE_RSP, TEST_PRESID_MPPS, UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_1, 1, STATUS_Success },
+    { DIMSE_N_SET_RSP, TEST_PRESID_MPPS, UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_1, 2, STATUS_Success },
+    // the same template with another message ID and a UID of odd length, which is padded
+    { DIMSE_N_SET_RSP, TEST_PRESID_MPPS, UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_2, 0x1234, STATUS_Success },
+    { DIMSE_N_SET_RSP, TEST_PRESID_MPPS, UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_2, 4, STATUS_N_ProcessingFailure },
+    { DIMSE_N_CREATE_RSP, TEST_PRESID_MPPS, UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_1, 5, STATUS_N_DuplicateSOPInstance },
+    { DIMSE_N_ACTION_RSP, TEST_PRESID_STORCMT, UID_StorageCommitmentPushModelSOPClass, UID_StorageCommitmentPushModelSOPInstance, 6, STATUS_Success }
+  };
+  checkResponses(responses, sizeof(responses) / sizeof(responses[0]));
+}
+
+
+OFTEST(mppsscp_response_echoMatchesDIMSE)
+{
+  const TestResponse responses[] =
+  {
+    { DIMSE_C_ECHO_RSP, TEST_PRESID_VERIFICATION, UID_VerificationSOPClass, NULL, 1, STATUS_Success },
+    { DIMSE_C_ECHO_RSP, TEST_PRESID_VERIFICATION, UID_VerificationSOPClass, NULL, 0xfffe, STATUS_Success }
+  };
+  checkResponses(responses, sizeof(responses) / sizeof(responses[0]));
+}
@@ -0,0 +1,378 @@
+/*
+ *
+ *  Module:  mppsscp
+ *
+ *  Purpose: Tests of the in-memory store of MPPS instances
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/oftest.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmdata/dctk.h"
+#include "dmppsstore.h"
+#include "dmppsstrm.h"
+
+#define INCLUDE_CSTDLIB
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <sys/types.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// SOP instance UIDs of the instances stored by the tests
+#define TEST_UID_1 "1.2.276.0.7230010.3.1.4.1001"
+#define TEST_UID_2 "1.2.276.0.7230010.3.1.4.1002"
+#define TEST_UID_3 "1.2.276.0.7230010.3.1.4.1003"
+
+
+// create an empty directory for the segment files of a test
+static OFString makeDirectory()
+{
+  char name[] = "/tmp/mppsstoreXXXXXX";
+  if (mkdtemp(name) == NULL)
+    return "";
+  return name;
+}
+
+
+// remove the segment files of a test, optionally the directory as well
+static void removeSegments(const OFString &directory,
+                           const OFBool removeDir)
+{
+  OFVector<Uint64> segments;
+  if (DcmMppsSegmentLog::listSegments(directory, segments).good())
+  {
+    for (size_t i = 0; i < segments.size(); ++i)
+      unlink(DcmMppsSegmentLog::getSegmentFilename(directory, segments[i]).c_str());
+  }
+  if (removeDir)
+    rmdir(directory.c_str());
+}
+
+
+// fill an N-CREATE attribute list of a procedure step in progress
+static void makeCreateDataset(DcmDataset &dataset,
+                              const char *stationAETitle)
+{
+  dataset.clear();
+  dataset.putAndInsertString(DCM_PerformedStationAETitle, stationAETitle);
+  dataset.putAndInsertString(DCM_PerformedProcedureStepID, "PPS1");
+  dataset.putAndInsertString(DCM_PerformedProcedureStepStartDate, "20160801");
+  dataset.putAndInsertString(DCM_PerformedProcedureStepStatus, "IN PROGRESS");
+  dataset.putAndInsertString(DCM_PerformedProcedureStepEndDate, "");
+}
+
+
+// fill an N-SET modification list completing a procedure step
+static void makeCompleteDataset(DcmDataset &dataset)
+{
+  dataset.clear();
+  dataset.putAndInsertString(DCM_PerformedProcedureStepStatus, "COMPLETED");
+  dataset.putAndInsertString(DCM_PerformedProcedureStepEndDate, "20160802");
+}
+
+
+// create an instance and complete it, recording both requests in the stream if given
+static void storeCompletedInstance(DcmMppsInstanceStore &store,
+                                   DcmMppsEventStream *stream,
+                                   const OFString &sopInstanceUID,
+                                   const char *stationAETitle)
+{
+  DcmDataset dataset;
+  Uint64 sequence = 0;
+  makeCreateDataset(dataset, stationAETitle);
+  OFCHECK(store.createInstance(UID_ModalityPerformedProcedureStepSOPClass, sopInstanceUID, dataset).good());
+  if (stream != NULL)
+  {
+    OFCHECK(stream->append(MPPS_RT_Create, sopInstanceUID, dataset, &sequence).good());
+    store.addHistoryRecord(sopInstanceUID, sequence);
+  }
+  makeCompleteDataset(dataset);
+  OFCHECK(store.setInstance(sopInstanceUID, dataset).good());
+  if (stream != NULL)
+  {
+    OFCHECK(stream->append(MPPS_RT_Set, sopInstanceUID, dataset, &sequence).good());
+    store.addHistoryRecord(sopInstanceUID, sequence);
+  }
+}
+
+
+// check the complete content of a stored instance
+static void checkCompletedInstance(DcmMppsInstanceStore &store,
+                                   const OFString &sopInstanceUID,
+                                   const char *stationAETitle)
+{
+  DcmDataset dataset;
+  OFVector<Uint32> missing;
+  OFString value;
+  OFCHECK(store.getInstance(sopInstanceUID, NULL, 0, dataset, missing).good());
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedStationAETitle, value).good());
+  OFCHECK_EQUAL(value, stationAETitle);
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedProcedureStepStatus, value).good());
+  OFCHECK_EQUAL(value, "COMPLETED");
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedProcedureStepEndDate, value).good());
+  OFCHECK_EQUAL(value, "20160802");
+}
+
+
+OFTEST(mppsscp_store_evictColdInstances)
+{
+  const OFString directory = makeDirectory();
+  OFCHECK(!directory.empty());
+  DcmMppsEventStream stream;
+  stream.setDirectory(directory);
+  OFCHECK(stream.open().good());
+
+  DcmMppsInstanceStore store;
+  store.setColdAfter(1);
+  store.setColdCacheSize(1);
+  store.setHistory(&stream.getLog(), 0);
+  storeCompletedInstance(store, &stream, TEST_UID_1, "STATION1");
+  storeCompletedInstance(store, &stream, TEST_UID_2, "STATION2");
+  // an instance that is not in the history cannot be evicted
+  storeCompletedInstance(store, NULL, TEST_UID_3, "STATION3");
+
+  // all instances are cold, only the newest one of those in the history stays
+  store.ageInstances(time(NULL) + 10);
+  OFCHECK_EQUAL(store.getNumberOfInstances(), 2);
+  OFCHECK_EQUAL(store.getNumberOfEvictedInstances(), 1);
+  OFCHECK(store.findInstance(TEST_UID_1) == NULL);
+  OFCHECK(store.findInstance(TEST_UID_3) != NULL);
+
+  // evicted instances are still known
+  DcmDataset dataset;
+  makeCreateDataset(dataset, "STATION1");
+  OFCHECK(store.createInstance(UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_1, dataset) == MPPS_EC_DuplicateSOPInstance);
+  makeCompleteDataset(dataset);
+  OFCHECK(store.setInstance(TEST_UID_1, dataset) == MPPS_EC_InstanceFinalized);
+
+  // and restored from the history on access, with all modifications
+  checkCompletedInstance(store, TEST_UID_1, "STATION1");
+  OFCHECK(store.findInstance(TEST_UID_1) != NULL);
+  OFCHECK(store.findInstance(TEST_UID_1)->isFinal());
+  OFCHECK_EQUAL(store.getNumberOfInstances(), 3);
+
+  // the restored instance is the newest cold one, so the other one goes now
+  store.ageInstances(time(NULL) + 10);
+  OFCHECK(store.findInstance(TEST_UID_1) != NULL);
+  OFCHECK(store.findInstance(TEST_UID_2) == NULL);
+  OFCHECK_EQUAL(store.getNumberOfEvictedInstances(), 2);
+  checkCompletedInstance(store, TEST_UID_2, "STATION2");
+
+  stream.close();
+  removeSegments(directory, OFTrue);
+}
+
+
+OFTEST(mppsscp_store_evictDroppedInstances)
+{
+  const OFString directory = makeDirectory();
+  OFCHECK(!directory.empty());
+  DcmMppsEventStream stream;
+  stream.setDirectory(directory);
+  OFCHECK(stream.open().good());
+
+  DcmMppsInstanceStore store;
+  store.setColdAfter(1);
+  store.setColdCacheSize(0);
+  store.setHistory(&stream.getLog(), 0);
+  storeCompletedInstance(store, &stream, TEST_UID_1, "STATION1");
+  store.ageInstances(time(NULL) + 10);
+  OFCHECK_EQUAL(store.getNumberOfInstances(), 0);
+  OFCHECK_EQUAL(store.getNumberOfEvictedInstances(), 1);
+
+  // an instance that is no longer in the history is gone for good
+  stream.close();
+  removeSegments(directory, OFFalse);
+  OFCHECK(stream.open().good());
+  DcmDataset dataset;
+  OFVector<Uint32> missing;
+  OFCHECK(store.getInstance(TEST_UID_1, NULL, 0, dataset, missing) == MPPS_EC_NoSuchSOPInstance);
+  OFCHECK_EQUAL(store.getNumberOfEvictedInstances(), 0);
+  makeCreateDataset(dataset, "STATION1");
+  OFCHECK(store.createInstance(UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_1, dataset).good());
+
+  stream.close();
+  removeSegments(directory, OFTrue);
+}
+
+
+OFTEST(mppsscp_store_forgetExpiredInstances)
+{
+  const OFString directory = makeDirectory();
+  OFCHECK(!directory.empty());
+  DcmMppsEventStream stream;
+  stream.setDirectory(directory);
+  OFCHECK(stream.open().good());
+
+  DcmMppsInstanceStore store;
+  store.setColdAfter(1);
+  store.setColdCacheSize(0);
+  store.setHistory(&stream.getLog(), 3600);
+  storeCompletedInstance(store, &stream, TEST_UID_1, "STATION1");
+  store.ageInstances(time(NULL) + 10);
+  OFCHECK_EQUAL(store.getNumberOfEvictedInstances(), 1);
+
+  // once the retention has expired, the instance is dropped from the index as well
+  store.ageInstances(time(NULL) + 3600 + 10);
+  OFCHECK_EQUAL(store.getNumberOfEvictedInstances(), 0);
+  DcmDataset dataset;
+  OFVector<Uint32> missing;
+  OFCHECK(store.getInstance(TEST_UID_1, NULL, 0, dataset, missing) == MPPS_EC_NoSuchSOPInstance);
+
+  stream.close();
+  removeSegments(directory, OFTrue);
+}
+
+
+// add an item referencing a series to the Performed Series Sequence of a dataset
+static void addPerformedSeries(DcmDataset &dataset,
+                               const char *seriesInstanceUID)
+{
+  DcmItem *item = NULL;
+  OFCHECK(dataset.findOrCreateSequenceItem(DCM_PerformedSeriesSequence, item, -2 /* append */).good());
+  if (item != NULL)
+    OFCHECK(item->putAndInsertString(DCM_SeriesInstanceUID, seriesInstanceUID).good());
+}
+
+
+OFTEST(mppsscp_store_mergeModificationList)
+{
+  DcmMppsInstanceStore store;
+  DcmDataset dataset;
+  makeCreateDataset(dataset, "STATION1");
+  addPerformedSeries(dataset, "1.2.276.0.7230010.3.1.3.1");
+  OFCHECK(store.createInstance(UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_1, dataset).good());
+  OFCHECK(store.createInstance(UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_1, dataset) == MPPS_EC_DuplicateSOPInstance);
+
+  // replace an attribute by a longer value, add a new one and replace the sequence
+  dataset.clear();
+  dataset.putAndInsertString(DCM_PerformedProcedureStepID, "PPS1-RENAMED");
+  dataset.putAndInsertString(DCM_PerformedProcedureStepDescription, "CHEST");
+  addPerformedSeries(dataset, "1.2.276.0.7230010.3.1.3.2");
+  addPerformedSeries(dataset, "1.2.276.0.7230010.3.1.3.3");
+  OFCHECK(store.setInstance(TEST_UID_1, dataset).good());
+  OFCHECK(store.setInstance(TEST_UID_2, dataset) == MPPS_EC_NoSuchSOPInstance);
+  const DcmMppsInstance *instance = store.findInstance(TEST_UID_1);
+  OFCHECK(instance != NULL);
+  if (instance != NULL)
+  {
+    OFCHECK_EQUAL(instance->getNumberOfAttributes(), 7);
+    OFCHECK_EQUAL(instance->getPerformedProcedureStepStatus(), "IN PROGRESS");
+    OFCHECK(!instance->isFinal());
+  }
+
+  // the attributes not in the modification list are left as they were
+  dataset.clear();
+  OFVector<Uint32> missing;
+  OFString value;
+  OFCHECK(store.getInstance(TEST_UID_1, NULL, 0, dataset, missing).good());
+  OFCHECK(missing.empty());
+  OFCHECK_EQUAL(dataset.card(), 7);
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedStationAETitle, value).good());
+  OFCHECK_EQUAL(value, "STATION1");
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedProcedureStepStartDate, value).good());
+  OFCHECK_EQUAL(value, "20160801");
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedProcedureStepID, value).good());
+  OFCHECK_EQUAL(value, "PPS1-RENAMED");
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedProcedureStepDescription, value).good());
+  OFCHECK_EQUAL(value, "CHEST");
+  DcmSequenceOfItems *sequence = NULL;
+  OFCHECK(dataset.findAndGetSequence(DCM_PerformedSeriesSequence, sequence).good());
+  if (sequence != NULL)
+  {
+    OFCHECK_EQUAL(sequence->card(), 2);
+    OFCHECK(sequence->getItem(0)->findAndGetOFString(DCM_SeriesInstanceUID, value).good());
+    OFCHECK_EQUAL(value, "1.2.276.0.7230010.3.1.3.2");
+  }
+
+  // many modifications of the same attribute leave a single value
+  for (int i = 0; i < 50; ++i)
+  {
+    dataset.clear();
+    dataset.putAndInsertString(DCM_PerformedProcedureStepDescription, (i % 2 == 0) ? "HEAD AND NECK" : "CHEST");
+    OFCHECK(store.setInstance(TEST_UID_1, dataset).good());
+  }
+  if (instance != NULL)
+    OFCHECK_EQUAL(instance->getNumberOfAttributes(), 7);
+
+  // once completed, the instance cannot be modified any more
+  makeCompleteDataset(dataset);
+  OFCHECK(store.setInstance(TEST_UID_1, dataset).good());
+  OFCHECK(store.setInstance(TEST_UID_1, dataset) == MPPS_EC_InstanceFinalized);
+  dataset.clear();
+  OFCHECK(store.getInstance(TEST_UID_1, NULL, 0, dataset, missing).good());
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedProcedureStepStatus, value).good());
+  OFCHECK_EQUAL(value, "COMPLETED");
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedProcedureStepDescription, value).good());
+  OFCHECK_EQUAL(value, "CHEST");
+}
+
+
+// request some attributes of an instance in the form of an N-GET attribute identifier
+// list and check that exactly the stored ones are returned
+static void checkRequestedAttributes(DcmMppsInstanceStore &store,
+                                     const OFString &sopInstanceUID)
+{
+  // unsorted, with an attribute requested twice and one that is not stored
+  const Uint16 tagList[] =
+  {
+    0x0040, 0x0252,   // Performed Procedure Step Status
+    0x0040, 0x0241,   // Performed Station AE Title
+    0x0040, 0x0254,   // Performed Procedure Step Description (not stored)
+    0x0040, 0x0252    // Performed Procedure Step Status (again)
+  };
+  DcmDataset dataset;
+  OFVector<Uint32> missing;
+  OFString value;
+  OFCHECK(store.getInstance(sopInstanceUID, tagList, 4, dataset, missing).good());
+  OFCHECK_EQUAL(dataset.card(), 2);
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedProcedureStepStatus, value).good());
+  OFCHECK_EQUAL(value, "COMPLETED");
+  OFCHECK(dataset.findAndGetOFString(DCM_PerformedStationAETitle, value).good());
+  OFCHECK_EQUAL(value, "STATION1");
+  OFCHECK_EQUAL(missing.size(), 1);
+  if (missing.size() == 1)
+    OFCHECK_EQUAL(missing[0], 0x00400254);
+
+  // an attribute stored with an empty value is not missing
+  const Uint16 emptyTag[] = { 0x0040, 0x0250 };   // Performed Procedure Step End Date
+  dataset.clear();
+  missing.clear();
+  OFCHECK(store.getInstance(sopInstanceUID, emptyTag, 1, dataset, missing).good());
+  OFCHECK_EQUAL(dataset.card(), 1);
+  OFCHECK(missing.empty());
+}
+
+
+OFTEST(mppsscp_store_getRequestedAttributes)
+{
+  DcmMppsInstanceStore store;
+  DcmDataset dataset;
+  makeCreateDataset(dataset, "STATION1");
+  OFCHECK(store.createInstance(UID_ModalityPerformedProcedureStepSOPClass, TEST_UID_1, dataset).good());
+  dataset.clear();
+  dataset.putAndInsertString(DCM_PerformedProcedureStepStatus, "COMPLETED");
+  OFCHECK(store.setInstance(TEST_UID_1, dataset).good());
+  checkRequestedAttributes(store, TEST_UID_1);
+
+  // the same from the compressed instance
+  store.setColdAfter(1);
+  store.ageInstances(time(NULL) + 10);
+  OFCHECK(store.findInstance(TEST_UID_1) != NULL);
+#ifdef WITH_ZLIB
+  OFCHECK(store.findInstance(TEST_UID_1)->isCompressed());
+#endif
+  checkRequestedAttributes(store, TEST_UID_1);
+
+  // attributes of an unknown instance cannot be requested
+  const Uint16 tagList[] = { 0x0040, 0x0252 };
+  OFVector<Uint32> missing;
+  dataset.clear();
+  OFCHECK(store.getInstance(TEST_UID_2, tagList, 1, dataset, missing) == MPPS_EC_NoSuchSOPInstance);
+  OFCHECK(missing.empty());
+}
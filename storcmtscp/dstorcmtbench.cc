@@ -0,0 +1,660 @@
+/*
+ *
+ *  Module:  storcmtscp
+ *
+ *  Purpose: End-to-end benchmark of Storage Commitment requests
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dstorcmtbench.h"
+#include "dstorcmtcond.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcuid.h"
+#include "dcmtk/dcmnet/diutil.h"
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#include "dcmtk/ofstd/ofstdinc.h"
+
+BEGIN_EXTERN_C
+#include <time.h>
+#include <unistd.h>
+END_EXTERN_C
+
+// interval in microseconds at which the client checks for the N-EVENT-REPORT request
+#define STORCMT_BENCH_POLL_INTERVAL 1000
+
+// interval in seconds at which the listener checks whether it should stop
+#define STORCMT_BENCH_LISTEN_INTERVAL 1
+
+
+// print a latency in microseconds as milliseconds with three decimals
+static void printMilliseconds(STD_NAMESPACE ostream &out,
+                              const Uint64 microseconds)
+{
+  char buf[32];
+  sprintf(buf, "%10.3f", OFstatic_cast(double, microseconds) / 1000.0);
+  out << buf;
+}
+
+
+// receive the dataset of an N-EVENT-REPORT request and answer it with status Success
+static OFCondition answerEventReport(T_ASC_Association *assoc,
+                                     const T_ASC_PresentationContextID presID,
+                                     const T_DIMSE_N_EventReportRQ &request,
+                                     const Uint32 timeout,
+                                     OFString &transactionUID)
+{
+  OFString tempStr;
+  OFCondition cond = EC_Normal;
+  transactionUID.clear();
+  if (request.DataSetType == DIMSE_DATASET_PRESENT)
+  {
+    DcmDataset *dataset = NULL;
+    T_ASC_PresentationContextID datasetPresID = presID;
+    cond = DIMSE_receiveDataSetInMemory(assoc, (timeout > 0) ? DIMSE_NONBLOCKING : DIMSE_BLOCKING,
+      timeout, &datasetPresID, &dataset, NULL /* callback */, NULL /* callbackContext */);
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Failed receiving N-EVENT-REPORT dataset: " << DimseCondition::dump(tempStr, cond));
+      return cond;
+    }
+    dataset->findAndGetOFString(DCM_TransactionUID, transactionUID);
+    delete dataset;
+  }
+
+  T_DIMSE_Message response;
+  memset(&response, 0, sizeof(response));
+  response.CommandField = DIMSE_N_EVENT_REPORT_RSP;
+  T_DIMSE_N_EventReportRSP &eventReportRsp = response.msg.NEventReportRSP;
+  eventReportRsp.MessageIDBeingRespondedTo = request.MessageID;
+  eventReportRsp.DimseStatus = STATUS_Success;
+  eventReportRsp.DataSetType = DIMSE_DATASET_NULL;
+  eventReportRsp.EventTypeID = request.EventTypeID;
+  eventReportRsp.opts = O_NEVENTREPORT_AFFECTEDSOPCLASSUID | O_NEVENTREPORT_AFFECTEDSOPINSTANCEUID | O_NEVENTREPORT_EVENTTYPEID;
+  OFStandard::strlcpy(eventReportRsp.AffectedSOPClassUID, request.AffectedSOPClassUID, sizeof(eventReportRsp.AffectedSOPClassUID));
+  OFStandard::strlcpy(eventReportRsp.AffectedSOPInstanceUID, request.AffectedSOPInstanceUID, sizeof(eventReportRsp.AffectedSOPInstanceUID));
+  cond = DIMSE_sendMessageUsingMemoryData(assoc, presID, &response, NULL /* statusDetail */, NULL /* dataObject */,
+    NULL /* callback */, NULL /* callbackContext */);
+  if (cond.bad())
+    DCMNET_ERROR("Failed sending N-EVENT-REPORT response: " << DimseCondition::dump(tempStr, cond));
+  return cond;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmStorCmtBenchConfig::DcmStorCmtBenchConfig()
+  : peerHost()
+  , peerPort(104)
+  , ourAETitle("STORCMTBENCH")
+  , peerAETitle("ANY-SCP")
+  , maxReceivePDULength(ASC_DEFAULTMAXPDU)
+  , acseTimeout(30)
+  , dimseTimeout(0)
+  , reportTimeout(STORCMT_BENCH_DEFAULT_REPORT_TIMEOUT)
+{
+}
+
+// ----------------------------------------------------------------------------
+
+DcmStorCmtBenchStatistics::DcmStorCmtBenchStatistics()
+  : actionLatency()
+  , reportLatency()
+  , committed(0)
+  , partial(0)
+  , timedOut(0)
+  , failed(0)
+{
+}
+
+
+void DcmStorCmtBenchStatistics::printHeader(STD_NAMESPACE ostream &out)
+{
+  char buf[160];
+  sprintf(buf, "%-5s %8s %-14s %8s %10s %10s %10s %10s %10s %10s", "path", "refs", "latency (ms)",
+    "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+  out << buf << OFendl;
+}
+
+
+void DcmStorCmtBenchStatistics::print(STD_NAMESPACE ostream &out,
+                                      const DcmStorCmtBenchPath path,
+                                      const Uint32 references) const
+{
+  const char *pathName = (path == STORCMT_BP_SameAssociation) ? "same" : "new";
+  const DcmLatencyHistogram *histograms[2] = { &actionLatency, &reportLatency };
+  const char *names[2] = { "N-ACTION-RSP", "N-EVENT-REPORT" };
+  char buf[64];
+  for (size_t i = 0; i < 2; ++i)
+  {
+    const Uint64 count = histograms[i]->getCount();
+    sprintf(buf, "%-5s %8u %-14s %8lu ", pathName, OFstatic_cast(unsigned int, references), names[i],
+      OFstatic_cast(unsigned long, count));
+    out << buf;
+    if (count > 0)
+    {
+      printMilliseconds(out, histograms[i]->getSum() / count);
+      out << ' ';
+      printMilliseconds(out, histograms[i]->getQuantile(0.5));
+      out << ' ';
+      printMilliseconds(out, histograms[i]->getQuantile(0.9));
+      out << ' ';
+      printMilliseconds(out, histograms[i]->getQuantile(0.99));
+      out << ' ';
+      printMilliseconds(out, histograms[i]->getQuantile(0.999));
+      out << ' ';
+      printMilliseconds(out, histograms[i]->getQuantile(1.0));
+    }
+    out << OFendl;
+  }
+  out << "      " << committed << " committed, " << partial << " with failures, "
+      << timedOut << " timed out, " << failed << " failed" << OFendl;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmStorCmtBenchTracker::DcmStorCmtBenchTracker()
+  : m_mutex()
+  , m_transactionUID()
+  , m_arrivalTime(0)
+  , m_eventTypeID(0)
+{
+}
+
+
+void DcmStorCmtBenchTracker::expect(const OFString &transactionUID)
+{
+  m_mutex.lock();
+  m_transactionUID = transactionUID;
+  m_arrivalTime = 0;
+  m_eventTypeID = 0;
+  m_mutex.unlock();
+}
+
+
+OFBool DcmStorCmtBenchTracker::arrive(const OFString &transactionUID,
+                                      const Uint64 arrivalTime,
+                                      const Uint16 eventTypeID)
+{
+  OFBool expected = OFFalse;
+  m_mutex.lock();
+  if (!m_transactionUID.empty() && (transactionUID == m_transactionUID) && (m_arrivalTime == 0))
+  {
+    m_arrivalTime = arrivalTime;
+    m_eventTypeID = eventTypeID;
+    expected = OFTrue;
+  }
+  m_mutex.unlock();
+  return expected;
+}
+
+
+OFBool DcmStorCmtBenchTracker::wait(const Uint32 timeout,
+                                    Uint64 &arrivalTime,
+                                    Uint16 &eventTypeID)
+{
+  // the arrival time is taken by the listener, so polling does not add to the latency
+  const Uint64 deadline = DcmMetricsRegistry::now() + OFstatic_cast(Uint64, timeout) * 1000000;
+  OFBool arrived = OFFalse;
+  while (!arrived)
+  {
+    m_mutex.lock();
+    if (m_arrivalTime > 0)
+    {
+      arrivalTime = m_arrivalTime;
+      eventTypeID = m_eventTypeID;
+      m_transactionUID.clear();
+      arrived = OFTrue;
+    }
+    m_mutex.unlock();
+    if (!arrived)
+    {
+      if (DcmMetricsRegistry::now() >= deadline)
+        break;
+      usleep(STORCMT_BENCH_POLL_INTERVAL);
+    }
+  }
+  return arrived;
+}
+
+// ----------------------------------------------------------------------------
+
+DcmStorCmtBenchListener::DcmStorCmtBenchListener(const DcmStorCmtBenchConfig &config,
+                                                 DcmStorCmtBenchTracker &tracker)
+  : OFThread()
+  , m_config(config)
+  , m_tracker(tracker)
+  , m_net(NULL)
+  , m_stop(OFFalse)
+{
+}
+
+
+DcmStorCmtBenchListener::~DcmStorCmtBenchListener()
+{
+  ASC_dropNetwork(&m_net);
+}
+
+
+OFCondition DcmStorCmtBenchListener::open(const Uint16 port)
+{
+  OFCondition cond = ASC_initializeNetwork(NET_ACCEPTOR, port, m_config.acseTimeout, &m_net);
+  if (cond.bad())
+  {
+    OFString tempStr;
+    DCMNET_ERROR("Cannot listen on port " << port << ": " << DimseCondition::dump(tempStr, cond));
+  }
+  return cond;
+}
+
+
+void DcmStorCmtBenchListener::stop()
+{
+  m_stop = OFTrue;
+}
+
+
+void DcmStorCmtBenchListener::run()
+{
+  while (!m_stop)
+  {
+    T_ASC_Association *assoc = NULL;
+    OFCondition cond = ASC_receiveAssociation(m_net, &assoc, m_config.maxReceivePDULength, NULL, NULL,
+      OFFalse, DUL_NOBLOCK, STORCMT_BENCH_LISTEN_INTERVAL);
+    if (cond.good())
+      handleAssociation(assoc);
+    else if (cond != DUL_NOASSOCIATIONREQUEST)
+    {
+      OFString tempStr;
+      DCMNET_WARN("Cannot receive association: " << DimseCondition::dump(tempStr, cond));
+    }
+    if (assoc != NULL)
+    {
+      ASC_dropSCPAssociation(assoc);
+      ASC_destroyAssociation(&assoc);
+    }
+  }
+}
+
+
+void DcmStorCmtBenchListener::handleAssociation(T_ASC_Association *assoc)
+{
+  OFString tempStr;
+  const char *abstractSyntaxes[] = { UID_StorageCommitmentPushModelSOPClass };
+  const char *transferSyntaxes[] =
+  {
+    UID_LittleEndianExplicitTransferSyntax,
+    UID_BigEndianExplicitTransferSyntax,
+    UID_LittleEndianImplicitTransferSyntax
+  };
+  OFCondition cond = ASC_acceptContextsWithPreferredTransferSyntaxes(assoc->params,
+    abstractSyntaxes, 1, transferSyntaxes, 3);
+  if (cond.good())
+    cond = ASC_acknowledgeAssociation(assoc);
+  if (cond.bad())
+  {
+    DCMNET_WARN("Cannot accept association: " << DimseCondition::dump(tempStr, cond));
+    ASC_abortAssociation(assoc);
+    return;
+  }
+  DCMNET_DEBUG("Association for N-EVENT-REPORT accepted");
+
+  const T_DIMSE_BlockingMode blockMode = (m_config.dimseTimeout > 0) ? DIMSE_NONBLOCKING : DIMSE_BLOCKING;
+  while (cond.good())
+  {
+    T_DIMSE_Message request;
+    memset(&request, 0, sizeof(request));
+    T_ASC_PresentationContextID presID;
+    cond = DIMSE_receiveCommand(assoc, blockMode, m_config.dimseTimeout, &presID, &request, NULL);
+    const Uint64 arrivalTime = DcmMetricsRegistry::now();
+    if (cond == DUL_PEERREQUESTEDRELEASE)
+    {
+      ASC_acknowledgeRelease(assoc);
+      break;
+    }
+    if (cond.bad())
+    {
+      if (cond != DUL_PEERABORTEDASSOCIATION)
+      {
+        DCMNET_WARN("Failed receiving DIMSE command: " << DimseCondition::dump(tempStr, cond));
+        ASC_abortAssociation(assoc);
+      }
+      break;
+    }
+    if (request.CommandField != DIMSE_N_EVENT_REPORT_RQ)
+    {
+      DCMNET_WARN("Expected N-EVENT-REPORT request but received DIMSE command 0x"
+        << STD_NAMESPACE hex << STD_NAMESPACE setfill('0') << STD_NAMESPACE setw(4)
+        << OFstatic_cast(unsigned int, request.CommandField));
+      ASC_abortAssociation(assoc);
+      break;
+    }
+    OFString transactionUID;
+    cond = answerEventReport(assoc, presID, request.msg.NEventReportRQ, m_config.dimseTimeout, transactionUID);
+    if (cond.good() && !m_tracker.arrive(transactionUID, arrivalTime, request.msg.NEventReportRQ.EventTypeID))
+      DCMNET_WARN("Received N-EVENT-REPORT for unexpected transaction " << transactionUID);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+DcmStorCmtBenchClient::DcmStorCmtBenchClient(const DcmStorCmtBenchConfig &config,
+                                             DcmStorCmtBenchTracker &tracker)
+  : m_config(config)
+  , m_tracker(tracker)
+  , m_net(NULL)
+  , m_assoc(NULL)
+  , m_presID(0)
+  , m_messageID(0)
+{
+}
+
+
+DcmStorCmtBenchClient::~DcmStorCmtBenchClient()
+{
+  disconnect(OFFalse);
+  ASC_dropNetwork(&m_net);
+}
+
+
+OFCondition DcmStorCmtBenchClient::runRequest(const DcmStorCmtBenchPath path,
+                                              const Uint32 references,
+                                              DcmStorCmtBenchStatistics *statistics)
+{
+  // create the dataset before the request is timed
+  char uid[100];
+  DcmDataset dataset;
+  const OFString transactionUID = dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT);
+  dataset.putAndInsertString(DCM_TransactionUID, transactionUID.c_str());
+  dataset.insertEmptyElement(DCM_ReferencedSOPSequence);
+  for (Uint32 i = 0; i < references; ++i)
+  {
+    DcmItem *item = NULL;
+    if (dataset.findOrCreateSequenceItem(DCM_ReferencedSOPSequence, item, -2 /* append */).bad())
+      break;
+    item->putAndInsertString(DCM_ReferencedSOPClassUID, UID_CTImageStorage);
+    item->putAndInsertString(DCM_ReferencedSOPInstanceUID, dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT));
+  }
+
+  OFCondition cond = connect();
+  if (cond.bad())
+  {
+    if (statistics != NULL)
+      ++statistics->failed;
+    return cond;
+  }
+
+  m_tracker.expect(transactionUID);
+  const Uint64 sendTime = DcmMetricsRegistry::now();
+  cond = sendAction(dataset);
+  const Uint64 responseTime = DcmMetricsRegistry::now();
+  if (cond.bad())
+  {
+    if (cond != STORCMT_EC_RequestFailed)
+      disconnect(OFTrue);
+    if (statistics != NULL)
+      ++statistics->failed;
+    return cond;
+  }
+  if (statistics != NULL)
+    statistics->actionLatency.record(responseTime - sendTime);
+
+  Uint64 arrivalTime = 0;
+  Uint16 eventTypeID = 0;
+  if (path == STORCMT_BP_SameAssociation)
+  {
+    // the SCP sends the report on this association unless it is released
+    cond = receiveReport(transactionUID, arrivalTime, eventTypeID);
+    if (cond.bad() && (cond != STORCMT_EC_ReportTimeout))
+      disconnect(OFTrue);
+  } else {
+    // releasing the association makes the SCP send the report on a new one
+    disconnect(OFFalse);
+    if (!m_tracker.wait(m_config.reportTimeout, arrivalTime, eventTypeID))
+      cond = STORCMT_EC_ReportTimeout;
+  }
+  if (cond == STORCMT_EC_ReportTimeout)
+  {
+    DCMNET_WARN("No N-EVENT-REPORT received for transaction " << transactionUID
+      << " within " << m_config.reportTimeout << " seconds");
+    // a late report must not be taken for the one of the next request
+    disconnect(OFTrue);
+  }
+  if (statistics != NULL)
+  {
+    if (cond.good())
+    {
+      statistics->reportLatency.record(arrivalTime - sendTime);
+      if (eventTypeID == 1)
+        ++statistics->committed;
+      else
+        ++statistics->partial;
+    }
+    else if (cond == STORCMT_EC_ReportTimeout)
+      ++statistics->timedOut;
+    else
+      ++statistics->failed;
+  }
+  return cond;
+}
+
+
+OFCondition DcmStorCmtBenchClient::connect()
+{
+  if (m_assoc != NULL)
+    return EC_Normal;
+
+  OFString tempStr;
+  OFCondition cond;
+  if (m_net == NULL)
+  {
+    cond = ASC_initializeNetwork(NET_REQUESTOR, 0, m_config.acseTimeout, &m_net);
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Cannot initialize network: " << DimseCondition::dump(tempStr, cond));
+      return cond;
+    }
+  }
+
+  T_ASC_Parameters *params = NULL;
+  cond = ASC_createAssociationParameters(&params, m_config.maxReceivePDULength);
+  if (cond.bad())
+  {
+    DCMNET_ERROR(DimseCondition::dump(tempStr, cond));
+    return cond;
+  }
+  ASC_setAPTitles(params, m_config.ourAETitle.c_str(), m_config.peerAETitle.c_str(), NULL);
+
+  DIC_NODENAME localHost;
+  DIC_NODENAME peerHost;
+  memset(localHost, 0, sizeof(localHost));
+  gethostname(localHost, sizeof(localHost) - 1);
+  // the host names are limited to 63 characters by the underlying dcmnet structures
+  if (m_config.peerHost.length() + 6 /* ":65535" */ > 63)
+  {
+    DCMNET_ERROR("Peer host name '" << m_config.peerHost << "' is longer than maximum of 57 characters");
+    ASC_destroyAssociationParameters(&params);
+    return EC_IllegalCall;
+  }
+  sprintf(peerHost, "%s:%d", m_config.peerHost.c_str(), OFstatic_cast(int, m_config.peerPort));
+  ASC_setPresentationAddresses(params, localHost, peerHost);
+
+  const char *transferSyntaxes[] =
+  {
+    UID_LittleEndianExplicitTransferSyntax,
+    UID_BigEndianExplicitTransferSyntax,
+    UID_LittleEndianImplicitTransferSyntax
+  };
+  cond = ASC_addPresentationContext(params, 1, UID_StorageCommitmentPushModelSOPClass,
+    transferSyntaxes, 3);
+  if (cond.bad())
+  {
+    DCMNET_ERROR(DimseCondition::dump(tempStr, cond));
+    ASC_destroyAssociationParameters(&params);
+    return cond;
+  }
+
+  DCMNET_DEBUG("Requesting Association");
+  cond = ASC_requestAssociation(m_net, params, &m_assoc);
+  if (cond.bad())
+  {
+    if (cond == DUL_ASSOCIATIONREJECTED)
+    {
+      T_ASC_RejectParameters rej;
+      ASC_getRejectParameters(params, &rej);
+      DCMNET_ERROR("Association Rejected:" << OFendl << ASC_printRejectParameters(tempStr, &rej));
+    } else {
+      DCMNET_ERROR("Association Request Failed: " << DimseCondition::dump(tempStr, cond));
+    }
+    // the association (if created) owns the parameters
+    if (m_assoc != NULL)
+      ASC_destroyAssociation(&m_assoc);
+    else
+      ASC_destroyAssociationParameters(&params);
+    return cond;
+  }
+
+  m_presID = ASC_findAcceptedPresentationContextID(m_assoc, UID_StorageCommitmentPushModelSOPClass);
+  if (m_presID == 0)
+  {
+    DCMNET_ERROR("No Acceptable Presentation Contexts");
+    disconnect(OFTrue);
+    return NET_EC_NoAcceptablePresentationContexts;
+  }
+  DCMNET_DEBUG("Association Accepted (Max Send PDV: "
+    << OFstatic_cast(unsigned long, m_assoc->sendPDVLength) << ")");
+  return EC_Normal;
+}
+
+
+void DcmStorCmtBenchClient::disconnect(const OFBool abort)
+{
+  if (m_assoc == NULL)
+    return;
+  OFString tempStr;
+  OFCondition cond;
+  if (abort)
+  {
+    DCMNET_DEBUG("Aborting Association");
+    cond = ASC_abortAssociation(m_assoc);
+  } else {
+    DCMNET_DEBUG("Releasing Association");
+    cond = ASC_releaseAssociation(m_assoc);
+  }
+  if (cond.bad())
+    DCMNET_WARN("Cannot terminate association: " << DimseCondition::dump(tempStr, cond));
+  ASC_destroyAssociation(&m_assoc);
+  m_presID = 0;
+}
+
+
+OFCondition DcmStorCmtBenchClient::sendAction(DcmDataset &dataset)
+{
+  T_DIMSE_Message request;
+  // make sure everything is zeroed (especially options)
+  memset(&request, 0, sizeof(request));
+  request.CommandField = DIMSE_N_ACTION_RQ;
+  T_DIMSE_N_ActionRQ &actionReq = request.msg.NActionRQ;
+  const Uint16 messageID = ++m_messageID;
+  actionReq.MessageID = messageID;
+  actionReq.ActionTypeID = 1;
+  actionReq.DataSetType = DIMSE_DATASET_PRESENT;
+  OFStandard::strlcpy(actionReq.RequestedSOPClassUID, UID_StorageCommitmentPushModelSOPClass, sizeof(actionReq.RequestedSOPClassUID));
+  OFStandard::strlcpy(actionReq.RequestedSOPInstanceUID, UID_StorageCommitmentPushModelSOPInstance, sizeof(actionReq.RequestedSOPInstanceUID));
+
+  OFString tempStr;
+  OFCondition cond = DIMSE_sendMessageUsingMemoryData(m_assoc, m_presID, &request, NULL /* statusDetail */,
+    &dataset, NULL /* callback */, NULL /* callbackContext */);
+  if (cond.bad())
+  {
+    DCMNET_ERROR("Failed sending N-ACTION request: " << DimseCondition::dump(tempStr, cond));
+    return cond;
+  }
+
+  const T_DIMSE_BlockingMode blockMode = (m_config.dimseTimeout > 0) ? DIMSE_NONBLOCKING : DIMSE_BLOCKING;
+  T_DIMSE_Message response;
+  memset(&response, 0, sizeof(response));
+  T_ASC_PresentationContextID presID;
+  DcmDataset *statusDetail = NULL;
+  cond = DIMSE_receiveCommand(m_assoc, blockMode, m_config.dimseTimeout, &presID, &response, &statusDetail);
+  if (cond.bad())
+  {
+    DCMNET_ERROR("Failed receiving N-ACTION response: " << DimseCondition::dump(tempStr, cond));
+    return cond;
+  }
+  delete statusDetail;
+  if (response.CommandField != DIMSE_N_ACTION_RSP)
+  {
+    DCMNET_ERROR("Expected N-ACTION response but received DIMSE command 0x"
+      << STD_NAMESPACE hex << STD_NAMESPACE setfill('0') << STD_NAMESPACE setw(4)
+      << OFstatic_cast(unsigned int, response.CommandField));
+    return DIMSE_BADCOMMANDTYPE;
+  }
+  const T_DIMSE_N_ActionRSP &actionRsp = response.msg.NActionRSP;
+  if (actionRsp.DataSetType == DIMSE_DATASET_PRESENT)
+  {
+    DcmDataset *rspDataset = NULL;
+    cond = DIMSE_receiveDataSetInMemory(m_assoc, blockMode, m_config.dimseTimeout, &presID, &rspDataset,
+      NULL /* callback */, NULL /* callbackContext */);
+    delete rspDataset;
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Failed receiving N-ACTION response dataset: " << DimseCondition::dump(tempStr, cond));
+      return cond;
+    }
+  }
+  if (actionRsp.MessageIDBeingRespondedTo != messageID)
+  {
+    DCMNET_ERROR("Response to message ID " << actionRsp.MessageIDBeingRespondedTo
+      << " received, expected " << messageID);
+    return DIMSE_BADMESSAGE;
+  }
+  if (actionRsp.DimseStatus != STATUS_Success)
+  {
+    DCMNET_WARN("N-ACTION failed with status 0x" << STD_NAMESPACE hex << STD_NAMESPACE setfill('0')
+      << STD_NAMESPACE setw(4) << actionRsp.DimseStatus);
+    return STORCMT_EC_RequestFailed;
+  }
+  return EC_Normal;
+}
+
+
+OFCondition DcmStorCmtBenchClient::receiveReport(const OFString &transactionUID,
+                                                 Uint64 &arrivalTime,
+                                                 Uint16 &eventTypeID)
+{
+  OFString tempStr;
+  T_DIMSE_Message request;
+  memset(&request, 0, sizeof(request));
+  T_ASC_PresentationContextID presID;
+  OFCondition cond = DIMSE_receiveCommand(m_assoc, DIMSE_NONBLOCKING, m_config.reportTimeout, &presID,
+    &request, NULL);
+  arrivalTime = DcmMetricsRegistry::now();
+  if (cond == DIMSE_NODATAAVAILABLE)
+    return STORCMT_EC_ReportTimeout;
+  if (cond.bad())
+  {
+    DCMNET_ERROR("Failed receiving N-EVENT-REPORT request: " << DimseCondition::dump(tempStr, cond));
+    return cond;
+  }
+  if (request.CommandField != DIMSE_N_EVENT_REPORT_RQ)
+  {
+    DCMNET_ERROR("Expected N-EVENT-REPORT request but received DIMSE command 0x"
+      << STD_NAMESPACE hex << STD_NAMESPACE setfill('0') << STD_NAMESPACE setw(4)
+      << OFstatic_cast(unsigned int, request.CommandField));
+    return DIMSE_BADCOMMANDTYPE;
+  }
+  eventTypeID = request.msg.NEventReportRQ.EventTypeID;
+  OFString reportedUID;
+  cond = answerEventReport(m_assoc, presID, request.msg.NEventReportRQ, m_config.dimseTimeout, reportedUID);
+  if (cond.good() && (reportedUID != transactionUID))
+  {
+    DCMNET_ERROR("Received N-EVENT-REPORT for transaction " << reportedUID << ", expected " << transactionUID);
+    cond = DIMSE_BADDATA;
+  }
+  return cond;
+}
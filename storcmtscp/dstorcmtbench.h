@@ -0,0 +1,331 @@
+/*
+ *
+ *  Module:  storcmtscp
+ *
+ *  Purpose: End-to-end benchmark of Storage Commitment requests
+ *
+ */
+
+#ifndef DSTORCMTBENCH_H
+#define DSTORCMTBENCH_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+#include "dcmtk/ofstd/ofstring.h"
+#include "dcmtk/ofstd/ofstream.h"
+#include "dcmtk/ofstd/ofthread.h"
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmnet/assoc.h"
+#include "dcmtk/dcmnet/dimse.h"
+#include "dscpmetr.h"               /* for DcmLatencyHistogram */
+
+/// default number of references in the Referenced SOP Sequence of a request
+#define STORCMT_BENCH_DEFAULT_REFERENCES 100
+
+/// default time in seconds to wait for the N-EVENT-REPORT request
+#define STORCMT_BENCH_DEFAULT_REPORT_TIMEOUT 30
+
+/** Path of the N-EVENT-REPORT request
+ */
+enum DcmStorCmtBenchPath
+{
+  /// on the association of the N-ACTION request, which is kept open
+  STORCMT_BP_SameAssociation,
+  /// on a new association to our listener, after the N-ACTION association was released
+  STORCMT_BP_NewAssociation
+};
+
+/*---------------------*
+ *  class declaration  *
+ *---------------------*/
+
+/** Settings of the benchmark
+ */
+struct DcmStorCmtBenchConfig
+{
+  /** default constructor, sets the defaults
+   */
+  DcmStorCmtBenchConfig();
+
+  /// host name or address of the SCP
+  OFString peerHost;
+  /// port of the SCP
+  Uint16 peerPort;
+  /// calling AE title
+  OFString ourAETitle;
+  /// called AE title
+  OFString peerAETitle;
+  /// maximum PDU length received
+  Uint32 maxReceivePDULength;
+  /// timeout for ACSE messages in seconds
+  Uint32 acseTimeout;
+  /// timeout for DIMSE messages in seconds, 0 for none
+  Uint32 dimseTimeout;
+  /// time in seconds to wait for the N-EVENT-REPORT request of a commitment request
+  Uint32 reportTimeout;
+};
+
+
+/** Latencies and counters of the commitment requests of one run
+ */
+class DcmStorCmtBenchStatistics
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmStorCmtBenchStatistics();
+
+    /// time from sending the N-ACTION request to receiving its response
+    DcmLatencyHistogram actionLatency;
+
+    /// time from sending the N-ACTION request to the arrival of the N-EVENT-REPORT request
+    DcmLatencyHistogram reportLatency;
+
+    /// number of requests with an N-EVENT-REPORT (event type 1, all committed)
+    Uint32 committed;
+
+    /// number of requests with an N-EVENT-REPORT (event type 2, failures exist)
+    Uint32 partial;
+
+    /// number of requests without an N-EVENT-REPORT in time
+    Uint32 timedOut;
+
+    /// number of requests failing otherwise
+    Uint32 failed;
+
+    /** Print the header of the table printed by print()
+     *  @param out [out] Stream the header is printed to
+     */
+    static void printHeader(STD_NAMESPACE ostream &out);
+
+    /** Print the latency percentiles and counters
+     *  @param out        [out] Stream the table rows are printed to
+     *  @param path       [in]  Path of the N-EVENT-REPORT requests
+     *  @param references [in]  Number of references per request
+     */
+    void print(STD_NAMESPACE ostream &out,
+               const DcmStorCmtBenchPath path,
+               const Uint32 references) const;
+
+  private:
+
+    // private undefined copy constructor
+    DcmStorCmtBenchStatistics(const DcmStorCmtBenchStatistics &);
+
+    // private undefined assignment operator
+    DcmStorCmtBenchStatistics &operator=(const DcmStorCmtBenchStatistics &);
+};
+
+
+/** Rendezvous between the client waiting for an N-EVENT-REPORT request and the
+ *  listener receiving it on a new association. Requests are matched by their
+ *  Transaction UID; only one request is outstanding at a time.
+ */
+class DcmStorCmtBenchTracker
+{
+
+  public:
+
+    /** default constructor
+     */
+    DcmStorCmtBenchTracker();
+
+    /** Announce a request whose N-EVENT-REPORT is expected
+     *  @param transactionUID [in] Transaction UID of the request
+     */
+    void expect(const OFString &transactionUID);
+
+    /** Report the arrival of an N-EVENT-REPORT request
+     *  @param transactionUID [in] Transaction UID in the request
+     *  @param arrivalTime    [in] Time the request arrived, see DcmMetricsRegistry::now()
+     *  @param eventTypeID    [in] Event type of the request
+     *  @return OFTrue if the request was expected, OFFalse otherwise
+     */
+    OFBool arrive(const OFString &transactionUID,
+                  const Uint64 arrivalTime,
+                  const Uint16 eventTypeID);
+
+    /** Wait for the N-EVENT-REPORT request of the expected request
+     *  @param timeout     [in]  Time in seconds to wait
+     *  @param arrivalTime [out] Time the request arrived
+     *  @param eventTypeID [out] Event type of the request
+     *  @return OFTrue if the request arrived, OFFalse on timeout
+     */
+    OFBool wait(const Uint32 timeout,
+                Uint64 &arrivalTime,
+                Uint16 &eventTypeID);
+
+  private:
+
+    /// mutex protecting the members below
+    OFMutex m_mutex;
+
+    /// Transaction UID of the expected request, empty if none
+    OFString m_transactionUID;
+
+    /// arrival time of the N-EVENT-REPORT request, 0 if it has not arrived yet
+    Uint64 m_arrivalTime;
+
+    /// event type of the N-EVENT-REPORT request
+    Uint16 m_eventTypeID;
+
+    // private undefined copy constructor
+    DcmStorCmtBenchTracker(const DcmStorCmtBenchTracker &);
+
+    // private undefined assignment operator
+    DcmStorCmtBenchTracker &operator=(const DcmStorCmtBenchTracker &);
+};
+
+
+/** Thread accepting the associations the SCP opens to send N-EVENT-REPORT requests
+ *  (the port the SCP is configured with by its --peer-port option). Each request is
+ *  answered with status Success and handed to the tracker.
+ */
+class DcmStorCmtBenchListener : public OFThread
+{
+
+  public:
+
+    /** constructor
+     *  @param config  [in] Settings, must exist as long as the listener
+     *  @param tracker [in] Tracker the N-EVENT-REPORT requests are handed to
+     */
+    DcmStorCmtBenchListener(const DcmStorCmtBenchConfig &config,
+                            DcmStorCmtBenchTracker &tracker);
+
+    /** destructor
+     */
+    virtual ~DcmStorCmtBenchListener();
+
+    /** Open the port to listen on. Call before start().
+     *  @param port [in] The port
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition open(const Uint16 port);
+
+    /** Ask the thread to stop, it does within a second
+     */
+    void stop();
+
+  protected:
+
+    /** Accept associations until stopped
+     */
+    virtual void run();
+
+  private:
+
+    /** Handle an association until it is released or aborted
+     *  @param assoc [in] The association
+     */
+    void handleAssociation(T_ASC_Association *assoc);
+
+    /// settings
+    const DcmStorCmtBenchConfig &m_config;
+
+    /// tracker of the N-EVENT-REPORT requests
+    DcmStorCmtBenchTracker &m_tracker;
+
+    /// the network listened on, NULL if not open
+    T_ASC_Network *m_net;
+
+    /// flag asking the thread to stop
+    volatile OFBool m_stop;
+
+    // private undefined copy constructor
+    DcmStorCmtBenchListener(const DcmStorCmtBenchListener &);
+
+    // private undefined assignment operator
+    DcmStorCmtBenchListener &operator=(const DcmStorCmtBenchListener &);
+};
+
+
+/** Client sending Storage Commitment requests (N-ACTION) with synthetic Referenced
+ *  SOP Sequences one after the other and measuring the time until the N-EVENT-REPORT
+ *  request arrives, either on the same association or, via the tracker, on a new
+ *  association to the listener.
+ */
+class DcmStorCmtBenchClient
+{
+
+  public:
+
+    /** constructor
+     *  @param config  [in] Settings, must exist as long as the client
+     *  @param tracker [in] Tracker of the N-EVENT-REPORT requests received by the listener
+     */
+    DcmStorCmtBenchClient(const DcmStorCmtBenchConfig &config,
+                          DcmStorCmtBenchTracker &tracker);
+
+    /** destructor. Releases the association, if any.
+     */
+    ~DcmStorCmtBenchClient();
+
+    /** Send a commitment request and wait for its N-EVENT-REPORT request
+     *  @param path       [in] Path the N-EVENT-REPORT request is expected on
+     *  @param references [in] Number of references in the Referenced SOP Sequence
+     *  @param statistics [in] Statistics updated, NULL if the request is not measured
+     *  @return EC_Normal if the N-EVENT-REPORT request arrived, an error code otherwise
+     */
+    OFCondition runRequest(const DcmStorCmtBenchPath path,
+                           const Uint32 references,
+                           DcmStorCmtBenchStatistics *statistics);
+
+    /** Release or abort the association (if any)
+     *  @param abort [in] OFTrue to abort, OFFalse to release
+     */
+    void disconnect(const OFBool abort);
+
+  private:
+
+    /** Request an association (if there is none)
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition connect();
+
+    /** Send the N-ACTION request and receive its response
+     *  @param dataset [in] The dataset of the request
+     *  @return EC_Normal if the response has status Success, STORCMT_EC_RequestFailed
+     *          if it has another status, an error code otherwise
+     */
+    OFCondition sendAction(DcmDataset &dataset);
+
+    /** Wait for the N-EVENT-REPORT request on the association and answer it
+     *  @param transactionUID [in]  Transaction UID of the request
+     *  @param arrivalTime    [out] Time the N-EVENT-REPORT request arrived
+     *  @param eventTypeID    [out] Event type of the N-EVENT-REPORT request
+     *  @return EC_Normal if successful, an error code otherwise
+     */
+    OFCondition receiveReport(const OFString &transactionUID,
+                              Uint64 &arrivalTime,
+                              Uint16 &eventTypeID);
+
+    /// settings
+    const DcmStorCmtBenchConfig &m_config;
+
+    /// tracker of the N-EVENT-REPORT requests received by the listener
+    DcmStorCmtBenchTracker &m_tracker;
+
+    /// network of the association
+    T_ASC_Network *m_net;
+
+    /// the association, NULL if none
+    T_ASC_Association *m_assoc;
+
+    /// accepted presentation context for Storage Commitment
+    T_ASC_PresentationContextID m_presID;
+
+    /// message ID of the last request
+    Uint16 m_messageID;
+
+    // private undefined copy constructor
+    DcmStorCmtBenchClient(const DcmStorCmtBenchClient &);
+
+    // private undefined assignment operator
+    DcmStorCmtBenchClient &operator=(const DcmStorCmtBenchClient &);
+};
+
+#endif // DSTORCMTBENCH_H
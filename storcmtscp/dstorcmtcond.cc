@@ -0,0 +1,15 @@
+/*
+ *
+ *  Module:  storcmtscp
+ *
+ *  Purpose: Error conditions of the Storage Commitment SCP
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dstorcmtcond.h"
+
+makeOFConditionConst(STORCMT_EC_RequestFailed, OFM_storcmtscp, 5, OF_error, "Request failed with error status");
+makeOFConditionConst(STORCMT_EC_ReportTimeout, OFM_storcmtscp, 6, OF_error, "No N-EVENT-REPORT received in time");
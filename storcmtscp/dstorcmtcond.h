@@ -0,0 +1,24 @@
+/*
+ *
+ *  Module:  storcmtscp
+ *
+ *  Purpose: Error conditions of the Storage Commitment SCP
+ *
+ */
+
+#ifndef DSTORCMTCOND_H
+#define DSTORCMTCOND_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofcond.h"
+
+/// module number for the conditions of the Storage Commitment SCP
+#define OFM_storcmtscp 1025
+
+/// a request was answered with a failure status
+extern const OFCondition STORCMT_EC_RequestFailed;
+/// no N-EVENT-REPORT request was received for a commitment request in time
+extern const OFCondition STORCMT_EC_ReportTimeout;
+
+#endif // DSTORCMTCOND_H
@@ -0,0 +1,66 @@
+/*
+ *
+ *  Module:  storcmtscp
+ *
+ *  Purpose: Static tracepoints (USDT probes) for bpftrace, perf and SystemTap
+ *
+ */
+
+#ifndef DSTORCMTPROBE_H
+#define DSTORCMTPROBE_H
+
+#include "dcmtk/config/osconfig.h"  /* make sure OS specific configuration is included first */
+
+/* The probes are compiled in if <sys/sdt.h> is available (package systemtap-sdt-dev
+ * or systemtap-sdt-devel), unless STORCMT_DISABLE_PROBES is defined. Define
+ * HAVE_SYS_SDT_H if the compiler cannot check for the header itself. A probe is a
+ * single nop instruction until a tracer attaches to it; its arguments are still
+ * evaluated, so they should be values at hand.
+ *
+ * Probes of provider "storcmtscp" (list them with "bpftrace -l 'usdt:<path>/storcmtrecv:*'"):
+ *   association__accept(peer, calling AE title, called AE title)
+ *   association__refuse(reason)
+ *   association__ack(calling AE title, number of accepted presentation contexts)
+ *   association__release(reason: "release", "abort" or "error")
+ *   command__receive(command field, message ID, presentation context ID)
+ *   dataset__receive(presentation context ID, 1 if successful)
+ *   response__sent(command field, message ID responded to, status, 1 if successful)
+ *   event__report__sent(message ID, event type ID, association: "same" or "new",
+ *                       1 if successful)
+ * Probes of the association the N-EVENT-REPORT request is sent on if the N-ACTION
+ * association has been released:
+ *   report__association__request(peer host, peer port, called AE title)
+ *   report__association__ack(1 if accepted, number of accepted presentation contexts)
+ *   report__association__release(reason: "release", "abort", "error" or "peer abort",
+ *                                1 if successful)
+ */
+
+#ifndef STORCMT_DISABLE_PROBES
+#if defined(HAVE_SYS_SDT_H)
+#define STORCMT_PROBES_ENABLED 1
+#elif defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define STORCMT_PROBES_ENABLED 1
+#endif
+#endif
+#endif
+
+#ifdef STORCMT_PROBES_ENABLED
+
+#include <sys/sdt.h>
+
+#define STORCMT_PROBE1(name, a1) DTRACE_PROBE1(storcmtscp, name, a1)
+#define STORCMT_PROBE2(name, a1, a2) DTRACE_PROBE2(storcmtscp, name, a1, a2)
+#define STORCMT_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(storcmtscp, name, a1, a2, a3)
+#define STORCMT_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(storcmtscp, name, a1, a2, a3, a4)
+
+#else
+
+#define STORCMT_PROBE1(name, a1) do { } while (0)
+#define STORCMT_PROBE2(name, a1, a2) do { } while (0)
+#define STORCMT_PROBE3(name, a1, a2, a3) do { } while (0)
+#define STORCMT_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+
+#endif
+
+#endif // DSTORCMTPROBE_H
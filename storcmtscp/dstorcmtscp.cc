@@ -24,15 +24,103 @@
 
 #include "dstorcmtscp.h"
 #include "dcmtk/dcmnet/diutil.h"
+#include "dstorcmtcond.h"
+#include "dscpcond.h"
+#include "dstorcmtprobe.h"
+
+// minimum interval in seconds between two summaries of C-ECHO requests answered
+// by the fast path
+#define STORCMT_ECHO_REPORT_INTERVAL 60
+
+// log a message of the association level, at debug level for associations of
+// health checks (see isEchoOnlyRequest())
+#define STORCMT_ASSOCIATION_INFO(msg) do { if (m_echoOnly) DCMNET_DEBUG(msg); else DCMNET_INFO(msg); } while (0)
+
+// get the message ID of a request, or the message ID responded to and the status
+// of a response, for the probes and the flight recorder; returns OFTrue for a response
+static OFBool getMessageInfo(const T_DIMSE_Message &message,
+                             Uint16 &messageID,
+                             Uint16 &status)
+{
+  messageID = 0;
+  status = 0;
+  switch (message.CommandField)
+  {
+    case DIMSE_C_ECHO_RQ:
+      messageID = message.msg.CEchoRQ.MessageID;
+      return OFFalse;
+    case DIMSE_N_ACTION_RQ:
+      messageID = message.msg.NActionRQ.MessageID;
+      return OFFalse;
+    case DIMSE_C_ECHO_RSP:
+      messageID = message.msg.CEchoRSP.MessageIDBeingRespondedTo;
+      status = message.msg.CEchoRSP.DimseStatus;
+      return OFTrue;
+    case DIMSE_N_ACTION_RSP:
+      messageID = message.msg.NActionRSP.MessageIDBeingRespondedTo;
+      status = message.msg.NActionRSP.DimseStatus;
+      return OFTrue;
+    default:
+      return OFFalse;
+  }
+}
+
+// check whether an association request only proposes the Verification SOP class,
+// as health checks do
+static OFBool isEchoOnlyRequest(T_ASC_Parameters &params)
+{
+  T_ASC_PresentationContext pc;
+  const int count = ASC_countPresentationContexts(&params);
+  for (int i = 0; i < count; ++i)
+  {
+    if (ASC_getPresentationContext(&params, i, &pc).bad() || (strcmp(pc.abstractSyntax, UID_VerificationSOPClass) != 0))
+      return OFFalse;
+  }
+  return (count > 0);
+}
 
 // implementation of the main interface class
 
 DcmStorCmtSCP::DcmStorCmtSCP():
   m_assoc(NULL),
   m_cfg(),
+  m_commandPresContext(),
   m_commit_wait_timeout(5),
-  m_peerPort(115)
+  m_peerPort(115),
+  m_responseEncoder(),
+  m_transportLayer(),
+  m_socketOptions(),
+  m_negotiationCache(),
+  m_accessPolicy(),
+  m_hostLookup(OFTrue),
+  m_hostNameResolver(NULL),
+  m_metrics(),
+  m_metricsServer(NULL),
+  m_metricsPort(0),
+  m_metricsSocket(),
+  m_associationStart(0),
+  m_datasetReceiveTime(0),
+  m_responseSendTime(0),
+  m_trace(),
+  m_traceCommand(SCP_TRACE_NO_SPAN),
+  m_traceHandlerStart(0),
+  m_traceEventReport(SCP_TRACE_NO_SPAN),
+  m_flightRecorder(),
+  m_flightRecorderFile(),
+  m_flightRecorderCapacity(SCP_FLIGHT_DEFAULT_CAPACITY),
+  m_capture(),
+  m_captureFile(),
+  m_receivedMessages(0),
+  m_messageReadCalls(0),
+  m_fastEcho(OFTrue),
+  m_echoRequests(0),
+  m_echoRequestsReported(0),
+  m_echoReportTime(0),
+  m_echoCounter(NULL),
+  m_echoOnly(OFFalse)
 {
+    clearPresentationContextTable();
+    m_echoSOPClassUID[0] = '\0';
     // make sure that the SCP at least supports C-ECHO with default transfer syntax
     OFList<OFString> transferSyntaxes;
     transferSyntaxes.push_back(UID_LittleEndianExplicitTransferSyntax);
@@ -43,6 +131,18 @@ DcmStorCmtSCP::DcmStorCmtSCP():
     addPresentationContext(UID_StorageCommitmentPushModelSOPClass, transferSyntaxes);
 
     storageCommitCommand = NULL;
+
+    m_metrics.describe("storcmt_associations_total", "Association requests by result");
+    m_metrics.describe("storcmt_associations_closed_total", "Associations terminated by reason");
+    m_metrics.describe("storcmt_association_setup_seconds", "Time from association request to acknowledgement");
+    m_metrics.describe("storcmt_association_duration_seconds", "Time from association request to termination");
+    m_metrics.describe("storcmt_requests_total", "DIMSE requests handled by command, SOP class and status");
+    m_metrics.describe("storcmt_dataset_receive_seconds", "Time spent receiving the dataset of a request");
+    m_metrics.describe("storcmt_handler_seconds", "Time spent handling a request, excluding network I/O");
+    m_metrics.describe("storcmt_response_send_seconds", "Time spent sending the response to a request");
+    m_metrics.describe("storcmt_event_reports_total", "N-EVENT-REPORT deliveries by association and result");
+    m_metrics.describe("storcmt_event_report_seconds", "Time taken to deliver an N-EVENT-REPORT request (including association setup for a new association)");
+    m_trace.setServiceName("storcmtscp");
 }
 
 
@@ -62,7 +162,8 @@ DcmStorCmtSCP::~DcmStorCmtSCP()
   {
     dropAndDestroyAssociation();
   }
-
+  stopHostNameResolver();
+  stopMetricsServer();
 }
 
 // ----------------------------------------------------------------------------
@@ -96,6 +197,21 @@ OFCondition DcmStorCmtSCP::listen()
   if( cond.bad() )
     return cond;
 
+  // Read incoming PDUs through a buffer that holds a complete PDU, so that a small
+  // DIMSE message can be received with a single recv().
+  m_transportLayer.setBufferSize(m_cfg->getMaxReceivePDULength() + SCP_CONN_PDU_HEADER_SIZE);
+
+  // Apply the socket options to the listening socket and (through the transport
+  // layer) to the socket of each incoming association.
+  m_socketOptions.applyToListener(m_cfg->getPort());
+  m_transportLayer.setSocketOptions(m_socketOptions);
+  cond = ASC_setTransportLayer( network, &m_transportLayer, 0 /* do not take over ownership */ );
+  if( cond.bad() )
+  {
+    ASC_dropNetwork( &network );
+    return cond;
+  }
+
   // drop root privileges now and revert to the calling user id (if we are running as setuid root)
   cond = OFStandard::dropPrivileges();
   if (cond.bad())
@@ -104,6 +220,75 @@ OFCondition DcmStorCmtSCP::listen()
       return cond;
   }
 
+  // Never let DCMTK look up the host name of a peer while accepting its association,
+  // this may block for seconds if the DNS server is slow. Host names are resolved in
+  // the background instead.
+  m_cfg->setHostLookupEnabled(OFFalse);
+  if (m_hostLookup && (m_hostNameResolver == NULL))
+  {
+    m_hostNameResolver = new DcmHostNameResolver();
+    if (m_hostNameResolver->start() != 0)
+    {
+      DCMNET_WARN("Cannot start host name resolver, host names of peers are not looked up");
+      delete m_hostNameResolver;
+      m_hostNameResolver = NULL;
+    }
+  }
+
+  // Keep the last associations in memory (if configured), dumped on SIGUSR1 or a crash.
+  if (!m_flightRecorderFile.empty())
+  {
+    cond = m_flightRecorder.open(m_flightRecorderFile, m_flightRecorderCapacity);
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Cannot set up flight recorder " << m_flightRecorderFile << ": " << cond.text());
+      stopHostNameResolver();
+      ASC_dropNetwork( &network );
+      return cond;
+    }
+  }
+
+  // Append the PDUs received on each association to the capture file (if configured).
+  if (!m_captureFile.empty())
+  {
+    cond = m_capture.open(m_captureFile, SCP_CAPTURE_MAGIC_STORCMT);
+    if (cond.bad())
+    {
+      DCMNET_ERROR("Cannot open capture file " << m_captureFile << ": " << cond.text());
+      m_flightRecorder.close();
+      stopHostNameResolver();
+      ASC_dropNetwork( &network );
+      return cond;
+    }
+    m_transportLayer.setTrafficCapture(&m_capture);
+  }
+
+  // Serve the metrics (if configured) in the background.
+  if (((m_metricsPort > 0) || !m_metricsSocket.empty()) && (m_metricsServer == NULL))
+  {
+    m_metricsServer = new DcmMetricsServer(m_metrics);
+    if (m_metricsPort > 0)
+      cond = m_metricsServer->openPort(m_metricsPort);
+    else
+      cond = m_metricsServer->openSocket(m_metricsSocket);
+    if (cond.good() && (m_metricsServer->start() != 0))
+    {
+      DCMNET_ERROR("Cannot start metrics server");
+      cond = SCP_EC_MetricsError;
+    }
+    if (cond.bad())
+    {
+      delete m_metricsServer;
+      m_metricsServer = NULL;
+      m_transportLayer.setTrafficCapture(NULL);
+      m_capture.close();
+      m_flightRecorder.close();
+      stopHostNameResolver();
+      ASC_dropNetwork( &network );
+      return cond;
+    }
+  }
+
   // If we get to this point, the entire initialization process has been completed
   // successfully. Now, we want to start handling all incoming requests. Since
   // this activity is supposed to represent a server process, we do not want to
@@ -119,6 +304,11 @@ OFCondition DcmStorCmtSCP::listen()
   // is the counterpart of ASC_initializeNetwork(...) which was called above.
   cond = ASC_dropNetwork( &network );
   network = NULL;
+  stopHostNameResolver();
+  stopMetricsServer();
+  m_transportLayer.setTrafficCapture(NULL);
+  m_capture.close();
+  m_flightRecorder.close();
 
   // return ok
   return cond;
@@ -127,37 +317,113 @@ OFCondition DcmStorCmtSCP::listen()
 // ----------------------------------------------------------------------------
 
 void DcmStorCmtSCP::findPresentationContext(const T_ASC_PresentationContextID presID,
-                                     OFString &abstractSyntax,
-                                     OFString &transferSyntax)
+                                            OFString &abstractSyntax,
+                                            OFString &transferSyntax)
+{
+  const char *abstractSyntaxUID;
+  const char *transferSyntaxUID;
+  if (findPresentationContext(presID, abstractSyntaxUID, transferSyntaxUID))
+  {
+    transferSyntax = transferSyntaxUID;
+    abstractSyntax = abstractSyntaxUID;
+  }
+  else
+  {
+    transferSyntax.clear();
+    abstractSyntax.clear();
+  }
+}
+
+
+OFBool DcmStorCmtSCP::findPresentationContext(const T_ASC_PresentationContextID presID,
+                                              const char *&abstractSyntax,
+                                              const char *&transferSyntax) const
+{
+  // the table only holds accepted presentation contexts
+  const PresentationContextEntry &entry = m_presContexts[presID];
+  abstractSyntax = entry.abstractSyntax;
+  transferSyntax = entry.acceptedTransferSyntax;
+  return (m_assoc != NULL) && (entry.presentationContextID != 0);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::buildPresentationContextTable()
 {
-  transferSyntax.clear();
-  abstractSyntax.clear();
+  clearPresentationContextTable();
   if (m_assoc == NULL)
     return;
 
-  DUL_PRESENTATIONCONTEXT *pc;
-  LST_HEAD **l;
+  LST_HEAD **l = &m_assoc->params->DULparams.acceptedPresentationContext;
+  if (*l == NULL)
+    return;
+  DUL_PRESENTATIONCONTEXT *pc = (DUL_PRESENTATIONCONTEXT*) LST_Head(l);
+  (void)LST_Position(l, (LST_NODE*)pc);
+  while (pc)
+  {
+    if (pc->result == ASC_P_ACCEPTANCE)
+    {
+      PresentationContextEntry &entry = m_presContexts[pc->presentationContextID];
+      entry.presentationContextID = pc->presentationContextID;
+      entry.proposedSCRole = OFstatic_cast(Uint8, pc->proposedSCRole);
+      entry.acceptedSCRole = OFstatic_cast(Uint8, pc->acceptedSCRole);
+      entry.abstractSyntax = pc->abstractSyntax;
+      entry.acceptedTransferSyntax = pc->acceptedTransferSyntax;
+    }
+    pc = (DUL_PRESENTATIONCONTEXT*) LST_Next(l);
+  }
+}
 
-  /* we look for a presentation context matching
-   * both abstract and transfer syntax
-   */
-  l = &m_assoc->params->DULparams.acceptedPresentationContext;
-  pc = (DUL_PRESENTATIONCONTEXT*) LST_Head(l);
+
+void DcmStorCmtSCP::recordPresentationContexts()
+{
+  if (!m_flightRecorder.isOpen() || (m_assoc == NULL))
+    return;
+
+  LST_HEAD **l = &m_assoc->params->DULparams.acceptedPresentationContext;
+  if (*l == NULL)
+    return;
+  DUL_PRESENTATIONCONTEXT *pc = (DUL_PRESENTATIONCONTEXT*) LST_Head(l);
   (void)LST_Position(l, (LST_NODE*)pc);
   while (pc)
   {
-     if (presID == pc->presentationContextID)
-     {
-       if (pc->result == ASC_P_ACCEPTANCE)
-       {
-         // found a match
-         transferSyntax = pc->acceptedTransferSyntax;
-         abstractSyntax = pc->abstractSyntax;
-       }
-       break;
-     }
-     pc = (DUL_PRESENTATIONCONTEXT*) LST_Next(l);
+    m_flightRecorder.addContext(pc->presentationContextID, pc->result, pc->abstractSyntax,
+      (pc->result == ASC_P_ACCEPTANCE) ? pc->acceptedTransferSyntax : "");
+    pc = (DUL_PRESENTATIONCONTEXT*) LST_Next(l);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::clearPresentationContextTable()
+{
+  memset(m_presContexts, 0, sizeof(m_presContexts));
+  // the next command copies the UIDs again
+  m_commandPresContext.presentationContextID = 0;
+}
+
+// ----------------------------------------------------------------------------
+
+const DcmPresentationContextInfo &DcmStorCmtSCP::getCommandPresentationContext(const T_ASC_PresentationContextID presID)
+{
+  const PresentationContextEntry &entry = m_presContexts[presID];
+  if ((entry.presentationContextID == 0) || (m_commandPresContext.presentationContextID != presID))
+  {
+    m_commandPresContext.presentationContextID = entry.presentationContextID;
+    m_commandPresContext.proposedSCRole = entry.proposedSCRole;
+    m_commandPresContext.acceptedSCRole = entry.acceptedSCRole;
+    if (entry.presentationContextID != 0)
+    {
+      m_commandPresContext.abstractSyntax = entry.abstractSyntax;
+      m_commandPresContext.acceptedTransferSyntax = entry.acceptedTransferSyntax;
+    }
+    else
+    {
+      m_commandPresContext.abstractSyntax.clear();
+      m_commandPresContext.acceptedTransferSyntax.clear();
+    }
   }
+  return m_commandPresContext;
 }
 
 DUL_PRESENTATIONCONTEXT* DcmStorCmtSCP::findPresentationContextID(LST_HEAD *head,
@@ -200,6 +466,15 @@ void DcmStorCmtSCP::refuseAssociation(const DcmRefuseReasonType reason)
     return;
   }
 
+  // count the refusal, the association is not measured any further
+  OFString labels = getPeerLabel();
+  DcmMetricsRegistry::addLabel(labels, "result", "refused");
+  m_metrics.increment("storcmt_associations_total", labels);
+  m_associationStart = 0;
+  m_trace.setAttribute(0, "result", "refused");
+  m_flightRecorder.setOutcome("refused");
+  STORCMT_PROBE1(association__refuse, OFstatic_cast(int, reason));
+
   T_ASC_RejectParameters rej;
 
   // dump some information if required
@@ -220,6 +495,9 @@ void DcmStorCmtSCP::refuseAssociation(const DcmRefuseReasonType reason)
     case DCMSCP_CALLING_AE_TITLE_NOT_RECOGNIZED:
       DCMNET_INFO("Refusing Association (calling AE title not recognized)");
       break;
+    case DCMSCP_CALLING_HOST_NOT_ALLOWED:
+      DCMNET_INFO("Refusing Association (calling host not allowed)");
+      break;
     case DCMSCP_FORCED:
       DCMNET_INFO("Refusing Association (forced via command line)");
       break;
@@ -257,6 +535,9 @@ void DcmStorCmtSCP::refuseAssociation(const DcmRefuseReasonType reason)
     case DCMSCP_CALLING_AE_TITLE_NOT_RECOGNIZED:
       DCMNET_INFO("Refusing Association (calling AE title not recognized)");
       break;
+    case DCMSCP_CALLING_HOST_NOT_ALLOWED:
+      DCMNET_INFO("Refusing Association (calling host not allowed)");
+      break;
     case DCMSCP_FORCED:
       DCMNET_INFO("Refusing Association (forced via command line)");
       break;
@@ -302,6 +583,7 @@ void DcmStorCmtSCP::refuseAssociation(const DcmRefuseReasonType reason)
       rej.source = ASC_SOURCE_SERVICEUSER;
       rej.reason = ASC_REASON_SU_CALLINGAETITLENOTRECOGNIZED;
       break;
+    case DCMSCP_CALLING_HOST_NOT_ALLOWED:
     case DCMSCP_FORCED:
     case DCMSCP_NO_IMPLEMENTATION_CLASS_UID:
     case DCMSCP_NO_PRESENTATION_CONTEXTS:
@@ -348,6 +630,25 @@ OFCondition DcmStorCmtSCP::waitForAssociationRQ(T_ASC_Network *network)
     return EC_Normal;
   }
 
+  STORCMT_PROBE3(association__accept, m_assoc->params->DULparams.callingPresentationAddress,
+    m_assoc->params->DULparams.callingAPTitle, m_assoc->params->DULparams.calledAPTitle);
+  m_flightRecorder.beginAssociation(m_assoc->params->DULparams.callingPresentationAddress,
+    m_assoc->params->DULparams.callingAPTitle, m_assoc->params->DULparams.calledAPTitle);
+
+  // the trace of the association starts when the connection is accepted
+  if (m_trace.isEnabled())
+  {
+    Uint64 acceptTime = 0;
+    Uint64 readyTime = 0;
+    m_transportLayer.getConnectionTimes(acceptTime, readyTime);
+    const Uint64 receiveTime = DcmTraceRecorder::now();
+    if (acceptTime == 0)
+      acceptTime = readyTime = receiveTime;
+    m_trace.begin("association", acceptTime);
+    m_trace.addSpan("TCP accept", acceptTime, readyTime);
+    m_trace.addSpan("A-ASSOCIATE-RQ receive", readyTime, receiveTime);
+  }
+
   return processAssociationRQ();
 }
 
@@ -357,8 +658,27 @@ OFCondition DcmStorCmtSCP::processAssociationRQ()
   DcmSCPActionType desiredAction = DCMSCP_ACTION_UNDEFINED;
   if ( (m_assoc == NULL) || (m_assoc->params == NULL) )
     return ASC_NULLKEY;
+  m_associationStart = DcmMetricsRegistry::now();
+  const size_t negotiationSpan = m_trace.beginSpan("negotiation");
+
+  // Check the address of the peer before anything else, so that hosts not allowed by
+  // the access policy are refused without further effort
+  m_accessPolicy.update(time(NULL));
+  OFString peerAddress;
+  if (!m_transportLayer.getPeerAddress(peerAddress))
+    peerAddress = getPeerIP();
+  m_trace.setAttribute(0, "peer", peerAddress);
+  m_trace.setAttribute(0, "calling_ae", m_assoc->params->DULparams.callingAPTitle);
+  m_trace.setAttribute(0, "called_ae", m_assoc->params->DULparams.calledAPTitle);
+  if (!checkCallingHostAccepted(peerAddress))
+  {
+    refuseAssociation( DCMSCP_CALLING_HOST_NOT_ALLOWED );
+    dropAndDestroyAssociation();
+    return EC_Normal;
+  }
 
   // call notifier function
+  m_echoOnly = isEchoOnlyRequest(*m_assoc->params);
   notifyAssociationRequest(*m_assoc->params, desiredAction);
   if (desiredAction != DCMSCP_ACTION_UNDEFINED)
   {
@@ -425,6 +745,7 @@ OFCondition DcmStorCmtSCP::processAssociationRQ()
     dropAndDestroyAssociation();
     return EC_Normal;
   }
+  recordPresentationContexts();
 
   // Reject association if no presentation context was negotiated
   if( ASC_countAcceptedPresentationContexts( m_assoc->params ) == 0 )
@@ -442,17 +763,28 @@ OFCondition DcmStorCmtSCP::processAssociationRQ()
   }
 
   // If the negotiation was successful, accept the association request
+  m_trace.endSpan(negotiationSpan);
+  const size_t acknowledgeSpan = m_trace.beginSpan("A-ASSOCIATE-AC send");
   cond = ASC_acknowledgeAssociation( m_assoc );
+  m_trace.endSpan(acknowledgeSpan);
   if( cond.bad() )
   {
     dropAndDestroyAssociation();
     return EC_Normal;
   }
+  buildPresentationContextTable();
   notifyAssociationAcknowledge();
+  OFString labels = getPeerLabel();
+  m_metrics.observe("storcmt_association_setup_seconds", labels, DcmMetricsRegistry::now() - m_associationStart);
+  DcmMetricsRegistry::addLabel(labels, "result", "accepted");
+  m_metrics.increment("storcmt_associations_total", labels);
+  m_trace.setAttribute(0, "result", "accepted");
+  STORCMT_PROBE2(association__ack, m_assoc->params->DULparams.callingAPTitle,
+    ASC_countAcceptedPresentationContexts(m_assoc->params));
 
   // Dump some debug information
   OFString tempStr;
-  DCMNET_INFO("Association Acknowledged (Max Send PDV: " << OFstatic_cast(Uint32, m_assoc->sendPDVLength) << ")");
+  STORCMT_ASSOCIATION_INFO("Association Acknowledged (Max Send PDV: " << OFstatic_cast(Uint32, m_assoc->sendPDVLength) << ")");
   if (m_cfg->getVerbosePCMode())
     DCMNET_INFO(ASC_dumpParameters(tempStr, m_assoc->params, ASC_ASSOC_AC));
   else
@@ -471,6 +803,13 @@ OFCondition DcmStorCmtSCP::negotiateAssociation()
   if (m_assoc == NULL)
     return DIMSE_ILLEGALASSOCIATION;
 
+  // Accept the presentation contexts as for an identical earlier request, if any
+  if (m_negotiationCache.apply(*m_assoc->params))
+  {
+    DCMNET_DEBUG("Presentation contexts negotiated from cache");
+    return EC_Normal;
+  }
+
   // Set presentation contexts as defined in association configuration
   OFCondition result = m_cfg->evaluateIncomingAssociation(*m_assoc);
   if (result.bad())
@@ -478,6 +817,8 @@ OFCondition DcmStorCmtSCP::negotiateAssociation()
     OFString tempStr;
     DCMNET_ERROR(DimseCondition::dump(tempStr, result));
   }
+  else
+    m_negotiationCache.store(*m_assoc->params);
   return result;
 }
 
@@ -523,36 +864,89 @@ void DcmStorCmtSCP::handleAssociation()
   OFCondition cond = EC_Normal;
   T_DIMSE_Message message;
   T_ASC_PresentationContextID presID;
+  const Uint64 receivedMessages = m_receivedMessages;
+  const Uint64 messageReadCalls = m_messageReadCalls;
+  Uint64 receiveStart = 0;
 
   // start a loop to be able to receive more than one DIMSE command
   while( cond.good() )
   {
     // receive a DIMSE command over the network
+    const Uint64 readCalls = m_transportLayer.getReadCalls();
+    const Uint64 bytesReceived = m_transportLayer.getBytesReceived();
+    const Uint64 bytesSent = m_transportLayer.getBytesSent();
+    if (m_trace.isEnabled())
+    {
+      receiveStart = DcmTraceRecorder::now();
+      m_transportLayer.clearDataArrivalTime();
+    }
     cond = DIMSE_receiveCommand( m_assoc, m_cfg->getDIMSEBlockingMode(), m_cfg->getDIMSETimeout(),
                                  &presID, &message, NULL );
     // check if peer did release or abort, or if we have a valid message
     if( cond.good() )
     {
-      DcmPresentationContextInfo presInfo;
-      getPresentationContextInfo(m_assoc, presID, presInfo);
-      cond = handleIncomingCommand(&message, presInfo);
+      Uint16 messageID;
+      Uint16 status;
+      (void) getMessageInfo(message, messageID, status);
+      STORCMT_PROBE3(command__receive, OFstatic_cast(unsigned int, message.CommandField), messageID, presID);
+      m_flightRecorder.beginCommand(OFstatic_cast(Uint16, message.CommandField), messageID, presID,
+        bytesReceived, bytesSent);
+      if (m_trace.isEnabled())
+        beginCommandTrace(message, receiveStart);
+      cond = handleIncomingCommand(&message, getCommandPresentationContext(presID));
+      endCommandTrace();
+      m_flightRecorder.endCommand(m_transportLayer.getBytesReceived(), m_transportLayer.getBytesSent());
+      // count the recv() calls for command and dataset (the response is sent by then)
+      ++m_receivedMessages;
+      m_messageReadCalls += m_transportLayer.getReadCalls() - readCalls;
+      DCMNET_TRACE("DIMSE message received with " << (m_transportLayer.getReadCalls() - readCalls) << " recv() call(s)");
     }
   }
-  // Clean up on association termination.
+  if (m_receivedMessages > receivedMessages)
+  {
+    DCMNET_DEBUG("Received " << (m_receivedMessages - receivedMessages) << " DIMSE message(s) with "
+      << (m_messageReadCalls - messageReadCalls) << " recv() call(s)");
+  }
+  // Clean up on association termination. The trace span starts when the request
+  // (or the error) arrived.
+  size_t terminationSpan = SCP_TRACE_NO_SPAN;
+  if (m_trace.isEnabled())
+  {
+    const Uint64 arrivalTime = m_transportLayer.getDataArrivalTime();
+    const char *name = "error";
+    if (cond == DUL_PEERREQUESTEDRELEASE)
+      name = "release";
+    else if (cond == DUL_PEERABORTEDASSOCIATION)
+      name = "abort";
+    terminationSpan = m_trace.beginSpan(name, (arrivalTime > receiveStart) ? arrivalTime : receiveStart);
+  }
+  OFString labels = getPeerLabel();
   if( cond == DUL_PEERREQUESTEDRELEASE )
   {
     notifyReleaseRequest();
     ASC_acknowledgeRelease(m_assoc);
+    DcmMetricsRegistry::addLabel(labels, "reason", "release");
+    m_flightRecorder.setOutcome("released");
+    STORCMT_PROBE1(association__release, "release");
   }
   else if( cond == DUL_PEERABORTEDASSOCIATION )
   {
     notifyAbortRequest();
+    DcmMetricsRegistry::addLabel(labels, "reason", "abort");
+    m_flightRecorder.setOutcome("aborted");
+    STORCMT_PROBE1(association__release, "abort");
   }
   else
   {
     notifyDIMSEError(cond);
     ASC_abortAssociation( m_assoc );
+    DcmMetricsRegistry::addLabel(labels, "reason", "error");
+    m_flightRecorder.setOutcome("error");
+    STORCMT_PROBE1(association__release, "error");
+    m_trace.setAttribute(terminationSpan, "error", cond.text());
   }
+  m_trace.endSpan(terminationSpan);
+  m_metrics.increment("storcmt_associations_closed_total", labels);
 
   // Drop and destroy the association.
   dropAndDestroyAssociation();
@@ -569,13 +963,39 @@ OFCondition DcmStorCmtSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
                                                  const DcmPresentationContextInfo &presInfo)
 {
     OFCondition status = EC_IllegalParameter;
+    const Uint64 metricsStart = DcmMetricsRegistry::now();
+    m_datasetReceiveTime = 0;
+    m_responseSendTime = 0;
     if (incomingMsg != NULL)
     {
         // check whether we've received a supported command
         if (incomingMsg->CommandField == DIMSE_C_ECHO_RQ)
         {
-            // handle incoming C-ECHO request
-            status = handleECHORequest(incomingMsg->msg.CEchoRQ, presInfo.presentationContextID);
+            // answer health checks without logging (unless the messages are dumped),
+            // otherwise handle incoming C-ECHO request
+            status = EC_IllegalCall;
+            if (m_fastEcho && !DCM_dcmnetLogger.isEnabledFor(OFLogger::DEBUG_LOG_LEVEL))
+                status = sendFastECHOResponse(incomingMsg->msg.CEchoRQ, presInfo.presentationContextID);
+            if (status == EC_IllegalCall)
+                status = handleECHORequest(incomingMsg->msg.CEchoRQ, presInfo.presentationContextID);
+            // health checks are only counted. The counter is looked up by the first
+            // C-ECHO of an association and reused by all further ones.
+            const char *sopClassUID = incomingMsg->msg.CEchoRQ.AffectedSOPClassUID;
+            volatile Uint64 *counter = m_echoCounter;
+            if (status.bad() || (counter == NULL) || (strcmp(sopClassUID, m_echoSOPClassUID) != 0))
+            {
+              OFString labels = getPeerLabel();
+              DcmMetricsRegistry::addLabel(labels, "command", "C-ECHO");
+              DcmMetricsRegistry::addLabel(labels, "sop_class", sopClassUID);
+              DcmMetricsRegistry::addLabel(labels, "status", status.good() ? "0000" : "failed");
+              counter = m_metrics.getCounter("storcmt_requests_total", labels);
+              if (status.good())
+              {
+                m_echoCounter = counter;
+                OFStandard::strlcpy(m_echoSOPClassUID, sopClassUID, sizeof(m_echoSOPClassUID));
+              }
+            }
+            DcmMetricsRegistry::increment(counter);
         }
         else if (incomingMsg->CommandField == DIMSE_N_ACTION_RQ)
         {
@@ -606,6 +1026,7 @@ OFCondition DcmStorCmtSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
 
             status = sendACTIONResponse(presInfo.presentationContextID, messageID, 
                                        sopClassUID, sopInstanceUID,rspStatusCode);
+            recordMetrics("N-ACTION", sopClassUID.c_str(), rspStatusCode, metricsStart);
             if (status.good()) {
                 storageCommitCommand = new DcmStorageCommitmentCommand();
                 storageCommitCommand->scuinf.localAETitle = getCalledAETitle();
@@ -620,7 +1041,9 @@ OFCondition DcmStorCmtSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
             bzero((char*)&response, sizeof(response));
             T_ASC_PresentationContextID tempID;
             OFString tempStr;
+            const size_t waitSpan = beginTraceSpan("commit wait");
             status = receiveDIMSECommand(&tempID, &response, NULL, NULL /* commandSet */, m_commit_wait_timeout);
+            endTraceSpan(waitSpan);
             if( status == DUL_PEERREQUESTEDRELEASE )
             {
                 DCMNET_DEBUG("Aassociation Release Request received");
@@ -629,9 +1052,12 @@ OFCondition DcmStorCmtSCP::handleIncomingCommand(T_DIMSE_Message *incomingMsg,
             {
                 DCMNET_DEBUG("No Association Request. Go to send N-EVENT-REPORT request");
                 Uint16 eventTypeID = 1;
+                const Uint64 reportStart = DcmMetricsRegistry::now();
+                m_traceEventReport = beginTraceSpan("N-EVENT-REPORT");
                 status = sendEVENTREPORTRequest(presInfo.presentationContextID,
                                    sopInstanceUID, messageID, eventTypeID,
                                    storageCommitCommand->reqDataset,rspStatusCode);
+                recordEventReport("same", reportStart, status);
 
                 if (status.good()) {
                     delete storageCommitCommand->reqDataset ;
@@ -687,6 +1113,213 @@ OFCondition DcmStorCmtSCP::handleECHORequest(T_DIMSE_C_EchoRQ &reqMessage,
 
 // ----------------------------------------------------------------------------
 
+OFCondition DcmStorCmtSCP::sendFastECHOResponse(const T_DIMSE_C_EchoRQ &reqMessage,
+                                                const T_ASC_PresentationContextID presID)
+{
+  T_DIMSE_Message response;
+  bzero((char*)&response, sizeof(response));
+  T_DIMSE_C_EchoRSP &echoRsp = response.msg.CEchoRSP;
+  response.CommandField = DIMSE_C_ECHO_RSP;
+  echoRsp.MessageIDBeingRespondedTo = reqMessage.MessageID;
+  echoRsp.DimseStatus = STATUS_Success;
+  echoRsp.DataSetType = DIMSE_DATASET_NULL;
+  OFStandard::strlcpy(echoRsp.AffectedSOPClassUID, reqMessage.AffectedSOPClassUID, sizeof(echoRsp.AffectedSOPClassUID));
+  OFCondition cond = sendMessage(presID, response, NULL /* dataObject */, NULL, NULL, OFTrue /* preEncoded */);
+  if (cond.good())
+  {
+    ++m_echoRequests;
+    reportEchoRequests(time(NULL));
+  }
+  else if (cond != EC_IllegalCall)
+  {
+    OFString tempStr;
+    DCMNET_ERROR("Cannot send C-ECHO Response: " << DimseCondition::dump(tempStr, cond));
+  }
+  return cond;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::reportEchoRequests(const time_t now)
+{
+  if ((now >= m_echoReportTime) && (now - m_echoReportTime < STORCMT_ECHO_REPORT_INTERVAL))
+    return;
+  DCMNET_INFO("Answered " << (m_echoRequests - m_echoRequestsReported) << " C-ECHO Request(s) ("
+    << m_echoRequests << " in total)");
+  m_echoRequestsReported = m_echoRequests;
+  m_echoReportTime = now;
+}
+
+// ----------------------------------------------------------------------------
+
+OFString DcmStorCmtSCP::formatPeerAddress(const OFString &address)
+{
+  OFString hostName;
+  if ((m_hostNameResolver != NULL) && m_hostNameResolver->lookup(address, hostName))
+    return hostName + " (" + address + ")";
+  return address;
+}
+
+
+void DcmStorCmtSCP::stopHostNameResolver()
+{
+  if (m_hostNameResolver != NULL)
+  {
+    m_hostNameResolver->stop();
+    m_hostNameResolver->join();
+    delete m_hostNameResolver;
+    m_hostNameResolver = NULL;
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::recordMetrics(const char *command,
+                                  const char *sopClassUID,
+                                  const Uint16 status,
+                                  const Uint64 startTime)
+{
+  const Uint64 total = DcmMetricsRegistry::now() - startTime;
+  const Uint64 networkTime = m_datasetReceiveTime + m_responseSendTime;
+  OFString labels = getPeerLabel();
+  DcmMetricsRegistry::addLabel(labels, "command", command);
+  DcmMetricsRegistry::addLabel(labels, "sop_class", sopClassUID);
+  m_metrics.observe("storcmt_dataset_receive_seconds", labels, m_datasetReceiveTime);
+  m_metrics.observe("storcmt_handler_seconds", labels, (total > networkTime) ? total - networkTime : 0);
+  m_metrics.observe("storcmt_response_send_seconds", labels, m_responseSendTime);
+  char statusString[8];
+  sprintf(statusString, "%04x", OFstatic_cast(unsigned int, status));
+  DcmMetricsRegistry::addLabel(labels, "status", statusString);
+  m_metrics.increment("storcmt_requests_total", labels);
+}
+
+
+void DcmStorCmtSCP::recordEventReport(const char *association,
+                                      const Uint64 startTime,
+                                      const OFCondition &cond)
+{
+  OFString labels = getPeerLabel();
+  DcmMetricsRegistry::addLabel(labels, "association", association);
+  if (cond.good())
+    m_metrics.observe("storcmt_event_report_seconds", labels, DcmMetricsRegistry::now() - startTime);
+  DcmMetricsRegistry::addLabel(labels, "result", cond.good() ? "delivered" : "failed");
+  m_metrics.increment("storcmt_event_reports_total", labels);
+  m_trace.setAttribute(m_traceEventReport, "association", association);
+  m_trace.setAttribute(m_traceEventReport, "result", cond.good() ? "delivered" : "failed");
+  endTraceSpan(m_traceEventReport);
+  m_traceEventReport = SCP_TRACE_NO_SPAN;
+}
+
+
+OFString DcmStorCmtSCP::getPeerLabel() const
+{
+  if ((m_assoc == NULL) || (m_assoc->params == NULL))
+    return "";
+  OFString labels;
+  DcmMetricsRegistry::addLabel(labels, "peer", m_assoc->params->DULparams.callingAPTitle);
+  return labels;
+}
+
+
+void DcmStorCmtSCP::stopMetricsServer()
+{
+  if (m_metricsServer != NULL)
+  {
+    m_metricsServer->stop();
+    m_metricsServer->join();
+    delete m_metricsServer;
+    m_metricsServer = NULL;
+  }
+}
+
+
+void DcmStorCmtSCP::beginCommandTrace(const T_DIMSE_Message &message,
+                                      const Uint64 receiveStart)
+{
+  const char *name = "DIMSE";
+  Uint16 messageID = 0;
+  const char *sopClassUID = "";
+  switch (message.CommandField)
+  {
+    case DIMSE_C_ECHO_RQ:
+      name = "C-ECHO";
+      messageID = message.msg.CEchoRQ.MessageID;
+      sopClassUID = message.msg.CEchoRQ.AffectedSOPClassUID;
+      break;
+    case DIMSE_N_ACTION_RQ:
+      name = "N-ACTION";
+      messageID = message.msg.NActionRQ.MessageID;
+      sopClassUID = message.msg.NActionRQ.RequestedSOPClassUID;
+      break;
+    default:
+      break;
+  }
+  // the command starts when its first PDU arrived, unless it had been read ahead
+  const Uint64 arrivalTime = m_transportLayer.getDataArrivalTime();
+  const Uint64 startTime = (arrivalTime > receiveStart) ? arrivalTime : receiveStart;
+  m_traceCommand = m_trace.beginSpan(name, startTime);
+  char buf[8];
+  sprintf(buf, "%u", OFstatic_cast(unsigned int, messageID));
+  m_trace.setAttribute(m_traceCommand, "message_id", buf);
+  m_trace.setAttribute(m_traceCommand, "sop_class", sopClassUID);
+  m_traceHandlerStart = DcmTraceRecorder::now();
+  m_trace.addSpan("command receive", startTime, m_traceHandlerStart);
+}
+
+
+void DcmStorCmtSCP::traceIO(const char *name,
+                            const Uint64 startTime)
+{
+  if ((startTime == 0) || (m_traceHandlerStart == 0))
+    return;
+  if (startTime > m_traceHandlerStart)
+    m_trace.addSpan("handler", m_traceHandlerStart, startTime);
+  m_traceHandlerStart = DcmTraceRecorder::now();
+  m_trace.addSpan(name, startTime, m_traceHandlerStart);
+}
+
+
+void DcmStorCmtSCP::endCommandTrace()
+{
+  if (m_traceHandlerStart == 0)
+    return;
+  endTraceSpan(m_traceCommand);
+  m_traceCommand = SCP_TRACE_NO_SPAN;
+  m_traceHandlerStart = 0;
+}
+
+
+size_t DcmStorCmtSCP::beginTraceSpan(const char *name)
+{
+  if (!m_trace.isEnabled())
+    return SCP_TRACE_NO_SPAN;
+  const Uint64 startTime = DcmTraceRecorder::now();
+  if (m_traceHandlerStart > 0)
+  {
+    if (startTime > m_traceHandlerStart)
+      m_trace.addSpan("handler", m_traceHandlerStart, startTime);
+    m_traceHandlerStart = startTime;
+  }
+  return m_trace.beginSpan(name, startTime);
+}
+
+
+void DcmStorCmtSCP::endTraceSpan(const size_t span)
+{
+  if (span == SCP_TRACE_NO_SPAN)
+    return;
+  const Uint64 endTime = DcmTraceRecorder::now();
+  if (m_traceHandlerStart > 0)
+  {
+    if (endTime > m_traceHandlerStart)
+      m_trace.addSpan("handler", m_traceHandlerStart, endTime);
+    m_traceHandlerStart = endTime;
+  }
+  m_trace.endSpan(span, endTime);
+}
+
+// ----------------------------------------------------------------------------
+
 // -- N-ACTION --
 
 OFCondition DcmStorCmtSCP::receiveACTIONRequest(T_DIMSE_N_ActionRQ &reqMessage,
@@ -773,16 +1406,20 @@ OFCondition DcmStorCmtSCP::sendACTIONResponse(const T_ASC_PresentationContextID
   OFStandard::strlcpy(actionRsp.AffectedSOPInstanceUID, sopInstanceUID.c_str(), sizeof(actionRsp.AffectedSOPInstanceUID));
   // Do not send any other optional fields, e.g. "Action Type ID"
 
+  // Send the response from a pre-encoded command set (unless it is to be dumped)
+  cond = EC_IllegalCall;
   if (DCM_dcmnetLogger.isEnabledFor(OFLogger::DEBUG_LOG_LEVEL))
   {
     DCMNET_INFO("Sending N-ACTION Response");
     DCMNET_DEBUG(DIMSE_dumpMessage(tempStr, response, DIMSE_OUTGOING, NULL, presID));
   } else {
     DCMNET_INFO("Sending N-ACTION Response (" << DU_nactionStatusString(rspStatusCode) << ")");
+    cond = sendMessage(presID, response, NULL /* dataObject */, NULL, NULL, OFTrue /* preEncoded */);
   }
 
   // Send response message
-  cond = sendDIMSEMessage(presID, &response, NULL /* dataObject */);
+  if (cond == EC_IllegalCall)
+    cond = sendDIMSEMessage(presID, &response, NULL /* dataObject */);
   if (cond.bad())
   {
     DCMNET_ERROR("Failed sending N-ACTION response: " << DimseCondition::dump(tempStr, cond));
@@ -828,11 +1465,11 @@ OFCondition DcmStorCmtSCP::sendEVENTREPORTRequest(const T_ASC_PresentationContex
   eventReportReq.EventTypeID = eventTypeID;
 
   // Determine SOP Class from presentation context
-  OFString abstractSyntax, transferSyntax;
-  findPresentationContext(pcid, abstractSyntax, transferSyntax);
-  if (abstractSyntax.empty() || transferSyntax.empty())
+  const char *abstractSyntax;
+  const char *transferSyntax;
+  if (!findPresentationContext(pcid, abstractSyntax, transferSyntax))
     return DIMSE_NOVALIDPRESENTATIONCONTEXTID;
-  OFStandard::strlcpy(eventReportReq.AffectedSOPClassUID, abstractSyntax.c_str(), sizeof(eventReportReq.AffectedSOPClassUID));
+  OFStandard::strlcpy(eventReportReq.AffectedSOPClassUID, abstractSyntax, sizeof(eventReportReq.AffectedSOPClassUID));
   OFStandard::strlcpy(eventReportReq.AffectedSOPInstanceUID, sopInstanceUID.c_str(), sizeof(eventReportReq.AffectedSOPInstanceUID));
 
   // Send request
@@ -848,6 +1485,7 @@ OFCondition DcmStorCmtSCP::sendEVENTREPORTRequest(const T_ASC_PresentationContex
     DCMNET_INFO("Sending N-EVENT-REPORT Request (MsgID " << eventReportReq.MessageID << ")");
   }
   cond = sendDIMSEMessage(pcid, &request, reqDataset);
+  STORCMT_PROBE4(event__report__sent, eventReportReq.MessageID, eventTypeID, "same", cond.good() ? 1 : 0);
   if (cond.bad())
   {
     DCMNET_ERROR("Failed sending N-EVENT-REPORT request: " << DimseCondition::dump(tempStr, cond));
@@ -929,9 +1567,56 @@ OFCondition DcmStorCmtSCP::sendDIMSEMessage(const T_ASC_PresentationContextID pr
   if (message == NULL)
     return DIMSE_NULLKEY;
 
-  OFCondition cond;
-  cond = DIMSE_sendMessageUsingMemoryData(m_assoc, presID, message, statusDetail, dataObject,
+  return sendMessage(presID, *message, dataObject, statusDetail, commandSet, OFFalse /* preEncoded */);
+}
+
+// ----------------------------------------------------------------------------
+
+// Sends a message, by DIMSE or from a pre-encoded command set, and accounts for the time
+OFCondition DcmStorCmtSCP::sendMessage(const T_ASC_PresentationContextID presID,
+                                       T_DIMSE_Message &message,
+                                       DcmDataset *dataObject,
+                                       DcmDataset *statusDetail,
+                                       DcmDataset **commandSet,
+                                       const OFBool preEncoded)
+{
+  // Collect all PDVs of the message, so they are sent as one train of full segments
+  OFCondition cond = EC_IllegalCall;
+  const Uint64 startTime = DcmMetricsRegistry::now();
+  const Uint64 traceStart = (m_traceHandlerStart > 0) ? DcmTraceRecorder::now() : 0;
+  m_transportLayer.beginMessage();
+  if (!preEncoded)
+  {
+    cond = DIMSE_sendMessageUsingMemoryData(m_assoc, presID, &message, statusDetail, dataObject,
                                             NULL /*callback*/, NULL /*callbackData*/, commandSet);
+  }
+  else if (message.CommandField == DIMSE_C_ECHO_RSP)
+  {
+    cond = m_responseEncoder.sendEchoResponse(m_assoc, presID, message.msg.CEchoRSP.MessageIDBeingRespondedTo,
+      message.msg.CEchoRSP.AffectedSOPClassUID);
+  }
+  else if (message.CommandField == DIMSE_N_ACTION_RSP)
+  {
+    const T_DIMSE_N_ActionRSP &actionRsp = message.msg.NActionRSP;
+    cond = m_responseEncoder.sendResponse(m_assoc, presID, DIMSE_N_ACTION_RSP, actionRsp.MessageIDBeingRespondedTo,
+      actionRsp.AffectedSOPClassUID, actionRsp.AffectedSOPInstanceUID, actionRsp.DimseStatus);
+  }
+  const OFCondition sendCond = m_transportLayer.endMessage();
+  // nothing has been sent if the message cannot be sent from a pre-encoded command set
+  if (cond == EC_IllegalCall)
+    return cond;
+  m_responseSendTime += DcmMetricsRegistry::now() - startTime;
+  traceIO("message send", traceStart);
+  if (cond.good())
+    cond = sendCond;
+  Uint16 messageID;
+  Uint16 status;
+  if (getMessageInfo(message, messageID, status))
+  {
+    m_flightRecorder.setStatus(status);
+    STORCMT_PROBE4(response__sent, OFstatic_cast(unsigned int, message.CommandField), messageID, status,
+      cond.good() ? 1 : 0);
+  }
   return cond;
 }
 
@@ -948,6 +1633,9 @@ OFCondition DcmStorCmtSCP::receiveDIMSECommand(T_ASC_PresentationContextID *pres
     return DIMSE_ILLEGALASSOCIATION;
 
   OFCondition cond;
+  const Uint64 traceStart = (m_traceHandlerStart > 0) ? DcmTraceRecorder::now() : 0;
+  if (traceStart > 0)
+    m_transportLayer.clearDataArrivalTime();
   if (timeout > 0)
   {
     /* call the corresponding DIMSE function to receive the command (use specified timeout) */
@@ -958,6 +1646,7 @@ OFCondition DcmStorCmtSCP::receiveDIMSECommand(T_ASC_PresentationContextID *pres
     cond = DIMSE_receiveCommand(m_assoc, m_cfg->getDIMSEBlockingMode(), m_cfg->getDIMSETimeout(), presID,
                                 message, statusDetail, commandSet);
   }
+  traceIO("command receive", traceStart);
   return cond;
 }
 
@@ -971,8 +1660,13 @@ OFCondition DcmStorCmtSCP::receiveDIMSEDataset(T_ASC_PresentationContextID *pres
     return DIMSE_ILLEGALASSOCIATION;
 
   OFCondition cond;
+  const Uint64 startTime = DcmMetricsRegistry::now();
+  const Uint64 traceStart = (m_traceHandlerStart > 0) ? DcmTraceRecorder::now() : 0;
   cond = DIMSE_receiveDataSetInMemory(m_assoc, m_cfg->getDIMSEBlockingMode(), m_cfg->getDIMSETimeout(),
                                         presID, dataObject, NULL /*callback*/, NULL /*callbackData*/);
+  m_datasetReceiveTime += DcmMetricsRegistry::now() - startTime;
+  traceIO("dataset receive", traceStart);
+  STORCMT_PROBE2(dataset__receive, *presID, cond.good() ? 1 : 0);
 
   if (cond.good())
   {
@@ -999,6 +1693,8 @@ OFCondition DcmStorCmtSCP::addPresentationContext(const OFString &abstractSyntax
                                            const T_ASC_SC_ROLE role,
                                            const OFString &profile)
 {
+  // the cached negotiation results may no longer be valid
+  m_negotiationCache.clear();
   return m_cfg->addPresentationContext(abstractSyntax, xferSyntaxes, role, profile);
 }
 
@@ -1077,7 +1773,7 @@ void DcmStorCmtSCP::setVerbosePCMode(const OFBool mode)
 
 void DcmStorCmtSCP::setHostLookupEnabled(const OFBool mode)
 {
-  m_cfg->setHostLookupEnabled(mode);
+  m_hostLookup = mode;
 }
 
 // ----------------------------------------------------------------------------
@@ -1089,6 +1785,105 @@ void DcmStorCmtSCP::setCommitWaitTimeout(const Uint32 timeout)
 
 // ----------------------------------------------------------------------------
 
+void DcmStorCmtSCP::setTCPNoDelay(const OFBool noDelay)
+{
+  m_socketOptions.setNoDelay(noDelay);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setSocketBufferSizes(const Uint32 receiveSize,
+                                         const Uint32 sendSize)
+{
+  m_socketOptions.setReceiveBufferSize(receiveSize);
+  m_socketOptions.setSendBufferSize(sendSize);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setListenBacklog(const Uint32 backlog)
+{
+  m_socketOptions.setListenBacklog(backlog);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setTCPKeepAlive(const Uint32 idle,
+                                    const Uint32 interval,
+                                    const Uint32 count)
+{
+  m_socketOptions.setKeepAlive(idle, interval, count);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setTCPUserTimeout(const Uint32 timeout)
+{
+  m_socketOptions.setUserTimeout(timeout);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setFastEchoMode(const OFBool mode)
+{
+  m_fastEcho = mode;
+}
+
+// ----------------------------------------------------------------------------
+
+OFCondition DcmStorCmtSCP::setAccessPolicyFile(const OFString &filename)
+{
+  OFCondition cond = m_accessPolicy.load(filename);
+  if (cond.good())
+    m_negotiationCache.clear();
+  return cond;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setMetricsPort(const Uint16 port)
+{
+  m_metricsPort = port;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setMetricsSocket(const OFString &path)
+{
+  m_metricsSocket = path;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setTraceDirectory(const OFString &directory)
+{
+  m_trace.setDirectory(directory);
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setTraceFormat(const DcmTraceFormat format)
+{
+  m_trace.setFormat(format);
+}
+
+
+void DcmStorCmtSCP::setFlightRecorder(const OFString &filename,
+                                      const Uint32 capacity)
+{
+  m_flightRecorderFile = filename;
+  m_flightRecorderCapacity = capacity;
+}
+
+// ----------------------------------------------------------------------------
+
+void DcmStorCmtSCP::setCaptureFile(const OFString &filename)
+{
+  m_captureFile = filename;
+}
+
+// ----------------------------------------------------------------------------
+
 Uint32 DcmStorCmtSCP::getMaxReceivePDULength() const
 {
   return m_cfg->getMaxReceivePDULength();
@@ -1096,6 +1891,27 @@ Uint32 DcmStorCmtSCP::getMaxReceivePDULength() const
 
 // ----------------------------------------------------------------------------
 
+Uint64 DcmStorCmtSCP::getNumberOfReceivedMessages() const
+{
+  return m_receivedMessages;
+}
+
+// ----------------------------------------------------------------------------
+
+Uint64 DcmStorCmtSCP::getNumberOfReadCalls() const
+{
+  return m_messageReadCalls;
+}
+
+// ----------------------------------------------------------------------------
+
+Uint64 DcmStorCmtSCP::getNumberOfEchoRequests() const
+{
+  return m_echoRequests;
+}
+
+// ----------------------------------------------------------------------------
+
 Uint16 DcmStorCmtSCP::getPort() const
 {
   return m_cfg->getPort();
@@ -1161,7 +1977,7 @@ OFBool DcmStorCmtSCP::getVerbosePCMode() const
 
 OFBool DcmStorCmtSCP::getHostLookupEnabled() const
 {
-  return m_cfg->getHostLookupEnabled();
+  return m_hostLookup;
 }
 
 // ----------------------------------------------------------------------------
@@ -1230,7 +2046,13 @@ void DcmStorCmtSCP::dropAndDestroyAssociation()
     notifyAssociationTermination();
     ASC_dropSCPAssociation( m_assoc );
     ASC_destroyAssociation( &m_assoc );
+    m_trace.finish();
+    m_flightRecorder.endAssociation(m_transportLayer.getBytesReceived(), m_transportLayer.getBytesSent());
   }
+  clearPresentationContextTable();
+  // the peer label of the C-ECHO counter belongs to this association
+  m_echoCounter = NULL;
+  m_echoOnly = OFFalse;
 }
 
 
@@ -1243,9 +2065,9 @@ void DcmStorCmtSCP::notifyAssociationRequest(const T_ASC_Parameters &params,
                                       DcmSCPActionType & /* desiredAction */)
 {
   // Dump some information if required
-  DCMNET_INFO("Association Received " << params.DULparams.callingPresentationAddress << ": "
-                                      << params.DULparams.callingAPTitle << " -> "
-                                      << params.DULparams.calledAPTitle);
+  STORCMT_ASSOCIATION_INFO("Association Received " << formatPeerAddress(params.DULparams.callingPresentationAddress) << ": "
+                                                   << params.DULparams.callingAPTitle << " -> "
+                                                   << params.DULparams.calledAPTitle);
 
     // Dump more information if required
   OFString tempStr;
@@ -1257,24 +2079,24 @@ void DcmStorCmtSCP::notifyAssociationRequest(const T_ASC_Parameters &params,
 
 // ----------------------------------------------------------------------------
 
-OFBool DcmStorCmtSCP::checkCalledAETitleAccepted(const OFString& /*calledAETitle*/)
+OFBool DcmStorCmtSCP::checkCalledAETitleAccepted(const OFString& calledAETitle)
 {
-  return OFTrue;
+  return m_accessPolicy.isCalledAETitleAllowed(calledAETitle);
 }
 
 
 // ----------------------------------------------------------------------------
 
-OFBool DcmStorCmtSCP::checkCallingAETitleAccepted(const OFString& /*callingAETitle*/)
+OFBool DcmStorCmtSCP::checkCallingAETitleAccepted(const OFString& callingAETitle)
 {
-  return OFTrue;
+  return m_accessPolicy.isCallingAETitleAllowed(callingAETitle);
 }
 
 // ----------------------------------------------------------------------------
 
-OFBool DcmStorCmtSCP::checkCallingHostAccepted(const OFString& /*hostOrIP*/)
+OFBool DcmStorCmtSCP::checkCallingHostAccepted(const OFString& hostOrIP)
 {
-  return OFTrue;
+  return m_accessPolicy.isHostAllowed(hostOrIP);
 }
 
 // ----------------------------------------------------------------------------
@@ -1288,7 +2110,7 @@ void DcmStorCmtSCP::notifyAssociationAcknowledge()
 
 void DcmStorCmtSCP::notifyReleaseRequest()
 {
-  DCMNET_INFO("Received Association Release Request");
+  STORCMT_ASSOCIATION_INFO("Received Association Release Request");
 }
 
 // ----------------------------------------------------------------------------
@@ -1303,19 +2125,28 @@ void DcmStorCmtSCP::notifyAbortRequest()
 void DcmStorCmtSCP::notifyAssociationTermination()
 {
   DCMNET_DEBUG("DcmSCP: Association Terminated");
+  if (m_associationStart > 0)
+  {
+    m_metrics.observe("storcmt_association_duration_seconds", getPeerLabel(), DcmMetricsRegistry::now() - m_associationStart);
+    m_associationStart = 0;
+  }
 
     if ( storageCommitCommand != NULL)
     {
         OFCondition cond = EC_Normal;
+        const Uint64 reportStart = DcmMetricsRegistry::now();
+        m_traceEventReport = beginTraceSpan("N-EVENT-REPORT");
 
         DcmStorCmtSCU *scu = new DcmStorCmtSCU();
         scu->setVerbosePCMode(OFTrue);
+        scu->setSocketOptions(m_socketOptions);
         scu->setStorageCommitCommand(storageCommitCommand) ;
 
         cond = scu->initNetwork();
         if (cond.bad()) {
             OFString tempStr;
             DCMNET_ERROR(DimseCondition::dump(tempStr, cond));
+            recordEventReport("new", reportStart, cond);
             return;
         }
 
@@ -1323,6 +2154,7 @@ void DcmStorCmtSCP::notifyAssociationTermination()
         if (cond.bad()) {
             OFString tempStr;
             DCMNET_ERROR(DimseCondition::dump(tempStr, cond));
+            recordEventReport("new", reportStart, cond);
             return;
         }
 
@@ -1336,6 +2168,7 @@ void DcmStorCmtSCP::notifyAssociationTermination()
         if (presID == 0)
         {
             DCMNET_ERROR("No presentation context found for sending N-EVENT-REPORT with SOP Class / Transfer Syntax");
+            recordEventReport("new", reportStart, DIMSE_NOVALIDPRESENTATIONCONTEXTID);
             return;
         }
 
@@ -1346,11 +2179,13 @@ void DcmStorCmtSCP::notifyAssociationTermination()
         if (cond.bad()) {
             OFString tempStr;
             DCMNET_ERROR(DimseCondition::dump(tempStr, cond));
+            recordEventReport("new", reportStart, cond);
             return;
         }
 
         scu->closeAssociation(DCMSCU_RELEASE_ASSOCIATION);
         delete scu;
+        recordEventReport("new", reportStart, cond);
 
         delete storageCommitCommand->reqDataset ;
         delete storageCommitCommand;
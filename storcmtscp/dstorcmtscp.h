@@ -33,6 +33,15 @@
 
 //#include "dcmtk/dcmnet/scp.h"       /* for base class DcmSCP */
 #include "dstorcmtscu.h"
+#include "dscprsp.h"            /* for DcmDimseResponseEncoder */
+#include "dscpconn.h"           /* for DcmBufferedTransportLayer */
+#include "dscpneg.h"            /* for DcmNegotiationCache */
+#include "dscpacl.h"            /* for DcmAccessPolicy */
+#include "dscpdns.h"            /* for DcmHostNameResolver */
+#include "dscpmetr.h"           /* for DcmMetricsRegistry */
+#include "dscptrace.h"          /* for DcmTraceRecorder */
+#include "dscpfrec.h"           /* for DcmFlightRecorder */
+#include "dscpcapt.h"           /* for DcmTrafficCapture */
 
 
 
@@ -61,6 +70,8 @@ enum DcmRefuseReasonType
   DCMSCP_CALLED_AE_TITLE_NOT_RECOGNIZED,
   /// Refusing association because of unaccepted calling AE title
   DCMSCP_CALLING_AE_TITLE_NOT_RECOGNIZED,
+  /// Refusing association because the address of the calling host is not allowed
+  DCMSCP_CALLING_HOST_NOT_ALLOWED,
   /// Refusing association because SCP was forced to do so
   DCMSCP_FORCED,
   /// Refusing association because of missing Implementation Class UID
@@ -99,6 +110,9 @@ struct DCMTK_DCMNET_EXPORT DcmPresentationContextInfo
   // Fields "reserved" and "result" not included from DUL_PRESENTATIONCONTEXT
 };
 
+/// Number of possible presentation context IDs (IDs are odd numbers from 1 to 255)
+#define DCMSCP_MAX_PRESENTATION_CONTEXTS 256
+
 /*---------------------*
  *  class declaration  *
  *---------------------*/
@@ -226,8 +240,10 @@ class DCMTK_DCMNET_EXPORT DcmStorCmtSCP
   void setVerbosePCMode(const OFBool mode);
 
   /** Enables or disables looking up the host name from a connecting system.
-   *  Note that this sets a GLOBAL flag in DCMTK, i.e. the behavior changes
-   *  for all servers. This should be changed in the future.
+   *  Host names are only used for log output and are resolved by a background
+   *  thread with a cache, so accepting an association never waits for DNS. The
+   *  host name of a peer is thus usually not known for its first association.
+   *  While listening, the lookup in DCMTK (a GLOBAL flag) is always disabled.
    *  @param mode [in] OFTrue, if hostname lookup should be enabled, OFFalse for disabling it.
    */
   void setHostLookupEnabled(const OFBool mode);
@@ -238,6 +254,103 @@ class DCMTK_DCMNET_EXPORT DcmStorCmtSCP
   */
   void setCommitWaitTimeout(const Uint32 timeout);
 
+  /** Enable or disable TCP_NODELAY on the sockets of incoming associations. If not
+   *  set, the DCMTK default is used (enabled unless the environment variable
+   *  TCP_NODELAY is "0").
+   *  @param noDelay [in] OFTrue to disable the Nagle algorithm
+   */
+  void setTCPNoDelay(const OFBool noDelay);
+
+  /** Set the socket buffer sizes (SO_RCVBUF/SO_SNDBUF). Applied to the listening
+   *  socket as well, so the TCP window is negotiated with the configured size.
+   *  @param receiveSize [in] Size of the receive buffer in bytes, 0 for the default
+   *  @param sendSize    [in] Size of the send buffer in bytes, 0 for the default
+   */
+  void setSocketBufferSizes(const Uint32 receiveSize,
+                            const Uint32 sendSize);
+
+  /** Set the backlog of the listening socket
+   *  @param backlog [in] Maximum number of pending connections, 0 for the default
+   */
+  void setListenBacklog(const Uint32 backlog);
+
+  /** Enable TCP keepalive on the sockets of incoming associations
+   *  @param idle     [in] Seconds of idleness before the first probe, 0 for the default
+   *  @param interval [in] Seconds between probes, 0 for the default
+   *  @param count    [in] Number of probes before the connection is dropped, 0 for
+   *                       the default
+   */
+  void setTCPKeepAlive(const Uint32 idle,
+                       const Uint32 interval,
+                       const Uint32 count);
+
+  /** Set the maximum time sent data may remain unacknowledged before the connection is
+   *  dropped (TCP_USER_TIMEOUT, if supported by the operating system)
+   *  @param timeout [in] Timeout in milliseconds, 0 for the default
+   */
+  void setTCPUserTimeout(const Uint32 timeout);
+
+  /** Enable or disable the fast path for C-ECHO requests. If enabled (default), C-ECHO
+   *  requests of the Verification SOP Class are answered from a pre-encoded response
+   *  without logging each of them; a summary is logged at most once a minute instead.
+   *  handleECHORequest() is only called if the fast path is disabled, the request
+   *  cannot be answered this way or debug logging is enabled.
+   *  @param mode [in] OFTrue to enable the fast path, OFFalse to disable it
+   */
+  void setFastEchoMode(const OFBool mode);
+
+  /** Load the access policy from a file (see DcmAccessPolicy for the format). The
+   *  address of the peer, the called and the calling AE title of each association
+   *  request are checked against the policy before any negotiation takes place. The
+   *  file is reloaded automatically when modified.
+   *  @param filename [in] The name of the policy file
+   *  @return EC_Normal if successful, an error code otherwise
+   */
+  OFCondition setAccessPolicyFile(const OFString &filename);
+
+  /** Serve counters and latency summaries (per command, SOP class and calling AE
+   *  title, including the delivery of N-EVENT-REPORT requests) in Prometheus text
+   *  format on a TCP port of the loopback interface. The endpoint is opened by listen().
+   *  @param port [in] The port, 0 for none
+   */
+  void setMetricsPort(const Uint16 port);
+
+  /** Serve counters and latency summaries in Prometheus text format on a unix domain
+   *  socket instead of a TCP port
+   *  @param path [in] The socket path, empty for none
+   */
+  void setMetricsSocket(const OFString &path);
+
+  /** Record the phases of each association (accept, negotiation, each DIMSE command
+   *  with the receipt of its dataset, handling and response, the delivery of the
+   *  N-EVENT-REPORT request, release) as a tree of spans and write them to a file per
+   *  association
+   *  @param directory [in] The directory the trace files are written to, empty for none
+   */
+  void setTraceDirectory(const OFString &directory);
+
+  /** Set the format of the trace files
+   *  @param format [in] Chrome trace-event JSON (default) or OTLP JSON
+   */
+  void setTraceFormat(const DcmTraceFormat format);
+
+  /** Keep the last associations (peer, AE titles, presentation contexts, commands with
+   *  status, timing and byte counts) in memory and write them as text to a file on
+   *  SIGUSR1 and when the process is killed by SIGABRT, SIGSEGV, SIGBUS or SIGFPE.
+   *  The recorder is set up by listen().
+   *  @param filename [in] The file the associations are written to, empty for none
+   *  @param capacity [in] Number of associations kept
+   */
+  void setFlightRecorder(const OFString &filename,
+                         const Uint32 capacity);
+
+  /** Append the PDUs received on each association, with the time of their arrival,
+   *  to a capture file, so the traffic can be replayed later by storcmtreplay. The
+   *  file is opened by listen().
+   *  @param filename [in] The capture file, empty for none
+   */
+  void setCaptureFile(const OFString &filename);
+
   /* Get methods for SCP settings */
 
   /** Returns TCP/IP port number SCP listens for new connection requests
@@ -262,6 +375,21 @@ class DCMTK_DCMNET_EXPORT DcmStorCmtSCP
    */
   Uint32 getMaxReceivePDULength() const;
 
+  /** Returns the number of DIMSE messages received so far
+   *  @return Number of messages
+   */
+  Uint64 getNumberOfReceivedMessages() const;
+
+  /** Returns the number of recv() calls made for receiving DIMSE messages so far
+   *  @return Number of recv() calls
+   */
+  Uint64 getNumberOfReadCalls() const;
+
+  /** Returns the number of C-ECHO requests answered by the fast path so far
+   *  @return Number of C-ECHO requests
+   */
+  Uint64 getNumberOfEchoRequests() const;
+
   /** Returns whether receiving of TCP/IP connection requests is done in blocking or
    *  unblocking mode
    *  @return DUL_BLOCK if in blocking mode, otherwise DUL_NOBLOCK
@@ -362,6 +490,45 @@ class DCMTK_DCMNET_EXPORT DcmStorCmtSCP
                                OFString &abstractSyntax,
                                OFString &transferSyntax);
 
+  /** This call returns the presentation context belonging to the given
+   *  presentation context ID without copying the UIDs.
+   *  @param presID         [in]  The presentation context ID to look for
+   *  @param abstractSyntax [out] The abstract syntax (UID) for that ID, valid as long
+   *                              as the association exists. NULL, if such a
+   *                              presentation context does not exist.
+   *  @param transferSyntax [out] The transfer syntax (UID) for that ID, valid as long
+   *                              as the association exists. NULL, if such a
+   *                              presentation context does not exist.
+   *  @return OFTrue if the presentation context has been accepted, OFFalse otherwise
+   */
+  OFBool findPresentationContext(const T_ASC_PresentationContextID presID,
+                                 const char *&abstractSyntax,
+                                 const char *&transferSyntax) const;
+
+  /** Fill the presentation context table from the accepted presentation contexts of
+   *  the current association. Called once the association has been acknowledged, so
+   *  looking up the presentation context of an incoming command is a single array
+   *  access.
+   */
+  void buildPresentationContextTable();
+
+  /** Add the negotiated presentation contexts of the current association (accepted
+   *  or not) to the flight recorder
+   */
+  void recordPresentationContexts();
+
+  /** Clear the presentation context table, e.g.\ when the association is dropped
+   */
+  void clearPresentationContextTable();
+
+  /** Get the presentation context of an incoming command from the presentation
+   *  context table. The UIDs are only copied if the presentation context differs from
+   *  that of the previous command, and then into the strings already allocated.
+   *  @param presID [in] The presentation context ID of the command
+   *  @return The presentation context, valid until the next call
+   */
+  const DcmPresentationContextInfo &getCommandPresentationContext(const T_ASC_PresentationContextID presID);
+
   /** Aborts the current association by sending an A-ABORT request to the SCU.
    *  This method allows derived classes to abort an association in case of severe errors.
    *  @return status, EC_Normal if successful, an error code otherwise
@@ -389,7 +556,7 @@ class DCMTK_DCMNET_EXPORT DcmStorCmtSCP
    *  OFTrue is returned, the AE title is accepted and processing is continued.
    *  In case of OFFalse, the SCP will refuse the incoming association with
    *  error "Called Application Entity Title Not Recognized".
-   *  The standard handler always returns OFTrue.
+   *  The standard handler checks the AE title against the access policy, if any.
    *  @param calledAE The called AE title the SCU used that should be checked
    *  @return OFTrue, if AE title is accepted, OFFalse otherwise
    */
@@ -399,7 +566,7 @@ class DCMTK_DCMNET_EXPORT DcmStorCmtSCP
    *  OFTrue is returned, the AE title is accepted and processing is continued.
    *  In case of OFFalse, the SCP will refuse the incoming association with
    *  error "Calling Application Entity Title Not Recognized".
-   *  The standard handler always returns OFTrue.
+   *  The standard handler checks the AE title against the access policy, if any.
    *  @param callingAE The calling AE title the SCU used that should be checked
    *  @return OFTrue, if AE title is accepted, OFFalse otherwise
    */
@@ -409,7 +576,8 @@ class DCMTK_DCMNET_EXPORT DcmStorCmtSCP
    *  that this function may also return a hostname instead. If
    *  OFTrue is returned, the IP is accepted and processing is continued.
    *  In case of OFFalse, the SCP will refuse the incoming association with
-   *  an error. The standard handler always returns OFTrue.
+   *  an error. The standard handler checks the numeric address against the access
+   *  policy, if any. This function is called before any other check.
    *  @param hostOrIP The IP of the client to check.
    *  @return OFTrue, if IP/host is accepted, OFFalse otherwise
    */
@@ -461,6 +629,96 @@ class DCMTK_DCMNET_EXPORT DcmStorCmtSCP
   virtual OFCondition handleECHORequest(T_DIMSE_C_EchoRQ &reqMessage,
                                         const T_ASC_PresentationContextID presID);
 
+  /** Answer a C-ECHO request from the pre-encoded response, without logging
+   *  @param reqMessage [in] The C-ECHO request message that was received
+   *  @param presID     [in] The presentation context of the request
+   *  @return status, EC_Normal if successful, an error code otherwise. EC_IllegalCall
+   *          if the request cannot be answered this way, in which case nothing has
+   *          been sent.
+   */
+  OFCondition sendFastECHOResponse(const T_DIMSE_C_EchoRQ &reqMessage,
+                                   const T_ASC_PresentationContextID presID);
+
+  /** Log the number of C-ECHO requests answered by the fast path since the last
+   *  summary, unless the last summary is less than a minute old
+   *  @param now [in] The current time
+   */
+  void reportEchoRequests(const time_t now);
+
+  /** Format the address of a peer for log output, adding its host name if already
+   *  resolved. If not, the lookup is started in the background.
+   *  @param address [in] The numeric address of the peer
+   *  @return "hostname (address)" if the host name is known, the address otherwise
+   */
+  OFString formatPeerAddress(const OFString &address);
+
+  /** Stop the host name resolver (if running) and wait for it to terminate
+   */
+  void stopHostNameResolver();
+
+  /** Add the latencies of a handled request to the metrics
+   *  @param command     [in] Name of the command, e.g.\ "N-ACTION"
+   *  @param sopClassUID [in] Requested SOP class UID
+   *  @param status      [in] Status sent in the response
+   *  @param startTime   [in] Time the request was received (see DcmMetricsRegistry::now())
+   */
+  void recordMetrics(const char *command,
+                     const char *sopClassUID,
+                     const Uint16 status,
+                     const Uint64 startTime);
+
+  /** Add the delivery of an N-EVENT-REPORT request to the metrics
+   *  @param association [in] "same" if sent on the association of the N-ACTION
+   *                          request, "new" if sent on a new association
+   *  @param startTime   [in] Time the delivery was started (see DcmMetricsRegistry::now())
+   *  @param cond        [in] Result of the delivery
+   */
+  void recordEventReport(const char *association,
+                         const Uint64 startTime,
+                         const OFCondition &cond);
+
+  /** Returns the label identifying the peer of the current association in the metrics
+   *  @return The label (calling AE title), empty if there is no association
+   */
+  OFString getPeerLabel() const;
+
+  /** Stop the metrics server (if running) and wait for it to terminate
+   */
+  void stopMetricsServer();
+
+  /** Begin the trace span of a received DIMSE command, with the receipt of the command
+   *  as its first part
+   *  @param message      [in] The command received
+   *  @param receiveStart [in] Time the SCP started waiting for the command (see
+   *                           DcmTraceRecorder::now())
+   */
+  void beginCommandTrace(const T_DIMSE_Message &message,
+                         const Uint64 receiveStart);
+
+  /** Add a part of network I/O to the trace span of the current command. The time since
+   *  the previous part is added as handler part.
+   *  @param name      [in] Name of the part
+   *  @param startTime [in] Start of the I/O (see DcmTraceRecorder::now()), 0 if not traced
+   */
+  void traceIO(const char *name,
+               const Uint64 startTime);
+
+  /** End the trace span of the current command (if any)
+   */
+  void endCommandTrace();
+
+  /** Begin a trace span nested in the current command (if any), e.g.\ for waiting for
+   *  the release or delivering the N-EVENT-REPORT request
+   *  @param name [in] Name of the span
+   *  @return ID of the span, SCP_TRACE_NO_SPAN if not traced
+   */
+  size_t beginTraceSpan(const char *name);
+
+  /** End a trace span begun by beginTraceSpan()
+   *  @param span [in] ID of the span
+   */
+  void endTraceSpan(const size_t span);
+
   /** Receive N-ACTION request on the currently opened association.
    *  @param reqMessage   [in]  The N-ACTION request message that was received
    *  @param presID       [in]  The presentation context to be used. By default, the
@@ -607,6 +865,29 @@ class DCMTK_DCMNET_EXPORT DcmStorCmtSCP
                                DcmDataset *statusDetail = NULL,
                                DcmDataset **commandSet = NULL);
 
+  /** Send a message on the current association, by DIMSE or from a pre-encoded command
+   *  set, and add the time to the response send time and the trace of the current
+   *  request. The status of a response is set in the flight recorder.
+   *  @param presID       [in]  Presentation context ID to be used for message
+   *  @param message      [in]  The message to be sent
+   *  @param dataObject   [in]  The dataset to be sent, NULL if there is none
+   *  @param statusDetail [in]  The status detail of the response, NULL if none
+   *  @param commandSet   [out] If not NULL, returns a copy of the command set sent
+   *  @param preEncoded   [in]  Send the message from a pre-encoded command set (see
+   *                            DcmDimseResponseEncoder). Only possible for C-ECHO and
+   *                            N-ACTION responses without dataset; dataObject,
+   *                            statusDetail and commandSet are ignored.
+   *  @return EC_Normal if successful, an error code otherwise. EC_IllegalCall if the
+   *          message cannot be sent from a pre-encoded command set, in which case
+   *          nothing has been sent.
+   */
+  OFCondition sendMessage(const T_ASC_PresentationContextID presID,
+                          T_DIMSE_Message &message,
+                          DcmDataset *dataObject,
+                          DcmDataset *statusDetail,
+                          DcmDataset **commandSet,
+                          const OFBool preEncoded);
+
   /** Receive DIMSE command (excluding dataset!) over the currently open association
    *  @param presID       [out] Contains in the end the ID of the presentation context
    *                            which was specified in the DIMSE command received
@@ -658,6 +939,30 @@ private:
   /// it, e.g. in the context of the DcmSCPPool class.
   DcmSharedSCPConfig m_cfg;
 
+  /** Entry of the presentation context table. The UIDs are not copied but point to
+   *  the strings held by the association parameters, so the table is cleared when the
+   *  association is dropped.
+   */
+  struct PresentationContextEntry
+  {
+    /// Presentation Context ID, 0 if not accepted
+    Uint8 presentationContextID;
+    /// SCP role as proposed from SCU
+    Uint8 proposedSCRole;
+    /// Role accepted by SCP for this Presentation Context
+    Uint8 acceptedSCRole;
+    /// Abstract Syntax name (UID) as proposed by SCU, NULL if not accepted
+    const char *abstractSyntax;
+    /// Transfer Syntax accepted for this Presentation Context (UID), NULL if not accepted
+    const char *acceptedTransferSyntax;
+  };
+
+  /// Accepted presentation contexts of the current association, indexed by ID
+  PresentationContextEntry m_presContexts[DCMSCP_MAX_PRESENTATION_CONTEXTS];
+
+  /// Presentation context of the current command, see getCommandPresentationContext()
+  DcmPresentationContextInfo m_commandPresContext;
+
   /** Drops association and clears internal structures to free memory
    */
   void dropAndDestroyAssociation();
@@ -676,6 +981,102 @@ private:
 
     // peer port of SCU
     Uint16 m_peerPort;
+
+    // encoder for N-ACTION responses
+    DcmDimseResponseEncoder m_responseEncoder;
+
+    // transport layer reading incoming PDUs through a receive buffer
+    DcmBufferedTransportLayer m_transportLayer;
+
+    // options applied to the listening socket and the sockets of incoming associations
+    DcmSocketOptions m_socketOptions;
+
+    // results of earlier association negotiations
+    DcmNegotiationCache m_negotiationCache;
+
+    // access policy for the admission of associations
+    DcmAccessPolicy m_accessPolicy;
+
+    // flag indicating whether host names of peers are looked up
+    OFBool m_hostLookup;
+
+    // background lookup of host names of peers, NULL if not running
+    DcmHostNameResolver *m_hostNameResolver;
+
+    // counters and latency histograms
+    DcmMetricsRegistry m_metrics;
+
+    // thread serving the metrics, NULL if not running
+    DcmMetricsServer *m_metricsServer;
+
+    // TCP port the metrics are served on, 0 if none
+    Uint16 m_metricsPort;
+
+    // unix domain socket the metrics are served on, empty if none
+    OFString m_metricsSocket;
+
+    // time the current association was received (see DcmMetricsRegistry::now()), 0 if refused
+    Uint64 m_associationStart;
+
+    // time spent receiving datasets for the current request in microseconds
+    Uint64 m_datasetReceiveTime;
+
+    // time spent sending messages for the current request in microseconds
+    Uint64 m_responseSendTime;
+
+    // spans of the current association
+    DcmTraceRecorder m_trace;
+
+    // span of the current DIMSE command, SCP_TRACE_NO_SPAN if none
+    size_t m_traceCommand;
+
+    // end of the last traced part of the current command, 0 if none
+    Uint64 m_traceHandlerStart;
+
+    // span of the N-EVENT-REPORT request being delivered, SCP_TRACE_NO_SPAN if none
+    size_t m_traceEventReport;
+
+    // last associations, dumped on signals
+    DcmFlightRecorder m_flightRecorder;
+
+    // file the flight recorder is dumped to, empty if disabled
+    OFString m_flightRecorderFile;
+
+    // number of associations kept by the flight recorder
+    Uint32 m_flightRecorderCapacity;
+
+    // capture of the PDUs received
+    DcmTrafficCapture m_capture;
+
+    // file the PDUs received are captured to, empty if disabled
+    OFString m_captureFile;
+
+    // number of DIMSE messages received
+    Uint64 m_receivedMessages;
+
+    // number of recv() calls made for receiving these messages
+    Uint64 m_messageReadCalls;
+
+    // flag indicating whether C-ECHO requests are answered by the fast path
+    OFBool m_fastEcho;
+
+    // number of C-ECHO requests answered by the fast path
+    Uint64 m_echoRequests;
+
+    // number of these requests already included in a summary
+    Uint64 m_echoRequestsReported;
+
+    // time of the last summary of C-ECHO requests
+    time_t m_echoReportTime;
+
+    // counter of successful C-ECHO requests of the current association, NULL until the first one
+    volatile Uint64 *m_echoCounter;
+
+    // SOP class UID of the requests counted by m_echoCounter
+    DIC_UI m_echoSOPClassUID;
+
+    // flag indicating whether the current association only proposes the Verification SOP class
+    OFBool m_echoOnly;
 };
 
 #endif // DSTORCMTSCP_H
@@ -23,6 +23,7 @@
 #include "dcmtk/dcmnet/diutil.h"
 
 #include "dcmtk/ofstd/ofstd.h"
+#include "dstorcmtprobe.h"
 
 // DcmStorCmtSCU
 //
@@ -38,7 +39,9 @@ DcmStorCmtSCU::DcmStorCmtSCU():
   m_peerAETitle("ANY-SCP"),
   m_peerPort(104),
   m_dimseTimeout(0),
-  m_acseTimeout(30)
+  m_acseTimeout(30),
+  m_transportLayer(NET_REQUESTOR),
+  m_socketOptions()
 {
     OFList<OFString> transferSyntaxes;
     transferSyntaxes.push_back(UID_LittleEndianExplicitTransferSyntax);
@@ -114,6 +117,16 @@ OFCondition DcmStorCmtSCU::initNetwork()
     return cond;
   }
 
+  /* apply the socket options to the socket of the association once it is connected */
+  m_transportLayer.setBufferSize(m_maxReceivePDULength + SCP_CONN_PDU_HEADER_SIZE);
+  m_transportLayer.setSocketOptions(m_socketOptions);
+  cond = ASC_setTransportLayer(m_net, &m_transportLayer, 0 /* do not take over ownership */);
+  if (cond.bad())
+  {
+    DCMNET_ERROR(DimseCondition::dump(tempStr, cond));
+    return cond;
+  }
+
   /* initialize association parameters, i.e. create an instance of T_ASC_Parameters*. */
   cond = ASC_createAssociationParameters(&m_params, m_maxReceivePDULength);
   if (cond.bad())
@@ -232,9 +245,12 @@ OFCondition DcmStorCmtSCU::negotiateAssociation()
   /* create association, i.e. try to establish a network connection to another */
   /* DICOM application. This call creates an instance of T_ASC_Association*. */
   DCMNET_INFO("Requesting Association");
+  STORCMT_PROBE3(report__association__request, m_peer.c_str(), OFstatic_cast(unsigned int, m_peerPort),
+    m_peerAETitle.c_str());
   OFCondition cond = ASC_requestAssociation(m_net, m_params, &m_assoc);
   if (cond.bad())
   {
+    STORCMT_PROBE2(report__association__ack, 0, 0);
     if (cond == DUL_ASSOCIATIONREJECTED)
     {
       T_ASC_RejectParameters rej;
@@ -256,7 +272,9 @@ OFCondition DcmStorCmtSCU::negotiateAssociation()
 
   /* count the presentation contexts which have been accepted by the SCP */
   /* If there are none, finish the execution */
-  if (ASC_countAcceptedPresentationContexts(m_params) == 0)
+  const int acceptedContexts = ASC_countAcceptedPresentationContexts(m_params);
+  STORCMT_PROBE2(report__association__ack, 1, acceptedContexts);
+  if (acceptedContexts == 0)
   {
     DCMNET_ERROR("No Acceptable Presentation Contexts");
     return NET_EC_NoAcceptablePresentationContexts;
@@ -388,6 +406,7 @@ void DcmStorCmtSCU::closeAssociation(const DcmCloseAssociationType closeType)
       /* release association */
       DCMNET_INFO("Releasing Association");
       cond = ASC_releaseAssociation(m_assoc);
+      STORCMT_PROBE2(report__association__release, "release", cond.good() ? 1 : 0);
       if (cond.bad())
       {
         DCMNET_ERROR("Association Release Failed: " << DimseCondition::dump(tempStr, cond));
@@ -398,6 +417,7 @@ void DcmStorCmtSCU::closeAssociation(const DcmCloseAssociationType closeType)
       /* abort association */
       DCMNET_INFO("Aborting Association");
       cond = ASC_abortAssociation(m_assoc);
+      STORCMT_PROBE2(report__association__release, "abort", cond.good() ? 1 : 0);
       if (cond.bad())
       {
         DCMNET_ERROR("Association Abort Failed: " << DimseCondition::dump(tempStr, cond));
@@ -408,6 +428,7 @@ void DcmStorCmtSCU::closeAssociation(const DcmCloseAssociationType closeType)
       DCMNET_ERROR("Protocol Error: Peer requested release (Aborting)");
       DCMNET_INFO("Aborting Association");
       cond = ASC_abortAssociation(m_assoc);
+      STORCMT_PROBE2(report__association__release, "error", cond.good() ? 1 : 0);
       if (cond.bad())
       {
         DCMNET_ERROR("Association Abort Failed: " << DimseCondition::dump(tempStr, cond));
@@ -416,6 +437,7 @@ void DcmStorCmtSCU::closeAssociation(const DcmCloseAssociationType closeType)
     case DCMSCU_PEER_ABORTED_ASSOCIATION:
       /* peer aborted association */
       DCMNET_INFO("Peer Aborted Association");
+      STORCMT_PROBE2(report__association__release, "peer abort", 1);
       break;
   }
 
@@ -522,6 +544,7 @@ OFCondition DcmStorCmtSCU::sendEVENTREPORTRequest(const T_ASC_PresentationContex
     DCMNET_INFO("Sending N-EVENT-REPORT Request (MsgID " << eventReportReq.MessageID << ")");
   }
   cond = sendDIMSEMessage(pcid, &request, reqDataset);
+  STORCMT_PROBE4(event__report__sent, eventReportReq.MessageID, eventTypeID, "new", cond.good() ? 1 : 0);
   if (cond.bad())
   {
     DCMNET_ERROR("Failed sending N-EVENT-REPORT request: " << DimseCondition::dump(tempStr, cond));
@@ -694,6 +717,35 @@ void DcmStorCmtSCU::setVerbosePCMode(const OFBool mode)
   m_verbosePCMode = mode;
 }
 
+void DcmStorCmtSCU::setTCPNoDelay(const OFBool noDelay)
+{
+  m_socketOptions.setNoDelay(noDelay);
+}
+
+void DcmStorCmtSCU::setSocketBufferSizes(const Uint32 receiveSize,
+                                         const Uint32 sendSize)
+{
+  m_socketOptions.setReceiveBufferSize(receiveSize);
+  m_socketOptions.setSendBufferSize(sendSize);
+}
+
+void DcmStorCmtSCU::setTCPKeepAlive(const Uint32 idle,
+                                    const Uint32 interval,
+                                    const Uint32 count)
+{
+  m_socketOptions.setKeepAlive(idle, interval, count);
+}
+
+void DcmStorCmtSCU::setTCPUserTimeout(const Uint32 timeout)
+{
+  m_socketOptions.setUserTimeout(timeout);
+}
+
+void DcmStorCmtSCU::setSocketOptions(const DcmSocketOptions &options)
+{
+  m_socketOptions = options;
+}
+
 /* Get methods */
 
 OFBool DcmStorCmtSCU::isConnected() const
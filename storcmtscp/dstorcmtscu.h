@@ -28,6 +28,7 @@
 #include "dcmtk/dcmnet/dcompat.h"
 #include "dcmtk/dcmnet/dimse.h"     /* DIMSE network layer */
 #include "dcmtk/ofstd/oflist.h"
+#include "dscpconn.h"               /* for DcmBufferedTransportLayer */
 
 #include <dcmtk/ofstd/ofthread.h>
 
@@ -213,6 +214,41 @@ public:
    */
   void setVerbosePCMode(const OFBool mode);
 
+  /** Enable or disable TCP_NODELAY on the socket of the association. If not set, the
+   *  DCMTK default is used (enabled unless the environment variable TCP_NODELAY is "0").
+   *  @param noDelay [in] OFTrue to disable the Nagle algorithm
+   */
+  void setTCPNoDelay(const OFBool noDelay);
+
+  /** Set the socket buffer sizes (SO_RCVBUF/SO_SNDBUF) of the association
+   *  @param receiveSize [in] Size of the receive buffer in bytes, 0 for the default
+   *  @param sendSize    [in] Size of the send buffer in bytes, 0 for the default
+   */
+  void setSocketBufferSizes(const Uint32 receiveSize,
+                            const Uint32 sendSize);
+
+  /** Enable TCP keepalive on the socket of the association
+   *  @param idle     [in] Seconds of idleness before the first probe, 0 for the default
+   *  @param interval [in] Seconds between probes, 0 for the default
+   *  @param count    [in] Number of probes before the connection is dropped, 0 for
+   *                       the default
+   */
+  void setTCPKeepAlive(const Uint32 idle,
+                       const Uint32 interval,
+                       const Uint32 count);
+
+  /** Set the maximum time sent data may remain unacknowledged before the connection is
+   *  dropped (TCP_USER_TIMEOUT, if supported by the operating system)
+   *  @param timeout [in] Timeout in milliseconds, 0 for the default
+   */
+  void setTCPUserTimeout(const Uint32 timeout);
+
+  /** Set all socket options at once, e.g.\ to use the options of the SCP the storage
+   *  commitment request was received by. The listen backlog is ignored.
+   *  @param options [in] The socket options
+   */
+  void setSocketOptions(const DcmSocketOptions &options);
+
   /* Get methods */
 
   /** Get current connection status
@@ -378,6 +414,12 @@ private:
   /// Verbose PC mode (default: disabled)
   OFBool m_verbosePCMode;
 
+  /// Transport layer applying the socket options to the socket of the association
+  DcmBufferedTransportLayer m_transportLayer;
+
+  /// Options applied to the socket of the association
+  DcmSocketOptions m_socketOptions;
+
   /** Returns next available message ID free to be used by SCU
    *  @return Next free message ID
    */
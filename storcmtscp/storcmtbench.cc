@@ -0,0 +1,274 @@
+/*
+ *
+ *  Module:  storcmtscp
+ *
+ *  Purpose: End-to-end benchmark of Storage Commitment SCPs
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"   /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofstd.h"       /* for OFStandard functions */
+#include "dcmtk/ofstd/ofconapp.h"    /* for OFConsoleApplication */
+#include "dcmtk/ofstd/ofstream.h"    /* for OFStringStream et al. */
+#include "dcmtk/ofstd/ofvector.h"    /* for OFVector */
+#include "dcmtk/dcmdata/dcdict.h"    /* for global data dictionary */
+#include "dcmtk/dcmdata/dcuid.h"     /* for dcmtk version name */
+#include "dcmtk/dcmdata/cmdlnarg.h"  /* for prepareCmdLineArgs */
+#include "dstorcmtbench.h"  /* for DcmStorCmtBenchClient et al. */
+
+#ifdef WITH_ZLIB
+#include <zlib.h>       /* for zlibVersion() */
+#endif
+
+
+/* general definitions */
+
+#define OFFIS_CONSOLE_APPLICATION "storcmtbench"
+
+static OFLogger storcmtbenchLogger = OFLog::getLogger("dcmtk.apps." OFFIS_CONSOLE_APPLICATION);
+
+static char rcsid[] = "$dcmtk: " OFFIS_CONSOLE_APPLICATION " v"
+  OFFIS_DCMTK_VERSION " " OFFIS_DCMTK_RELEASEDATE " $";
+
+/* default application entity titles */
+#define APPLICATIONTITLE "STORCMTBENCH"
+#define PEERAPPLICATIONTITLE "ANY-SCP"
+
+/* default number of measured requests per path and size */
+#define DEFAULT_REQUESTS 100
+
+
+/* exit codes for this command line tool */
+/* (EXIT_SUCCESS and EXIT_FAILURE are standard codes) */
+
+// general
+#define EXITCODE_NO_ERROR                         0
+
+// network errors
+#define EXITCODE_CANNOT_INITIALIZE_NETWORK       60
+#define EXITCODE_CANNOT_SEND_REQUEST             62
+
+
+/* helper macro for converting stream output to a string */
+#define CONVERT_TO_STRING(output, string) \
+    optStream.str(""); \
+    optStream.clear(); \
+    optStream << output << OFStringStream_ends; \
+    OFSTRINGSTREAM_GETOFSTRING(optStream, string)
+
+
+/* main program */
+
+#define SHORTCOL 4
+#define LONGCOL 20
+
+int main(int argc, char *argv[])
+{
+    OFOStringStream optStream;
+    const char *opt_peer = NULL;
+    OFCmdUnsignedInt opt_port = 104;
+    OFCmdUnsignedInt opt_acseTimeout = 30;
+    OFCmdUnsignedInt opt_dimseTimeout = 0;
+    OFCmdUnsignedInt opt_maxPDULength = ASC_DEFAULTMAXPDU;
+    OFCmdUnsignedInt opt_requests = DEFAULT_REQUESTS;
+    OFCmdUnsignedInt opt_warmup = 0;
+    OFCmdUnsignedInt opt_reportTimeout = STORCMT_BENCH_DEFAULT_REPORT_TIMEOUT;
+    OFCmdUnsignedInt opt_listenPort = 0;
+    OFBool opt_samePath = OFTrue;
+    OFBool opt_newPath = OFFalse;
+    OFVector<Uint32> opt_references;
+    DcmStorCmtBenchConfig config;
+    config.ourAETitle = APPLICATIONTITLE;
+    config.peerAETitle = PEERAPPLICATIONTITLE;
+
+    OFConsoleApplication app(OFFIS_CONSOLE_APPLICATION , "End-to-end benchmark for DICOM Storage Commitment SCPs", rcsid);
+    OFCommandLine cmd;
+
+    cmd.setParamColumn(LONGCOL + SHORTCOL + 4);
+    cmd.addParam("peer", "hostname of DICOM peer");
+    cmd.addParam("port", "tcp/ip port number of peer");
+
+    cmd.setOptionColumns(LONGCOL, SHORTCOL);
+    cmd.addGroup("general options:", LONGCOL, SHORTCOL + 2);
+      cmd.addOption("--help",                  "-h",      "print this help text and exit", OFCommandLine::AF_Exclusive);
+      cmd.addOption("--version",                          "print version information and exit", OFCommandLine::AF_Exclusive);
+      OFLog::addOptions(cmd);
+
+    cmd.addGroup("network options:");
+      cmd.addSubGroup("application entity titles:");
+        CONVERT_TO_STRING("set my calling AE title (default: " << APPLICATIONTITLE << ")", optString1);
+        cmd.addOption("--aetitle",             "-aet", 1, "[a]etitle: string", optString1.c_str());
+        CONVERT_TO_STRING("set called AE title of peer (default: " << PEERAPPLICATIONTITLE << ")", optString2);
+        cmd.addOption("--call",                "-aec", 1, "[a]etitle: string", optString2.c_str());
+      cmd.addSubGroup("other network options:");
+        CONVERT_TO_STRING("[s]econds: integer (default: " << opt_acseTimeout << ")", optString3);
+        cmd.addOption("--acse-timeout",        "-ta",  1, optString3.c_str(),
+                                                          "timeout for ACSE messages");
+        cmd.addOption("--dimse-timeout",       "-td",  1, "[s]econds: integer (default: unlimited)",
+                                                          "timeout for DIMSE messages");
+        CONVERT_TO_STRING("[n]umber of bytes: integer (" << ASC_MINIMUMPDUSIZE << ".." << ASC_MAXIMUMPDUSIZE << ")", optString4);
+        CONVERT_TO_STRING("set max receive pdu to n bytes (default: " << opt_maxPDULength << ")", optString5);
+        cmd.addOption("--max-pdu",             "-pdu", 1, optString4.c_str(),
+                                                          optString5.c_str());
+
+    cmd.addGroup("benchmark options:");
+      CONVERT_TO_STRING("[n]umber: integer (1..1000000, default: " << STORCMT_BENCH_DEFAULT_REFERENCES << ")", optString6);
+      cmd.addOption("--references",            "-r",   1, optString6.c_str(),
+                                                          "reference n SOP instances per request;\nrepeat to measure several sizes");
+      CONVERT_TO_STRING("[n]umber: integer (default: " << opt_requests << ")", optString7);
+      cmd.addOption("--requests",              "-n",   1, optString7.c_str(),
+                                                          "measure n requests per path and size");
+      cmd.addOption("--warmup",                "-w",   1, "[n]umber: integer (default: 0)",
+                                                          "send n requests before measuring");
+      CONVERT_TO_STRING("[s]econds: integer (default: " << opt_reportTimeout << ")", optString8);
+      cmd.addOption("--report-timeout",        "-rt",  1, optString8.c_str(),
+                                                          "wait s seconds for each N-EVENT-REPORT");
+      cmd.addSubGroup("N-EVENT-REPORT path:");
+        cmd.addOption("--same-assoc",          "+sa",     "keep the association open and expect the\nreport on it (default)");
+        cmd.addOption("--new-assoc",           "+na",     "release the association and expect the\nreport on a new one (requires --listen-port)");
+        cmd.addOption("--both-paths",          "+bp",     "measure both paths (requires --listen-port)");
+      cmd.addOption("--listen-port",           "-lp",  1, "[p]ort: integer (1..65535)",
+                                                          "accept the new associations on port p\n(storcmtrecv --peer-port)");
+
+    /* evaluate command line */
+    prepareCmdLineArgs(argc, argv, OFFIS_CONSOLE_APPLICATION);
+    if (app.parseCommandLine(cmd, argc, argv))
+    {
+        /* check exclusive options first */
+        if (cmd.hasExclusiveOption())
+        {
+            if (cmd.findOption("--version"))
+            {
+                app.printHeader(OFTrue /*print host identifier*/);
+#ifdef WITH_ZLIB
+                COUT << OFendl << "External libraries used:" << OFendl;
+                COUT << "- ZLIB, Version " << zlibVersion() << OFendl;
+#else
+                COUT << OFendl << "External libraries used: none" << OFendl;
+#endif
+                return EXITCODE_NO_ERROR;
+            }
+        }
+
+        /* general options */
+        OFLog::configureFromCommandLine(cmd, app);
+
+        /* network options */
+        if (cmd.findOption("--aetitle"))
+            app.checkValue(cmd.getValue(config.ourAETitle));
+        if (cmd.findOption("--call"))
+            app.checkValue(cmd.getValue(config.peerAETitle));
+        if (cmd.findOption("--acse-timeout"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_acseTimeout, 1));
+        if (cmd.findOption("--dimse-timeout"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_dimseTimeout, 1));
+        if (cmd.findOption("--max-pdu"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_maxPDULength, ASC_MINIMUMPDUSIZE, ASC_MAXIMUMPDUSIZE));
+
+        /* benchmark options */
+        if (cmd.findOption("--references", 0, OFCommandLine::FOM_FirstFromLeft))
+        {
+            do
+            {
+                OFCmdUnsignedInt references = 0;
+                app.checkValue(cmd.getValueAndCheckMinMax(references, 1, 1000000));
+                opt_references.push_back(OFstatic_cast(Uint32, references));
+            } while (cmd.findOption("--references", 0, OFCommandLine::FOM_NextFromLeft));
+        }
+        if (cmd.findOption("--requests"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_requests, 1));
+        if (cmd.findOption("--warmup"))
+            app.checkValue(cmd.getValue(opt_warmup));
+        if (cmd.findOption("--report-timeout"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_reportTimeout, 1));
+        cmd.beginOptionBlock();
+        if (cmd.findOption("--same-assoc"))
+        {
+            opt_samePath = OFTrue;
+            opt_newPath = OFFalse;
+        }
+        if (cmd.findOption("--new-assoc"))
+        {
+            opt_samePath = OFFalse;
+            opt_newPath = OFTrue;
+        }
+        if (cmd.findOption("--both-paths"))
+        {
+            opt_samePath = OFTrue;
+            opt_newPath = OFTrue;
+        }
+        cmd.endOptionBlock();
+        if (cmd.findOption("--listen-port"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_listenPort, 1, 65535));
+        if (opt_newPath)
+            app.checkDependence(opt_samePath ? "--both-paths" : "--new-assoc", "--listen-port", opt_listenPort > 0);
+
+        /* command line parameters */
+        cmd.getParam(1, opt_peer);
+        app.checkParam(cmd.getParamAndCheckMinMax(2, opt_port, 1, 65535));
+    }
+
+    /* print resource identifier */
+    OFLOG_DEBUG(storcmtbenchLogger, rcsid << OFendl);
+
+    /* make sure data dictionary is loaded */
+    if (!dcmDataDict.isDictionaryLoaded())
+    {
+        OFLOG_WARN(storcmtbenchLogger, "no data dictionary loaded, check environment variable: "
+            << DCM_DICT_ENVIRONMENT_VARIABLE);
+    }
+
+    config.peerHost = opt_peer;
+    config.peerPort = OFstatic_cast(Uint16, opt_port);
+    config.acseTimeout = OFstatic_cast(Uint32, opt_acseTimeout);
+    config.dimseTimeout = OFstatic_cast(Uint32, opt_dimseTimeout);
+    config.maxReceivePDULength = OFstatic_cast(Uint32, opt_maxPDULength);
+    config.reportTimeout = OFstatic_cast(Uint32, opt_reportTimeout);
+    if (opt_references.empty())
+        opt_references.push_back(STORCMT_BENCH_DEFAULT_REFERENCES);
+
+    DcmStorCmtBenchTracker tracker;
+    DcmStorCmtBenchListener listener(config, tracker);
+    if (opt_newPath)
+    {
+        if (listener.open(OFstatic_cast(Uint16, opt_listenPort)).bad() || (listener.start() != 0))
+        {
+            OFLOG_FATAL(storcmtbenchLogger, "cannot accept associations on port " << opt_listenPort);
+            return EXITCODE_CANNOT_INITIALIZE_NETWORK;
+        }
+    }
+
+    /* the requests are sent one after the other, storcmtrecv handles one association at a time */
+    OFLOG_INFO(storcmtbenchLogger, "sending commitment requests to " << config.peerAETitle << "@"
+        << config.peerHost << ":" << config.peerPort);
+    int result = EXITCODE_NO_ERROR;
+    DcmStorCmtBenchClient client(config, tracker);
+    DcmStorCmtBenchStatistics::printHeader(COUT);
+    for (int p = 0; p < 2; ++p)
+    {
+        const DcmStorCmtBenchPath path = (p == 0) ? STORCMT_BP_SameAssociation : STORCMT_BP_NewAssociation;
+        if ((path == STORCMT_BP_SameAssociation) ? !opt_samePath : !opt_newPath)
+            continue;
+        for (size_t i = 0; i < opt_references.size(); ++i)
+        {
+            DcmStorCmtBenchStatistics statistics;
+            for (OFCmdUnsignedInt n = 0; n < opt_warmup; ++n)
+                client.runRequest(path, opt_references[i], NULL);
+            for (OFCmdUnsignedInt n = 0; n < opt_requests; ++n)
+                client.runRequest(path, opt_references[i], &statistics);
+            statistics.print(COUT, path, opt_references[i]);
+            if (statistics.timedOut + statistics.failed > 0)
+                result = EXITCODE_CANNOT_SEND_REQUEST;
+        }
+        client.disconnect(OFFalse);
+    }
+
+    if (opt_newPath)
+    {
+        listener.stop();
+        listener.join();
+    }
+    return result;
+}
@@ -0,0 +1,268 @@
+/*
+ *
+ *  Module:  storcmtscp
+ *
+ *  Purpose: Micro-benchmarks of the Storage Commitment request path
+ *
+ */
+
+
+#include "dcmtk/config/osconfig.h"   /* make sure OS specific configuration is included first */
+
+#include "dcmtk/ofstd/ofstd.h"       /* for OFStandard functions */
+#include "dcmtk/ofstd/ofconapp.h"    /* for OFConsoleApplication */
+#include "dcmtk/ofstd/ofstream.h"    /* for OFStringStream et al. */
+#include "dcmtk/ofstd/offile.h"      /* for OFFile */
+#include "dcmtk/dcmdata/dcdict.h"    /* for global data dictionary */
+#include "dcmtk/dcmdata/dcdeftag.h"  /* for DCM_ tags */
+#include "dcmtk/dcmdata/dcuid.h"     /* for dcmtk version name */
+#include "dcmtk/dcmdata/cmdlnarg.h"  /* for prepareCmdLineArgs */
+#include "dscpmicro.h"  /* for DcmMicroBenchmarkRunner et al. */
+
+#define INCLUDE_CSTDIO
+#define INCLUDE_CSTRING
+#include "dcmtk/ofstd/ofstdinc.h"
+
+#ifdef WITH_ZLIB
+#include <zlib.h>       /* for zlibVersion() */
+#endif
+
+
+/* general definitions */
+
+#define OFFIS_CONSOLE_APPLICATION "storcmtmicrobench"
+
+static OFLogger storcmtmicrobenchLogger = OFLog::getLogger("dcmtk.apps." OFFIS_CONSOLE_APPLICATION);
+
+static char rcsid[] = "$dcmtk: " OFFIS_CONSOLE_APPLICATION " v"
+  OFFIS_DCMTK_VERSION " " OFFIS_DCMTK_RELEASEDATE " $";
+
+/* number of references in the Referenced SOP Sequence of the requests */
+static const Uint32 referenceCounts[] = { 10, 1000, 100000 };
+
+
+/* exit codes for this command line tool */
+/* (EXIT_SUCCESS and EXIT_FAILURE are standard codes) */
+
+// general
+#define EXITCODE_NO_ERROR                         0
+
+// input file errors
+#define EXITCODE_CANNOT_READ_INPUT_FILE          20
+
+// output file errors
+#define EXITCODE_CANNOT_WRITE_OUTPUT_FILE        40
+
+// processing errors
+#define EXITCODE_BENCHMARK_FAILED                80
+#define EXITCODE_REGRESSION                      81
+
+
+/* helper macro for converting stream output to a string */
+#define CONVERT_TO_STRING(output, string) \
+    optStream.str(""); \
+    optStream.clear(); \
+    optStream << output << OFStringStream_ends; \
+    OFSTRINGSTREAM_GETOFSTRING(optStream, string)
+
+
+/* N-ACTION dataset of a commitment request (also sent back in the N-EVENT-REPORT) */
+static DcmDataset *createActionDataset(const Uint32 references)
+{
+  char uid[100];
+  DcmDataset *dataset = new DcmDataset();
+  dataset->putAndInsertString(DCM_TransactionUID, SITE_INSTANCE_UID_ROOT ".1");
+  dataset->insertEmptyElement(DCM_ReferencedSOPSequence);
+  for (Uint32 i = 1; i <= references; ++i)
+  {
+    DcmItem *item = NULL;
+    if (dataset->findOrCreateSequenceItem(DCM_ReferencedSOPSequence, item, -2 /* append */).bad())
+      break;
+    item->putAndInsertString(DCM_ReferencedSOPClassUID, UID_CTImageStorage);
+    sprintf(uid, "%s.2.%lu", SITE_INSTANCE_UID_ROOT, OFstatic_cast(unsigned long, i));
+    item->putAndInsertString(DCM_ReferencedSOPInstanceUID, uid);
+  }
+  return dataset;
+}
+
+
+/* N-ACTION request for the Storage Commitment Push Model SOP instance */
+static T_DIMSE_Message createActionRequest()
+{
+  T_DIMSE_Message message;
+  memset(&message, 0, sizeof(message));
+  message.CommandField = DIMSE_N_ACTION_RQ;
+  T_DIMSE_N_ActionRQ &actionReq = message.msg.NActionRQ;
+  actionReq.MessageID = 1;
+  actionReq.ActionTypeID = 1;
+  actionReq.DataSetType = DIMSE_DATASET_PRESENT;
+  OFStandard::strlcpy(actionReq.RequestedSOPClassUID, UID_StorageCommitmentPushModelSOPClass, sizeof(actionReq.RequestedSOPClassUID));
+  OFStandard::strlcpy(actionReq.RequestedSOPInstanceUID, UID_StorageCommitmentPushModelSOPInstance, sizeof(actionReq.RequestedSOPInstanceUID));
+  return message;
+}
+
+
+/* main program */
+
+#define SHORTCOL 3
+#define LONGCOL 16
+
+int main(int argc, char *argv[])
+{
+    OFOStringStream optStream;
+    OFCmdUnsignedInt opt_samples = SCP_MICRO_DEFAULT_SAMPLES;
+    OFCmdUnsignedInt opt_sampleTime = SCP_MICRO_DEFAULT_SAMPLE_TIME;
+    OFCmdFloat opt_threshold = SCP_MICRO_DEFAULT_THRESHOLD;
+    OFString opt_filter;
+    OFString opt_baseline;
+    OFString opt_output;
+    OFBool opt_list = OFFalse;
+
+    OFConsoleApplication app(OFFIS_CONSOLE_APPLICATION , "Micro-benchmarks of the Storage Commitment request path", rcsid);
+    OFCommandLine cmd;
+
+    cmd.setOptionColumns(LONGCOL, SHORTCOL);
+    cmd.addGroup("general options:", LONGCOL, SHORTCOL + 2);
+      cmd.addOption("--help",                  "-h",      "print this help text and exit", OFCommandLine::AF_Exclusive);
+      cmd.addOption("--version",                          "print version information and exit", OFCommandLine::AF_Exclusive);
+      OFLog::addOptions(cmd);
+
+    cmd.addGroup("benchmark options:");
+      cmd.addOption("--list",                  "-l",      "print the names of the benchmarks and exit");
+      cmd.addOption("--filter",                "-f",   1, "[t]ext: string",
+                                                          "only run benchmarks whose name contains t");
+      CONVERT_TO_STRING("[n]umber: integer (1..1000, default: " << opt_samples << ")", optString1);
+      cmd.addOption("--samples",               "-s",   1, optString1.c_str(),
+                                                          "take n samples per benchmark");
+      CONVERT_TO_STRING("[m]illiseconds: integer (1..10000, default: " << opt_sampleTime << ")", optString2);
+      cmd.addOption("--sample-time",           "-st",  1, optString2.c_str(),
+                                                          "run each sample for at least m ms");
+
+    cmd.addGroup("output options:");
+      cmd.addOption("--output",                "-o",   1, "[f]ilename: string",
+                                                          "write the results to file f (default: stdout)");
+      cmd.addOption("--baseline",              "-b",   1, "[f]ilename: string",
+                                                          "compare with the results in file f, written\nby an earlier run, and fail on regressions");
+      CONVERT_TO_STRING("[p]ercent: float (default: " << opt_threshold << ")", optString3);
+      cmd.addOption("--threshold",             "-t",   1, optString3.c_str(),
+                                                          "report a regression if the median time is\nmore than p percent above the baseline");
+
+    /* evaluate command line */
+    prepareCmdLineArgs(argc, argv, OFFIS_CONSOLE_APPLICATION);
+    if (app.parseCommandLine(cmd, argc, argv))
+    {
+        /* check exclusive options first */
+        if (cmd.hasExclusiveOption())
+        {
+            if (cmd.findOption("--version"))
+            {
+                app.printHeader(OFTrue /*print host identifier*/);
+#ifdef WITH_ZLIB
+                COUT << OFendl << "External libraries used:" << OFendl;
+                COUT << "- ZLIB, Version " << zlibVersion() << OFendl;
+#else
+                COUT << OFendl << "External libraries used: none" << OFendl;
+#endif
+                return EXITCODE_NO_ERROR;
+            }
+        }
+
+        /* general options */
+        OFLog::configureFromCommandLine(cmd, app);
+
+        /* benchmark options */
+        if (cmd.findOption("--list"))
+            opt_list = OFTrue;
+        if (cmd.findOption("--filter"))
+            app.checkValue(cmd.getValue(opt_filter));
+        if (cmd.findOption("--samples"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_samples, 1, 1000));
+        if (cmd.findOption("--sample-time"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_sampleTime, 1, 10000));
+
+        /* output options */
+        if (cmd.findOption("--output"))
+            app.checkValue(cmd.getValue(opt_output));
+        if (cmd.findOption("--baseline"))
+            app.checkValue(cmd.getValue(opt_baseline));
+        if (cmd.findOption("--threshold"))
+        {
+            app.checkDependence("--threshold", "--baseline", !opt_baseline.empty());
+            app.checkValue(cmd.getValueAndCheckMin(opt_threshold, 0.0));
+        }
+    }
+
+    /* print resource identifier */
+    OFLOG_DEBUG(storcmtmicrobenchLogger, rcsid << OFendl);
+
+    /* make sure data dictionary is loaded */
+    if (!dcmDataDict.isDictionaryLoaded())
+    {
+        OFLOG_WARN(storcmtmicrobenchLogger, "no data dictionary loaded, check environment variable: "
+            << DCM_DICT_ENVIRONMENT_VARIABLE);
+    }
+
+    /* the request path of storcmtrecv: decode the request, dump it (debug logging),
+       keep a copy of the dataset for the report, encode the response and the report */
+    const E_TransferSyntax xfer = EXS_LittleEndianExplicit;
+    DcmMicroBenchmarkRunner runner(OFstatic_cast(Uint32, opt_samples), OFstatic_cast(Uint32, opt_sampleTime));
+    const size_t sizes = sizeof(referenceCounts) / sizeof(referenceCounts[0]);
+    char name[64];
+    for (size_t i = 0; i < sizes; ++i)
+    {
+        sprintf(name, "decode/n-action-%lu", OFstatic_cast(unsigned long, referenceCounts[i]));
+        runner.add(new DcmDecodeBenchmark(name, createActionDataset(referenceCounts[i]), xfer));
+    }
+    for (size_t i = 0; i < sizes; ++i)
+    {
+        sprintf(name, "clone/n-action-%lu", OFstatic_cast(unsigned long, referenceCounts[i]));
+        runner.add(new DcmCloneBenchmark(name, createActionDataset(referenceCounts[i])));
+    }
+    for (size_t i = 0; i < sizes; ++i)
+    {
+        sprintf(name, "dump/n-action-rq-%lu", OFstatic_cast(unsigned long, referenceCounts[i]));
+        runner.add(new DcmDumpBenchmark(name, createActionRequest(), createActionDataset(referenceCounts[i])));
+    }
+    runner.add(new DcmResponseBenchmark("encode/n-action-rsp", DIMSE_N_ACTION_RSP,
+      UID_StorageCommitmentPushModelSOPClass, UID_StorageCommitmentPushModelSOPInstance));
+    for (size_t i = 0; i < sizes; ++i)
+    {
+        sprintf(name, "encode/n-event-report-%lu", OFstatic_cast(unsigned long, referenceCounts[i]));
+        runner.add(new DcmEncodeBenchmark(name, createActionDataset(referenceCounts[i]), xfer));
+    }
+
+    if (opt_list)
+    {
+        runner.printNames(COUT);
+        return EXITCODE_NO_ERROR;
+    }
+
+    if (!opt_baseline.empty() && runner.readBaseline(opt_baseline).bad())
+        return EXITCODE_CANNOT_READ_INPUT_FILE;
+
+    int result = EXITCODE_NO_ERROR;
+    if (runner.run(opt_filter).bad())
+        result = EXITCODE_BENCHMARK_FAILED;
+    if (!opt_baseline.empty() && (runner.compare(opt_threshold) > 0) && (result == EXITCODE_NO_ERROR))
+        result = EXITCODE_REGRESSION;
+
+    /* print the results */
+    if (opt_output.empty())
+        runner.printJSON(COUT, OFFIS_CONSOLE_APPLICATION);
+    else
+    {
+        OFOStringStream stream;
+        runner.printJSON(stream, OFFIS_CONSOLE_APPLICATION);
+        stream << OFStringStream_ends;
+        OFSTRINGSTREAM_GETOFSTRING(stream, text)
+        OFFile file;
+        if (!file.fopen(opt_output.c_str(), "w") ||
+            (file.fwrite(text.c_str(), 1, text.length()) != text.length()) ||
+            (file.fclose() != 0))
+        {
+            OFLOG_FATAL(storcmtmicrobenchLogger, "cannot write output file: " << opt_output);
+            return EXITCODE_CANNOT_WRITE_OUTPUT_FILE;
+        }
+    }
+    return result;
+}
@@ -29,6 +29,7 @@
 #include "dcmtk/dcmdata/dcuid.h"     /* for dcmtk version name */
 #include "dcmtk/dcmdata/cmdlnarg.h"  /* for prepareCmdLineArgs */
 #include "dstorcmtscp.h"   /* for DcmStorCmtSCP */
+#include "dscpalog.h"  /* for DcmAsyncLogAppender */
 
 
 /* general definitions */
@@ -50,6 +51,9 @@ static char rcsid[] = "$dcmtk: " OFFIS_CONSOLE_APPLICATION " v"
 // general
 #define EXITCODE_NO_ERROR                         0
 
+// input file errors
+#define EXITCODE_CANNOT_READ_INPUT_FILE          20
+
 // network errors
 #define EXITCODE_CANNOT_START_SCP_AND_LISTEN     64
 
@@ -80,6 +84,27 @@ int main(int argc, char *argv[])
     OFCmdUnsignedInt opt_maxPDULength = ASC_DEFAULTMAXPDU;
     T_DIMSE_BlockingMode opt_blockingMode = DIMSE_BLOCKING;
     OFCmdUnsignedInt opt_commitWaitTimeout = 5;
+    OFBool opt_tcpNoDelaySet = OFFalse;             // default: use the DCMTK setting of TCP_NODELAY
+    OFBool opt_tcpNoDelay = OFTrue;
+    OFCmdUnsignedInt opt_socketReceiveBuffer = 0;
+    OFCmdUnsignedInt opt_socketSendBuffer = 0;
+    OFCmdUnsignedInt opt_listenBacklog = 0;
+    OFBool opt_keepAlive = OFFalse;
+    OFCmdUnsignedInt opt_keepAliveIdle = 0;
+    OFCmdUnsignedInt opt_keepAliveInterval = 0;
+    OFCmdUnsignedInt opt_keepAliveCount = 0;
+    OFCmdUnsignedInt opt_userTimeout = 0;
+    const char *opt_accessPolicy = NULL;
+    OFBool opt_asyncLog = OFFalse;
+    OFCmdUnsignedInt opt_asyncLogBuffer = SCP_ALOG_DEFAULT_CAPACITY;
+    OFBool opt_asyncLogWait = OFFalse;
+    OFCmdUnsignedInt opt_metricsPort = 0;
+    const char *opt_metricsSocket = NULL;
+    const char *opt_traceDirectory = NULL;
+    OFBool opt_traceOTLP = OFFalse;
+    const char *opt_flightRecorder = NULL;
+    OFCmdUnsignedInt opt_flightSize = SCP_FLIGHT_DEFAULT_CAPACITY;
+    const char *opt_captureFile = NULL;
 
     OFBool opt_showPresentationContexts = OFFalse;  // default: do not show presentation contexts in verbose mode
     OFBool opt_useCalledAETitle = OFFalse;          // default: respond with specified application entity title
@@ -98,6 +123,13 @@ int main(int argc, char *argv[])
       OFLog::addOptions(cmd);
       cmd.addOption("--verbose-pc",            "+v",      "show presentation contexts in verbose mode");
 
+    cmd.addGroup("logging options:");
+      cmd.addOption("--async-log",             "+al",     "write log output in a background thread");
+      CONVERT_TO_STRING("[n]umber: integer (default: " << opt_asyncLogBuffer << ")", optString7);
+      cmd.addOption("--async-log-buffer",      "-alb", 1, optString7.c_str(),
+                                                          "buffer up to n log records");
+      cmd.addOption("--async-log-wait",        "+alw",    "wait if the buffer is full instead of\ndropping log records");
+
     cmd.addGroup("network options:");
       cmd.addSubGroup("application entity title:");
         CONVERT_TO_STRING("set my AE title (default: " << opt_aeTitle << ")", optString1);
@@ -119,6 +151,38 @@ int main(int argc, char *argv[])
         cmd.addOption("--max-pdu",             "-pdu", 1, optString5.c_str(),
                                                           optString6.c_str());
         cmd.addOption("--disable-host-lookup", "-dhl",    "disable hostname lookup");
+      cmd.addSubGroup("access control:");
+        cmd.addOption("--access-policy",       "-acl", 1, "[f]ilename: string",
+                                                          "only accept associations allowed by the\ncalling/called AE title and host rules\nin file f (reloaded when modified)");
+      cmd.addSubGroup("socket options:");
+        cmd.addOption("--tcp-nodelay",         "+tn",     "disable Nagle algorithm (TCP_NODELAY),\ndefault unless environment variable\nTCP_NODELAY is 0");
+        cmd.addOption("--tcp-delay",           "-tn",     "enable Nagle algorithm");
+        cmd.addOption("--socket-rcvbuf",       "-srb", 1, "[b]ytes: integer (default: system)",
+                                                          "set socket receive buffer size");
+        cmd.addOption("--socket-sndbuf",       "-ssb", 1, "[b]ytes: integer (default: system)",
+                                                          "set socket send buffer size");
+        cmd.addOption("--listen-backlog",      "-lb",  1, "[n]umber: integer (default: DCMTK)",
+                                                          "set maximum number of pending connections");
+        cmd.addOption("--tcp-keepalive",       "+ka",  3, "[i]dle [i]nterval [c]ount: integer",
+                                                          "enable TCP keepalive: first probe after\ni s idle, next probes every i s, drop\nafter c probes (0 = system default)");
+        cmd.addOption("--tcp-user-timeout",    "-tut", 1, "[m]illiseconds: integer (default: system)",
+                                                          "drop connection if sent data is not\nacknowledged within m ms");
+
+    cmd.addGroup("monitoring options:");
+      cmd.addOption("--metrics-port",          "-mp",  1, "[p]ort: integer (1..65535)",
+                                                          "serve counters and latencies in\nPrometheus format on 127.0.0.1:p");
+      cmd.addOption("--metrics-socket",        "-ms",  1, "[p]ath: string",
+                                                          "serve counters and latencies in\nPrometheus format on unix domain\nsocket p");
+      cmd.addOption("--trace-dir",             "-trd", 1, "[d]irectory: string",
+                                                          "write the phases of each association as\ntrace to a file in directory d");
+      cmd.addOption("--trace-otlp",            "+tro",    "write OTLP JSON instead of Chrome\ntrace-event JSON");
+      cmd.addOption("--flight-recorder",       "-fr",  1, "[f]ilename: string",
+                                                          "keep the last associations in memory and\nwrite them to file f on SIGUSR1 or crash");
+      CONVERT_TO_STRING("[n]umber: integer (default: " << opt_flightSize << ")", optString8);
+      cmd.addOption("--flight-size",           "-fs",  1, optString8.c_str(),
+                                                          "keep the last n associations");
+      cmd.addOption("--capture-file",          "-cf",  1, "[f]ilename: string",
+                                                          "append the PDUs received on each\nassociation to file f for storcmtreplay");
 
     /* evaluate command line */
     prepareCmdLineArgs(argc, argv, OFFIS_CONSOLE_APPLICATION);
@@ -142,6 +206,18 @@ int main(int argc, char *argv[])
             app.checkDependence("--verbose-pc", "verbose mode", dcmrecvLogger.isEnabledFor(OFLogger::INFO_LOG_LEVEL));
             opt_showPresentationContexts = OFTrue;
         }
+        if (cmd.findOption("--async-log"))
+            opt_asyncLog = OFTrue;
+        if (cmd.findOption("--async-log-buffer"))
+        {
+            app.checkDependence("--async-log-buffer", "--async-log", opt_asyncLog);
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_asyncLogBuffer, 16, 1048576));
+        }
+        if (cmd.findOption("--async-log-wait"))
+        {
+            app.checkDependence("--async-log-wait", "--async-log", opt_asyncLog);
+            opt_asyncLogWait = OFTrue;
+        }
 
         cmd.beginOptionBlock();
         if (cmd.findOption("--aetitle"))
@@ -170,6 +246,60 @@ int main(int argc, char *argv[])
             opt_HostnameLookup = OFFalse;
         cmd.endOptionBlock();
 
+        cmd.beginOptionBlock();
+        if (cmd.findOption("--tcp-nodelay"))
+        {
+            opt_tcpNoDelaySet = OFTrue;
+            opt_tcpNoDelay = OFTrue;
+        }
+        if (cmd.findOption("--tcp-delay"))
+        {
+            opt_tcpNoDelaySet = OFTrue;
+            opt_tcpNoDelay = OFFalse;
+        }
+        cmd.endOptionBlock();
+        if (cmd.findOption("--socket-rcvbuf"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_socketReceiveBuffer, 1024, 268435456));
+        if (cmd.findOption("--socket-sndbuf"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_socketSendBuffer, 1024, 268435456));
+        if (cmd.findOption("--listen-backlog"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_listenBacklog, 1, 65535));
+        if (cmd.findOption("--tcp-keepalive"))
+        {
+            opt_keepAlive = OFTrue;
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_keepAliveIdle, 0, 32767));
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_keepAliveInterval, 0, 32767));
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_keepAliveCount, 0, 127));
+        }
+        if (cmd.findOption("--tcp-user-timeout"))
+            app.checkValue(cmd.getValueAndCheckMin(opt_userTimeout, 1));
+        if (cmd.findOption("--access-policy"))
+            app.checkValue(cmd.getValue(opt_accessPolicy));
+
+        if (cmd.findOption("--metrics-port"))
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_metricsPort, 1, 65535));
+        if (cmd.findOption("--metrics-socket"))
+        {
+            app.checkConflict("--metrics-socket", "--metrics-port", opt_metricsPort > 0);
+            app.checkValue(cmd.getValue(opt_metricsSocket));
+        }
+        if (cmd.findOption("--trace-dir"))
+            app.checkValue(cmd.getValue(opt_traceDirectory));
+        if (cmd.findOption("--trace-otlp"))
+        {
+            app.checkDependence("--trace-otlp", "--trace-dir", opt_traceDirectory != NULL);
+            opt_traceOTLP = OFTrue;
+        }
+        if (cmd.findOption("--flight-recorder"))
+            app.checkValue(cmd.getValue(opt_flightRecorder));
+        if (cmd.findOption("--flight-size"))
+        {
+            app.checkDependence("--flight-size", "--flight-recorder", opt_flightRecorder != NULL);
+            app.checkValue(cmd.getValueAndCheckMinMax(opt_flightSize, 1, 65536));
+        }
+        if (cmd.findOption("--capture-file"))
+            app.checkValue(cmd.getValue(opt_captureFile));
+
       /* command line parameters */
       app.checkParam(cmd.getParamAndCheckMinMax(1, opt_port, 1, 65535));
 
@@ -204,10 +334,55 @@ int main(int argc, char *argv[])
     storcmtSCP.setHostLookupEnabled(opt_HostnameLookup);
     storcmtSCP.setCommitWaitTimeout(opt_commitWaitTimeout);
 
+    /* set socket parameters */
+    if (opt_tcpNoDelaySet)
+        storcmtSCP.setTCPNoDelay(opt_tcpNoDelay);
+    storcmtSCP.setSocketBufferSizes(OFstatic_cast(Uint32, opt_socketReceiveBuffer), OFstatic_cast(Uint32, opt_socketSendBuffer));
+    storcmtSCP.setListenBacklog(OFstatic_cast(Uint32, opt_listenBacklog));
+    if (opt_keepAlive)
+        storcmtSCP.setTCPKeepAlive(OFstatic_cast(Uint32, opt_keepAliveIdle), OFstatic_cast(Uint32, opt_keepAliveInterval), OFstatic_cast(Uint32, opt_keepAliveCount));
+    storcmtSCP.setTCPUserTimeout(OFstatic_cast(Uint32, opt_userTimeout));
+
+    /* set access control parameters */
+    if (opt_accessPolicy != NULL)
+    {
+        status = storcmtSCP.setAccessPolicyFile(opt_accessPolicy);
+        if (status.bad())
+        {
+            OFLOG_FATAL(dcmrecvLogger, "cannot read access policy file " << opt_accessPolicy << ": " << status.text());
+            return EXITCODE_CANNOT_READ_INPUT_FILE;
+        }
+    }
+
+    /* set monitoring parameters */
+    if (opt_metricsPort > 0)
+        storcmtSCP.setMetricsPort(OFstatic_cast(Uint16, opt_metricsPort));
+    if (opt_metricsSocket != NULL)
+        storcmtSCP.setMetricsSocket(opt_metricsSocket);
+    if (opt_traceDirectory != NULL)
+    {
+        storcmtSCP.setTraceDirectory(opt_traceDirectory);
+        if (opt_traceOTLP)
+            storcmtSCP.setTraceFormat(SCP_TF_OTLP);
+    }
+    if (opt_flightRecorder != NULL)
+        storcmtSCP.setFlightRecorder(opt_flightRecorder, OFstatic_cast(Uint32, opt_flightSize));
+    if (opt_captureFile != NULL)
+        storcmtSCP.setCaptureFile(opt_captureFile);
+
     OFLOG_INFO(dcmrecvLogger, "starting service class provider and listening ...");
 
+    /* write log output in a background thread from now on */
+    if (opt_asyncLog)
+    {
+        status = DcmAsyncLogAppender::install(OFstatic_cast(size_t, opt_asyncLogBuffer), opt_asyncLogWait ? SCP_LO_Block : SCP_LO_Drop);
+        if (status.bad())
+            OFLOG_WARN(dcmrecvLogger, "cannot start log thread, writing log output synchronously");
+    }
+
     /* start SCP and listen on the specified port */
     status = storcmtSCP.listen();
+    DcmAsyncLogAppender::uninstall();
     if (status.bad())
     {
         OFLOG_FATAL(dcmrecvLogger, "cannot start SCP and listen on port " << opt_port << ": " << status.text());